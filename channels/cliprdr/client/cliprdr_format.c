@@ -55,6 +55,9 @@ UINT cliprdr_process_format_list(cliprdrPlugin* cliprdr, wStream* s, UINT32 data
 	WLog_Print(cliprdr->log, WLOG_DEBUG, "ServerFormatList: numFormats: %" PRIu32 "",
 	           formatList.numFormats);
 
+	/* the list indices of pending reads refer to the previous clipboard */
+	ClipboardPipelineReset(cliprdr->fileContents, ERROR_INVALID_STATE);
+
 	if (context->ServerFormatList)
 	{
 		if ((error = context->ServerFormatList(context, &formatList)))
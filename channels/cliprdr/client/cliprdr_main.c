@@ -26,6 +26,7 @@
 #include <winpr/assert.h>
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/interlocked.h>
 
 #include <freerdp/types.h>
 #include <freerdp/constants.h>
@@ -362,6 +363,11 @@ static UINT cliprdr_process_filecontents_response(cliprdrPlugin* cliprdr, wStrea
 	if ((error = cliprdr_read_file_contents_response(s, &response)))
 		return error;
 
+	if (ClipboardPipelineResponse(cliprdr->fileContents, response.streamId,
+	                              (flags & CB_RESPONSE_FAIL) ? ERROR_INTERNAL_ERROR : CHANNEL_RC_OK,
+	                              response.requestedData, response.cbRequested))
+		return CHANNEL_RC_OK;
+
 	IFCALLRET(context->ServerFileContentsResponse, error, context, &response);
 
 	if (error)
@@ -908,6 +914,76 @@ cliprdr_client_file_contents_response(CliprdrClientContext* context,
 	return cliprdr_packet_send(cliprdr, s);
 }
 
+static UINT cliprdr_pipeline_request_range(void* context, UINT32 streamId, UINT32 listIndex,
+                                           UINT64 offset, UINT32 length)
+{
+	CLIPRDR_FILE_CONTENTS_REQUEST request = { 0 };
+
+	request.streamId = streamId;
+	request.listIndex = listIndex;
+	request.dwFlags = FILECONTENTS_RANGE;
+	request.nPositionLow = (UINT32)(offset & 0xFFFFFFFF);
+	request.nPositionHigh = (UINT32)(offset >> 32);
+	request.cbRequested = length;
+	return cliprdr_client_file_contents_request((CliprdrClientContext*)context, &request);
+}
+
+static void cliprdr_pipeline_read_complete(void* context, void* userdata, UINT error,
+                                           const BYTE* data, UINT32 size)
+{
+	UINT rc = CHANNEL_RC_OK;
+	CliprdrClientContext* cliprdrContext = (CliprdrClientContext*)context;
+
+	IFCALLRET(cliprdrContext->ServerFileContentsReadComplete, rc, cliprdrContext, userdata, error,
+	          data, size);
+
+	if (rc)
+		WLog_ERR(TAG, "ServerFileContentsReadComplete failed with error %" PRIu32 "!", rc);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT cliprdr_client_file_contents_read(CliprdrClientContext* context, UINT32 listIndex,
+                                              UINT64 offset, UINT32 length, void* userdata)
+{
+	cliprdrPlugin* cliprdr;
+
+	WINPR_ASSERT(context);
+
+	cliprdr = (cliprdrPlugin*)context->handle;
+	if (!cliprdr)
+		return ERROR_INTERNAL_ERROR;
+
+	/* created on first use so the window configured by the application applies */
+	if (!cliprdr->fileContents)
+	{
+		wClipboardPipeline* pipeline;
+		wClipboardPipelineConfig config = { 0 };
+
+		config.window = context->fileContentsWindow;
+		config.chunkSize = context->fileContentsChunkSize;
+		config.firstStreamId = CLIPRDR_PIPELINE_FIRST_STREAM_ID;
+		config.context = context;
+		config.RequestRange = cliprdr_pipeline_request_range;
+		config.ReadComplete = cliprdr_pipeline_read_complete;
+		pipeline = ClipboardPipelineNew(&config);
+
+		if (!pipeline)
+		{
+			WLog_ERR(TAG, "ClipboardPipelineNew failed!");
+			return CHANNEL_RC_NO_MEMORY;
+		}
+
+		if (InterlockedCompareExchangePointer((PVOID*)&cliprdr->fileContents, pipeline, NULL))
+			ClipboardPipelineFree(pipeline);
+	}
+
+	return ClipboardPipelineRead(cliprdr->fileContents, listIndex, offset, length, userdata);
+}
+
 static VOID VCAPITYPE cliprdr_virtual_channel_open_event_ex(LPVOID lpUserParam, DWORD openHandle,
                                                             UINT event, LPVOID pData,
                                                             UINT32 dataLength, UINT32 totalLength,
@@ -987,6 +1063,7 @@ static UINT cliprdr_virtual_channel_event_disconnected(cliprdrPlugin* cliprdr)
 
 	channel_client_quit_handler(cliprdr->MsgsHandle);
 	cliprdr->MsgsHandle = NULL;
+	ClipboardPipelineReset(cliprdr->fileContents, ERROR_INVALID_STATE);
 
 	if (cliprdr->OpenHandle == 0)
 		return CHANNEL_RC_OK;
@@ -1017,6 +1094,7 @@ static UINT cliprdr_virtual_channel_event_terminated(cliprdrPlugin* cliprdr)
 	WINPR_ASSERT(cliprdr);
 
 	cliprdr->InitHandle = 0;
+	ClipboardPipelineFree(cliprdr->fileContents);
 	free(cliprdr->context);
 	free(cliprdr);
 	return CHANNEL_RC_OK;
@@ -1116,6 +1194,7 @@ BOOL VCAPITYPE VirtualChannelEntryEx(PCHANNEL_ENTRY_POINTS pEntryPoints, PVOID p
 		context->ClientFormatDataResponse = cliprdr_client_format_data_response;
 		context->ClientFileContentsRequest = cliprdr_client_file_contents_request;
 		context->ClientFileContentsResponse = cliprdr_client_file_contents_response;
+		context->ClientFileContentsRead = cliprdr_client_file_contents_read;
 		cliprdr->context = context;
 		context->rdpcontext = pEntryPointsEx->context;
 	}
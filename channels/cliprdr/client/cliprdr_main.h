@@ -23,6 +23,7 @@
 #define FREERDP_CHANNEL_CLIPRDR_CLIENT_MAIN_H
 
 #include <winpr/stream.h>
+#include <winpr/clipboard.h>
 
 #include <freerdp/svc.h>
 #include <freerdp/addin.h>
@@ -48,6 +49,8 @@ typedef struct
 	BOOL fileClipNoFilePaths;
 	BOOL canLockClipData;
 	BOOL hasHugeFileSupport;
+
+	wClipboardPipeline* fileContents;
 } cliprdrPlugin;
 
 CliprdrClientContext* cliprdr_get_client_interface(cliprdrPlugin* cliprdr);
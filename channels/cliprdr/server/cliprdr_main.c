@@ -25,6 +25,7 @@
 #include <winpr/assert.h>
 #include <winpr/print.h>
 #include <winpr/stream.h>
+#include <winpr/interlocked.h>
 
 #include <freerdp/channels/log.h>
 #include "cliprdr_main.h"
@@ -477,6 +478,76 @@ cliprdr_server_file_contents_response(CliprdrServerContext* context,
 	return cliprdr_server_packet_send(cliprdr, s);
 }
 
+static UINT cliprdr_server_pipeline_request_range(void* context, UINT32 streamId,
+                                                  UINT32 listIndex, UINT64 offset, UINT32 length)
+{
+	CLIPRDR_FILE_CONTENTS_REQUEST request = { 0 };
+
+	request.common.msgType = CB_FILECONTENTS_REQUEST;
+	request.streamId = streamId;
+	request.listIndex = listIndex;
+	request.dwFlags = FILECONTENTS_RANGE;
+	request.nPositionLow = (UINT32)(offset & 0xFFFFFFFF);
+	request.nPositionHigh = (UINT32)(offset >> 32);
+	request.cbRequested = length;
+	return cliprdr_server_file_contents_request((CliprdrServerContext*)context, &request);
+}
+
+static void cliprdr_server_pipeline_read_complete(void* context, void* userdata, UINT error,
+                                                  const BYTE* data, UINT32 size)
+{
+	UINT rc = CHANNEL_RC_OK;
+	CliprdrServerContext* cliprdrContext = (CliprdrServerContext*)context;
+
+	IFCALLRET(cliprdrContext->ClientFileContentsReadComplete, rc, cliprdrContext, userdata, error,
+	          data, size);
+
+	if (rc)
+		WLog_ERR(TAG, "ClientFileContentsReadComplete failed with error %" PRIu32 "!", rc);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT cliprdr_server_file_contents_read(CliprdrServerContext* context, UINT32 listIndex,
+                                              UINT64 offset, UINT32 length, void* userdata)
+{
+	CliprdrServerPrivate* cliprdr;
+
+	WINPR_ASSERT(context);
+
+	cliprdr = (CliprdrServerPrivate*)context->handle;
+	WINPR_ASSERT(cliprdr);
+
+	/* created on first use so the window configured by the application applies */
+	if (!cliprdr->fileContents)
+	{
+		wClipboardPipeline* pipeline;
+		wClipboardPipelineConfig config = { 0 };
+
+		config.window = context->fileContentsWindow;
+		config.chunkSize = context->fileContentsChunkSize;
+		config.firstStreamId = CLIPRDR_PIPELINE_FIRST_STREAM_ID;
+		config.context = context;
+		config.RequestRange = cliprdr_server_pipeline_request_range;
+		config.ReadComplete = cliprdr_server_pipeline_read_complete;
+		pipeline = ClipboardPipelineNew(&config);
+
+		if (!pipeline)
+		{
+			WLog_ERR(TAG, "ClipboardPipelineNew failed!");
+			return CHANNEL_RC_NO_MEMORY;
+		}
+
+		if (InterlockedCompareExchangePointer((PVOID*)&cliprdr->fileContents, pipeline, NULL))
+			ClipboardPipelineFree(pipeline);
+	}
+
+	return ClipboardPipelineRead(cliprdr->fileContents, listIndex, offset, length, userdata);
+}
+
 /**
  * Function description
  *
@@ -676,6 +747,10 @@ static UINT cliprdr_server_receive_format_list(CliprdrServerContext* context, wS
 		goto out;
 
 	WLog_DBG(TAG, "ClientFormatList: numFormats: %" PRIu32 "", formatList.numFormats);
+
+	/* the list indices of pending reads refer to the previous clipboard */
+	ClipboardPipelineReset(((CliprdrServerPrivate*)context->handle)->fileContents,
+	                       ERROR_INVALID_STATE);
 	IFCALLRET(context->ClientFormatList, error, context, &formatList);
 
 	if (error)
@@ -896,6 +971,13 @@ static UINT cliprdr_server_receive_filecontents_response(CliprdrServerContext* c
 	if ((error = cliprdr_read_file_contents_response(s, &response)))
 		return error;
 
+	if (ClipboardPipelineResponse(((CliprdrServerPrivate*)context->handle)->fileContents,
+	                              response.streamId,
+	                              (header->msgFlags & CB_RESPONSE_FAIL) ? ERROR_INTERNAL_ERROR
+	                                                                    : CHANNEL_RC_OK,
+	                              response.requestedData, response.cbRequested))
+		return CHANNEL_RC_OK;
+
 	IFCALLRET(context->ClientFileContentsResponse, error, context, &response);
 
 	if (error)
@@ -1447,6 +1529,8 @@ static UINT cliprdr_server_stop(CliprdrServerContext* context)
 		CloseHandle(cliprdr->StopEvent);
 	}
 
+	ClipboardPipelineReset(cliprdr->fileContents, ERROR_INVALID_STATE);
+
 	if (cliprdr->ChannelHandle)
 		return context->Close(context);
 
@@ -1498,6 +1582,7 @@ CliprdrServerContext* cliprdr_server_context_new(HANDLE vcm)
 		context->ServerFormatDataResponse = cliprdr_server_format_data_response;
 		context->ServerFileContentsRequest = cliprdr_server_file_contents_request;
 		context->ServerFileContentsResponse = cliprdr_server_file_contents_response;
+		context->ServerFileContentsRead = cliprdr_server_file_contents_read;
 		cliprdr = context->handle = (CliprdrServerPrivate*)calloc(1, sizeof(CliprdrServerPrivate));
 
 		if (cliprdr)
@@ -1535,6 +1620,7 @@ void cliprdr_server_context_free(CliprdrServerContext* context)
 
 	if (cliprdr)
 	{
+		ClipboardPipelineFree(cliprdr->fileContents);
 		Stream_Free(cliprdr->s, TRUE);
 	}
 
@@ -24,6 +24,7 @@
 #include <winpr/synch.h>
 #include <winpr/stream.h>
 #include <winpr/thread.h>
+#include <winpr/clipboard.h>
 
 #include <freerdp/server/cliprdr.h>
 #include <freerdp/channels/log.h>
@@ -42,6 +43,8 @@ typedef struct
 
 	wStream* s;
 	char temporaryDirectory[260];
+
+	wClipboardPipeline* fileContents;
 } CliprdrServerPrivate;
 
 #endif /* FREERDP_CHANNEL_CLIPRDR_SERVER_MAIN_H */
@@ -31,9 +31,26 @@
 
 #define TAG CHANNELS_TAG("drdynvc.client")
 
+/* Messages sent uncompressed on a channel after its data failed to shrink */
+#define DRDYNVC_COMPRESS_BACKOFF 32
+
+/* PDUs handed to the static channel and not yet written */
+#define DRDYNVC_MAX_IN_FLIGHT 8
+
+/* a write waiting in the scheduler, data follows the structure */
+typedef struct
+{
+	DVCMAN_CHANNEL* channel;
+	BOOL compress;
+	BOOL shrunk;
+	BOOL failed;
+	BYTE* data;
+} DVCMAN_WRITE;
+
 static void dvcman_free(drdynvcPlugin* drdynvc, IWTSVirtualChannelManager* pChannelMgr);
-static UINT drdynvc_write_data(drdynvcPlugin* drdynvc, UINT32 ChannelId, const BYTE* data,
-                               UINT32 dataSize, BOOL* close);
+static UINT dvcman_queue_write(DVCMAN_CHANNEL* channel, const BYTE* data, UINT32 dataSize);
+static UINT drdynvc_pump(drdynvcPlugin* drdynvc, BOOL flush);
+static void drdynvc_drop_queued(drdynvcPlugin* drdynvc);
 static UINT drdynvc_send(drdynvcPlugin* drdynvc, wStream* s);
 
 static void dvcman_wtslistener_free(DVCMAN_LISTENER* listener)
@@ -278,6 +295,10 @@ static IWTSVirtualChannelManager* dvcman_new(drdynvcPlugin* plugin)
 	if (!dvcman->pool)
 		goto fail;
 
+	dvcman->scheduler = fair_queue_new();
+	if (!dvcman->scheduler)
+		goto fail;
+
 	dvcman->listeners = HashTable_New(TRUE);
 	if (!dvcman->listeners)
 		goto fail;
@@ -402,6 +423,9 @@ static UINT dvcman_channel_close(DVCMAN_CHANNEL* channel, bool perRequest)
 				WLog_Print(drdynvc->log, WLOG_DEBUG, "sending close confirm for '%s'",
 				           channel->channel_name);
 
+			/* data written before the close goes out ahead of it */
+			drdynvc_pump(drdynvc, TRUE);
+			fair_queue_remove_flow(channel->dvcman->scheduler, channel->channel_id);
 			error = dvcchannel_send_close(channel);
 			if (error != CHANNEL_RC_OK)
 			{
@@ -489,6 +513,7 @@ static void dvcman_free(drdynvcPlugin* drdynvc, IWTSVirtualChannelManager* pChan
 	HashTable_Free(dvcman->listeners);
 
 	StreamPool_Free(dvcman->pool);
+	fair_queue_free(dvcman->scheduler);
 	free(dvcman);
 }
 
@@ -530,7 +555,6 @@ fail:
 static UINT dvcman_write_channel(IWTSVirtualChannel* pChannel, ULONG cbSize, const BYTE* pBuffer,
                                  void* pReserved)
 {
-	BOOL close = FALSE;
 	UINT status;
 	DVCMAN_CHANNEL* channel = (DVCMAN_CHANNEL*)pChannel;
 
@@ -538,15 +562,18 @@ static UINT dvcman_write_channel(IWTSVirtualChannel* pChannel, ULONG cbSize, con
 	if (!channel || !channel->dvcman)
 		return CHANNEL_RC_BAD_CHANNEL;
 
+	/* a zero length write closes the channel */
+	if (cbSize == 0)
+		return dvcman_channel_close(channel, FALSE);
+
 	EnterCriticalSection(&(channel->lock));
-	status =
-	    drdynvc_write_data(channel->dvcman->drdynvc, channel->channel_id, pBuffer, cbSize, &close);
+	status = dvcman_queue_write(channel, pBuffer, cbSize);
 	LeaveCriticalSection(&(channel->lock));
-	/* Close delayed, it removes the channel struct */
-	if (close)
-		dvcman_channel_close(channel, FALSE);
 
-	return status;
+	if (status != CHANNEL_RC_OK)
+		return status;
+
+	return drdynvc_pump(channel->dvcman->drdynvc, FALSE);
 }
 
 /**
@@ -823,6 +850,7 @@ static UINT drdynvc_send(drdynvcPlugin* drdynvc, wStream* s)
 	switch (status)
 	{
 		case CHANNEL_RC_OK:
+			InterlockedIncrement(&drdynvc->inFlight);
 			return CHANNEL_RC_OK;
 
 		case CHANNEL_RC_NOT_CONNECTED:
@@ -843,29 +871,96 @@ static UINT drdynvc_send(drdynvcPlugin* drdynvc, wStream* s)
 	}
 }
 
+static UINT32 drdynvc_priority_weight(drdynvcPlugin* drdynvc, int priority)
+{
+	int charge;
+
+	switch (priority)
+	{
+		case 0:
+			charge = drdynvc->PriorityCharge0 ? drdynvc->PriorityCharge0
+			                                  : DRDYNVC_PRIORITY_CHARGE0;
+			break;
+		case 1:
+			charge = drdynvc->PriorityCharge1 ? drdynvc->PriorityCharge1
+			                                  : DRDYNVC_PRIORITY_CHARGE1;
+			break;
+		case 2:
+			charge = drdynvc->PriorityCharge2 ? drdynvc->PriorityCharge2
+			                                  : DRDYNVC_PRIORITY_CHARGE2;
+			break;
+		default:
+			charge = drdynvc->PriorityCharge3 ? drdynvc->PriorityCharge3
+			                                  : DRDYNVC_PRIORITY_CHARGE3;
+			break;
+	}
+
+	return MAX(1, 65536 / charge);
+}
+
 /**
  * Function description
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT drdynvc_write_data(drdynvcPlugin* drdynvc, UINT32 ChannelId, const BYTE* data,
-                               UINT32 dataSize, BOOL* close)
+static UINT dvcman_queue_write(DVCMAN_CHANNEL* channel, const BYTE* data, UINT32 dataSize)
 {
-	wStream* data_out;
-	size_t pos;
-	UINT8 cbChId;
-	UINT8 cbLen;
-	unsigned long chunkLength;
-	UINT status = CHANNEL_RC_BAD_INIT_HANDLE;
-	DVCMAN* dvcman;
+	DVCMAN_WRITE* item;
+	DVCMAN* dvcman = channel->dvcman;
 
-	if (!drdynvc)
-		return CHANNEL_RC_BAD_CHANNEL_HANDLE;
+	item = (DVCMAN_WRITE*)calloc(1, sizeof(DVCMAN_WRITE) + dataSize);
 
-	dvcman = (DVCMAN*)drdynvc->channel_mgr;
+	if (!item)
+	{
+		WLog_Print(dvcman->drdynvc->log, WLOG_ERROR, "calloc failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	item->channel = channel;
+	item->data = (BYTE*)&item[1];
+	CopyMemory(item->data, data, dataSize);
+	InterlockedIncrement(&channel->refCounter);
+
+	if (!fair_queue_push(dvcman->scheduler, channel->channel_id, item, dataSize))
+	{
+		dvcman_channel_unref(channel);
+		free(item);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Sends one chunk of a queued write as a DVC data PDU. The compression choice is made
+ * when a write starts: a channel whose data did not shrink, like one carrying already
+ * compressed graphics, is sent uncompressed for a while.
+ * Called with send_lock held, so PDUs leave in the order they were compressed.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT drdynvc_send_chunk(drdynvcPlugin* drdynvc, const FairQueueChunk* chunk)
+{
+	UINT8 cbChId;
+	UINT32 flags = 0;
+	DVCMAN_WRITE* item = (DVCMAN_WRITE*)chunk->item;
+	DVCMAN_CHANNEL* channel = item->channel;
+	DVCMAN* dvcman = (DVCMAN*)drdynvc->channel_mgr;
+	const BOOL first = (chunk->offset == 0) && (chunk->length < chunk->total);
+	wStream* data_out;
+
+	if (chunk->offset == 0)
+	{
+		if (channel->compress_skip > 0)
+			channel->compress_skip--;
+		else
+			item->compress = drdynvc->compress;
+	}
 
-	WLog_Print(drdynvc->log, WLOG_TRACE, "write_data: ChannelId=%" PRIu32 " size=%" PRIu32 "",
-	           ChannelId, dataSize);
+	WLog_Print(drdynvc->log, WLOG_TRACE,
+	           "send_chunk: ChannelId=%" PRIu32 " offset=%" PRIuz " size=%" PRIuz " total=%" PRIuz
+	           " compressed=%d",
+	           channel->channel_id, chunk->offset, chunk->length, chunk->total, item->compress);
 	data_out = StreamPool_Take(dvcman->pool, CHANNEL_CHUNK_LENGTH);
 
 	if (!data_out)
@@ -875,62 +970,99 @@ static UINT drdynvc_write_data(drdynvcPlugin* drdynvc, UINT32 ChannelId, const B
 	}
 
 	Stream_SetPosition(data_out, 1);
-	cbChId = drdynvc_write_variable_uint(data_out, ChannelId);
-	pos = Stream_GetPosition(data_out);
+	cbChId = drdynvc_write_variable_uint(data_out, channel->channel_id);
 
-	if (dataSize == 0)
+	if (first)
 	{
-		/* TODO: shall treat that case with write(0) that do a close */
-		*close = TRUE;
-		Stream_Release(data_out);
+		const UINT8 cbLen = drdynvc_write_variable_uint(data_out, (UINT32)chunk->total);
+		const BYTE cmd = item->compress ? DATA_FIRST_COMPRESSED_PDU : DATA_FIRST_PDU;
+		Stream_Buffer(data_out)[0] = (cmd << 4) | (cbLen << 2) | cbChId;
 	}
-	else if (dataSize <= CHANNEL_CHUNK_LENGTH - pos)
+	else
 	{
-		Stream_SetPosition(data_out, 0);
-		Stream_Write_UINT8(data_out, (DATA_PDU << 4) | cbChId);
-		Stream_SetPosition(data_out, pos);
-		Stream_Write(data_out, data, dataSize);
-		status = drdynvc_send(drdynvc, data_out);
+		const BYTE cmd = item->compress ? DATA_COMPRESSED_PDU : DATA_PDU;
+		Stream_Buffer(data_out)[0] = (cmd << 4) | cbChId;
+	}
+
+	if (item->compress)
+	{
+		if (zgfx_compress_bulk_to_stream(drdynvc->compressor, data_out,
+		                                 &item->data[chunk->offset], (UINT32)chunk->length,
+		                                 &flags) < 0)
+		{
+			WLog_Print(drdynvc->log, WLOG_ERROR, "zgfx_compress_bulk_to_stream failed!");
+			Stream_Release(data_out);
+			return ERROR_INTERNAL_ERROR;
+		}
+
+		if (flags & PACKET_COMPRESSED)
+			item->shrunk = TRUE;
 	}
 	else
+		Stream_Write(data_out, &item->data[chunk->offset], chunk->length);
+
+	if ((chunk->offset + chunk->length == chunk->total) && item->compress && !item->shrunk)
+		channel->compress_skip = DRDYNVC_COMPRESS_BACKOFF;
+
+	return drdynvc_send(drdynvc, data_out);
+}
+
+/**
+ * Moves queued writes to the static channel, a chunk of the channel with the lowest
+ * weighted share at a time. Only DRDYNVC_MAX_IN_FLIGHT PDUs are handed over at once, so
+ * a write to a higher priority channel does not wait behind a bulk transfer. The pump
+ * runs again when the static channel reports a write complete.
+ *
+ * @param flush send everything queued regardless of the PDUs in flight
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT drdynvc_pump(drdynvcPlugin* drdynvc, BOOL flush)
+{
+	UINT status = CHANNEL_RC_OK;
+	DVCMAN* dvcman = (DVCMAN*)drdynvc->channel_mgr;
+
+	if (!dvcman)
+		return CHANNEL_RC_OK;
+
+	while (TRUE)
 	{
-		/* Fragment the data */
-		cbLen = drdynvc_write_variable_uint(data_out, dataSize);
-		pos = Stream_GetPosition(data_out);
-		Stream_SetPosition(data_out, 0);
-		Stream_Write_UINT8(data_out, (DATA_FIRST_PDU << 4) | cbChId | (cbLen << 2));
-		Stream_SetPosition(data_out, pos);
-		chunkLength = CHANNEL_CHUNK_LENGTH - pos;
-		Stream_Write(data_out, data, chunkLength);
-		data += chunkLength;
-		dataSize -= chunkLength;
-		status = drdynvc_send(drdynvc, data_out);
-
-		while (status == CHANNEL_RC_OK && dataSize > 0)
+		FairQueueChunk chunk;
+		DVCMAN_WRITE* item;
+		DVCMAN_WRITE* done = NULL;
+
+		EnterCriticalSection(&drdynvc->send_lock);
+
+		if ((!flush && (drdynvc->inFlight >= DRDYNVC_MAX_IN_FLIGHT)) ||
+		    !fair_queue_next(dvcman->scheduler, DRDYNVC_COMPRESSED_CHUNK_LENGTH, &chunk))
+		{
+			LeaveCriticalSection(&drdynvc->send_lock);
+			break;
+		}
+
+		item = (DVCMAN_WRITE*)chunk.item;
+
+		/* the rest of a write is dropped once a chunk of it failed */
+		if (!item->failed)
 		{
-			data_out = StreamPool_Take(dvcman->pool, CHANNEL_CHUNK_LENGTH);
+			const UINT error = drdynvc_send_chunk(drdynvc, &chunk);
 
-			if (!data_out)
+			if (error != CHANNEL_RC_OK)
 			{
-				WLog_Print(drdynvc->log, WLOG_ERROR, "StreamPool_Take failed!");
-				return CHANNEL_RC_NO_MEMORY;
+				item->failed = TRUE;
+				status = error;
 			}
+		}
+
+		if (chunk.offset + chunk.length == chunk.total)
+			done = item;
 
-			Stream_SetPosition(data_out, 1);
-			cbChId = drdynvc_write_variable_uint(data_out, ChannelId);
-			pos = Stream_GetPosition(data_out);
-			Stream_SetPosition(data_out, 0);
-			Stream_Write_UINT8(data_out, (DATA_PDU << 4) | cbChId);
-			Stream_SetPosition(data_out, pos);
-			chunkLength = dataSize;
-
-			if (chunkLength > CHANNEL_CHUNK_LENGTH - pos)
-				chunkLength = CHANNEL_CHUNK_LENGTH - pos;
-
-			Stream_Write(data_out, data, chunkLength);
-			data += chunkLength;
-			dataSize -= chunkLength;
-			status = drdynvc_send(drdynvc, data_out);
+		LeaveCriticalSection(&drdynvc->send_lock);
+
+		/* unref outside of send_lock, it takes the channel table lock */
+		if (done)
+		{
+			dvcman_channel_unref(done->channel);
+			free(done);
 		}
 	}
 
@@ -938,9 +1070,63 @@ static UINT drdynvc_write_data(drdynvcPlugin* drdynvc, UINT32 ChannelId, const B
 	{
 		WLog_Print(drdynvc->log, WLOG_ERROR, "VirtualChannelWriteEx failed with %s [%08" PRIX32 "]",
 		           WTSErrorToString(status), status);
-		return status;
 	}
 
+	return status;
+}
+
+static void drdynvc_drop_queued(drdynvcPlugin* drdynvc)
+{
+	DVCMAN_WRITE* item;
+	DVCMAN* dvcman = (DVCMAN*)drdynvc->channel_mgr;
+
+	if (!dvcman)
+		return;
+
+	while ((item = fair_queue_pop(dvcman->scheduler, NULL)))
+	{
+		dvcman_channel_unref(item->channel);
+		free(item);
+	}
+
+	drdynvc->inFlight = 0;
+}
+
+/**
+ * Version 3 allows compressed data PDUs in both directions. The history buffers are only
+ * allocated once that version was negotiated, compressing our own PDUs is optional.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT drdynvc_init_compression(drdynvcPlugin* drdynvc)
+{
+	WINPR_ASSERT(drdynvc);
+
+	if (drdynvc->version < DYNVC_CAPS_VERSION3)
+		return CHANNEL_RC_OK;
+
+	if (!drdynvc->decompressor)
+		drdynvc->decompressor = zgfx_context_new(FALSE);
+
+	if (!drdynvc->decompressor)
+	{
+		WLog_Print(drdynvc->log, WLOG_ERROR, "zgfx_context_new failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	if (!freerdp_settings_get_bool(drdynvc->rdpcontext->settings, FreeRDP_CompressionEnabled))
+		return CHANNEL_RC_OK;
+
+	if (!drdynvc->compressor)
+		drdynvc->compressor = zgfx_context_new(TRUE);
+
+	if (!drdynvc->compressor)
+	{
+		WLog_Print(drdynvc->log, WLOG_ERROR, "zgfx_context_new failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	drdynvc->compress = TRUE;
 	return CHANNEL_RC_OK;
 }
 
@@ -976,9 +1162,10 @@ static UINT drdynvc_send_capability_response(drdynvcPlugin* drdynvc)
 	{
 		WLog_Print(drdynvc->log, WLOG_ERROR, "VirtualChannelWriteEx failed with %s [%08" PRIX32 "]",
 		           WTSErrorToString(status), status);
+		return status;
 	}
 
-	return status;
+	return drdynvc_init_compression(drdynvc);
 }
 
 /**
@@ -1075,7 +1262,6 @@ static UINT drdynvc_process_create_request(drdynvcPlugin* drdynvc, int Sp, int c
 	DVCMAN_CHANNEL* channel;
 	UINT32 retStatus;
 
-	WINPR_UNUSED(Sp);
 	if (!drdynvc)
 		return CHANNEL_RC_BAD_CHANNEL_HANDLE;
 
@@ -1123,8 +1309,13 @@ static UINT drdynvc_process_create_request(drdynvcPlugin* drdynvc, int Sp, int c
 	Stream_SetPosition(s, 1);
 	Stream_Copy(s, data_out, pos - 1);
 
+	/* Sp carries the priority class of the new channel */
+	fair_queue_set_weight(dvcman->scheduler, ChannelId, drdynvc_priority_weight(drdynvc, Sp));
 	channel =
 	    dvcman_create_channel(drdynvc, drdynvc->channel_mgr, ChannelId, name, &channel_status);
+	if (channel_status != CHANNEL_RC_OK)
+		fair_queue_remove_flow(dvcman->scheduler, ChannelId);
+
 	switch (channel_status)
 	{
 		case CHANNEL_RC_OK:
@@ -1168,18 +1359,52 @@ static UINT drdynvc_process_create_request(drdynvcPlugin* drdynvc, int Sp, int c
 	return status;
 }
 
+/**
+ * Decompresses the rest of a compressed data PDU. This is done before the
+ * channel is looked up, data for unknown channels still feeds the history.
+ *
+ * @return a stream over the decompressed data, NULL on failure
+ */
+static wStream* drdynvc_decompress(drdynvcPlugin* drdynvc, wStream* s, wStream* sbuffer,
+                                   BYTE** buffer)
+{
+	UINT32 size = 0;
+
+	WINPR_ASSERT(drdynvc);
+	WINPR_ASSERT(buffer);
+
+	if (!drdynvc->decompressor)
+	{
+		WLog_Print(drdynvc->log, WLOG_ERROR, "compressed data PDU without version 3 capabilities");
+		return NULL;
+	}
+
+	if (zgfx_decompress_bulk(drdynvc->decompressor, Stream_Pointer(s),
+	                         (UINT32)Stream_GetRemainingLength(s), buffer, &size) < 0)
+	{
+		WLog_Print(drdynvc->log, WLOG_ERROR, "zgfx_decompress_bulk failed!");
+		free(*buffer);
+		*buffer = NULL;
+		return NULL;
+	}
+
+	return Stream_StaticInit(sbuffer, *buffer, size);
+}
+
 /**
  * Function description
  *
  * @return 0 on success, otherwise a Win32 error code
  */
 static UINT drdynvc_process_data_first(drdynvcPlugin* drdynvc, int Sp, int cbChId, wStream* s,
-                                       UINT32 ThreadingFlags)
+                                       UINT32 ThreadingFlags, BOOL compressed)
 {
 	UINT status = CHANNEL_RC_OK;
 	UINT32 Length;
 	UINT32 ChannelId;
 	DVCMAN_CHANNEL* channel;
+	BYTE* buffer = NULL;
+	wStream sbuffer = { 0 };
 
 	if (!Stream_CheckAndLogRequiredLength(
 	        TAG, s, drdynvc_cblen_to_bytes(cbChId) + drdynvc_cblen_to_bytes(Sp)))
@@ -1191,6 +1416,9 @@ static UINT drdynvc_process_data_first(drdynvcPlugin* drdynvc, int Sp, int cbChI
 	           "process_data_first: Sp=%d cbChId=%d, ChannelId=%" PRIu32 " Length=%" PRIu32 "", Sp,
 	           cbChId, ChannelId, Length);
 
+	if (compressed && !(s = drdynvc_decompress(drdynvc, s, &sbuffer, &buffer)))
+		return ERROR_INVALID_DATA;
+
 	channel = dvcman_get_channel_by_id(drdynvc->channel_mgr, ChannelId, TRUE);
 	if (!channel)
 	{
@@ -1200,6 +1428,7 @@ static UINT drdynvc_process_data_first(drdynvcPlugin* drdynvc, int Sp, int cbChI
 		 * registered on our side. Ignoring it works.
 		 */
 		WLog_Print(drdynvc->log, WLOG_ERROR, "ChannelId %" PRIu32 " not found!", ChannelId);
+		free(buffer);
 		return CHANNEL_RC_OK;
 	}
 
@@ -1215,6 +1444,7 @@ static UINT drdynvc_process_data_first(drdynvcPlugin* drdynvc, int Sp, int cbChI
 		status = dvcman_channel_close(channel, FALSE);
 
 out:
+	free(buffer);
 	dvcman_channel_unref(channel);
 	return status;
 }
@@ -1225,11 +1455,13 @@ out:
  * @return 0 on success, otherwise a Win32 error code
  */
 static UINT drdynvc_process_data(drdynvcPlugin* drdynvc, int Sp, int cbChId, wStream* s,
-                                 UINT32 ThreadingFlags)
+                                 UINT32 ThreadingFlags, BOOL compressed)
 {
 	UINT32 ChannelId;
 	DVCMAN_CHANNEL* channel;
 	UINT status = CHANNEL_RC_OK;
+	BYTE* buffer = NULL;
+	wStream sbuffer = { 0 };
 
 	if (!Stream_CheckAndLogRequiredLength(TAG, s, drdynvc_cblen_to_bytes(cbChId)))
 		return ERROR_INVALID_DATA;
@@ -1238,6 +1470,9 @@ static UINT drdynvc_process_data(drdynvcPlugin* drdynvc, int Sp, int cbChId, wSt
 	WLog_Print(drdynvc->log, WLOG_TRACE, "process_data: Sp=%d cbChId=%d, ChannelId=%" PRIu32 "", Sp,
 	           cbChId, ChannelId);
 
+	if (compressed && !(s = drdynvc_decompress(drdynvc, s, &sbuffer, &buffer)))
+		return ERROR_INVALID_DATA;
+
 	channel = dvcman_get_channel_by_id(drdynvc->channel_mgr, ChannelId, TRUE);
 	if (!channel)
 	{
@@ -1247,6 +1482,7 @@ static UINT drdynvc_process_data(drdynvcPlugin* drdynvc, int Sp, int cbChId, wSt
 		 * registered on our side. Ignoring it works.
 		 */
 		WLog_Print(drdynvc->log, WLOG_ERROR, "ChannelId %" PRIu32 " not found!", ChannelId);
+		free(buffer);
 		return CHANNEL_RC_OK;
 	}
 
@@ -1258,6 +1494,7 @@ static UINT drdynvc_process_data(drdynvcPlugin* drdynvc, int Sp, int cbChId, wSt
 		status = dvcman_channel_close(channel, FALSE);
 
 out:
+	free(buffer);
 	dvcman_channel_unref(channel);
 	return status;
 }
@@ -1323,10 +1560,16 @@ static UINT drdynvc_order_recv(drdynvcPlugin* drdynvc, wStream* s, UINT32 Thread
 			return drdynvc_process_create_request(drdynvc, Sp, cbChId, s);
 
 		case DATA_FIRST_PDU:
-			return drdynvc_process_data_first(drdynvc, Sp, cbChId, s, ThreadingFlags);
+			return drdynvc_process_data_first(drdynvc, Sp, cbChId, s, ThreadingFlags, FALSE);
 
 		case DATA_PDU:
-			return drdynvc_process_data(drdynvc, Sp, cbChId, s, ThreadingFlags);
+			return drdynvc_process_data(drdynvc, Sp, cbChId, s, ThreadingFlags, FALSE);
+
+		case DATA_FIRST_COMPRESSED_PDU:
+			return drdynvc_process_data_first(drdynvc, Sp, cbChId, s, ThreadingFlags, TRUE);
+
+		case DATA_COMPRESSED_PDU:
+			return drdynvc_process_data(drdynvc, Sp, cbChId, s, ThreadingFlags, TRUE);
 
 		case CLOSE_REQUEST_PDU:
 			return drdynvc_process_close_request(drdynvc, Sp, cbChId, s);
@@ -1446,6 +1689,12 @@ static void VCAPITYPE drdynvc_virtual_channel_open_event_ex(LPVOID lpUserParam,
 		{
 			wStream* s = (wStream*)pData;
 			Stream_Release(s);
+
+			if (drdynvc)
+			{
+				InterlockedDecrement(&drdynvc->inFlight);
+				drdynvc_pump(drdynvc, FALSE);
+			}
 		}
 		break;
 
@@ -1630,6 +1879,13 @@ static UINT drdynvc_virtual_channel_event_connected(drdynvcPlugin* drdynvc, LPVO
 		goto error;
 	}
 
+	/* Each connection starts with empty compression histories */
+	drdynvc->inFlight = 0;
+	drdynvc->compress = FALSE;
+	zgfx_context_free(drdynvc->compressor);
+	zgfx_context_free(drdynvc->decompressor);
+	drdynvc->compressor = NULL;
+	drdynvc->decompressor = NULL;
 	drdynvc->state = DRDYNVC_STATE_CAPABILITIES;
 
 	if (drdynvc->async)
@@ -1697,10 +1953,12 @@ static UINT drdynvc_virtual_channel_event_disconnected(drdynvcPlugin* drdynvc)
 		           WTSErrorToString(status), status);
 	}
 
+	drdynvc_drop_queued(drdynvc);
 	dvcman_clear(drdynvc, drdynvc->channel_mgr);
 	if (drdynvc->queue)
 		MessageQueue_Clear(drdynvc->queue);
 	drdynvc->OpenHandle = 0;
+	drdynvc->compress = FALSE;
 
 	if (drdynvc->data_in)
 	{
@@ -1726,10 +1984,14 @@ static UINT drdynvc_virtual_channel_event_terminated(drdynvcPlugin* drdynvc)
 
 	if (drdynvc->channel_mgr)
 	{
+		drdynvc_drop_queued(drdynvc);
 		dvcman_free(drdynvc, drdynvc->channel_mgr);
 		drdynvc->channel_mgr = NULL;
 	}
 	drdynvc->InitHandle = 0;
+	zgfx_context_free(drdynvc->compressor);
+	zgfx_context_free(drdynvc->decompressor);
+	DeleteCriticalSection(&drdynvc->send_lock);
 	free(drdynvc->context);
 	free(drdynvc);
 	return CHANNEL_RC_OK;
@@ -1878,6 +2140,21 @@ static int drdynvc_get_version(DrdynvcClientContext* context)
 	return drdynvc->version;
 }
 
+static BOOL drdynvc_get_channel_queue_stats(DrdynvcClientContext* context, UINT32 ChannelId,
+                                            FairQueueStats* stats)
+{
+	DVCMAN* dvcman;
+	drdynvcPlugin* drdynvc = (drdynvcPlugin*)context->handle;
+
+	WINPR_ASSERT(drdynvc);
+	dvcman = (DVCMAN*)drdynvc->channel_mgr;
+
+	if (!dvcman)
+		return FALSE;
+
+	return fair_queue_get_stats(dvcman->scheduler, ChannelId, stats);
+}
+
 /* drdynvc is always built-in */
 #define VirtualChannelEntryEx drdynvc_VirtualChannelEntryEx
 
@@ -1900,6 +2177,14 @@ BOOL VCAPITYPE VirtualChannelEntryEx(PCHANNEL_ENTRY_POINTS_EX pEntryPoints, PVOI
 	sprintf_s(drdynvc->channelDef.name, ARRAYSIZE(drdynvc->channelDef.name),
 	          DRDYNVC_SVC_CHANNEL_NAME);
 	drdynvc->state = DRDYNVC_STATE_INITIAL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&drdynvc->send_lock, 4000))
+	{
+		WLog_ERR(TAG, "InitializeCriticalSectionAndSpinCount failed!");
+		free(drdynvc);
+		return FALSE;
+	}
+
 	pEntryPointsEx = (CHANNEL_ENTRY_POINTS_FREERDP_EX*)pEntryPoints;
 
 	if ((pEntryPointsEx->cbSize >= sizeof(CHANNEL_ENTRY_POINTS_FREERDP_EX)) &&
@@ -1910,6 +2195,7 @@ BOOL VCAPITYPE VirtualChannelEntryEx(PCHANNEL_ENTRY_POINTS_EX pEntryPoints, PVOI
 		if (!context)
 		{
 			WLog_Print(drdynvc->log, WLOG_ERROR, "calloc failed!");
+			DeleteCriticalSection(&drdynvc->send_lock);
 			free(drdynvc);
 			return FALSE;
 		}
@@ -1918,6 +2204,7 @@ BOOL VCAPITYPE VirtualChannelEntryEx(PCHANNEL_ENTRY_POINTS_EX pEntryPoints, PVOI
 		context->custom = NULL;
 		drdynvc->context = context;
 		context->GetVersion = drdynvc_get_version;
+		context->GetChannelQueueStats = drdynvc_get_channel_queue_stats;
 		drdynvc->rdpcontext = pEntryPointsEx->context;
 		if (!freerdp_settings_get_bool(drdynvc->rdpcontext->settings, FreeRDP_TransportDumpReplay))
 			drdynvc->async = TRUE;
@@ -1938,6 +2225,7 @@ BOOL VCAPITYPE VirtualChannelEntryEx(PCHANNEL_ENTRY_POINTS_EX pEntryPoints, PVOI
 	{
 		WLog_Print(drdynvc->log, WLOG_ERROR, "pVirtualChannelInit failed with %s [%08" PRIX32 "]",
 		           WTSErrorToString(rc), rc);
+		DeleteCriticalSection(&drdynvc->send_lock);
 		free(drdynvc->context);
 		free(drdynvc);
 		return FALSE;
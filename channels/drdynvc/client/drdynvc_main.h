@@ -33,6 +33,8 @@
 #include <freerdp/addin.h>
 #include <freerdp/channels/log.h>
 #include <freerdp/client/drdynvc.h>
+#include <freerdp/codec/zgfx.h>
+#include <freerdp/utils/fair_queue.h>
 #include <freerdp/freerdp.h>
 
 typedef struct drdynvc_plugin drdynvcPlugin;
@@ -49,6 +51,9 @@ typedef struct
 	wHashTable* listeners;
 	wHashTable* channelsById;
 	wStreamPool* pool;
+
+	/* pending writes, one flow per channel id weighted by its priority class */
+	FairQueue* scheduler;
 } DVCMAN;
 
 typedef struct
@@ -91,6 +96,7 @@ typedef struct
 
 	wStream* dvc_data;
 	UINT32 dvc_data_length;
+	UINT32 compress_skip;
 	CRITICAL_SECTION lock;
 } DVCMAN_CHANNEL;
 
@@ -128,6 +134,14 @@ struct drdynvc_plugin
 	rdpContext* rdpcontext;
 
 	IWTSVirtualChannelManager* channel_mgr;
+
+	BOOL compress;
+	ZGFX_CONTEXT* compressor;
+	ZGFX_CONTEXT* decompressor;
+
+	/* serializes PDUs leaving the scheduler, they share the compression history */
+	CRITICAL_SECTION send_lock;
+	volatile LONG inFlight;
 };
 
 #endif /* FREERDP_CHANNEL_DRDYNVC_CLIENT_MAIN_H */
@@ -38,6 +38,7 @@
 #include <winpr/path.h>
 #include <winpr/file.h>
 #include <winpr/stream.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/channels/rdpdr.h>
 
@@ -333,7 +334,8 @@ static BOOL drive_file_init(DRIVE_FILE* file)
 
 DRIVE_FILE* drive_file_new(const WCHAR* base_path, const WCHAR* path, UINT32 PathLength, UINT32 id,
                            UINT32 DesiredAccess, UINT32 CreateDisposition, UINT32 CreateOptions,
-                           UINT32 FileAttributes, UINT32 SharedAccess)
+                           UINT32 FileAttributes, UINT32 SharedAccess,
+                           const volatile LONG* generation)
 {
 	DRIVE_FILE* file;
 
@@ -357,6 +359,8 @@ DRIVE_FILE* drive_file_new(const WCHAR* base_path, const WCHAR* path, UINT32 Pat
 	file->CreateDisposition = CreateDisposition;
 	file->CreateOptions = CreateOptions;
 	file->SharedAccess = SharedAccess;
+	file->generation = generation;
+	file->dir_error = ERROR_NO_MORE_FILES;
 	drive_file_set_fullpath(file, drive_file_combine_fullpath(base_path, path, PathLength));
 
 	if (!drive_file_init(file))
@@ -403,6 +407,8 @@ BOOL drive_file_free(DRIVE_FILE* file)
 	rc = TRUE;
 fail:
 	DEBUG_WSTR("Free %s", file->fullpath);
+	free(file->ra_buffer);
+	free(file->dir_entries);
 	free(file->fullpath);
 	free(file);
 	return rc;
@@ -419,25 +425,145 @@ BOOL drive_file_seek(DRIVE_FILE* file, UINT64 Offset)
 		return FALSE;
 
 	loffset.QuadPart = (LONGLONG)Offset;
-	return SetFilePointerEx(file->file_handle, loffset, NULL, FILE_BEGIN);
+
+	if (!SetFilePointerEx(file->file_handle, loffset, NULL, FILE_BEGIN))
+		return FALSE;
+
+	file->offset = Offset;
+	return TRUE;
 }
 
-BOOL drive_file_read(DRIVE_FILE* file, BYTE* buffer, UINT32* Length)
+static BOOL drive_file_get_version(DRIVE_FILE* file, UINT64* size, UINT64* mtime)
+{
+	BY_HANDLE_FILE_INFORMATION info;
+
+	if (!GetFileInformationByHandle(file->file_handle, &info))
+		return FALSE;
+
+	*size = ((UINT64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	*mtime = ((UINT64)info.ftLastWriteTime.dwHighDateTime << 32) |
+	         info.ftLastWriteTime.dwLowDateTime;
+	return TRUE;
+}
+
+/**
+ * Drops the read-ahead data once a write on any file of the drive may have changed it, or
+ * once the file changed size or modification time outside of the drive, e.g. by another
+ * process. Changes within the same second keep the size and modification time, so the data
+ * is dropped after DRIVE_READ_AHEAD_LIFETIME ms as well.
+ */
+static void drive_file_check_read_ahead(DRIVE_FILE* file)
+{
+	UINT64 size;
+	UINT64 mtime;
+
+	if (file->ra_length == 0)
+		return;
+
+	if ((file->generation && (file->ra_generation != *file->generation)) ||
+	    (GetTickCount64() - file->ra_filled > DRIVE_READ_AHEAD_LIFETIME) ||
+	    !drive_file_get_version(file, &size, &mtime) || (size != file->ra_size) ||
+	    (mtime != file->ra_mtime))
+		file->ra_length = 0;
+}
+
+/**
+ * Refills the read-ahead buffer of a sequential reader from where its last read ended,
+ * called between requests so the disk read overlaps the round trip to the server.
+ */
+static void drive_file_read_ahead(DRIVE_FILE* file)
 {
 	DWORD read;
+	UINT32 keep = 0;
+	LARGE_INTEGER loffset;
+
+	if (!file->generation || (file->sequential_reads < 2))
+		return;
+
+	drive_file_check_read_ahead(file);
+
+	if ((file->next_read >= file->ra_offset) &&
+	    (file->next_read < file->ra_offset + file->ra_length))
+		keep = (UINT32)(file->ra_offset + file->ra_length - file->next_read);
+
+	if (keep >= DRIVE_READ_AHEAD_SIZE / 2)
+		return;
+
+	if (!file->ra_buffer)
+	{
+		file->ra_buffer = (BYTE*)malloc(DRIVE_READ_AHEAD_SIZE);
+
+		if (!file->ra_buffer)
+			return;
+	}
+
+	if (keep > 0)
+		MoveMemory(file->ra_buffer, &file->ra_buffer[file->next_read - file->ra_offset], keep);
+
+	file->ra_offset = file->next_read;
+	file->ra_length = keep;
+	file->ra_generation = *file->generation;
+
+	/* kept data ages from its own fill */
+	if (keep == 0)
+		file->ra_filled = GetTickCount64();
+
+	if (!drive_file_get_version(file, &file->ra_size, &file->ra_mtime))
+	{
+		file->ra_length = 0;
+		return;
+	}
+
+	loffset.QuadPart = (LONGLONG)(file->ra_offset + keep);
+
+	if (!SetFilePointerEx(file->file_handle, loffset, NULL, FILE_BEGIN) ||
+	    !ReadFile(file->file_handle, &file->ra_buffer[keep], DRIVE_READ_AHEAD_SIZE - keep, &read,
+	              NULL))
+	{
+		file->ra_length = 0;
+		return;
+	}
+
+	file->ra_length += read;
+}
+
+BOOL drive_file_read(DRIVE_FILE* file, BYTE* buffer, UINT32* Length)
+{
+	DWORD read = 0;
+	UINT32 done = 0;
+	UINT64 offset;
 
 	if (!file || !buffer || !Length)
 		return FALSE;
 
 	DEBUG_WSTR("Read file %s", file->fullpath);
+	drive_file_check_read_ahead(file);
+	offset = file->offset;
 
-	if (ReadFile(file->file_handle, buffer, *Length, &read, NULL))
+	if ((offset >= file->ra_offset) && (offset < file->ra_offset + file->ra_length))
 	{
-		*Length = read;
-		return TRUE;
+		done = (UINT32)MIN(*Length, file->ra_offset + file->ra_length - offset);
+		CopyMemory(buffer, &file->ra_buffer[offset - file->ra_offset], done);
 	}
 
-	return FALSE;
+	if (done < *Length)
+	{
+		if ((done > 0) && !drive_file_seek(file, offset + done))
+			return FALSE;
+
+		if (!ReadFile(file->file_handle, &buffer[done], *Length - done, &read, NULL))
+			return FALSE;
+	}
+
+	if (offset == file->next_read)
+		file->sequential_reads++;
+	else
+		file->sequential_reads = 0;
+
+	*Length = done + read;
+	file->next_read = offset + *Length;
+	file->offset = file->next_read;
+	return TRUE;
 }
 
 BOOL drive_file_write(DRIVE_FILE* file, BYTE* buffer, UINT32 Length)
@@ -458,6 +584,7 @@ BOOL drive_file_write(DRIVE_FILE* file, BYTE* buffer, UINT32 Length)
 		buffer += written;
 	}
 
+	file->ra_length = 0;
 	return TRUE;
 }
 
@@ -763,6 +890,48 @@ BOOL drive_file_set_information(DRIVE_FILE* file, UINT32 FsInformationClass, UIN
 	return TRUE;
 }
 
+/**
+ * Fetches directory entries until the batch is full. The search handle is closed at the
+ * end of the listing, the error that ended it is reported once the batch is consumed.
+ */
+static BOOL drive_file_fill_directory(DRIVE_FILE* file)
+{
+	if (!file->dir_entries)
+	{
+		file->dir_entries =
+		    (WIN32_FIND_DATAW*)calloc(DRIVE_DIR_BATCH_SIZE, sizeof(WIN32_FIND_DATAW));
+
+		if (!file->dir_entries)
+		{
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			return FALSE;
+		}
+	}
+
+	if (file->dir_index > 0)
+	{
+		MoveMemory(file->dir_entries, &file->dir_entries[file->dir_index],
+		           (file->dir_count - file->dir_index) * sizeof(WIN32_FIND_DATAW));
+		file->dir_count -= file->dir_index;
+		file->dir_index = 0;
+	}
+
+	while ((file->find_handle != INVALID_HANDLE_VALUE) && (file->dir_count < DRIVE_DIR_BATCH_SIZE))
+	{
+		if (!FindNextFileW(file->find_handle, &file->dir_entries[file->dir_count]))
+		{
+			file->dir_error = GetLastError();
+			FindClose(file->find_handle);
+			file->find_handle = INVALID_HANDLE_VALUE;
+			break;
+		}
+
+		file->dir_count++;
+	}
+
+	return TRUE;
+}
+
 BOOL drive_file_query_directory(DRIVE_FILE* file, UINT32 FsInformationClass, BYTE InitialQuery,
                                 const WCHAR* path, UINT32 PathLength, wStream* output)
 {
@@ -778,6 +947,9 @@ BOOL drive_file_query_directory(DRIVE_FILE* file, UINT32 FsInformationClass, BYT
 		if (file->find_handle != INVALID_HANDLE_VALUE)
 			FindClose(file->find_handle);
 
+		file->dir_count = 0;
+		file->dir_index = 0;
+		file->dir_error = ERROR_NO_MORE_FILES;
 		ent_path = drive_file_combine_fullpath(file->basepath, path, PathLength);
 		/* open new search handle and retrieve the first entry */
 		file->find_handle = FindFirstFileW(ent_path, &file->find_data);
@@ -786,8 +958,19 @@ BOOL drive_file_query_directory(DRIVE_FILE* file, UINT32 FsInformationClass, BYT
 		if (file->find_handle == INVALID_HANDLE_VALUE)
 			goto out_fail;
 	}
-	else if (!FindNextFileW(file->find_handle, &file->find_data))
-		goto out_fail;
+	else
+	{
+		if ((file->dir_index >= file->dir_count) && !drive_file_fill_directory(file))
+			goto out_fail;
+
+		if (file->dir_index >= file->dir_count)
+		{
+			SetLastError(file->dir_error);
+			goto out_fail;
+		}
+
+		file->find_data = file->dir_entries[file->dir_index++];
+	}
 
 	length = _wcslen(file->find_data.cFileName) * 2;
 
@@ -937,3 +1120,18 @@ out_fail:
 	Stream_Write_UINT8(output, 0);  /* Padding */
 	return FALSE;
 }
+
+void drive_file_prefetch(DRIVE_FILE* file)
+{
+	if (!file)
+		return;
+
+	if (file->is_dir)
+	{
+		if ((file->find_handle != INVALID_HANDLE_VALUE) &&
+		    (file->dir_count - file->dir_index < DRIVE_DIR_BATCH_SIZE / 2))
+			drive_file_fill_directory(file);
+	}
+	else
+		drive_file_read_ahead(file);
+}
@@ -31,6 +31,16 @@
 
 #define TAG CHANNELS_TAG("drive.client")
 
+/* bytes read ahead of a sequential reader, refilled when half of it is consumed */
+#define DRIVE_READ_AHEAD_SIZE (1024 * 1024)
+
+/* milliseconds read-ahead data is kept, bounds what a same-second change by another process
+ * can leave stale as the modification time only has a resolution of a second */
+#define DRIVE_READ_AHEAD_LIFETIME 1000
+
+/* directory entries fetched from the file system at a time */
+#define DRIVE_DIR_BATCH_SIZE 64
+
 typedef struct
 {
 	UINT32 id;
@@ -47,11 +57,31 @@ typedef struct
 	UINT32 DesiredAccess;
 	UINT32 CreateDisposition;
 	UINT32 CreateOptions;
+
+	/* read-ahead, dropped when the drive generation, file size or modification time changes */
+	const volatile LONG* generation;
+	UINT64 offset;
+	UINT64 next_read;
+	UINT32 sequential_reads;
+	BYTE* ra_buffer;
+	UINT64 ra_offset;
+	UINT32 ra_length;
+	LONG ra_generation;
+	UINT64 ra_size;
+	UINT64 ra_mtime;
+	UINT64 ra_filled;
+
+	/* directory entries fetched ahead of the queries */
+	WIN32_FIND_DATAW* dir_entries;
+	size_t dir_count;
+	size_t dir_index;
+	DWORD dir_error;
 } DRIVE_FILE;
 
 DRIVE_FILE* drive_file_new(const WCHAR* base_path, const WCHAR* path, UINT32 PathLength, UINT32 id,
                            UINT32 DesiredAccess, UINT32 CreateDisposition, UINT32 CreateOptions,
-                           UINT32 FileAttributes, UINT32 SharedAccess);
+                           UINT32 FileAttributes, UINT32 SharedAccess,
+                           const volatile LONG* generation);
 BOOL drive_file_free(DRIVE_FILE* file);
 
 BOOL drive_file_open(DRIVE_FILE* file);
@@ -63,5 +93,6 @@ BOOL drive_file_set_information(DRIVE_FILE* file, UINT32 FsInformationClass, UIN
                                 wStream* input);
 BOOL drive_file_query_directory(DRIVE_FILE* file, UINT32 FsInformationClass, BYTE InitialQuery,
                                 const WCHAR* path, UINT32 PathLength, wStream* output);
+void drive_file_prefetch(DRIVE_FILE* file);
 
 #endif /* FREERDP_CHANNEL_DRIVE_FILE_H */
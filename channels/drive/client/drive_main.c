@@ -45,6 +45,9 @@
 
 #include "drive_file.h"
 
+/* IRPs executed at the same time, IRPs for one FileId always run in order */
+#define DRIVE_WORKER_COUNT 4
+
 typedef struct
 {
 	DEVICE device;
@@ -54,8 +57,16 @@ typedef struct
 	UINT32 PathLength;
 	wListDictionary* files;
 
-	HANDLE thread;
-	wMessageQueue* IrpQueue;
+	HANDLE threads[DRIVE_WORKER_COUNT];
+	CRITICAL_SECTION lock;
+	wArrayList* pending;
+	UINT32 busyIds[DRIVE_WORKER_COUNT];
+	size_t busyCount;
+	HANDLE workEvent;
+	BOOL stopping;
+
+	/* bumped by every change to the drive content, invalidates read-ahead */
+	volatile LONG generation;
 
 	DEVMAN* devman;
 
@@ -180,9 +191,10 @@ static UINT drive_process_irp_create(DRIVE_DEVICE* drive, IRP* irp)
 		return ERROR_INVALID_DATA;
 
 	path = (const WCHAR*)Stream_Pointer(irp->input);
-	FileId = irp->devman->id_sequence++;
+	/* several drives and workers allocate from the same sequence */
+	FileId = (UINT32)InterlockedIncrement((volatile LONG*)&irp->devman->id_sequence) - 1;
 	file = drive_file_new(drive->path, path, PathLength, FileId, DesiredAccess, CreateDisposition,
-	                      CreateOptions, FileAttributes, SharedAccess);
+	                      CreateOptions, FileAttributes, SharedAccess, &drive->generation);
 
 	if (!file)
 	{
@@ -200,6 +212,9 @@ static UINT drive_process_irp_create(DRIVE_DEVICE* drive, IRP* irp)
 			return ERROR_INTERNAL_ERROR;
 		}
 
+		if (CreateDisposition != FILE_OPEN)
+			InterlockedIncrement(&drive->generation);
+
 		switch (CreateDisposition)
 		{
 			case FILE_SUPERSEDE:
@@ -360,6 +375,8 @@ static UINT drive_process_irp_write(DRIVE_DEVICE* drive, IRP* irp)
 		Length = 0;
 	}
 
+	InterlockedIncrement(&drive->generation);
+
 	Stream_Write_UINT32(irp->output, Length);
 	Stream_Write_UINT8(irp->output, 0); /* Padding */
 	return irp->Complete(irp);
@@ -427,6 +444,8 @@ static UINT drive_process_irp_set_information(DRIVE_DEVICE* drive, IRP* irp)
 		irp->IoStatus = drive_map_windows_err(GetLastError());
 	}
 
+	InterlockedIncrement(&drive->generation);
+
 	if (file && file->is_dir && !PathIsDirectoryEmptyW(file->fullpath))
 		irp->IoStatus = STATUS_DIRECTORY_NOT_EMPTY;
 
@@ -748,10 +767,67 @@ static UINT drive_process_irp(DRIVE_DEVICE* drive, IRP* irp)
 	return error;
 }
 
+static BOOL drive_is_busy(DRIVE_DEVICE* drive, UINT32 FileId)
+{
+	size_t i;
+
+	for (i = 0; i < drive->busyCount; i++)
+	{
+		if (drive->busyIds[i] == FileId)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Takes the oldest pending IRP whose file is not in use by another worker.
+ * Creates do not refer to a file yet and may always run.
+ * Called with the drive lock held.
+ */
+static IRP* drive_take_irp(DRIVE_DEVICE* drive)
+{
+	size_t i;
+	const size_t count = ArrayList_Count(drive->pending);
+
+	for (i = 0; i < count; i++)
+	{
+		IRP* irp = (IRP*)ArrayList_GetItem(drive->pending, i);
+
+		if (irp->MajorFunction == IRP_MJ_CREATE)
+		{
+			ArrayList_RemoveAt(drive->pending, i);
+			return irp;
+		}
+
+		if (!drive_is_busy(drive, irp->FileId))
+		{
+			ArrayList_RemoveAt(drive->pending, i);
+			drive->busyIds[drive->busyCount++] = irp->FileId;
+			return irp;
+		}
+	}
+
+	return NULL;
+}
+
+static void drive_release_file_id(DRIVE_DEVICE* drive, UINT32 FileId)
+{
+	size_t i;
+
+	for (i = 0; i < drive->busyCount; i++)
+	{
+		if (drive->busyIds[i] == FileId)
+		{
+			drive->busyIds[i] = drive->busyIds[--drive->busyCount];
+			break;
+		}
+	}
+}
+
 static DWORD WINAPI drive_thread_func(LPVOID arg)
 {
 	IRP* irp;
-	wMessage message;
 	DRIVE_DEVICE* drive = (DRIVE_DEVICE*)arg;
 	UINT error = CHANNEL_RC_OK;
 
@@ -763,33 +839,53 @@ static DWORD WINAPI drive_thread_func(LPVOID arg)
 
 	while (1)
 	{
-		if (!MessageQueue_Wait(drive->IrpQueue))
-		{
-			WLog_ERR(TAG, "MessageQueue_Wait failed!");
-			error = ERROR_INTERNAL_ERROR;
-			break;
-		}
+		UINT32 FileId;
+		UINT32 MajorFunction;
 
-		if (!MessageQueue_Peek(drive->IrpQueue, &message, TRUE))
+		irp = NULL;
+		EnterCriticalSection(&drive->lock);
+
+		while (!drive->stopping && !(irp = drive_take_irp(drive)))
 		{
-			WLog_ERR(TAG, "MessageQueue_Peek failed!");
-			error = ERROR_INTERNAL_ERROR;
-			break;
+			ResetEvent(drive->workEvent);
+			LeaveCriticalSection(&drive->lock);
+
+			if (WaitForSingleObject(drive->workEvent, INFINITE) == WAIT_FAILED)
+			{
+				error = GetLastError();
+				WLog_ERR(TAG, "WaitForSingleObject failed with error %" PRIu32 "!", error);
+				goto fail;
+			}
+
+			EnterCriticalSection(&drive->lock);
 		}
 
-		if (message.id == WMQ_QUIT)
+		LeaveCriticalSection(&drive->lock);
+
+		if (!irp)
 			break;
 
-		irp = (IRP*)message.wParam;
+		/* the IRP is gone once completed */
+		FileId = irp->FileId;
+		MajorFunction = irp->MajorFunction;
 
-		if (irp)
+		if ((error = drive_process_irp(drive, irp)))
+			WLog_ERR(TAG, "drive_process_irp failed with error %" PRIu32 "!", error);
+
+		/* still holding the file, prepare its next request while this reply is in flight */
+		if (!error && (MajorFunction != IRP_MJ_CREATE) && (MajorFunction != IRP_MJ_CLOSE))
+			drive_file_prefetch(drive_get_file_by_id(drive, FileId));
+
+		if (MajorFunction != IRP_MJ_CREATE)
 		{
-			if ((error = drive_process_irp(drive, irp)))
-			{
-				WLog_ERR(TAG, "drive_process_irp failed with error %" PRIu32 "!", error);
-				break;
-			}
+			EnterCriticalSection(&drive->lock);
+			drive_release_file_id(drive, FileId);
+			SetEvent(drive->workEvent);
+			LeaveCriticalSection(&drive->lock);
 		}
+
+		if (error)
+			break;
 	}
 
 fail:
@@ -808,14 +904,23 @@ fail:
  */
 static UINT drive_irp_request(DEVICE* device, IRP* irp)
 {
+	BOOL rc;
 	DRIVE_DEVICE* drive = (DRIVE_DEVICE*)device;
 
 	if (!drive)
 		return ERROR_INVALID_PARAMETER;
 
-	if (!MessageQueue_Post(drive->IrpQueue, NULL, 0, (void*)irp, NULL))
+	EnterCriticalSection(&drive->lock);
+	rc = ArrayList_Append(drive->pending, irp);
+
+	if (rc)
+		SetEvent(drive->workEvent);
+
+	LeaveCriticalSection(&drive->lock);
+
+	if (!rc)
 	{
-		WLog_ERR(TAG, "MessageQueue_Post failed!");
+		WLog_ERR(TAG, "ArrayList_Append failed!");
 		return ERROR_INTERNAL_ERROR;
 	}
 
@@ -824,14 +929,34 @@ static UINT drive_irp_request(DEVICE* device, IRP* irp)
 
 static UINT drive_free_int(DRIVE_DEVICE* drive)
 {
+	size_t i;
 	UINT error = CHANNEL_RC_OK;
 
 	if (!drive)
 		return ERROR_INVALID_PARAMETER;
 
-	CloseHandle(drive->thread);
+	for (i = 0; i < DRIVE_WORKER_COUNT; i++)
+	{
+		if (drive->threads[i])
+			CloseHandle(drive->threads[i]);
+	}
+
+	if (drive->pending)
+	{
+		for (i = 0; i < ArrayList_Count(drive->pending); i++)
+		{
+			IRP* irp = (IRP*)ArrayList_GetItem(drive->pending, i);
+			irp->Discard(irp);
+		}
+
+		ArrayList_Free(drive->pending);
+	}
+
+	if (drive->workEvent)
+		CloseHandle(drive->workEvent);
+
+	DeleteCriticalSection(&drive->lock);
 	ListDictionary_Free(drive->files);
-	MessageQueue_Free(drive->IrpQueue);
 	Stream_Free(drive->device.data, TRUE);
 	free(drive->path);
 	free(drive);
@@ -845,18 +970,27 @@ static UINT drive_free_int(DRIVE_DEVICE* drive)
  */
 static UINT drive_free(DEVICE* device)
 {
+	size_t i;
 	DRIVE_DEVICE* drive = (DRIVE_DEVICE*)device;
 	UINT error = CHANNEL_RC_OK;
 
 	if (!drive)
 		return ERROR_INVALID_PARAMETER;
 
-	if (MessageQueue_PostQuit(drive->IrpQueue, 0) &&
-	    (WaitForSingleObject(drive->thread, INFINITE) == WAIT_FAILED))
+	EnterCriticalSection(&drive->lock);
+	drive->stopping = TRUE;
+	SetEvent(drive->workEvent);
+	LeaveCriticalSection(&drive->lock);
+
+	for (i = 0; i < DRIVE_WORKER_COUNT; i++)
 	{
-		error = GetLastError();
-		WLog_ERR(TAG, "WaitForSingleObject failed with error %" PRIu32 "", error);
-		return error;
+		if (drive->threads[i] &&
+		    (WaitForSingleObject(drive->threads[i], INFINITE) == WAIT_FAILED))
+		{
+			error = GetLastError();
+			WLog_ERR(TAG, "WaitForSingleObject failed with error %" PRIu32 "", error);
+			return error;
+		}
 	}
 
 	return drive_free_int(drive);
@@ -900,6 +1034,13 @@ static UINT drive_register_drive_path(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints,
 			return CHANNEL_RC_NO_MEMORY;
 		}
 
+		if (!InitializeCriticalSectionAndSpinCount(&drive->lock, 4000))
+		{
+			WLog_ERR(TAG, "InitializeCriticalSectionAndSpinCount failed!");
+			free(drive);
+			return ERROR_INTERNAL_ERROR;
+		}
+
 		drive->device.type = RDPDR_DTYP_FILESYSTEM;
 		drive->device.IRPRequest = drive_irp_request;
 		drive->device.Free = drive_free;
@@ -961,29 +1102,39 @@ static UINT drive_register_drive_path(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints,
 		}
 
 		ListDictionary_ValueObject(drive->files)->fnObjectFree = drive_file_objfree;
-		drive->IrpQueue = MessageQueue_New(NULL);
+		drive->pending = ArrayList_New(FALSE);
 
-		if (!drive->IrpQueue)
+		if (!drive->pending)
 		{
-			WLog_ERR(TAG, "ListDictionary_New failed!");
+			WLog_ERR(TAG, "ArrayList_New failed!");
 			error = CHANNEL_RC_NO_MEMORY;
 			goto out_error;
 		}
 
+		if (!(drive->workEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		{
+			WLog_ERR(TAG, "CreateEvent failed!");
+			goto out_error;
+		}
+
 		if ((error = pEntryPoints->RegisterDevice(pEntryPoints->devman, (DEVICE*)drive)))
 		{
 			WLog_ERR(TAG, "RegisterDevice failed with error %" PRIu32 "!", error);
 			goto out_error;
 		}
 
-		if (!(drive->thread =
-		          CreateThread(NULL, 0, drive_thread_func, drive, CREATE_SUSPENDED, NULL)))
+		for (i = 0; i < DRIVE_WORKER_COUNT; i++)
 		{
-			WLog_ERR(TAG, "CreateThread failed!");
-			goto out_error;
+			if (!(drive->threads[i] =
+			          CreateThread(NULL, 0, drive_thread_func, drive, CREATE_SUSPENDED, NULL)))
+			{
+				WLog_ERR(TAG, "CreateThread failed!");
+				goto out_error;
+			}
 		}
 
-		ResumeThread(drive->thread);
+		for (i = 0; i < DRIVE_WORKER_COUNT; i++)
+			ResumeThread(drive->threads[i]);
 	}
 
 	return CHANNEL_RC_OK;
@@ -0,0 +1,303 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#include "../drive_file.h"
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+/*
+ * Reads a file sequentially until the drive reads ahead, then changes it behind the
+ * drive's back. Each change must be seen by the next read, whichever check notices it.
+ */
+
+#define TEST_FILE_SIZE (2 * DRIVE_READ_AHEAD_SIZE)
+#define TEST_READ_SIZE (64 * 1024)
+#define TEST_GROW_SIZE 4096
+
+/* FILETIME ticks per second */
+#define TEST_SECOND 10000000ULL
+
+typedef struct
+{
+	char* base;
+	char* path;
+	WCHAR* wbase;
+	BYTE* content;
+	size_t size;
+	DRIVE_FILE* file;
+	volatile LONG generation;
+	UINT64 offset;
+	BYTE seed;
+} TestReadAhead;
+
+static BOOL test_read(TestReadAhead* test, UINT64 offset, UINT32 length)
+{
+	BOOL rc;
+	UINT32 read = length;
+	BYTE* buffer = (BYTE*)malloc(length);
+
+	if (!buffer)
+		return FALSE;
+
+	rc = drive_file_seek(test->file, offset) && drive_file_read(test->file, buffer, &read) &&
+	     (read == MIN(length, test->size - offset)) &&
+	     (memcmp(buffer, &test->content[offset], read) == 0);
+	free(buffer);
+	return rc;
+}
+
+static BOOL test_buffered(const TestReadAhead* test)
+{
+	const DRIVE_FILE* file = test->file;
+
+	return (test->offset >= file->ra_offset) && (test->offset < file->ra_offset + file->ra_length);
+}
+
+/* sequential reads, then the prefetch the drive runs between requests */
+static BOOL test_fill(TestReadAhead* test)
+{
+	size_t i;
+
+	for (i = 0; i < 3; i++)
+	{
+		if (!test_read(test, test->offset, TEST_READ_SIZE))
+			return FALSE;
+
+		test->offset += TEST_READ_SIZE;
+	}
+
+	drive_file_prefetch(test->file);
+	return test_buffered(test);
+}
+
+static BOOL test_get_mtime(HANDLE handle, UINT64* mtime)
+{
+	BY_HANDLE_FILE_INFORMATION info;
+
+	if (!GetFileInformationByHandle(handle, &info))
+		return FALSE;
+
+	*mtime = ((UINT64)info.ftLastWriteTime.dwHighDateTime << 32) |
+	         info.ftLastWriteTime.dwLowDateTime;
+	return TRUE;
+}
+
+/**
+ * Rewrites the next read behind the drive's back, optionally growing the file, and sets
+ * its modification time to what it was plus shift.
+ */
+static BOOL test_modify(TestReadAhead* test, BOOL grow, UINT64 shift)
+{
+	size_t i;
+	DWORD written;
+	UINT64 mtime;
+	FILETIME ft;
+	LARGE_INTEGER offset;
+	HANDLE handle;
+	size_t length = TEST_READ_SIZE;
+
+	handle = CreateFileA(test->path, GENERIC_READ | GENERIC_WRITE,
+	                     FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+	                     FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (handle == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	if (!test_get_mtime(handle, &mtime))
+	{
+		CloseHandle(handle);
+		return FALSE;
+	}
+
+	test->seed++;
+
+	for (i = 0; i < length; i++)
+		test->content[test->offset + i] = (BYTE)(test->content[test->offset + i] ^ test->seed);
+
+	offset.QuadPart = (LONGLONG)test->offset;
+
+	if (grow)
+	{
+		/* one write from the change to the new end of the file */
+		for (i = test->size; i < test->size + TEST_GROW_SIZE; i++)
+			test->content[i] = (BYTE)(i * 13);
+
+		length = test->size + TEST_GROW_SIZE - test->offset;
+		test->size += TEST_GROW_SIZE;
+	}
+
+	if (!SetFilePointerEx(handle, offset, NULL, FILE_BEGIN) ||
+	    !WriteFile(handle, &test->content[test->offset], (DWORD)length, &written, NULL) ||
+	    (written != length))
+	{
+		CloseHandle(handle);
+		return FALSE;
+	}
+
+	CloseHandle(handle);
+
+	/* after the close, which flushes the write */
+	handle = CreateFileA(test->path, GENERIC_READ | GENERIC_WRITE,
+	                     FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+	                     FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (handle == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	mtime += shift;
+	ft.dwLowDateTime = (DWORD)(mtime & 0xFFFFFFFF);
+	ft.dwHighDateTime = (DWORD)(mtime >> 32);
+
+	if (!SetFileTime(handle, NULL, NULL, &ft))
+	{
+		CloseHandle(handle);
+		return FALSE;
+	}
+
+	CloseHandle(handle);
+	return TRUE;
+}
+
+/* the next read must see the change */
+static BOOL test_check(TestReadAhead* test, const char* what)
+{
+	if (!test_read(test, test->offset, TEST_READ_SIZE))
+	{
+		fprintf(stderr, "TestDriveReadAhead: stale data after %s\n", what);
+		return FALSE;
+	}
+
+	test->offset += TEST_READ_SIZE;
+	return TRUE;
+}
+
+static BOOL test_setup(TestReadAhead* test)
+{
+	size_t i;
+	DWORD written;
+	HANDLE handle;
+	char name[64];
+	WCHAR* path = NULL;
+	int length;
+
+	sprintf_s(name, sizeof(name), "TestDriveReadAhead.%08" PRIX32, GetCurrentProcessId());
+	test->base = GetKnownSubPath(KNOWN_PATH_TEMP, name);
+
+	if (!test->base || !CreateDirectoryA(test->base, NULL))
+		return FALSE;
+
+	test->path = GetCombinedPath(test->base, "data.bin");
+	test->size = TEST_FILE_SIZE;
+	test->content = (BYTE*)malloc(TEST_FILE_SIZE + TEST_GROW_SIZE);
+
+	if (!test->path || !test->content)
+		return FALSE;
+
+	for (i = 0; i < test->size; i++)
+		test->content[i] = (BYTE)((i % 251) ^ (i >> 12));
+
+	handle = CreateFileA(test->path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL,
+	                     NULL);
+
+	if (handle == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	if (!WriteFile(handle, test->content, (DWORD)test->size, &written, NULL) ||
+	    (written != test->size))
+	{
+		CloseHandle(handle);
+		return FALSE;
+	}
+
+	CloseHandle(handle);
+
+	if (ConvertToUnicode(CP_UTF8, 0, test->base, -1, &test->wbase, 0) <= 0)
+		return FALSE;
+
+	length = ConvertToUnicode(CP_UTF8, 0, "\\data.bin", -1, &path, 0);
+
+	if (length <= 0)
+		return FALSE;
+
+	test->file = drive_file_new(test->wbase, path, (UINT32)length * sizeof(WCHAR), 1,
+	                            GENERIC_READ, FILE_OPEN, FILE_NON_DIRECTORY_FILE,
+	                            FILE_ATTRIBUTE_NORMAL, FILE_SHARE_READ | FILE_SHARE_WRITE,
+	                            &test->generation);
+	free(path);
+	return test->file != NULL;
+}
+
+static void test_teardown(TestReadAhead* test)
+{
+	drive_file_free(test->file);
+
+	if (test->path)
+		winpr_DeleteFile(test->path);
+
+	if (test->base)
+		winpr_RemoveDirectory(test->base);
+
+	free(test->wbase);
+	free(test->content);
+	free(test->path);
+	free(test->base);
+}
+
+int TestDriveReadAhead(int argc, char* argv[])
+{
+	int rc = -1;
+	TestReadAhead test = { 0 };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_setup(&test))
+		goto fail;
+
+	/* unchanged, the read is served from the buffer and keeps it */
+	if (!test_fill(&test) || !test_check(&test, "nothing") || !test_buffered(&test))
+		goto fail;
+
+	/* a write through the drive, e.g. on another handle */
+	if (!test_fill(&test) || !test_modify(&test, FALSE, 0))
+		goto fail;
+
+	InterlockedIncrement(&test.generation);
+
+	if (!test_check(&test, "a drive write"))
+		goto fail;
+
+	/* another process changed the data and the modification time */
+	if (!test_fill(&test) || !test_modify(&test, FALSE, 2 * TEST_SECOND) ||
+	    !test_check(&test, "a modification time change"))
+		goto fail;
+
+	/* another process changed the data and the size */
+	if (!test_fill(&test) || !test_modify(&test, TRUE, 0) || !test_check(&test, "a size change"))
+		goto fail;
+
+	/* within the same second, only the lifetime of the buffer bounds the stale data */
+	if (!test_fill(&test) || !test_modify(&test, FALSE, 0))
+		goto fail;
+
+	Sleep(DRIVE_READ_AHEAD_LIFETIME + 100);
+
+	if (!test_check(&test, "the read-ahead lifetime"))
+		goto fail;
+
+	rc = 0;
+fail:
+	if (rc != 0)
+		fprintf(stderr, "TestDriveReadAhead failed\n");
+
+	test_teardown(&test);
+	return rc;
+}
@@ -0,0 +1,621 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/nt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/channels/rdpdr.h>
+
+#include "../drive_file.h"
+
+/*
+ * Drives a redirected drive through its IRP interface. Completions are checked
+ * on the worker threads, the test thread only submits and waits.
+ */
+
+#define TEST_FILES 3
+#define TEST_CHUNKS 32
+#define TEST_CHUNK_SIZE 4096
+#define TEST_SLOW_REPLY 100
+#define TEST_DIR_ENTRIES (3 * DRIVE_DIR_BATCH_SIZE + 5)
+#define TEST_TIMEOUT 10000
+
+/* CompletionId of an IRP whose order is checked, file index and sequence number */
+#define TEST_ORDERED 0x80000000
+#define TEST_ORDERED_ID(index, seq) (TEST_ORDERED | ((index) << 16) | (seq))
+#define TEST_ORDERED_INDEX(id) (((id) >> 16) & 0x7FFF)
+#define TEST_ORDERED_SEQ(id) ((id)&0xFFFF)
+
+UINT drive_DeviceServiceEntry(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints);
+
+typedef struct
+{
+	DEVMAN devman; /* first, completions find the test through irp->devman */
+	DEVICE* device;
+	char* base;
+	CRITICAL_SECTION lock;
+	HANDLE done;
+	size_t pending;
+	BOOL failed;
+	UINT32 lastStatus;
+	UINT32 lastFileId;
+	BYTE last[1024];
+	size_t lastLength;
+	UINT32 next[TEST_FILES];
+} TestDrive;
+
+static BYTE test_pattern(UINT32 index, UINT32 chunk, size_t i)
+{
+	return (BYTE)(index * 31 + chunk * 7 + i);
+}
+
+static void test_check_ordered(TestDrive* test, IRP* irp)
+{
+	size_t i;
+	UINT32 length;
+	const UINT32 index = TEST_ORDERED_INDEX(irp->CompletionId);
+	const UINT32 seq = TEST_ORDERED_SEQ(irp->CompletionId);
+
+	/* IRPs of one file complete in the order they were submitted */
+	if ((index >= TEST_FILES) || (seq != test->next[index]++) || (irp->IoStatus != 0))
+	{
+		test->failed = TRUE;
+		return;
+	}
+
+	if (irp->MajorFunction != IRP_MJ_READ)
+		return;
+
+	/* each read follows the write of its chunk */
+	Stream_SetPosition(irp->output, 0);
+	Stream_Read_UINT32(irp->output, length);
+
+	if (length != TEST_CHUNK_SIZE)
+	{
+		test->failed = TRUE;
+		return;
+	}
+
+	for (i = 0; i < length; i++)
+	{
+		if (Stream_Pointer(irp->output)[i] != test_pattern(index, seq / 2, i))
+		{
+			test->failed = TRUE;
+			return;
+		}
+	}
+}
+
+static void test_irp_free(IRP* irp)
+{
+	Stream_Free(irp->input, TRUE);
+	Stream_Free(irp->output, TRUE);
+	winpr_aligned_free(irp);
+}
+
+static UINT test_irp_complete(IRP* irp)
+{
+	TestDrive* test = (TestDrive*)irp->devman;
+
+	/* the first write of each file has a slow reply, later IRPs of the file must wait for it
+	 * while the idle workers are free to take them */
+	if ((irp->CompletionId & TEST_ORDERED) && (TEST_ORDERED_SEQ(irp->CompletionId) == 0))
+		Sleep(TEST_SLOW_REPLY);
+
+	EnterCriticalSection(&test->lock);
+
+	if (irp->CompletionId & TEST_ORDERED)
+		test_check_ordered(test, irp);
+	else
+	{
+		test->lastStatus = irp->IoStatus;
+		test->lastLength = MIN(Stream_GetPosition(irp->output), sizeof(test->last));
+		CopyMemory(test->last, Stream_Buffer(irp->output), test->lastLength);
+
+		if ((irp->MajorFunction == IRP_MJ_CREATE) && (test->lastLength >= 4))
+			CopyMemory(&test->lastFileId, test->last, sizeof(UINT32));
+	}
+
+	if (--test->pending == 0)
+		SetEvent(test->done);
+
+	LeaveCriticalSection(&test->lock);
+	test_irp_free(irp);
+	return CHANNEL_RC_OK;
+}
+
+static UINT test_irp_discard(IRP* irp)
+{
+	TestDrive* test = (TestDrive*)irp->devman;
+
+	EnterCriticalSection(&test->lock);
+	test->failed = TRUE;
+
+	if (--test->pending == 0)
+		SetEvent(test->done);
+
+	LeaveCriticalSection(&test->lock);
+	test_irp_free(irp);
+	return CHANNEL_RC_OK;
+}
+
+static IRP* test_irp_new(TestDrive* test, UINT32 FileId, UINT32 CompletionId, UINT32 major,
+                         UINT32 minor)
+{
+	IRP* irp = (IRP*)winpr_aligned_malloc(sizeof(IRP), MEMORY_ALLOCATION_ALIGNMENT);
+
+	if (!irp)
+		return NULL;
+
+	ZeroMemory(irp, sizeof(IRP));
+	irp->device = test->device;
+	irp->devman = &test->devman;
+	irp->FileId = FileId;
+	irp->CompletionId = CompletionId;
+	irp->MajorFunction = major;
+	irp->MinorFunction = minor;
+	irp->input = Stream_New(NULL, 256);
+	irp->output = Stream_New(NULL, 256);
+	irp->Complete = test_irp_complete;
+	irp->Discard = test_irp_discard;
+
+	if (!irp->input || !irp->output)
+	{
+		test_irp_free(irp);
+		return NULL;
+	}
+
+	return irp;
+}
+
+static BOOL test_submit(TestDrive* test, IRP* irp)
+{
+	if (!irp)
+		return FALSE;
+
+	Stream_SealLength(irp->input);
+	Stream_SetPosition(irp->input, 0);
+	EnterCriticalSection(&test->lock);
+	test->pending++;
+	ResetEvent(test->done);
+	LeaveCriticalSection(&test->lock);
+
+	if (test->device->IRPRequest(test->device, irp) != CHANNEL_RC_OK)
+	{
+		EnterCriticalSection(&test->lock);
+		test->pending--;
+		LeaveCriticalSection(&test->lock);
+		test_irp_free(irp);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_wait(TestDrive* test)
+{
+	return (WaitForSingleObject(test->done, TEST_TIMEOUT) == WAIT_OBJECT_0) && !test->failed;
+}
+
+static BOOL test_write_path(wStream* s, const char* path)
+{
+	int length;
+	WCHAR* wpath = NULL;
+
+	length = ConvertToUnicode(CP_UTF8, 0, path, -1, &wpath, 0);
+
+	if ((length <= 0) || !Stream_EnsureRemainingCapacity(s, 4 + length * sizeof(WCHAR)))
+	{
+		free(wpath);
+		return FALSE;
+	}
+
+	Stream_Write_UINT32(s, (UINT32)(length * sizeof(WCHAR))); /* PathLength */
+	Stream_Write(s, wpath, length * sizeof(WCHAR));
+	free(wpath);
+	return TRUE;
+}
+
+/* opens a file or directory, returns its FileId or 0 */
+static UINT32 test_create(TestDrive* test, const char* path, UINT32 disposition, UINT32 options)
+{
+	IRP* irp = test_irp_new(test, 0, 0, IRP_MJ_CREATE, 0);
+
+	if (!irp)
+		return 0;
+
+	Stream_Write_UINT32(irp->input, GENERIC_READ | GENERIC_WRITE);         /* DesiredAccess */
+	Stream_Write_UINT64(irp->input, 0);                                    /* AllocationSize */
+	Stream_Write_UINT32(irp->input, FILE_ATTRIBUTE_NORMAL);                /* FileAttributes */
+	Stream_Write_UINT32(irp->input, FILE_SHARE_READ | FILE_SHARE_WRITE);   /* SharedAccess */
+	Stream_Write_UINT32(irp->input, disposition);                          /* CreateDisposition */
+	Stream_Write_UINT32(irp->input, options);                              /* CreateOptions */
+
+	if (!test_write_path(irp->input, path))
+	{
+		test_irp_free(irp);
+		return 0;
+	}
+
+	if (!test_submit(test, irp) || !test_wait(test) || (test->lastStatus != 0))
+		return 0;
+
+	return test->lastFileId;
+}
+
+static BOOL test_close(TestDrive* test, UINT32 FileId)
+{
+	IRP* irp = test_irp_new(test, FileId, 0, IRP_MJ_CLOSE, 0);
+
+	if (!irp)
+		return FALSE;
+
+	Stream_Zero(irp->input, 32); /* Padding */
+	return test_submit(test, irp) && test_wait(test) && (test->lastStatus == 0);
+}
+
+static IRP* test_write_irp(TestDrive* test, UINT32 FileId, UINT32 index, UINT32 chunk)
+{
+	size_t i;
+	IRP* irp = test_irp_new(test, FileId, TEST_ORDERED_ID(index, 2 * chunk), IRP_MJ_WRITE, 0);
+
+	if (!irp)
+		return NULL;
+
+	if (!Stream_EnsureRemainingCapacity(irp->input, 32 + TEST_CHUNK_SIZE))
+	{
+		test_irp_free(irp);
+		return NULL;
+	}
+
+	Stream_Write_UINT32(irp->input, TEST_CHUNK_SIZE);                 /* Length */
+	Stream_Write_UINT64(irp->input, (UINT64)chunk * TEST_CHUNK_SIZE); /* Offset */
+	Stream_Zero(irp->input, 20);                                      /* Padding */
+
+	for (i = 0; i < TEST_CHUNK_SIZE; i++)
+		Stream_Write_UINT8(irp->input, test_pattern(index, chunk, i));
+
+	return irp;
+}
+
+static IRP* test_read_irp(TestDrive* test, UINT32 FileId, UINT32 index, UINT32 chunk)
+{
+	IRP* irp = test_irp_new(test, FileId, TEST_ORDERED_ID(index, 2 * chunk + 1), IRP_MJ_READ, 0);
+
+	if (!irp)
+		return NULL;
+
+	Stream_Write_UINT32(irp->input, TEST_CHUNK_SIZE);                 /* Length */
+	Stream_Write_UINT64(irp->input, (UINT64)chunk * TEST_CHUNK_SIZE); /* Offset */
+	Stream_Zero(irp->input, 20);                                      /* Padding */
+	return irp;
+}
+
+/**
+ * Queues a write and a read of every chunk of several files at once, interleaving the
+ * files. The workers take them in parallel, yet each file must see them in order.
+ */
+static BOOL test_file_order(TestDrive* test)
+{
+	UINT32 i;
+	UINT32 chunk;
+	char name[32];
+	UINT32 FileIds[TEST_FILES] = { 0 };
+	BOOL rc = FALSE;
+
+	for (i = 0; i < TEST_FILES; i++)
+	{
+		sprintf_s(name, sizeof(name), "\\file%" PRIu32 ".bin", i);
+		FileIds[i] = test_create(test, name, FILE_OVERWRITE_IF, FILE_NON_DIRECTORY_FILE);
+
+		if (FileIds[i] == 0)
+			goto fail;
+	}
+
+	for (chunk = 0; chunk < TEST_CHUNKS; chunk++)
+	{
+		for (i = 0; i < TEST_FILES; i++)
+		{
+			if (!test_submit(test, test_write_irp(test, FileIds[i], i, chunk)) ||
+			    !test_submit(test, test_read_irp(test, FileIds[i], i, chunk)))
+				goto fail;
+		}
+	}
+
+	if (!test_wait(test))
+		goto fail;
+
+	for (i = 0; i < TEST_FILES; i++)
+	{
+		if (test->next[i] != 2 * TEST_CHUNKS)
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	/* whatever is still queued has to finish before the files go away */
+	if (!rc)
+		test_wait(test);
+
+	for (i = 0; i < TEST_FILES; i++)
+	{
+		if (FileIds[i] && !test_close(test, FileIds[i]))
+			rc = FALSE;
+
+		sprintf_s(name, sizeof(name), "file%" PRIu32 ".bin", i);
+		{
+			char* path = GetCombinedPath(test->base, name);
+
+			if (path)
+				winpr_DeleteFile(path);
+
+			free(path);
+		}
+	}
+
+	if (!rc)
+		fprintf(stderr, "TestDriveWorkers: IRPs of one file ran out of order\n");
+
+	return rc;
+}
+
+/* returns the listed name in name, NULL at the end of the listing */
+static BOOL test_query_directory(TestDrive* test, UINT32 FileId, BOOL initial, char** name)
+{
+	int count = 0;
+	UINT32 length;
+	WCHAR* wpath = NULL;
+	wStream sbuffer = { 0 };
+	wStream* s;
+	IRP* irp = test_irp_new(test, FileId, 0, IRP_MJ_DIRECTORY_CONTROL, IRP_MN_QUERY_DIRECTORY);
+
+	*name = NULL;
+
+	if (!irp)
+		return FALSE;
+
+	Stream_Write_UINT32(irp->input, FileNamesInformation); /* FsInformationClass */
+	Stream_Write_UINT8(irp->input, initial ? 1 : 0);       /* InitialQuery */
+
+	/* only the initial query names the path */
+	if (initial)
+		count = ConvertToUnicode(CP_UTF8, 0, "\\dir\\*", -1, &wpath, 0);
+
+	if ((count < 0) || !Stream_EnsureRemainingCapacity(irp->input, 27 + count * sizeof(WCHAR)))
+	{
+		free(wpath);
+		test_irp_free(irp);
+		return FALSE;
+	}
+
+	Stream_Write_UINT32(irp->input, (UINT32)(count * sizeof(WCHAR))); /* PathLength */
+	Stream_Zero(irp->input, 23);                                     /* Padding */
+	Stream_Write(irp->input, wpath, count * sizeof(WCHAR));
+	free(wpath);
+
+	if (!test_submit(test, irp) || !test_wait(test))
+		return FALSE;
+
+	if (test->lastStatus == STATUS_NO_MORE_FILES)
+		return TRUE;
+
+	if (test->lastStatus != 0)
+		return FALSE;
+
+	/* Length, NextEntryOffset, FileIndex, FileNameLength, FileName */
+	s = Stream_StaticConstInit(&sbuffer, test->last, test->lastLength);
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, 16))
+		return FALSE;
+
+	Stream_Seek(s, 12);
+	Stream_Read_UINT32(s, length);
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, length) || (length == 0))
+		return FALSE;
+
+	return ConvertFromUnicode(CP_UTF8, 0, (const WCHAR*)Stream_Pointer(s),
+	                          (int)(length / sizeof(WCHAR)), name, 0, NULL, NULL) > 0;
+}
+
+/* lists the directory, counting each entry, after stop entries if stop is not 0 */
+static BOOL test_list(TestDrive* test, UINT32 FileId, size_t stop, UINT32* seen, size_t* count)
+{
+	char* name = NULL;
+	BOOL initial = TRUE;
+
+	*count = 0;
+
+	while (test_query_directory(test, FileId, initial, &name))
+	{
+		unsigned index;
+
+		initial = FALSE;
+
+		if (!name)
+			return TRUE;
+
+		if (sscanf(name, "f%03u", &index) == 1)
+		{
+			if (index < TEST_DIR_ENTRIES)
+				seen[index]++;
+		}
+		else if ((strcmp(name, ".") != 0) && (strcmp(name, "..") != 0))
+		{
+			free(name);
+			return FALSE;
+		}
+
+		free(name);
+
+		if ((++*count == stop) && (stop != 0))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Lists a directory larger than several batches, restarting once in the middle of
+ * the first batch. Every entry must be listed exactly once after the restart.
+ */
+static BOOL test_directory_batches(TestDrive* test)
+{
+	size_t i;
+	size_t count;
+	UINT32 FileId = 0;
+	char name[32];
+	char* dir;
+	BOOL rc = FALSE;
+	UINT32 seen[TEST_DIR_ENTRIES] = { 0 };
+
+	dir = GetCombinedPath(test->base, "dir");
+
+	if (!dir || !CreateDirectoryA(dir, NULL))
+		goto fail;
+
+	for (i = 0; i < TEST_DIR_ENTRIES; i++)
+	{
+		char* path;
+		HANDLE handle;
+
+		sprintf_s(name, sizeof(name), "f%03" PRIuz, i);
+		path = GetCombinedPath(dir, name);
+
+		if (!path)
+			goto fail;
+
+		handle = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL,
+		                     NULL);
+		free(path);
+
+		if (handle == INVALID_HANDLE_VALUE)
+			goto fail;
+
+		CloseHandle(handle);
+	}
+
+	FileId = test_create(test, "\\dir", FILE_OPEN, FILE_DIRECTORY_FILE);
+
+	if (FileId == 0)
+		goto fail;
+
+	if (!test_list(test, FileId, DRIVE_DIR_BATCH_SIZE / 4, seen, &count))
+		goto fail;
+
+	ZeroMemory(seen, sizeof(seen));
+
+	/* the directory itself and its parent are listed as well */
+	if (!test_list(test, FileId, 0, seen, &count) || (count != TEST_DIR_ENTRIES + 2))
+		goto fail;
+
+	for (i = 0; i < TEST_DIR_ENTRIES; i++)
+	{
+		if (seen[i] != 1)
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (FileId && !test_close(test, FileId))
+		rc = FALSE;
+
+	if (dir)
+	{
+		for (i = 0; i < TEST_DIR_ENTRIES; i++)
+		{
+			char* path;
+
+			sprintf_s(name, sizeof(name), "f%03" PRIuz, i);
+			path = GetCombinedPath(dir, name);
+
+			if (path)
+				winpr_DeleteFile(path);
+
+			free(path);
+		}
+
+		winpr_RemoveDirectory(dir);
+		free(dir);
+	}
+
+	if (!rc)
+		fprintf(stderr, "TestDriveWorkers: batched directory listing failed\n");
+
+	return rc;
+}
+
+static UINT test_register_device(DEVMAN* devman, DEVICE* device)
+{
+	TestDrive* test = (TestDrive*)devman;
+
+	test->device = device;
+	return CHANNEL_RC_OK;
+}
+
+int TestDriveWorkers(int argc, char* argv[])
+{
+	int rc = -1;
+	char name[64];
+	TestDrive* test;
+	RDPDR_DRIVE drive = { 0 };
+	DEVICE_SERVICE_ENTRY_POINTS entryPoints = { 0 };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	test = (TestDrive*)calloc(1, sizeof(TestDrive));
+
+	if (!test)
+		return -1;
+
+	if (!InitializeCriticalSectionAndSpinCount(&test->lock, 4000))
+	{
+		free(test);
+		return -1;
+	}
+
+	test->done = CreateEvent(NULL, TRUE, FALSE, NULL);
+	sprintf_s(name, sizeof(name), "TestDriveWorkers.%08" PRIX32, GetCurrentProcessId());
+	test->base = GetKnownSubPath(KNOWN_PATH_TEMP, name);
+
+	if (!test->done || !test->base || !CreateDirectoryA(test->base, NULL))
+		goto fail;
+
+	drive.device.Type = RDPDR_DTYP_FILESYSTEM;
+	drive.device.Name = "TEST";
+	drive.Path = test->base;
+	/* FileId 0 is the failed create */
+	test->devman.id_sequence = 1;
+	entryPoints.devman = &test->devman;
+	entryPoints.RegisterDevice = test_register_device;
+	entryPoints.device = &drive.device;
+
+	if ((drive_DeviceServiceEntry(&entryPoints) != CHANNEL_RC_OK) || !test->device)
+		goto fail;
+
+	if (!test_file_order(test) || !test_directory_batches(test))
+		goto fail;
+
+	rc = 0;
+fail:
+	if (test->device)
+		test->device->Free(test->device);
+
+	if (test->base)
+		winpr_RemoveDirectory(test->base);
+
+	if (rc != 0)
+		fprintf(stderr, "TestDriveWorkers failed\n");
+
+	if (test->done)
+		CloseHandle(test->done);
+
+	DeleteCriticalSection(&test->lock);
+	free(test->base);
+	free(test);
+	return rc;
+}
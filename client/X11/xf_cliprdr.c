@@ -1643,6 +1643,28 @@ xf_cliprdr_server_file_contents_response(CliprdrClientContext* context,
 	}
 	return CHANNEL_RC_OK;
 }
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_server_file_contents_read_complete(CliprdrClientContext* context,
+                                                          void* userdata, UINT error,
+                                                          const BYTE* data, UINT32 size)
+{
+	fuse_req_t req = (fuse_req_t)userdata;
+
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(req);
+
+	if (error)
+		fuse_reply_err(req, EIO);
+	else
+		fuse_reply_buf(req, (const char*)data, size);
+
+	return CHANNEL_RC_OK;
+}
 #endif
 
 /**
@@ -2692,38 +2714,6 @@ error:
 	return err;
 }
 
-static int xf_cliprdr_fuse_util_add_stream_list(xfClipboard* clipboard, fuse_req_t req,
-                                                UINT32* stream_id)
-{
-	int err = 0;
-	xfCliprdrFuseStream* stream;
-
-	WINPR_ASSERT(clipboard);
-	WINPR_ASSERT(stream_id);
-
-	stream = (xfCliprdrFuseStream*)calloc(1, sizeof(xfCliprdrFuseStream));
-	if (!stream)
-	{
-		err = ENOMEM;
-		return err;
-	}
-	ArrayList_Lock(clipboard->stream_list);
-	stream->req = req;
-	stream->req_type = FILECONTENTS_RANGE;
-	stream->stream_id = clipboard->current_stream_id;
-	*stream_id = stream->stream_id;
-	stream->req_ino = 0;
-	clipboard->current_stream_id++;
-	if (!ArrayList_Append(clipboard->stream_list, stream))
-	{
-		err = ENOMEM;
-		goto error;
-	}
-error:
-	ArrayList_Unlock(clipboard->stream_list);
-	return err;
-}
-
 static void xf_cliprdr_fuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
 {
 	int err;
@@ -2874,7 +2864,6 @@ static void xf_cliprdr_fuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, of
 	int err;
 	xfClipboard* clipboard = (xfClipboard*)fuse_req_userdata(req);
 	UINT32 lindex;
-	UINT32 stream_id;
 
 	WINPR_ASSERT(clipboard);
 
@@ -2885,18 +2874,12 @@ static void xf_cliprdr_fuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, of
 		return;
 	}
 
-	err = xf_cliprdr_fuse_util_add_stream_list(clipboard, req, &stream_id);
-	if (err)
-	{
-		fuse_reply_err(req, err);
-		return;
-	}
-
-	UINT32 nPositionLow = (off >> 0) & 0xFFFFFFFF;
-	UINT32 nPositionHigh = (off >> 32) & 0xFFFFFFFF;
-
-	xf_cliprdr_send_client_file_contents(clipboard, stream_id, lindex, FILECONTENTS_RANGE,
-	                                     nPositionLow, nPositionHigh, size);
+	/* the channel keeps the following ranges in flight while this one is read */
+	WINPR_ASSERT(clipboard->context);
+	WINPR_ASSERT(clipboard->context->ClientFileContentsRead);
+	if (clipboard->context->ClientFileContentsRead(clipboard->context, lindex, (UINT64)off,
+	                                               (UINT32)MIN(size, UINT32_MAX), req))
+		fuse_reply_err(req, EIO);
 }
 
 static void xf_cliprdr_fuse_lookup(fuse_req_t req, fuse_ino_t parent, const char* name)
@@ -3395,6 +3378,7 @@ void xf_cliprdr_init(xfContext* xfc, CliprdrClientContext* cliprdr)
 	cliprdr->ServerFileContentsRequest = xf_cliprdr_server_file_contents_request;
 #ifdef WITH_FUSE
 	cliprdr->ServerFileContentsResponse = xf_cliprdr_server_file_contents_response;
+	cliprdr->ServerFileContentsReadComplete = xf_cliprdr_server_file_contents_read_complete;
 #endif
 }
 
@@ -23,6 +23,18 @@
 
 typedef struct rdp_autodetect rdpAutoDetect;
 
+/* Smoothed network characteristics, see freerdp_get_network_characteristics */
+typedef struct
+{
+	UINT32 bandwidth;        /* kbit/s, 0 until a usable measurement completed */
+	UINT32 baseRTT;          /* lowest round trip time in ms */
+	UINT32 averageRTT;       /* smoothed round trip time in ms */
+	UINT32 rttVariation;     /* smoothed mean deviation of the round trip time in ms */
+	UINT32 rttSamples;       /* number of round trip measurements */
+	UINT32 bandwidthSamples; /* number of bandwidth measurements used */
+	UINT64 lastUpdate;       /* GetTickCount64() of the last measurement, 0 if none */
+} rdpNetworkCharacteristics;
+
 typedef BOOL (*pRTTMeasureRequest)(rdpContext* context, UINT16 sequenceNumber);
 typedef BOOL (*pRTTMeasureResponse)(rdpContext* context, UINT16 sequenceNumber);
 typedef BOOL (*pBandwidthMeasureStart)(rdpContext* context, UINT16 sequenceNumber);
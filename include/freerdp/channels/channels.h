@@ -27,6 +27,7 @@
 #include <freerdp/api.h>
 #include <freerdp/types.h>
 #include <freerdp/freerdp.h>
+#include <freerdp/utils/fair_queue.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -59,6 +60,17 @@ extern "C"
 	FREERDP_API UINT16 freerdp_channels_get_id_by_name(freerdp* instance, const char* channel_name);
 	FREERDP_API const char* freerdp_channels_get_name_by_id(freerdp* instance, UINT16 channelId);
 
+	/**
+	 * gets the send queue depth of a static channel
+	 *
+	 * @param channels the channel manager
+	 * @param name the static channel name
+	 * @param stats receives the statistics
+	 * @return FALSE if the channel is unknown
+	 */
+	FREERDP_API BOOL freerdp_channels_get_queue_stats(rdpChannels* channels, const char* name,
+	                                                  FairQueueStats* stats);
+
 	FREERDP_API const WtsApiFunctionTable* FreeRDP_InitWtsApi(void);
 
 #ifdef __cplusplus
@@ -85,6 +85,9 @@ typedef enum
 #define FILECONTENTS_SIZE 0x00000001
 #define FILECONTENTS_RANGE 0x00000002
 
+/* Stream ids issued by pipelined file contents reads, applications use lower ones */
+#define CLIPRDR_PIPELINE_FIRST_STREAM_ID 0x80000000
+
 #ifdef __cplusplus
 extern "C"
 {
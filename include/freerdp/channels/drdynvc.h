@@ -41,6 +41,24 @@ enum
 	TUNNELTYPE_UDPFECL = 0x00000003
 };
 
+/* defined in MS-RDPEDYC 2.2.1.1 Capabilities Request PDU (DYNVC_CAPS_VERSION*) */
+enum
+{
+	DYNVC_CAPS_VERSION1 = 0x0001,
+	DYNVC_CAPS_VERSION2 = 0x0002,
+	DYNVC_CAPS_VERSION3 = 0x0003
+};
+
+/* MS-RDPEDYC 2.2.3.3, uncompressed bytes carried by one compressed data PDU at most */
+#define DRDYNVC_COMPRESSED_CHUNK_LENGTH 1590
+
+/* MS-RDPEDYC 3.1.5.1.1, default priority charges of 65536 / percent, splitting bandwidth
+ * 70/20/7/3 percent */
+#define DRDYNVC_PRIORITY_CHARGE0 936
+#define DRDYNVC_PRIORITY_CHARGE1 3276
+#define DRDYNVC_PRIORITY_CHARGE2 9362
+#define DRDYNVC_PRIORITY_CHARGE3 21845
+
 /* @brief dynamic channel commands */
 typedef enum
 {
@@ -72,6 +72,8 @@ extern "C"
 	FREERDP_API void WTSVirtualChannelManagerSetDVCCreationCallback(HANDLE hServer,
 	                                                                psDVCCreationStatusCallback cb,
 	                                                                void* userdata);
+	/* Offers compressed DVC data (DYNVC version 3), call before WTSVirtualChannelManagerOpen */
+	FREERDP_API void WTSVirtualChannelManagerSetDVCCompression(HANDLE hServer, BOOL enable);
 
 	/**
 	 * Extended FreeRDP WTS functions for channel handling
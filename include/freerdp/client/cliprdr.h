@@ -74,6 +74,11 @@ typedef UINT (*pcCliprdrClientFileContentsResponse)(
     CliprdrClientContext* context, const CLIPRDR_FILE_CONTENTS_RESPONSE* fileContentsResponse);
 typedef UINT (*pcCliprdrServerFileContentsResponse)(
     CliprdrClientContext* context, const CLIPRDR_FILE_CONTENTS_RESPONSE* fileContentsResponse);
+typedef UINT (*pcCliprdrClientFileContentsRead)(CliprdrClientContext* context, UINT32 listIndex,
+                                                UINT64 offset, UINT32 length, void* userdata);
+typedef UINT (*pcCliprdrServerFileContentsReadComplete)(CliprdrClientContext* context,
+                                                        void* userdata, UINT error,
+                                                        const BYTE* data, UINT32 size);
 
 struct s_cliprdr_client_context
 {
@@ -101,6 +106,14 @@ struct s_cliprdr_client_context
 	pcCliprdrClientFileContentsResponse ClientFileContentsResponse;
 	pcCliprdrServerFileContentsResponse ServerFileContentsResponse;
 
+	/* Reads a range of a file of the server, keeping up to fileContentsWindow range requests
+	 * in flight. Every read ends with exactly one ServerFileContentsReadComplete, reads still
+	 * pending when the server clipboard changes fail with ERROR_INVALID_STATE. */
+	pcCliprdrClientFileContentsRead ClientFileContentsRead;
+	pcCliprdrServerFileContentsReadComplete ServerFileContentsReadComplete;
+	UINT32 fileContentsWindow;    /* set before the first read, 0 for the default */
+	UINT32 fileContentsChunkSize; /* set before the first read, 0 for the default */
+
 	UINT32 lastRequestedFormatId;
 	rdpContext* rdpcontext;
 };
@@ -22,6 +22,8 @@
 #ifndef FREERDP_CHANNEL_DRDYNVC_CLIENT_DRDYNVC_H
 #define FREERDP_CHANNEL_DRDYNVC_CLIENT_DRDYNVC_H
 
+#include <freerdp/utils/fair_queue.h>
+
 /**
  * Client Interface
  */
@@ -37,6 +39,8 @@ typedef UINT (*pcDrdynvcOnChannelAttached)(DrdynvcClientContext* context, const
                                            void* pInterface);
 typedef UINT (*pcDrdynvcOnChannelDetached)(DrdynvcClientContext* context, const char* name,
                                            void* pInterface);
+typedef BOOL (*pcDrdynvcGetChannelQueueStats)(DrdynvcClientContext* context, UINT32 ChannelId,
+                                              FairQueueStats* stats);
 
 struct s_drdynvc_client_context
 {
@@ -48,6 +52,7 @@ struct s_drdynvc_client_context
 	pcDrdynvcOnChannelDisconnected OnChannelDisconnected;
 	pcDrdynvcOnChannelAttached OnChannelAttached;
 	pcDrdynvcOnChannelDetached OnChannelDetached;
+	pcDrdynvcGetChannelQueueStats GetChannelQueueStats;
 };
 
 #endif /* FREERDP_CHANNEL_DRDYNVC_CLIENT_DRDYNVC_H */
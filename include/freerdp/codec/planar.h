@@ -97,8 +97,25 @@ struct S_BITMAP_PLANAR_CONTEXT
 
 	BOOL bgr;
 	BOOL topdown;
+
+	DWORD flags;
+	UINT32 maxRlePlaneSize;
+
+	/* Scratch contexts of freerdp_bitmap_planar_compress_tiles, one per thread */
+	BITMAP_PLANAR_CONTEXT** tileContexts;
+	UINT32 tileContextCount;
+	LONG volatile nextTileContext;
 };
 
+typedef struct
+{
+	const BYTE* data; /* first pixel of the tile, rows are scanline bytes apart */
+	UINT32 width;
+	UINT32 height;
+	BYTE* dstData;  /* caller provided output buffer */
+	UINT32 dstSize; /* in: size of dstData, out: compressed size */
+} PLANAR_TILE;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -109,6 +126,20 @@ extern "C"
 	                                                 UINT32 height, UINT32 scanline, BYTE* dstData,
 	                                                 UINT32* pDstSize);
 
+	/**
+	 * Upper bound of the compressed size of a width x height bitmap. Content that does not
+	 * compress is sent as raw planes.
+	 */
+	FREERDP_API UINT32 freerdp_bitmap_planar_max_size(UINT32 width, UINT32 height);
+
+	/**
+	 * Compresses count tiles of up to the context size in one call, in parallel on the default
+	 * thread pool. Fails if a tile does not fit its dstData.
+	 */
+	FREERDP_API BOOL freerdp_bitmap_planar_compress_tiles(BITMAP_PLANAR_CONTEXT* context,
+	                                                      UINT32 format, UINT32 scanline,
+	                                                      PLANAR_TILE* tiles, size_t count);
+
 	FREERDP_API BOOL freerdp_bitmap_planar_context_reset(BITMAP_PLANAR_CONTEXT* context,
 	                                                     UINT32 width, UINT32 height);
 
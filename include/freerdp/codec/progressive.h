@@ -43,6 +43,31 @@ extern "C"
 	                                     const REGION16* invalidRegion, BYTE** ppDstData,
 	                                     UINT32* pDstSize);
 
+	/**
+	 * Multi pass encoding of a surface created with progressive_create_surface_context.
+	 * Tiles touched by invalidRegion are sent as RFX_PROGRESSIVE_TILE_FIRST at the first
+	 * quality of the ladder, progressive_compress_upgrade refines them one ladder step per
+	 * call with RFX_PROGRESSIVE_TILE_UPGRADE. Without a ladder this is progressive_compress.
+	 */
+	FREERDP_API int progressive_compress_surface(PROGRESSIVE_CONTEXT* progressive,
+	                                             UINT16 surfaceId, const BYTE* pSrcData,
+	                                             UINT32 SrcSize, UINT32 SrcFormat, UINT32 Width,
+	                                             UINT32 Height, UINT32 ScanLine,
+	                                             const REGION16* invalidRegion, BYTE** ppDstData,
+	                                             UINT32* pDstSize);
+
+	/** @return 1 if an upgrade pass was encoded, 0 if all tiles are at the final quality */
+	FREERDP_API int progressive_compress_upgrade(PROGRESSIVE_CONTEXT* progressive,
+	                                             UINT16 surfaceId, BYTE** ppDstData,
+	                                             UINT32* pDstSize);
+
+	/**
+	 * Set the qualities (strictly ascending, 1 - 100, at most 16) of the encoder passes.
+	 * An empty ladder disables multi pass encoding.
+	 */
+	FREERDP_API BOOL progressive_set_quality_ladder(PROGRESSIVE_CONTEXT* progressive,
+	                                                const BYTE* qualities, size_t count);
+
 	FREERDP_API INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData,
 	                                         UINT32 SrcSize, BYTE* pDstData, UINT32 DstFormat,
 	                                         UINT32 nDstStep, UINT32 nXDst, UINT32 nYDst,
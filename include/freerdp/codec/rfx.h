@@ -189,6 +189,21 @@ extern "C"
 	FREERDP_API BOOL rfx_write_message(RFX_CONTEXT* context, wStream* s,
 	                                   const RFX_MESSAGE* message);
 
+	/**
+	 * Writes the sync, context, codec versions and channels blocks if they
+	 * have not yet been sent on this context. Allows frame data encoded once
+	 * to be prefixed with the per-connection headers.
+	 */
+	FREERDP_API BOOL rfx_write_message_header(RFX_CONTEXT* context, wStream* s);
+
+	/**
+	 * Writes frame data written by rfx_write_message on another context, after the
+	 * headers of this one. The frame index in the data is replaced by the next frame
+	 * index of this context.
+	 */
+	FREERDP_API BOOL rfx_write_encoded_message(RFX_CONTEXT* context, wStream* s,
+	                                           const BYTE* data, size_t length);
+
 	FREERDP_API BOOL rfx_context_reset(RFX_CONTEXT* context, UINT32 width, UINT32 height);
 
 	FREERDP_API RFX_CONTEXT* rfx_context_new_ex(BOOL encoder, UINT32 ThreadingFlags);
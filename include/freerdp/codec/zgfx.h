@@ -32,6 +32,12 @@
 
 #define ZGFX_SEGMENTED_MAXSIZE 65535
 
+/* Compressor speed/ratio trade-off, 0 stores segments uncompressed */
+#define ZGFX_LEVEL_NONE 0
+#define ZGFX_LEVEL_FAST 1
+#define ZGFX_LEVEL_DEFAULT 4
+#define ZGFX_LEVEL_BEST 9
+
 typedef struct S_ZGFX_CONTEXT ZGFX_CONTEXT;
 
 #ifdef __cplusplus
@@ -47,6 +53,15 @@ extern "C"
 	                                        const BYTE* pUncompressed, UINT32 uncompressedSize,
 	                                        UINT32* pFlags);
 
+	/* A single RDP8_BULK_ENCODED_DATA without the RDP_SEGMENTED_DATA descriptor, as used by
+	 * compressed dynamic channel data */
+	FREERDP_API int zgfx_decompress_bulk(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize,
+	                                     BYTE** ppDstData, UINT32* pDstSize);
+	FREERDP_API int zgfx_compress_bulk_to_stream(ZGFX_CONTEXT* zgfx, wStream* sDst,
+	                                             const BYTE* pUncompressed,
+	                                             UINT32 uncompressedSize, UINT32* pFlags);
+
+	FREERDP_API BOOL zgfx_context_set_level(ZGFX_CONTEXT* zgfx, UINT32 level);
 	FREERDP_API void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush);
 
 	FREERDP_API ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor);
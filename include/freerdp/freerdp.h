@@ -590,6 +590,14 @@ owned by rdpRdp */
 
 	FREERDP_API ULONG freerdp_get_transport_sent(rdpContext* context, BOOL resetCount);
 
+	/** Current network characteristics of the connection.
+	 *  A server measures them continuously during the session if the client announced
+	 *  support for network autodetection and FreeRDP_NetworkAutoDetect is set, a client
+	 *  reports what the server sent in the Network Characteristics Result PDU.
+	 */
+	FREERDP_API BOOL freerdp_get_network_characteristics(rdpContext* context,
+	                                                     rdpNetworkCharacteristics* netchar);
+
 	FREERDP_API BOOL freerdp_nla_impersonate(rdpContext* context);
 	FREERDP_API BOOL freerdp_nla_revert_to_self(rdpContext* context);
 
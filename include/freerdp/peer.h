@@ -74,6 +74,8 @@ typedef void* (*psPeerVirtualChannelGetData)(freerdp_peer* peer, HANDLE hChannel
 typedef int (*psPeerVirtualChannelSetData)(freerdp_peer* peer, HANDLE hChannel, void* data);
 typedef BOOL (*psPeerSetState)(freerdp_peer* peer, CONNECTION_STATE state);
 typedef BOOL (*psPeerReachedState)(freerdp_peer* peer, CONNECTION_STATE state);
+typedef BOOL (*psPeerBeginWriteBatch)(freerdp_peer* peer);
+typedef BOOL (*psPeerEndWriteBatch)(freerdp_peer* peer);
 
 /** @brief the result of the license callback */
 typedef enum
@@ -172,6 +174,16 @@ struct rdp_freerdp_peer
 	ALIGN64 psPeerSetState SetState;
 	ALIGN64 psPeerReachedState ReachedState;
 	ALIGN64 psSspiNtlmHashCallback SspiNtlmHashCallback;
+
+	/**
+	 * @brief BeginWriteBatch and EndWriteBatch bracket a burst of PDUs.
+	 *
+	 * PDUs sent in between are coalesced into as few TLS records as possible. The queued
+	 * data is sent when the outermost batch ends, when DrainOutputBuffer is called or when it
+	 * gets too large or too old. Batches nest.
+	 */
+	ALIGN64 psPeerBeginWriteBatch BeginWriteBatch;
+	ALIGN64 psPeerEndWriteBatch EndWriteBatch;
 };
 
 #ifdef __cplusplus
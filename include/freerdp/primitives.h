@@ -142,6 +142,13 @@ typedef pstatus_t (*__RGBToAVC444YUV_t)(const BYTE* pSrc, UINT32 srcFormat, UINT
                                         const prim_size_t* roi);
 typedef pstatus_t (*__andC_32u_t)(const UINT32* pSrc, UINT32 val, UINT32* pDst, INT32 len);
 typedef pstatus_t (*__orC_32u_t)(const UINT32* pSrc, UINT32 val, UINT32* pDst, INT32 len);
+typedef pstatus_t (*__compareTiles_32u_t)(const BYTE* pSrc1, UINT32 src1Step, const BYTE* pSrc2,
+                                          UINT32 src2Step, UINT32 width, /* pixels */
+                                          UINT32 height, BYTE* pDirty);
+typedef pstatus_t (*__splitPlanes_8u_t)(const BYTE* pSrc, INT32 srcStep, UINT32 srcFormat,
+                                        BYTE* pDst[4], UINT32 width, UINT32 height);
+typedef pstatus_t (*__deltaEncodePlane_8u_t)(const BYTE* pSrc, BYTE* pDst, UINT32 width,
+                                             UINT32 height);
 typedef pstatus_t (*primitives_uninit_t)(void);
 
 typedef struct
@@ -185,6 +192,11 @@ typedef struct
 	__YUV444ToRGB_8u_P3AC4R_t YUV444ToRGB_8u_P3AC4R;
 	__RGBToAVC444YUV_t RGBToAVC444YUV;
 	__RGBToAVC444YUV_t RGBToAVC444YUVv2;
+	/* Damage detection, one dirty flag per 16 pixel wide tile */
+	__compareTiles_32u_t compareTiles_32u;
+	/* Planar codec, A/R/G/B plane split and delta encoding */
+	__splitPlanes_8u_t splitPlanes_8u;
+	__deltaEncodePlane_8u_t deltaEncodePlane_8u;
 	/* flags */
 	DWORD flags;
 	primitives_uninit_t uninit;
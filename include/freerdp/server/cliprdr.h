@@ -82,6 +82,11 @@ typedef UINT (*psCliprdrClientFileContentsResponse)(
     CliprdrServerContext* context, const CLIPRDR_FILE_CONTENTS_RESPONSE* fileContentsResponse);
 typedef UINT (*psCliprdrServerFileContentsResponse)(
     CliprdrServerContext* context, const CLIPRDR_FILE_CONTENTS_RESPONSE* fileContentsResponse);
+typedef UINT (*psCliprdrServerFileContentsRead)(CliprdrServerContext* context, UINT32 listIndex,
+                                                UINT64 offset, UINT32 length, void* userdata);
+typedef UINT (*psCliprdrClientFileContentsReadComplete)(CliprdrServerContext* context,
+                                                        void* userdata, UINT error,
+                                                        const BYTE* data, UINT32 size);
 
 struct s_cliprdr_server_context
 {
@@ -127,6 +132,14 @@ struct s_cliprdr_server_context
 	BOOL autoInitializationSequence;
 	UINT32 lastRequestedFormatId;
 	BOOL hasHugeFileSupport;
+
+	/* Reads a range of a file of the client, keeping up to fileContentsWindow range requests
+	 * in flight. Every read ends with exactly one ClientFileContentsReadComplete, reads still
+	 * pending when the client clipboard changes fail with ERROR_INVALID_STATE. */
+	psCliprdrServerFileContentsRead ServerFileContentsRead;
+	psCliprdrClientFileContentsReadComplete ClientFileContentsReadComplete;
+	UINT32 fileContentsWindow;    /* set before the first read, 0 for the default */
+	UINT32 fileContentsChunkSize; /* set before the first read, 0 for the default */
 };
 
 #ifdef __cplusplus
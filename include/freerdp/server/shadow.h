@@ -48,6 +48,9 @@ typedef struct rdp_shadow_server rdpShadowServer;
 typedef struct rdp_shadow_screen rdpShadowScreen;
 typedef struct rdp_shadow_surface rdpShadowSurface;
 typedef struct rdp_shadow_encoder rdpShadowEncoder;
+typedef struct rdp_shadow_encode_cache rdpShadowEncodeCache;
+typedef struct rdp_shadow_classifier rdpShadowClassifier;
+typedef struct rdp_shadow_broadcast rdpShadowBroadcast;
 typedef struct rdp_shadow_capture rdpShadowCapture;
 typedef struct rdp_shadow_subsystem rdpShadowSubsystem;
 typedef struct rdp_shadow_multiclient_event rdpShadowMultiClientEvent;
@@ -129,6 +132,9 @@ struct rdp_shadow_server
 	rdpShadowSurface* surface;
 	rdpShadowSurface* lobby;
 	rdpShadowCapture* capture;
+	rdpShadowEncodeCache* encodeCache;
+	rdpShadowClassifier* classifier;
+	rdpShadowBroadcast* broadcast;
 	rdpShadowSubsystem* subsystem;
 
 	DWORD port;
@@ -145,6 +151,12 @@ struct rdp_shadow_server
 	UINT32 h264BitRate;
 	UINT32 h264FrameRate;
 	UINT32 h264QP;
+	BOOL gfxClear;
+	BOOL gfxAdaptive;
+	BOOL gfxBroadcast;
+	/* Qualities of the GFX progressive passes, see progressive_set_quality_ladder */
+	BYTE progressiveLadder[16];
+	UINT32 progressiveLadderCount;
 
 	char* ipcSocket;
 	char* ConfigPath;
@@ -165,6 +177,7 @@ struct rdp_shadow_surface
 	UINT32 scanline;
 	DWORD format;
 	BYTE* data;
+	UINT32 frameSequence;
 
 	CRITICAL_SECTION lock;
 	REGION16 invalidRegion;
@@ -277,6 +290,22 @@ typedef struct
 	UINT16 right;
 } SHADOW_MSG_OUT_AUDIO_OUT_VOLUME;
 
+/* Decisions and inputs of the per client rate controller, see shadow_encoder_get_rate_metrics */
+typedef struct
+{
+	UINT32 fps;            /* capture rate suggested to the subsystem */
+	UINT32 bitRate;        /* H.264 target in bit/s */
+	UINT32 quality;        /* 0 is the default RFX quantization, higher is coarser */
+	UINT32 ackLatency;     /* smoothed frame acknowledge latency in ms */
+	UINT32 baseLatency;    /* lowest recent acknowledge latency in ms */
+	UINT32 bandwidth;      /* kbit/s from autodetect or acknowledged throughput, 0 if unknown */
+	UINT32 inflightFrames; /* frames sent but not yet acknowledged */
+	UINT64 inflightBytes;  /* bytes of those frames */
+	UINT64 framesSent;
+	UINT64 framesDeferred; /* updates postponed because the connection was congested */
+	UINT64 writeBlocked;   /* updates that found the socket backed up */
+} SHADOW_RATE_METRICS;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -311,6 +340,14 @@ extern "C"
 	                                       UINT32 nHeight, BYTE* pData2, UINT32 nStep2,
 	                                       RECTANGLE_16* rect);
 
+	/** Compare two 32bpp images in 16x16 tiles and store the changed tiles in \b region
+	 *  \return 1 if anything changed, 0 if the images are equal, -1 on failure
+	 */
+	FREERDP_API int shadow_capture_compare_region(const BYTE* pData1, UINT32 nStep1,
+	                                              UINT32 nWidth, UINT32 nHeight,
+	                                              const BYTE* pData2, UINT32 nStep2,
+	                                              REGION16* region);
+
 	FREERDP_API void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem);
 
 	FREERDP_API BOOL shadow_client_post_msg(rdpShadowClient* client, void* context, UINT32 type,
@@ -321,6 +358,8 @@ extern "C"
 
 	FREERDP_API UINT32 shadow_encoder_preferred_fps(rdpShadowEncoder* encoder);
 	FREERDP_API UINT32 shadow_encoder_inflight_frames(rdpShadowEncoder* encoder);
+	FREERDP_API BOOL shadow_encoder_get_rate_metrics(rdpShadowEncoder* encoder,
+	                                                 SHADOW_RATE_METRICS* metrics);
 
 	FREERDP_API BOOL shadow_screen_resize(rdpShadowScreen* screen);
 
@@ -0,0 +1,139 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Weighted fair queue
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_UTILS_FAIR_QUEUE_H
+#define FREERDP_UTILS_FAIR_QUEUE_H
+
+#include <winpr/wtypes.h>
+#include <freerdp/api.h>
+
+/** @brief a queue of items spread over flows, each flow gets bandwidth by its weight */
+typedef struct s_fair_queue FairQueue;
+
+/** @brief a piece of a queued item, as returned by fair_queue_next() */
+typedef struct
+{
+	UINT32 flow;
+	void* item;
+	size_t offset;
+	size_t length;
+	size_t total;
+} FairQueueChunk;
+
+/** @brief queue depth and throughput of a flow */
+typedef struct
+{
+	UINT32 weight;
+	size_t queuedItems;
+	size_t queuedBytes;
+	size_t maxQueuedBytes;
+	UINT64 sentItems;
+	UINT64 sentBytes;
+} FairQueueStats;
+
+#define FAIR_QUEUE_DEFAULT_WEIGHT 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	/**
+	 * creates an empty fair queue, the queue is synchronized
+	 *
+	 * @return the new queue or NULL in case of OOM
+	 */
+	FREERDP_API FairQueue* fair_queue_new(void);
+
+	/**
+	 * destroys a fair queue, items still queued are not freed
+	 *
+	 * @param queue the queue
+	 */
+	FREERDP_API void fair_queue_free(FairQueue* queue);
+
+	/**
+	 * sets the weight of a flow, a flow of weight 2 gets twice the bytes of a flow of weight 1
+	 * while both have data queued. Unknown flows are created.
+	 *
+	 * @param queue the queue
+	 * @param flow the flow identifier
+	 * @param weight the weight, at least 1
+	 * @return if the operation was successful
+	 */
+	FREERDP_API BOOL fair_queue_set_weight(FairQueue* queue, UINT32 flow, UINT32 weight);
+
+	/**
+	 * appends an item to a flow, items of one flow leave in order
+	 *
+	 * @param queue the queue
+	 * @param flow the flow identifier, unknown flows are created with the default weight
+	 * @param item the item, owned by the queue until its last chunk is returned
+	 * @param length the item size in bytes, not 0
+	 * @return if the operation was successful
+	 */
+	FREERDP_API BOOL fair_queue_push(FairQueue* queue, UINT32 flow, void* item, size_t length);
+
+	/**
+	 * picks the next chunk to send. When the chunk ends its item, the item is
+	 * removed from the queue and belongs to the caller again.
+	 *
+	 * @param queue the queue
+	 * @param maxChunk the largest chunk to return, 0 returns whole items
+	 * @param chunk receives the chunk
+	 * @return FALSE if the queue is empty
+	 */
+	FREERDP_API BOOL fair_queue_next(FairQueue* queue, size_t maxChunk, FairQueueChunk* chunk);
+
+	/**
+	 * removes the head item of any flow without sending it, used to flush a queue
+	 *
+	 * @param queue the queue
+	 * @param flow receives the flow of the item, may be NULL
+	 * @return the item or NULL if the queue is empty
+	 */
+	FREERDP_API void* fair_queue_pop(FairQueue* queue, UINT32* flow);
+
+	/**
+	 * @param queue the queue
+	 * @return the number of items queued over all flows
+	 */
+	FREERDP_API size_t fair_queue_count(FairQueue* queue);
+
+	/**
+	 * gets the queue depth of a flow
+	 *
+	 * @param queue the queue
+	 * @param flow the flow identifier
+	 * @param stats receives the statistics
+	 * @return FALSE if the flow is unknown
+	 */
+	FREERDP_API BOOL fair_queue_get_stats(FairQueue* queue, UINT32 flow, FairQueueStats* stats);
+
+	/**
+	 * forgets a flow, its queued items are not freed
+	 *
+	 * @param queue the queue
+	 * @param flow the flow identifier
+	 */
+	FREERDP_API void fair_queue_remove_flow(FairQueue* queue, UINT32 flow);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_UTILS_FAIR_QUEUE_H */
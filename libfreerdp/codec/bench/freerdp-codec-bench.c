@@ -0,0 +1,1698 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Codec Benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/image.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/stream.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/bulk.h>
+#include <freerdp/codec/color.h>
+#include <freerdp/codec/rfx.h>
+#include <freerdp/codec/nsc.h>
+#include <freerdp/codec/planar.h>
+#include <freerdp/codec/interleaved.h>
+#include <freerdp/codec/clear.h>
+#include <freerdp/codec/progressive.h>
+#include <freerdp/codec/yuv.h>
+#include <freerdp/codec/zgfx.h>
+
+#include "../mppc.h"
+#include "../ncrush.h"
+#include "../xcrush.h"
+
+#define BENCH_FORMAT PIXEL_FORMAT_BGRX32
+#define BENCH_TILE_SIZE 64
+#define BENCH_BULK_CHUNK_SIZE 16000 /* bulk compression is only applied below 16384 bytes */
+#define BENCH_BULK_BUFFER_SIZE 65536
+
+typedef struct
+{
+	char* source;
+	UINT32 width;
+	UINT32 height;
+	UINT32 step;
+	size_t count;
+	BYTE** frames;
+} BENCH_CORPUS;
+
+/* A unit of encoded data, a whole message or one tile / chunk of a frame */
+typedef struct
+{
+	BYTE* data;
+	size_t size;
+	size_t capacity;
+	UINT32 flags;
+	RECTANGLE_16 rect;
+} BENCH_PACKET;
+
+typedef struct
+{
+	BENCH_PACKET* packets;
+	size_t count;
+	size_t capacity;
+} BENCH_OUTPUT;
+
+typedef struct
+{
+	const BENCH_CORPUS* corpus;
+	BOOL encoder;
+	UINT32 threadingFlags;
+	void* codec;
+	wStream* s;
+	BYTE* buffer;
+	BYTE* planes[2][3];
+	UINT32 strides[3];
+	UINT32 frameId;
+} BENCH_CONTEXT;
+
+typedef struct
+{
+	const char* name;
+	/* Create the codec in ctx->codec */
+	BOOL (*init)(BENCH_CONTEXT* ctx);
+	void (*uninit)(BENCH_CONTEXT* ctx);
+	/* Encode a frame, the packets produced are appended to out */
+	BOOL (*encode)(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out);
+	/* Decode the packets of a frame into dst */
+	BOOL (*decode)(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst);
+	/* Return a decoder to its initial state, NULL for codecs without history */
+	void (*reset)(BENCH_CONTEXT* ctx);
+} BENCH_CODEC;
+
+typedef struct
+{
+	UINT32 threads;
+	UINT64 milliseconds;
+	UINT64 frames;
+	UINT64 bytes;
+} BENCH_RESULT;
+
+typedef struct
+{
+	const BENCH_CODEC* codec;
+	const BENCH_CORPUS* corpus;
+	const BENCH_OUTPUT* encoded;
+	UINT32 threadingFlags;
+	BOOL encode;
+	UINT32 passes;
+	HANDLE ready;
+	HANDLE start;
+	HANDLE done;
+	BOOL rc;
+} BENCH_WORKER;
+
+/* ------------------------------------------------------------------------- */
+static BOOL bench_output_append(BENCH_OUTPUT* out, const BYTE* data, size_t size, UINT32 flags,
+                                UINT32 x, UINT32 y, UINT32 width, UINT32 height)
+{
+	BENCH_PACKET* packet;
+
+	if (out->count == out->capacity)
+	{
+		const size_t capacity = out->capacity ? out->capacity * 2 : 16;
+		BENCH_PACKET* tmp = realloc(out->packets, capacity * sizeof(BENCH_PACKET));
+
+		if (!tmp)
+			return FALSE;
+
+		ZeroMemory(&tmp[out->count], (capacity - out->count) * sizeof(BENCH_PACKET));
+		out->packets = tmp;
+		out->capacity = capacity;
+	}
+
+	packet = &out->packets[out->count];
+
+	/* Buffers are kept when an output is cleared, reuse them */
+	if (packet->capacity < size)
+	{
+		BYTE* tmp = realloc(packet->data, size);
+
+		if (!tmp)
+			return FALSE;
+
+		packet->data = tmp;
+		packet->capacity = size;
+	}
+
+	if (size > 0)
+		CopyMemory(packet->data, data, size);
+
+	packet->size = size;
+	packet->flags = flags;
+	packet->rect.left = (UINT16)x;
+	packet->rect.top = (UINT16)y;
+	packet->rect.right = (UINT16)(x + width);
+	packet->rect.bottom = (UINT16)(y + height);
+	out->count++;
+	return TRUE;
+}
+
+static size_t bench_output_size(const BENCH_OUTPUT* out)
+{
+	size_t x;
+	size_t size = 0;
+
+	for (x = 0; x < out->count; x++)
+		size += out->packets[x].size;
+
+	return size;
+}
+
+static void bench_output_free(BENCH_OUTPUT* outputs, size_t count)
+{
+	size_t x, y;
+
+	if (!outputs)
+		return;
+
+	for (x = 0; x < count; x++)
+	{
+		for (y = 0; y < outputs[x].capacity; y++)
+			free(outputs[x].packets[y].data);
+
+		free(outputs[x].packets);
+	}
+
+	free(outputs);
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL bench_rfx_init(BENCH_CONTEXT* ctx)
+{
+	RFX_CONTEXT* rfx = rfx_context_new_ex(ctx->encoder, ctx->threadingFlags);
+
+	ctx->codec = rfx;
+
+	if (!rfx || !rfx_context_reset(rfx, ctx->corpus->width, ctx->corpus->height))
+		return FALSE;
+
+	rfx->mode = RLGR3;
+	rfx_context_set_pixel_format(rfx, BENCH_FORMAT);
+	return TRUE;
+}
+
+static void bench_rfx_uninit(BENCH_CONTEXT* ctx)
+{
+	rfx_context_free(ctx->codec);
+}
+
+static BOOL bench_rfx_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	const RFX_RECT rect = { 0, 0, (UINT16)ctx->corpus->width, (UINT16)ctx->corpus->height };
+
+	Stream_SetPosition(ctx->s, 0);
+
+	if (!rfx_compose_message(ctx->codec, ctx->s, &rect, 1, frame, ctx->corpus->width,
+	                         ctx->corpus->height, ctx->corpus->step))
+		return FALSE;
+
+	return bench_output_append(out, Stream_Buffer(ctx->s), Stream_GetPosition(ctx->s), 0, 0, 0,
+	                           ctx->corpus->width, ctx->corpus->height);
+}
+
+static BOOL bench_rfx_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	size_t x;
+
+	for (x = 0; x < in->count; x++)
+	{
+		const BENCH_PACKET* packet = &in->packets[x];
+
+		if (!rfx_process_message(ctx->codec, packet->data, (UINT32)packet->size, 0, 0, dst,
+		                         BENCH_FORMAT, ctx->corpus->step, ctx->corpus->height, NULL))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL bench_nsc_init(BENCH_CONTEXT* ctx)
+{
+	NSC_CONTEXT* nsc = nsc_context_new();
+
+	ctx->codec = nsc;
+
+	if (!nsc || !nsc_context_reset(nsc, ctx->corpus->width, ctx->corpus->height))
+		return FALSE;
+
+	/* Same parameters as the shadow server */
+	if (!nsc_context_set_parameters(nsc, NSC_COLOR_LOSS_LEVEL, 3) ||
+	    !nsc_context_set_parameters(nsc, NSC_ALLOW_SUBSAMPLING, 1) ||
+	    !nsc_context_set_parameters(nsc, NSC_DYNAMIC_COLOR_FIDELITY, 1) ||
+	    !nsc_context_set_parameters(nsc, NSC_COLOR_FORMAT, BENCH_FORMAT))
+		return FALSE;
+
+	return TRUE;
+}
+
+static void bench_nsc_uninit(BENCH_CONTEXT* ctx)
+{
+	nsc_context_free(ctx->codec);
+}
+
+static BOOL bench_nsc_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	Stream_SetPosition(ctx->s, 0);
+
+	if (!nsc_compose_message(ctx->codec, ctx->s, frame, ctx->corpus->width, ctx->corpus->height,
+	                         ctx->corpus->step))
+		return FALSE;
+
+	return bench_output_append(out, Stream_Buffer(ctx->s), Stream_GetPosition(ctx->s), 0, 0, 0,
+	                           ctx->corpus->width, ctx->corpus->height);
+}
+
+static BOOL bench_nsc_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	size_t x;
+
+	for (x = 0; x < in->count; x++)
+	{
+		const BENCH_PACKET* packet = &in->packets[x];
+
+		if (!nsc_process_message(ctx->codec, 32, ctx->corpus->width, ctx->corpus->height,
+		                         packet->data, (UINT32)packet->size, dst, BENCH_FORMAT,
+		                         ctx->corpus->step, 0, 0, ctx->corpus->width, ctx->corpus->height,
+		                         FREERDP_FLIP_NONE))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Planar and interleaved are used for bitmap updates, which the shadow server
+ * splits into 64x64 tiles. */
+static BOOL bench_planar_init(BENCH_CONTEXT* ctx)
+{
+	BITMAP_PLANAR_CONTEXT* planar = freerdp_bitmap_planar_context_new(
+	    PLANAR_FORMAT_HEADER_RLE, BENCH_TILE_SIZE, BENCH_TILE_SIZE);
+
+	ctx->codec = planar;
+
+	if (!planar)
+		return FALSE;
+
+	freerdp_planar_topdown_image(planar, TRUE);
+	ctx->buffer = malloc(BENCH_TILE_SIZE * BENCH_TILE_SIZE * 4 * 2);
+	return ctx->buffer != NULL;
+}
+
+static void bench_planar_uninit(BENCH_CONTEXT* ctx)
+{
+	freerdp_bitmap_planar_context_free(ctx->codec);
+}
+
+static BOOL bench_planar_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	UINT32 x, y;
+	const BENCH_CORPUS* corpus = ctx->corpus;
+
+	for (y = 0; y < corpus->height; y += BENCH_TILE_SIZE)
+	{
+		const UINT32 h = MIN(BENCH_TILE_SIZE, corpus->height - y);
+
+		for (x = 0; x < corpus->width; x += BENCH_TILE_SIZE)
+		{
+			const UINT32 w = MIN(BENCH_TILE_SIZE, corpus->width - x);
+			const BYTE* src = &frame[y * corpus->step + x * 4];
+			UINT32 size = BENCH_TILE_SIZE * BENCH_TILE_SIZE * 4 * 2;
+
+			if (!freerdp_bitmap_compress_planar(ctx->codec, src, BENCH_FORMAT, w, h, corpus->step,
+			                                    ctx->buffer, &size))
+				return FALSE;
+
+			if (!bench_output_append(out, ctx->buffer, size, 0, x, y, w, h))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL bench_planar_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	size_t x;
+
+	for (x = 0; x < in->count; x++)
+	{
+		const BENCH_PACKET* packet = &in->packets[x];
+		const UINT32 w = packet->rect.right - packet->rect.left;
+		const UINT32 h = packet->rect.bottom - packet->rect.top;
+
+		if (!planar_decompress(ctx->codec, packet->data, (UINT32)packet->size, w, h, dst,
+		                       BENCH_FORMAT, ctx->corpus->step, packet->rect.left, packet->rect.top,
+		                       w, h, FALSE))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL bench_interleaved_init(BENCH_CONTEXT* ctx)
+{
+	ctx->codec = bitmap_interleaved_context_new(ctx->encoder);
+
+	if (!ctx->codec)
+		return FALSE;
+
+	ctx->buffer = malloc(BENCH_TILE_SIZE * BENCH_TILE_SIZE * 4);
+	return ctx->buffer != NULL;
+}
+
+static void bench_interleaved_uninit(BENCH_CONTEXT* ctx)
+{
+	bitmap_interleaved_context_free(ctx->codec);
+}
+
+static BOOL bench_interleaved_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	UINT32 x, y;
+	const BENCH_CORPUS* corpus = ctx->corpus;
+
+	for (y = 0; y < corpus->height; y += BENCH_TILE_SIZE)
+	{
+		const UINT32 h = MIN(BENCH_TILE_SIZE, corpus->height - y);
+
+		for (x = 0; x < corpus->width; x += BENCH_TILE_SIZE)
+		{
+			/* The encoder requires a width that is a multiple of 4 */
+			const UINT32 w = MIN(BENCH_TILE_SIZE, corpus->width - x) & ~3u;
+			UINT32 size = BENCH_TILE_SIZE * BENCH_TILE_SIZE * 4;
+
+			if (w == 0)
+				continue;
+
+			if (!interleaved_compress(ctx->codec, ctx->buffer, &size, w, h, frame, BENCH_FORMAT,
+			                          corpus->step, x, y, NULL, 24))
+				return FALSE;
+
+			if (!bench_output_append(out, ctx->buffer, size, 0, x, y, w, h))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL bench_interleaved_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	size_t x;
+
+	for (x = 0; x < in->count; x++)
+	{
+		const BENCH_PACKET* packet = &in->packets[x];
+		const UINT32 w = packet->rect.right - packet->rect.left;
+		const UINT32 h = packet->rect.bottom - packet->rect.top;
+
+		if (!interleaved_decompress(ctx->codec, packet->data, (UINT32)packet->size, w, h, 24, dst,
+		                            BENCH_FORMAT, ctx->corpus->step, packet->rect.left,
+		                            packet->rect.top, w, h, NULL))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL bench_clear_init(BENCH_CONTEXT* ctx)
+{
+	ctx->codec = clear_context_new(ctx->encoder);
+	return ctx->codec != NULL;
+}
+
+static void bench_clear_uninit(BENCH_CONTEXT* ctx)
+{
+	clear_context_free(ctx->codec);
+}
+
+static BOOL bench_clear_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	BYTE* data = NULL;
+	UINT32 size = 0;
+	const BENCH_CORPUS* corpus = ctx->corpus;
+
+	if (clear_compress(ctx->codec, frame, corpus->step * corpus->height, BENCH_FORMAT,
+	                   corpus->width, corpus->height, corpus->step, &data, &size) < 0)
+		return FALSE;
+
+	if (!data || (size == 0))
+		return FALSE;
+
+	return bench_output_append(out, data, size, 0, 0, 0, corpus->width, corpus->height);
+}
+
+static BOOL bench_clear_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	size_t x;
+	const BENCH_CORPUS* corpus = ctx->corpus;
+
+	for (x = 0; x < in->count; x++)
+	{
+		const BENCH_PACKET* packet = &in->packets[x];
+
+		if (clear_decompress(ctx->codec, packet->data, (UINT32)packet->size, corpus->width,
+		                     corpus->height, dst, BENCH_FORMAT, corpus->step, 0, 0, corpus->width,
+		                     corpus->height, NULL) < 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL bench_progressive_init(BENCH_CONTEXT* ctx)
+{
+	PROGRESSIVE_CONTEXT* progressive = progressive_context_new(ctx->encoder);
+
+	ctx->codec = progressive;
+
+	if (!progressive || !progressive_context_reset(progressive))
+		return FALSE;
+
+	if (!ctx->encoder)
+	{
+		if (progressive_create_surface_context(progressive, 0, ctx->corpus->width,
+		                                       ctx->corpus->height) < 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void bench_progressive_uninit(BENCH_CONTEXT* ctx)
+{
+	progressive_context_free(ctx->codec);
+}
+
+static BOOL bench_progressive_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	BYTE* data = NULL;
+	UINT32 size = 0;
+	const BENCH_CORPUS* corpus = ctx->corpus;
+
+	/* The output is owned by the codec context */
+	if (progressive_compress(ctx->codec, frame, corpus->step * corpus->height, BENCH_FORMAT,
+	                         corpus->width, corpus->height, corpus->step, NULL, &data, &size) < 0)
+		return FALSE;
+
+	return bench_output_append(out, data, size, 0, 0, 0, corpus->width, corpus->height);
+}
+
+static BOOL bench_progressive_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	size_t x;
+
+	for (x = 0; x < in->count; x++)
+	{
+		const BENCH_PACKET* packet = &in->packets[x];
+
+		if (progressive_decompress(ctx->codec, packet->data, (UINT32)packet->size, dst,
+		                           BENCH_FORMAT, ctx->corpus->step, 0, 0, NULL, 0,
+		                           ctx->frameId++) < 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+/* The color conversion stage of AVC420 / AVC444, the H.264 encoder itself is
+ * an external library. One packet per YUV plane. */
+static BOOL bench_yuv_init(BENCH_CONTEXT* ctx)
+{
+	size_t x, y;
+	const UINT32 stride = (ctx->corpus->width + 15) & ~15u;
+	const UINT32 height = (ctx->corpus->height + 15) & ~15u;
+	YUV_CONTEXT* yuv = yuv_context_new(ctx->encoder, ctx->threadingFlags);
+
+	ctx->codec = yuv;
+
+	if (!yuv || !yuv_context_reset(yuv, ctx->corpus->width, ctx->corpus->height))
+		return FALSE;
+
+	ctx->strides[0] = stride;
+	ctx->strides[1] = (stride + 1) / 2;
+	ctx->strides[2] = (stride + 1) / 2;
+
+	/* Full height chroma planes, AVC444 needs them and AVC420 does not care */
+	for (x = 0; x < 2; x++)
+	{
+		for (y = 0; y < 3; y++)
+		{
+			ctx->planes[x][y] = winpr_aligned_recalloc(NULL, stride, height, 16);
+
+			if (!ctx->planes[x][y])
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void bench_yuv_uninit(BENCH_CONTEXT* ctx)
+{
+	size_t x, y;
+
+	for (x = 0; x < 2; x++)
+	{
+		for (y = 0; y < 3; y++)
+			winpr_aligned_free(ctx->planes[x][y]);
+	}
+
+	yuv_context_free(ctx->codec);
+}
+
+static BOOL bench_yuv_append_planes(BENCH_CONTEXT* ctx, BYTE* planes[3], BOOL fullChroma,
+                                    BENCH_OUTPUT* out)
+{
+	size_t x;
+	const BENCH_CORPUS* corpus = ctx->corpus;
+
+	for (x = 0; x < 3; x++)
+	{
+		const UINT32 height = ((x == 0) || fullChroma) ? corpus->height : (corpus->height + 1) / 2;
+
+		if (!bench_output_append(out, planes[x], (size_t)ctx->strides[x] * height, 0, 0, 0,
+		                         corpus->width, corpus->height))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL bench_avc420_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	const BENCH_CORPUS* corpus = ctx->corpus;
+	const RECTANGLE_16 rect = { 0, 0, (UINT16)corpus->width, (UINT16)corpus->height };
+
+	if (!yuv420_context_encode(ctx->codec, frame, corpus->step, BENCH_FORMAT, ctx->strides,
+	                           ctx->planes[0], &rect, 1))
+		return FALSE;
+
+	return bench_yuv_append_planes(ctx, ctx->planes[0], FALSE, out);
+}
+
+static BOOL bench_avc420_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	const BENCH_CORPUS* corpus = ctx->corpus;
+	const RECTANGLE_16 rect = { 0, 0, (UINT16)corpus->width, (UINT16)corpus->height };
+	const BYTE* planes[3];
+
+	if (in->count != 3)
+		return FALSE;
+
+	planes[0] = in->packets[0].data;
+	planes[1] = in->packets[1].data;
+	planes[2] = in->packets[2].data;
+	return yuv420_context_decode(ctx->codec, planes, ctx->strides, corpus->height, BENCH_FORMAT,
+	                             dst, corpus->step, &rect, 1);
+}
+
+static BOOL bench_avc444_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	const BENCH_CORPUS* corpus = ctx->corpus;
+	const RECTANGLE_16 rect = { 0, 0, (UINT16)corpus->width, (UINT16)corpus->height };
+
+	if (!yuv444_context_encode(ctx->codec, 1, frame, corpus->step, BENCH_FORMAT, ctx->strides,
+	                           ctx->planes[0], ctx->planes[1], &rect, 1))
+		return FALSE;
+
+	if (!bench_yuv_append_planes(ctx, ctx->planes[0], FALSE, out))
+		return FALSE;
+
+	return bench_yuv_append_planes(ctx, ctx->planes[1], TRUE, out);
+}
+
+static BOOL bench_avc444_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	size_t x;
+	const BENCH_CORPUS* corpus = ctx->corpus;
+	const RECTANGLE_16 rect = { 0, 0, (UINT16)corpus->width, (UINT16)corpus->height };
+	const UINT32 strides[3] = { ctx->strides[0], ctx->strides[0], ctx->strides[0] };
+
+	if (in->count != 6)
+		return FALSE;
+
+	/* The decoded 4:4:4 planes are kept in the encoder plane buffers */
+	for (x = 0; x < 2; x++)
+	{
+		const BYTE type = (x == 0) ? AVC444_LUMA : AVC444_CHROMAv1;
+		const BYTE* planes[3] = { in->packets[x * 3 + 0].data, in->packets[x * 3 + 1].data,
+			                      in->packets[x * 3 + 2].data };
+
+		if (!yuv444_context_decode(ctx->codec, type, planes, ctx->strides, corpus->height,
+		                           ctx->planes[1], strides, BENCH_FORMAT, dst, corpus->step, &rect,
+		                           1))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Bulk compressors, fed with the raw frame data */
+static BOOL bench_zgfx_init(BENCH_CONTEXT* ctx)
+{
+	ctx->codec = zgfx_context_new(ctx->encoder);
+	return ctx->codec != NULL;
+}
+
+static void bench_zgfx_uninit(BENCH_CONTEXT* ctx)
+{
+	zgfx_context_free(ctx->codec);
+}
+
+static BOOL bench_zgfx_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	UINT32 flags = 0;
+	const BENCH_CORPUS* corpus = ctx->corpus;
+
+	Stream_SetPosition(ctx->s, 0);
+
+	if (zgfx_compress_to_stream(ctx->codec, ctx->s, frame, corpus->step * corpus->height,
+	                            &flags) < 0)
+		return FALSE;
+
+	return bench_output_append(out, Stream_Buffer(ctx->s), Stream_GetPosition(ctx->s), flags, 0,
+	                           0, corpus->width, corpus->height);
+}
+
+static BOOL bench_zgfx_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	size_t x;
+
+	WINPR_UNUSED(dst);
+
+	for (x = 0; x < in->count; x++)
+	{
+		const BENCH_PACKET* packet = &in->packets[x];
+		BYTE* data = NULL;
+		UINT32 size = 0;
+
+		if (zgfx_decompress(ctx->codec, packet->data, (UINT32)packet->size, &data, &size, 0) < 0)
+			return FALSE;
+
+		free(data);
+	}
+
+	return TRUE;
+}
+
+static void bench_zgfx_reset(BENCH_CONTEXT* ctx)
+{
+	zgfx_context_reset(ctx->codec, FALSE);
+}
+
+typedef int (*bench_bulk_compress_fn)(void* ctx, const BYTE* pSrcData, UINT32 SrcSize,
+                                      BYTE* pDstBuffer, const BYTE** ppDstData, UINT32* pDstSize,
+                                      UINT32* pFlags);
+typedef int (*bench_bulk_decompress_fn)(void* ctx, const BYTE* pSrcData, UINT32 SrcSize,
+                                        const BYTE** ppDstData, UINT32* pDstSize, UINT32 flags);
+
+static BOOL bench_bulk_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out,
+                              bench_bulk_compress_fn fkt)
+{
+	size_t offset;
+	const BENCH_CORPUS* corpus = ctx->corpus;
+	const size_t size = (size_t)corpus->step * corpus->height;
+
+	for (offset = 0; offset < size; offset += BENCH_BULK_CHUNK_SIZE)
+	{
+		const UINT32 chunk = (UINT32)MIN(BENCH_BULK_CHUNK_SIZE, size - offset);
+		const BYTE* data = NULL;
+		UINT32 dstSize = BENCH_BULK_BUFFER_SIZE;
+		UINT32 flags = 0;
+
+		if (fkt(ctx->codec, &frame[offset], chunk, ctx->buffer, &data, &dstSize, &flags) < 0)
+			return FALSE;
+
+		/* Chunks the compressor did not shrink are sent as they are */
+		if (!(flags & PACKET_COMPRESSED))
+		{
+			data = &frame[offset];
+			dstSize = chunk;
+		}
+
+		if (!bench_output_append(out, data, dstSize, flags, 0, 0, 0, 0))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL bench_bulk_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in,
+                              bench_bulk_decompress_fn fkt, UINT32 type)
+{
+	size_t x;
+
+	for (x = 0; x < in->count; x++)
+	{
+		const BENCH_PACKET* packet = &in->packets[x];
+		const BYTE* data = NULL;
+		UINT32 size = 0;
+
+		if (!(packet->flags & (PACKET_COMPRESSED | PACKET_AT_FRONT | PACKET_FLUSHED)))
+			continue;
+
+		if (fkt(ctx->codec, packet->data, (UINT32)packet->size, &data, &size,
+		        packet->flags | type) < 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL bench_bulk_init_buffer(BENCH_CONTEXT* ctx)
+{
+	if (!ctx->codec)
+		return FALSE;
+
+	ctx->buffer = malloc(BENCH_BULK_BUFFER_SIZE);
+	return ctx->buffer != NULL;
+}
+
+static BOOL bench_mppc_init(BENCH_CONTEXT* ctx)
+{
+	ctx->codec = mppc_context_new(1, ctx->encoder); /* RDP 5.0, 64K history */
+	return bench_bulk_init_buffer(ctx);
+}
+
+static void bench_mppc_uninit(BENCH_CONTEXT* ctx)
+{
+	mppc_context_free(ctx->codec);
+}
+
+static BOOL bench_mppc_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	return bench_bulk_encode(ctx, frame, out, (bench_bulk_compress_fn)mppc_compress);
+}
+
+static BOOL bench_mppc_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	WINPR_UNUSED(dst);
+	return bench_bulk_decode(ctx, in, (bench_bulk_decompress_fn)mppc_decompress,
+	                         PACKET_COMPR_TYPE_64K);
+}
+
+static void bench_mppc_reset(BENCH_CONTEXT* ctx)
+{
+	mppc_context_reset(ctx->codec, FALSE);
+}
+
+static BOOL bench_ncrush_init(BENCH_CONTEXT* ctx)
+{
+	ctx->codec = ncrush_context_new(ctx->encoder);
+	return bench_bulk_init_buffer(ctx);
+}
+
+static void bench_ncrush_uninit(BENCH_CONTEXT* ctx)
+{
+	ncrush_context_free(ctx->codec);
+}
+
+static BOOL bench_ncrush_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	return bench_bulk_encode(ctx, frame, out, (bench_bulk_compress_fn)ncrush_compress);
+}
+
+static BOOL bench_ncrush_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	WINPR_UNUSED(dst);
+	return bench_bulk_decode(ctx, in, (bench_bulk_decompress_fn)ncrush_decompress,
+	                         PACKET_COMPR_TYPE_RDP6);
+}
+
+static void bench_ncrush_reset(BENCH_CONTEXT* ctx)
+{
+	ncrush_context_reset(ctx->codec, FALSE);
+}
+
+static BOOL bench_xcrush_init(BENCH_CONTEXT* ctx)
+{
+	ctx->codec = xcrush_context_new(ctx->encoder);
+	return bench_bulk_init_buffer(ctx);
+}
+
+static void bench_xcrush_uninit(BENCH_CONTEXT* ctx)
+{
+	xcrush_context_free(ctx->codec);
+}
+
+static BOOL bench_xcrush_encode(BENCH_CONTEXT* ctx, const BYTE* frame, BENCH_OUTPUT* out)
+{
+	return bench_bulk_encode(ctx, frame, out, (bench_bulk_compress_fn)xcrush_compress);
+}
+
+static BOOL bench_xcrush_decode(BENCH_CONTEXT* ctx, const BENCH_OUTPUT* in, BYTE* dst)
+{
+	WINPR_UNUSED(dst);
+	return bench_bulk_decode(ctx, in, (bench_bulk_decompress_fn)xcrush_decompress,
+	                         PACKET_COMPR_TYPE_RDP61);
+}
+
+static void bench_xcrush_reset(BENCH_CONTEXT* ctx)
+{
+	xcrush_context_reset(ctx->codec, FALSE);
+}
+
+static const BENCH_CODEC bench_codecs[] = {
+	{ "rfx", bench_rfx_init, bench_rfx_uninit, bench_rfx_encode, bench_rfx_decode, NULL },
+	{ "nsc", bench_nsc_init, bench_nsc_uninit, bench_nsc_encode, bench_nsc_decode, NULL },
+	{ "planar", bench_planar_init, bench_planar_uninit, bench_planar_encode, bench_planar_decode,
+	  NULL },
+	{ "interleaved", bench_interleaved_init, bench_interleaved_uninit, bench_interleaved_encode,
+	  bench_interleaved_decode, NULL },
+	{ "clear", bench_clear_init, bench_clear_uninit, bench_clear_encode, bench_clear_decode,
+	  NULL },
+	{ "progressive", bench_progressive_init, bench_progressive_uninit, bench_progressive_encode,
+	  bench_progressive_decode, NULL },
+	{ "avc420-yuv", bench_yuv_init, bench_yuv_uninit, bench_avc420_encode, bench_avc420_decode,
+	  NULL },
+	{ "avc444-yuv", bench_yuv_init, bench_yuv_uninit, bench_avc444_encode, bench_avc444_decode,
+	  NULL },
+	{ "zgfx", bench_zgfx_init, bench_zgfx_uninit, bench_zgfx_encode, bench_zgfx_decode,
+	  bench_zgfx_reset },
+	{ "mppc", bench_mppc_init, bench_mppc_uninit, bench_mppc_encode, bench_mppc_decode,
+	  bench_mppc_reset },
+	{ "ncrush", bench_ncrush_init, bench_ncrush_uninit, bench_ncrush_encode, bench_ncrush_decode,
+	  bench_ncrush_reset },
+	{ "xcrush", bench_xcrush_init, bench_xcrush_uninit, bench_xcrush_encode, bench_xcrush_decode,
+	  bench_xcrush_reset },
+};
+
+/* ------------------------------------------------------------------------- */
+static void bench_context_free(const BENCH_CODEC* codec, BENCH_CONTEXT* ctx)
+{
+	if (!ctx)
+		return;
+
+	if (ctx->codec)
+		codec->uninit(ctx);
+
+	Stream_Free(ctx->s, TRUE);
+	free(ctx->buffer);
+	free(ctx);
+}
+
+static BENCH_CONTEXT* bench_context_new(const BENCH_CODEC* codec, const BENCH_CORPUS* corpus,
+                                        BOOL encoder, UINT32 threadingFlags)
+{
+	BENCH_CONTEXT* ctx = calloc(1, sizeof(BENCH_CONTEXT));
+
+	if (!ctx)
+		return NULL;
+
+	ctx->corpus = corpus;
+	ctx->encoder = encoder;
+	ctx->threadingFlags = threadingFlags;
+	ctx->s = Stream_New(NULL, (size_t)corpus->step * corpus->height);
+
+	if (!ctx->s || !codec->init(ctx))
+	{
+		bench_context_free(codec, ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+/* ------------------------------------------------------------------------- */
+static DWORD WINAPI bench_worker_thread(LPVOID arg)
+{
+	UINT32 pass;
+	size_t x;
+	BENCH_WORKER* worker = arg;
+	const BENCH_CORPUS* corpus = worker->corpus;
+	BENCH_OUTPUT scratch = { 0 };
+	BYTE* dst = NULL;
+	BENCH_CONTEXT* ctx =
+	    bench_context_new(worker->codec, corpus, worker->encode, worker->threadingFlags);
+
+	worker->rc = FALSE;
+
+	if (ctx && !worker->encode)
+		dst = winpr_aligned_recalloc(NULL, corpus->step, corpus->height, 16);
+
+	SetEvent(worker->ready);
+	WaitForSingleObject(worker->start, INFINITE);
+
+	if (!ctx || (!worker->encode && !dst))
+		goto out;
+
+	for (pass = 0; pass < worker->passes; pass++)
+	{
+		if (!worker->encode && (pass > 0) && worker->codec->reset)
+			worker->codec->reset(ctx);
+
+		for (x = 0; x < corpus->count; x++)
+		{
+			if (worker->encode)
+			{
+				scratch.count = 0;
+
+				if (!worker->codec->encode(ctx, corpus->frames[x], &scratch))
+					goto out;
+			}
+			else if (!worker->codec->decode(ctx, &worker->encoded[x], dst))
+				goto out;
+		}
+	}
+
+	worker->rc = TRUE;
+out:
+	SetEvent(worker->done);
+
+	for (x = 0; x < scratch.capacity; x++)
+		free(scratch.packets[x].data);
+
+	free(scratch.packets);
+	winpr_aligned_free(dst);
+	bench_context_free(worker->codec, ctx);
+	return 0;
+}
+
+/* Run the codec on `threads` threads in parallel, each with its own context */
+static BOOL bench_run(const BENCH_CODEC* codec, const BENCH_CORPUS* corpus,
+                      const BENCH_OUTPUT* encoded, BOOL encode, UINT32 threads, UINT32 passes,
+                      UINT32 threadingFlags, BENCH_RESULT* result)
+{
+	UINT32 x;
+	BOOL rc = FALSE;
+	UINT64 begin, end;
+	HANDLE start = CreateEventA(NULL, TRUE, FALSE, NULL);
+	BENCH_WORKER* workers = calloc(threads, sizeof(BENCH_WORKER));
+	HANDLE* handles = calloc(threads, sizeof(HANDLE));
+
+	if (!start || !workers || !handles)
+		goto fail;
+
+	for (x = 0; x < threads; x++)
+	{
+		BENCH_WORKER* worker = &workers[x];
+		worker->codec = codec;
+		worker->corpus = corpus;
+		worker->encoded = encoded;
+		worker->threadingFlags = threadingFlags;
+		worker->encode = encode;
+		worker->passes = passes;
+		worker->start = start;
+		worker->ready = CreateEventA(NULL, TRUE, FALSE, NULL);
+		worker->done = CreateEventA(NULL, TRUE, FALSE, NULL);
+
+		if (!worker->ready || !worker->done)
+			goto fail;
+	}
+
+	for (x = 0; x < threads; x++)
+	{
+		handles[x] = CreateThread(NULL, 0, bench_worker_thread, &workers[x], 0, NULL);
+
+		if (!handles[x])
+			goto fail;
+	}
+
+	/* Context setup is not part of the measurement */
+	for (x = 0; x < threads; x++)
+		WaitForSingleObject(workers[x].ready, INFINITE);
+
+	begin = GetTickCount64();
+	SetEvent(start);
+
+	for (x = 0; x < threads; x++)
+		WaitForSingleObject(workers[x].done, INFINITE);
+
+	end = GetTickCount64();
+	rc = TRUE;
+
+	for (x = 0; x < threads; x++)
+		rc &= workers[x].rc;
+
+	result->threads = threads;
+	result->milliseconds = end - begin;
+	result->frames = (UINT64)threads * passes * corpus->count;
+	result->bytes = result->frames * corpus->step * corpus->height;
+fail:
+	if (start)
+		SetEvent(start);
+
+	for (x = 0; x < threads; x++)
+	{
+		if (handles && handles[x])
+		{
+			WaitForSingleObject(handles[x], INFINITE);
+			CloseHandle(handles[x]);
+		}
+
+		if (workers)
+		{
+			if (workers[x].ready)
+				CloseHandle(workers[x].ready);
+
+			if (workers[x].done)
+				CloseHandle(workers[x].done);
+		}
+	}
+
+	if (start)
+		CloseHandle(start);
+
+	free(handles);
+	free(workers);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+static double bench_seconds(const BENCH_RESULT* result)
+{
+	/* The tick count has millisecond resolution, avoid dividing by zero */
+	return (double)MAX(result->milliseconds, 1) / 1000.0;
+}
+
+static void bench_print_result(FILE* fp, const char* name, const BENCH_RESULT* result,
+                               const BENCH_RESULT* base)
+{
+	const double seconds = bench_seconds(result);
+	const double mbps = (double)result->bytes / seconds / (1024.0 * 1024.0);
+	const double fps = (double)result->frames / seconds;
+
+	if (name)
+		fprintf(fp, "\"%s\": ", name);
+
+	fprintf(fp, "{ \"threads\": %" PRIu32 ", \"seconds\": %.3f, \"frames\": %" PRIu64
+	            ", \"mb_per_second\": %.2f, \"frames_per_second\": %.2f",
+	        result->threads, seconds, result->frames, mbps, fps);
+
+	if (base)
+	{
+		const double baseFps = (double)base->frames / bench_seconds(base);
+		fprintf(fp, ", \"speedup\": %.2f", fps / baseFps);
+	}
+
+	fprintf(fp, " }");
+}
+
+static void bench_print_scaling(FILE* fp, const char* name, const BENCH_RESULT* results,
+                                size_t count)
+{
+	size_t x;
+
+	fprintf(fp, ",\n      \"%s_scaling\": [", name);
+
+	for (x = 0; x < count; x++)
+	{
+		fprintf(fp, "%s\n        ", (x > 0) ? "," : "");
+		bench_print_result(fp, NULL, &results[x], &results[0]);
+	}
+
+	fprintf(fp, "\n      ]");
+}
+
+static BOOL bench_codec(FILE* fp, const BENCH_CODEC* codec, const BENCH_CORPUS* corpus,
+                        UINT32 passes, UINT32 maxThreads, UINT32 threadingFlags, BOOL first)
+{
+	size_t x;
+	BOOL rc = FALSE;
+	BOOL supported = FALSE;
+	UINT64 compressed = 0;
+	size_t nresults = 0;
+	UINT32 threads;
+	BENCH_RESULT* encoding = calloc(32, sizeof(BENCH_RESULT));
+	BENCH_RESULT* decoding = calloc(32, sizeof(BENCH_RESULT));
+	BENCH_OUTPUT* outputs = calloc(corpus->count, sizeof(BENCH_OUTPUT));
+	BENCH_CONTEXT* ctx = bench_context_new(codec, corpus, TRUE, threadingFlags);
+
+	fprintf(stderr, "benchmarking %s\n", codec->name);
+
+	if (!encoding || !decoding || !outputs)
+		goto fail;
+
+	/* Encode the corpus once, this is the input of the decoder runs and gives the ratio */
+	if (ctx)
+	{
+		supported = TRUE;
+
+		for (x = 0; x < corpus->count; x++)
+		{
+			if (!codec->encode(ctx, corpus->frames[x], &outputs[x]))
+			{
+				supported = FALSE;
+				break;
+			}
+
+			compressed += bench_output_size(&outputs[x]);
+		}
+	}
+
+	fprintf(fp, "%s\n    {\n      \"codec\": \"%s\",\n      \"supported\": %s", first ? "" : ",",
+	        codec->name, supported ? "true" : "false");
+
+	if (supported)
+	{
+		const UINT64 raw = (UINT64)corpus->count * corpus->step * corpus->height;
+
+		for (threads = 1; (threads <= maxThreads) && (nresults < 32); threads *= 2)
+		{
+			if (!bench_run(codec, corpus, NULL, TRUE, threads, passes, threadingFlags,
+			               &encoding[nresults]) ||
+			    !bench_run(codec, corpus, outputs, FALSE, threads, passes, threadingFlags,
+			               &decoding[nresults]))
+				goto fail;
+
+			nresults++;
+
+			/* Always measure the requested maximum, even if not a power of 2 */
+			if ((threads < maxThreads) && (threads * 2 > maxThreads))
+				threads = maxThreads / 2;
+		}
+
+		fprintf(fp, ",\n      \"compressed_bytes\": %" PRIu64 ",\n      \"compression_ratio\": %.3f",
+		        compressed, (double)raw / (double)MAX(compressed, 1));
+		fprintf(fp, ",\n      ");
+		bench_print_result(fp, "encode", &encoding[0], NULL);
+		fprintf(fp, ",\n      ");
+		bench_print_result(fp, "decode", &decoding[0], NULL);
+		bench_print_scaling(fp, "encode", encoding, nresults);
+		bench_print_scaling(fp, "decode", decoding, nresults);
+	}
+
+	fprintf(fp, "\n    }");
+	rc = TRUE;
+fail:
+	if (!rc)
+		fprintf(stderr, "%s failed\n", codec->name);
+
+	bench_context_free(codec, ctx);
+	bench_output_free(outputs, corpus->count);
+	free(encoding);
+	free(decoding);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+static UINT32 bench_rand(UINT32* seed)
+{
+	*seed = *seed * 1103515245u + 12345u;
+	return (*seed >> 16) & 0x7FFF;
+}
+
+static void bench_fill_rect(BYTE* frame, UINT32 step, UINT32 x, UINT32 y, UINT32 w, UINT32 h,
+                            UINT32 color)
+{
+	UINT32 i, j;
+
+	for (j = y; j < y + h; j++)
+	{
+		UINT32* line = (UINT32*)&frame[j * step];
+
+		for (i = x; i < x + w; i++)
+			line[i] = color;
+	}
+}
+
+/* A deterministic desktop like scene: a gradient background, windows with
+ * title bars, text like glyph rows and a noisy photo area. Every frame moves
+ * one window and scrolls the text, like a user working. */
+static void bench_draw_frame(BYTE* frame, UINT32 width, UINT32 height, UINT32 step, UINT32 index)
+{
+	UINT32 i, x, y;
+	UINT32 seed = 0x1234;
+
+	for (y = 0; y < height; y++)
+	{
+		UINT32* line = (UINT32*)&frame[y * step];
+
+		for (x = 0; x < width; x++)
+			line[x] = 0xFF000000 | ((y * 0x60 / height) << 16) | ((y * 0x80 / height) << 8) |
+			          (0x80 + y * 0x40 / height);
+	}
+
+	for (i = 0; i < 3; i++)
+	{
+		const UINT32 ww = width / 2;
+		const UINT32 wh = height / 2;
+		UINT32 wx = (width / 8) * (i + 1);
+		UINT32 wy = (height / 8) * (i + 1);
+
+		if (i == 2)
+			wx = (wx + index * 16) % (width - ww);
+
+		if ((ww < 8) || (wh < 24))
+			break;
+
+		bench_fill_rect(frame, step, wx, wy, ww, 20, 0xFF2050A0);
+		bench_fill_rect(frame, step, wx, wy + 20, ww, wh - 20, 0xFFF0F0F0);
+
+		/* text, rows of 8x12 glyphs made of random strokes */
+		for (y = wy + 24; y + 12 < wy + wh; y += 16)
+		{
+			UINT32 glyphSeed = seed + (y - wy) / 16 + ((i == 1) ? index : 0);
+
+			for (x = wx + 4; x + 8 < wx + ww; x += 8)
+			{
+				UINT32 gx, gy;
+				const UINT32 glyph = bench_rand(&glyphSeed) | (bench_rand(&glyphSeed) << 15);
+
+				if ((glyph & 0x1F) == 0)
+					continue; /* word gap */
+
+				for (gy = 0; gy < 12; gy++)
+				{
+					UINT32* line = (UINT32*)&frame[(y + gy) * step];
+
+					for (gx = 1; gx < 7; gx++)
+					{
+						if (glyph & (1u << ((gx + gy * 3) % 30)))
+							line[x + gx] = 0xFF101010;
+					}
+				}
+			}
+		}
+
+		seed += 97;
+	}
+
+	/* photo */
+	seed = 0x4321;
+
+	for (y = height * 5 / 8; y < height * 7 / 8; y++)
+	{
+		UINT32* line = (UINT32*)&frame[y * step];
+
+		for (x = width * 5 / 8; x < width * 7 / 8; x++)
+		{
+			const UINT32 noise = bench_rand(&seed) & 0x1F;
+			line[x] = 0xFF000000 | ((x * 255 / width) << 16) | ((0x40 + noise) << 8) |
+			          (y * 255 / height);
+		}
+	}
+}
+
+static void bench_corpus_free(BENCH_CORPUS* corpus)
+{
+	size_t x;
+
+	for (x = 0; x < corpus->count; x++)
+		winpr_aligned_free(corpus->frames[x]);
+
+	free(corpus->frames);
+	free(corpus->source);
+	ZeroMemory(corpus, sizeof(BENCH_CORPUS));
+}
+
+static BOOL bench_corpus_alloc(BENCH_CORPUS* corpus, UINT32 width, UINT32 height, size_t count)
+{
+	corpus->width = width;
+	corpus->height = height;
+	corpus->step = width * 4;
+	corpus->frames = calloc(count, sizeof(BYTE*));
+	return corpus->frames != NULL;
+}
+
+static BOOL bench_corpus_synthetic(BENCH_CORPUS* corpus, UINT32 width, UINT32 height,
+                                   size_t count)
+{
+	corpus->source = _strdup("synthetic");
+
+	if (!corpus->source || !bench_corpus_alloc(corpus, width, height, count))
+		return FALSE;
+
+	for (corpus->count = 0; corpus->count < count; corpus->count++)
+	{
+		BYTE* frame = winpr_aligned_malloc((size_t)corpus->step * height, 16);
+
+		if (!frame)
+			return FALSE;
+
+		bench_draw_frame(frame, width, height, corpus->step, (UINT32)corpus->count);
+		corpus->frames[corpus->count] = frame;
+	}
+
+	return TRUE;
+}
+
+static int bench_compare_names(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static BOOL bench_corpus_add_image(BENCH_CORPUS* corpus, const char* file)
+{
+	BOOL rc = FALSE;
+	BYTE* frame = NULL;
+	UINT32 format;
+	wImage* image = winpr_image_new();
+
+	if (!image || (winpr_image_read(image, file) <= 0))
+	{
+		fprintf(stderr, "failed to read %s\n", file);
+		goto fail;
+	}
+
+	switch (image->bytesPerPixel)
+	{
+		case 4:
+			format = PIXEL_FORMAT_BGRA32;
+			break;
+
+		case 3:
+			format = PIXEL_FORMAT_BGR24;
+			break;
+
+		default:
+			fprintf(stderr, "%s: unsupported %" PRIu32 " bpp image\n", file, image->bitsPerPixel);
+			goto fail;
+	}
+
+	if (corpus->count == 0)
+	{
+		corpus->width = image->width;
+		corpus->height = image->height;
+		corpus->step = image->width * 4;
+	}
+	else if ((image->width != corpus->width) || (image->height != corpus->height))
+	{
+		fprintf(stderr, "%s: all frames must have the same size\n", file);
+		goto fail;
+	}
+
+	frame = winpr_aligned_malloc((size_t)corpus->step * corpus->height, 16);
+
+	if (!frame || !freerdp_image_copy(frame, BENCH_FORMAT, corpus->step, 0, 0, corpus->width,
+	                                  corpus->height, image->data, format, image->scanline, 0, 0,
+	                                  NULL, FREERDP_FLIP_NONE))
+		goto fail;
+
+	corpus->frames[corpus->count++] = frame;
+	frame = NULL;
+	rc = TRUE;
+fail:
+	winpr_aligned_free(frame);
+	winpr_image_free(image, TRUE);
+	return rc;
+}
+
+/* Load every .bmp and .png of a directory, in name order */
+static BOOL bench_corpus_load(BENCH_CORPUS* corpus, const char* path, size_t maxFrames)
+{
+	size_t x;
+	BOOL rc = FALSE;
+	char** names = NULL;
+	size_t count = 0;
+	WIN32_FIND_DATAA fd = { 0 };
+	char* pattern = GetCombinedPath(path, "*");
+	HANDLE hFind = pattern ? FindFirstFileA(pattern, &fd) : INVALID_HANDLE_VALUE;
+
+	corpus->source = _strdup(path);
+
+	if (!corpus->source || (hFind == INVALID_HANDLE_VALUE))
+	{
+		fprintf(stderr, "failed to open corpus directory %s\n", path);
+		goto fail;
+	}
+
+	do
+	{
+		char** tmp;
+		const char* ext = strrchr(fd.cFileName, '.');
+
+		if (!ext || ((_stricmp(ext, ".bmp") != 0) && (_stricmp(ext, ".png") != 0)))
+			continue;
+
+		tmp = realloc(names, (count + 1) * sizeof(char*));
+
+		if (!tmp)
+			goto fail;
+
+		names = tmp;
+
+		if (!(names[count] = GetCombinedPath(path, fd.cFileName)))
+			goto fail;
+
+		count++;
+	} while (FindNextFileA(hFind, &fd));
+
+	if (count == 0)
+	{
+		fprintf(stderr, "no .bmp or .png frames found in %s\n", path);
+		goto fail;
+	}
+
+	qsort(names, count, sizeof(char*), bench_compare_names);
+	count = MIN(count, maxFrames);
+
+	if (!(corpus->frames = calloc(count, sizeof(BYTE*))))
+		goto fail;
+
+	for (x = 0; x < count; x++)
+	{
+		if (!bench_corpus_add_image(corpus, names[x]))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (hFind != INVALID_HANDLE_VALUE)
+		FindClose(hFind);
+
+	for (x = 0; names && (x < count); x++)
+		free(names[x]);
+
+	free(names);
+	free(pattern);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+static void bench_print_json_string(FILE* fp, const char* str)
+{
+	fputc('"', fp);
+
+	for (; *str; str++)
+	{
+		if ((*str == '"') || (*str == '\\'))
+			fputc('\\', fp);
+
+		if ((unsigned char)*str < 0x20)
+			fprintf(fp, "\\u%04x", (unsigned char)*str);
+		else
+			fputc(*str, fp);
+	}
+
+	fputc('"', fp);
+}
+
+static BOOL bench_codec_selected(const char* list, const char* name)
+{
+	const size_t len = strlen(name);
+	const char* cur = list;
+
+	if (!list)
+		return TRUE;
+
+	while ((cur = strstr(cur, name)) != NULL)
+	{
+		const BOOL start = (cur == list) || (cur[-1] == ',');
+		const BOOL end = (cur[len] == '\0') || (cur[len] == ',');
+
+		if (start && end)
+			return TRUE;
+
+		cur += len;
+	}
+
+	return FALSE;
+}
+
+static WINPR_NORETURN(void usage_and_exit(int status))
+{
+	size_t x;
+
+	printf("freerdp-codec-bench: codec throughput benchmark\n");
+	printf("Usage: freerdp-codec-bench [options]\n");
+	printf("  -c <dir>   corpus directory with .bmp/.png frames of equal size\n");
+	printf("             (default: synthetic desktop frames)\n");
+	printf("  -n <num>   number of frames (default 8)\n");
+	printf("  -s <WxH>   size of the synthetic frames (default 1024x768)\n");
+	printf("  -i <num>   passes over the corpus per measurement (default 3)\n");
+	printf("  -t <num>   maximum number of threads for the scaling runs\n");
+	printf("             (default: number of processors)\n");
+	printf("  -m         let the codecs use their internal thread pools\n");
+	printf("  -e <list>  comma separated codecs to run (default: all)\n");
+	printf("  -o <file>  write the JSON report to file (default: stdout)\n");
+	printf("Codecs:");
+
+	for (x = 0; x < ARRAYSIZE(bench_codecs); x++)
+		printf(" %s", bench_codecs[x].name);
+
+	printf("\n");
+	exit(status);
+}
+
+static const char* bench_arg(int argc, char* argv[], int* index)
+{
+	if (*index + 1 >= argc)
+	{
+		printf("missing argument for %s\n\n", argv[*index]);
+		usage_and_exit(1);
+	}
+
+	return argv[++(*index)];
+}
+
+static unsigned long bench_arg_number(int argc, char* argv[], int* index)
+{
+	char* end = NULL;
+	const char* arg = bench_arg(argc, argv, index);
+	unsigned long value;
+
+	errno = 0;
+	value = strtoul(arg, &end, 0);
+
+	if ((errno != 0) || !end || (*end != '\0') || (value == 0) || (value > UINT16_MAX))
+	{
+		printf("invalid number %s\n\n", arg);
+		usage_and_exit(1);
+	}
+
+	return value;
+}
+
+int main(int argc, char* argv[])
+{
+	int index;
+	size_t x;
+	int rc = 1;
+	BOOL first = TRUE;
+	FILE* fp = stdout;
+	SYSTEM_INFO sysinfo = { 0 };
+	BENCH_CORPUS corpus = { 0 };
+	const char* corpusPath = NULL;
+	const char* outputPath = NULL;
+	const char* codecs = NULL;
+	UINT32 frames = 8;
+	UINT32 width = 1024;
+	UINT32 height = 768;
+	UINT32 passes = 3;
+	UINT32 maxThreads;
+	UINT32 threadingFlags = THREADING_FLAGS_DISABLE_THREADS;
+
+	GetNativeSystemInfo(&sysinfo);
+	maxThreads = MAX(sysinfo.dwNumberOfProcessors, 1);
+
+	for (index = 1; index < argc; index++)
+	{
+		if (strcmp("-c", argv[index]) == 0)
+			corpusPath = bench_arg(argc, argv, &index);
+		else if (strcmp("-n", argv[index]) == 0)
+			frames = bench_arg_number(argc, argv, &index);
+		else if (strcmp("-s", argv[index]) == 0)
+		{
+			const char* arg = bench_arg(argc, argv, &index);
+
+			if ((sscanf(arg, "%" SCNu32 "x%" SCNu32, &width, &height) != 2) || (width < 16) ||
+			    (height < 16) || (width > 8192) || (height > 8192))
+			{
+				printf("invalid size %s\n\n", arg);
+				usage_and_exit(1);
+			}
+		}
+		else if (strcmp("-i", argv[index]) == 0)
+			passes = bench_arg_number(argc, argv, &index);
+		else if (strcmp("-t", argv[index]) == 0)
+			maxThreads = bench_arg_number(argc, argv, &index);
+		else if (strcmp("-m", argv[index]) == 0)
+			threadingFlags = 0;
+		else if (strcmp("-e", argv[index]) == 0)
+			codecs = bench_arg(argc, argv, &index);
+		else if (strcmp("-o", argv[index]) == 0)
+			outputPath = bench_arg(argc, argv, &index);
+		else if (strcmp("-h", argv[index]) == 0)
+			usage_and_exit(0);
+		else
+		{
+			printf("unknown option %s\n\n", argv[index]);
+			usage_and_exit(1);
+		}
+	}
+
+	if (corpusPath)
+	{
+		if (!bench_corpus_load(&corpus, corpusPath, frames))
+			goto fail;
+	}
+	else if (!bench_corpus_synthetic(&corpus, width, height, frames))
+		goto fail;
+
+	if (outputPath && !(fp = winpr_fopen(outputPath, "w")))
+	{
+		fprintf(stderr, "failed to open %s\n", outputPath);
+		goto fail;
+	}
+
+	fprintf(fp, "{\n  \"version\": ");
+	bench_print_json_string(fp, freerdp_get_version_string());
+	fprintf(fp, ",\n  \"corpus\": { \"source\": ");
+	bench_print_json_string(fp, corpus.source);
+	fprintf(fp,
+	        ", \"frames\": %" PRIuz ", \"width\": %" PRIu32 ", \"height\": %" PRIu32
+	        ", \"bytes\": %" PRIu64 " },\n",
+	        corpus.count, corpus.width, corpus.height,
+	        (UINT64)corpus.count * corpus.step * corpus.height);
+	fprintf(fp,
+	        "  \"passes\": %" PRIu32 ",\n  \"max_threads\": %" PRIu32
+	        ",\n  \"codec_threads\": %s,\n  \"results\": [",
+	        passes, maxThreads, threadingFlags ? "false" : "true");
+
+	rc = 0;
+
+	for (x = 0; x < ARRAYSIZE(bench_codecs); x++)
+	{
+		if (!bench_codec_selected(codecs, bench_codecs[x].name))
+			continue;
+
+		if (!bench_codec(fp, &bench_codecs[x], &corpus, passes, maxThreads, threadingFlags,
+		                 first))
+			rc = 1;
+
+		first = FALSE;
+	}
+
+	fprintf(fp, "\n  ]\n}\n");
+fail:
+	if (fp && (fp != stdout))
+		fclose(fp);
+
+	bench_corpus_free(&corpus);
+	return rc;
+}
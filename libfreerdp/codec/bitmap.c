@@ -19,9 +19,33 @@
 
 #include <freerdp/config.h>
 
+#include <winpr/sysinfo.h>
+
 #include <freerdp/codec/bitmap.h>
 #include <freerdp/codec/planar.h>
 
+#include "bitmap_sse2.h"
+
+/* A line is never longer than the 32K output limit of a single call */
+#define BITMAP_MAX_LINE_PIXELS 16384
+
+#if defined(WITH_SSE2)
+static BOOL g_SSE2 = FALSE;
+#endif
+
+static INIT_ONCE bitmap_init_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK bitmap_init(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+#if defined(WITH_SSE2)
+	g_SSE2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+	return TRUE;
+}
+
 static INLINE UINT16 GETPIXEL16(const void* d, UINT32 x, UINT32 y, UINT32 w)
 {
 	const BYTE* src = (const BYTE*)d + ((y * w + x) * sizeof(UINT16));
@@ -59,6 +83,113 @@ static INLINE UINT32 IN_PIXEL32(const void* in_ptr, UINT32 in_x, UINT32 in_y, UI
 		return in_last_pixel;
 }
 
+/*****************************************************************************/
+/* run test results of a whole line, the encoder only steps through changes */
+static void bitmap_classify_32(const BYTE* line, const BYTE* last_line, UINT32 x, UINT32 width,
+                               UINT32 mix, BYTE* cls)
+{
+	for (; x < width; x++)
+	{
+		const UINT32 pixel = GETPIXEL32(line, x, 0, width);
+		const UINT32 ypixel = IN_PIXEL32(last_line, x, 0, width, 0);
+		BYTE bits = 0;
+
+		if (pixel == ypixel)
+			bits |= BITMAP_CLASS_FILL;
+
+		if (pixel == (ypixel ^ mix))
+			bits |= BITMAP_CLASS_MIX;
+
+		if ((x > 0) && (pixel == GETPIXEL32(line, x - 1, 0, width)))
+			bits |= BITMAP_CLASS_COLOR;
+		else if ((x > 1) && (pixel == GETPIXEL32(line, x - 2, 0, width)))
+			bits |= BITMAP_CLASS_ALT;
+
+		cls[x] = bits;
+	}
+}
+
+static void bitmap_classify_16(const BYTE* line, const BYTE* last_line, UINT32 x, UINT32 width,
+                               UINT16 mix, BYTE* cls)
+{
+	for (; x < width; x++)
+	{
+		const UINT16 pixel = GETPIXEL16(line, x, 0, width);
+		const UINT16 ypixel = IN_PIXEL16(last_line, x, 0, width, 0);
+		BYTE bits = 0;
+
+		if (pixel == ypixel)
+			bits |= BITMAP_CLASS_FILL;
+
+		if (pixel == (ypixel ^ mix))
+			bits |= BITMAP_CLASS_MIX;
+
+		if ((x > 0) && (pixel == GETPIXEL16(line, x - 1, 0, width)))
+			bits |= BITMAP_CLASS_COLOR;
+		else if ((x > 1) && (pixel == GETPIXEL16(line, x - 2, 0, width)))
+			bits |= BITMAP_CLASS_ALT;
+
+		cls[x] = bits;
+	}
+}
+
+static void bitmap_classify_row_32(const BYTE* line, const BYTE* last_line, UINT32 width,
+                                   UINT32 mix, BYTE* cls)
+{
+	UINT32 x = (width < 2) ? width : 2;
+	bitmap_classify_32(line, last_line, 0, x, mix, cls);
+#if defined(WITH_SSE2)
+	if (g_SSE2)
+		x = bitmap_classify_row_32_sse2(line, last_line, x, width, mix, cls);
+#endif
+	bitmap_classify_32(line, last_line, x, width, mix, cls);
+}
+
+static void bitmap_classify_row_16(const BYTE* line, const BYTE* last_line, UINT32 width,
+                                   UINT16 mix, BYTE* cls)
+{
+	UINT32 x = (width < 2) ? width : 2;
+	bitmap_classify_16(line, last_line, 0, x, mix, cls);
+#if defined(WITH_SSE2)
+	if (g_SSE2)
+		x = bitmap_classify_row_16_sse2(line, last_line, x, width, mix, cls);
+#endif
+	bitmap_classify_16(line, last_line, x, width, mix, cls);
+}
+
+/* Number of pixels from x on that keep the test results of pixel x and never alternate */
+static INLINE UINT32 bitmap_run_length(const BYTE* cls, UINT32 x, UINT32 width)
+{
+	const BYTE bits = cls[x] & BITMAP_CLASS_RUN;
+	UINT32 n = 1;
+
+	while ((x + n < width) && (cls[x + n] == bits))
+		n++;
+
+	return n;
+}
+
+/* Appends run pixels to the fill or mix mask, bit set for mix */
+static INLINE size_t bitmap_fom_append(char* fom_mask, size_t fom_mask_len, UINT16 fom_count,
+                                       UINT32 n, BOOL set)
+{
+	UINT32 k;
+
+	for (k = 0; k < n; k++, fom_count++)
+	{
+		if ((fom_count % 8) == 0)
+		{
+			fom_mask[fom_mask_len] = 0;
+			fom_mask_len++;
+		}
+
+		if (set)
+			fom_mask[fom_mask_len - 1] |= (1 << (fom_count % 8));
+	}
+
+	return fom_mask_len;
+}
+
 /*****************************************************************************/
 /* color */
 static UINT16 out_color_count_2(UINT16 in_count, wStream* in_s, UINT16 in_data)
@@ -180,7 +311,7 @@ static INLINE UINT16 out_copy_count_3(UINT16 in_count, wStream* in_s, wStream* i
 			Stream_Write_UINT16(in_s, in_count);
 		}
 
-		Stream_Write(in_s, Stream_Pointer(in_data), in_count * 3);
+		Stream_Write(in_s, Stream_Buffer(in_data), in_count * 3);
 	}
 
 	Stream_SetPosition(in_data, 0);
@@ -462,6 +593,7 @@ static SSIZE_T freerdp_bitmap_compress_24(const void* srcData, UINT32 width, UIN
                                           wStream* temp_s, UINT32 e)
 {
 	char fom_mask[8192]; /* good for up to 64K bitmap */
+	BYTE cls[BITMAP_MAX_LINE_PIXELS];
 	SSIZE_T lines_sent = 0;
 	UINT16 count = 0;
 	UINT16 color_count = 0;
@@ -495,6 +627,7 @@ static SSIZE_T freerdp_bitmap_compress_24(const void* srcData, UINT32 width, UIN
 		}
 
 		out_count += end * 3;
+		bitmap_classify_row_32((const BYTE*)line, (const BYTE*)last_line, width, mix, cls);
 
 		for (j = 0; j < end; j++)
 		{
@@ -502,6 +635,58 @@ static SSIZE_T freerdp_bitmap_compress_24(const void* srcData, UINT32 width, UIN
 			const UINT32 pixel = IN_PIXEL32(line, j, 0, width, last_pixel);
 			const UINT32 ypixel = IN_PIXEL32(last_line, j, 0, width, last_ypixel);
 
+			/* Same test results as the previous pixel, none of the runs can end here.
+			 * All counters of failing tests are 0 already, the others just grow.
+			 * Pixel 0 compares against the previous line, so runs start at 2 at the earliest. */
+			if ((j > 1) && (j < width) && (bicolor_count == 0) && !(TEST_BICOLOR) &&
+			    ((cls[j] & BITMAP_CLASS_RUN) == (cls[j - 1] & BITMAP_CLASS_RUN)))
+			{
+				UINT32 k;
+				const UINT32 n = bitmap_run_length(cls, j, width);
+				const UINT32 last = j + n - 1;
+				BYTE* dst;
+
+				if (Stream_GetRemainingCapacity(temp_s) < n * 3)
+					return -1;
+
+				dst = Stream_Pointer(temp_s);
+
+				for (k = j; k <= last; k++)
+				{
+					const BYTE* src = (const BYTE*)&line[k * 4];
+					*dst++ = src[0];
+					*dst++ = src[1];
+					*dst++ = src[2];
+				}
+
+				Stream_Seek(temp_s, n * 3);
+
+				if (cls[j] & BITMAP_CLASS_FILL)
+					fill_count += n;
+
+				if (cls[j] & BITMAP_CLASS_MIX)
+					mix_count += n;
+
+				if (cls[j] & BITMAP_CLASS_COLOR)
+					color_count += n;
+
+				if (cls[j] & (BITMAP_CLASS_FILL | BITMAP_CLASS_MIX))
+				{
+					fom_mask_len = bitmap_fom_append(fom_mask, fom_mask_len, fom_count, n,
+					                                 cls[j] & BITMAP_CLASS_MIX);
+					fom_count += n;
+				}
+
+				bicolor1 = (n > 1) ? GETPIXEL32(line, last - 1, 0, width) : last_pixel;
+				bicolor2 = GETPIXEL32(line, last, 0, width);
+				bicolor_spin = FALSE;
+				count += n;
+				last_pixel = bicolor2;
+				last_ypixel = IN_PIXEL32(last_line, last, 0, width, last_ypixel);
+				j = last;
+				continue;
+			}
+
 			if (!TEST_FILL)
 			{
 				if (fill_count > 3 && fill_count >= color_count && fill_count >= bicolor_count &&
@@ -768,6 +953,7 @@ static SSIZE_T freerdp_bitmap_compress_16(const void* srcData, UINT32 width, UIN
                                           UINT32 start_line, wStream* temp_s, UINT32 e)
 {
 	char fom_mask[8192]; /* good for up to 64K bitmap */
+	BYTE cls[BITMAP_MAX_LINE_PIXELS];
 	SSIZE_T lines_sent = 0;
 	UINT16 count = 0;
 	UINT16 color_count = 0;
@@ -801,6 +987,7 @@ static SSIZE_T freerdp_bitmap_compress_16(const void* srcData, UINT32 width, UIN
 		}
 
 		out_count += end * 2;
+		bitmap_classify_row_16((const BYTE*)line, (const BYTE*)last_line, width, (UINT16)mix, cls);
 
 		for (j = 0; j < end; j++)
 		{
@@ -808,6 +995,46 @@ static SSIZE_T freerdp_bitmap_compress_16(const void* srcData, UINT32 width, UIN
 			const UINT16 pixel = IN_PIXEL16(line, j, 0, width, last_pixel);
 			const UINT16 ypixel = IN_PIXEL16(last_line, j, 0, width, last_ypixel);
 
+			/* Same test results as the previous pixel, none of the runs can end here.
+			 * All counters of failing tests are 0 already, the others just grow.
+			 * Pixel 0 compares against the previous line, so runs start at 2 at the earliest. */
+			if ((j > 1) && (j < width) && (bicolor_count == 0) && !(TEST_BICOLOR) &&
+			    ((cls[j] & BITMAP_CLASS_RUN) == (cls[j - 1] & BITMAP_CLASS_RUN)))
+			{
+				const UINT32 n = bitmap_run_length(cls, j, width);
+				const UINT32 last = j + n - 1;
+
+				if (Stream_GetRemainingCapacity(temp_s) < n * 2)
+					return -1;
+
+				Stream_Write(temp_s, &line[j * 2], n * 2);
+
+				if (cls[j] & BITMAP_CLASS_FILL)
+					fill_count += n;
+
+				if (cls[j] & BITMAP_CLASS_MIX)
+					mix_count += n;
+
+				if (cls[j] & BITMAP_CLASS_COLOR)
+					color_count += n;
+
+				if (cls[j] & (BITMAP_CLASS_FILL | BITMAP_CLASS_MIX))
+				{
+					fom_mask_len = bitmap_fom_append(fom_mask, fom_mask_len, fom_count, n,
+					                                 cls[j] & BITMAP_CLASS_MIX);
+					fom_count += n;
+				}
+
+				bicolor1 = (n > 1) ? GETPIXEL16(line, last - 1, 0, width) : last_pixel;
+				bicolor2 = GETPIXEL16(line, last, 0, width);
+				bicolor_spin = FALSE;
+				count += n;
+				last_pixel = bicolor2;
+				last_ypixel = IN_PIXEL16(last_line, last, 0, width, last_ypixel);
+				j = last;
+				continue;
+			}
+
 			if (!TEST_FILL)
 			{
 				if (fill_count > 3 && fill_count >= color_count && fill_count >= bicolor_count &&
@@ -1071,8 +1298,13 @@ SSIZE_T freerdp_bitmap_compress(const void* srcData, UINT32 width, UINT32 height
                                 UINT32 bpp, UINT32 byte_limit, UINT32 start_line, wStream* temp_s,
                                 UINT32 e)
 {
+	InitOnceExecuteOnce(&bitmap_init_once, bitmap_init, NULL, NULL);
 	Stream_SetPosition(temp_s, 0);
 
+	/* Longer lines could never be sent within the 32K limit of a single call */
+	if (width > BITMAP_MAX_LINE_PIXELS)
+		return -1;
+
 	switch (bpp)
 	{
 		case 15:
@@ -0,0 +1,95 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Bitmap Compression - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#include "bitmap_sse2.h"
+
+/* one holds the value 1 in every lane, the class bits are 1, 2, 4 and 8 */
+static INLINE __m128i bitmap_class_bits(__m128i fill, __m128i mix, __m128i color, __m128i alt,
+                                        __m128i one)
+{
+	const __m128i two = _mm_add_epi8(one, one);
+	const __m128i four = _mm_add_epi8(two, two);
+	const __m128i eight = _mm_add_epi8(four, four);
+	__m128i bits = _mm_and_si128(fill, one);
+	bits = _mm_or_si128(bits, _mm_and_si128(mix, two));
+	bits = _mm_or_si128(bits, _mm_and_si128(color, four));
+	/* alternating only counts when the neighbour differs */
+	return _mm_or_si128(bits, _mm_and_si128(_mm_andnot_si128(color, alt), eight));
+}
+
+UINT32 bitmap_classify_row_32_sse2(const BYTE* line, const BYTE* last_line, UINT32 x,
+                                   UINT32 width, UINT32 mix, BYTE* cls)
+{
+	const __m128i vmix = _mm_set1_epi32((int)mix);
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i zero = _mm_setzero_si128();
+
+	/* 8 pixels per iteration, two vectors packed into 8 class bytes */
+	for (; x + 8 <= width; x += 8)
+	{
+		__m128i bits[2];
+		size_t i;
+
+		for (i = 0; i < 2; i++)
+		{
+			const BYTE* src = &line[(x + 4 * i) * 4];
+			const __m128i pixel = _mm_loadu_si128((const __m128i*)src);
+			const __m128i prev = _mm_loadu_si128((const __m128i*)(src - 4));
+			const __m128i prev2 = _mm_loadu_si128((const __m128i*)(src - 8));
+			const __m128i ypixel =
+			    last_line ? _mm_loadu_si128((const __m128i*)&last_line[(x + 4 * i) * 4]) : zero;
+			bits[i] = bitmap_class_bits(_mm_cmpeq_epi32(pixel, ypixel),
+			                            _mm_cmpeq_epi32(pixel, _mm_xor_si128(ypixel, vmix)),
+			                            _mm_cmpeq_epi32(pixel, prev),
+			                            _mm_cmpeq_epi32(pixel, prev2), one);
+		}
+
+		_mm_storel_epi64((__m128i*)&cls[x],
+		                 _mm_packus_epi16(_mm_packs_epi32(bits[0], bits[1]), zero));
+	}
+
+	return x;
+}
+
+UINT32 bitmap_classify_row_16_sse2(const BYTE* line, const BYTE* last_line, UINT32 x,
+                                   UINT32 width, UINT16 mix, BYTE* cls)
+{
+	const __m128i vmix = _mm_set1_epi16((short)mix);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; x + 8 <= width; x += 8)
+	{
+		const BYTE* src = &line[x * 2];
+		const __m128i pixel = _mm_loadu_si128((const __m128i*)src);
+		const __m128i prev = _mm_loadu_si128((const __m128i*)(src - 2));
+		const __m128i prev2 = _mm_loadu_si128((const __m128i*)(src - 4));
+		const __m128i ypixel =
+		    last_line ? _mm_loadu_si128((const __m128i*)&last_line[x * 2]) : zero;
+		const __m128i bits = bitmap_class_bits(
+		    _mm_cmpeq_epi16(pixel, ypixel), _mm_cmpeq_epi16(pixel, _mm_xor_si128(ypixel, vmix)),
+		    _mm_cmpeq_epi16(pixel, prev), _mm_cmpeq_epi16(pixel, prev2), one);
+		_mm_storel_epi64((__m128i*)&cls[x], _mm_packus_epi16(bits, zero));
+	}
+
+	return x;
+}
@@ -0,0 +1,37 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Bitmap Compression - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CODEC_BITMAP_SSE2_H
+#define FREERDP_LIB_CODEC_BITMAP_SSE2_H
+
+#include <winpr/wtypes.h>
+#include <freerdp/api.h>
+
+/* Per pixel results of the run tests, see freerdp_bitmap_compress */
+#define BITMAP_CLASS_FILL 0x01  /* pixel equals the one above */
+#define BITMAP_CLASS_MIX 0x02   /* pixel equals the one above xor the mix color */
+#define BITMAP_CLASS_COLOR 0x04 /* pixel equals its left neighbour */
+#define BITMAP_CLASS_ALT 0x08   /* pixel equals the one two to the left but not its neighbour */
+#define BITMAP_CLASS_RUN (BITMAP_CLASS_FILL | BITMAP_CLASS_MIX | BITMAP_CLASS_COLOR)
+
+/* Classify pixels [x, width) with x >= 2, returns the first pixel not classified */
+FREERDP_LOCAL UINT32 bitmap_classify_row_32_sse2(const BYTE* line, const BYTE* last_line,
+                                                 UINT32 x, UINT32 width, UINT32 mix, BYTE* cls);
+FREERDP_LOCAL UINT32 bitmap_classify_row_16_sse2(const BYTE* line, const BYTE* last_line,
+                                                 UINT32 x, UINT32 width, UINT16 mix, BYTE* cls);
+
+#endif /* FREERDP_LIB_CODEC_BITMAP_SSE2_H */
@@ -37,6 +37,12 @@
 
 #define CLEARCODEC_VBAR_SIZE 32768
 #define CLEARCODEC_VBAR_SHORT_SIZE 16384
+#define CLEARCODEC_VBAR_MAX_HEIGHT 52
+#define CLEARCODEC_VBAR_HASH_SIZE 8192
+#define CLEARCODEC_GLYPH_COUNT 4000
+#define CLEARCODEC_GLYPH_MAX_PIXELS 1024
+#define CLEARCODEC_PALETTE_MAX 127
+#define CLEARCODEC_ENCODE_BLOCK 64
 
 typedef struct
 {
@@ -52,6 +58,51 @@ typedef struct
 	BYTE* pixels;
 } CLEAR_VBAR_ENTRY;
 
+/* Lookup index for a V-bar storage, only used by the encoder. The pixels
+ * stay in the storage entries so they mirror what the decoder holds. */
+typedef struct
+{
+	UINT32 hash[CLEARCODEC_VBAR_SIZE];
+	INT32 next[CLEARCODEC_VBAR_SIZE];
+	BYTE used[CLEARCODEC_VBAR_SIZE];
+	INT32 head[CLEARCODEC_VBAR_HASH_SIZE];
+} CLEAR_VBAR_INDEX;
+
+typedef enum
+{
+	CLEAR_BLOCK_SOLID,
+	CLEAR_BLOCK_TEXT,
+	CLEAR_BLOCK_PALETTE,
+	CLEAR_BLOCK_PHOTO
+} CLEAR_BLOCK_TYPE;
+
+typedef struct
+{
+	CLEAR_BLOCK_TYPE type;
+	UINT32 background;
+} CLEAR_BLOCK;
+
+typedef struct
+{
+	BOOL cacheReset;
+	CLEAR_VBAR_INDEX vBars;
+	CLEAR_VBAR_INDEX shortVBars;
+	UINT32 glyphHash[CLEARCODEC_GLYPH_COUNT];
+	UINT32 glyphCursor;
+	BYTE* coverage;
+	size_t coverageSize;
+	CLEAR_BLOCK* blocks;
+	size_t blocksSize;
+	BYTE indices[CLEARCODEC_ENCODE_BLOCK * CLEARCODEC_ENCODE_BLOCK];
+	BYTE* flipped;
+	size_t flippedSize;
+	wStream* residual;
+	wStream* bands;
+	wStream* subcodecs;
+	wStream* scratch;
+	wStream* s;
+} CLEAR_ENCODER;
+
 struct S_CLEAR_CONTEXT
 {
 	BOOL Compressor;
@@ -62,11 +113,12 @@ struct S_CLEAR_CONTEXT
 	UINT32 nTempStep;
 	UINT32 TempFormat;
 	UINT32 format;
-	CLEAR_GLYPH_ENTRY GlyphCache[4000];
+	CLEAR_GLYPH_ENTRY GlyphCache[CLEARCODEC_GLYPH_COUNT];
 	UINT32 VBarStorageCursor;
 	CLEAR_VBAR_ENTRY VBarStorage[CLEARCODEC_VBAR_SIZE];
 	UINT32 ShortVBarStorageCursor;
 	CLEAR_VBAR_ENTRY ShortVBarStorage[CLEARCODEC_VBAR_SHORT_SIZE];
+	CLEAR_ENCODER* encoder;
 };
 
 static const UINT32 CLEAR_LOG2_FLOOR[256] = {
@@ -1117,10 +1169,826 @@ fail:
 	return rc;
 }
 
-int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData,
+static UINT32 clear_hash_pixels(const UINT32* pixels, UINT32 count)
+{
+	UINT32 i;
+	UINT32 hash = 2166136261u ^ count;
+
+	for (i = 0; i < count; i++)
+	{
+		hash ^= pixels[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void clear_vbar_index_reset(CLEAR_VBAR_INDEX* index)
+{
+	size_t i;
+
+	ZeroMemory(index->used, sizeof(index->used));
+
+	for (i = 0; i < ARRAYSIZE(index->head); i++)
+		index->head[i] = -1;
+}
+
+static INT32 clear_vbar_index_find(const CLEAR_VBAR_INDEX* index, const CLEAR_VBAR_ENTRY* storage,
+                                   UINT32 hash, const UINT32* pixels, UINT32 count)
+{
+	INT32 cur = index->head[hash % CLEARCODEC_VBAR_HASH_SIZE];
+
+	while (cur >= 0)
+	{
+		const CLEAR_VBAR_ENTRY* entry = &storage[cur];
+
+		if ((index->hash[cur] == hash) && (entry->count == count) &&
+		    ((count == 0) || (memcmp(entry->pixels, pixels, count * sizeof(UINT32)) == 0)))
+			return cur;
+
+		cur = index->next[cur];
+	}
+
+	return -1;
+}
+
+/* Replaces the storage entry at slot, just like the decoder does when its
+ * cursor wraps around, and moves the slot to the chain of the new hash. */
+static BOOL clear_vbar_index_store(CLEAR_CONTEXT* clear, CLEAR_VBAR_INDEX* index,
+                                   CLEAR_VBAR_ENTRY* storage, UINT32 slot, UINT32 hash,
+                                   const UINT32* pixels, UINT32 count)
+{
+	UINT32 bucket;
+	CLEAR_VBAR_ENTRY* entry = &storage[slot];
+
+	if (index->used[slot])
+	{
+		INT32* link = &index->head[index->hash[slot] % CLEARCODEC_VBAR_HASH_SIZE];
+
+		while (*link != (INT32)slot)
+			link = &index->next[*link];
+
+		*link = index->next[slot];
+		index->used[slot] = 0;
+	}
+
+	entry->count = count;
+
+	if (!resize_vbar_entry(clear, entry))
+		return FALSE;
+
+	if (count > 0)
+		CopyMemory(entry->pixels, pixels, count * sizeof(UINT32));
+
+	bucket = hash % CLEARCODEC_VBAR_HASH_SIZE;
+	index->hash[slot] = hash;
+	index->next[slot] = index->head[bucket];
+	index->head[bucket] = (INT32)slot;
+	index->used[slot] = 1;
+	return TRUE;
+}
+
+static void clear_encoder_free(CLEAR_ENCODER* encoder)
+{
+	if (!encoder)
+		return;
+
+	Stream_Free(encoder->residual, TRUE);
+	Stream_Free(encoder->bands, TRUE);
+	Stream_Free(encoder->subcodecs, TRUE);
+	Stream_Free(encoder->scratch, TRUE);
+	Stream_Free(encoder->s, TRUE);
+	free(encoder->coverage);
+	free(encoder->blocks);
+	free(encoder->flipped);
+	free(encoder);
+}
+
+static CLEAR_ENCODER* clear_encoder_new(void)
+{
+	CLEAR_ENCODER* encoder = (CLEAR_ENCODER*)calloc(1, sizeof(CLEAR_ENCODER));
+
+	if (!encoder)
+		return NULL;
+
+	encoder->residual = Stream_New(NULL, 1024);
+	encoder->bands = Stream_New(NULL, 1024);
+	encoder->subcodecs = Stream_New(NULL, 1024);
+	encoder->scratch = Stream_New(NULL, 1024);
+	encoder->s = Stream_New(NULL, 1024);
+
+	if (!encoder->residual || !encoder->bands || !encoder->subcodecs || !encoder->scratch ||
+	    !encoder->s)
+	{
+		clear_encoder_free(encoder);
+		return NULL;
+	}
+
+	clear_vbar_index_reset(&encoder->vBars);
+	clear_vbar_index_reset(&encoder->shortVBars);
+	encoder->cacheReset = TRUE;
+	return encoder;
+}
+
+static BOOL clear_write_run_length(wStream* s, UINT32 runLength)
+{
+	if (!Stream_EnsureRemainingCapacity(s, 7))
+		return FALSE;
+
+	if (runLength < 0xFF)
+		Stream_Write_UINT8(s, (BYTE)runLength);
+	else
+	{
+		Stream_Write_UINT8(s, 0xFF);
+
+		if (runLength < 0xFFFF)
+			Stream_Write_UINT16(s, (UINT16)runLength);
+		else
+		{
+			Stream_Write_UINT16(s, 0xFFFF);
+			Stream_Write_UINT32(s, runLength);
+		}
+	}
+
+	return TRUE;
+}
+
+/* Pixels are kept as BGRX32, the first three bytes in memory are b, g, r. */
+static INLINE void clear_write_bgr(wStream* s, UINT32 color)
+{
+	Stream_Write(s, &color, 3);
+}
+
+static CLEAR_BLOCK_TYPE clear_classify_block(const UINT32* pixels, UINT32 step, UINT32 width,
+                                             UINT32 height, UINT32* background)
+{
+	UINT32 x, y;
+	UINT32 colors = 0;
+	UINT32 dominant = 0;
+	UINT32 dominantCount = 0;
+	UINT32 keys[256];
+	UINT32 counts[256] = { 0 };
+
+	for (y = 0; y < height; y++)
+	{
+		const UINT32* row = &pixels[y * step];
+
+		for (x = 0; x < width; x++)
+		{
+			const UINT32 color = row[x];
+			UINT32 slot = (color * 2654435761u) >> 24;
+
+			while (counts[slot] && (keys[slot] != color))
+				slot = (slot + 1) & 0xFF;
+
+			if (!counts[slot])
+			{
+				if (colors == CLEARCODEC_PALETTE_MAX)
+					return CLEAR_BLOCK_PHOTO;
+
+				keys[slot] = color;
+				colors++;
+			}
+
+			if (++counts[slot] > dominantCount)
+			{
+				dominantCount = counts[slot];
+				dominant = color;
+			}
+		}
+	}
+
+	*background = dominant;
+
+	if (colors == 1)
+		return CLEAR_BLOCK_SOLID;
+
+	if (dominantCount * 2 >= width * height)
+		return CLEAR_BLOCK_TEXT;
+
+	return CLEAR_BLOCK_PALETTE;
+}
+
+static void clear_mark_coverage(CLEAR_ENCODER* encoder, UINT32 width, UINT32 x, UINT32 y,
+                                UINT32 w, UINT32 h)
+{
+	UINT32 row;
+
+	for (row = y; row < y + h; row++)
+		FillMemory(&encoder->coverage[row * width + x], w, 1);
+}
+
+static BOOL clear_row_is_background(const UINT32* row, UINT32 x0, UINT32 x1, UINT32 background)
+{
+	UINT32 x;
+
+	for (x = x0; x < x1; x++)
+	{
+		if (row[x] != background)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_vbar(CLEAR_CONTEXT* clear, wStream* s, const UINT32* column,
+                              UINT32 count, UINT32 background)
+{
+	INT32 index;
+	UINT32 hash;
+	UINT32 yOn = 0;
+	UINT32 yOff = 0;
+	UINT32 y;
+	CLEAR_ENCODER* encoder = clear->encoder;
+
+	if (!Stream_EnsureRemainingCapacity(s, 3 + 3ull * count))
+		return FALSE;
+
+	hash = clear_hash_pixels(column, count);
+	index = clear_vbar_index_find(&encoder->vBars, clear->VBarStorage, hash, column, count);
+
+	if (index >= 0)
+	{
+		Stream_Write_UINT16(s, 0x8000 | (UINT16)index);
+		return TRUE;
+	}
+
+	for (y = 0; y < count; y++)
+	{
+		if (column[y] != background)
+		{
+			if (yOff == 0)
+				yOn = y;
+
+			yOff = y + 1;
+		}
+	}
+
+	{
+		const UINT32 shortCount = yOff - yOn;
+		const UINT32 shortHash = clear_hash_pixels(&column[yOn], shortCount);
+		index = clear_vbar_index_find(&encoder->shortVBars, clear->ShortVBarStorage, shortHash,
+		                              &column[yOn], shortCount);
+
+		if (index >= 0)
+		{
+			Stream_Write_UINT16(s, 0x4000 | (UINT16)index);
+			Stream_Write_UINT8(s, (BYTE)yOn);
+		}
+		else
+		{
+			Stream_Write_UINT16(s, (UINT16)((yOff << 8) | yOn));
+
+			for (y = yOn; y < yOff; y++)
+				clear_write_bgr(s, column[y]);
+
+			if (!clear_vbar_index_store(clear, &encoder->shortVBars, clear->ShortVBarStorage,
+			                            clear->ShortVBarStorageCursor, shortHash, &column[yOn],
+			                            shortCount))
+				return FALSE;
+
+			clear->ShortVBarStorageCursor =
+			    (clear->ShortVBarStorageCursor + 1) % CLEARCODEC_VBAR_SHORT_SIZE;
+		}
+	}
+
+	if (!clear_vbar_index_store(clear, &encoder->vBars, clear->VBarStorage,
+	                            clear->VBarStorageCursor, hash, column, count))
+		return FALSE;
+
+	clear->VBarStorageCursor = (clear->VBarStorageCursor + 1) % CLEARCODEC_VBAR_SIZE;
+	return TRUE;
+}
+
+static BOOL clear_encode_band(CLEAR_CONTEXT* clear, const UINT32* pixels, UINT32 width, UINT32 x0,
+                              UINT32 x1, UINT32 y0, UINT32 y1, UINT32 background)
+{
+	UINT32 x, y;
+	UINT32 column[CLEARCODEC_VBAR_MAX_HEIGHT];
+	wStream* s = clear->encoder->bands;
+
+	if (!Stream_EnsureRemainingCapacity(s, 11))
+		return FALSE;
+
+	Stream_Write_UINT16(s, (UINT16)x0);
+	Stream_Write_UINT16(s, (UINT16)(x1 - 1));
+	Stream_Write_UINT16(s, (UINT16)y0);
+	Stream_Write_UINT16(s, (UINT16)(y1 - 1));
+	clear_write_bgr(s, background);
+
+	for (x = x0; x < x1; x++)
+	{
+		for (y = y0; y < y1; y++)
+			column[y - y0] = pixels[y * width + x];
+
+		if (!clear_encode_vbar(clear, s, column, y1 - y0, background))
+			return FALSE;
+	}
+
+	clear_mark_coverage(clear->encoder, width, x0, y0, x1 - x0, y1 - y0);
+	return TRUE;
+}
+
+/* Text areas are cut into bands at rows holding only the background, so a
+ * line of text lands at the same offset inside its band from frame to frame
+ * and its columns hit the V-bar cache. Background rows go to the residual. */
+static BOOL clear_encode_bands(CLEAR_CONTEXT* clear, const UINT32* pixels, UINT32 width, UINT32 x0,
+                               UINT32 x1, UINT32 y0, UINT32 y1, UINT32 background)
+{
+	UINT32 y = y0;
+
+	while (y < y1)
+	{
+		UINT32 start;
+
+		if (clear_row_is_background(&pixels[y * width], x0, x1, background))
+		{
+			y++;
+			continue;
+		}
+
+		start = y++;
+
+		while ((y < y1) && (y - start < CLEARCODEC_VBAR_MAX_HEIGHT) &&
+		       !clear_row_is_background(&pixels[y * width], x0, x1, background))
+			y++;
+
+		if (!clear_encode_band(clear, pixels, width, x0, x1, start, y, background))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_rlex(CLEAR_ENCODER* encoder, wStream* s, const UINT32* pixels,
+                              UINT32 step, UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+	UINT32 i;
+	UINT32 numBits;
+	UINT32 maxDepth;
+	UINT32 paletteCount = 0;
+	UINT32 palette[CLEARCODEC_PALETTE_MAX];
+	UINT32 keys[256];
+	BYTE slots[256] = { 0 };
+	BYTE* indices = encoder->indices;
+	const UINT32 count = width * height;
+
+	/* The palette is built in order of appearance, gradients then map to
+	 * ascending indices which the suites can express. */
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			const UINT32 color = pixels[y * step + x];
+			UINT32 slot = (color * 2654435761u) >> 24;
+
+			while (slots[slot] && (keys[slot] != color))
+				slot = (slot + 1) & 0xFF;
+
+			if (!slots[slot])
+			{
+				if (paletteCount == CLEARCODEC_PALETTE_MAX)
+					return FALSE;
+
+				keys[slot] = color;
+				palette[paletteCount++] = color;
+				slots[slot] = (BYTE)paletteCount;
+			}
+
+			indices[y * width + x] = slots[slot] - 1;
+		}
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, 1 + 3ull * paletteCount))
+		return FALSE;
+
+	Stream_Write_UINT8(s, (BYTE)paletteCount);
+
+	for (i = 0; i < paletteCount; i++)
+		clear_write_bgr(s, palette[i]);
+
+	numBits = CLEAR_LOG2_FLOOR[paletteCount - 1] + 1;
+	maxDepth = CLEAR_8BIT_MASKS[8 - numBits];
+	i = 0;
+
+	while (i < count)
+	{
+		const BYTE startIndex = indices[i];
+		UINT32 runLength = 1;
+		UINT32 suiteDepth = 0;
+
+		while ((i + runLength < count) && (indices[i + runLength] == startIndex))
+			runLength++;
+
+		/* The last pixel of the run is the first one of the suite */
+		i += runLength - 1;
+
+		while ((suiteDepth < maxDepth) && (i + suiteDepth + 1 < count) &&
+		       (startIndex + suiteDepth + 1u < paletteCount) &&
+		       (indices[i + suiteDepth + 1] == startIndex + suiteDepth + 1))
+			suiteDepth++;
+
+		if (!Stream_EnsureRemainingCapacity(s, 1))
+			return FALSE;
+
+		Stream_Write_UINT8(s, (BYTE)((suiteDepth << numBits) | (startIndex + suiteDepth)));
+
+		if (!clear_write_run_length(s, runLength - 1))
+			return FALSE;
+
+		i += suiteDepth + 1;
+	}
+
+	return TRUE;
+}
+
+/* nsc_compose_message produces bottom up bitmaps for surface bits, the
+ * ClearCodec subcodec is decoded top down. */
+static BOOL clear_encode_nscodec(CLEAR_CONTEXT* clear, wStream* s, const UINT32* pixels,
+                                 UINT32 step, UINT32 width, UINT32 height)
+{
+	CLEAR_ENCODER* encoder = clear->encoder;
+	const size_t size = 4ull * width * height;
+
+	if (size > encoder->flippedSize)
+	{
+		BYTE* tmp = (BYTE*)realloc(encoder->flipped, size);
+
+		if (!tmp)
+			return FALSE;
+
+		encoder->flipped = tmp;
+		encoder->flippedSize = size;
+	}
+
+	if (!freerdp_image_copy(encoder->flipped, clear->format, width * 4, 0, 0, width, height,
+	                        (const BYTE*)pixels, clear->format, step * 4, 0, 0, NULL,
+	                        FREERDP_FLIP_VERTICAL))
+		return FALSE;
+
+	return nsc_compose_message(clear->nsc, s, encoder->flipped, width, height, width * 4);
+}
+
+static BOOL clear_encode_subcodec(CLEAR_CONTEXT* clear, const UINT32* pixels, UINT32 width,
+                                  UINT32 x0, UINT32 y0, UINT32 w, UINT32 h, BYTE subcodecId)
+{
+	UINT32 x, y;
+	size_t length;
+	CLEAR_ENCODER* encoder = clear->encoder;
+	const UINT32* src = &pixels[y0 * width + x0];
+	const size_t rawLength = 3ull * w * h;
+	wStream* s = encoder->subcodecs;
+	wStream* scratch = encoder->scratch;
+	BOOL rc;
+
+	Stream_SetPosition(scratch, 0);
+
+	if (subcodecId == 1)
+		rc = clear_encode_nscodec(clear, scratch, src, width, w, h);
+	else
+		rc = clear_encode_rlex(encoder, scratch, src, width, w, h);
+
+	length = Stream_GetPosition(scratch);
+
+	/* Fall back to uncompressed pixels if the subcodec does not pay off */
+	if (!rc || (length >= rawLength))
+	{
+		subcodecId = 0;
+		length = rawLength;
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, 13 + length))
+		return FALSE;
+
+	Stream_Write_UINT16(s, (UINT16)x0);
+	Stream_Write_UINT16(s, (UINT16)y0);
+	Stream_Write_UINT16(s, (UINT16)w);
+	Stream_Write_UINT16(s, (UINT16)h);
+	Stream_Write_UINT32(s, (UINT32)length);
+	Stream_Write_UINT8(s, subcodecId);
+
+	if (subcodecId == 0)
+	{
+		for (y = 0; y < h; y++)
+		{
+			for (x = 0; x < w; x++)
+				clear_write_bgr(s, src[y * width + x]);
+		}
+	}
+	else
+		Stream_Write(s, Stream_Buffer(scratch), length);
+
+	clear_mark_coverage(encoder, width, x0, y0, w, h);
+	return TRUE;
+}
+
+/* Covered pixels are painted by bands or subcodecs later on, the residual
+ * run lengths may span them freely. */
+static BOOL clear_encode_residual(CLEAR_ENCODER* encoder, const UINT32* pixels, UINT32 count)
+{
+	UINT32 i;
+	UINT32 runColor = 0;
+	UINT32 runLength = 0;
+	BOOL runStarted = FALSE;
+	wStream* s = encoder->residual;
+
+	for (i = 0; i < count; i++)
+	{
+		if (encoder->coverage[i] || (runStarted && (pixels[i] == runColor)))
+		{
+			runLength++;
+			continue;
+		}
+
+		if (runStarted)
+		{
+			if (!Stream_EnsureRemainingCapacity(s, 3))
+				return FALSE;
+
+			clear_write_bgr(s, runColor);
+
+			if (!clear_write_run_length(s, runLength))
+				return FALSE;
+
+			runLength = 0;
+		}
+
+		runStarted = TRUE;
+		runColor = pixels[i];
+		runLength++;
+	}
+
+	/* Nothing is left to the residual layer if all pixels are covered */
+	if (!runStarted)
+		return TRUE;
+
+	if (!Stream_EnsureRemainingCapacity(s, 3))
+		return FALSE;
+
+	clear_write_bgr(s, runColor);
+	return clear_write_run_length(s, runLength);
+}
+
+static BOOL clear_encode_layers(CLEAR_CONTEXT* clear, const UINT32* pixels, UINT32 width,
+                                UINT32 height)
+{
+	UINT32 bx, by;
+	CLEAR_ENCODER* encoder = clear->encoder;
+	const size_t count = 1ull * width * height;
+	const UINT32 blocksX = (width + CLEARCODEC_ENCODE_BLOCK - 1) / CLEARCODEC_ENCODE_BLOCK;
+	const UINT32 blocksY = (height + CLEARCODEC_ENCODE_BLOCK - 1) / CLEARCODEC_ENCODE_BLOCK;
+
+	if (count > encoder->coverageSize)
+	{
+		BYTE* tmp = (BYTE*)realloc(encoder->coverage, count);
+
+		if (!tmp)
+			return FALSE;
+
+		encoder->coverage = tmp;
+		encoder->coverageSize = count;
+	}
+
+	if (1ull * blocksX * blocksY > encoder->blocksSize)
+	{
+		CLEAR_BLOCK* tmp =
+		    (CLEAR_BLOCK*)realloc(encoder->blocks, sizeof(CLEAR_BLOCK) * blocksX * blocksY);
+
+		if (!tmp)
+			return FALSE;
+
+		encoder->blocks = tmp;
+		encoder->blocksSize = 1ull * blocksX * blocksY;
+	}
+
+	ZeroMemory(encoder->coverage, count);
+	Stream_SetPosition(encoder->residual, 0);
+	Stream_SetPosition(encoder->bands, 0);
+	Stream_SetPosition(encoder->subcodecs, 0);
+
+	for (by = 0; by < blocksY; by++)
+	{
+		const UINT32 y0 = by * CLEARCODEC_ENCODE_BLOCK;
+		const UINT32 y1 = MIN(y0 + CLEARCODEC_ENCODE_BLOCK, height);
+		CLEAR_BLOCK* blocks = &encoder->blocks[by * blocksX];
+
+		for (bx = 0; bx < blocksX; bx++)
+		{
+			const UINT32 x0 = bx * CLEARCODEC_ENCODE_BLOCK;
+			const UINT32 x1 = MIN(x0 + CLEARCODEC_ENCODE_BLOCK, width);
+			blocks[bx].type = clear_classify_block(&pixels[y0 * width + x0], width, x1 - x0,
+			                                       y1 - y0, &blocks[bx].background);
+		}
+
+		bx = 0;
+
+		while (bx < blocksX)
+		{
+			UINT32 end = bx + 1;
+			const UINT32 x0 = bx * CLEARCODEC_ENCODE_BLOCK;
+			const CLEAR_BLOCK* block = &blocks[bx];
+
+			switch (block->type)
+			{
+				case CLEAR_BLOCK_TEXT:
+					while ((end < blocksX) && (blocks[end].type == CLEAR_BLOCK_TEXT) &&
+					       (blocks[end].background == block->background))
+						end++;
+
+					if (!clear_encode_bands(clear, pixels, width, x0,
+					                        MIN(end * CLEARCODEC_ENCODE_BLOCK, width), y0, y1,
+					                        block->background))
+						return FALSE;
+
+					break;
+
+				case CLEAR_BLOCK_PALETTE:
+					if (!clear_encode_subcodec(clear, pixels, width, x0, y0,
+					                           MIN(x0 + CLEARCODEC_ENCODE_BLOCK, width) - x0,
+					                           y1 - y0, 2))
+						return FALSE;
+
+					break;
+
+				case CLEAR_BLOCK_PHOTO:
+					while ((end < blocksX) && (blocks[end].type == CLEAR_BLOCK_PHOTO))
+						end++;
+
+					if (!clear_encode_subcodec(clear, pixels, width, x0, y0,
+					                           MIN(end * CLEARCODEC_ENCODE_BLOCK, width) - x0,
+					                           y1 - y0, 1))
+						return FALSE;
+
+					break;
+
+				case CLEAR_BLOCK_SOLID:
+				default:
+					break;
+			}
+
+			bx = end;
+		}
+	}
+
+	return clear_encode_residual(encoder, pixels, (UINT32)count);
+}
+
+static INT32 clear_find_glyph(CLEAR_CONTEXT* clear, UINT32 hash, const UINT32* pixels,
+                              UINT32 count)
+{
+	UINT32 i;
+
+	for (i = 0; i < CLEARCODEC_GLYPH_COUNT; i++)
+	{
+		const CLEAR_GLYPH_ENTRY* glyphEntry = &clear->GlyphCache[i];
+
+		if ((clear->encoder->glyphHash[i] == hash) && (glyphEntry->count == count) &&
+		    glyphEntry->pixels && (memcmp(glyphEntry->pixels, pixels, count * sizeof(UINT32)) == 0))
+			return (INT32)i;
+	}
+
+	return -1;
+}
+
+static BOOL clear_store_glyph(CLEAR_CONTEXT* clear, UINT32 glyphIndex, UINT32 hash,
+                              const UINT32* pixels, UINT32 count)
+{
+	CLEAR_GLYPH_ENTRY* glyphEntry = &clear->GlyphCache[glyphIndex];
+
+	if (count > glyphEntry->size)
+	{
+		UINT32* tmp = (UINT32*)realloc(glyphEntry->pixels, count * sizeof(UINT32));
+
+		if (!tmp)
+			return FALSE;
+
+		glyphEntry->pixels = tmp;
+		glyphEntry->size = count;
+	}
+
+	CopyMemory(glyphEntry->pixels, pixels, count * sizeof(UINT32));
+	glyphEntry->count = count;
+	clear->encoder->glyphHash[glyphIndex] = hash;
+	return TRUE;
+}
+
+int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize, UINT32 SrcFormat,
+                   UINT32 nWidth, UINT32 nHeight, UINT32 nSrcStep, BYTE** ppDstData,
                    UINT32* pDstSize)
 {
-	WLog_ERR(TAG, "TODO: %s not implemented!", __FUNCTION__);
+	UINT32 i;
+	UINT32* pixels;
+	UINT32 hash = 0;
+	UINT32 glyphIndex = 0;
+	BYTE glyphFlags = 0;
+	BOOL storeGlyph = FALSE;
+	UINT32 opaque;
+	size_t residualLength, bandsLength, subcodecLength;
+	const BYTE alpha[4] = { 0, 0, 0, 0xFF };
+	const UINT32 count = nWidth * nHeight;
+	const UINT32 bpp = FreeRDPGetBytesPerPixel(SrcFormat);
+	CLEAR_ENCODER* encoder;
+	wStream* s;
+
+	if (!clear || !clear->Compressor || !clear->encoder || !pSrcData || !ppDstData || !pDstSize)
+		return -1;
+
+	if ((nWidth == 0) || (nHeight == 0) || (nWidth > 0xFFFF) || (nHeight > 0xFFFF))
+		return -1;
+
+	if (nSrcStep == 0)
+		nSrcStep = nWidth * bpp;
+
+	if (SrcSize < 1ull * nSrcStep * (nHeight - 1) + 1ull * nWidth * bpp)
+		return -1;
+
+	encoder = clear->encoder;
+	s = encoder->s;
+
+	if (!clear_resize_buffer(clear, nWidth, nHeight))
+		return -1;
+
+	if (!freerdp_image_copy(clear->TempBuffer, clear->format, nWidth * sizeof(UINT32), 0, 0,
+	                        nWidth, nHeight, pSrcData, SrcFormat, nSrcStep, 0, 0, NULL,
+	                        FREERDP_FLIP_NONE))
+		return -1;
+
+	/* Colors are compared as whole words, make the unused byte constant */
+	pixels = (UINT32*)clear->TempBuffer;
+	CopyMemory(&opaque, alpha, sizeof(opaque));
+
+	for (i = 0; i < count; i++)
+		pixels[i] |= opaque;
+
+	if (encoder->cacheReset)
+	{
+		glyphFlags |= CLEARCODEC_FLAG_CACHE_RESET;
+		clear_vbar_index_reset(&encoder->vBars);
+		clear_vbar_index_reset(&encoder->shortVBars);
+		clear->VBarStorageCursor = 0;
+		clear->ShortVBarStorageCursor = 0;
+		encoder->cacheReset = FALSE;
+	}
+
+	if (count <= CLEARCODEC_GLYPH_MAX_PIXELS)
+	{
+		INT32 hit;
+
+		hash = clear_hash_pixels(pixels, count);
+		hit = clear_find_glyph(clear, hash, pixels, count);
+		glyphFlags |= CLEARCODEC_FLAG_GLYPH_INDEX;
+
+		if (hit >= 0)
+		{
+			glyphFlags |= CLEARCODEC_FLAG_GLYPH_HIT;
+			glyphIndex = (UINT32)hit;
+		}
+		else
+		{
+			glyphIndex = encoder->glyphCursor;
+			encoder->glyphCursor = (encoder->glyphCursor + 1) % CLEARCODEC_GLYPH_COUNT;
+			storeGlyph = TRUE;
+		}
+	}
+
+	Stream_SetPosition(s, 0);
+
+	if (!Stream_EnsureRemainingCapacity(s, 4))
+		return -1;
+
+	Stream_Write_UINT8(s, glyphFlags);
+	Stream_Write_UINT8(s, (BYTE)clear->seqNumber);
+
+	if (glyphFlags & CLEARCODEC_FLAG_GLYPH_INDEX)
+		Stream_Write_UINT16(s, (UINT16)glyphIndex);
+
+	if (!(glyphFlags & CLEARCODEC_FLAG_GLYPH_HIT))
+	{
+		if (!clear_encode_layers(clear, pixels, nWidth, nHeight))
+			return -1;
+
+		residualLength = Stream_GetPosition(encoder->residual);
+		bandsLength = Stream_GetPosition(encoder->bands);
+		subcodecLength = Stream_GetPosition(encoder->subcodecs);
+
+		if (!Stream_EnsureRemainingCapacity(s, 12 + residualLength + bandsLength + subcodecLength))
+			return -1;
+
+		Stream_Write_UINT32(s, (UINT32)residualLength);
+		Stream_Write_UINT32(s, (UINT32)bandsLength);
+		Stream_Write_UINT32(s, (UINT32)subcodecLength);
+		Stream_Write(s, Stream_Buffer(encoder->residual), residualLength);
+		Stream_Write(s, Stream_Buffer(encoder->bands), bandsLength);
+		Stream_Write(s, Stream_Buffer(encoder->subcodecs), subcodecLength);
+
+		if (storeGlyph && !clear_store_glyph(clear, glyphIndex, hash, pixels, count))
+			return -1;
+	}
+
+	clear->seqNumber = (clear->seqNumber + 1) % 256;
+	*ppDstData = Stream_Buffer(s);
+	*pDstSize = (UINT32)Stream_GetPosition(s);
 	return 1;
 }
 
@@ -1163,6 +2031,14 @@ CLEAR_CONTEXT* clear_context_new(BOOL Compressor)
 	if (!clear_context_reset(clear))
 		goto error_nsc;
 
+	if (Compressor)
+	{
+		clear->encoder = clear_encoder_new();
+
+		if (!clear->encoder)
+			goto error_nsc;
+	}
+
 	return clear;
 error_nsc:
 	clear_context_free(clear);
@@ -1179,6 +2055,7 @@ void clear_context_free(CLEAR_CONTEXT* clear)
 
 	clear_reset_vbar_storage(clear, TRUE);
 	clear_reset_glyph_cache(clear);
+	clear_encoder_free(clear->encoder);
 
 	free(clear);
 }
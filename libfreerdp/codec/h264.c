@@ -209,12 +209,10 @@ static BOOL detect_changes(BOOL firstFrameDone, const UINT32 QP, const RECTANGLE
 			for (x = regionRect->left; x < regionRect->right; x += 64)
 			{
 				RECTANGLE_16 rect;
-				rect.left = (UINT16)MIN(UINT16_MAX, regionRect->left + x);
-				rect.top = (UINT16)MIN(UINT16_MAX, regionRect->top + y);
-				rect.right =
-				    (UINT16)MIN(UINT16_MAX, MIN(regionRect->left + x + 64, regionRect->right));
-				rect.bottom =
-				    (UINT16)MIN(UINT16_MAX, MIN(regionRect->top + y + 64, regionRect->bottom));
+				rect.left = (UINT16)x;
+				rect.top = (UINT16)y;
+				rect.right = (UINT16)MIN(x + 64, regionRect->right);
+				rect.bottom = (UINT16)MIN(y + 64, regionRect->bottom);
 				if (diff_tile(&rect, pYUVData, pOldYUVData, iStride))
 					rectangles[count++] = rect;
 			}
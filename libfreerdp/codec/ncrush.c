@@ -2010,6 +2010,23 @@ static INLINE void NCrushWriteFinish(BYTE** DstPtr, UINT32 accumulator)
 	*(*DstPtr)++ = (accumulator >> 8) & 0xFF;
 }
 
+/* Copies a match that may overlap its own output. The bytes already written repeat
+ * with the match period, so each pass can copy twice as much as the one before. */
+static INLINE void ncrush_copy_match(BYTE* dst, const BYTE* src, UINT32 length)
+{
+	WINPR_ASSERT(dst);
+	WINPR_ASSERT(src);
+
+	while (length > 0)
+	{
+		const UINT32 valid = (UINT32)(dst - src);
+		const UINT32 bytes = (length < valid) ? length : valid;
+		CopyMemory(dst, src, bytes);
+		dst += bytes;
+		length -= bytes;
+	}
+}
+
 int ncrush_decompress(NCRUSH_CONTEXT* ncrush, const BYTE* pSrcData, UINT32 SrcSize,
                       const BYTE** ppDstData, UINT32* pDstSize, UINT32 flags)
 {
@@ -2205,6 +2222,9 @@ int ncrush_decompress(NCRUSH_CONTEXT* ncrush, const BYTE* pSrcData, UINT32 SrcSi
 		if (LengthOfMatch < 2)
 			return -1005;
 
+		if (CopyOffset == 0)
+			return -1008;
+
 		if ((CopyOffsetPtr >= (HistoryBufferEnd - LengthOfMatch)) ||
 		    (HistoryPtr >= (HistoryBufferEnd - LengthOfMatch)))
 			return -1006;
@@ -2215,18 +2235,8 @@ int ncrush_decompress(NCRUSH_CONTEXT* ncrush, const BYTE* pSrcData, UINT32 SrcSi
 
 		if (CopyOffsetPtr >= HistoryBuffer)
 		{
-			while (CopyLength > 0)
-			{
-				*HistoryPtr++ = *CopyOffsetPtr++;
-				CopyLength--;
-			}
-
-			while (LengthOfMatch > CopyOffset)
-			{
-				index = ((index >= CopyOffset)) ? 0 : index;
-				*HistoryPtr++ = *(CopyOffsetPtr + index++);
-				LengthOfMatch--;
-			}
+			ncrush_copy_match(HistoryPtr, CopyOffsetPtr, LengthOfMatch);
+			HistoryPtr += LengthOfMatch;
 		}
 		else
 		{
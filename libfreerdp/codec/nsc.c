@@ -374,6 +374,7 @@ void nsc_context_free(NSC_CONTEXT* context)
 		for (i = 0; i < 5; i++)
 			free(context->priv->PlaneBuffers[i]);
 
+		free(context->priv->RleBuffer);
 		nsc_profiler_print(context->priv);
 		PROFILER_FREE(context->priv->prof_nsc_rle_decompress_data)
 		PROFILER_FREE(context->priv->prof_nsc_decode)
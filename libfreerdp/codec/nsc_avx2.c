@@ -0,0 +1,125 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * NSCodec Library - AVX2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Same arithmetic as the SSE2 kernels in nsc_sse2.c, 16 pixels at a time.
+ */
+
+#include <freerdp/config.h>
+
+#include <immintrin.h>
+
+#include <winpr/sysinfo.h>
+
+#include "nsc_types.h"
+#include "nsc_avx2.h"
+
+#if !defined(WITH_AVX2)
+#error "This file needs WITH_AVX2 enabled!"
+#endif
+
+/* Extracts the byte at offset from every 32bit lane, the alpha offset -1 yields 0xFF */
+static INLINE __m256i nsc_channel_avx2(__m256i lo, __m256i hi, int offset)
+{
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+
+	if (offset < 0)
+		return _mm256_set1_epi16(0xFF);
+
+	lo = _mm256_and_si256(_mm256_srl_epi32(lo, _mm_cvtsi32_si128(offset * 8)), mask);
+	hi = _mm256_and_si256(_mm256_srl_epi32(hi, _mm_cvtsi32_si128(offset * 8)), mask);
+	/* packs works per 128bit lane, restore the pixel order */
+	return _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+}
+
+/* Truncates 16bit lanes to bytes like the (BYTE) casts of the generic encoder */
+static INLINE __m128i nsc_pack_avx2(__m256i val)
+{
+	val = _mm256_and_si256(val, _mm256_set1_epi16(0xFF));
+	val = _mm256_permute4x64_epi64(_mm256_packus_epi16(val, val), 0xD8);
+	return _mm256_castsi256_si128(val);
+}
+
+static UINT32 nsc_encode_row_avx2(NSC_CONTEXT* context, const BYTE* src, UINT32 width,
+                                  BYTE* yplane, BYTE* coplane, BYTE* cgplane, BYTE* aplane)
+{
+	int r, g, b, a;
+	UINT32 x;
+	const __m128i ccl = _mm_cvtsi32_si128((int)context->ColorLossLevel);
+
+	if (!nsc_encode_channel_offsets(context->format, &r, &g, &b, &a))
+		return 0;
+
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const __m256i lo = _mm256_loadu_si256((const __m256i*)&src[x * 4]);
+		const __m256i hi = _mm256_loadu_si256((const __m256i*)&src[x * 4 + 32]);
+		const __m256i r_val = nsc_channel_avx2(lo, hi, r);
+		const __m256i g_val = nsc_channel_avx2(lo, hi, g);
+		const __m256i b_val = nsc_channel_avx2(lo, hi, b);
+		const __m256i a_val = nsc_channel_avx2(lo, hi, a);
+		__m256i y_val;
+		__m256i co_val;
+		__m256i cg_val;
+		y_val = _mm256_srai_epi16(r_val, 2);
+		y_val = _mm256_add_epi16(y_val, _mm256_srai_epi16(g_val, 1));
+		y_val = _mm256_add_epi16(y_val, _mm256_srai_epi16(b_val, 2));
+		co_val = _mm256_sub_epi16(r_val, b_val);
+		co_val = _mm256_sra_epi16(co_val, ccl);
+		cg_val = _mm256_sub_epi16(g_val, _mm256_srai_epi16(r_val, 1));
+		cg_val = _mm256_sub_epi16(cg_val, _mm256_srai_epi16(b_val, 1));
+		cg_val = _mm256_sra_epi16(cg_val, ccl);
+		_mm_storeu_si128((__m128i*)&yplane[x], nsc_pack_avx2(y_val));
+		_mm_storeu_si128((__m128i*)&coplane[x], nsc_pack_avx2(co_val));
+		_mm_storeu_si128((__m128i*)&cgplane[x], nsc_pack_avx2(cg_val));
+		_mm_storeu_si128((__m128i*)&aplane[x], nsc_pack_avx2(a_val));
+	}
+
+	return x;
+}
+
+/* Sums of horizontally adjacent signed bytes of a row */
+static INLINE __m256i nsc_pair_sum_avx2(__m256i val)
+{
+	const __m256i even = _mm256_srai_epi16(_mm256_slli_epi16(val, 8), 8);
+	const __m256i odd = _mm256_srai_epi16(val, 8);
+	return _mm256_add_epi16(even, odd);
+}
+
+static UINT32 nsc_subsample_row_avx2(const BYTE* src0, const BYTE* src1, UINT32 width, BYTE* dst)
+{
+	UINT32 x;
+
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const __m256i row0 = _mm256_loadu_si256((const __m256i*)&src0[2 * x]);
+		const __m256i row1 = _mm256_loadu_si256((const __m256i*)&src1[2 * x]);
+		const __m256i sum =
+		    _mm256_add_epi16(nsc_pair_sum_avx2(row0), nsc_pair_sum_avx2(row1));
+		_mm_storeu_si128((__m128i*)&dst[x], nsc_pack_avx2(_mm256_srai_epi16(sum, 2)));
+	}
+
+	return x;
+}
+
+void nsc_init_avx2(NSC_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		return;
+
+	PROFILER_RENAME(context->priv->prof_nsc_encode, "nsc_encode_avx2")
+	context->encodeRow = nsc_encode_row_avx2;
+	context->subsampleRow = nsc_subsample_row_avx2;
+}
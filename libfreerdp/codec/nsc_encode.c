@@ -26,6 +26,7 @@
 #include <string.h>
 
 #include <winpr/crt.h>
+#include <winpr/pool.h>
 
 #include <freerdp/codec/nsc.h>
 #include <freerdp/codec/color.h>
@@ -33,6 +34,9 @@
 #include "nsc_types.h"
 #include "nsc_encode.h"
 
+/* Bitmaps with at least this many pixels RLE encode their planes in parallel */
+#define NSC_PARALLEL_MIN_PIXELS (256 * 256)
+
 typedef struct
 {
 	UINT32 x;
@@ -82,6 +86,17 @@ static BOOL nsc_context_initialize_encode(NSC_CONTEXT* context)
 		context->priv->PlaneBuffersLength = length;
 	}
 
+	if (4ull * length > context->priv->RleBufferLength)
+	{
+		BYTE* tmp = (BYTE*)realloc(context->priv->RleBuffer, 4ull * length);
+
+		if (!tmp)
+			return FALSE;
+
+		context->priv->RleBuffer = tmp;
+		context->priv->RleBufferLength = 4 * length;
+	}
+
 	if (context->ChromaSubsamplingLevel)
 	{
 		context->OrgByteCount[0] = tempWidth * context->height;
@@ -137,8 +152,20 @@ static BOOL nsc_encode_argb_to_aycocg(NSC_CONTEXT* context, const BYTE* data, UI
 		coplane = context->priv->PlaneBuffers[1] + y * rw;
 		cgplane = context->priv->PlaneBuffers[2] + y * rw;
 		aplane = context->priv->PlaneBuffers[3] + y * context->width;
+		x = 0;
+
+		if (context->encodeRow)
+		{
+			x = (UINT16)context->encodeRow(context, src, context->width, yplane, coplane, cgplane,
+			                               aplane);
+			src += x * FreeRDPGetBytesPerPixel(context->format);
+			yplane += x;
+			coplane += x;
+			cgplane += x;
+			aplane += x;
+		}
 
-		for (x = 0; x < context->width; x++)
+		for (; x < context->width; x++)
 		{
 			switch (context->format)
 			{
@@ -296,7 +323,23 @@ static BOOL nsc_encode_subsampling(NSC_CONTEXT* context)
 		const INT8* cg_src0 = (INT8*)context->priv->PlaneBuffers[2] + (y << 1) * tempWidth;
 		const INT8* cg_src1 = cg_src0 + tempWidth;
 
-		for (x = 0; x < tempWidth >> 1; x++)
+		if (context->subsampleRow)
+		{
+			x = context->subsampleRow((const BYTE*)co_src0, (const BYTE*)co_src1, tempWidth >> 1,
+			                          co_dst);
+			context->subsampleRow((const BYTE*)cg_src0, (const BYTE*)cg_src1, tempWidth >> 1,
+			                      cg_dst);
+			co_dst += x;
+			cg_dst += x;
+			co_src0 += 2 * x;
+			co_src1 += 2 * x;
+			cg_src0 += 2 * x;
+			cg_src1 += 2 * x;
+		}
+		else
+			x = 0;
+
+		for (; x < tempWidth >> 1; x++)
 		{
 			*co_dst++ = (BYTE)(((INT16)*co_src0 + (INT16) * (co_src0 + 1) + (INT16)*co_src1 +
 			                    (INT16) * (co_src1 + 1)) >>
@@ -385,15 +428,17 @@ static UINT32 nsc_rle_encode(const BYTE* in, BYTE* out, UINT32 originalSize)
 	return planeSize;
 }
 
-static void nsc_rle_compress_data(NSC_CONTEXT* context)
+/* RLE encode the planes [first, first + count), each into its own part of the RLE buffer */
+static BOOL nsc_rle_compress_planes(PVOID arg, size_t first, size_t count)
 {
-	UINT16 i;
-	UINT32 planeSize;
-	UINT32 originalSize;
+	size_t i;
+	NSC_CONTEXT* context = (NSC_CONTEXT*)arg;
 
-	for (i = 0; i < 4; i++)
+	for (i = first; i < first + count; i++)
 	{
-		originalSize = context->OrgByteCount[i];
+		UINT32 planeSize;
+		const UINT32 originalSize = context->OrgByteCount[i];
+		BYTE* rle = &context->priv->RleBuffer[i * context->priv->PlaneBuffersLength];
 
 		if (originalSize == 0)
 		{
@@ -401,18 +446,27 @@ static void nsc_rle_compress_data(NSC_CONTEXT* context)
 		}
 		else
 		{
-			planeSize = nsc_rle_encode(context->priv->PlaneBuffers[i],
-			                           context->priv->PlaneBuffers[4], originalSize);
+			planeSize = nsc_rle_encode(context->priv->PlaneBuffers[i], rle, originalSize);
 
 			if (planeSize < originalSize)
-				CopyMemory(context->priv->PlaneBuffers[i], context->priv->PlaneBuffers[4],
-				           planeSize);
+				CopyMemory(context->priv->PlaneBuffers[i], rle, planeSize);
 			else
 				planeSize = originalSize;
 		}
 
 		context->PlaneByteCount[i] = planeSize;
 	}
+
+	return TRUE;
+}
+
+static BOOL nsc_rle_compress_data(NSC_CONTEXT* context)
+{
+	/* Each plane has its own RLE buffer, so they can be compressed concurrently */
+	if ((size_t)context->width * context->height >= NSC_PARALLEL_MIN_PIXELS)
+		return winpr_ThreadpoolParallelFor(NULL, 4, 0, nsc_rle_compress_planes, context);
+
+	return nsc_rle_compress_planes(context, 0, 4);
 }
 
 static UINT32 nsc_compute_byte_count(NSC_CONTEXT* context, UINT32* ByteCount, UINT32 width,
@@ -503,8 +557,11 @@ BOOL nsc_compose_message(NSC_CONTEXT* context, wStream* s, const BYTE* data, UIN
 
 	/* RLE encode */
 	PROFILER_ENTER(context->priv->prof_nsc_rle_compress_data)
-	nsc_rle_compress_data(context);
+	rc = nsc_rle_compress_data(context);
 	PROFILER_EXIT(context->priv->prof_nsc_rle_compress_data)
+	if (!rc)
+		return FALSE;
+
 	message.PlaneBuffers[0] = context->priv->PlaneBuffers[0];
 	message.PlaneBuffers[1] = context->priv->PlaneBuffers[1];
 	message.PlaneBuffers[2] = context->priv->PlaneBuffers[2];
@@ -28,6 +28,7 @@
 #include <winpr/collections.h>
 
 #include <freerdp/utils/profiler.h>
+#include <freerdp/codec/color.h>
 #include <freerdp/codec/nsc.h>
 
 #define ROUND_UP_TO(_b, _n) (_b + ((~(_b & (_n - 1)) + 0x1) & (_n - 1)))
@@ -39,6 +40,8 @@ typedef struct
 
 	BYTE* PlaneBuffers[5];     /* Decompressed Plane Buffers in the respective order */
 	UINT32 PlaneBuffersLength; /* Lengths of each plane buffer */
+	BYTE* RleBuffer;           /* Encoder RLE output, one plane buffer length per plane */
+	UINT32 RleBufferLength;
 
 	/* profilers */
 	PROFILER_DEFINE(prof_nsc_rle_decompress_data)
@@ -68,7 +71,41 @@ struct S_NSC_CONTEXT
 	BOOL (*decode)(NSC_CONTEXT* context);
 	BOOL (*encode)(NSC_CONTEXT* context, const BYTE* BitmapData, UINT32 rowstride);
 
+	/* Optional SIMD encoder kernels, both return the number of pixels done.
+	 * encodeRow converts the start of a row to Y, Co, Cg and A,
+	 * subsampleRow averages 2x2 blocks of two chroma rows. */
+	UINT32 (*encodeRow)(NSC_CONTEXT* context, const BYTE* src, UINT32 width, BYTE* yplane,
+	                    BYTE* coplane, BYTE* cgplane, BYTE* aplane);
+	UINT32 (*subsampleRow)(const BYTE* src0, const BYTE* src1, UINT32 width, BYTE* dst);
+
 	NSC_CONTEXT_PRIV* priv;
 };
 
+/* Byte offsets of the channels in the 32bpp formats the encoder kernels handle,
+ * alpha is -1 for formats without one */
+static INLINE BOOL nsc_encode_channel_offsets(UINT32 format, int* r, int* g, int* b, int* a)
+{
+	switch (format)
+	{
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_BGRA32:
+			*b = 0;
+			*g = 1;
+			*r = 2;
+			*a = (format == PIXEL_FORMAT_BGRA32) ? 3 : -1;
+			return TRUE;
+
+		case PIXEL_FORMAT_RGBX32:
+		case PIXEL_FORMAT_RGBA32:
+			*r = 0;
+			*g = 1;
+			*b = 2;
+			*a = (format == PIXEL_FORMAT_RGBA32) ? 3 : -1;
+			return TRUE;
+
+		default:
+			return FALSE;
+	}
+}
+
 #endif /* FREERDP_LIB_CODEC_NSC_TYPES_H */
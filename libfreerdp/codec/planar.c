@@ -24,6 +24,9 @@
 #include <winpr/crt.h>
 #include <winpr/assert.h>
 #include <winpr/print.h>
+#include <winpr/pool.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
 
 #include <freerdp/primitives.h>
 #include <freerdp/log.h>
@@ -32,6 +35,9 @@
 
 #define TAG FREERDP_TAG("codec")
 
+/* Bitmaps with at least this many pixels encode their planes in parallel */
+#define PLANAR_PARALLEL_MIN_PIXELS (256 * 256)
+
 #define PLANAR_ALIGN(val, align) \
 	((val) % (align) == 0) ? (val) : ((val) + (align) - (val) % (align))
 
@@ -1014,7 +1020,11 @@ static INLINE BOOL freerdp_split_color_planes(BITMAP_PLANAR_CONTEXT* planar, con
                                               UINT32 format, UINT32 width, UINT32 height,
                                               UINT32 scanline, BYTE* planes[4])
 {
+	INT32 step;
+	const primitives_t* prims = primitives_get();
+
 	WINPR_ASSERT(planar);
+	WINPR_ASSERT(prims->splitPlanes_8u);
 
 	if ((width > INT32_MAX) || (height > INT32_MAX) || (scanline > INT32_MAX))
 		return FALSE;
@@ -1022,43 +1032,17 @@ static INLINE BOOL freerdp_split_color_planes(BITMAP_PLANAR_CONTEXT* planar, con
 	if (scanline == 0)
 		scanline = width * FreeRDPGetBytesPerPixel(format);
 
-	if (planar->topdown)
-	{
-		UINT32 i, j, k = 0;
-		for (i = 0; i < height; i++)
-		{
-			const BYTE* pixel = &data[scanline * (UINT32)i];
+	step = (INT32)scanline;
 
-			for (j = 0; j < width; j++)
-			{
-				const UINT32 color = FreeRDPReadColor(pixel, format);
-				pixel += FreeRDPGetBytesPerPixel(format);
-				FreeRDPSplitColor(color, format, &planes[1][k], &planes[2][k], &planes[3][k],
-				                  &planes[0][k], NULL);
-				k++;
-			}
-		}
-	}
-	else
+	/* Planes are stored bottom up unless the caller asked otherwise */
+	if (!planar->topdown && (height > 0))
 	{
-		INT64 i;
-		UINT32 j, k = 0;
-
-		for (i = (INT64)height - 1; i >= 0; i--)
-		{
-			const BYTE* pixel = &data[scanline * (UINT32)i];
-
-			for (j = 0; j < width; j++)
-			{
-				const UINT32 color = FreeRDPReadColor(pixel, format);
-				pixel += FreeRDPGetBytesPerPixel(format);
-				FreeRDPSplitColor(color, format, &planes[1][k], &planes[2][k], &planes[3][k],
-				                  &planes[0][k], NULL);
-				k++;
-			}
-		}
+		data = &data[(size_t)scanline * (height - 1)];
+		step = -step;
 	}
-	return TRUE;
+
+	return prims->splitPlanes_8u(data, step, format, planes, width, height) ==
+	       PRIMITIVES_SUCCESS;
 }
 
 static INLINE UINT32 freerdp_bitmap_planar_write_rle_bytes(const BYTE* pInBuffer, UINT32 cRawBytes,
@@ -1295,64 +1279,12 @@ BOOL freerdp_bitmap_planar_compress_plane_rle(const BYTE* inPlane, UINT32 width,
 	return TRUE;
 }
 
-static INLINE BOOL freerdp_bitmap_planar_compress_planes_rle(BYTE* inPlanes[4], UINT32 width,
-                                                             UINT32 height, BYTE* outPlanes,
-                                                             UINT32* dstSizes, BOOL skipAlpha)
-{
-	UINT32 outPlanesSize = width * height * 4;
-
-	/* AlphaPlane */
-	if (skipAlpha)
-	{
-		dstSizes[0] = 0;
-	}
-	else
-	{
-		dstSizes[0] = outPlanesSize;
-
-		if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[0], width, height, outPlanes,
-		                                              &dstSizes[0]))
-			return FALSE;
-
-		outPlanes += dstSizes[0];
-		outPlanesSize -= dstSizes[0];
-	}
-
-	/* LumaOrRedPlane */
-	dstSizes[1] = outPlanesSize;
-
-	if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[1], width, height, outPlanes,
-	                                              &dstSizes[1]))
-		return FALSE;
-
-	outPlanes += dstSizes[1];
-	outPlanesSize -= dstSizes[1];
-	/* OrangeChromaOrGreenPlane */
-	dstSizes[2] = outPlanesSize;
-
-	if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[2], width, height, outPlanes,
-	                                              &dstSizes[2]))
-		return FALSE;
-
-	outPlanes += dstSizes[2];
-	outPlanesSize -= dstSizes[2];
-	/* GreenChromeOrBluePlane */
-	dstSizes[3] = outPlanesSize;
-
-	if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[3], width, height, outPlanes,
-	                                              &dstSizes[3]))
-		return FALSE;
-
-	return TRUE;
-}
-
 BYTE* freerdp_bitmap_planar_delta_encode_plane(const BYTE* inPlane, UINT32 width, UINT32 height,
                                                BYTE* outPlane)
 {
-	char s2c;
-	UINT32 y, x;
-	BYTE* outPtr;
-	const BYTE *srcPtr, *prevLinePtr;
+	const primitives_t* prims = primitives_get();
+
+	WINPR_ASSERT(prims->deltaEncodePlane_8u);
 
 	if (!outPlane)
 	{
@@ -1363,47 +1295,85 @@ BYTE* freerdp_bitmap_planar_delta_encode_plane(const BYTE* inPlane, UINT32 width
 			return NULL;
 	}
 
-	// first line is copied as is
-	CopyMemory(outPlane, inPlane, width);
-	outPtr = outPlane + width;
-	srcPtr = inPlane + width;
-	prevLinePtr = inPlane;
+	if (prims->deltaEncodePlane_8u(inPlane, outPlane, width, height) != PRIMITIVES_SUCCESS)
+		return NULL;
+
+	return outPlane;
+}
+
+typedef struct
+{
+	BITMAP_PLANAR_CONTEXT* context;
+	UINT32 width;
+	UINT32 height;
+	UINT32 firstPlane;
+	UINT32 dstSizes[4];
+} PLANAR_PLANES_PARAM;
+
+/* Delta and RLE encode the planes [first, first + count), each into its own RLE buffer */
+static BOOL planar_encode_planes_range(PVOID arg, size_t first, size_t count)
+{
+	size_t index;
+	PLANAR_PLANES_PARAM* param = (PLANAR_PLANES_PARAM*)arg;
+	BITMAP_PLANAR_CONTEXT* context;
+
+	WINPR_ASSERT(param);
+	context = param->context;
+	WINPR_ASSERT(context);
 
-	for (y = 1; y < height; y++)
+	for (index = first + param->firstPlane; index < first + param->firstPlane + count; index++)
 	{
-		for (x = 0; x < width; x++, outPtr++, srcPtr++, prevLinePtr++)
-		{
-			INT32 delta = *srcPtr - *prevLinePtr;
-			s2c = (delta >= 0) ? (char)delta : (char)(~((BYTE)(-delta)) + 1);
-			s2c = (s2c >= 0) ? (char)((UINT32)s2c << 1)
-			                 : (char)(((UINT32)(~((BYTE)s2c) + 1) << 1) - 1);
-			*outPtr = (BYTE)s2c;
-		}
+		BYTE* rlePlane = &context->rlePlanesBuffer[index * context->maxRlePlaneSize];
+
+		if (!freerdp_bitmap_planar_delta_encode_plane(context->planes[index], param->width,
+		                                              param->height, context->deltaPlanes[index]))
+			return FALSE;
+
+		param->dstSizes[index] = context->maxRlePlaneSize;
+
+		if (!freerdp_bitmap_planar_compress_plane_rle(context->deltaPlanes[index], param->width,
+		                                              param->height, rlePlane,
+		                                              &param->dstSizes[index]))
+			return FALSE;
+
+		context->rlePlanes[index] = rlePlane;
 	}
 
-	return outPlane;
+	return TRUE;
 }
 
-static INLINE BOOL freerdp_bitmap_planar_delta_encode_planes(BYTE* inPlanes[4], UINT32 width,
-                                                             UINT32 height, BYTE* outPlanes[4])
+static BOOL planar_encode_planes(BITMAP_PLANAR_CONTEXT* context, UINT32 width, UINT32 height,
+                                 UINT32 dstSizes[4])
 {
-	UINT32 i;
+	size_t index;
+	PLANAR_PLANES_PARAM param = { 0 };
 
-	for (i = 0; i < 4; i++)
-	{
-		outPlanes[i] =
-		    freerdp_bitmap_planar_delta_encode_plane(inPlanes[i], width, height, outPlanes[i]);
+	param.context = context;
+	param.width = width;
+	param.height = height;
+	param.firstPlane = context->AllowSkipAlpha ? 1 : 0;
+	context->rlePlanes[0] = NULL;
 
-		if (!outPlanes[i])
+	/* Small bitmaps are not worth the hand-off to the pool */
+	if ((size_t)width * height >= PLANAR_PARALLEL_MIN_PIXELS)
+	{
+		if (!winpr_ThreadpoolParallelFor(NULL, 4 - param.firstPlane, 0,
+		                                 planar_encode_planes_range, &param))
 			return FALSE;
 	}
+	else if (!planar_encode_planes_range(&param, 0, 4 - param.firstPlane))
+		return FALSE;
+
+	for (index = 0; index < 4; index++)
+		dstSizes[index] = param.dstSizes[index];
 
 	return TRUE;
 }
 
-BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE* data,
-                                     UINT32 format, UINT32 width, UINT32 height, UINT32 scanline,
-                                     BYTE* dstData, UINT32* pDstSize)
+/* Compresses one bitmap, writing at most dstCapacity bytes if dstData is provided */
+static BYTE* planar_compress_bitmap(BITMAP_PLANAR_CONTEXT* context, const BYTE* data,
+                                    UINT32 format, UINT32 width, UINT32 height, UINT32 scanline,
+                                    BYTE* dstData, UINT32 dstCapacity, UINT32* pDstSize)
 {
 	UINT32 size;
 	BYTE* dstp;
@@ -1419,6 +1389,9 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE*
 
 	planeSize = width * height;
 
+	if ((width > context->maxWidth) || (height > context->maxHeight))
+		return NULL;
+
 	if (!context->AllowSkipAlpha)
 		format = planar_invert_format(context, TRUE, format);
 
@@ -1428,30 +1401,10 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE*
 
 	if (context->AllowRunLengthEncoding)
 	{
-		if (!freerdp_bitmap_planar_delta_encode_planes(context->planes, width, height,
-		                                               context->deltaPlanes))
+		if (!planar_encode_planes(context, width, height, dstSizes))
 			return NULL;
 
-		if (!freerdp_bitmap_planar_compress_planes_rle(context->deltaPlanes, width, height,
-		                                               context->rlePlanesBuffer, dstSizes,
-		                                               context->AllowSkipAlpha))
-			return NULL;
-
-		{
-			int offset = 0;
-			FormatHeader |= PLANAR_FORMAT_HEADER_RLE;
-			context->rlePlanes[0] = &context->rlePlanesBuffer[offset];
-			offset += dstSizes[0];
-			context->rlePlanes[1] = &context->rlePlanesBuffer[offset];
-			offset += dstSizes[1];
-			context->rlePlanes[2] = &context->rlePlanesBuffer[offset];
-			offset += dstSizes[2];
-			context->rlePlanes[3] = &context->rlePlanesBuffer[offset];
-			// WLog_DBG(TAG, "R: [%"PRIu32"/%"PRIu32"] G: [%"PRIu32"/%"PRIu32"] B:
-			// [%"PRIu32"/%"PRIu32"]", 		dstSizes[1], planeSize, dstSizes[2], planeSize,
-			// dstSizes[3],
-			// planeSize);
-		}
+		FormatHeader |= PLANAR_FORMAT_HEADER_RLE;
 	}
 
 	if (FormatHeader & PLANAR_FORMAT_HEADER_RLE)
@@ -1459,7 +1412,7 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE*
 		if (!context->AllowRunLengthEncoding)
 			return NULL;
 
-		if (context->rlePlanes[0] == NULL)
+		if (!(FormatHeader & PLANAR_FORMAT_HEADER_NA) && (context->rlePlanes[0] == NULL))
 			return NULL;
 
 		if (context->rlePlanes[1] == NULL)
@@ -1472,26 +1425,28 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE*
 			return NULL;
 	}
 
-	if (!dstData)
+	/* FormatHeader, planes and Pad1 */
+	size = 1 + planeSize * 3 + 1;
+
+	if (!(FormatHeader & PLANAR_FORMAT_HEADER_NA))
+		size += planeSize;
+
+	if (FormatHeader & PLANAR_FORMAT_HEADER_RLE)
 	{
-		size = 1;
+		UINT32 rleSize = 1 + dstSizes[1] + dstSizes[2] + dstSizes[3];
 
 		if (!(FormatHeader & PLANAR_FORMAT_HEADER_NA))
-		{
-			if (FormatHeader & PLANAR_FORMAT_HEADER_RLE)
-				size += dstSizes[0];
-			else
-				size += planeSize;
-		}
+			rleSize += dstSizes[0];
 
-		if (FormatHeader & PLANAR_FORMAT_HEADER_RLE)
-			size += (dstSizes[1] + dstSizes[2] + dstSizes[3]);
+		/* Noisy content can grow under RLE, the raw planes are the upper bound then */
+		if (rleSize < size)
+			size = rleSize;
 		else
-			size += (planeSize * 3);
-
-		if (!(FormatHeader & PLANAR_FORMAT_HEADER_RLE))
-			size++;
+			FormatHeader &= ~PLANAR_FORMAT_HEADER_RLE;
+	}
 
+	if (!dstData)
+	{
 		dstData = malloc(size);
 
 		if (!dstData)
@@ -1499,6 +1454,8 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE*
 
 		*pDstSize = size;
 	}
+	else if (size > dstCapacity)
+		return NULL;
 
 	dstp = dstData;
 	*dstp = FormatHeader; /* FormatHeader */
@@ -1572,6 +1529,139 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE*
 	return dstData;
 }
 
+UINT32 freerdp_bitmap_planar_max_size(UINT32 width, UINT32 height)
+{
+	/* FormatHeader, four raw planes and Pad1 */
+	return 1 + width * height * 4 + 1;
+}
+
+BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE* data,
+                                     UINT32 format, UINT32 width, UINT32 height, UINT32 scanline,
+                                     BYTE* dstData, UINT32* pDstSize)
+{
+	return planar_compress_bitmap(context, data, format, width, height, scanline, dstData,
+	                              UINT32_MAX, pDstSize);
+}
+
+typedef struct
+{
+	BITMAP_PLANAR_CONTEXT* context;
+	UINT32 format;
+	UINT32 scanline;
+	PLANAR_TILE* tiles;
+} PLANAR_TILES_PARAM;
+
+static BOOL planar_compress_tiles_range(PVOID arg, size_t first, size_t count)
+{
+	size_t index;
+	BITMAP_PLANAR_CONTEXT* worker;
+	PLANAR_TILES_PARAM* param = (PLANAR_TILES_PARAM*)arg;
+
+	WINPR_ASSERT(param);
+	WINPR_ASSERT(param->context);
+
+	/* Every range gets a scratch context of its own */
+	if (param->context->tileContextCount > 0)
+	{
+		const LONG slot = InterlockedIncrement(&param->context->nextTileContext) - 1;
+		WINPR_ASSERT((UINT32)slot < param->context->tileContextCount);
+		worker = param->context->tileContexts[slot];
+	}
+	else
+		worker = param->context;
+
+	for (index = first; index < first + count; index++)
+	{
+		PLANAR_TILE* tile = &param->tiles[index];
+
+		if (!planar_compress_bitmap(worker, tile->data, param->format, tile->width, tile->height,
+		                            param->scanline, tile->dstData, tile->dstSize,
+		                            &tile->dstSize))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL planar_init_tile_contexts(BITMAP_PLANAR_CONTEXT* context)
+{
+	UINT32 index;
+	SYSTEM_INFO sysinfo = { 0 };
+
+	if (context->tileContexts)
+		return TRUE;
+
+	GetSystemInfo(&sysinfo);
+
+	if (sysinfo.dwNumberOfProcessors <= 1)
+		return TRUE;
+
+	context->tileContexts = (BITMAP_PLANAR_CONTEXT**)calloc(sysinfo.dwNumberOfProcessors,
+	                                                        sizeof(BITMAP_PLANAR_CONTEXT*));
+
+	if (!context->tileContexts)
+		return FALSE;
+
+	context->tileContextCount = sysinfo.dwNumberOfProcessors;
+
+	for (index = 0; index < context->tileContextCount; index++)
+	{
+		context->tileContexts[index] = freerdp_bitmap_planar_context_new(
+		    context->flags, context->maxWidth, context->maxHeight);
+
+		if (!context->tileContexts[index])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void planar_free_tile_contexts(BITMAP_PLANAR_CONTEXT* context)
+{
+	UINT32 index;
+
+	for (index = 0; index < context->tileContextCount; index++)
+		freerdp_bitmap_planar_context_free(context->tileContexts[index]);
+
+	free(context->tileContexts);
+	context->tileContexts = NULL;
+	context->tileContextCount = 0;
+}
+
+BOOL freerdp_bitmap_planar_compress_tiles(BITMAP_PLANAR_CONTEXT* context, UINT32 format,
+                                          UINT32 scanline, PLANAR_TILE* tiles, size_t count)
+{
+	UINT32 index;
+	PLANAR_TILES_PARAM param = { 0 };
+
+	if (!context || (!tiles && (count > 0)))
+		return FALSE;
+
+	if (!planar_init_tile_contexts(context))
+	{
+		planar_free_tile_contexts(context);
+		return FALSE;
+	}
+
+	for (index = 0; index < context->tileContextCount; index++)
+	{
+		context->tileContexts[index]->bgr = context->bgr;
+		context->tileContexts[index]->topdown = context->topdown;
+	}
+
+	param.context = context;
+	param.format = format;
+	param.scanline = scanline;
+	param.tiles = tiles;
+	context->nextTileContext = 0;
+
+	if (context->tileContextCount == 0)
+		return planar_compress_tiles_range(&param, 0, count);
+
+	return winpr_ThreadpoolParallelFor(NULL, count, context->tileContextCount,
+	                                   planar_compress_tiles_range, &param);
+}
+
 BOOL freerdp_bitmap_planar_context_reset(BITMAP_PLANAR_CONTEXT* context, UINT32 width,
                                          UINT32 height)
 {
@@ -1582,7 +1672,11 @@ BOOL freerdp_bitmap_planar_context_reset(BITMAP_PLANAR_CONTEXT* context, UINT32
 	context->maxWidth = PLANAR_ALIGN(width, 4);
 	context->maxHeight = PLANAR_ALIGN(height, 4);
 	context->maxPlaneSize = context->maxWidth * context->maxHeight;
+	/* Raw RLE segments cost one control byte per 15 bytes, plus up to two per row */
+	context->maxRlePlaneSize =
+	    context->maxPlaneSize + context->maxPlaneSize / 8 + 2 * context->maxHeight;
 	context->nTempStep = context->maxWidth * 4;
+	planar_free_tile_contexts(context);
 	free(context->planesBuffer);
 	free(context->pTempData);
 	free(context->deltaPlanesBuffer);
@@ -1590,7 +1684,7 @@ BOOL freerdp_bitmap_planar_context_reset(BITMAP_PLANAR_CONTEXT* context, UINT32
 	context->planesBuffer = calloc(context->maxPlaneSize, 4);
 	context->pTempData = calloc(context->maxPlaneSize, 6);
 	context->deltaPlanesBuffer = calloc(context->maxPlaneSize, 4);
-	context->rlePlanesBuffer = calloc(context->maxPlaneSize, 4);
+	context->rlePlanesBuffer = calloc(context->maxRlePlaneSize, 4);
 
 	if (!context->planesBuffer || !context->pTempData || !context->deltaPlanesBuffer ||
 	    !context->rlePlanesBuffer)
@@ -1616,6 +1710,8 @@ BITMAP_PLANAR_CONTEXT* freerdp_bitmap_planar_context_new(DWORD flags, UINT32 max
 	if (!context)
 		return NULL;
 
+	context->flags = flags;
+
 	if (flags & PLANAR_FORMAT_HEADER_NA)
 		context->AllowSkipAlpha = TRUE;
 
@@ -1648,6 +1744,7 @@ void freerdp_bitmap_planar_context_free(BITMAP_PLANAR_CONTEXT* context)
 	free(context->planesBuffer);
 	free(context->deltaPlanesBuffer);
 	free(context->rlePlanesBuffer);
+	planar_free_tile_contexts(context);
 	free(context);
 }
 
@@ -21,6 +21,8 @@
 
 #include <freerdp/config.h>
 
+#include <stddef.h>
+
 #include <winpr/assert.h>
 #include <winpr/crt.h>
 #include <winpr/print.h>
@@ -35,6 +37,7 @@
 #include "rfx_differential.h"
 #include "rfx_quantization.h"
 #include "rfx_dwt.h"
+#include "rfx_encode.h"
 #include "rfx_rlgr.h"
 #include "rfx_types.h"
 #include "progressive.h"
@@ -1653,35 +1656,38 @@ typedef struct
 	PROGRESSIVE_CONTEXT* progressive;
 	PROGRESSIVE_BLOCK_REGION* region;
 	const PROGRESSIVE_BLOCK_CONTEXT* context;
-	RFX_PROGRESSIVE_TILE* tile;
 } PROGRESSIVE_TILE_PROCESS_WORK_PARAM;
 
-static void CALLBACK progressive_process_tiles_tile_work_callback(PTP_CALLBACK_INSTANCE instance,
-                                                                  void* context, PTP_WORK work)
+static BOOL progressive_process_tiles_range(void* context, size_t first, size_t count)
 {
+	size_t index;
 	PROGRESSIVE_TILE_PROCESS_WORK_PARAM* param = (PROGRESSIVE_TILE_PROCESS_WORK_PARAM*)context;
 
-	WINPR_UNUSED(instance);
-	WINPR_UNUSED(work);
-
-	switch (param->tile->blockType)
+	for (index = first; index < first + count; index++)
 	{
-		case PROGRESSIVE_WBT_TILE_SIMPLE:
-		case PROGRESSIVE_WBT_TILE_FIRST:
-			progressive_decompress_tile_first(param->progressive, param->tile, param->region,
-			                                  param->context);
-			break;
+		RFX_PROGRESSIVE_TILE* tile = param->region->tiles[index];
 
-		case PROGRESSIVE_WBT_TILE_UPGRADE:
-			progressive_decompress_tile_upgrade(param->progressive, param->tile, param->region,
-			                                    param->context);
-			break;
-		default:
-			WLog_Print(param->progressive->log, WLOG_ERROR, "Invalid block type %04 (%s)" PRIx16,
-			           param->tile->blockType,
-			           progressive_get_block_type_string(param->tile->blockType));
-			break;
+		switch (tile->blockType)
+		{
+			case PROGRESSIVE_WBT_TILE_SIMPLE:
+			case PROGRESSIVE_WBT_TILE_FIRST:
+				progressive_decompress_tile_first(param->progressive, tile, param->region,
+				                                  param->context);
+				break;
+
+			case PROGRESSIVE_WBT_TILE_UPGRADE:
+				progressive_decompress_tile_upgrade(param->progressive, tile, param->region,
+				                                    param->context);
+				break;
+			default:
+				WLog_Print(param->progressive->log, WLOG_ERROR,
+				           "Invalid block type %04 (%s)" PRIx16, tile->blockType,
+				           progressive_get_block_type_string(tile->blockType));
+				break;
+		}
 	}
+
+	return TRUE;
 }
 
 static INLINE int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive, wStream* s,
@@ -1689,16 +1695,12 @@ static INLINE int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive, wS
                                             PROGRESSIVE_SURFACE_CONTEXT* surface,
                                             const PROGRESSIVE_BLOCK_CONTEXT* context)
 {
-	int status = 0;
 	size_t end;
 	const size_t start = Stream_GetPosition(s);
-	UINT16 index;
 	UINT16 blockType;
 	UINT32 blockLen;
 	UINT32 count = 0;
-	PTP_WORK* work_objects = NULL;
-	PROGRESSIVE_TILE_PROCESS_WORK_PARAM* params = NULL;
-	UINT16 close_cnt = 0;
+	PROGRESSIVE_TILE_PROCESS_WORK_PARAM param = { 0 };
 
 	WINPR_ASSERT(progressive);
 	WINPR_ASSERT(region);
@@ -1778,76 +1780,22 @@ static INLINE int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive, wS
 		return -1044;
 	}
 
-	if (progressive->rfx_context->priv->UseThreads)
-	{
-		work_objects = (PTP_WORK*)calloc(region->numTiles, sizeof(PTP_WORK));
-		if (!work_objects)
-			return -1;
-	}
-
-	params = (PROGRESSIVE_TILE_PROCESS_WORK_PARAM*)calloc(
-	    region->numTiles, sizeof(PROGRESSIVE_TILE_PROCESS_WORK_PARAM));
-	if (!params)
-	{
-		free(work_objects);
-		return -1;
-	}
-
-	for (index = 0; index < region->numTiles; index++)
-	{
-		RFX_PROGRESSIVE_TILE* tile = region->tiles[index];
-		PROGRESSIVE_TILE_PROCESS_WORK_PARAM* param = &params[index];
-		param->progressive = progressive;
-		param->region = region;
-		param->context = context;
-		param->tile = tile;
-
-		if (progressive->rfx_context->priv->UseThreads)
-		{
-			if (!(work_objects[index] = CreateThreadpoolWork(
-			          progressive_process_tiles_tile_work_callback, (void*)&params[index],
-			          &progressive->rfx_context->priv->ThreadPoolEnv)))
-			{
-				WLog_ERR(TAG, "CreateThreadpoolWork failed.");
-				status = -1;
-				break;
-			}
-
-			SubmitThreadpoolWork(work_objects[index]);
-			close_cnt = index + 1;
-		}
-		else
-		{
-			progressive_process_tiles_tile_work_callback(0, &params[index], 0);
-		}
-
-		if (status < 0)
-		{
-			WLog_Print(progressive->log, WLOG_ERROR, "Failed to decompress %s at %" PRIu16,
-			           progressive_get_block_type_string(tile->blockType), index);
-			goto fail;
-		}
-	}
-
-	if (status < 0)
-		WLog_Print(progressive->log, WLOG_ERROR,
-		           "Failed to create ThreadpoolWork for tile %" PRIu16, index);
+	param.progressive = progressive;
+	param.region = region;
+	param.context = context;
 
 	if (progressive->rfx_context->priv->UseThreads)
 	{
-		for (index = 0; index < close_cnt; index++)
+		if (!winpr_ThreadpoolParallelFor(&progressive->rfx_context->priv->ThreadPoolEnv,
+		                                 region->numTiles, 0, progressive_process_tiles_range,
+		                                 &param))
 		{
-			WaitForThreadpoolWorkCallbacks(work_objects[index], FALSE);
-			CloseThreadpoolWork(work_objects[index]);
+			WLog_Print(progressive->log, WLOG_ERROR, "Failed to decompress tiles");
+			return -1;
 		}
 	}
-
-fail:
-	free(work_objects);
-	free(params);
-
-	if (status < 0)
-		return -1;
+	else
+		progressive_process_tiles_range(&param, 0, region->numTiles);
 
 	return (int)(end - start);
 }
@@ -1868,7 +1816,8 @@ static INLINE BOOL progressive_write_wb_sync(PROGRESSIVE_CONTEXT* progressive, w
 	return TRUE;
 }
 
-static INLINE BOOL progressive_write_wb_context(PROGRESSIVE_CONTEXT* progressive, wStream* s)
+static INLINE BOOL progressive_write_wb_context(PROGRESSIVE_CONTEXT* progressive, wStream* s,
+                                                BYTE flags)
 {
 	const UINT32 blockLen = 10;
 	WINPR_ASSERT(progressive);
@@ -1881,7 +1830,7 @@ static INLINE BOOL progressive_write_wb_context(PROGRESSIVE_CONTEXT* progressive
 	Stream_Write_UINT32(s, blockLen);                /* blockLen (4 bytes) */
 	Stream_Write_UINT8(s, 0);                        /* ctxId (1 byte) */
 	Stream_Write_UINT16(s, 64);                      /* tileSize (2 bytes) */
-	Stream_Write_UINT8(s, 0);                        /* flags (1 byte) */
+	Stream_Write_UINT8(s, flags);                    /* flags (1 byte) */
 	return TRUE;
 }
 
@@ -1952,19 +1901,18 @@ static INLINE BOOL progressive_write_region(PROGRESSIVE_CONTEXT* progressive, wS
 }
 
 static INLINE BOOL progressive_write_frame_begin(PROGRESSIVE_CONTEXT* progressive, wStream* s,
-                                                 const RFX_MESSAGE* msg)
+                                                 UINT32 frameIndex)
 {
 	const UINT32 blockLen = 12;
 	WINPR_ASSERT(progressive);
 	WINPR_ASSERT(s);
-	WINPR_ASSERT(msg);
 
 	if (!Stream_EnsureRemainingCapacity(s, blockLen))
 		return FALSE;
 
 	Stream_Write_UINT16(s, PROGRESSIVE_WBT_FRAME_BEGIN); /* blockType (2 bytes) */
 	Stream_Write_UINT32(s, blockLen);                    /* blockLen (4 bytes) */
-	Stream_Write_UINT32(s, msg->frameIdx);               /* frameIndex (4 bytes) */
+	Stream_Write_UINT32(s, frameIndex);                  /* frameIndex (4 bytes) */
 	Stream_Write_UINT16(s, 1);                           /* regionCount (2 bytes) */
 
 	return TRUE;
@@ -2016,6 +1964,606 @@ static INLINE BOOL progressive_write_tile_simple(PROGRESSIVE_CONTEXT* progressiv
 	return TRUE;
 }
 
+static INLINE void progressive_component_codec_quant_write(wStream* s,
+                                                           const RFX_COMPONENT_CODEC_QUANT* quantVal)
+{
+	Stream_Write_UINT8(s, (UINT8)(quantVal->LL3 | (quantVal->HL3 << 4))); /* LL3, HL3 */
+	Stream_Write_UINT8(s, (UINT8)(quantVal->LH3 | (quantVal->HH3 << 4))); /* LH3, HH3 */
+	Stream_Write_UINT8(s, (UINT8)(quantVal->HL2 | (quantVal->LH2 << 4))); /* HL2, LH2 */
+	Stream_Write_UINT8(s, (UINT8)(quantVal->HH2 | (quantVal->HL1 << 4))); /* HH2, HL1 */
+	Stream_Write_UINT8(s, (UINT8)(quantVal->LH1 | (quantVal->HH1 << 4))); /* LH1, HH1 */
+}
+
+static INLINE BOOL progressive_write_region_begin(PROGRESSIVE_CONTEXT* progressive, wStream* s,
+                                                  const RFX_RECT* rects, UINT16 numRects,
+                                                  UINT16 numTiles)
+{
+	UINT16 i;
+	const size_t blockLen = 18ull + numRects * 8ull + 5ull + progressive->numQuantProgVals * 16ull;
+
+	WINPR_ASSERT(progressive);
+	WINPR_ASSERT(s);
+	WINPR_ASSERT(rects);
+
+	if (!Stream_EnsureRemainingCapacity(s, blockLen))
+		return FALSE;
+
+	/* blockLen and tilesDataSize are updated by progressive_write_region_end */
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_REGION);       /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 0);                            /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 64);                            /* tileSize (1 byte) */
+	Stream_Write_UINT16(s, numRects);                     /* numRects (2 bytes) */
+	Stream_Write_UINT8(s, 1);                             /* numQuant (1 byte) */
+	Stream_Write_UINT8(s, progressive->numQuantProgVals); /* numProgQuant (1 byte) */
+	Stream_Write_UINT8(s, RFX_DWT_REDUCE_EXTRAPOLATE);    /* flags (1 byte) */
+	Stream_Write_UINT16(s, numTiles);                     /* numTiles (2 bytes) */
+	Stream_Write_UINT32(s, 0);                            /* tilesDataSize (4 bytes) */
+
+	for (i = 0; i < numRects; i++)
+	{
+		/* TS_RFX_RECT */
+		Stream_Write_UINT16(s, rects[i].x);      /* x (2 bytes) */
+		Stream_Write_UINT16(s, rects[i].y);      /* y (2 bytes) */
+		Stream_Write_UINT16(s, rects[i].width);  /* width (2 bytes) */
+		Stream_Write_UINT16(s, rects[i].height); /* height (2 bytes) */
+	}
+
+	progressive_component_codec_quant_write(s, &progressive->quantVal);
+
+	for (i = 0; i < progressive->numQuantProgVals; i++)
+	{
+		/* RFX_PROGRESSIVE_CODEC_QUANT */
+		const RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal = &progressive->quantProgVals[i];
+		Stream_Write_UINT8(s, quantProgVal->quality); /* quality (1 byte) */
+		progressive_component_codec_quant_write(s, &quantProgVal->yQuantValues);
+		progressive_component_codec_quant_write(s, &quantProgVal->cbQuantValues);
+		progressive_component_codec_quant_write(s, &quantProgVal->crQuantValues);
+	}
+
+	return TRUE;
+}
+
+static INLINE BOOL progressive_write_region_end(wStream* s, size_t regionStart, size_t tilesStart)
+{
+	const size_t end = Stream_GetPosition(s);
+	const size_t blockLen = end - regionStart;
+	const size_t tilesDataSize = end - tilesStart;
+
+	if ((blockLen > UINT32_MAX) || (tilesDataSize > UINT32_MAX))
+		return FALSE;
+
+	Stream_SetPosition(s, regionStart + 2);
+	Stream_Write_UINT32(s, (UINT32)blockLen); /* blockLen (4 bytes) */
+	Stream_Seek(s, 8);
+	Stream_Write_UINT32(s, (UINT32)tilesDataSize); /* tilesDataSize (4 bytes) */
+	Stream_SetPosition(s, end);
+	return TRUE;
+}
+
+typedef struct
+{
+	size_t offset;
+	size_t length;
+	size_t quant; /* offset of the band in RFX_COMPONENT_CODEC_QUANT */
+} PROGRESSIVE_BAND;
+
+/* Same order as the bands are processed by progressive_rfx_upgrade_component */
+static const PROGRESSIVE_BAND progressive_bands[] = {
+	{ 0, 1023, offsetof(RFX_COMPONENT_CODEC_QUANT, HL1) },
+	{ 1023, 1023, offsetof(RFX_COMPONENT_CODEC_QUANT, LH1) },
+	{ 2046, 961, offsetof(RFX_COMPONENT_CODEC_QUANT, HH1) },
+	{ 3007, 272, offsetof(RFX_COMPONENT_CODEC_QUANT, HL2) },
+	{ 3279, 272, offsetof(RFX_COMPONENT_CODEC_QUANT, LH2) },
+	{ 3551, 256, offsetof(RFX_COMPONENT_CODEC_QUANT, HH2) },
+	{ 3807, 72, offsetof(RFX_COMPONENT_CODEC_QUANT, HL3) },
+	{ 3879, 72, offsetof(RFX_COMPONENT_CODEC_QUANT, LH3) },
+	{ 3951, 64, offsetof(RFX_COMPONENT_CODEC_QUANT, HH3) },
+	{ 4015, 81, offsetof(RFX_COMPONENT_CODEC_QUANT, LL3) }
+};
+
+#define PROGRESSIVE_BAND_LL3 (ARRAYSIZE(progressive_bands) - 1)
+
+static INLINE BYTE progressive_rfx_quant_band(const RFX_COMPONENT_CODEC_QUANT* q, size_t band)
+{
+	return ((const BYTE*)q)[progressive_bands[band].quant];
+}
+
+/* Forward transform matching progressive_rfx_idwt_x / progressive_rfx_idwt_y */
+static INLINE void progressive_rfx_dwt_1d(const INT16* pX, size_t nXStep, INT16* pL, size_t nLStep,
+                                          INT16* pH, size_t nHStep, size_t nLowCount,
+                                          size_t nHighCount)
+{
+	size_t n;
+	const size_t last = 2 * nHighCount;
+
+	for (n = 0; n < nHighCount; n++)
+	{
+		const INT32 X0 = pX[(2 * n) * nXStep];
+		const INT32 X1 = pX[(2 * n + 1) * nXStep];
+		const INT32 X2 = pX[(2 * n + 2) * nXStep];
+		pH[n * nHStep] = (INT16)((X1 - ((X0 + X2) / 2)) / 2);
+	}
+
+	pL[0] = (INT16)(pX[0] + pH[0]);
+
+	for (n = 1; n < nHighCount; n++)
+	{
+		const INT32 H0 = pH[(n - 1) * nHStep];
+		const INT32 H1 = pH[n * nHStep];
+		pL[n * nLStep] = (INT16)(pX[(2 * n) * nXStep] + ((H0 + H1) / 2));
+	}
+
+	if (nLowCount == nHighCount + 1)
+	{
+		pL[nHighCount * nLStep] = (INT16)(pX[last * nXStep] + pH[(nHighCount - 1) * nHStep]);
+	}
+	else
+	{
+		const INT32 X0 = pX[last * nXStep];
+		const INT32 X1 = pX[(last + 1) * nXStep];
+		pL[nHighCount * nLStep] = (INT16)(X0 + (pH[(nHighCount - 1) * nHStep] / 2));
+		pL[(nHighCount + 1) * nLStep] = (INT16)((2 * X1) - X0);
+	}
+}
+
+static INLINE void progressive_rfx_dwt_2d_encode_block(INT16* buffer, INT16* temp, size_t level)
+{
+	size_t i;
+	const size_t nBandL = progressive_rfx_get_band_l_count(level);
+	const size_t nBandH = progressive_rfx_get_band_h_count(level);
+	const size_t nStep = nBandL + nBandH;
+	INT16* HL = &buffer[0];
+	INT16* LH = &HL[nBandL * nBandH];
+	INT16* HH = &LH[nBandH * nBandL];
+	INT16* LL = &HH[nBandH * nBandH];
+	INT16* L = &temp[0];
+	INT16* H = &temp[nBandL * nStep];
+
+	/* vertical (LL -> L + H) */
+	for (i = 0; i < nStep; i++)
+		progressive_rfx_dwt_1d(&buffer[i], nStep, &L[i], nStep, &H[i], nStep, nBandL, nBandH);
+
+	/* horizontal (L -> LL + HL) */
+	for (i = 0; i < nBandL; i++)
+		progressive_rfx_dwt_1d(&L[i * nStep], 1, &LL[i * nBandL], 1, &HL[i * nBandH], 1, nBandL,
+		                       nBandH);
+
+	/* horizontal (H -> LH + HH) */
+	for (i = 0; i < nBandH; i++)
+		progressive_rfx_dwt_1d(&H[i * nStep], 1, &LH[i * nBandL], 1, &HH[i * nBandH], 1, nBandL,
+		                       nBandH);
+}
+
+static INLINE BOOL progressive_rfx_dwt_2d_encode(PROGRESSIVE_CONTEXT* progressive, INT16* buffer)
+{
+	INT16* temp = (INT16*)BufferPool_Take(progressive->bufferPool, -1); /* DWT buffer */
+
+	if (!temp)
+		return FALSE;
+
+	progressive_rfx_dwt_2d_encode_block(&buffer[0], temp, 1);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3007], temp, 2);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3807], temp, 3);
+	BufferPool_Return(progressive->bufferPool, temp);
+	return TRUE;
+}
+
+/**
+ * Quantize to a bit position.
+ * Upgrade passes append the next bit planes of the magnitude (sign magnitude) for
+ * the high bands and raw two's complement bits for LL3, so truncate accordingly.
+ */
+static INLINE INT16 progressive_rfx_quantize(INT16 value, UINT32 bitPos, BOOL nonLL)
+{
+	const UINT32 shift = bitPos - 1;
+
+	if (!nonLL)
+		return (INT16)(value >> shift);
+
+	if (value < 0)
+		return (INT16)(-((-value) >> shift));
+
+	return (INT16)(value >> shift);
+}
+
+/**
+ * Round the coefficients to the precision of the last pass.
+ * The passes themselves truncate, so the final result is the rounded value
+ * while every pass before only sends a prefix of its bits.
+ */
+static INLINE void progressive_rfx_round_component(INT16* coefficients,
+                                                   const RFX_COMPONENT_CODEC_QUANT* bitPos)
+{
+	size_t band;
+
+	for (band = 0; band < ARRAYSIZE(progressive_bands); band++)
+	{
+		size_t index;
+		const PROGRESSIVE_BAND* b = &progressive_bands[band];
+		const UINT32 shift = progressive_rfx_quant_band(bitPos, band) - 1;
+		const INT32 half = (1 << shift) >> 1;
+
+		for (index = b->offset; index < b->offset + b->length; index++)
+		{
+			INT32 value = coefficients[index];
+
+			if ((band != PROGRESSIVE_BAND_LL3) && (value < 0))
+				value = -(((-value + half) >> shift) << shift);
+			else
+				value = ((value + half) >> shift) << shift;
+
+			coefficients[index] = (INT16)MAX(INT16_MIN, MIN(INT16_MAX, value));
+		}
+	}
+}
+
+static INLINE BOOL progressive_rfx_encode_component(PROGRESSIVE_CONTEXT* progressive,
+                                                    const INT16* coefficients,
+                                                    const RFX_COMPONENT_CODEC_QUANT* bitPos,
+                                                    INT16* buffer, BYTE* pDstData, UINT32 DstSize,
+                                                    UINT16* pLength)
+{
+	size_t band;
+	int length;
+
+	for (band = 0; band < ARRAYSIZE(progressive_bands); band++)
+	{
+		size_t index;
+		const PROGRESSIVE_BAND* b = &progressive_bands[band];
+		const UINT32 pos = progressive_rfx_quant_band(bitPos, band);
+		const BOOL nonLL = band != PROGRESSIVE_BAND_LL3;
+
+		for (index = b->offset; index < b->offset + b->length; index++)
+			buffer[index] = progressive_rfx_quantize(coefficients[index], pos, nonLL);
+	}
+
+	rfx_differential_encode(&buffer[4015], 81); /* LL3 */
+	length = progressive->rfx_context->rlgr_encode(RLGR1, buffer, 4096, pDstData, DstSize);
+
+	if ((length <= 0) || (length > UINT16_MAX))
+		return FALSE;
+
+	*pLength = (UINT16)length;
+	return TRUE;
+}
+
+static INLINE void progressive_rfx_srl_write_bits(wBitStream* bs, UINT32 bits, UINT32 nbits)
+{
+	while (nbits > 16)
+	{
+		nbits -= 16;
+		BitStream_Write_Bits(bs, (bits >> nbits) & 0xFFFF, 16);
+	}
+
+	if (nbits)
+		BitStream_Write_Bits(bs, bits & ((1u << nbits) - 1u), nbits);
+}
+
+/* Inverse of progressive_rfx_srl_read, zero runs are collected in state->nz */
+static INLINE void progressive_rfx_srl_write(RFX_PROGRESSIVE_UPGRADE_STATE* state, INT16 value,
+                                             UINT32 numBits)
+{
+	UINT32 k;
+	UINT32 mag;
+	wBitStream* bs = state->srl;
+
+	if (value == 0)
+	{
+		state->nz++;
+		return;
+	}
+
+	k = state->kp / 8;
+
+	while (state->nz >= (1 << k))
+	{
+		/* '0' bit, nz >= (1 << k) */
+		progressive_rfx_srl_write_bits(bs, 0, 1);
+		state->nz -= (1 << k);
+		state->kp += 4;
+
+		if (state->kp > 80)
+			state->kp = 80;
+
+		k = state->kp / 8;
+	}
+
+	/* '1' bit, nz < (1 << k) in the next k bits */
+	progressive_rfx_srl_write_bits(bs, 1, 1);
+	progressive_rfx_srl_write_bits(bs, (UINT32)state->nz, k);
+	state->nz = 0;
+
+	/* sign bit and unary encoded magnitude */
+	progressive_rfx_srl_write_bits(bs, (value < 0) ? 1 : 0, 1);
+
+	if (state->kp < 6)
+		state->kp = 0;
+	else
+		state->kp -= 6;
+
+	if (numBits == 1)
+		return;
+
+	mag = (value < 0) ? -value : value;
+	progressive_rfx_srl_write_bits(bs, 0, mag - 1);
+
+	if (mag < ((1u << numBits) - 1))
+		progressive_rfx_srl_write_bits(bs, 1, 1);
+}
+
+static INLINE void progressive_rfx_srl_finish(RFX_PROGRESSIVE_UPGRADE_STATE* state)
+{
+	/* trailing zeros, the decoder ignores a run exceeding the coefficients left */
+	while (state->nz > 0)
+	{
+		const int run = 1 << (state->kp / 8);
+		progressive_rfx_srl_write_bits(state->srl, 0, 1);
+		state->nz -= MIN(state->nz, run);
+		state->kp = MIN(state->kp + 4, 80);
+	}
+}
+
+static INLINE BOOL progressive_rfx_upgrade_encode_component(
+    const INT16* coefficients, const RFX_COMPONENT_CODEC_QUANT* oldBitPos,
+    const RFX_COMPONENT_CODEC_QUANT* newBitPos, BYTE* srlData, UINT32 srlSize, BYTE* rawData,
+    UINT32 rawSize, UINT16* pSrlLen, UINT16* pRawLen)
+{
+	size_t band;
+	size_t srlLen;
+	size_t rawLen;
+	wBitStream s_srl = { 0 };
+	wBitStream s_raw = { 0 };
+	RFX_PROGRESSIVE_UPGRADE_STATE state = { 0 };
+
+	state.kp = 8;
+	state.srl = &s_srl;
+	state.raw = &s_raw;
+	BitStream_Attach(state.srl, srlData, srlSize);
+	BitStream_Attach(state.raw, rawData, rawSize);
+
+	for (band = 0; band < ARRAYSIZE(progressive_bands); band++)
+	{
+		size_t index;
+		const PROGRESSIVE_BAND* b = &progressive_bands[band];
+		const UINT32 oldPos = progressive_rfx_quant_band(oldBitPos, band);
+		const UINT32 newPos = progressive_rfx_quant_band(newBitPos, band);
+		const UINT32 numBits = oldPos - newPos;
+		const UINT32 mask = (1u << numBits) - 1u;
+
+		if (!numBits)
+			continue;
+
+		for (index = b->offset; index < b->offset + b->length; index++)
+		{
+			const INT16 value = coefficients[index];
+			const UINT32 mag = (UINT32)((value < 0) ? -value : value);
+
+			if (band == PROGRESSIVE_BAND_LL3)
+				progressive_rfx_srl_write_bits(state.raw, ((UINT32)(value >> (newPos - 1))) & mask,
+				                               numBits);
+			else if ((mag >> (oldPos - 1)) != 0)
+				progressive_rfx_srl_write_bits(state.raw, (mag >> (newPos - 1)) & mask, numBits);
+			else
+				progressive_rfx_srl_write(&state,
+				                          progressive_rfx_quantize(value, newPos, TRUE), numBits);
+		}
+	}
+
+	progressive_rfx_srl_finish(&state);
+	BitStream_Flush(state.srl);
+	BitStream_Flush(state.raw);
+
+	srlLen = (state.srl->position + 7) / 8;
+	rawLen = (state.raw->position + 7) / 8;
+
+	if ((srlLen > srlSize) || (rawLen > rawSize) || (srlLen > UINT16_MAX) ||
+	    (rawLen > UINT16_MAX))
+		return FALSE;
+
+	*pSrlLen = (UINT16)srlLen;
+	*pRawLen = (UINT16)rawLen;
+	return TRUE;
+}
+
+static INLINE INT16* progressive_tile_component(BYTE* buffer, size_t index)
+{
+	return (INT16*)((BYTE*)(&buffer[((8192 + 32) * index) + 16]));
+}
+
+static INLINE BOOL progressive_tile_encode_dwt(PROGRESSIVE_CONTEXT* progressive,
+                                               RFX_PROGRESSIVE_TILE* tile, const BYTE* pSrcData,
+                                               UINT32 SrcFormat, UINT32 Width, UINT32 Height,
+                                               UINT32 ScanLine)
+{
+	size_t x;
+	INT16* pCurrent[3];
+	const UINT32 nXSrc = tile->xIdx * 64;
+	const UINT32 nYSrc = tile->yIdx * 64;
+	const BYTE* src = &pSrcData[nYSrc * ScanLine + nXSrc * FreeRDPGetBytesPerPixel(SrcFormat)];
+
+	for (x = 0; x < 3; x++)
+		pCurrent[x] = progressive_tile_component(tile->current, x);
+
+	rfx_encode_ycbcr(progressive->rfx_context, src, MIN(64, Width - nXSrc),
+	                 MIN(64, Height - nYSrc), ScanLine, pCurrent);
+
+	for (x = 0; x < 3; x++)
+	{
+		if (!progressive_rfx_dwt_2d_encode(progressive, pCurrent[x]))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static INLINE BOOL progressive_write_tile_first(PROGRESSIVE_CONTEXT* progressive, wStream* s,
+                                                RFX_PROGRESSIVE_TILE* tile)
+{
+	BOOL rc = FALSE;
+	size_t x;
+	size_t offset = 0;
+	UINT16 len[3] = { 0 };
+	BYTE* pBuffer;
+	BYTE* pDstData;
+	const size_t start = Stream_GetPosition(s);
+	const size_t maxLen = 23 + 3 * 8192;
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProg = &progressive->quantProgVals[0];
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantFinal =
+	    &progressive->quantProgVals[progressive->numQuantProgVals - 1];
+	const RFX_COMPONENT_CODEC_QUANT* quantProgVals[3] = { &quantProg->yQuantValues,
+		                                                  &quantProg->cbQuantValues,
+		                                                  &quantProg->crQuantValues };
+	const RFX_COMPONENT_CODEC_QUANT* quantProgFinal[3] = { &quantFinal->yQuantValues,
+		                                                   &quantFinal->cbQuantValues,
+		                                                   &quantFinal->crQuantValues };
+	RFX_COMPONENT_CODEC_QUANT* bitPos[3] = { &tile->yBitPos, &tile->cbBitPos, &tile->crBitPos };
+
+	if (!Stream_EnsureRemainingCapacity(s, maxLen))
+		return FALSE;
+
+	/* The RLGR encoder expects a zero initialized output buffer */
+	pDstData = Stream_Pointer(s);
+	memset(pDstData, 0, maxLen);
+
+	pBuffer = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+	if (!pBuffer)
+		return FALSE;
+
+	tile->yQuant = tile->cbQuant = tile->crQuant = progressive->quantVal;
+	tile->yProgQuant = quantProg->yQuantValues;
+	tile->cbProgQuant = quantProg->cbQuantValues;
+	tile->crProgQuant = quantProg->crQuantValues;
+
+	for (x = 0; x < 3; x++)
+	{
+		RFX_COMPONENT_CODEC_QUANT finalBitPos = { 0 };
+
+		progressive_rfx_quant_add(&progressive->quantVal, quantProgFinal[x], &finalBitPos);
+		progressive_rfx_round_component(progressive_tile_component(tile->current, x),
+		                                &finalBitPos);
+		progressive_rfx_quant_add(&progressive->quantVal, quantProgVals[x], bitPos[x]);
+
+		if (!progressive_rfx_encode_component(progressive,
+		                                      progressive_tile_component(tile->current, x),
+		                                      bitPos[x], progressive_tile_component(pBuffer, 0),
+		                                      &pDstData[23 + offset], 8192, &len[x]))
+			goto fail;
+
+		offset += len[x];
+	}
+
+	tile->quality = 0;
+	tile->pass = 1;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_FIRST); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(23 + offset));      /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, tile->xIdx);                 /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, tile->yIdx);                 /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, 0);                           /* flags (1 byte) */
+	Stream_Write_UINT8(s, tile->quality);               /* quality (1 byte) */
+	Stream_Write_UINT16(s, len[0]);                     /* yLen (2 bytes) */
+	Stream_Write_UINT16(s, len[1]);                     /* cbLen (2 bytes) */
+	Stream_Write_UINT16(s, len[2]);                     /* crLen (2 bytes) */
+	Stream_Write_UINT16(s, 0);                          /* tailLen (2 bytes) */
+	Stream_Seek(s, offset);                             /* yData, cbData, crData */
+	WINPR_ASSERT(Stream_GetPosition(s) - start == 23 + offset);
+	rc = TRUE;
+fail:
+	BufferPool_Return(progressive->bufferPool, pBuffer);
+	return rc;
+}
+
+static INLINE BOOL progressive_write_tile_upgrade(PROGRESSIVE_CONTEXT* progressive, wStream* s,
+                                                  RFX_PROGRESSIVE_TILE* tile)
+{
+	BOOL rc = FALSE;
+	size_t x;
+	UINT16 srlLen[3] = { 0 };
+	UINT16 rawLen[3] = { 0 };
+	RFX_COMPONENT_CODEC_QUANT newBitPos[3] = { 0 };
+	BYTE* srlData;
+	BYTE* rawData;
+	const size_t start = Stream_GetPosition(s);
+	const BYTE quality = tile->quality + 1;
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProg = &progressive->quantProgVals[quality];
+	const RFX_COMPONENT_CODEC_QUANT* quantProgVals[3] = { &quantProg->yQuantValues,
+		                                                  &quantProg->cbQuantValues,
+		                                                  &quantProg->crQuantValues };
+	RFX_COMPONENT_CODEC_QUANT* bitPos[3] = { &tile->yBitPos, &tile->cbBitPos, &tile->crBitPos };
+
+	if (!Stream_EnsureRemainingCapacity(s, 20 + 6))
+		return FALSE;
+
+	srlData = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+	if (!srlData)
+		return FALSE;
+
+	rawData = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+	if (!rawData)
+	{
+		BufferPool_Return(progressive->bufferPool, srlData);
+		return FALSE;
+	}
+
+	/* blockLen and the srl/raw lengths are updated once the components are encoded */
+	Stream_Seek(s, 20 + 6);
+
+	for (x = 0; x < 3; x++)
+	{
+		const UINT32 size = (8192 + 32) * 3;
+
+		progressive_rfx_quant_add(&progressive->quantVal, quantProgVals[x], &newBitPos[x]);
+
+		if (!progressive_rfx_upgrade_encode_component(progressive_tile_component(tile->current, x),
+		                                              bitPos[x], &newBitPos[x], srlData, size,
+		                                              rawData, size, &srlLen[x], &rawLen[x]))
+			goto fail;
+
+		if (!Stream_EnsureRemainingCapacity(s, 1ull * srlLen[x] + rawLen[x]))
+			goto fail;
+
+		Stream_Write(s, srlData, srlLen[x]);
+		Stream_Write(s, rawData, rawLen[x]);
+	}
+
+	for (x = 0; x < 3; x++)
+		*bitPos[x] = newBitPos[x];
+
+	tile->yProgQuant = quantProg->yQuantValues;
+	tile->cbProgQuant = quantProg->cbQuantValues;
+	tile->crProgQuant = quantProg->crQuantValues;
+	tile->quality = quality;
+	tile->pass++;
+
+	{
+		const size_t end = Stream_GetPosition(s);
+		Stream_SetPosition(s, start);
+		Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_UPGRADE); /* blockType (2 bytes) */
+		Stream_Write_UINT32(s, (UINT32)(end - start));        /* blockLen (4 bytes) */
+		Stream_Write_UINT8(s, 0);                             /* quantIdxY (1 byte) */
+		Stream_Write_UINT8(s, 0);                             /* quantIdxCb (1 byte) */
+		Stream_Write_UINT8(s, 0);                             /* quantIdxCr (1 byte) */
+		Stream_Write_UINT16(s, tile->xIdx);                   /* xIdx (2 bytes) */
+		Stream_Write_UINT16(s, tile->yIdx);                   /* yIdx (2 bytes) */
+		Stream_Write_UINT8(s, tile->quality);                 /* quality (1 byte) */
+		for (x = 0; x < 3; x++)
+		{
+			Stream_Write_UINT16(s, srlLen[x]); /* srlLen (2 bytes) */
+			Stream_Write_UINT16(s, rawLen[x]); /* rawLen (2 bytes) */
+		}
+		Stream_SetPosition(s, end);
+	}
+
+	rc = TRUE;
+fail:
+	BufferPool_Return(progressive->bufferPool, srlData);
+	BufferPool_Return(progressive->bufferPool, rawData);
+	return rc;
+}
+
 static INLINE INT32 progressive_wb_sync(PROGRESSIVE_CONTEXT* progressive, wStream* s,
                                         UINT16 blockType, UINT32 blockLen)
 {
@@ -2601,10 +3149,10 @@ static BOOL progressive_rfx_write_message_progressive_simple(PROGRESSIVE_CONTEXT
 	if (!progressive_write_wb_sync(progressive, s))
 		return FALSE;
 
-	if (!progressive_write_wb_context(progressive, s))
+	if (!progressive_write_wb_context(progressive, s, 0))
 		return FALSE;
 
-	if (!progressive_write_frame_begin(progressive, s, msg))
+	if (!progressive_write_frame_begin(progressive, s, msg->frameIdx))
 		return FALSE;
 
 	if (!progressive_write_region(progressive, s, msg))
@@ -2623,6 +3171,28 @@ static BOOL progressive_rfx_write_message_progressive_simple(PROGRESSIVE_CONTEXT
 	return TRUE;
 }
 
+static INLINE BOOL progressive_check_scanline(UINT32 SrcFormat, UINT32 Width, UINT32* ScanLine)
+{
+	if (*ScanLine != 0)
+		return TRUE;
+
+	switch (SrcFormat)
+	{
+		case PIXEL_FORMAT_ABGR32:
+		case PIXEL_FORMAT_ARGB32:
+		case PIXEL_FORMAT_XBGR32:
+		case PIXEL_FORMAT_XRGB32:
+		case PIXEL_FORMAT_BGRA32:
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_RGBA32:
+		case PIXEL_FORMAT_RGBX32:
+			*ScanLine = Width * 4;
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
 int progressive_compress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData, UINT32 SrcSize,
                          UINT32 SrcFormat, UINT32 Width, UINT32 Height, UINT32 ScanLine,
                          const REGION16* invalidRegion, BYTE** ppDstData, UINT32* pDstSize)
@@ -2640,24 +3210,8 @@ int progressive_compress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData,
 		return -1;
 	}
 
-	if (ScanLine == 0)
-	{
-		switch (SrcFormat)
-		{
-			case PIXEL_FORMAT_ABGR32:
-			case PIXEL_FORMAT_ARGB32:
-			case PIXEL_FORMAT_XBGR32:
-			case PIXEL_FORMAT_XRGB32:
-			case PIXEL_FORMAT_BGRA32:
-			case PIXEL_FORMAT_BGRX32:
-			case PIXEL_FORMAT_RGBA32:
-			case PIXEL_FORMAT_RGBX32:
-				ScanLine = Width * 4;
-				break;
-			default:
-				return -2;
-		}
-	}
+	if (!progressive_check_scanline(SrcFormat, Width, &ScanLine))
+		return -2;
 
 	if (SrcSize < Height * ScanLine)
 		return -4;
@@ -2673,9 +3227,10 @@ int progressive_compress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData,
 	if (numRects == 0)
 		return 0;
 
-	if (!Stream_EnsureCapacity(progressive->rects, numRects * sizeof(RFX_RECT)))
+	Arena_Reset(progressive->frameArena);
+	rects = (RFX_RECT*)Arena_Alloc(progressive->frameArena, numRects * sizeof(RFX_RECT));
+	if (!rects)
 		return -5;
-	rects = (RFX_RECT*)Stream_Buffer(progressive->rects);
 	if (invalidRegion)
 	{
 		const RECTANGLE_16* region_rects = region16_rects(invalidRegion, NULL);
@@ -2745,6 +3300,300 @@ fail:
 	return res;
 }
 
+static INLINE BOOL progressive_tile_upgrade_pending(const PROGRESSIVE_CONTEXT* progressive,
+                                                    const RFX_PROGRESSIVE_TILE* tile)
+{
+	RFX_COMPONENT_CODEC_QUANT bitPos = { 0 };
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProg;
+	const size_t quality = tile->quality + 1ull;
+
+	if ((tile->pass == 0) || (quality >= progressive->numQuantProgVals))
+		return FALSE;
+
+	/* A ladder changed after the first pass might not refine the tile state */
+	quantProg = &progressive->quantProgVals[quality];
+	progressive_rfx_quant_add(&progressive->quantVal, &quantProg->yQuantValues, &bitPos);
+	if (!progressive_rfx_quant_cmp_less_equal(&bitPos, &tile->yBitPos))
+		return FALSE;
+	progressive_rfx_quant_add(&progressive->quantVal, &quantProg->cbQuantValues, &bitPos);
+	if (!progressive_rfx_quant_cmp_less_equal(&bitPos, &tile->cbBitPos))
+		return FALSE;
+	progressive_rfx_quant_add(&progressive->quantVal, &quantProg->crQuantValues, &bitPos);
+	return progressive_rfx_quant_cmp_less_equal(&bitPos, &tile->crBitPos);
+}
+
+static BOOL progressive_write_message_begin(PROGRESSIVE_CONTEXT* progressive, wStream* s)
+{
+	if (!progressive_write_wb_sync(progressive, s))
+		return FALSE;
+
+	if (!progressive_write_wb_context(progressive, s, RFX_SUBBAND_DIFFING))
+		return FALSE;
+
+	return progressive_write_frame_begin(progressive, s, progressive->rfx_context->frameIdx++);
+}
+
+int progressive_compress_surface(PROGRESSIVE_CONTEXT* progressive, UINT16 surfaceId,
+                                 const BYTE* pSrcData, UINT32 SrcSize, UINT32 SrcFormat,
+                                 UINT32 Width, UINT32 Height, UINT32 ScanLine,
+                                 const REGION16* invalidRegion, BYTE** ppDstData, UINT32* pDstSize)
+{
+	int res = -6;
+	UINT32 i;
+	UINT32 numRects;
+	UINT32 numTiles = 0;
+	size_t regionStart;
+	size_t tilesStart;
+	RFX_RECT* rects;
+	BYTE* dirty = NULL;
+	wStream* s;
+	PROGRESSIVE_SURFACE_CONTEXT* surface;
+
+	if (!progressive || !pSrcData || !ppDstData || !pDstSize)
+		return -1;
+
+	if (progressive->numQuantProgVals == 0)
+		return progressive_compress(progressive, pSrcData, SrcSize, SrcFormat, Width, Height,
+		                            ScanLine, invalidRegion, ppDstData, pDstSize);
+
+	surface = progressive_get_surface_data(progressive, surfaceId);
+	if (!surface || (Width > surface->width) || (Height > surface->height))
+	{
+		WLog_Print(progressive->log, WLOG_ERROR,
+		           "no surface %" PRIu16 " for %" PRIu32 "x%" PRIu32 " frame", surfaceId, Width,
+		           Height);
+		return -1;
+	}
+
+	if (!progressive_check_scanline(SrcFormat, Width, &ScanLine))
+		return -2;
+
+	if (SrcSize < Height * ScanLine)
+		return -4;
+
+	numRects = invalidRegion ? region16_n_rects(invalidRegion) : 1;
+
+	if (numRects == 0)
+		return 0;
+
+	if (numRects > UINT16_MAX)
+		return -5;
+
+	Arena_Reset(progressive->frameArena);
+	rects = (RFX_RECT*)Arena_Alloc(progressive->frameArena, numRects * sizeof(RFX_RECT));
+	if (!rects)
+		return -5;
+
+	if (invalidRegion)
+	{
+		const RECTANGLE_16* region_rects = region16_rects(invalidRegion, NULL);
+		for (i = 0; i < numRects; i++)
+		{
+			const RECTANGLE_16* r = &region_rects[i];
+			RFX_RECT* rect = &rects[i];
+
+			rect->x = r->left;
+			rect->y = r->top;
+			rect->width = r->right - r->left;
+			rect->height = r->bottom - r->top;
+		}
+	}
+	else
+	{
+		rects[0].x = 0;
+		rects[0].y = 0;
+		rects[0].width = (UINT16)Width;
+		rects[0].height = (UINT16)Height;
+	}
+
+	dirty = (BYTE*)Arena_Calloc(progressive->frameArena, surface->gridSize, sizeof(BYTE));
+	if (!dirty)
+		return -5;
+
+	for (i = 0; i < numRects; i++)
+	{
+		UINT32 x, y;
+		const RFX_RECT* rect = &rects[i];
+		const UINT32 right = MIN(Width, 1ul * rect->x + rect->width);
+		const UINT32 bottom = MIN(Height, 1ul * rect->y + rect->height);
+
+		for (y = rect->y / 64; y < (bottom + 63) / 64; y++)
+		{
+			for (x = rect->x / 64; x < (right + 63) / 64; x++)
+			{
+				const UINT32 index = y * surface->gridWidth + x;
+				numTiles += dirty[index] ? 0 : 1;
+				dirty[index] = 1;
+			}
+		}
+	}
+
+	if ((numTiles == 0) || (numTiles > UINT16_MAX))
+	{
+		res = (numTiles == 0) ? 0 : -5;
+		goto fail;
+	}
+
+	rfx_context_set_pixel_format(progressive->rfx_context, SrcFormat);
+
+	s = progressive->buffer;
+	Stream_SetPosition(s, 0);
+
+	if (!progressive_write_message_begin(progressive, s))
+		goto fail;
+
+	regionStart = Stream_GetPosition(s);
+	if (!progressive_write_region_begin(progressive, s, rects, (UINT16)numRects,
+	                                    (UINT16)numTiles))
+		goto fail;
+	tilesStart = Stream_GetPosition(s);
+
+	for (i = 0; i < surface->gridSize; i++)
+	{
+		RFX_PROGRESSIVE_TILE* tile = &surface->tiles[i];
+
+		if (!dirty[i])
+			continue;
+
+		tile->xIdx = (UINT16)(i % surface->gridWidth);
+		tile->yIdx = (UINT16)(i / surface->gridWidth);
+
+		if (!progressive_tile_encode_dwt(progressive, tile, pSrcData, SrcFormat, Width, Height,
+		                                 ScanLine))
+			goto fail;
+
+		if (!progressive_write_tile_first(progressive, s, tile))
+			goto fail;
+	}
+
+	if (!progressive_write_region_end(s, regionStart, tilesStart))
+		goto fail;
+
+	if (!progressive_write_frame_end(progressive, s))
+		goto fail;
+
+	*pDstSize = Stream_GetPosition(s);
+	*ppDstData = Stream_Buffer(s);
+	res = 1;
+fail:
+	return res;
+}
+
+int progressive_compress_upgrade(PROGRESSIVE_CONTEXT* progressive, UINT16 surfaceId,
+                                 BYTE** ppDstData, UINT32* pDstSize)
+{
+	UINT32 i;
+	UINT32 numTiles = 0;
+	size_t regionStart;
+	size_t tilesStart;
+	RFX_RECT* rects;
+	wStream* s;
+	PROGRESSIVE_SURFACE_CONTEXT* surface;
+
+	if (!progressive || !ppDstData || !pDstSize)
+		return -1;
+
+	surface = progressive_get_surface_data(progressive, surfaceId);
+	if (!surface)
+		return -1;
+
+	Arena_Reset(progressive->frameArena);
+	rects = (RFX_RECT*)Arena_Alloc(progressive->frameArena, surface->gridSize * sizeof(RFX_RECT));
+	if (!rects)
+		return -5;
+
+	for (i = 0; i < surface->gridSize; i++)
+	{
+		RFX_RECT* rect;
+		const RFX_PROGRESSIVE_TILE* tile = &surface->tiles[i];
+
+		if (!progressive_tile_upgrade_pending(progressive, tile))
+			continue;
+
+		rect = &rects[numTiles++];
+		rect->x = tile->xIdx * 64;
+		rect->y = tile->yIdx * 64;
+		rect->width = (UINT16)MIN(64, surface->width - rect->x);
+		rect->height = (UINT16)MIN(64, surface->height - rect->y);
+	}
+
+	*pDstSize = 0;
+
+	if (numTiles == 0)
+		return 0;
+
+	if (numTiles > UINT16_MAX)
+		return -5;
+
+	s = progressive->buffer;
+	Stream_SetPosition(s, 0);
+
+	if (!progressive_write_message_begin(progressive, s))
+		return -6;
+
+	regionStart = Stream_GetPosition(s);
+	if (!progressive_write_region_begin(progressive, s, rects, (UINT16)numTiles, (UINT16)numTiles))
+		return -6;
+	tilesStart = Stream_GetPosition(s);
+
+	for (i = 0; i < surface->gridSize; i++)
+	{
+		RFX_PROGRESSIVE_TILE* tile = &surface->tiles[i];
+
+		if (!progressive_tile_upgrade_pending(progressive, tile))
+			continue;
+
+		if (!progressive_write_tile_upgrade(progressive, s, tile))
+			return -6;
+	}
+
+	if (!progressive_write_region_end(s, regionStart, tilesStart))
+		return -6;
+
+	if (!progressive_write_frame_end(progressive, s))
+		return -6;
+
+	*pDstSize = Stream_GetPosition(s);
+	*ppDstData = Stream_Buffer(s);
+	return 1;
+}
+
+BOOL progressive_set_quality_ladder(PROGRESSIVE_CONTEXT* progressive, const BYTE* qualities,
+                                    size_t count)
+{
+	size_t i;
+
+	if (!progressive || (!qualities && (count > 0)) || (count > PROGRESSIVE_MAX_QUALITY_LADDER))
+		return FALSE;
+
+	for (i = 0; i < count; i++)
+	{
+		if ((qualities[i] < 1) || (qualities[i] > 100))
+			return FALSE;
+
+		if ((i > 0) && (qualities[i] <= qualities[i - 1]))
+			return FALSE;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		RFX_COMPONENT_CODEC_QUANT quant = { 0 };
+		RFX_PROGRESSIVE_CODEC_QUANT* quantProg = &progressive->quantProgVals[i];
+		/* drop up to 4 bit planes, one less for LL3 which carries most of the energy */
+		const BYTE drop = (BYTE)(((100 - qualities[i]) * 4 + 50) / 100);
+
+		progressive_rfx_quant_ladd(&quant, drop);
+		quant.LL3 = (drop > 0) ? drop - 1 : 0;
+		quantProg->quality = qualities[i];
+		quantProg->yQuantValues = quant;
+		quantProg->cbQuantValues = quant;
+		quantProg->crQuantValues = quant;
+	}
+
+	progressive->numQuantProgVals = (BYTE)count;
+	return TRUE;
+}
+
 BOOL progressive_context_reset(PROGRESSIVE_CONTEXT* progressive)
 {
 	if (!progressive)
@@ -2762,6 +3611,17 @@ PROGRESSIVE_CONTEXT* progressive_context_new(BOOL Compressor)
 
 	progressive->Compressor = Compressor;
 	progressive->quantProgValFull.quality = 100;
+	/* the RemoteFX default quantization values */
+	progressive->quantVal.LL3 = 6;
+	progressive->quantVal.HL3 = 6;
+	progressive->quantVal.LH3 = 6;
+	progressive->quantVal.HH3 = 6;
+	progressive->quantVal.HL2 = 7;
+	progressive->quantVal.LH2 = 7;
+	progressive->quantVal.HH2 = 8;
+	progressive->quantVal.HL1 = 8;
+	progressive->quantVal.LH1 = 8;
+	progressive->quantVal.HH1 = 9;
 	progressive->log = WLog_Get(TAG);
 	if (!progressive->log)
 		goto fail;
@@ -2771,8 +3631,8 @@ PROGRESSIVE_CONTEXT* progressive_context_new(BOOL Compressor)
 	progressive->buffer = Stream_New(NULL, 1024);
 	if (!progressive->buffer)
 		goto fail;
-	progressive->rects = Stream_New(NULL, 1024);
-	if (!progressive->rects)
+	progressive->frameArena = Arena_New(FALSE, 0, 16);
+	if (!progressive->frameArena)
 		goto fail;
 	progressive->bufferPool = BufferPool_New(TRUE, (8192 + 32) * 3, 16);
 	if (!progressive->bufferPool)
@@ -2798,7 +3658,7 @@ void progressive_context_free(PROGRESSIVE_CONTEXT* progressive)
 		return;
 
 	Stream_Free(progressive->buffer, TRUE);
-	Stream_Free(progressive->rects, TRUE);
+	Arena_Free(progressive->frameArena);
 	rfx_context_free(progressive->rfx_context);
 
 	BufferPool_Free(progressive->bufferPool);
@@ -41,6 +41,8 @@
 #define PROGRESSIVE_WBT_TILE_FIRST 0xCCC6
 #define PROGRESSIVE_WBT_TILE_UPGRADE 0xCCC7
 
+#define PROGRESSIVE_MAX_QUALITY_LADDER 16
+
 typedef struct
 {
 	BYTE LL3;
@@ -222,8 +224,13 @@ struct S_PROGRESSIVE_CONTEXT
 	wHashTable* SurfaceContexts;
 	wLog* log;
 	wStream* buffer;
-	wStream* rects;
+	wArena* frameArena; /* scratch of one progressive_compress* call */
 	RFX_CONTEXT* rfx_context;
+
+	/* encoder quality ladder, see progressive_set_quality_ladder */
+	RFX_COMPONENT_CODEC_QUANT quantVal;
+	BYTE numQuantProgVals;
+	RFX_PROGRESSIVE_CODEC_QUANT quantProgVals[PROGRESSIVE_MAX_QUALITY_LADDER];
 };
 
 #endif /* INTERNAL_CODEC_PROGRESSIVE_H */
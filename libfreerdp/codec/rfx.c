@@ -268,6 +268,15 @@ RFX_CONTEXT* rfx_context_new_ex(BOOL encoder, UINT32 ThreadingFlags)
 	if (!priv->BufferPool)
 		goto fail;
 
+	/* Sized for a handful of tiles, grows to the largest frame seen */
+	if (encoder)
+	{
+		priv->FrameArena = Arena_New(FALSE, (8192 + 32) * 3 * 16, 16);
+
+		if (!priv->FrameArena)
+			goto fail;
+	}
+
 	if (!(ThreadingFlags & THREADING_FLAGS_DISABLE_THREADS))
 	{
 #ifdef _WIN32
@@ -381,8 +390,6 @@ void rfx_context_free(RFX_CONTEXT* context)
 			if (priv->ThreadPool)
 				CloseThreadpool(priv->ThreadPool);
 			DestroyThreadpoolEnvironment(&priv->ThreadPoolEnv);
-			free(priv->workObjects);
-			free(priv->tileWorkParams);
 #ifdef WITH_PROFILER
 			WLog_VRB(
 			    TAG,
@@ -391,6 +398,7 @@ void rfx_context_free(RFX_CONTEXT* context)
 		}
 
 		BufferPool_Free(priv->BufferPool);
+		Arena_Free(priv->FrameArena);
 		free(priv);
 	}
 	free(context);
@@ -724,22 +732,29 @@ static BOOL rfx_process_message_region(RFX_CONTEXT* context, RFX_MESSAGE* messag
 
 typedef struct
 {
-	RFX_TILE* tile;
+	RFX_TILE** tiles;
 	RFX_CONTEXT* context;
 } RFX_TILE_PROCESS_WORK_PARAM;
 
-static void CALLBACK rfx_process_message_tile_work_callback(PTP_CALLBACK_INSTANCE instance,
-                                                            void* context, PTP_WORK work)
+static BOOL rfx_process_message_tiles(void* context, size_t first, size_t count)
 {
+	size_t i;
 	RFX_TILE_PROCESS_WORK_PARAM* param = (RFX_TILE_PROCESS_WORK_PARAM*)context;
-	rfx_decode_rgb(param->context, param->tile, param->tile->data, 64 * 4);
+
+	for (i = first; i < first + count; i++)
+	{
+		RFX_TILE* tile = param->tiles[i];
+		rfx_decode_rgb(param->context, tile, tile->data, 64 * 4);
+	}
+
+	return TRUE;
 }
 
 static BOOL rfx_process_message_tileset(RFX_CONTEXT* context, RFX_MESSAGE* message, wStream* s,
                                         UINT16* pExpectedBlockType)
 {
 	BOOL rc;
-	int i, close_cnt;
+	int i;
 	BYTE quant;
 	RFX_TILE* tile;
 	RFX_TILE** tmpTiles;
@@ -748,8 +763,7 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context, RFX_MESSAGE* messa
 	UINT32 blockLen;
 	UINT32 blockType;
 	UINT32 tilesDataSize;
-	PTP_WORK* work_objects = NULL;
-	RFX_TILE_PROCESS_WORK_PARAM* params = NULL;
+	RFX_TILE_PROCESS_WORK_PARAM param = { 0 };
 	void* pmem;
 
 	if (*pExpectedBlockType != WBT_EXTENSION)
@@ -840,27 +854,7 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context, RFX_MESSAGE* messa
 	message->tiles = tmpTiles;
 	message->numTiles = numTiles;
 
-	if (context->priv->UseThreads)
-	{
-		work_objects = (PTP_WORK*)calloc(message->numTiles, sizeof(PTP_WORK));
-		params = (RFX_TILE_PROCESS_WORK_PARAM*)calloc(message->numTiles,
-		                                              sizeof(RFX_TILE_PROCESS_WORK_PARAM));
-
-		if (!work_objects)
-		{
-			free(params);
-			return FALSE;
-		}
-
-		if (!params)
-		{
-			free(work_objects);
-			return FALSE;
-		}
-	}
-
 	/* tiles */
-	close_cnt = 0;
 	rc = FALSE;
 
 	if (Stream_GetRemainingLength(s) >= tilesDataSize)
@@ -945,48 +939,20 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context, RFX_MESSAGE* messa
 			}
 			tile->x = tile->xIdx * 64;
 			tile->y = tile->yIdx * 64;
-
-			if (context->priv->UseThreads)
-			{
-				if (!params)
-				{
-					rc = FALSE;
-					break;
-				}
-
-				params[i].context = context;
-				params[i].tile = message->tiles[i];
-
-				if (!(work_objects[i] =
-				          CreateThreadpoolWork(rfx_process_message_tile_work_callback,
-				                               (void*)&params[i], &context->priv->ThreadPoolEnv)))
-				{
-					WLog_ERR(TAG, "CreateThreadpoolWork failed.");
-					rc = FALSE;
-					break;
-				}
-
-				SubmitThreadpoolWork(work_objects[i]);
-				close_cnt = i + 1;
-			}
-			else
-			{
-				rfx_decode_rgb(context, tile, tile->data, 64 * 4);
-			}
 		}
 	}
 
-	if (context->priv->UseThreads)
+	if (rc)
 	{
-		for (i = 0; i < close_cnt; i++)
-		{
-			WaitForThreadpoolWorkCallbacks(work_objects[i], FALSE);
-			CloseThreadpoolWork(work_objects[i]);
-		}
-	}
+		param.context = context;
+		param.tiles = message->tiles;
 
-	free(work_objects);
-	free(params);
+		if (context->priv->UseThreads)
+			rc = winpr_ThreadpoolParallelFor(&context->priv->ThreadPoolEnv, message->numTiles, 0,
+			                                 rfx_process_message_tiles, &param);
+		else
+			rc = rfx_process_message_tiles(&param, 0, message->numTiles);
+	}
 
 	for (i = 0; i < message->numTiles; i++)
 	{
@@ -1231,9 +1197,13 @@ void rfx_message_free(RFX_CONTEXT* context, RFX_MESSAGE* message)
 {
 	int i;
 	RFX_TILE* tile;
+	BOOL arena;
 
 	if (message)
 	{
+		/* Encoded messages keep their arrays in the frame arena */
+		arena = Arena_Contains(context->priv->FrameArena, message->tiles);
+
 		if ((message->rects) && (message->freeRects))
 		{
 			free(message->rects);
@@ -1248,16 +1218,21 @@ void rfx_message_free(RFX_CONTEXT* context, RFX_MESSAGE* message)
 
 				if (tile->YCbCrData)
 				{
-					BufferPool_Return(context->priv->BufferPool, tile->YCbCrData);
+					if (!arena)
+						BufferPool_Return(context->priv->BufferPool, tile->YCbCrData);
 					tile->YCbCrData = NULL;
 				}
 
 				ObjectPool_Return(context->priv->TilePool, (void*)tile);
 			}
 
-			free(message->tiles);
+			if (!arena)
+				free(message->tiles);
 		}
 
+		if (arena && (context->priv->FrameMessages > 0))
+			context->priv->FrameMessages--;
+
 		if (!message->freeArray)
 			free(message);
 	}
@@ -1363,17 +1338,15 @@ static BOOL rfx_write_tile(RFX_CONTEXT* context, wStream* s, RFX_TILE* tile)
 	return TRUE;
 }
 
-struct S_RFX_TILE_COMPOSE_WORK_PARAM
+static BOOL rfx_compose_message_tiles(void* context, size_t first, size_t count)
 {
-	RFX_TILE* tile;
-	RFX_CONTEXT* context;
-};
+	size_t i;
+	RFX_TILE_PROCESS_WORK_PARAM* param = (RFX_TILE_PROCESS_WORK_PARAM*)context;
 
-static void CALLBACK rfx_compose_message_tile_work_callback(PTP_CALLBACK_INSTANCE instance,
-                                                            void* context, PTP_WORK work)
-{
-	RFX_TILE_COMPOSE_WORK_PARAM* param = (RFX_TILE_COMPOSE_WORK_PARAM*)context;
-	rfx_encode_rgb(param->context, param->tile);
+	for (i = first; i < first + count; i++)
+		rfx_encode_rgb(param->context, param->tiles[i]);
+
+	return TRUE;
 }
 
 static BOOL computeRegion(const RFX_RECT* rects, int numRects, REGION16* region, int width,
@@ -1400,25 +1373,26 @@ static BOOL computeRegion(const RFX_RECT* rects, int numRects, REGION16* region,
 
 #define TILE_NO(v) ((v) / 64)
 
-static BOOL setupWorkers(RFX_CONTEXT* context, int nbTiles)
+/*
+ * Encoded messages take their tile arrays and tile buffers from the frame arena. The arena can
+ * only be reset once every message of the previous frame was freed, a frame encoded while
+ * messages are still held uses the heap instead.
+ */
+static wArena* rfx_frame_arena(RFX_CONTEXT* context)
 {
-	RFX_CONTEXT_PRIV* priv = context->priv;
-	void* pmem;
-
-	if (!context->priv->UseThreads)
-		return TRUE;
-
-	if (!(pmem = realloc((void*)priv->workObjects, sizeof(PTP_WORK) * nbTiles)))
-		return FALSE;
+	if (!context->priv->FrameArena || (context->priv->FrameMessages > 0))
+		return NULL;
 
-	priv->workObjects = (PTP_WORK*)pmem;
+	Arena_Reset(context->priv->FrameArena);
+	return context->priv->FrameArena;
+}
 
-	if (!(pmem =
-	          realloc((void*)priv->tileWorkParams, sizeof(RFX_TILE_COMPOSE_WORK_PARAM) * nbTiles)))
-		return FALSE;
+static void* rfx_frame_calloc(wArena* arena, size_t nmemb, size_t size)
+{
+	if (arena)
+		return Arena_Calloc(arena, nmemb, size);
 
-	priv->tileWorkParams = (RFX_TILE_COMPOSE_WORK_PARAM*)pmem;
-	return TRUE;
+	return calloc(nmemb, size);
 }
 
 RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, size_t numRects,
@@ -1433,9 +1407,9 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, siz
 	RFX_TILE* tile;
 	RFX_RECT* rfxRect;
 	RFX_MESSAGE* message = NULL;
-	PTP_WORK* workObject = NULL;
-	RFX_TILE_COMPOSE_WORK_PARAM* workParam = NULL;
+	RFX_TILE_PROCESS_WORK_PARAM param = { 0 };
 	BOOL success = FALSE;
+	wArena* arena;
 	REGION16 rectsRegion, tilesRegion;
 	RECTANGLE_16 currentTileRect;
 	const RECTANGLE_16* regionRect;
@@ -1450,6 +1424,7 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, siz
 	if (!(message = (RFX_MESSAGE*)calloc(1, sizeof(RFX_MESSAGE))))
 		return NULL;
 
+	arena = rfx_frame_arena(context);
 	region16_init(&tilesRegion);
 	region16_init(&rectsRegion);
 
@@ -1485,20 +1460,15 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, siz
 	maxTilesY = 1 + TILE_NO(extents->bottom - 1) - TILE_NO(extents->top);
 	maxNbTiles = maxTilesX * maxTilesY;
 
-	if (!(message->tiles = calloc(maxNbTiles, sizeof(RFX_TILE*))))
+	if (!(message->tiles = (RFX_TILE**)rfx_frame_calloc(arena, maxNbTiles, sizeof(RFX_TILE*))))
 		goto skip_encoding_loop;
 
-	if (!setupWorkers(context, maxNbTiles))
-		goto skip_encoding_loop;
-
-	if (context->priv->UseThreads)
-	{
-		workObject = context->priv->workObjects;
-		workParam = context->priv->tileWorkParams;
-	}
+	if (arena)
+		context->priv->FrameMessages++;
 
 	regionRect = region16_rects(&rectsRegion, &regionNbRects);
 
+	/* The caller owns the rects, see rfx_encode_messages */
 	if (!(message->rects = calloc(regionNbRects, sizeof(RFX_RECT))))
 		goto skip_encoding_loop;
 
@@ -1573,7 +1543,12 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, siz
 				tile->quantIdxCr = context->quantIdxCr;
 				tile->YLen = tile->CbLen = tile->CrLen = 0;
 
-				if (!(tile->YCbCrData = (BYTE*)BufferPool_Take(context->priv->BufferPool, -1)))
+				if (arena)
+					tile->YCbCrData = (BYTE*)Arena_Alloc(arena, (8192 + 32) * 3);
+				else
+					tile->YCbCrData = (BYTE*)BufferPool_Take(context->priv->BufferPool, -1);
+
+				if (!tile->YCbCrData)
 					goto skip_encoding_loop;
 
 				tile->YData = (BYTE*)&(tile->YCbCrData[((8192 + 32) * 0) + 16]);
@@ -1582,27 +1557,6 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, siz
 				message->tiles[message->numTiles] = tile;
 				message->numTiles++;
 
-				if (context->priv->UseThreads)
-				{
-					workParam->context = context;
-					workParam->tile = tile;
-
-					if (!(*workObject = CreateThreadpoolWork(rfx_compose_message_tile_work_callback,
-					                                         (void*)workParam,
-					                                         &context->priv->ThreadPoolEnv)))
-					{
-						goto skip_encoding_loop;
-					}
-
-					SubmitThreadpoolWork(*workObject);
-					workObject++;
-					workParam++;
-				}
-				else
-				{
-					rfx_encode_rgb(context, tile);
-				}
-
 				if (!region16_union_rect(&tilesRegion, &tilesRegion, &currentTileRect))
 					goto skip_encoding_loop;
 			} /* xIdx */
@@ -1612,44 +1566,28 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, siz
 	success = TRUE;
 skip_encoding_loop:
 
-	if (success && message->numTiles != maxNbTiles)
+	if (success && (message->numTiles == 0))
+		success = FALSE;
+
+	if (success)
 	{
-		if (message->numTiles > 0)
-		{
-			void* pmem = realloc((void*)message->tiles, sizeof(RFX_TILE*) * message->numTiles);
+		param.context = context;
+		param.tiles = message->tiles;
 
-			if (pmem)
-				message->tiles = (RFX_TILE**)pmem;
-			else
-				success = FALSE;
-		}
+		if (context->priv->UseThreads)
+			success = winpr_ThreadpoolParallelFor(&context->priv->ThreadPoolEnv,
+			                                      message->numTiles, 0, rfx_compose_message_tiles,
+			                                      &param);
 		else
-			success = FALSE;
+			success = rfx_compose_message_tiles(&param, 0, message->numTiles);
 	}
 
-	/* when using threads ensure all computations are done */
 	if (success)
 	{
 		message->tilesDataSize = 0;
-		workObject = context->priv->workObjects;
 
 		for (i = 0; i < message->numTiles; i++)
-		{
-			tile = message->tiles[i];
-
-			if (context->priv->UseThreads)
-			{
-				if (*workObject)
-				{
-					WaitForThreadpoolWorkCallbacks(*workObject, FALSE);
-					CloseThreadpoolWork(*workObject);
-				}
-
-				workObject++;
-			}
-
-			message->tilesDataSize += rfx_tile_length(tile);
-		}
+			message->tilesDataSize += rfx_tile_length(message->tiles[i]);
 
 		region16_uninit(&tilesRegion);
 		region16_uninit(&rectsRegion);
@@ -1669,7 +1607,13 @@ static RFX_MESSAGE* rfx_split_message(RFX_CONTEXT* context, RFX_MESSAGE* message
 	size_t i, j;
 	UINT32 tileDataSize;
 	RFX_MESSAGE* messages;
+	wArena* arena = NULL;
 	maxDataSize -= 1024; /* reserve enough space for headers */
+
+	/* The parts stay where the frame was encoded */
+	if (Arena_Contains(context->priv->FrameArena, message->tiles))
+		arena = context->priv->FrameArena;
+
 	*numMessages = ((message->tilesDataSize + maxDataSize) / maxDataSize) * 4;
 
 	if (!(messages = (RFX_MESSAGE*)calloc((*numMessages), sizeof(RFX_MESSAGE))))
@@ -1694,8 +1638,12 @@ static RFX_MESSAGE* rfx_split_message(RFX_CONTEXT* context, RFX_MESSAGE* message
 			messages[j].freeRects = FALSE;
 			messages[j].freeArray = TRUE;
 
-			if (!(messages[j].tiles = (RFX_TILE**)calloc(message->numTiles, sizeof(RFX_TILE*))))
+			if (!(messages[j].tiles = (RFX_TILE**)rfx_frame_calloc(arena, message->numTiles,
+			                                                       sizeof(RFX_TILE*))))
 				goto free_messages;
+
+			if (arena)
+				context->priv->FrameMessages++;
 		}
 
 		messages[j].tilesDataSize += tileDataSize;
@@ -1709,8 +1657,13 @@ static RFX_MESSAGE* rfx_split_message(RFX_CONTEXT* context, RFX_MESSAGE* message
 	return messages;
 free_messages:
 
-	for (i = 0; i < j; i++)
-		free(messages[i].tiles);
+	if (arena)
+		context->priv->FrameMessages -= j;
+	else
+	{
+		for (i = 0; i < j; i++)
+			free(messages[i].tiles);
+	}
 
 	free(messages);
 	return NULL;
@@ -1843,8 +1796,10 @@ static BOOL rfx_write_message_frame_end(RFX_CONTEXT* context, wStream* s,
 	return TRUE;
 }
 
-BOOL rfx_write_message(RFX_CONTEXT* context, wStream* s, const RFX_MESSAGE* message)
+BOOL rfx_write_message_header(RFX_CONTEXT* context, wStream* s)
 {
+	WINPR_ASSERT(context);
+
 	if (context->state == RFX_STATE_SEND_HEADERS)
 	{
 		if (!rfx_compose_message_header(context, s))
@@ -1853,6 +1808,14 @@ BOOL rfx_write_message(RFX_CONTEXT* context, wStream* s, const RFX_MESSAGE* mess
 		context->state = RFX_STATE_SEND_FRAME_DATA;
 	}
 
+	return TRUE;
+}
+
+BOOL rfx_write_message(RFX_CONTEXT* context, wStream* s, const RFX_MESSAGE* message)
+{
+	if (!rfx_write_message_header(context, s))
+		return FALSE;
+
 	if (!rfx_write_message_frame_begin(context, s, message) ||
 	    !rfx_write_message_region(context, s, message) ||
 	    !rfx_write_message_tileset(context, s, message) ||
@@ -1864,6 +1827,32 @@ BOOL rfx_write_message(RFX_CONTEXT* context, wStream* s, const RFX_MESSAGE* mess
 	return TRUE;
 }
 
+BOOL rfx_write_encoded_message(RFX_CONTEXT* context, wStream* s, const BYTE* data, size_t length)
+{
+	size_t start;
+
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(data || (length == 0));
+
+	/* the data must start with the RFX_FRAME_BEGIN block written by rfx_write_message */
+	if ((length < 14) || (data[0] != (WBT_FRAME_BEGIN & 0xFF)) ||
+	    (data[1] != (WBT_FRAME_BEGIN >> 8)))
+		return FALSE;
+
+	if (!rfx_write_message_header(context, s))
+		return FALSE;
+
+	if (!Stream_EnsureRemainingCapacity(s, length))
+		return FALSE;
+
+	start = Stream_GetPosition(s);
+	Stream_Write(s, data, length);
+	Stream_SetPosition(s, start + 8);
+	Stream_Write_UINT32(s, context->frameIdx++); /* frameIdx */
+	Stream_SetPosition(s, start + length);
+	return TRUE;
+}
+
 BOOL rfx_compose_message(RFX_CONTEXT* context, wStream* s, const RFX_RECT* rects, size_t numRects,
                          const BYTE* data, UINT32 width, UINT32 height, UINT32 scanline)
 {
@@ -25,4 +25,8 @@
 
 FREERDP_LOCAL void rfx_encode_rgb(RFX_CONTEXT* context, RFX_TILE* tile);
 
+/* Convert a (up to) 64x64 tile to 11.5 fixed point YCbCr planes, edges are padded */
+FREERDP_LOCAL void rfx_encode_ycbcr(RFX_CONTEXT* context, const BYTE* data, UINT32 width,
+                                    UINT32 height, UINT32 scanline, INT16* pSrcDst[3]);
+
 #endif /* FREERDP_LIB_CODEC_RFX_ENCODE_H */
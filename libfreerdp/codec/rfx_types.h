@@ -40,16 +40,12 @@
 	} while (0)
 #endif
 
-typedef struct S_RFX_TILE_COMPOSE_WORK_PARAM RFX_TILE_COMPOSE_WORK_PARAM;
-
 struct S_RFX_CONTEXT_PRIV
 {
 	wLog* log;
 	wObjectPool* TilePool;
 
 	BOOL UseThreads;
-	PTP_WORK* workObjects;
-	RFX_TILE_COMPOSE_WORK_PARAM* tileWorkParams;
 
 	DWORD MinThreadCount;
 	DWORD MaxThreadCount;
@@ -59,6 +55,11 @@ struct S_RFX_CONTEXT_PRIV
 
 	wBufferPool* BufferPool;
 
+	/* Tile arrays, rects and tile buffers of encoded messages. Reset before
+	 * encoding once all messages of the previous frame were freed. */
+	wArena* FrameArena;
+	UINT32 FrameMessages;
+
 	/* profilers */
 	PROFILER_DEFINE(prof_rfx_decode_rgb)
 	PROFILER_DEFINE(prof_rfx_decode_component)
@@ -71,6 +71,186 @@ fail:
 	return rc;
 }
 
+typedef void (*fill_image_fn)(BYTE* data, UINT32 width, UINT32 height, UINT32 seed);
+
+static void fill_solid(BYTE* data, UINT32 width, UINT32 height, UINT32 seed)
+{
+	UINT32 x;
+
+	for (x = 0; x < width * height; x++)
+		FreeRDPWriteColor(&data[x * 4], PIXEL_FORMAT_BGRX32,
+		                  FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0x20, 0x40, (BYTE)seed, 0xFF));
+}
+
+/* Dark glyph like strokes on a light background, ends up in bands */
+static void fill_text(BYTE* data, UINT32 width, UINT32 height, UINT32 seed)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			const UINT32 line = (y + seed) % 20;
+			const BOOL ink = (line >= 4) && (line < 14) && (((x * 7 + y * 3) % 11) < 3);
+			const BYTE v = ink ? (BYTE)(0x10 * (x % 3)) : 0xF0;
+			FreeRDPWriteColor(&data[(y * width + x) * 4], PIXEL_FORMAT_BGRX32,
+			                  FreeRDPGetColor(PIXEL_FORMAT_BGRX32, v, v, v, 0xFF));
+		}
+	}
+}
+
+/* Few colors, none dominant, ends up in RLEX */
+static void fill_palette(BYTE* data, UINT32 width, UINT32 height, UINT32 seed)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			const BYTE v = (BYTE)((((x / 3) + (y / 2) + seed) % 12) * 20);
+			FreeRDPWriteColor(&data[(y * width + x) * 4], PIXEL_FORMAT_BGRX32,
+			                  FreeRDPGetColor(PIXEL_FORMAT_BGRX32, v, (BYTE)(0xFF - v), 0x80,
+			                                  0xFF));
+		}
+	}
+}
+
+/* Smooth gradient with many colors, ends up in NSCodec */
+static void fill_photo(BYTE* data, UINT32 width, UINT32 height, UINT32 seed)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			FreeRDPWriteColor(&data[(y * width + x) * 4], PIXEL_FORMAT_BGRX32,
+			                  FreeRDPGetColor(PIXEL_FORMAT_BGRX32, (BYTE)(x * 2 + seed),
+			                                  (BYTE)(y * 2), (BYTE)(x + y), 0xFF));
+		}
+	}
+}
+
+static BOOL compare_images(const BYTE* a, const BYTE* b, UINT32 width, UINT32 height,
+                           UINT32 tolerance)
+{
+	UINT32 x;
+
+	for (x = 0; x < width * height * 4; x++)
+	{
+		const UINT32 diff = (a[x] > b[x]) ? (a[x] - b[x]) : (b[x] - a[x]);
+
+		if ((x % 4) == 3)
+			continue;
+
+		if (diff > tolerance)
+		{
+			printf("pixel %" PRIu32 "x%" PRIu32 " differs: %" PRIu8 " != %" PRIu8 "\n",
+			       (x / 4) % width, (x / 4) / width, a[x], b[x]);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Encodes the same image twice and a changed one, decodes all of them with a
+ * single decoder context so the cache state of both sides has to match. */
+static BOOL test_ClearRoundTrip(const char* name, fill_image_fn fill, UINT32 width, UINT32 height,
+                                UINT32 tolerance, CLEAR_CONTEXT* encoder, CLEAR_CONTEXT* decoder)
+{
+	BOOL rc = FALSE;
+	UINT32 pass;
+	UINT32 sizes[3] = { 0 };
+	const size_t length = 4ull * width * height;
+	BYTE* src = calloc(length, 1);
+	BYTE* dst = calloc(length, 1);
+
+	if (!src || !dst)
+		goto fail;
+
+	for (pass = 0; pass < ARRAYSIZE(sizes); pass++)
+	{
+		BYTE* data = NULL;
+		int status;
+
+		fill(src, width, height, (pass == 2) ? 5 : 0);
+		status = clear_compress(encoder, src, (UINT32)length, PIXEL_FORMAT_BGRX32, width, height,
+		                        width * 4, &data, &sizes[pass]);
+
+		if ((status < 0) || !data || (sizes[pass] == 0))
+		{
+			printf("clear_compress %s pass %" PRIu32 " failed: %d\n", name, pass, status);
+			goto fail;
+		}
+
+		status = clear_decompress(decoder, data, sizes[pass], width, height, dst,
+		                          PIXEL_FORMAT_BGRX32, width * 4, 0, 0, width, height, NULL);
+
+		if (status < 0)
+		{
+			printf("clear_decompress %s pass %" PRIu32 " failed: %d\n", name, pass, status);
+			goto fail;
+		}
+
+		if (!compare_images(src, dst, width, height, tolerance))
+		{
+			printf("clear round trip %s pass %" PRIu32 " mismatch\n", name, pass);
+			goto fail;
+		}
+	}
+
+	printf("clear round trip %s %" PRIu32 "x%" PRIu32 ": %" PRIu32 ", %" PRIu32 ", %" PRIu32
+	       " bytes\n",
+	       name, width, height, sizes[0], sizes[1], sizes[2]);
+
+	/* The repeated image must profit from the V-bar or glyph caches */
+	if ((tolerance == 0) && (sizes[1] > sizes[0]))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	free(src);
+	free(dst);
+	return rc;
+}
+
+static BOOL test_ClearEncoder(void)
+{
+	BOOL rc = FALSE;
+	CLEAR_CONTEXT* encoder = clear_context_new(TRUE);
+	CLEAR_CONTEXT* decoder = clear_context_new(FALSE);
+
+	if (!encoder || !decoder)
+		goto fail;
+
+	if (!test_ClearRoundTrip("solid", fill_solid, 100, 70, 0, encoder, decoder))
+		goto fail;
+
+	if (!test_ClearRoundTrip("text", fill_text, 200, 130, 0, encoder, decoder))
+		goto fail;
+
+	if (!test_ClearRoundTrip("palette", fill_palette, 130, 64, 0, encoder, decoder))
+		goto fail;
+
+	if (!test_ClearRoundTrip("glyph", fill_text, 24, 20, 0, encoder, decoder))
+		goto fail;
+
+	if (!test_ClearRoundTrip("photo", fill_photo, 96, 80, 24, encoder, decoder))
+		goto fail;
+
+	if (!test_ClearRoundTrip("text", fill_text, 200, 130, 0, encoder, decoder))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	clear_context_free(encoder);
+	clear_context_free(decoder);
+	return rc;
+}
+
 int TestFreeRDPCodecClear(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -90,5 +270,8 @@ int TestFreeRDPCodecClear(int argc, char* argv[])
 	if (!test_ClearDecompressExample(4, 7, 15, TEST_CLEAR_EXAMPLE_4, sizeof(TEST_CLEAR_EXAMPLE_4)))
 		return -1;
 
+	if (!test_ClearEncoder())
+		return -1;
+
 	return 0;
 }
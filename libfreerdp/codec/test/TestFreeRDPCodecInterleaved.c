@@ -5,6 +5,7 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/color.h>
@@ -153,6 +154,255 @@ fail:
 	return rc;
 }
 
+typedef struct
+{
+	UINT32 pattern;
+	UINT32 width;
+	UINT32 height;
+	UINT16 bpp;
+	UINT32 size;
+	UINT32 hash;
+} INTERLEAVED_REFERENCE;
+
+/* Output of the scalar encoder, the run detection must not change a single byte */
+static const INTERLEAVED_REFERENCE interleaved_reference[] = {
+	{ 0, 64, 64, 24, 10, 0xc53541fd },
+	{ 1, 64, 64, 24, 198, 0x882f494d },
+	{ 2, 64, 64, 24, 112, 0xbb2c5e4c },
+	{ 3, 64, 64, 24, 960, 0xb96e6305 },
+	{ 4, 64, 64, 24, 12291, 0xc93eb72b },
+	{ 5, 64, 64, 24, 5818, 0x187208b8 },
+	{ 6, 64, 64, 24, 12291, 0x7160ca43 },
+	{ 7, 64, 64, 24, 7291, 0x2b91e48c },
+	{ 0, 28, 9, 24, 9, 0x2b59843f },
+	{ 1, 28, 9, 24, 27, 0x596a3805 },
+	{ 2, 28, 9, 24, 52, 0x882fd24d },
+	{ 3, 28, 9, 24, 126, 0xbd6377f0 },
+	{ 4, 28, 9, 24, 758, 0x7605e21d },
+	{ 5, 28, 9, 24, 346, 0xca9460fa },
+	{ 6, 28, 9, 24, 758, 0xab759595 },
+	{ 7, 28, 9, 24, 349, 0x65ca7a75 },
+	{ 0, 64, 64, 16, 8, 0x414bccf3 },
+	{ 1, 64, 64, 16, 154, 0xfb6671e9 },
+	{ 2, 64, 64, 16, 27, 0xc3ce9fa8 },
+	{ 3, 64, 64, 16, 704, 0xad9ab905 },
+	{ 4, 64, 64, 16, 448, 0x573efe45 },
+	{ 5, 64, 64, 16, 4080, 0x07953b8c },
+	{ 6, 64, 64, 16, 8195, 0xcb93c951 },
+	{ 7, 64, 64, 16, 2478, 0xde436833 },
+	{ 0, 28, 9, 16, 7, 0x3f2acfb9 },
+	{ 1, 28, 9, 16, 21, 0xec9bc195 },
+	{ 2, 28, 9, 16, 14, 0x27eb0e51 },
+	{ 3, 28, 9, 16, 90, 0x8d718fea },
+	{ 4, 28, 9, 16, 54, 0x85f7c15f },
+	{ 5, 28, 9, 16, 236, 0x42014df4 },
+	{ 6, 28, 9, 16, 506, 0x59d4da13 },
+	{ 7, 28, 9, 16, 33, 0x6fe7b133 },
+	{ 0, 64, 64, 15, 8, 0xa7c9b6b9 },
+	{ 1, 64, 64, 15, 154, 0xfbba2419 },
+	{ 2, 64, 64, 15, 27, 0xa18ed360 },
+	{ 3, 64, 64, 15, 704, 0xa827ff05 },
+	{ 4, 64, 64, 15, 448, 0x68699e45 },
+	{ 5, 64, 64, 15, 4105, 0x410b9d24 },
+	{ 6, 64, 64, 15, 8195, 0x34e6b614 },
+	{ 7, 64, 64, 15, 2478, 0xdb6c580d },
+	{ 0, 28, 9, 15, 7, 0xb8256509 },
+	{ 1, 28, 9, 15, 21, 0xe283a6f5 },
+	{ 2, 28, 9, 15, 14, 0x9c85d701 },
+	{ 3, 28, 9, 15, 90, 0x9a2e48ea },
+	{ 4, 28, 9, 15, 54, 0x6c5e35bf },
+	{ 5, 28, 9, 15, 247, 0x1071f626 },
+	{ 6, 28, 9, 15, 506, 0x2c1221e8 },
+	{ 7, 28, 9, 15, 33, 0x1a260863 },
+};
+
+static UINT32 interleaved_hash(const BYTE* data, size_t size)
+{
+	size_t x;
+	UINT32 hash = 2166136261u;
+
+	for (x = 0; x < size; x++)
+		hash = (hash ^ data[x]) * 16777619u;
+
+	return hash;
+}
+
+static UINT32 interleaved_test_color(UINT32 pattern, UINT32 x, UINT32 y, UINT32* seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+
+	switch (pattern)
+	{
+		case 0: /* solid */
+			return 0x336699;
+
+		case 1: /* horizontal stripes, fill runs */
+			return ((y / 3) % 2) ? 0xE0E0E0 : 0x204080;
+
+		case 2: /* vertical bars, color runs */
+			return 0x010203 * ((x / 5) % 7);
+
+		case 3: /* checkerboard, bicolor runs */
+			return ((x + y) % 2) ? 0xFFFFFF : 0x000000;
+
+		case 4: /* every row inverts the one above, mix runs */
+			return ((y % 2) ? 0xFFFFFF : 0) ^ (0x10 * ((x / 4) % 8) + 0x3050);
+
+		case 5: /* text, sparse foreground on a white background */
+			return ((*seed >> 16) % 5 == 0) ? 0x000000 : 0xFFFFFF;
+
+		case 6: /* noise */
+			return *seed >> 8;
+
+		default: /* user interface, blocks, gradients and some noise */
+			if ((x / 16 + y / 16) % 3 == 0)
+				return 0xF0F0F0;
+			else if ((x / 16 + y / 16) % 3 == 1)
+				return 0x000100 * (x * 4) + y;
+			else
+				return ((*seed >> 16) % 3 == 0) ? (*seed >> 8) : 0x0000FF;
+	}
+}
+
+static BOOL run_compatibility(BITMAP_INTERLEAVED_CONTEXT* encoder,
+                              BITMAP_INTERLEAVED_CONTEXT* decoder)
+{
+	size_t x;
+	BOOL rc = FALSE;
+	const UINT32 format = PIXEL_FORMAT_BGRX32;
+	const UINT32 step = 64 * 4;
+	BYTE* pSrcData = calloc(64, step);
+	BYTE* pDstData = calloc(64, step);
+	BYTE* tmp = calloc(64, step);
+
+	if (!pSrcData || !pDstData || !tmp)
+		goto fail;
+
+	for (x = 0; x < ARRAYSIZE(interleaved_reference); x++)
+	{
+		UINT32 i, j;
+		UINT32 seed = 1;
+		UINT32 DstSize = 64 * step;
+		const INTERLEAVED_REFERENCE* ref = &interleaved_reference[x];
+
+		for (i = 0; i < ref->height; i++)
+		{
+			for (j = 0; j < ref->width; j++)
+			{
+				const UINT32 color = interleaved_test_color(ref->pattern, j, i, &seed);
+				FreeRDPWriteColor(&pSrcData[i * step + j * 4], format, color | 0xFF000000);
+			}
+		}
+
+		if (!interleaved_compress(encoder, tmp, &DstSize, ref->width, ref->height, pSrcData,
+		                          format, step, 0, 0, NULL, ref->bpp))
+			goto fail;
+
+		if ((DstSize != ref->size) || (interleaved_hash(tmp, DstSize) != ref->hash))
+		{
+			printf("interleaved %" PRIu16 "bpp pattern %" PRIu32 " %" PRIu32 "x%" PRIu32
+			       " differs from the reference output\n",
+			       ref->bpp, ref->pattern, ref->width, ref->height);
+			goto fail;
+		}
+
+		if (!interleaved_decompress(decoder, tmp, DstSize, ref->width, ref->height, ref->bpp,
+		                            pDstData, format, step, 0, 0, ref->width, ref->height, NULL))
+			goto fail;
+
+		/* The encoder gets dithered runs and some fill or mix runs wrong. Fixing that
+		 * changes the output, so those patterns are only checked for compatibility. */
+		if ((ref->pattern == 3) || (ref->pattern == 5))
+			continue;
+
+		for (i = 0; i < ref->height; i++)
+		{
+			for (j = 0; j < ref->width; j++)
+			{
+				BYTE r, g, b, dr, dg, db;
+				const int maxDiff = (ref->bpp < 24) ? 8 : 0;
+				const UINT32 srcColor = FreeRDPReadColor(&pSrcData[i * step + j * 4], format);
+				const UINT32 dstColor = FreeRDPReadColor(&pDstData[i * step + j * 4], format);
+				FreeRDPSplitColor(srcColor, format, &r, &g, &b, NULL, NULL);
+				FreeRDPSplitColor(dstColor, format, &dr, &dg, &db, NULL, NULL);
+
+				if ((abs(r - dr) > maxDiff) || (abs(g - dg) > maxDiff) || (abs(b - db) > maxDiff))
+				{
+					printf("interleaved %" PRIu16 "bpp pattern %" PRIu32
+					       " pixel %" PRIu32 "x%" PRIu32 " differs after decoding\n",
+					       ref->bpp, ref->pattern, j, i);
+					goto fail;
+				}
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(pSrcData);
+	free(pDstData);
+	free(tmp);
+	return rc;
+}
+
+static BOOL run_throughput(BITMAP_INTERLEAVED_CONTEXT* encoder, UINT16 bpp)
+{
+	size_t x;
+	UINT32 i, j;
+	UINT64 start;
+	UINT64 duration;
+	BOOL rc = FALSE;
+	UINT32 seed = 1;
+	const size_t passes = 2000;
+	const UINT32 patterns[] = { 5, 7 };
+	const UINT32 format = PIXEL_FORMAT_BGRX32;
+	const UINT32 step = 64 * 4;
+	BYTE* pSrcData = calloc(ARRAYSIZE(patterns) * 64, step);
+	BYTE* tmp = calloc(64, step);
+
+	if (!pSrcData || !tmp)
+		goto fail;
+
+	for (x = 0; x < ARRAYSIZE(patterns); x++)
+	{
+		for (i = 0; i < 64; i++)
+		{
+			for (j = 0; j < 64; j++)
+			{
+				const UINT32 color = interleaved_test_color(patterns[x], j, i, &seed);
+				FreeRDPWriteColor(&pSrcData[(x * 64 + i) * step + j * 4], format,
+				                  color | 0xFF000000);
+			}
+		}
+	}
+
+	start = GetTickCount64();
+
+	for (x = 0; x < passes; x++)
+	{
+		UINT32 DstSize = 64 * step;
+		const BYTE* tile = &pSrcData[(x % ARRAYSIZE(patterns)) * 64 * step];
+
+		if (!interleaved_compress(encoder, tmp, &DstSize, 64, 64, tile, format, step, 0, 0, NULL,
+		                          bpp))
+			goto fail;
+	}
+
+	duration = GetTickCount64() - start;
+
+	if (duration == 0)
+		duration = 1;
+
+	printf("interleaved_compress %" PRIu16 "bpp: %" PRIuz " 64x64 tiles in %" PRIu64
+	       "ms (%" PRIu64 " MB/s)\n",
+	       bpp, passes, duration, (UINT64)passes * 64 * step * 1000 / duration / 1000000);
+	rc = TRUE;
+fail:
+	free(pSrcData);
+	free(tmp);
+	return rc;
+}
+
 static BOOL TestColorConversion(void)
 {
 	const UINT32 formats[] = { PIXEL_FORMAT_RGB15,  PIXEL_FORMAT_BGR15, PIXEL_FORMAT_ABGR15,
@@ -202,6 +452,13 @@ int TestFreeRDPCodecInterleaved(int argc, char* argv[])
 	if (!run_encode_decode(15, encoder, decoder))
 		goto fail;
 
+	if (!run_compatibility(encoder, decoder))
+		goto fail;
+
+	if (!run_throughput(encoder, 24) || !run_throughput(encoder, 16) ||
+	    !run_throughput(encoder, 15))
+		goto fail;
+
 	if (!TestColorConversion())
 		goto fail;
 
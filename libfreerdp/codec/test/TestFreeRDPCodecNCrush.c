@@ -1,5 +1,6 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include "../ncrush.h"
 
@@ -107,6 +108,107 @@ fail:
 	return rc;
 }
 
+#define TEST_THROUGHPUT_CHUNK 8192
+#define TEST_THROUGHPUT_CHUNKS 64
+#define TEST_THROUGHPUT_PASSES 20
+
+/* Decodes a stream of bulk packets built from the bells sample over and over and
+ * reports the decoder throughput. */
+static BOOL test_NCrushDecompressThroughput(void)
+{
+	BOOL rc = FALSE;
+	size_t index;
+	size_t pass;
+	UINT32 seed = 1;
+	UINT64 start;
+	UINT64 duration;
+	const size_t SrcSize = TEST_THROUGHPUT_CHUNK * TEST_THROUGHPUT_CHUNKS;
+	BYTE* pSrcData = (BYTE*)malloc(SrcSize);
+	BYTE* pPackets = (BYTE*)calloc(TEST_THROUGHPUT_CHUNKS, 65536);
+	UINT32 PacketSize[TEST_THROUGHPUT_CHUNKS] = { 0 };
+	UINT32 PacketFlags[TEST_THROUGHPUT_CHUNKS] = { 0 };
+	NCRUSH_CONTEXT* ncrush = ncrush_context_new(TRUE);
+
+	if (!pSrcData || !pPackets || !ncrush)
+		goto fail;
+
+	for (index = 0; index < SrcSize; index++)
+	{
+		seed = seed * 1103515245 + 12345;
+
+		if ((seed >> 16) % 32 == 0)
+			pSrcData[index] = (BYTE)(seed >> 24);
+		else
+			pSrcData[index] = TEST_BELLS_DATA[index % (sizeof(TEST_BELLS_DATA) - 1)];
+	}
+
+	for (index = 0; index < TEST_THROUGHPUT_CHUNKS; index++)
+	{
+		BYTE* pPacket = &pPackets[index * 65536];
+		const BYTE* pDstData = NULL;
+		UINT32 DstSize = 65536;
+
+		if (ncrush_compress(ncrush, &pSrcData[index * TEST_THROUGHPUT_CHUNK],
+		                    TEST_THROUGHPUT_CHUNK, pPacket, &pDstData, &DstSize,
+		                    &PacketFlags[index]) < 0)
+			goto fail;
+
+		if (!(PacketFlags[index] & PACKET_COMPRESSED))
+		{
+			printf("NCrushDecompressThroughput: chunk %" PRIuz " did not compress\n", index);
+			goto fail;
+		}
+
+		CopyMemory(pPacket, pDstData, DstSize);
+		PacketSize[index] = DstSize;
+	}
+
+	ncrush_context_free(ncrush);
+	ncrush = NULL;
+	start = GetTickCount64();
+
+	for (pass = 0; pass < TEST_THROUGHPUT_PASSES; pass++)
+	{
+		if (!(ncrush = ncrush_context_new(FALSE)))
+			goto fail;
+
+		for (index = 0; index < TEST_THROUGHPUT_CHUNKS; index++)
+		{
+			const BYTE* pDstData = NULL;
+			UINT32 DstSize = 0;
+
+			if (ncrush_decompress(ncrush, &pPackets[index * 65536], PacketSize[index], &pDstData,
+			                      &DstSize, PacketFlags[index]) < 0)
+				goto fail;
+
+			if ((DstSize != TEST_THROUGHPUT_CHUNK) ||
+			    (memcmp(pDstData, &pSrcData[index * TEST_THROUGHPUT_CHUNK], DstSize) != 0))
+			{
+				printf("NCrushDecompressThroughput: chunk %" PRIuz " mismatch\n", index);
+				goto fail;
+			}
+		}
+
+		ncrush_context_free(ncrush);
+		ncrush = NULL;
+	}
+
+	duration = GetTickCount64() - start;
+
+	if (duration == 0)
+		duration = 1;
+
+	printf("NCrushDecompressThroughput: %" PRIuz " bytes in %" PRIu64 "ms (%" PRIu64 " MB/s)\n",
+	       SrcSize * TEST_THROUGHPUT_PASSES, duration,
+	       (UINT64)SrcSize * TEST_THROUGHPUT_PASSES * 1000 / duration / 1000000);
+	rc = TRUE;
+fail:
+	ncrush_context_free(ncrush);
+	free(pPackets);
+	free(pSrcData);
+	return rc;
+}
+
 int TestFreeRDPCodecNCrush(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -118,5 +220,8 @@ int TestFreeRDPCodecNCrush(int argc, char* argv[])
 	if (!test_NCrushDecompressBells())
 		return -1;
 
+	if (!test_NCrushDecompressThroughput())
+		return -1;
+
 	return 0;
 }
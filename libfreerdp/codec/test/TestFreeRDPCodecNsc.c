@@ -0,0 +1,213 @@
+#include <winpr/crt.h>
+#include <winpr/print.h>
+#include <winpr/crypto.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/codec/color.h>
+#include <freerdp/codec/nsc.h>
+
+#include "../nsc_types.h"
+
+static const UINT32 nsc_formats[] = { PIXEL_FORMAT_BGRX32, PIXEL_FORMAT_BGRA32,
+	                                  PIXEL_FORMAT_RGBX32, PIXEL_FORMAT_RGBA32 };
+
+static BYTE* create_image(UINT32 width, UINT32 height, UINT32 pattern)
+{
+	UINT32 x, y;
+	BYTE* image = (BYTE*)malloc(4ull * width * height);
+
+	if (!image)
+		return NULL;
+
+	if (pattern == 0)
+	{
+		winpr_RAND(image, 4ull * width * height);
+		return image;
+	}
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			BYTE* px = &image[4ull * (y * width + x)];
+			px[0] = (BYTE)(x * 7 + y);
+			px[1] = (BYTE)(255 - x * 3);
+			px[2] = (BYTE)((x ^ y) * 13);
+			px[3] = (BYTE)(y * 5);
+		}
+	}
+
+	return image;
+}
+
+static BOOL encode_decode(NSC_CONTEXT* encoder, NSC_CONTEXT* decoder, wStream* s,
+                          const BYTE* image, UINT32 format, UINT32 width, UINT32 height,
+                          BYTE* output)
+{
+	Stream_SetPosition(s, 0);
+
+	if (!nsc_context_set_parameters(encoder, NSC_COLOR_FORMAT, format))
+		return FALSE;
+
+	if (!nsc_compose_message(encoder, s, image, width, height, width * 4))
+		return FALSE;
+
+	/* The encoder stores the rows bottom up */
+	Stream_SealLength(s);
+	return nsc_process_message(decoder, 32, width, height, Stream_Buffer(s),
+	                           (UINT32)Stream_Length(s), output, PIXEL_FORMAT_BGRA32, width * 4, 0,
+	                           0, width, height, FREERDP_FLIP_VERTICAL);
+}
+
+/* The SIMD row kernels must produce exactly the planes of the generic encoder */
+static BOOL TestNscEncodeKernels(void)
+{
+	BOOL rc = FALSE;
+	size_t i, f;
+	UINT32 ccl, subsampling, pattern;
+	const UINT32 sizes[][2] = { { 1, 1 }, { 7, 3 }, { 8, 8 }, { 15, 9 }, { 16, 16 },
+		                        { 17, 5 }, { 33, 31 }, { 64, 64 }, { 129, 67 } };
+	NSC_CONTEXT* simd = nsc_context_new();
+	NSC_CONTEXT* generic = nsc_context_new();
+	NSC_CONTEXT* decoder = nsc_context_new();
+	wStream* s = Stream_New(NULL, 1024);
+
+	if (!simd || !generic || !decoder || !s)
+		goto fail;
+
+	generic->encodeRow = NULL;
+	generic->subsampleRow = NULL;
+
+	if (!simd->encodeRow)
+		printf("no SIMD NSC encoder kernels on this machine, comparing the generic encoder\n");
+
+	for (i = 0; i < ARRAYSIZE(sizes); i++)
+	{
+		const UINT32 width = sizes[i][0];
+		const UINT32 height = sizes[i][1];
+
+		for (pattern = 0; pattern < 2; pattern++)
+		{
+			BOOL same = TRUE;
+			BYTE* image = create_image(width, height, pattern);
+			BYTE* out1 = (BYTE*)calloc(height, 4ull * width);
+			BYTE* out2 = (BYTE*)calloc(height, 4ull * width);
+
+			for (f = 0; image && out1 && out2 && (f < ARRAYSIZE(nsc_formats)); f++)
+			{
+				for (ccl = 1; ccl <= 7; ccl += 2)
+				{
+					for (subsampling = 0; subsampling < 2; subsampling++)
+					{
+						nsc_context_set_parameters(simd, NSC_COLOR_LOSS_LEVEL, ccl);
+						nsc_context_set_parameters(generic, NSC_COLOR_LOSS_LEVEL, ccl);
+						nsc_context_set_parameters(simd, NSC_ALLOW_SUBSAMPLING, subsampling);
+						nsc_context_set_parameters(generic, NSC_ALLOW_SUBSAMPLING, subsampling);
+
+						if (!encode_decode(simd, decoder, s, image, nsc_formats[f], width, height,
+						                   out1) ||
+						    !encode_decode(generic, decoder, s, image, nsc_formats[f], width,
+						                   height, out2))
+						{
+							printf("nsc %" PRIu32 "x%" PRIu32 " encode/decode failed\n", width,
+							       height);
+							same = FALSE;
+						}
+						else if (memcmp(out1, out2, 4ull * width * height) != 0)
+						{
+							printf("nsc %" PRIu32 "x%" PRIu32 " %s ccl %" PRIu32
+							       " subsampling %" PRIu32 " pattern %" PRIu32 " mismatch\n",
+							       width, height, FreeRDPGetColorFormatName(nsc_formats[f]), ccl,
+							       subsampling, pattern);
+							same = FALSE;
+						}
+					}
+				}
+			}
+
+			if (!image || !out1 || !out2)
+				same = FALSE;
+
+			free(image);
+			free(out1);
+			free(out2);
+
+			if (!same)
+				goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	Stream_Free(s, TRUE);
+	nsc_context_free(simd);
+	nsc_context_free(generic);
+	nsc_context_free(decoder);
+	return rc;
+}
+
+/* Large bitmaps take the parallel RLE path, colour loss 1 keeps the result close */
+static BOOL TestNscLarge(void)
+{
+	BOOL rc = FALSE;
+	size_t i;
+	UINT64 start;
+	const UINT32 width = 512;
+	const UINT32 height = 384;
+	NSC_CONTEXT* encoder = nsc_context_new();
+	NSC_CONTEXT* decoder = nsc_context_new();
+	wStream* s = Stream_New(NULL, 1024);
+	BYTE* image = create_image(width, height, 1);
+	BYTE* output = (BYTE*)calloc(height, 4ull * width);
+
+	if (!encoder || !decoder || !s || !image || !output)
+		goto fail;
+
+	nsc_context_set_parameters(encoder, NSC_COLOR_LOSS_LEVEL, 1);
+	nsc_context_set_parameters(encoder, NSC_ALLOW_SUBSAMPLING, 0);
+	start = GetTickCount64();
+
+	if (!encode_decode(encoder, decoder, s, image, PIXEL_FORMAT_BGRX32, width, height, output))
+		goto fail;
+
+	printf("nsc %" PRIu32 "x%" PRIu32 " encode and decode: %" PRIu64 " ms, %" PRIuz " bytes\n",
+	       width, height, (UINT64)(GetTickCount64() - start), Stream_Length(s));
+
+	for (i = 0; i < 4ull * width * height; i++)
+	{
+		/* Alpha is not encoded for BGRX32 */
+		if ((i % 4) == 3)
+			continue;
+
+		if (abs((int)image[i] - (int)output[i]) > 2)
+		{
+			printf("nsc byte %" PRIuz " differs: %" PRIu8 " != %" PRIu8 "\n", i, image[i],
+			       output[i]);
+			goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(image);
+	free(output);
+	Stream_Free(s, TRUE);
+	nsc_context_free(encoder);
+	nsc_context_free(decoder);
+	return rc;
+}
+
+int TestFreeRDPCodecNsc(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!TestNscEncodeKernels())
+		return -1;
+
+	if (!TestNscLarge())
+		return -1;
+
+	return 0;
+}
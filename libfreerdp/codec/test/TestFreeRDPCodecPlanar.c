@@ -5651,6 +5651,222 @@ fail:
 	return rc;
 }
 
+/* Smooth gradients with noisy stripes, so both RLE runs and raw segments show up */
+static void FillTestImage(BYTE* data, UINT32 width, UINT32 height, UINT32 step)
+{
+	UINT32 x, y;
+	UINT32 seed = 7;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			BYTE* pixel = &data[y * step + x * 4];
+			seed = seed * 1103515245 + 12345;
+			pixel[0] = (BYTE)(x + y);
+			pixel[1] = ((y / 16) % 3 == 0) ? (BYTE)(seed >> 16) : (BYTE)(y * 2);
+			pixel[2] = (BYTE)(x / 8);
+			pixel[3] = 0xFF;
+		}
+	}
+}
+
+static BOOL CheckPlanarRoundTrip(BITMAP_PLANAR_CONTEXT* planar, const BYTE* compressed,
+                                 UINT32 compressedSize, const BYTE* src, UINT32 srcStep,
+                                 UINT32 width, UINT32 height)
+{
+	BOOL rc = FALSE;
+	UINT32 y;
+	BYTE* decompressed = (BYTE*)calloc(height, width * 4);
+
+	if (!decompressed)
+		return FALSE;
+
+	if (!planar_decompress(planar, compressed, compressedSize, width, height, decompressed,
+	                       PIXEL_FORMAT_BGRX32, width * 4, 0, 0, width, height, TRUE))
+		goto fail;
+
+	for (y = 0; y < height; y++)
+	{
+		if (memcmp(&decompressed[y * width * 4], &src[y * srcStep], width * 4) != 0)
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free(decompressed);
+	return rc;
+}
+
+static BOOL TestPlanarTiles(void)
+{
+	size_t i;
+	BOOL rc = FALSE;
+	const UINT32 width = 200;
+	const UINT32 height = 136;
+	const UINT32 step = width * 4;
+	const UINT32 cols = (width + 63) / 64;
+	const UINT32 rows = (height + 63) / 64;
+	const DWORD planarFlags = PLANAR_FORMAT_HEADER_NA | PLANAR_FORMAT_HEADER_RLE;
+	PLANAR_TILE tiles[16] = { 0 };
+	BYTE* image = (BYTE*)malloc(step * height);
+	BYTE* buffers = (BYTE*)calloc(cols * rows, 64 * 64 * 4);
+	BITMAP_PLANAR_CONTEXT* planar = freerdp_bitmap_planar_context_new(planarFlags, 64, 64);
+	BITMAP_PLANAR_CONTEXT* reference = freerdp_bitmap_planar_context_new(planarFlags, 64, 64);
+
+	printf("%s: ", __FUNCTION__);
+
+	if (!image || !buffers || !planar || !reference)
+		goto fail;
+
+	FillTestImage(image, width, height, step);
+
+	for (i = 0; i < cols * rows; i++)
+	{
+		const UINT32 x = (UINT32)(i % cols) * 64;
+		const UINT32 y = (UINT32)(i / cols) * 64;
+		tiles[i].data = &image[y * step + x * 4];
+		tiles[i].width = (width - x < 64) ? width - x : 64;
+		tiles[i].height = (height - y < 64) ? height - y : 64;
+		tiles[i].dstData = &buffers[i * 64 * 64 * 4];
+		tiles[i].dstSize = 64 * 64 * 4;
+	}
+
+	if (!freerdp_bitmap_planar_compress_tiles(planar, PIXEL_FORMAT_BGRX32, step, tiles,
+	                                          cols * rows))
+		goto fail;
+
+	/* Every tile must match the single bitmap encoder byte for byte */
+	for (i = 0; i < cols * rows; i++)
+	{
+		UINT32 size = 0;
+		BOOL same;
+		BYTE* expected =
+		    freerdp_bitmap_compress_planar(reference, tiles[i].data, PIXEL_FORMAT_BGRX32,
+		                                   tiles[i].width, tiles[i].height, step, NULL, &size);
+
+		same = expected && (size == tiles[i].dstSize) &&
+		       (memcmp(expected, tiles[i].dstData, size) == 0);
+		free(expected);
+
+		if (!same)
+		{
+			printf("tile %" PRIuz " differs from freerdp_bitmap_compress_planar\n", i);
+			goto fail;
+		}
+
+		if (!CheckPlanarRoundTrip(reference, tiles[i].dstData, tiles[i].dstSize, tiles[i].data,
+		                          step, tiles[i].width, tiles[i].height))
+		{
+			printf("tile %" PRIuz " round trip mismatch\n", i);
+			goto fail;
+		}
+	}
+
+	/* A tile that does not fit its buffer is an error */
+	tiles[0].dstSize = 16;
+
+	if (freerdp_bitmap_planar_compress_tiles(planar, PIXEL_FORMAT_BGRX32, step, tiles, 1))
+		goto fail;
+
+	printf("SUCCESS\n");
+	rc = TRUE;
+fail:
+	freerdp_bitmap_planar_context_free(planar);
+	freerdp_bitmap_planar_context_free(reference);
+	free(buffers);
+	free(image);
+	return rc;
+}
+
+/* Noise with alpha grows under RLE, the tile must still fit the documented upper bound */
+static BOOL TestPlanarIncompressible(void)
+{
+	UINT32 y;
+	BOOL rc = FALSE;
+	const UINT32 width = 64;
+	const UINT32 height = 64;
+	const UINT32 step = width * 4;
+	const UINT32 capacity = freerdp_bitmap_planar_max_size(width, height);
+	PLANAR_TILE tile = { 0 };
+	BYTE* image = (BYTE*)malloc(step * height);
+	BYTE* compressed = (BYTE*)malloc(capacity);
+	BYTE* decompressed = (BYTE*)calloc(height, step);
+	BITMAP_PLANAR_CONTEXT* planar =
+	    freerdp_bitmap_planar_context_new(PLANAR_FORMAT_HEADER_RLE, width, height);
+
+	printf("%s: ", __FUNCTION__);
+
+	if (!image || !compressed || !decompressed || !planar)
+		goto fail;
+
+	winpr_RAND(image, step * height);
+	tile.data = image;
+	tile.width = width;
+	tile.height = height;
+	tile.dstData = compressed;
+	tile.dstSize = capacity;
+
+	if (!freerdp_bitmap_planar_compress_tiles(planar, PIXEL_FORMAT_BGRA32, step, &tile, 1))
+		goto fail;
+
+	if ((tile.dstSize > capacity) || (compressed[0] & PLANAR_FORMAT_HEADER_RLE))
+		goto fail;
+
+	if (!planar_decompress(planar, compressed, tile.dstSize, width, height, decompressed,
+	                       PIXEL_FORMAT_BGRA32, step, 0, 0, width, height, TRUE))
+		goto fail;
+
+	for (y = 0; y < height; y++)
+	{
+		if (memcmp(&decompressed[y * step], &image[y * step], step) != 0)
+			goto fail;
+	}
+
+	printf("SUCCESS\n");
+	rc = TRUE;
+fail:
+	freerdp_bitmap_planar_context_free(planar);
+	free(decompressed);
+	free(compressed);
+	free(image);
+	return rc;
+}
+
+/* Large enough for the planes to be encoded in parallel */
+static BOOL TestPlanarLarge(void)
+{
+	BOOL rc = FALSE;
+	UINT32 size = 0;
+	const UINT32 width = 512;
+	const UINT32 height = 300;
+	BYTE* compressed = NULL;
+	BYTE* image = (BYTE*)malloc(width * height * 4);
+	BITMAP_PLANAR_CONTEXT* planar =
+	    freerdp_bitmap_planar_context_new(PLANAR_FORMAT_HEADER_RLE, width, height);
+
+	printf("%s: ", __FUNCTION__);
+
+	if (!image || !planar)
+		goto fail;
+
+	FillTestImage(image, width, height, width * 4);
+	compressed = freerdp_bitmap_compress_planar(planar, image, PIXEL_FORMAT_BGRA32, width, height,
+	                                            0, NULL, &size);
+
+	if (!compressed || !CheckPlanarRoundTrip(planar, compressed, size, image, width * 4, width,
+	                                         height))
+		goto fail;
+
+	printf("SUCCESS\n");
+	rc = TRUE;
+fail:
+	freerdp_bitmap_planar_context_free(planar);
+	free(compressed);
+	free(image);
+	return rc;
+}
+
 static UINT32 prand(UINT32 max)
 {
 	UINT32 tmp;
@@ -5779,5 +5995,14 @@ int TestFreeRDPCodecPlanar(int argc, char* argv[])
 			return -1;
 	}
 
+	if (!TestPlanarTiles())
+		return -1;
+
+	if (!TestPlanarLarge())
+		return -1;
+
+	if (!TestPlanarIncompressible())
+		return -1;
+
 	return 0;
 }
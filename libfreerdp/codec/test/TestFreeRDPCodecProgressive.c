@@ -1119,6 +1119,119 @@ fail:
 	return res;
 }
 
+static BOOL test_compare_image(const wImage* image, const BYTE* resultData, UINT32 ColorFormat,
+                               UINT64* error)
+{
+	int x, y;
+	BOOL rc = TRUE;
+
+	*error = 0;
+	for (y = 0; y < image->height; y++)
+	{
+		const BYTE* orig = &image->data[y * image->scanline];
+		const BYTE* dec = &resultData[y * image->scanline];
+		for (x = 0; x < image->width; x++)
+		{
+			BYTE ar, ag, ab, br, bg, bb;
+			const DWORD a = FreeRDPReadColor(&orig[x * 4], ColorFormat);
+			const DWORD b = FreeRDPReadColor(&dec[x * 4], ColorFormat);
+
+			FreeRDPSplitColor(a, ColorFormat, &ar, &ag, &ab, NULL, NULL);
+			FreeRDPSplitColor(b, ColorFormat, &br, &bg, &bb, NULL, NULL);
+			*error += abs(ar - br) + abs(ag - bg) + abs(ab - bb);
+
+			if (!colordiff(ColorFormat, a, b))
+				rc = FALSE;
+		}
+	}
+	return rc;
+}
+
+static BOOL test_encode_decode_upgrade(const char* path)
+{
+	int rc;
+	UINT32 pass;
+	BOOL res = FALSE;
+	BYTE* resultData = NULL;
+	BYTE* dstData = NULL;
+	UINT32 dstSize = 0;
+	UINT64 error = 0;
+	UINT64 lastError = 0;
+	UINT64 firstError = 0;
+	UINT32 ColorFormat = PIXEL_FORMAT_BGRX32;
+	REGION16 invalidRegion = { 0 };
+	const BYTE ladder[] = { 25, 50, 75, 100 };
+	wImage* image = winpr_image_new();
+	char* name = GetCombinedPath(path, "progressive.bmp");
+	PROGRESSIVE_CONTEXT* progressiveEnc = progressive_context_new(TRUE);
+	PROGRESSIVE_CONTEXT* progressiveDec = progressive_context_new(FALSE);
+
+	region16_init(&invalidRegion);
+	if (!image || !name || !progressiveEnc || !progressiveDec)
+		goto fail;
+
+	rc = winpr_image_read(image, name);
+	if (rc <= 0)
+		goto fail;
+
+	resultData = calloc(image->scanline, image->height);
+	if (!resultData)
+		goto fail;
+
+	if (!progressive_set_quality_ladder(progressiveEnc, ladder, ARRAYSIZE(ladder)))
+		goto fail;
+
+	if ((progressive_create_surface_context(progressiveEnc, 0, image->width, image->height) <= 0) ||
+	    (progressive_create_surface_context(progressiveDec, 0, image->width, image->height) <= 0))
+		goto fail;
+
+	// First pass, coarse quality
+	rc = progressive_compress_surface(progressiveEnc, 0, image->data,
+	                                  image->scanline * image->height, ColorFormat, image->width,
+	                                  image->height, image->scanline, NULL, &dstData, &dstSize);
+	if (rc <= 0)
+		goto fail;
+
+	for (pass = 0; rc > 0; pass++)
+	{
+		rc = progressive_decompress(progressiveDec, dstData, dstSize, resultData, ColorFormat,
+		                            image->scanline, 0, 0, &invalidRegion, 0, pass);
+		if (rc < 0)
+			goto fail;
+
+		test_compare_image(image, resultData, ColorFormat, &error);
+		printf("pass %" PRIu32 ": %" PRIu32 " bytes, error %" PRIu64 "\n", pass, dstSize, error);
+
+		if (pass == 0)
+			firstError = error;
+		else if (error > lastError)
+			goto fail;
+		lastError = error;
+
+		// Refine while the image is static
+		rc = progressive_compress_upgrade(progressiveEnc, 0, &dstData, &dstSize);
+		if (rc < 0)
+			goto fail;
+	}
+
+	if ((pass != ARRAYSIZE(ladder)) || (lastError >= firstError))
+		goto fail;
+
+	// The final pass must be as good as a simple (full quality) encode
+	if (!test_compare_image(image, resultData, ColorFormat, &error))
+		goto fail;
+
+	res = TRUE;
+fail:
+	region16_uninit(&invalidRegion);
+	progressive_context_free(progressiveEnc);
+	progressive_context_free(progressiveDec);
+	winpr_image_free(image, TRUE);
+	free(resultData);
+	free(name);
+	return res;
+}
+
 int TestFreeRDPCodecProgressive(int argc, char* argv[])
 {
 	int rc = -1;
@@ -1150,6 +1263,8 @@ int TestFreeRDPCodecProgressive(int argc, char* argv[])
 		    */
 		if (!test_encode_decode(ms_sample_path))
 			goto fail;
+		if (!test_encode_decode_upgrade(ms_sample_path))
+			goto fail;
 		rc = 0;
 	}
 
@@ -843,6 +843,69 @@ static BOOL fuzzyCompareImage(const UINT32* crefImage, const BYTE* img, size_t n
 	return TRUE;
 }
 
+/* Frame data replayed on another encoder must carry the frame index of that encoder */
+static BOOL test_encoded_message(void)
+{
+	BOOL rc = FALSE;
+	size_t x;
+	size_t start;
+	size_t length;
+	UINT32 frameIdx;
+	const RFX_RECT rect = { 0, 0, 64, 64 };
+	BYTE* data = NULL;
+	wStream* sa = NULL;
+	wStream* sb = NULL;
+	RFX_CONTEXT* a = rfx_context_new(TRUE);
+	RFX_CONTEXT* b = rfx_context_new(TRUE);
+
+	data = malloc(64 * 64 * 4);
+	sa = Stream_New(NULL, 1024);
+	sb = Stream_New(NULL, 1024);
+
+	if (!a || !b || !data || !sa || !sb || !rfx_context_reset(a, 64, 64) ||
+	    !rfx_context_reset(b, 64, 64))
+		goto fail;
+
+	for (x = 0; x < 64 * 64 * 4; x++)
+		data[x] = (BYTE)(x * 7);
+
+	/* a encodes its first frame, b has already sent one */
+	if (!rfx_write_message_header(a, sa))
+		goto fail;
+
+	start = Stream_GetPosition(sa);
+
+	if (!rfx_compose_message(a, sa, &rect, 1, data, 64, 64, 64 * 4) ||
+	    !rfx_compose_message(b, sb, &rect, 1, data, 64, 64, 64 * 4))
+		goto fail;
+
+	length = Stream_GetPosition(sa) - start;
+	Stream_SetPosition(sb, 0);
+
+	if (rfx_write_encoded_message(b, sb, Stream_Buffer(sa) + start + 1, length - 1) ||
+	    !rfx_write_encoded_message(b, sb, Stream_Buffer(sa) + start, length))
+		goto fail;
+
+	if ((Stream_GetPosition(sb) != length) || (b->frameIdx != 2))
+		goto fail;
+
+	Stream_SetPosition(sb, 8);
+	Stream_Read_UINT32(sb, frameIdx);
+
+	if ((frameIdx != 1) || (memcmp(Stream_Buffer(sb), Stream_Buffer(sa) + start, 8) != 0) ||
+	    (memcmp(Stream_Buffer(sb) + 12, Stream_Buffer(sa) + start + 12, length - 12) != 0))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	Stream_Free(sa, TRUE);
+	Stream_Free(sb, TRUE);
+	free(data);
+	rfx_context_free(a);
+	rfx_context_free(b);
+	return rc;
+}
+
 int TestFreeRDPCodecRemoteFX(int argc, char* argv[])
 {
 	int rc = -1;
@@ -884,6 +947,9 @@ int TestFreeRDPCodecRemoteFX(int argc, char* argv[])
 	if (!fuzzyCompareImage(srefImage, dest, IMG_WIDTH * IMG_HEIGHT))
 		goto fail;
 
+	if (!test_encoded_message())
+		goto fail;
+
 	rc = 0;
 fail:
 	region16_uninit(&region);
@@ -1,6 +1,7 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
 #include <winpr/bitstream.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/zgfx.h>
@@ -253,6 +254,225 @@ fail:
 	return rc;
 }
 
+static BOOL test_ZGfxRoundTrip(ZGFX_CONTEXT* compressor, ZGFX_CONTEXT* decompressor,
+                               const BYTE* pSrcData, UINT32 SrcSize, UINT32* pCompressedSize)
+{
+	BOOL rc = FALSE;
+	UINT32 Flags = 0;
+	UINT32 DstSize = 0;
+	UINT32 CompressedSize = 0;
+	BYTE* pDstData = NULL;
+	BYTE* pCompressedData = NULL;
+
+	if (zgfx_compress(compressor, pSrcData, SrcSize, &pCompressedData, &CompressedSize, &Flags) <
+	    0)
+		goto fail;
+
+	if (zgfx_decompress(decompressor, pCompressedData, CompressedSize, &pDstData, &DstSize,
+	                    Flags) < 0)
+		goto fail;
+
+	if ((DstSize != SrcSize) || (memcmp(pDstData, pSrcData, SrcSize) != 0))
+	{
+		printf("test_ZGfxRoundTrip: output mismatch (%" PRIu32 " of %" PRIu32 " bytes)\n",
+		       DstSize, SrcSize);
+		goto fail;
+	}
+
+	*pCompressedSize = CompressedSize;
+	rc = TRUE;
+fail:
+	free(pDstData);
+	free(pCompressedData);
+	return rc;
+}
+
+static int test_ZGfxCompressLevels(void)
+{
+	int rc = -1;
+	size_t index;
+	UINT32 seed = 1;
+	UINT32 previous = 0;
+	const UINT32 SrcSize = 200000;
+	const UINT32 levels[] = { ZGFX_LEVEL_NONE, ZGFX_LEVEL_FAST, ZGFX_LEVEL_DEFAULT,
+		                      ZGFX_LEVEL_BEST };
+	BYTE* pSrcData = (BYTE*)malloc(SrcSize);
+
+	if (!pSrcData)
+		return -1;
+
+	/* Repetitive text with some noise spans several segments */
+	for (index = 0; index < SrcSize; index++)
+	{
+		seed = seed * 1103515245 + 12345;
+
+		if ((seed >> 16) % 16 == 0)
+			pSrcData[index] = (BYTE)(seed >> 24);
+		else
+			pSrcData[index] = TEST_FOX_DATA[(index + index / 512) % (sizeof(TEST_FOX_DATA) - 1)];
+	}
+
+	for (index = 0; index < ARRAYSIZE(levels); index++)
+	{
+		UINT32 first = 0;
+		UINT32 second = 0;
+		ZGFX_CONTEXT* compressor = zgfx_context_new(TRUE);
+		ZGFX_CONTEXT* decompressor = zgfx_context_new(FALSE);
+		BOOL success = compressor && decompressor &&
+		               zgfx_context_set_level(compressor, levels[index]) &&
+		               test_ZGfxRoundTrip(compressor, decompressor, pSrcData, SrcSize, &first) &&
+		               test_ZGfxRoundTrip(compressor, decompressor, pSrcData, SrcSize, &second);
+		zgfx_context_free(compressor);
+		zgfx_context_free(decompressor);
+
+		if (!success)
+		{
+			printf("test_ZGfxCompressLevels: level %" PRIu32 " failed\n", levels[index]);
+			goto fail;
+		}
+
+		printf("level %" PRIu32 ": %" PRIu32 " -> %" PRIu32 ", repeated %" PRIu32 "\n",
+		       levels[index], SrcSize, first, second);
+
+		/* Higher levels must not do worse and the history must pay off on repeated data */
+		if ((index > 0) && ((first > previous) || (second >= first)))
+		{
+			printf("test_ZGfxCompressLevels: level %" PRIu32 " did not compress\n",
+			       levels[index]);
+			goto fail;
+		}
+
+		previous = first;
+	}
+
+	rc = 0;
+fail:
+	free(pSrcData);
+	return rc;
+}
+
+/* The match finder of a compressor is allocated when it first compresses above level 0 */
+static int test_ZGfxCompressLevelSwitch(void)
+{
+	int rc = -1;
+	size_t index;
+	UINT32 stored = 0;
+	UINT32 first = 0;
+	UINT32 second = 0;
+	const UINT32 SrcSize = 100000;
+	BYTE* pSrcData = (BYTE*)malloc(SrcSize);
+	ZGFX_CONTEXT* compressor = zgfx_context_new(TRUE);
+	ZGFX_CONTEXT* decompressor = zgfx_context_new(FALSE);
+
+	if (!pSrcData || !compressor || !decompressor)
+		goto fail;
+
+	for (index = 0; index < SrcSize; index++)
+		pSrcData[index] = TEST_FOX_DATA[(index + index / 512) % (sizeof(TEST_FOX_DATA) - 1)];
+
+	if (!zgfx_context_set_level(compressor, ZGFX_LEVEL_NONE) ||
+	    !test_ZGfxRoundTrip(compressor, decompressor, pSrcData, SrcSize, &stored) ||
+	    !zgfx_context_set_level(compressor, ZGFX_LEVEL_DEFAULT) ||
+	    !test_ZGfxRoundTrip(compressor, decompressor, pSrcData, SrcSize, &first) ||
+	    !test_ZGfxRoundTrip(compressor, decompressor, pSrcData, SrcSize, &second))
+		goto fail;
+
+	if ((stored <= SrcSize) || (first >= SrcSize / 4) || (second >= first))
+	{
+		printf("test_ZGfxCompressLevelSwitch: %" PRIu32 " -> %" PRIu32 ", %" PRIu32
+		       ", %" PRIu32 "\n",
+		       SrcSize, stored, first, second);
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	zgfx_context_free(compressor);
+	zgfx_context_free(decompressor);
+	free(pSrcData);
+	return rc;
+}
+
+#define TEST_THROUGHPUT_SIZE (1024 * 1024)
+#define TEST_THROUGHPUT_PASSES 20
+
+/* Decodes fox sample based data compressed at the default level over and over and
+ * reports the decoder throughput. */
+static int test_ZGfxDecompressThroughput(void)
+{
+	int rc = -1;
+	size_t index;
+	UINT32 seed = 1;
+	UINT32 Flags = 0;
+	UINT64 start;
+	UINT64 duration;
+	UINT32 CompressedSize = 0;
+	BYTE* pCompressedData = NULL;
+	BYTE* pSrcData = (BYTE*)malloc(TEST_THROUGHPUT_SIZE);
+	ZGFX_CONTEXT* zgfx = zgfx_context_new(TRUE);
+
+	if (!pSrcData || !zgfx)
+		goto fail;
+
+	for (index = 0; index < TEST_THROUGHPUT_SIZE; index++)
+	{
+		seed = seed * 1103515245 + 12345;
+
+		if ((seed >> 16) % 32 == 0)
+			pSrcData[index] = (BYTE)(seed >> 24);
+		else
+			pSrcData[index] = TEST_FOX_DATA[index % (sizeof(TEST_FOX_DATA) - 1)];
+	}
+
+	if (zgfx_compress(zgfx, pSrcData, TEST_THROUGHPUT_SIZE, &pCompressedData, &CompressedSize,
+	                  &Flags) < 0)
+		goto fail;
+
+	zgfx_context_free(zgfx);
+	zgfx = NULL;
+	start = GetTickCount64();
+
+	for (index = 0; index < TEST_THROUGHPUT_PASSES; index++)
+	{
+		BYTE* pDstData = NULL;
+		UINT32 DstSize = 0;
+		BOOL match;
+
+		if (!(zgfx = zgfx_context_new(FALSE)))
+			goto fail;
+
+		if (zgfx_decompress(zgfx, pCompressedData, CompressedSize, &pDstData, &DstSize, Flags) < 0)
+			goto fail;
+
+		match = (DstSize == TEST_THROUGHPUT_SIZE) && (memcmp(pDstData, pSrcData, DstSize) == 0);
+		free(pDstData);
+		zgfx_context_free(zgfx);
+		zgfx = NULL;
+
+		if (!match)
+		{
+			printf("test_ZGfxDecompressThroughput: output mismatch\n");
+			goto fail;
+		}
+	}
+
+	duration = GetTickCount64() - start;
+
+	if (duration == 0)
+		duration = 1;
+
+	printf("test_ZGfxDecompressThroughput: %" PRIu32 " -> %d bytes, %d passes in %" PRIu64
+	       "ms (%" PRIu64 " MB/s)\n",
+	       CompressedSize, TEST_THROUGHPUT_SIZE, TEST_THROUGHPUT_PASSES, duration,
+	       (UINT64)TEST_THROUGHPUT_SIZE * TEST_THROUGHPUT_PASSES * 1000 / duration / 1000000);
+	rc = 0;
+fail:
+	free(pCompressedData);
+	free(pSrcData);
+	zgfx_context_free(zgfx);
+	return rc;
+}
+
 int TestFreeRDPCodecZGfx(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -270,5 +490,14 @@ int TestFreeRDPCodecZGfx(int argc, char* argv[])
 	if (test_ZGfxCompressConsistent() < 0)
 		return -1;
 
+	if (test_ZGfxCompressLevels() < 0)
+		return -1;
+
+	if (test_ZGfxCompressLevelSwitch() < 0)
+		return -1;
+
+	if (test_ZGfxDecompressThroughput() < 0)
+		return -1;
+
 	return 0;
 }
@@ -40,6 +40,63 @@
  * Minimum match length: 3 bytes
  */
 
+#define ZGFX_MAX_DISTANCE 2500000
+#define ZGFX_MIN_MATCH 3
+
+/* The encoder window is a power of two ring large enough to hold the whole
+ * match distance plus one segment, so positions map to it with a mask. */
+#define ZGFX_WINDOW_BITS 22
+#define ZGFX_WINDOW_SIZE (1u << ZGFX_WINDOW_BITS)
+#define ZGFX_WINDOW_MASK (ZGFX_WINDOW_SIZE - 1)
+#define ZGFX_HASH_BITS 16
+#define ZGFX_HASH_SIZE (1u << ZGFX_HASH_BITS)
+/* Hash heads reach back over the whole window, chains only over the last 64K positions */
+#define ZGFX_PREV_BITS 16
+#define ZGFX_PREV_SIZE (1u << ZGFX_PREV_BITS)
+#define ZGFX_PREV_MASK (ZGFX_PREV_SIZE - 1)
+
+typedef struct
+{
+	UINT32 maxChain;
+	UINT32 niceLength;
+	BOOL lazy;
+	BOOL insertAll;
+} ZGFX_LEVEL_PARAMS;
+
+static const ZGFX_LEVEL_PARAMS ZGFX_LEVELS[] = {
+	{ 0, 0, FALSE, FALSE },       /* 0: store only */
+	{ 4, 16, FALSE, FALSE },      /* 1 */
+	{ 8, 32, FALSE, TRUE },       /* 2 */
+	{ 16, 64, FALSE, TRUE },      /* 3 */
+	{ 16, 64, TRUE, TRUE },       /* 4 */
+	{ 32, 128, TRUE, TRUE },      /* 5 */
+	{ 64, 256, TRUE, TRUE },      /* 6 */
+	{ 128, 1024, TRUE, TRUE },    /* 7 */
+	{ 512, 4096, TRUE, TRUE },    /* 8 */
+	{ 2048, 65535, TRUE, TRUE }   /* 9 */
+};
+
+typedef struct
+{
+	wStream* s;
+	UINT64 bits;
+	UINT32 count;
+	size_t written;
+	size_t limit;
+} ZGFX_BIT_WRITER;
+
+typedef struct
+{
+	const BYTE* next;
+	const BYTE* end;
+	UINT64 bits; /* next bits to decode, most significant bit first */
+	UINT32 count;
+	size_t position; /* bits consumed in the segment */
+} ZGFX_BIT_READER;
+
+/* The longest token prefix, a lookup of this many bits always resolves a token */
+#define ZGFX_TOKEN_LOOKUP_BITS 9
+
 typedef struct
 {
 	UINT32 prefixLength;
@@ -53,13 +110,7 @@ struct S_ZGFX_CONTEXT
 {
 	BOOL Compressor;
 
-	const BYTE* pbInputCurrent;
-	const BYTE* pbInputEnd;
-
-	UINT32 bits;
-	UINT32 cBitsRemaining;
-	UINT32 BitsCurrent;
-	UINT32 cBitsCurrent;
+	BYTE TokenLookup[1 << ZGFX_TOKEN_LOOKUP_BITS];
 
 	BYTE OutputBuffer[65536];
 	UINT32 OutputCount;
@@ -67,6 +118,15 @@ struct S_ZGFX_CONTEXT
 	BYTE HistoryBuffer[2500000];
 	UINT32 HistoryIndex;
 	UINT32 HistoryBufferSize;
+
+	UINT32 Level;
+	BYTE* Window;
+	UINT32* Head;
+	UINT32* Prev;
+	UINT32 Position;
+	UINT32 WindowStart;
+	UINT32 LiteralCode[256];
+	BYTE LiteralBits[256];
 };
 
 static const ZGFX_TOKEN ZGFX_TOKEN_TABLE[] = {
@@ -114,28 +174,6 @@ static const ZGFX_TOKEN ZGFX_TOKEN_TABLE[] = {
 	{ 0 }
 };
 
-static INLINE BOOL zgfx_GetBits(ZGFX_CONTEXT* zgfx, UINT32 nbits)
-{
-	if (!zgfx)
-		return FALSE;
-
-	while (zgfx->cBitsCurrent < nbits)
-	{
-		zgfx->BitsCurrent <<= 8;
-
-		if (zgfx->pbInputCurrent < zgfx->pbInputEnd)
-			zgfx->BitsCurrent += *(zgfx->pbInputCurrent)++;
-
-		zgfx->cBitsCurrent += 8;
-	}
-
-	zgfx->cBitsRemaining -= nbits;
-	zgfx->cBitsCurrent -= nbits;
-	zgfx->bits = zgfx->BitsCurrent >> zgfx->cBitsCurrent;
-	zgfx->BitsCurrent &= ((1 << zgfx->cBitsCurrent) - 1);
-	return TRUE;
-}
-
 static void zgfx_history_buffer_ring_write(ZGFX_CONTEXT* zgfx, const BYTE* src, size_t count)
 {
 	UINT32 front;
@@ -167,65 +205,128 @@ static void zgfx_history_buffer_ring_write(ZGFX_CONTEXT* zgfx, const BYTE* src,
 	}
 }
 
-static void zgfx_history_buffer_ring_read(ZGFX_CONTEXT* zgfx, int offset, BYTE* dst, UINT32 count)
+static INLINE void zgfx_reader_fill(ZGFX_BIT_READER* br)
 {
-	UINT32 front;
-	UINT32 index;
-	INT32 bytes;
-	UINT32 valid;
-	INT32 bytesLeft;
-	BYTE* dptr = dst;
-	BYTE* origDst = dst;
-
-	if ((count <= 0) || (count > INT32_MAX))
-		return;
+	/* Past the end the stream reads as zero bits, the bit count bounds the decode */
+	while (br->count <= 56)
+	{
+		const UINT64 value = (br->next < br->end) ? *br->next++ : 0;
+		br->bits |= value << (56 - br->count);
+		br->count += 8;
+	}
+}
 
-	bytesLeft = (INT32)count;
-	index = (zgfx->HistoryIndex + zgfx->HistoryBufferSize - offset) % zgfx->HistoryBufferSize;
-	bytes = MIN(bytesLeft, offset);
+static INLINE UINT32 zgfx_reader_peek(const ZGFX_BIT_READER* br, UINT32 nbits)
+{
+	return (UINT32)(br->bits >> (64 - nbits));
+}
 
-	if ((index + bytes) <= zgfx->HistoryBufferSize)
+static INLINE void zgfx_reader_skip(ZGFX_BIT_READER* br, UINT32 nbits)
+{
+	br->bits <<= nbits;
+	br->count -= nbits;
+	br->position += nbits;
+}
+
+static INLINE UINT32 zgfx_reader_read(ZGFX_BIT_READER* br, UINT32 nbits)
+{
+	UINT32 value = 0;
+
+	if (nbits)
 	{
-		CopyMemory(dptr, &(zgfx->HistoryBuffer[index]), bytes);
+		value = zgfx_reader_peek(br, nbits);
+		zgfx_reader_skip(br, nbits);
 	}
-	else
+
+	return value;
+}
+
+static void zgfx_init_token_lookup(ZGFX_CONTEXT* zgfx)
+{
+	size_t i;
+	size_t code;
+
+	/* Every 9 bit prefix maps to exactly one token, shorter codes fill all their suffixes */
+	for (i = 0; ZGFX_TOKEN_TABLE[i].prefixLength != 0; i++)
 	{
-		front = zgfx->HistoryBufferSize - index;
-		CopyMemory(dptr, &(zgfx->HistoryBuffer[index]), front);
-		CopyMemory(&dptr[front], zgfx->HistoryBuffer, bytes - front);
+		const ZGFX_TOKEN* token = &ZGFX_TOKEN_TABLE[i];
+		const UINT32 shift = ZGFX_TOKEN_LOOKUP_BITS - token->prefixLength;
+		const size_t first = (size_t)token->prefixCode << shift;
+
+		for (code = first; code < first + (1ull << shift); code++)
+			zgfx->TokenLookup[code] = (BYTE)i;
 	}
+}
+
+static INLINE void zgfx_copy_overlap(BYTE* dst, UINT32 distance, UINT32 count)
+{
+	const BYTE* src = dst - distance;
 
-	if ((bytesLeft -= bytes) == 0)
+	if (distance >= count)
+	{
+		CopyMemory(dst, src, count);
 		return;
+	}
+
+	/* The bytes written so far repeat with the match period, so every pass can copy
+	 * twice as much as the one before. */
+	while (count > 0)
+	{
+		const UINT32 valid = (UINT32)(dst - src);
+		const UINT32 bytes = (count < valid) ? count : valid;
+		CopyMemory(dst, src, bytes);
+		dst += bytes;
+		count -= bytes;
+	}
+}
+
+static BOOL zgfx_copy_match(ZGFX_CONTEXT* zgfx, UINT32 distance, UINT32 count)
+{
+	BYTE* dst = &zgfx->OutputBuffer[zgfx->OutputCount];
 
-	dptr += bytes;
-	valid = bytes;
+	if (count > sizeof(zgfx->OutputBuffer) - zgfx->OutputCount)
+		return FALSE;
 
-	do
+	/* The current segment only enters the history ring once it is complete, so matches
+	 * reaching back before it read the ring and the rest comes from OutputBuffer. */
+	if (distance > zgfx->OutputCount)
 	{
-		bytes = valid;
+		const UINT32 back = distance - zgfx->OutputCount;
+		const UINT32 bytes = (count < back) ? count : back;
+		UINT32 index;
+		UINT32 front;
+
+		if (back > zgfx->HistoryBufferSize)
+			return FALSE;
+
+		index = (zgfx->HistoryIndex + zgfx->HistoryBufferSize - back) % zgfx->HistoryBufferSize;
+		front = zgfx->HistoryBufferSize - index;
+
+		if (bytes <= front)
+			CopyMemory(dst, &zgfx->HistoryBuffer[index], bytes);
+		else
+		{
+			CopyMemory(dst, &zgfx->HistoryBuffer[index], front);
+			CopyMemory(&dst[front], zgfx->HistoryBuffer, bytes - front);
+		}
 
-		if (bytes > bytesLeft)
-			bytes = bytesLeft;
+		if (count > bytes)
+			zgfx_copy_overlap(&dst[bytes], distance, count - bytes);
+	}
+	else
+		zgfx_copy_overlap(dst, distance, count);
 
-		CopyMemory(dptr, origDst, bytes);
-		dptr += bytes;
-		valid <<= 1;
-	} while ((bytesLeft -= bytes) > 0);
+	zgfx->OutputCount += count;
+	return TRUE;
 }
 
 static BOOL zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, wStream* stream, size_t segmentSize)
 {
-	BYTE c;
 	BYTE flags;
-	UINT32 extra = 0;
-	int opIndex;
-	UINT32 haveBits;
-	UINT32 inPrefix;
-	UINT32 count;
-	UINT32 distance;
+	size_t totalBits;
 	BYTE* pbSegment;
 	size_t cbSegment;
+	ZGFX_BIT_READER br = { 0 };
 
 	if (!zgfx || !stream)
 		return FALSE;
@@ -253,110 +354,85 @@ static BOOL zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, wStream* stream, size_t
 		return TRUE;
 	}
 
-	zgfx->pbInputCurrent = pbSegment;
-	zgfx->pbInputEnd = &pbSegment[cbSegment - 1];
+	if (cbSegment < 1)
+		return FALSE;
+
+	br.next = pbSegment;
+	br.end = &pbSegment[cbSegment - 1];
 	/* NumberOfBitsToDecode = ((NumberOfBytesToDecode - 1) * 8) - ValueOfLastByte */
-	zgfx->cBitsRemaining = 8 * (cbSegment - 1) - *zgfx->pbInputEnd;
-	zgfx->cBitsCurrent = 0;
-	zgfx->BitsCurrent = 0;
+	totalBits = 8 * (cbSegment - 1);
+
+	if (*br.end > totalBits)
+		return FALSE;
+
+	totalBits -= *br.end;
 
-	while (zgfx->cBitsRemaining)
+	while (br.position < totalBits)
 	{
-		haveBits = 0;
-		inPrefix = 0;
+		const ZGFX_TOKEN* token;
+		UINT32 value;
 
-		for (opIndex = 0; ZGFX_TOKEN_TABLE[opIndex].prefixLength != 0; opIndex++)
+		zgfx_reader_fill(&br);
+		token = &ZGFX_TOKEN_TABLE[zgfx->TokenLookup[zgfx_reader_peek(&br, ZGFX_TOKEN_LOOKUP_BITS)]];
+		zgfx_reader_skip(&br, token->prefixLength);
+		value = token->valueBase + zgfx_reader_read(&br, token->valueBits);
+
+		if (token->tokenType == 0)
 		{
-			while (haveBits < ZGFX_TOKEN_TABLE[opIndex].prefixLength)
-			{
-				zgfx_GetBits(zgfx, 1);
-				inPrefix = (inPrefix << 1) + zgfx->bits;
-				haveBits++;
-			}
+			/* Literal */
+			if (zgfx->OutputCount >= sizeof(zgfx->OutputBuffer))
+				return FALSE;
 
-			if (inPrefix == ZGFX_TOKEN_TABLE[opIndex].prefixCode)
-			{
-				if (ZGFX_TOKEN_TABLE[opIndex].tokenType == 0)
-				{
-					/* Literal */
-					zgfx_GetBits(zgfx, ZGFX_TOKEN_TABLE[opIndex].valueBits);
-					c = (BYTE)(ZGFX_TOKEN_TABLE[opIndex].valueBase + zgfx->bits);
-					zgfx->HistoryBuffer[zgfx->HistoryIndex] = c;
+			zgfx->OutputBuffer[zgfx->OutputCount++] = (BYTE)value;
+		}
+		else if (value != 0)
+		{
+			/* Match */
+			UINT32 count = 3;
 
-					if (++zgfx->HistoryIndex == zgfx->HistoryBufferSize)
-						zgfx->HistoryIndex = 0;
+			zgfx_reader_fill(&br);
 
-					if (zgfx->OutputCount >= sizeof(zgfx->OutputBuffer))
-						return FALSE;
+			if (zgfx_reader_read(&br, 1))
+			{
+				UINT32 extra = 2;
 
-					zgfx->OutputBuffer[zgfx->OutputCount++] = c;
-				}
-				else
+				while (zgfx_reader_read(&br, 1))
 				{
-					zgfx_GetBits(zgfx, ZGFX_TOKEN_TABLE[opIndex].valueBits);
-					distance = ZGFX_TOKEN_TABLE[opIndex].valueBase + zgfx->bits;
-
-					if (distance != 0)
-					{
-						/* Match */
-						zgfx_GetBits(zgfx, 1);
-
-						if (zgfx->bits == 0)
-						{
-							count = 3;
-						}
-						else
-						{
-							count = 4;
-							extra = 2;
-							zgfx_GetBits(zgfx, 1);
-
-							while (zgfx->bits == 1)
-							{
-								count *= 2;
-								extra++;
-								zgfx_GetBits(zgfx, 1);
-							}
-
-							zgfx_GetBits(zgfx, extra);
-							count += zgfx->bits;
-						}
-
-						if (count > sizeof(zgfx->OutputBuffer) - zgfx->OutputCount)
-							return FALSE;
-
-						zgfx_history_buffer_ring_read(
-						    zgfx, distance, &(zgfx->OutputBuffer[zgfx->OutputCount]), count);
-						zgfx_history_buffer_ring_write(
-						    zgfx, &(zgfx->OutputBuffer[zgfx->OutputCount]), count);
-						zgfx->OutputCount += count;
-					}
-					else
-					{
-						/* Unencoded */
-						zgfx_GetBits(zgfx, 15);
-						count = zgfx->bits;
-						zgfx->cBitsRemaining -= zgfx->cBitsCurrent;
-						zgfx->cBitsCurrent = 0;
-						zgfx->BitsCurrent = 0;
-
-						if (count > sizeof(zgfx->OutputBuffer) - zgfx->OutputCount)
-							return FALSE;
-
-						CopyMemory(&(zgfx->OutputBuffer[zgfx->OutputCount]), zgfx->pbInputCurrent,
-						           count);
-						zgfx_history_buffer_ring_write(zgfx, zgfx->pbInputCurrent, count);
-						zgfx->pbInputCurrent += count;
-						zgfx->cBitsRemaining -= (8 * count);
-						zgfx->OutputCount += count;
-					}
+					if (++extra > 16)
+						return FALSE;
 				}
 
-				break;
+				count = (1u << extra) + zgfx_reader_read(&br, extra);
 			}
+
+			if (!zgfx_copy_match(zgfx, value, count))
+				return FALSE;
+		}
+		else
+		{
+			/* Unencoded, the bytes start at the next byte boundary */
+			const BYTE* pbRaw;
+			const UINT32 count = zgfx_reader_read(&br, 15);
+
+			pbRaw = &pbSegment[(br.position + 7) / 8];
+
+			if ((count > (size_t)(br.end - pbRaw)) ||
+			    (count > sizeof(zgfx->OutputBuffer) - zgfx->OutputCount))
+				return FALSE;
+
+			CopyMemory(&(zgfx->OutputBuffer[zgfx->OutputCount]), pbRaw, count);
+			zgfx->OutputCount += count;
+			br.next = &pbRaw[count];
+			br.position = 8 * (size_t)(br.next - pbSegment);
+			br.bits = 0;
+			br.count = 0;
 		}
 	}
 
+	if (br.position != totalBits)
+		return FALSE;
+
+	zgfx_history_buffer_ring_write(zgfx, zgfx->OutputBuffer, zgfx->OutputCount);
 	return TRUE;
 }
 
@@ -371,6 +447,33 @@ static BYTE* aligned_zgfx_malloc(size_t size)
 	return malloc(size + 64);
 }
 
+static BOOL zgfx_copy_output(ZGFX_CONTEXT* zgfx, BYTE** ppDstData, UINT32* pDstSize)
+{
+	*ppDstData = NULL;
+
+	if (zgfx->OutputCount > 0)
+		*ppDstData = aligned_zgfx_malloc(zgfx->OutputCount);
+
+	if (!*ppDstData)
+		return FALSE;
+
+	*pDstSize = zgfx->OutputCount;
+	CopyMemory(*ppDstData, zgfx->OutputBuffer, zgfx->OutputCount);
+	return TRUE;
+}
+
+int zgfx_decompress_bulk(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize,
+                         BYTE** ppDstData, UINT32* pDstSize)
+{
+	wStream sbuffer = { 0 };
+	wStream* stream = Stream_StaticConstInit(&sbuffer, pSrcData, SrcSize);
+
+	if (!stream || !zgfx_decompress_segment(zgfx, stream, SrcSize))
+		return -1;
+
+	return zgfx_copy_output(zgfx, ppDstData, pDstSize) ? 1 : -1;
+}
+
 int zgfx_decompress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData,
                     UINT32* pDstSize, UINT32 flags)
 {
@@ -392,16 +495,8 @@ int zgfx_decompress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BY
 		if (!zgfx_decompress_segment(zgfx, stream, Stream_GetRemainingLength(stream)))
 			goto fail;
 
-		*ppDstData = NULL;
-
-		if (zgfx->OutputCount > 0)
-			*ppDstData = aligned_zgfx_malloc(zgfx->OutputCount);
-
-		if (!*ppDstData)
+		if (!zgfx_copy_output(zgfx, ppDstData, pDstSize))
 			goto fail;
-
-		*pDstSize = zgfx->OutputCount;
-		CopyMemory(*ppDstData, zgfx->OutputBuffer, zgfx->OutputCount);
 	}
 	else if (descriptor == ZGFX_SEGMENTED_MULTIPART)
 	{
@@ -460,19 +555,323 @@ fail:
 	return status;
 }
 
+/* Indices of the match distance tokens in ZGFX_TOKEN_TABLE, ascending by valueBase. */
+static const BYTE ZGFX_DISTANCE_TOKENS[] = { 1, 2, 3, 4, 5, 8, 9, 13, 14, 31, 32 };
+
+static void zgfx_init_literal_codes(ZGFX_CONTEXT* zgfx)
+{
+	size_t i;
+
+	/* Prefix 0 followed by the byte value */
+	for (i = 0; i < ARRAYSIZE(zgfx->LiteralCode); i++)
+	{
+		zgfx->LiteralCode[i] = (UINT32)i;
+		zgfx->LiteralBits[i] = 9;
+	}
+
+	for (i = 0; ZGFX_TOKEN_TABLE[i].prefixLength != 0; i++)
+	{
+		const ZGFX_TOKEN* token = &ZGFX_TOKEN_TABLE[i];
+
+		if ((token->tokenType == 0) && (token->valueBits == 0))
+		{
+			zgfx->LiteralCode[token->valueBase] = token->prefixCode;
+			zgfx->LiteralBits[token->valueBase] = (BYTE)token->prefixLength;
+		}
+	}
+}
+
+static INLINE const ZGFX_TOKEN* zgfx_distance_token(UINT32 distance)
+{
+	size_t i = ARRAYSIZE(ZGFX_DISTANCE_TOKENS) - 1;
+
+	while ((i > 0) && (ZGFX_TOKEN_TABLE[ZGFX_DISTANCE_TOKENS[i]].valueBase > distance))
+		i--;
+
+	return &ZGFX_TOKEN_TABLE[ZGFX_DISTANCE_TOKENS[i]];
+}
+
+static INLINE UINT32 zgfx_log2_floor(UINT32 value)
+{
+	UINT32 log2 = 0;
+
+	while (value >>= 1)
+		log2++;
+
+	return log2;
+}
+
+static INLINE UINT32 zgfx_match_bits(UINT32 distance, UINT32 length)
+{
+	const ZGFX_TOKEN* token = zgfx_distance_token(distance);
+	const UINT32 lengthBits = (length == 3) ? 1 : 2 * zgfx_log2_floor(length);
+	return token->prefixLength + token->valueBits + lengthBits;
+}
+
+static INLINE BOOL zgfx_write_bits(ZGFX_BIT_WRITER* bw, UINT32 value, UINT32 count)
+{
+	bw->bits = (bw->bits << count) | (value & ((1ull << count) - 1));
+	bw->count += count;
+
+	while (bw->count >= 8)
+	{
+		bw->count -= 8;
+
+		/* Give up as soon as the output is not smaller than the input */
+		if (bw->written >= bw->limit)
+			return FALSE;
+
+		Stream_Write_UINT8(bw->s, (BYTE)(bw->bits >> bw->count));
+		bw->written++;
+	}
+
+	return TRUE;
+}
+
+static BOOL zgfx_write_match(ZGFX_BIT_WRITER* bw, UINT32 distance, UINT32 length)
+{
+	const ZGFX_TOKEN* token = zgfx_distance_token(distance);
+
+	if (!zgfx_write_bits(bw, token->prefixCode, token->prefixLength) ||
+	    !zgfx_write_bits(bw, distance - token->valueBase, token->valueBits))
+		return FALSE;
+
+	if (length == 3)
+		return zgfx_write_bits(bw, 0, 1);
+	else
+	{
+		/* k - 1 one bits and a zero, then the k low bits of the length */
+		const UINT32 k = zgfx_log2_floor(length);
+		return zgfx_write_bits(bw, ((1u << (k - 1)) - 1) << 1, k) &&
+		       zgfx_write_bits(bw, length - (1u << k), k);
+	}
+}
+
+static INLINE UINT32 zgfx_hash(const BYTE* window, UINT32 pos)
+{
+	const UINT32 value = ((UINT32)window[pos & ZGFX_WINDOW_MASK] << 16) |
+	                     ((UINT32)window[(pos + 1) & ZGFX_WINDOW_MASK] << 8) |
+	                     window[(pos + 2) & ZGFX_WINDOW_MASK];
+	return (value * 2654435761u) >> (32 - ZGFX_HASH_BITS);
+}
+
+static INLINE void zgfx_insert(ZGFX_CONTEXT* zgfx, UINT32 pos)
+{
+	const UINT32 hash = zgfx_hash(zgfx->Window, pos);
+	zgfx->Prev[pos & ZGFX_PREV_MASK] = zgfx->Head[hash];
+	zgfx->Head[hash] = pos;
+}
+
+static UINT32 zgfx_find_match(ZGFX_CONTEXT* zgfx, const ZGFX_LEVEL_PARAMS* params, UINT32 pos,
+                              UINT32 end, UINT32* pDistance)
+{
+	UINT32 i;
+	UINT32 literalBits = 0;
+	UINT32 last = pos;
+	UINT32 chain = params->maxChain;
+	UINT32 bestLength = ZGFX_MIN_MATCH - 1;
+	UINT32 bestDistance = 0;
+	const BYTE* window = zgfx->Window;
+	const UINT32 maxLength = end - pos;
+	UINT32 candidate = zgfx->Head[zgfx_hash(window, pos)];
+
+	/* Chains only ever point backwards, anything else is a stale or overwritten entry */
+	while (chain-- && (candidate >= zgfx->WindowStart) && (candidate < last) &&
+	       (pos - candidate <= ZGFX_MAX_DISTANCE))
+	{
+		if (window[(candidate + bestLength) & ZGFX_WINDOW_MASK] ==
+		    window[(pos + bestLength) & ZGFX_WINDOW_MASK])
+		{
+			UINT32 length = 0;
+
+			while ((length < maxLength) && (window[(candidate + length) & ZGFX_WINDOW_MASK] ==
+			                                window[(pos + length) & ZGFX_WINDOW_MASK]))
+				length++;
+
+			if (length > bestLength)
+			{
+				bestLength = length;
+				bestDistance = pos - candidate;
+
+				if ((length >= params->niceLength) || (length == maxLength))
+					break;
+			}
+		}
+
+		last = candidate;
+		candidate = zgfx->Prev[candidate & ZGFX_PREV_MASK];
+	}
+
+	if (bestDistance == 0)
+		return 0;
+
+	/* Short matches far back can cost more than the literals they replace */
+	if (bestLength < 8)
+	{
+		for (i = 0; i < bestLength; i++)
+			literalBits += zgfx->LiteralBits[window[(pos + i) & ZGFX_WINDOW_MASK]];
+
+		if (zgfx_match_bits(bestDistance, bestLength) >= literalBits)
+			return 0;
+	}
+
+	*pDistance = bestDistance;
+	return bestLength;
+}
+
+static BOOL zgfx_encode_segment(ZGFX_CONTEXT* zgfx, wStream* s, UINT32 SrcSize)
+{
+	UINT32 pad;
+	UINT32 pos = zgfx->Position;
+	const UINT32 end = zgfx->Position + SrcSize;
+	const ZGFX_LEVEL_PARAMS* params = &ZGFX_LEVELS[zgfx->Level];
+	ZGFX_BIT_WRITER bw = { 0 };
+
+	/* The compressed bytes and the trailing padding byte must stay below SrcSize */
+	if (SrcSize < 3)
+		return FALSE;
+
+	bw.s = s;
+	bw.limit = SrcSize - 2;
+
+	while (pos < end)
+	{
+		UINT32 distance = 0;
+		UINT32 length = 0;
+
+		if (pos + ZGFX_MIN_MATCH <= end)
+		{
+			length = zgfx_find_match(zgfx, params, pos, end, &distance);
+			zgfx_insert(zgfx, pos);
+
+			if (length && params->lazy && (length < params->niceLength) &&
+			    (pos + 1 + ZGFX_MIN_MATCH <= end))
+			{
+				UINT32 nextDistance = 0;
+
+				if (zgfx_find_match(zgfx, params, pos + 1, end, &nextDistance) > length)
+					length = 0;
+			}
+		}
+
+		if (length)
+		{
+			UINT32 next;
+
+			if (!zgfx_write_match(&bw, distance, length))
+				return FALSE;
+
+			if (params->insertAll)
+			{
+				for (next = pos + 1; (next < pos + length) && (next + ZGFX_MIN_MATCH <= end);
+				     next++)
+					zgfx_insert(zgfx, next);
+			}
+
+			pos += length;
+		}
+		else
+		{
+			const BYTE c = zgfx->Window[pos & ZGFX_WINDOW_MASK];
+
+			if (!zgfx_write_bits(&bw, zgfx->LiteralCode[c], zgfx->LiteralBits[c]))
+				return FALSE;
+
+			pos++;
+		}
+	}
+
+	/* Pad the last byte, the final byte tells the decoder how many bits to ignore */
+	pad = (8 - bw.count) & 7;
+
+	if (pad && !zgfx_write_bits(&bw, 0, pad))
+		return FALSE;
+
+	Stream_Write_UINT8(s, (BYTE)pad);
+	return TRUE;
+}
+
+static void zgfx_window_append(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize)
+{
+	const UINT32 index = zgfx->Position & ZGFX_WINDOW_MASK;
+	const UINT32 front = (SrcSize < ZGFX_WINDOW_SIZE - index) ? SrcSize : ZGFX_WINDOW_SIZE - index;
+
+	/* Rebase before the positions wrap around, the mapping into the ring is kept */
+	if (zgfx->Position > 0x80000000)
+	{
+		ZeroMemory(zgfx->Head, ZGFX_HASH_SIZE * sizeof(UINT32));
+		ZeroMemory(zgfx->Prev, ZGFX_PREV_SIZE * sizeof(UINT32));
+		zgfx->Position = (zgfx->Position & ZGFX_WINDOW_MASK) | ZGFX_WINDOW_SIZE;
+		zgfx->WindowStart = zgfx->Position;
+	}
+
+	CopyMemory(&zgfx->Window[index], pSrcData, front);
+	CopyMemory(zgfx->Window, &pSrcData[front], SrcSize - front);
+}
+
+/* The match finder is only allocated once a compressor compresses at a level above 0 */
+static BOOL zgfx_match_finder_new(ZGFX_CONTEXT* zgfx)
+{
+	zgfx->Window = (BYTE*)malloc(ZGFX_WINDOW_SIZE);
+	zgfx->Head = (UINT32*)calloc(ZGFX_HASH_SIZE, sizeof(UINT32));
+	zgfx->Prev = (UINT32*)calloc(ZGFX_PREV_SIZE, sizeof(UINT32));
+
+	if (!zgfx->Window || !zgfx->Head || !zgfx->Prev)
+	{
+		free(zgfx->Window);
+		free(zgfx->Head);
+		free(zgfx->Prev);
+		zgfx->Window = NULL;
+		zgfx->Head = NULL;
+		zgfx->Prev = NULL;
+		return FALSE;
+	}
+
+	/* Nothing before this segment is in the window */
+	zgfx->WindowStart = zgfx->Position;
+	return TRUE;
+}
+
 static BOOL zgfx_compress_segment(ZGFX_CONTEXT* zgfx, wStream* s, const BYTE* pSrcData,
                                   UINT32 SrcSize, UINT32* pFlags)
 {
-	/* FIXME: Currently compression not implemented. Just copy the raw source */
+	size_t start;
+	BYTE header = ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
+
 	if (!Stream_EnsureRemainingCapacity(s, SrcSize + 1))
 	{
 		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
 		return FALSE;
 	}
 
-	(*pFlags) |= ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
-	Stream_Write_UINT8(s, (*pFlags));         /* header (1 byte) */
-	Stream_Write(s, pSrcData, SrcSize);
+	if (zgfx->Compressor && (zgfx->Level > 0) && !zgfx->Window && !zgfx_match_finder_new(zgfx))
+	{
+		WLog_ERR(TAG, "failed to allocate the match finder");
+		return FALSE;
+	}
+
+	start = Stream_GetPosition(s);
+	Stream_Seek(s, 1); /* header (1 byte) */
+
+	if (zgfx->Window)
+	{
+		zgfx_window_append(zgfx, pSrcData, SrcSize);
+
+		if ((zgfx->Level > 0) && zgfx_encode_segment(zgfx, s, SrcSize))
+			header |= PACKET_COMPRESSED;
+
+		zgfx->Position += SrcSize;
+	}
+
+	/* Segments that do not shrink are sent as they are */
+	if (!(header & PACKET_COMPRESSED))
+	{
+		Stream_SetPosition(s, start + 1);
+		Stream_Write(s, pSrcData, SrcSize);
+	}
+
+	(*pFlags) |= header;
+	Stream_Buffer(s)[start] = header; /* header (1 byte) */
 	return TRUE;
 }
 
@@ -558,6 +957,19 @@ int zgfx_compress_to_stream(ZGFX_CONTEXT* zgfx, wStream* sDst, const BYTE* pUnco
 	return status;
 }
 
+int zgfx_compress_bulk_to_stream(ZGFX_CONTEXT* zgfx, wStream* sDst, const BYTE* pUncompressed,
+                                 UINT32 uncompressedSize, UINT32* pFlags)
+{
+	if (uncompressedSize > ZGFX_SEGMENTED_MAXSIZE)
+		return -1;
+
+	if (!zgfx_compress_segment(zgfx, sDst, pUncompressed, uncompressedSize, pFlags))
+		return -1;
+
+	Stream_SealLength(sDst);
+	return 0;
+}
+
 int zgfx_compress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData,
                   UINT32* pDstSize, UINT32* pFlags)
 {
@@ -570,9 +982,21 @@ int zgfx_compress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BYTE
 	return status;
 }
 
+BOOL zgfx_context_set_level(ZGFX_CONTEXT* zgfx, UINT32 level)
+{
+	if (!zgfx || !zgfx->Compressor || (level > ZGFX_LEVEL_BEST))
+		return FALSE;
+
+	zgfx->Level = level;
+	return TRUE;
+}
+
 void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush)
 {
 	zgfx->HistoryIndex = 0;
+
+	/* Matches must not reach back past a reset */
+	zgfx->WindowStart = zgfx->Position;
 }
 
 ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
@@ -584,6 +1008,17 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 	{
 		zgfx->Compressor = Compressor;
 		zgfx->HistoryBufferSize = sizeof(zgfx->HistoryBuffer);
+		zgfx_init_token_lookup(zgfx);
+
+		if (Compressor)
+		{
+			zgfx->Level = ZGFX_LEVEL_DEFAULT;
+
+			/* Position 0 marks an empty hash chain entry */
+			zgfx->Position = 1;
+			zgfx_init_literal_codes(zgfx);
+		}
+
 		zgfx_context_reset(zgfx, FALSE);
 	}
 
@@ -592,5 +1027,11 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 
 void zgfx_context_free(ZGFX_CONTEXT* zgfx)
 {
+	if (!zgfx)
+		return;
+
+	free(zgfx->Window);
+	free(zgfx->Head);
+	free(zgfx->Prev);
 	free(zgfx);
 }
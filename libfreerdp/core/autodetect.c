@@ -46,6 +46,14 @@
 #define RDP_NETCHAR_RESULTS_0x0880 0x0880U
 #define RDP_NETCHAR_RESULTS_0x08C0 0x08C0U
 
+/* Continuous autodetection of a server, all times in ms */
+#define AUTODETECT_RTT_INTERVAL 1000
+#define AUTODETECT_BW_INTERVAL 2000
+#define AUTODETECT_BW_DURATION 1000
+#define AUTODETECT_RESPONSE_TIMEOUT 10000
+/* A passive measurement over less data says nothing about the link */
+#define AUTODETECT_BW_MIN_BYTES 16384
+
 typedef struct
 {
 	UINT8 headerLength;
@@ -382,6 +390,63 @@ static BOOL autodetect_send_netchar_sync(rdpRdp* rdp, UINT16 sequenceNumber)
 	return rdp_send_message_channel_pdu(rdp, s, SEC_AUTODETECT_RSP);
 }
 
+static void autodetect_update_rtt(rdp_autodetect_internal* ad, UINT32 rtt)
+{
+	rdpNetworkCharacteristics* netchar = &ad->netchar;
+
+	/* Smoothed like the TCP retransmission timer, RFC 6298 */
+	if (netchar->rttSamples == 0)
+	{
+		netchar->averageRTT = rtt;
+		netchar->rttVariation = rtt / 2;
+	}
+	else
+	{
+		const UINT32 delta =
+		    (rtt > netchar->averageRTT) ? rtt - netchar->averageRTT : netchar->averageRTT - rtt;
+		netchar->rttVariation = (netchar->rttVariation * 3 + delta) / 4;
+		netchar->averageRTT = (netchar->averageRTT * 7 + rtt) / 8;
+	}
+
+	if ((netchar->baseRTT == 0) || (netchar->baseRTT > rtt))
+		netchar->baseRTT = rtt;
+
+	netchar->rttSamples++;
+	netchar->lastUpdate = GetTickCount64();
+	ad->common.netCharAverageRTT = netchar->averageRTT;
+	ad->common.netCharBaseRTT = netchar->baseRTT;
+}
+
+static void autodetect_update_bandwidth(rdp_autodetect_internal* ad, BOOL saturated)
+{
+	UINT32 bandwidth;
+	rdpAutoDetect* autodetect = &ad->common;
+	rdpNetworkCharacteristics* netchar = &ad->netchar;
+
+	if ((autodetect->bandwidthMeasureTimeDelta == 0) ||
+	    (!saturated && (autodetect->bandwidthMeasureByteCount < AUTODETECT_BW_MIN_BYTES)))
+		return;
+
+	bandwidth = (UINT32)MIN(autodetect->bandwidthMeasureByteCount * 8ULL /
+	                            autodetect->bandwidthMeasureTimeDelta,
+	                        UINT32_MAX);
+
+	/*
+	 * Only a measurement over a saturated link tells the capacity, otherwise
+	 * the sender did not have more to send and the result is a lower bound.
+	 */
+	if (netchar->bandwidthSamples == 0)
+		netchar->bandwidth = bandwidth;
+	else if (saturated)
+		netchar->bandwidth = (UINT32)((netchar->bandwidth * 3ULL + bandwidth) / 4);
+	else if (bandwidth > netchar->bandwidth)
+		netchar->bandwidth = (UINT32)((netchar->bandwidth + (UINT64)bandwidth) / 2);
+
+	netchar->bandwidthSamples++;
+	netchar->lastUpdate = GetTickCount64();
+	autodetect->netCharBandwidth = netchar->bandwidth;
+}
+
 static BOOL autodetect_recv_rtt_measure_request(rdpRdp* rdp, wStream* s,
                                                 AUTODETECT_REQ_PDU* autodetectReqPdu)
 {
@@ -397,18 +462,21 @@ static BOOL autodetect_recv_rtt_measure_response(rdpRdp* rdp, wStream* s,
                                                  AUTODETECT_RSP_PDU* autodetectRspPdu)
 {
 	BOOL success = TRUE;
+	rdp_autodetect_internal* ad;
 
 	if (autodetectRspPdu->headerLength != 0x06)
 		return FALSE;
 
 	WLog_VRB(AUTODETECT_TAG, "received RTT Measure Response PDU");
-	rdp->autodetect->netCharAverageRTT =
-	    (UINT32)MIN(GetTickCount64() - rdp->autodetect->rttMeasureStartTime, UINT32_MAX);
+	ad = autodetect_cast(rdp->autodetect);
 
-	if (rdp->autodetect->netCharBaseRTT == 0 ||
-	    rdp->autodetect->netCharBaseRTT > rdp->autodetect->netCharAverageRTT)
-		rdp->autodetect->netCharBaseRTT = rdp->autodetect->netCharAverageRTT;
+	/* A late answer to a probe that already timed out */
+	if (ad->rttPending && (autodetectRspPdu->sequenceNumber != ad->rttSequenceNumber))
+		return TRUE;
 
+	ad->rttPending = FALSE;
+	autodetect_update_rtt(
+	    ad, (UINT32)MIN(GetTickCount64() - rdp->autodetect->rttMeasureStartTime, UINT32_MAX));
 	IFCALLRET(rdp->autodetect->RTTMeasureResponse, success, rdp->context,
 	          autodetectRspPdu->sequenceNumber);
 	return success;
@@ -506,6 +574,7 @@ static BOOL autodetect_recv_bandwidth_measure_results(rdpRdp* rdp, wStream* s,
                                                       AUTODETECT_RSP_PDU* autodetectRspPdu)
 {
 	BOOL success = TRUE;
+	rdp_autodetect_internal* ad;
 
 	if (autodetectRspPdu->headerLength != 0x0E)
 		return FALSE;
@@ -516,13 +585,17 @@ static BOOL autodetect_recv_bandwidth_measure_results(rdpRdp* rdp, wStream* s,
 	Stream_Read_UINT32(s, rdp->autodetect->bandwidthMeasureTimeDelta); /* timeDelta (4 bytes) */
 	Stream_Read_UINT32(s, rdp->autodetect->bandwidthMeasureByteCount); /* byteCount (4 bytes) */
 
-	if (rdp->autodetect->bandwidthMeasureTimeDelta > 0)
-		rdp->autodetect->netCharBandwidth =
-		    (UINT32)MIN(rdp->autodetect->bandwidthMeasureByteCount * 8ULL /
-		                    rdp->autodetect->bandwidthMeasureTimeDelta,
-		                UINT32_MAX);
+	ad = autodetect_cast(rdp->autodetect);
+
+	if (ad->bandwidthPending && (autodetectRspPdu->sequenceNumber == ad->bandwidthSequenceNumber))
+	{
+		/* Passive measurement of the session traffic */
+		ad->bandwidthPending = FALSE;
+		autodetect_update_bandwidth(ad, ad->bandwidthSaturated);
+	}
 	else
-		rdp->autodetect->netCharBandwidth = 0;
+		autodetect_update_bandwidth(
+		    ad, autodetectRspPdu->responseType == RDP_BW_RESULTS_RESPONSE_TYPE_CONNECTTIME);
 
 	IFCALLRET(rdp->autodetect->BandwidthMeasureResults, success, rdp->context,
 	          autodetectRspPdu->sequenceNumber);
@@ -715,18 +788,30 @@ int rdp_recv_autodetect_response_packet(rdpRdp* rdp, wStream* s)
 
 rdpAutoDetect* autodetect_new(rdpContext* context)
 {
-	rdpAutoDetect* autoDetect = (rdpAutoDetect*)calloc(1, sizeof(rdpAutoDetect));
+	rdp_autodetect_internal* autoDetect =
+	    (rdp_autodetect_internal*)calloc(1, sizeof(rdp_autodetect_internal));
+
+	if (!autoDetect)
+		return NULL;
+
+	autoDetect->common.context = context;
+	autoDetect->timer = CreateWaitableTimerA(NULL, FALSE, NULL);
 
-	if (autoDetect)
+	if (!autoDetect->timer)
 	{
-		autoDetect->context = context;
+		free(autoDetect);
+		return NULL;
 	}
 
-	return autoDetect;
+	return &autoDetect->common;
 }
 
 void autodetect_free(rdpAutoDetect* autoDetect)
 {
+	if (!autoDetect)
+		return;
+
+	CloseHandle(autodetect_cast(autoDetect)->timer);
 	free(autoDetect);
 }
 
@@ -737,3 +822,140 @@ void autodetect_register_server_callbacks(rdpAutoDetect* autodetect)
 	autodetect->BandwidthMeasureStop = autodetect_send_continuous_bandwidth_measure_stop;
 	autodetect->NetworkCharacteristicsResult = autodetect_send_netchar_result;
 }
+
+/* Arms the timer for the earliest probe or timeout that is due after now */
+static BOOL autodetect_schedule_server(rdp_autodetect_internal* ad, UINT64 now)
+{
+	LARGE_INTEGER due;
+	UINT64 next;
+
+	if (ad->rttPending)
+		next = ad->common.rttMeasureStartTime + AUTODETECT_RESPONSE_TIMEOUT + 1;
+	else
+		next = ad->rttNext;
+
+	if (ad->bandwidthStart != 0)
+		next = MIN(next, ad->bandwidthStart + AUTODETECT_BW_DURATION);
+	else if (ad->bandwidthPending)
+		next = MIN(next, ad->bandwidthStop + AUTODETECT_RESPONSE_TIMEOUT + 1);
+	else
+		next = MIN(next, ad->bandwidthStop + AUTODETECT_BW_INTERVAL);
+
+	/* Rearmed on every call, the wait may already have consumed an early signal */
+	next = MAX(next, now + 1);
+	due.QuadPart = -10000LL * (LONGLONG)(next - now);
+	return SetWaitableTimer(ad->timer, &due, 0, NULL, NULL, FALSE);
+}
+
+HANDLE autodetect_get_event_handle(rdpAutoDetect* autodetect)
+{
+	if (!autodetect)
+		return NULL;
+
+	return autodetect_cast(autodetect)->timer;
+}
+
+/**
+ * Sends the continuous probes of a server that are due. The peer loop wakes up for them
+ * through the handle of autodetect_get_event_handle, even if the session is idle.
+ */
+BOOL autodetect_check_server(rdpAutoDetect* autodetect)
+{
+	UINT64 now;
+	rdpRdp* rdp;
+	rdpContext* context;
+	rdp_autodetect_internal* ad;
+
+	if (!autodetect || !autodetect->context)
+		return TRUE;
+
+	context = autodetect->context;
+	rdp = context->rdp;
+	WINPR_ASSERT(rdp);
+	WINPR_ASSERT(rdp->settings);
+	WINPR_ASSERT(rdp->mcs);
+
+	/* Autodetect PDUs travel on the message channel the client asked for */
+	if (!rdp->settings->ServerMode || !rdp->settings->NetworkAutoDetect ||
+	    (rdp->mcs->messageChannelId == 0) || (rdp_get_state(rdp) != CONNECTION_STATE_ACTIVE))
+		return TRUE;
+
+	ad = autodetect_cast(autodetect);
+	now = GetTickCount64();
+
+	/* Drains the timer if the wait did not already */
+	WaitForSingleObject(ad->timer, 0);
+
+	if (ad->rttPending && (now - autodetect->rttMeasureStartTime > AUTODETECT_RESPONSE_TIMEOUT))
+		ad->rttPending = FALSE;
+
+	if (!ad->rttPending && (now >= ad->rttNext) && autodetect->RTTMeasureRequest)
+	{
+		ad->rttSequenceNumber = ad->sequenceNumber++;
+		ad->rttPending = TRUE;
+		ad->rttNext = now + AUTODETECT_RTT_INTERVAL;
+
+		if (!autodetect->RTTMeasureRequest(context, ad->rttSequenceNumber))
+			return FALSE;
+	}
+
+	/*
+	 * Bandwidth is measured passively: the client counts the session traffic it receives
+	 * between start and stop. The window is saturated if our output backed up meanwhile.
+	 */
+	if (ad->bandwidthStart != 0)
+	{
+		if (transport_is_write_blocked(rdp->transport))
+			ad->bandwidthSaturated = TRUE;
+
+		if ((now - ad->bandwidthStart >= AUTODETECT_BW_DURATION) &&
+		    autodetect->BandwidthMeasureStop)
+		{
+			ad->bandwidthSequenceNumber = ad->sequenceNumber++;
+			ad->bandwidthPending = TRUE;
+			ad->bandwidthStart = 0;
+			ad->bandwidthStop = now;
+
+			if (!autodetect->BandwidthMeasureStop(context, ad->bandwidthSequenceNumber))
+				return FALSE;
+		}
+	}
+	else
+	{
+		if (ad->bandwidthPending && (now - ad->bandwidthStop > AUTODETECT_RESPONSE_TIMEOUT))
+			ad->bandwidthPending = FALSE;
+
+		if (!ad->bandwidthPending && (now - ad->bandwidthStop >= AUTODETECT_BW_INTERVAL) &&
+		    autodetect->BandwidthMeasureStart)
+		{
+			ad->bandwidthStart = now;
+			ad->bandwidthSaturated = FALSE;
+
+			if (!autodetect->BandwidthMeasureStart(context, ad->sequenceNumber++))
+				return FALSE;
+		}
+	}
+
+	return autodetect_schedule_server(ad, now);
+}
+
+BOOL autodetect_get_network_characteristics(rdpAutoDetect* autodetect,
+                                            rdpNetworkCharacteristics* netchar)
+{
+	if (!autodetect || !netchar)
+		return FALSE;
+
+	*netchar = autodetect_cast(autodetect)->netchar;
+
+	/* A client only knows what the server reported */
+	if (netchar->rttSamples == 0)
+	{
+		netchar->baseRTT = autodetect->netCharBaseRTT;
+		netchar->averageRTT = autodetect->netCharAverageRTT;
+	}
+
+	if (netchar->bandwidthSamples == 0)
+		netchar->bandwidth = autodetect->netCharBandwidth;
+
+	return TRUE;
+}
@@ -27,12 +27,46 @@
 #include <freerdp/log.h>
 #include <freerdp/api.h>
 
+#include <winpr/assert.h>
 #include <winpr/stream.h>
+#include <winpr/synch.h>
 #include <winpr/sysinfo.h>
 
 #define TYPE_ID_AUTODETECT_REQUEST 0x00
 #define TYPE_ID_AUTODETECT_RESPONSE 0x01
 
+typedef struct
+{
+	rdpAutoDetect common;
+
+	/* Continuous measurement of a server, see autodetect_check_server */
+	UINT16 sequenceNumber;
+	UINT16 rttSequenceNumber;
+	BOOL rttPending;
+	UINT64 rttNext;
+	UINT16 bandwidthSequenceNumber;
+	BOOL bandwidthPending;
+	BOOL bandwidthSaturated;
+	UINT64 bandwidthStart;
+	UINT64 bandwidthStop;
+	rdpNetworkCharacteristics netchar;
+	/* Wakes up the peer loop when the next probe is due, see autodetect_get_event_handle */
+	HANDLE timer;
+} rdp_autodetect_internal;
+
+static INLINE rdp_autodetect_internal* autodetect_cast(rdpAutoDetect* autodetect)
+{
+	union
+	{
+		rdpAutoDetect* pub;
+		rdp_autodetect_internal* internal;
+	} cnv;
+
+	WINPR_ASSERT(autodetect);
+	cnv.pub = autodetect;
+	return cnv.internal;
+}
+
 FREERDP_LOCAL int rdp_recv_autodetect_request_packet(rdpRdp* rdp, wStream* s);
 FREERDP_LOCAL int rdp_recv_autodetect_response_packet(rdpRdp* rdp, wStream* s);
 
@@ -40,6 +74,10 @@ FREERDP_LOCAL rdpAutoDetect* autodetect_new(rdpContext* context);
 FREERDP_LOCAL void autodetect_free(rdpAutoDetect* autodetect);
 
 FREERDP_LOCAL void autodetect_register_server_callbacks(rdpAutoDetect* autodetect);
+FREERDP_LOCAL BOOL autodetect_check_server(rdpAutoDetect* autodetect);
+FREERDP_LOCAL HANDLE autodetect_get_event_handle(rdpAutoDetect* autodetect);
+FREERDP_LOCAL BOOL autodetect_get_network_characteristics(rdpAutoDetect* autodetect,
+                                                          rdpNetworkCharacteristics* netchar);
 FREERDP_LOCAL BOOL autodetect_send_connecttime_rtt_measure_request(rdpContext* context,
                                                                    UINT16 sequenceNumber);
 FREERDP_LOCAL BOOL autodetect_send_connecttime_bandwidth_measure_start(rdpContext* context,
@@ -111,6 +111,35 @@ static rdpMcsChannel* freerdp_channels_find_channel_by_id(rdpRdp* rdp, UINT16 ch
 	return NULL;
 }
 
+static void freerdp_channels_notify_write(const CHANNEL_OPEN_EVENT* item, DWORD type)
+{
+	const CHANNEL_OPEN_DATA* pChannelOpenData = item->pChannelOpenData;
+
+	if (pChannelOpenData->pChannelOpenEventProc)
+	{
+		pChannelOpenData->pChannelOpenEventProc(pChannelOpenData->OpenHandle, type, item->UserData,
+		                                        item->DataLength, item->DataLength, 0);
+	}
+	else if (pChannelOpenData->pChannelOpenEventProcEx)
+	{
+		pChannelOpenData->pChannelOpenEventProcEx(pChannelOpenData->lpUserParam,
+		                                          pChannelOpenData->OpenHandle, type,
+		                                          item->UserData, item->DataLength,
+		                                          item->DataLength, 0);
+	}
+}
+
+static void freerdp_channels_cancel_scheduled(rdpChannels* channels)
+{
+	CHANNEL_OPEN_EVENT* item;
+
+	while ((item = fair_queue_pop(channels->scheduler, NULL)))
+	{
+		freerdp_channels_notify_write(item, CHANNEL_EVENT_WRITE_CANCELLED);
+		free(item);
+	}
+}
+
 static void channel_queue_message_free(wMessage* msg)
 {
 	CHANNEL_OPEN_EVENT* ev;
@@ -160,6 +189,11 @@ rdpChannels* freerdp_channels_new(freerdp* instance)
 	obj = MessageQueue_Object(channels->queue);
 	obj->fnObjectFree = channel_queue_free;
 
+	channels->scheduler = fair_queue_new();
+
+	if (!channels->scheduler)
+		goto error;
+
 	return channels;
 error:
 	freerdp_channels_free(channels);
@@ -179,6 +213,12 @@ void freerdp_channels_free(rdpChannels* channels)
 		channels->queue = NULL;
 	}
 
+	if (channels->scheduler)
+	{
+		freerdp_channels_cancel_scheduled(channels);
+		fair_queue_free(channels->scheduler);
+	}
+
 	free(channels);
 }
 
@@ -265,6 +305,7 @@ UINT freerdp_channels_pre_connect(rdpChannels* channels, freerdp* instance)
 	CHANNEL_CLIENT_DATA* pChannelClientData;
 
 	MessageQueue_Clear(channels->queue);
+	freerdp_channels_cancel_scheduled(channels);
 
 	for (index = 0; index < channels->clientDataCount; index++)
 	{
@@ -590,26 +631,12 @@ BOOL freerdp_channels_process_message_free(wMessage* message, DWORD type)
 
 	if (message->id == 0)
 	{
-		CHANNEL_OPEN_DATA* pChannelOpenData;
 		CHANNEL_OPEN_EVENT* item = (CHANNEL_OPEN_EVENT*)message->wParam;
 
 		if (!item)
 			return FALSE;
 
-		pChannelOpenData = item->pChannelOpenData;
-
-		if (pChannelOpenData->pChannelOpenEventProc)
-		{
-			pChannelOpenData->pChannelOpenEventProc(pChannelOpenData->OpenHandle, type,
-			                                        item->UserData, item->DataLength,
-			                                        item->DataLength, 0);
-		}
-		else if (pChannelOpenData->pChannelOpenEventProcEx)
-		{
-			pChannelOpenData->pChannelOpenEventProcEx(
-			    pChannelOpenData->lpUserParam, pChannelOpenData->OpenHandle, type, item->UserData,
-			    item->DataLength, item->DataLength, 0);
-		}
+		freerdp_channels_notify_write(item, type);
 	}
 
 	return TRUE;
@@ -659,21 +686,150 @@ fail:
 }
 
 /**
+ * The bandwidth share of a static channel follows its CHANNEL_OPTION_PRI_* option, using the
+ * same split as the dynamic channel priority classes.
+ */
+static UINT32 freerdp_channels_get_weight(const CHANNEL_OPEN_DATA* pChannelOpenData)
+{
+	UINT32 charge = DRDYNVC_PRIORITY_CHARGE1;
+
+	if (pChannelOpenData->options & CHANNEL_OPTION_PRI_HIGH)
+		charge = DRDYNVC_PRIORITY_CHARGE0;
+	else if (pChannelOpenData->options & CHANNEL_OPTION_PRI_LOW)
+		charge = DRDYNVC_PRIORITY_CHARGE2;
+
+	return 65536 / charge;
+}
+
+/**
+ * hands a write over to the scheduler, returns FALSE if the message must be processed directly
+ */
+static BOOL freerdp_channels_schedule_message(rdpChannels* channels, wMessage* message)
+{
+	UINT32 flow;
+	CHANNEL_OPEN_EVENT* item;
+
+	if (message->id != 0)
+		return FALSE;
+
+	item = (CHANNEL_OPEN_EVENT*)message->wParam;
+
+	if (!item || (item->pChannelOpenData->flags != 2))
+		return FALSE;
+
+	flow = (UINT32)(item->pChannelOpenData - channels->openDataList);
+
+	if (!fair_queue_set_weight(channels->scheduler, flow,
+	                           freerdp_channels_get_weight(item->pChannelOpenData)))
+		return FALSE;
+
+	return fair_queue_push(channels->scheduler, flow, item, item->DataLength);
+}
+
+static void freerdp_channels_send_chunk(freerdp* instance, const FairQueueChunk* chunk)
+{
+	CHANNEL_OPEN_EVENT* item = (CHANNEL_OPEN_EVENT*)chunk->item;
+	const CHANNEL_OPEN_DATA* pChannelOpenData = item->pChannelOpenData;
+	const BOOL last = (chunk->offset + chunk->length == chunk->total);
+
+	if (!item->cancelled && (pChannelOpenData->flags == 2))
+	{
+		const rdpMcsChannel* channel =
+		    freerdp_channels_find_channel_by_name(instance->context->rdp, pChannelOpenData->name);
+
+		if (channel)
+		{
+			UINT32 flags = 0;
+
+			if (chunk->offset == 0)
+				flags |= CHANNEL_FLAG_FIRST;
+
+			if (last)
+				flags |= CHANNEL_FLAG_LAST;
+
+			if (channel->options & CHANNEL_OPTION_SHOW_PROTOCOL)
+				flags |= CHANNEL_FLAG_SHOW_PROTOCOL;
+
+			if (!instance->SendChannelPacket(instance, channel->ChannelId, chunk->total, flags,
+			                                 (const BYTE*)item->Data + chunk->offset,
+			                                 chunk->length))
+				item->cancelled = TRUE;
+		}
+	}
+	else
+		item->cancelled = TRUE;
+
+	if (last)
+	{
+		freerdp_channels_notify_write(item, item->cancelled ? CHANNEL_EVENT_WRITE_CANCELLED
+		                                                    : CHANNEL_EVENT_WRITE_COMPLETE);
+		free(item);
+	}
+}
+
+/**
+ * Writes are moved from the message queue to the scheduler and leave in chunks of
+ * VirtualChannelChunkSize, so a large transfer on one channel does not hold back the
+ * others. The message queue is polled between chunks to let new writes join in.
+ *
  * called only from main thread
  */
 static int freerdp_channels_process_sync(rdpChannels* channels, freerdp* instance)
 {
 	int status = TRUE;
 	wMessage message;
+	FairQueueChunk chunk;
+	const size_t chunkSize = instance->context->settings->VirtualChannelChunkSize;
 
-	while (MessageQueue_Peek(channels->queue, &message, TRUE))
+	do
 	{
-		freerdp_channels_process_message(instance, &message);
-	}
+		while (MessageQueue_Peek(channels->queue, &message, TRUE))
+		{
+			if (freerdp_channels_schedule_message(channels, &message))
+				continue;
+
+			/* writes issued before the quit still go out */
+			if (message.id == WMQ_QUIT)
+			{
+				while (fair_queue_next(channels->scheduler, chunkSize, &chunk))
+					freerdp_channels_send_chunk(instance, &chunk);
+			}
+
+			freerdp_channels_process_message(instance, &message);
+		}
+
+		if (!fair_queue_next(channels->scheduler, chunkSize, &chunk))
+			break;
+
+		freerdp_channels_send_chunk(instance, &chunk);
+	} while (TRUE);
 
 	return status;
 }
 
+BOOL freerdp_channels_get_queue_stats(rdpChannels* channels, const char* name,
+                                      FairQueueStats* stats)
+{
+	CHANNEL_OPEN_DATA* pChannelOpenData;
+
+	WINPR_ASSERT(channels);
+	WINPR_ASSERT(name);
+	WINPR_ASSERT(stats);
+
+	pChannelOpenData = freerdp_channels_find_channel_open_data_by_name(channels, name);
+
+	if (!pChannelOpenData)
+		return FALSE;
+
+	if (fair_queue_get_stats(channels->scheduler,
+	                         (UINT32)(pChannelOpenData - channels->openDataList), stats))
+		return TRUE;
+
+	ZeroMemory(stats, sizeof(FairQueueStats));
+	stats->weight = freerdp_channels_get_weight(pChannelOpenData);
+	return TRUE;
+}
+
 /**
  * called only from main thread
  */
@@ -1167,7 +1323,7 @@ static UINT VCAPITYPE FreeRDP_VirtualChannelWriteEx(LPVOID pInitHandle, DWORD op
 	if (pChannelOpenData->flags != 2)
 		return CHANNEL_RC_NOT_OPEN;
 
-	pChannelOpenEvent = (CHANNEL_OPEN_EVENT*)malloc(sizeof(CHANNEL_OPEN_EVENT));
+	pChannelOpenEvent = (CHANNEL_OPEN_EVENT*)calloc(1, sizeof(CHANNEL_OPEN_EVENT));
 
 	if (!pChannelOpenEvent)
 		return CHANNEL_RC_NO_MEMORY;
@@ -1220,7 +1376,7 @@ static UINT VCAPITYPE FreeRDP_VirtualChannelWrite(DWORD openHandle, LPVOID pData
 	if (pChannelOpenData->flags != 2)
 		return CHANNEL_RC_NOT_OPEN;
 
-	pChannelOpenEvent = (CHANNEL_OPEN_EVENT*)malloc(sizeof(CHANNEL_OPEN_EVENT));
+	pChannelOpenEvent = (CHANNEL_OPEN_EVENT*)calloc(1, sizeof(CHANNEL_OPEN_EVENT));
 
 	if (!pChannelOpenEvent)
 		return CHANNEL_RC_NO_MEMORY;
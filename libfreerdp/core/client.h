@@ -35,6 +35,7 @@
 #include <freerdp/client/channels.h>
 #include <freerdp/client/drdynvc.h>
 #include <freerdp/channels/channels.h>
+#include <freerdp/utils/fair_queue.h>
 
 #ifndef CHANNEL_MAX_COUNT
 #define CHANNEL_MAX_COUNT 30
@@ -69,6 +70,7 @@ typedef struct
 	UINT32 DataLength;
 	void* UserData;
 	CHANNEL_OPEN_DATA* pChannelOpenData;
+	BOOL cancelled;
 } CHANNEL_OPEN_EVENT;
 
 /**
@@ -105,6 +107,9 @@ struct rdp_channels
 
 	wMessageQueue* queue;
 
+	/* writes taken from the queue, sent in chunks by channel priority */
+	FairQueue* scheduler;
+
 	DrdynvcClientContext* drdynvc;
 	CRITICAL_SECTION channelsLock;
 };
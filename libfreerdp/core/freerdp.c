@@ -1036,6 +1036,14 @@ ULONG freerdp_get_transport_sent(rdpContext* context, BOOL resetCount)
 	return transport_get_bytes_sent(context->rdp->transport, resetCount);
 }
 
+BOOL freerdp_get_network_characteristics(rdpContext* context, rdpNetworkCharacteristics* netchar)
+{
+	if (!context || !context->rdp || !netchar)
+		return FALSE;
+
+	return autodetect_get_network_characteristics(context->rdp->autodetect, netchar);
+}
+
 BOOL freerdp_nla_impersonate(rdpContext* context)
 {
 	rdpNla* nla;
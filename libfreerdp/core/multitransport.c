@@ -25,6 +25,18 @@
 
 #define TAG FREERDP_TAG("core.multitransport")
 
+static BOOL multitransport_client_send_response(rdpRdp* rdp, UINT32 requestId, HRESULT hr)
+{
+	wStream* s = rdp_message_channel_pdu_init(rdp);
+
+	if (!s)
+		return FALSE;
+
+	Stream_Write_UINT32(s, requestId);  /* requestId (4 bytes) */
+	Stream_Write_UINT32(s, (UINT32)hr); /* hrResponse (4 bytes) */
+	return rdp_send_message_channel_pdu(rdp, s, SEC_TRANSPORT_RSP);
+}
+
 int rdp_recv_multitransport_packet(rdpRdp* rdp, wStream* s)
 {
 	UINT32 requestId;
@@ -40,7 +52,10 @@ int rdp_recv_multitransport_packet(rdpRdp* rdp, wStream* s)
 	Stream_Read_UINT16(s, reserved);          /* reserved (2 bytes) */
 	Stream_Read(s, securityCookie, 16);       /* securityCookie (16 bytes) */
 
-	return 0;
+	/* No UDP transport, tell the server not to wait for the tunnel ([MS-RDPBCGR] 2.2.15.2) */
+	WLog_DBG(TAG, "declining tunnel %" PRIu32 " with protocol 0x%04" PRIx16, requestId,
+	         requestedProtocol);
+	return multitransport_client_send_response(rdp, requestId, E_ABORT) ? 0 : -1;
 }
 
 rdpMultitransport* multitransport_new(void)
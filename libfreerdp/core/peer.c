@@ -296,10 +296,31 @@ static HANDLE freerdp_peer_get_event_handle(freerdp_peer* client)
 
 static DWORD freerdp_peer_get_event_handles(freerdp_peer* client, HANDLE* events, DWORD count)
 {
+	DWORD nCount;
+	HANDLE timer;
+	rdpRdp* rdp;
+
 	WINPR_ASSERT(client);
 	WINPR_ASSERT(client->context);
 	WINPR_ASSERT(client->context->rdp);
-	return transport_get_event_handles(client->context->rdp->transport, events, count);
+
+	rdp = client->context->rdp;
+	nCount = transport_get_event_handles(rdp->transport, events, count);
+
+	/* Continuous autodetection must not depend on client activity */
+	timer = autodetect_get_event_handle(rdp->autodetect);
+
+	if ((nCount == 0) || !timer)
+		return nCount;
+
+	if (nCount >= count)
+	{
+		WLog_ERR(TAG, "provided handles array is too small");
+		return 0;
+	}
+
+	events[nCount++] = timer;
+	return nCount;
 }
 
 static BOOL freerdp_peer_check_fds(freerdp_peer* peer)
@@ -316,7 +337,7 @@ static BOOL freerdp_peer_check_fds(freerdp_peer* peer)
 	if (status < 0)
 		return FALSE;
 
-	return TRUE;
+	return autodetect_check_server(rdp->autodetect);
 }
 
 static BOOL peer_recv_data_pdu(freerdp_peer* client, wStream* s, UINT16 totalLength)
@@ -926,6 +947,22 @@ static int freerdp_peer_drain_output_buffer(freerdp_peer* peer)
 	return transport_drain_output_buffer(transport);
 }
 
+static BOOL freerdp_peer_begin_write_batch(freerdp_peer* peer)
+{
+	WINPR_ASSERT(peer);
+	WINPR_ASSERT(peer->context);
+	WINPR_ASSERT(peer->context->rdp);
+	return transport_begin_write_batch(peer->context->rdp->transport);
+}
+
+static BOOL freerdp_peer_end_write_batch(freerdp_peer* peer)
+{
+	WINPR_ASSERT(peer);
+	WINPR_ASSERT(peer->context);
+	WINPR_ASSERT(peer->context->rdp);
+	return transport_end_write_batch(peer->context->rdp->transport);
+}
+
 static BOOL freerdp_peer_has_more_to_read(freerdp_peer* peer)
 {
 	WINPR_ASSERT(peer);
@@ -1101,6 +1138,8 @@ freerdp_peer* freerdp_peer_new(int sockfd)
 		client->IsWriteBlocked = freerdp_peer_is_write_blocked;
 		client->DrainOutputBuffer = freerdp_peer_drain_output_buffer;
 		client->HasMoreToRead = freerdp_peer_has_more_to_read;
+		client->BeginWriteBatch = freerdp_peer_begin_write_batch;
+		client->EndWriteBatch = freerdp_peer_end_write_batch;
 		client->VirtualChannelOpen = freerdp_peer_virtual_channel_open;
 		client->VirtualChannelClose = freerdp_peer_virtual_channel_close;
 		client->VirtualChannelWrite = freerdp_peer_virtual_channel_write;
@@ -1182,6 +1221,8 @@ BOOL freerdp_peer_context_new_ex(freerdp_peer* client, const rdpSettings* settin
 	client->IsWriteBlocked = freerdp_peer_is_write_blocked;
 	client->DrainOutputBuffer = freerdp_peer_drain_output_buffer;
 	client->HasMoreToRead = freerdp_peer_has_more_to_read;
+	client->BeginWriteBatch = freerdp_peer_begin_write_batch;
+	client->EndWriteBatch = freerdp_peer_end_write_batch;
 	client->LicenseCallback = freerdp_peer_nolicense;
 	IFCALLRET(client->ContextNew, ret, client, client->context);
 
@@ -39,6 +39,9 @@
 #include "server.h"
 
 #define TAG FREERDP_TAG("core.server")
+
+/* Messages sent uncompressed on a channel after its data failed to shrink */
+#define WTS_DVC_COMPRESS_BACKOFF 32
 #ifdef WITH_DEBUG_DVC
 #define DEBUG_DVC(...) WLog_DBG(TAG, __VA_ARGS__)
 #else
@@ -155,16 +158,42 @@ static int wts_read_variable_uint(wStream* s, int cbLen, UINT32* val)
 static BOOL wts_read_drdynvc_capabilities_response(rdpPeerChannel* channel, UINT32 length)
 {
 	UINT16 Version;
+	const rdpSettings* settings;
 
 	WINPR_ASSERT(channel);
 	WINPR_ASSERT(channel->vcm);
+	WINPR_ASSERT(channel->client);
 	if (length < 3)
 		return FALSE;
 
 	Stream_Seek_UINT8(channel->receiveData); /* Pad (1 byte) */
 	Stream_Read_UINT16(channel->receiveData, Version);
 	DEBUG_DVC("Version: %" PRIu16 "", Version);
+
 	channel->vcm->drdynvc_state = DRDYNVC_STATE_READY;
+
+	/* Version 3 allows compressed data PDUs in both directions, the history buffers are
+	 * only allocated once it was negotiated */
+	if (!channel->vcm->dvc_compression || (Version < DYNVC_CAPS_VERSION3))
+		return TRUE;
+
+	if (!channel->vcm->dvc_decompressor)
+		channel->vcm->dvc_decompressor = zgfx_context_new(FALSE);
+
+	if (!channel->vcm->dvc_decompressor)
+		return FALSE;
+
+	settings = channel->client->context->settings;
+	if (!freerdp_settings_get_bool(settings, FreeRDP_CompressionEnabled))
+		return TRUE;
+
+	if (!channel->vcm->dvc_compressor)
+		channel->vcm->dvc_compressor = zgfx_context_new(TRUE);
+
+	if (!channel->vcm->dvc_compressor)
+		return FALSE;
+
+	channel->vcm->drdynvc_compress = TRUE;
 	return TRUE;
 }
 
@@ -200,18 +229,12 @@ static BOOL wts_read_drdynvc_create_response(rdpPeerChannel* channel, wStream* s
 	return status;
 }
 
-static BOOL wts_read_drdynvc_data_first(rdpPeerChannel* channel, wStream* s, int cbLen,
+static BOOL wts_read_drdynvc_data_first(rdpPeerChannel* channel, wStream* s, UINT32 totalLength,
                                         UINT32 length)
 {
-	int value;
 	WINPR_ASSERT(channel);
 	WINPR_ASSERT(s);
-	value = wts_read_variable_uint(s, cbLen, &channel->dvc_total_length);
-
-	if (value == 0)
-		return FALSE;
-
-	length -= value;
+	channel->dvc_total_length = totalLength;
 
 	if (length > channel->dvc_total_length)
 		return FALSE;
@@ -259,6 +282,59 @@ static BOOL wts_read_drdynvc_data(rdpPeerChannel* channel, wStream* s, UINT32 le
 	return ret;
 }
 
+static BOOL wts_read_drdynvc_compressed(WTSVirtualChannelManager* vcm, rdpPeerChannel* dvc,
+                                        wStream* s, int Cmd, int Sp, UINT32 length)
+{
+	int value;
+	BOOL ret = TRUE;
+	BYTE* buffer = NULL;
+	UINT32 size = 0;
+	UINT32 totalLength = 0;
+	wStream sbuffer = { 0 };
+	wStream* data;
+
+	WINPR_ASSERT(vcm);
+	WINPR_ASSERT(s);
+
+	if (Cmd == DATA_FIRST_COMPRESSED_PDU)
+	{
+		value = wts_read_variable_uint(s, Sp, &totalLength);
+
+		if (value == 0)
+			return FALSE;
+
+		length -= value;
+	}
+
+	if (!vcm->dvc_decompressor)
+	{
+		WLog_ERR(TAG, "compressed data PDU without version 3 capabilities");
+		return FALSE;
+	}
+
+	/* Data for unknown channels still feeds the history shared by all channels */
+	if (zgfx_decompress_bulk(vcm->dvc_decompressor, Stream_Pointer(s), length, &buffer, &size) <
+	    0)
+	{
+		WLog_ERR(TAG, "zgfx_decompress_bulk failed!");
+		free(buffer);
+		return FALSE;
+	}
+
+	if (dvc)
+	{
+		data = Stream_StaticInit(&sbuffer, buffer, size);
+
+		if (Cmd == DATA_FIRST_COMPRESSED_PDU)
+			ret = wts_read_drdynvc_data_first(dvc, data, totalLength, size);
+		else
+			ret = wts_read_drdynvc_data(dvc, data, size);
+	}
+
+	free(buffer);
+	return ret;
+}
+
 static void wts_read_drdynvc_close_response(rdpPeerChannel* channel)
 {
 	WINPR_ASSERT(channel);
@@ -319,6 +395,11 @@ static BOOL wts_read_drdynvc_pdu(rdpPeerChannel* channel)
 
 			DEBUG_DVC("Cmd %d ChannelId %" PRIu32 " length %" PRIu32 "", Cmd, ChannelId, length);
 			dvc = wts_get_dvc_channel_by_id(channel->vcm, ChannelId);
+
+			if ((Cmd == DATA_FIRST_COMPRESSED_PDU) || (Cmd == DATA_COMPRESSED_PDU))
+				return wts_read_drdynvc_compressed(channel->vcm, dvc, channel->receiveData, Cmd,
+				                                   Sp, length);
+
 			if (!dvc)
 			{
 				DEBUG_DVC("ChannelId %" PRIu32 " not exists.", ChannelId);
@@ -332,7 +413,16 @@ static BOOL wts_read_drdynvc_pdu(rdpPeerChannel* channel)
 				return wts_read_drdynvc_create_response(dvc, channel->receiveData, length);
 
 			case DATA_FIRST_PDU:
-				return wts_read_drdynvc_data_first(dvc, channel->receiveData, Sp, length);
+			{
+				UINT32 totalLength;
+				value = wts_read_variable_uint(channel->receiveData, Sp, &totalLength);
+
+				if (value == 0)
+					return FALSE;
+
+				return wts_read_drdynvc_data_first(dvc, channel->receiveData, totalLength,
+				                                   length - value);
+			}
 
 			case DATA_PDU:
 				return wts_read_drdynvc_data(dvc, channel->receiveData, length);
@@ -341,11 +431,6 @@ static BOOL wts_read_drdynvc_pdu(rdpPeerChannel* channel)
 				wts_read_drdynvc_close_response(dvc);
 				break;
 
-			case DATA_FIRST_COMPRESSED_PDU:
-			case DATA_COMPRESSED_PDU:
-				WLog_ERR(TAG, "Compressed data not handled");
-				break;
-
 			case SOFT_SYNC_RESPONSE_PDU:
 				WLog_ERR(TAG, "SoftSync response not handled yet(and rather strange to receive "
 				              "that packet as our code doesn't send SoftSync requests");
@@ -543,7 +628,7 @@ BOOL WTSVirtualChannelManagerOpen(HANDLE hServer)
 	if (vcm->drdynvc_state == DRDYNVC_STATE_NONE)
 	{
 		rdpPeerChannel* channel;
-		UINT32 dynvc_caps;
+		BYTE dynvc_caps[12];
 
 		/* Initialize drdynvc channel once and only once. */
 		vcm->drdynvc_state = DRDYNVC_STATE_INITIALIZED;
@@ -553,10 +638,22 @@ BOOL WTSVirtualChannelManagerOpen(HANDLE hServer)
 		if (channel)
 		{
 			ULONG written;
-			vcm->drdynvc_channel = channel;
-			dynvc_caps = 0x00010050; /* DYNVC_CAPS_VERSION1 (4 bytes) */
+			wStream sbuffer = { 0 };
+			wStream* s = Stream_StaticInit(&sbuffer, dynvc_caps, sizeof(dynvc_caps));
+			/* Older FreeRDP clients echo version 3 without handling compressed data */
+			const UINT16 version =
+			    vcm->dvc_compression ? DYNVC_CAPS_VERSION3 : DYNVC_CAPS_VERSION2;
 
-			if (!WTSVirtualChannelWrite(channel, (PCHAR)&dynvc_caps, sizeof(dynvc_caps), &written))
+			vcm->drdynvc_channel = channel;
+			Stream_Write_UINT8(s, CAPABILITY_REQUEST_PDU << 4); /* Cmd+Sp+cbChId (1 byte) */
+			Stream_Write_UINT8(s, 0);                           /* Pad (1 byte) */
+			Stream_Write_UINT16(s, version);                    /* Version (2 bytes) */
+			Stream_Write_UINT16(s, DRDYNVC_PRIORITY_CHARGE0);   /* PriorityCharge0 (2 bytes) */
+			Stream_Write_UINT16(s, DRDYNVC_PRIORITY_CHARGE1);   /* PriorityCharge1 (2 bytes) */
+			Stream_Write_UINT16(s, DRDYNVC_PRIORITY_CHARGE2);   /* PriorityCharge2 (2 bytes) */
+			Stream_Write_UINT16(s, DRDYNVC_PRIORITY_CHARGE3);   /* PriorityCharge3 (2 bytes) */
+
+			if (!WTSVirtualChannelWrite(channel, (PCHAR)dynvc_caps, sizeof(dynvc_caps), &written))
 				return FALSE;
 		}
 	}
@@ -567,6 +664,7 @@ BOOL WTSVirtualChannelManagerOpen(HANDLE hServer)
 BOOL WTSVirtualChannelManagerCheckFileDescriptorEx(HANDLE hServer, BOOL autoOpen)
 {
 	wMessage message;
+	BOOL batch;
 	BOOL status = TRUE;
 	WTSVirtualChannelManager* vcm;
 
@@ -581,6 +679,10 @@ BOOL WTSVirtualChannelManagerCheckFileDescriptorEx(HANDLE hServer, BOOL autoOpen
 			return FALSE;
 	}
 
+	/* Queued channel data, e.g. the GFX PDUs of a frame, shares TLS records */
+	WINPR_ASSERT(vcm->client);
+	batch = vcm->client->BeginWriteBatch && vcm->client->BeginWriteBatch(vcm->client);
+
 	while (MessageQueue_Peek(vcm->queue, &message, TRUE))
 	{
 		BYTE* buffer;
@@ -603,6 +705,9 @@ BOOL WTSVirtualChannelManagerCheckFileDescriptorEx(HANDLE hServer, BOOL autoOpen
 			break;
 	}
 
+	if (batch && !vcm->client->EndWriteBatch(vcm->client))
+		status = FALSE;
+
 	return status;
 }
 
@@ -705,6 +810,15 @@ void WTSVirtualChannelManagerSetDVCCreationCallback(HANDLE hServer, psDVCCreatio
 	vcm->dvc_creation_status_userdata = userdata;
 }
 
+void WTSVirtualChannelManagerSetDVCCompression(HANDLE hServer, BOOL enable)
+{
+	WTSVirtualChannelManager* vcm = hServer;
+
+	WINPR_ASSERT(vcm);
+
+	vcm->dvc_compression = enable;
+}
+
 UINT16 WTSChannelGetId(freerdp_peer* client, const char* channel_name)
 {
 	rdpMcsChannel* channel;
@@ -979,6 +1093,9 @@ HANDLE WINAPI FreeRDP_WTSOpenServerA(LPSTR pServerName)
 	if (!vcm->queue)
 		goto error_queue;
 
+	if (!InitializeCriticalSectionAndSpinCount(&vcm->dvc_compress_lock, 4000))
+		goto error_lock;
+
 	vcm->dvc_channel_id_seq = 0;
 	vcm->dynamicVirtualChannels = ArrayList_New(TRUE);
 
@@ -994,6 +1111,8 @@ HANDLE WINAPI FreeRDP_WTSOpenServerA(LPSTR pServerName)
 	hServer = (HANDLE)vcm;
 	return hServer;
 error_dynamicVirtualChannels:
+	DeleteCriticalSection(&vcm->dvc_compress_lock);
+error_lock:
 	MessageQueue_Free(vcm->queue);
 error_queue:
 	HashTable_Remove(g_ServerHandles, (void*)(UINT_PTR)vcm->SessionId);
@@ -1032,6 +1151,9 @@ VOID WINAPI FreeRDP_WTSCloseServer(HANDLE hServer)
 		}
 
 		MessageQueue_Free(vcm->queue);
+		DeleteCriticalSection(&vcm->dvc_compress_lock);
+		zgfx_context_free(vcm->dvc_compressor);
+		zgfx_context_free(vcm->dvc_decompressor);
 		free(vcm);
 	}
 }
@@ -1503,6 +1625,93 @@ BOOL WINAPI FreeRDP_WTSVirtualChannelRead(HANDLE hChannelHandle, ULONG TimeOut,
 	return TRUE;
 }
 
+static BOOL wts_use_compression(rdpPeerChannel* channel)
+{
+	WINPR_ASSERT(channel);
+
+	if (!channel->vcm->drdynvc_compress)
+		return FALSE;
+
+	if (channel->dvc_compress_skip > 0)
+	{
+		channel->dvc_compress_skip--;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Sends DVC data as DYNVC_DATA_FIRST_COMPRESSED / DYNVC_DATA_COMPRESSED PDUs */
+static BOOL wts_write_drdynvc_compressed(rdpPeerChannel* channel, const BYTE* data, UINT32 length)
+{
+	BOOL ret = TRUE;
+	BOOL shrunk = FALSE;
+	UINT32 offset = 0;
+	WTSVirtualChannelManager* vcm;
+
+	WINPR_ASSERT(channel);
+	vcm = channel->vcm;
+	WINPR_ASSERT(vcm);
+
+	/* All channels share one history, PDUs are queued in the order they were compressed */
+	EnterCriticalSection(&vcm->dvc_compress_lock);
+
+	while (ret && (offset < length))
+	{
+		int cbChId;
+		UINT32 flags = 0;
+		BYTE* buffer;
+		size_t size;
+		const UINT32 chunkLength = MIN(length - offset, DRDYNVC_COMPRESSED_CHUNK_LENGTH);
+		wStream* s = Stream_New(NULL, chunkLength + 16);
+
+		if (!s)
+		{
+			WLog_ERR(TAG, "Stream_New failed!");
+			SetLastError(E_OUTOFMEMORY);
+			ret = FALSE;
+			break;
+		}
+
+		Stream_Seek_UINT8(s);
+		cbChId = wts_write_variable_uint(s, channel->channelId);
+
+		if ((offset == 0) && (chunkLength < length))
+		{
+			const int cbLen = wts_write_variable_uint(s, length);
+			Stream_Buffer(s)[0] = (DATA_FIRST_COMPRESSED_PDU << 4) | (cbLen << 2) | cbChId;
+		}
+		else
+			Stream_Buffer(s)[0] = (DATA_COMPRESSED_PDU << 4) | cbChId;
+
+		if (zgfx_compress_bulk_to_stream(vcm->dvc_compressor, s, &data[offset], chunkLength,
+		                                 &flags) < 0)
+		{
+			WLog_ERR(TAG, "zgfx_compress_bulk_to_stream failed!");
+			Stream_Free(s, TRUE);
+			ret = FALSE;
+			break;
+		}
+
+		if (flags & PACKET_COMPRESSED)
+			shrunk = TRUE;
+
+		offset += chunkLength;
+		buffer = Stream_Buffer(s);
+		size = Stream_GetPosition(s);
+		Stream_Free(s, FALSE);
+		ret = wts_queue_send_item(vcm->drdynvc_channel, buffer, (UINT32)size);
+	}
+
+	LeaveCriticalSection(&vcm->dvc_compress_lock);
+
+	/* Already compressed payloads, like graphics, are not worth the cycles */
+	if (!shrunk)
+		channel->dvc_compress_skip = WTS_DVC_COMPRESS_BACKOFF;
+
+	return ret;
+}
+
 BOOL WINAPI FreeRDP_WTSVirtualChannelWrite(HANDLE hChannelHandle, PCHAR Buffer, ULONG Length,
                                            PULONG pBytesWritten)
 {
@@ -1541,6 +1750,11 @@ BOOL WINAPI FreeRDP_WTSVirtualChannelWrite(HANDLE hChannelHandle, PCHAR Buffer,
 		DEBUG_DVC("drdynvc not ready");
 		return FALSE;
 	}
+	else if ((Length > 0) && wts_use_compression(channel))
+	{
+		totalWritten = Length;
+		ret = wts_write_drdynvc_compressed(channel, (const BYTE*)Buffer, Length);
+	}
 	else
 	{
 		rdpContext* context;
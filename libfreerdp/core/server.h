@@ -24,6 +24,7 @@
 #include <freerdp/freerdp.h>
 #include <freerdp/api.h>
 #include <freerdp/channels/wtsvc.h>
+#include <freerdp/codec/zgfx.h>
 
 #include <winpr/synch.h>
 #include <winpr/stream.h>
@@ -65,6 +66,7 @@ struct rdp_peer_channel
 
 	BYTE dvc_open_state;
 	UINT32 dvc_total_length;
+	UINT32 dvc_compress_skip;
 	rdpMcsChannel* mcsChannel;
 };
 
@@ -78,8 +80,14 @@ struct WTSVirtualChannelManager
 
 	rdpPeerChannel* drdynvc_channel;
 	BYTE drdynvc_state;
+	BOOL dvc_compression; /* opt-in, see WTSVirtualChannelManagerSetDVCCompression */
+	BOOL drdynvc_compress;
 	LONG dvc_channel_id_seq;
 
+	CRITICAL_SECTION dvc_compress_lock;
+	ZGFX_CONTEXT* dvc_compressor;
+	ZGFX_CONTEXT* dvc_decompressor;
+
 	psDVCCreationStatusCallback dvc_creation_status;
 	void* dvc_creation_status_userdata;
 
@@ -0,0 +1,231 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/winsock.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/peer.h>
+
+#include "../rdp.h"
+#include "../transport.h"
+#include "../connection.h"
+
+/*
+ * Runs the continuous server autodetection against the client responses over a loopback
+ * connection. Neither side sends anything on its own, so the probes after the first one
+ * are only sent if the autodetect timer wakes up the peer loop.
+ */
+
+#define TEST_USER_ID 1007
+#define TEST_MESSAGE_CHANNEL_ID 1004
+#define TEST_WAIT_TIMEOUT 1500
+#define TEST_DURATION 5000
+#define TEST_RTT_SAMPLES 3
+
+static BOOL test_socket_pair(SOCKET* server, SOCKET* client)
+{
+	BOOL rc = FALSE;
+	struct sockaddr_in addr = { 0 };
+	int length = sizeof(addr);
+	SOCKET listener;
+
+	*server = INVALID_SOCKET;
+	*client = INVALID_SOCKET;
+
+	listener = _socket(AF_INET, SOCK_STREAM, 0);
+	if (listener == INVALID_SOCKET)
+		return FALSE;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	if ((_bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+	    (_listen(listener, 1) != 0) ||
+	    (_getsockname(listener, (struct sockaddr*)&addr, &length) != 0))
+		goto fail;
+
+	*client = _socket(AF_INET, SOCK_STREAM, 0);
+	if ((*client == INVALID_SOCKET) ||
+	    (_connect(*client, (struct sockaddr*)&addr, sizeof(addr)) != 0))
+		goto fail;
+
+	length = sizeof(addr);
+	*server = _accept(listener, (struct sockaddr*)&addr, &length);
+	rc = (*server != INVALID_SOCKET);
+fail:
+	closesocket(listener);
+	return rc;
+}
+
+static BOOL test_setup_peer(freerdp_peer* peer)
+{
+	rdpRdp* rdp;
+
+	if (!freerdp_peer_context_new(peer))
+		return FALSE;
+
+	rdp = peer->context->rdp;
+	rdp->mcs->userId = TEST_USER_ID;
+	rdp->mcs->messageChannelId = TEST_MESSAGE_CHANNEL_ID;
+
+	if (!freerdp_settings_set_bool(rdp->settings, FreeRDP_NetworkAutoDetect, TRUE))
+		return FALSE;
+
+	return peer->SetState(peer, CONNECTION_STATE_ACTIVE);
+}
+
+static BOOL test_setup_client(freerdp* instance, SOCKET sockfd)
+{
+	rdpRdp* rdp;
+
+	if (!freerdp_context_new(instance))
+	{
+		closesocket(sockfd);
+		return FALSE;
+	}
+
+	rdp = instance->context->rdp;
+
+	/* the transport owns the socket from here on */
+	if (!transport_attach(rdp->transport, (int)sockfd))
+	{
+		closesocket(sockfd);
+		return FALSE;
+	}
+
+	rdp->mcs->userId = TEST_USER_ID;
+	rdp->mcs->messageChannelId = TEST_MESSAGE_CHANNEL_ID;
+
+	if (!freerdp_settings_set_bool(rdp->settings, FreeRDP_NetworkAutoDetect, TRUE))
+		return FALSE;
+
+	if (!transport_set_blocking_mode(rdp->transport, FALSE) ||
+	    !transport_set_recv_callbacks(rdp->transport, rdp_recv_callback, rdp))
+		return FALSE;
+
+	return rdp_client_transition_to_state(rdp, CONNECTION_STATE_ACTIVE) >= 0;
+}
+
+static BOOL test_run(freerdp_peer* peer, freerdp* instance)
+{
+	const UINT64 end = GetTickCount64() + TEST_DURATION;
+	rdpRdp* rdp = instance->context->rdp;
+	rdpNetworkCharacteristics netchar = { 0 };
+
+	/* The first call sends the initial probes, a server does that when it gets activated */
+	if (!peer->CheckFileDescriptor(peer))
+		return FALSE;
+
+	while (GetTickCount64() < end)
+	{
+		DWORD status;
+		DWORD count;
+		DWORD tmp;
+		HANDLE handles[32] = { 0 };
+
+		count = peer->GetEventHandles(peer, handles, ARRAYSIZE(handles));
+		if (count == 0)
+			return FALSE;
+
+		tmp = transport_get_event_handles(rdp->transport, &handles[count],
+		                                  ARRAYSIZE(handles) - count);
+		if (tmp == 0)
+			return FALSE;
+
+		count += tmp;
+		status = WaitForMultipleObjects(count, handles, FALSE, TEST_WAIT_TIMEOUT);
+
+		if (status == WAIT_TIMEOUT)
+		{
+			fprintf(stderr, "TestAutodetect: peer loop was not woken up for the next probe\n");
+			return FALSE;
+		}
+
+		if (status == WAIT_FAILED)
+			return FALSE;
+
+		if (!peer->CheckFileDescriptor(peer))
+			return FALSE;
+
+		if (rdp_check_fds(rdp) < 0)
+			return FALSE;
+
+		if (!freerdp_get_network_characteristics(peer->context, &netchar))
+			return FALSE;
+
+		if (netchar.rttSamples >= TEST_RTT_SAMPLES)
+			return TRUE;
+	}
+
+	fprintf(stderr, "TestAutodetect: got %" PRIu32 " round trip samples, expected %d\n",
+	        netchar.rttSamples, TEST_RTT_SAMPLES);
+	return FALSE;
+}
+
+int TestAutodetect(int argc, char* argv[])
+{
+	int rc = -1;
+	SOCKET server = INVALID_SOCKET;
+	SOCKET client = INVALID_SOCKET;
+	SOCKET sockfd;
+	freerdp_peer* peer = NULL;
+	freerdp* instance = NULL;
+	WSADATA wsaData;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return -1;
+
+	if (!test_socket_pair(&server, &client))
+		goto fail;
+
+	/* the peer owns the server socket from here on */
+	peer = freerdp_peer_new((int)server);
+	if (!peer)
+		goto fail;
+
+	server = INVALID_SOCKET;
+
+	instance = freerdp_new();
+	if (!instance)
+		goto fail;
+
+	/* test_setup_client takes over the client socket */
+	sockfd = client;
+	client = INVALID_SOCKET;
+
+	if (!test_setup_client(instance, sockfd) || !test_setup_peer(peer) ||
+	    !test_run(peer, instance))
+		goto fail;
+
+	rc = 0;
+fail:
+	if (rc != 0)
+		fprintf(stderr, "TestAutodetect failed\n");
+
+	if (server != INVALID_SOCKET)
+		closesocket(server);
+
+	if (client != INVALID_SOCKET)
+		closesocket(client);
+
+	if (peer)
+	{
+		freerdp_peer_context_free(peer);
+		freerdp_peer_free(peer);
+	}
+
+	if (instance)
+	{
+		freerdp_context_free(instance);
+		freerdp_free(instance);
+	}
+
+	WSACleanup();
+	return rc;
+}
@@ -0,0 +1,440 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/wtsapi.h>
+#include <winpr/collections.h>
+
+#include <freerdp/svc.h>
+#include <freerdp/addin.h>
+#include <freerdp/peer.h>
+#include <freerdp/channels/drdynvc.h>
+#include <freerdp/channels/echo.h>
+#include <freerdp/client/cmdline.h>
+
+#include "../server.h"
+
+/*
+ * Connects the drdynvc client plugin, with the echo addin, to the server
+ * virtual channel manager in process. Static channel PDUs are handed over
+ * directly, so both sides run on this thread.
+ */
+
+#define TEST_CHANNEL_ID 1004
+#define TEST_OPEN_HANDLE 1
+#define TEST_MESSAGE_SIZE 10000
+
+typedef struct
+{
+	freerdp_peer* peer;
+	rdpContext* client;
+	LPVOID plugin;
+	PCHANNEL_INIT_EVENT_EX_FN InitEvent;
+	PCHANNEL_OPEN_EVENT_EX_FN OpenEvent;
+	wQueue* toServer;
+	wQueue* completed;
+	UINT32 toClientPdus[16];
+	UINT32 toServerPdus[16];
+	UINT16 version;
+	UINT16 charges[4];
+	BOOL segmented;
+} TestDvc;
+
+static TestDvc* s_test = NULL;
+
+static void test_count_pdu(TestDvc* test, UINT32* pdus, const BYTE* data, size_t size)
+{
+	const BYTE cmd = data[0] >> 4;
+	size_t offset = 1 + (1u << (data[0] & 0x03));
+
+	pdus[cmd]++;
+
+	if ((pdus == test->toClientPdus) && (cmd == CAPABILITY_REQUEST_PDU) && (size >= 12))
+	{
+		size_t index;
+
+		test->version = (UINT16)(data[2] | (data[3] << 8));
+
+		for (index = 0; index < ARRAYSIZE(test->charges); index++)
+			test->charges[index] = (UINT16)(data[4 + 2 * index] | (data[5 + 2 * index] << 8));
+	}
+
+	/* bulk data follows directly, without a RDP_SEGMENTED_DATA descriptor */
+	if (cmd == DATA_FIRST_COMPRESSED_PDU)
+		offset += 1u << ((data[0] >> 2) & 0x03);
+
+	if (((cmd == DATA_FIRST_COMPRESSED_PDU) || (cmd == DATA_COMPRESSED_PDU)) && (offset < size) &&
+	    ((data[offset] == 0xE0) || (data[offset] == 0xE1)))
+		test->segmented = TRUE;
+}
+
+static UINT VCAPITYPE test_init_ex(LPVOID lpUserParam, LPVOID clientContext, LPVOID pInitHandle,
+                                   PCHANNEL_DEF pChannel, INT channelCount, ULONG versionRequested,
+                                   PCHANNEL_INIT_EVENT_EX_FN pChannelInitEventProcEx)
+{
+	TestDvc* test = (TestDvc*)pInitHandle;
+
+	WINPR_UNUSED(clientContext);
+	WINPR_UNUSED(pChannel);
+	WINPR_UNUSED(channelCount);
+	WINPR_UNUSED(versionRequested);
+
+	test->plugin = lpUserParam;
+	test->InitEvent = pChannelInitEventProcEx;
+	return CHANNEL_RC_OK;
+}
+
+static UINT VCAPITYPE test_open_ex(LPVOID pInitHandle, LPDWORD pOpenHandle, PCHAR pChannelName,
+                                   PCHANNEL_OPEN_EVENT_EX_FN pChannelOpenEventProcEx)
+{
+	TestDvc* test = (TestDvc*)pInitHandle;
+
+	if (strcmp(pChannelName, DRDYNVC_SVC_CHANNEL_NAME) != 0)
+		return CHANNEL_RC_UNKNOWN_CHANNEL_NAME;
+
+	test->OpenEvent = pChannelOpenEventProcEx;
+	*pOpenHandle = TEST_OPEN_HANDLE;
+	return CHANNEL_RC_OK;
+}
+
+static UINT VCAPITYPE test_close_ex(LPVOID pInitHandle, DWORD openHandle)
+{
+	WINPR_UNUSED(pInitHandle);
+	WINPR_UNUSED(openHandle);
+	return CHANNEL_RC_OK;
+}
+
+static UINT VCAPITYPE test_write_ex(LPVOID pInitHandle, DWORD openHandle, LPVOID pData,
+                                    ULONG dataLength, LPVOID pUserData)
+{
+	wStream* s;
+	TestDvc* test = (TestDvc*)pInitHandle;
+
+	if (openHandle != TEST_OPEN_HANDLE)
+		return CHANNEL_RC_BAD_CHANNEL_HANDLE;
+
+	s = Stream_New(NULL, dataLength);
+
+	if (!s)
+		return CHANNEL_RC_NO_MEMORY;
+
+	Stream_Write(s, pData, dataLength);
+	Stream_SealLength(s);
+
+	if (!Queue_Enqueue(test->toServer, s) || !Queue_Enqueue(test->completed, pUserData))
+		return CHANNEL_RC_NO_MEMORY;
+
+	return CHANNEL_RC_OK;
+}
+
+static BOOL test_send_channel_data(freerdp_peer* peer, UINT16 channelId, const BYTE* data,
+                                   size_t size)
+{
+	TestDvc* test = s_test;
+
+	WINPR_UNUSED(peer);
+
+	if ((channelId != TEST_CHANNEL_ID) || (size == 0))
+		return FALSE;
+
+	test_count_pdu(test, test->toClientPdus, data, size);
+	test->OpenEvent(test->plugin, TEST_OPEN_HANDLE, CHANNEL_EVENT_DATA_RECEIVED, (LPVOID)data,
+	                (UINT32)size, (UINT32)size, CHANNEL_FLAG_FIRST | CHANNEL_FLAG_LAST);
+	return TRUE;
+}
+
+/* runs both sides until neither has anything left to send */
+static BOOL test_pump(TestDvc* test, HANDLE vcm)
+{
+	BOOL progress;
+
+	do
+	{
+		wStream* s;
+		void* userdata;
+
+		progress = FALSE;
+
+		if (!WTSVirtualChannelManagerCheckFileDescriptorEx(vcm, FALSE))
+			return FALSE;
+
+		while ((s = Queue_Dequeue(test->toServer)))
+		{
+			const size_t length = Stream_Length(s);
+			BOOL rc;
+
+			test_count_pdu(test, test->toServerPdus, Stream_Buffer(s), length);
+			rc = test->peer->ReceiveChannelData(test->peer, TEST_CHANNEL_ID, Stream_Buffer(s),
+			                                    length, CHANNEL_FLAG_FIRST | CHANNEL_FLAG_LAST,
+			                                    length);
+			Stream_Free(s, TRUE);
+
+			if (!rc)
+				return FALSE;
+
+			progress = TRUE;
+		}
+
+		while ((userdata = Queue_Dequeue(test->completed)))
+		{
+			test->OpenEvent(test->plugin, TEST_OPEN_HANDLE, CHANNEL_EVENT_WRITE_COMPLETE, userdata,
+			                0, 0, 0);
+			progress = TRUE;
+		}
+	} while (progress || (MessageQueue_Size(((WTSVirtualChannelManager*)vcm)->queue) > 0));
+
+	return TRUE;
+}
+
+static BOOL test_client_new(TestDvc* test)
+{
+	PVIRTUALCHANNELENTRYEX entry;
+	CHANNEL_ENTRY_POINTS_FREERDP_EX entryPoints = { 0 };
+	RDP_CLIENT_ENTRY_POINTS clientEntryPoints = { 0 };
+	const char* echo[] = { "echo" };
+
+	clientEntryPoints.Size = sizeof(RDP_CLIENT_ENTRY_POINTS);
+	clientEntryPoints.Version = RDP_CLIENT_INTERFACE_VERSION;
+	clientEntryPoints.ContextSize = sizeof(rdpClientContext);
+	test->client = freerdp_client_context_new(&clientEntryPoints);
+
+	if (!test->client)
+		return FALSE;
+
+	/* drdynvc handles PDUs on the calling thread */
+	if (!freerdp_settings_set_bool(test->client->settings, FreeRDP_TransportDumpReplay, TRUE) ||
+	    !freerdp_client_add_dynamic_channel(test->client->settings, ARRAYSIZE(echo), echo))
+		return FALSE;
+
+	entry = (PVIRTUALCHANNELENTRYEX)freerdp_load_channel_addin_entry(
+	    DRDYNVC_SVC_CHANNEL_NAME, NULL, NULL,
+	    FREERDP_ADDIN_CHANNEL_STATIC | FREERDP_ADDIN_CHANNEL_ENTRYEX);
+
+	if (!entry)
+		return FALSE;
+
+	entryPoints.cbSize = sizeof(entryPoints);
+	entryPoints.protocolVersion = VIRTUAL_CHANNEL_VERSION_WIN2000;
+	entryPoints.pVirtualChannelInitEx = test_init_ex;
+	entryPoints.pVirtualChannelOpenEx = test_open_ex;
+	entryPoints.pVirtualChannelCloseEx = test_close_ex;
+	entryPoints.pVirtualChannelWriteEx = test_write_ex;
+	entryPoints.MagicNumber = FREERDP_CHANNEL_MAGIC_NUMBER;
+	entryPoints.context = test->client;
+
+	if (!entry((PCHANNEL_ENTRY_POINTS_EX)&entryPoints, test) || !test->InitEvent)
+		return FALSE;
+
+	test->InitEvent(test->plugin, test, CHANNEL_EVENT_INITIALIZED, NULL, 0);
+	test->InitEvent(test->plugin, test, CHANNEL_EVENT_CONNECTED, NULL, 0);
+	return test->OpenEvent != NULL;
+}
+
+static BOOL test_server_new(TestDvc* test)
+{
+	rdpMcs* mcs;
+	rdpMcsChannel* channel;
+
+	test->peer = freerdp_peer_new((int)_socket(AF_INET, SOCK_STREAM, 0));
+
+	if (!test->peer || !freerdp_peer_context_new(test->peer))
+		return FALSE;
+
+	test->peer->SendChannelData = test_send_channel_data;
+	test->peer->BeginWriteBatch = NULL;
+	test->peer->EndWriteBatch = NULL;
+
+	mcs = test->peer->context->rdp->mcs;
+	channel = &mcs->channels[0];
+	sprintf_s(channel->Name, ARRAYSIZE(channel->Name), DRDYNVC_SVC_CHANNEL_NAME);
+	channel->ChannelId = TEST_CHANNEL_ID;
+	channel->joined = TRUE;
+	mcs->channelCount = 1;
+	return TRUE;
+}
+
+static BOOL test_echo(HANDLE vcm, TestDvc* test, BOOL compression)
+{
+	size_t index;
+	const UINT16 percent[] = { 70, 20, 7, 3 };
+	ULONG length;
+	ULONG received = 0;
+	BOOL rc = FALSE;
+	HANDLE channel = NULL;
+	BYTE* message = NULL;
+	BYTE* echo = NULL;
+	const DWORD sessionId = ((WTSVirtualChannelManager*)vcm)->SessionId;
+
+	WTSVirtualChannelManagerSetDVCCompression(vcm, compression);
+
+	if (!WTSVirtualChannelManagerOpen(vcm) || !test_pump(test, vcm))
+		goto fail;
+
+	if ((WTSVirtualChannelManagerGetDrdynvcState(vcm) != DRDYNVC_STATE_READY) ||
+	    (test->version != (compression ? DYNVC_CAPS_VERSION3 : DYNVC_CAPS_VERSION2)))
+		goto fail;
+
+	/* the history buffers only exist once version 3 was negotiated */
+	if (!((WTSVirtualChannelManager*)vcm)->dvc_compressor != !compression)
+		goto fail;
+
+	/* the advertised charges split the bandwidth 70/20/7/3 percent */
+	for (index = 0; index < ARRAYSIZE(percent); index++)
+	{
+		if (test->charges[index] != 65536 / percent[index])
+			goto fail;
+	}
+
+	channel = WTSVirtualChannelOpenEx(sessionId, ECHO_DVC_CHANNEL_NAME, WTS_CHANNEL_OPTION_DYNAMIC);
+
+	if (!channel || !test_pump(test, vcm))
+		goto fail;
+
+	message = (BYTE*)malloc(TEST_MESSAGE_SIZE);
+	echo = (BYTE*)calloc(1, TEST_MESSAGE_SIZE);
+
+	if (!message || !echo)
+		goto fail;
+
+	/* compressible but not trivially, so it spans several PDUs after compression */
+	for (length = 0; length < TEST_MESSAGE_SIZE; length++)
+		message[length] = (BYTE)((length % 251) ^ (length / 97));
+
+	if (!WTSVirtualChannelWrite(channel, (PCHAR)message, TEST_MESSAGE_SIZE, &length) ||
+	    (length != TEST_MESSAGE_SIZE) || !test_pump(test, vcm))
+		goto fail;
+
+	while (received < TEST_MESSAGE_SIZE)
+	{
+		if (!WTSVirtualChannelRead(channel, 0, (PCHAR)&echo[received],
+		                           TEST_MESSAGE_SIZE - received, &length) ||
+		    (length == 0))
+			goto fail;
+
+		received += length;
+	}
+
+	if (memcmp(message, echo, TEST_MESSAGE_SIZE) != 0)
+		goto fail;
+
+	if (test->segmented)
+		goto fail;
+
+	if (compression)
+	{
+		if ((test->toClientPdus[DATA_FIRST_COMPRESSED_PDU] == 0) ||
+		    (test->toClientPdus[DATA_COMPRESSED_PDU] == 0) ||
+		    (test->toServerPdus[DATA_FIRST_COMPRESSED_PDU] == 0) ||
+		    (test->toServerPdus[DATA_COMPRESSED_PDU] == 0))
+			goto fail;
+	}
+	else
+	{
+		if ((test->toClientPdus[DATA_FIRST_COMPRESSED_PDU] != 0) ||
+		    (test->toClientPdus[DATA_COMPRESSED_PDU] != 0) ||
+		    (test->toServerPdus[DATA_FIRST_COMPRESSED_PDU] != 0) ||
+		    (test->toServerPdus[DATA_COMPRESSED_PDU] != 0) ||
+		    (test->toClientPdus[DATA_FIRST_PDU] == 0))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (channel)
+		WTSVirtualChannelClose(channel);
+
+	free(message);
+	free(echo);
+	return rc;
+}
+
+static BOOL test_run(BOOL compression)
+{
+	BOOL rc = FALSE;
+	HANDLE vcm = INVALID_HANDLE_VALUE;
+	TestDvc* test = (TestDvc*)calloc(1, sizeof(TestDvc));
+
+	if (!test)
+		return FALSE;
+
+	s_test = test;
+	test->toServer = Queue_New(TRUE, -1, -1);
+	test->completed = Queue_New(TRUE, -1, -1);
+
+	if (!test->toServer || !test->completed)
+		goto fail;
+
+	if (!test_server_new(test) || !test_client_new(test))
+		goto fail;
+
+	vcm = WTSOpenServerA((LPSTR)test->peer->context);
+
+	if (!vcm || (vcm == INVALID_HANDLE_VALUE))
+		goto fail;
+
+	rc = test_echo(vcm, test, compression);
+
+	if (!rc)
+		fprintf(stderr, "TestDvcCompression: echo with compression %s failed\n",
+		        compression ? "on" : "off");
+
+fail:
+	if (test->completed)
+	{
+		void* userdata;
+
+		while ((userdata = Queue_Dequeue(test->completed)))
+			test->OpenEvent(test->plugin, TEST_OPEN_HANDLE, CHANNEL_EVENT_WRITE_CANCELLED,
+			                userdata, 0, 0, 0);
+	}
+
+	if (test->InitEvent)
+	{
+		if (test->OpenEvent)
+			test->InitEvent(test->plugin, test, CHANNEL_EVENT_DISCONNECTED, NULL, 0);
+
+		test->InitEvent(test->plugin, test, CHANNEL_EVENT_TERMINATED, NULL, 0);
+	}
+
+	if (vcm && (vcm != INVALID_HANDLE_VALUE))
+		WTSCloseServer(vcm);
+
+	if (test->peer)
+	{
+		freerdp_peer_context_free(test->peer);
+		freerdp_peer_free(test->peer);
+	}
+
+	freerdp_client_context_free(test->client);
+
+	if (test->toServer)
+	{
+		wStream* s;
+
+		while ((s = Queue_Dequeue(test->toServer)))
+			Stream_Free(s, TRUE);
+
+		Queue_Free(test->toServer);
+	}
+
+	Queue_Free(test->completed);
+	free(test);
+	s_test = NULL;
+	return rc;
+}
+
+int TestDvcCompression(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!WTSRegisterWtsApiFunctionTable(FreeRDP_InitWtsApi()))
+		return -1;
+
+	if (!test_run(FALSE))
+		return -1;
+
+	if (!test_run(TRUE))
+		return -1;
+
+	return 0;
+}
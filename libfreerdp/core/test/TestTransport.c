@@ -0,0 +1,244 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/winsock.h>
+
+#include <freerdp/freerdp.h>
+
+#include "../rdp.h"
+#include "../transport.h"
+
+/*
+ * Feeds TPKT PDUs through a loopback connection into transport_check_fds. The sends are
+ * sized so a read fills the read ahead buffer exactly to its end while a PDU is still
+ * incomplete, which wraps the write position of the ring buffer.
+ */
+
+#define TEST_BUFFER_SIZE 16384
+#define TEST_RING_SIZE (2 * TEST_BUFFER_SIZE)
+#define TEST_MAX_PDUS 8
+
+typedef struct
+{
+	size_t length;
+	BYTE* data;
+} TestPdu;
+
+typedef struct
+{
+	freerdp* instance;
+	rdpTransport* transport;
+	SOCKET peer;
+	TestPdu pdus[TEST_MAX_PDUS];
+	size_t count;
+	size_t sent;
+	size_t received;
+	BOOL mismatch;
+} TestLoopback;
+
+static int test_recv(rdpTransport* transport, wStream* s, void* extra)
+{
+	TestLoopback* test = (TestLoopback*)extra;
+	const TestPdu* pdu;
+
+	WINPR_UNUSED(transport);
+
+	if (test->received >= test->count)
+	{
+		test->mismatch = TRUE;
+		return -1;
+	}
+
+	pdu = &test->pdus[test->received++];
+
+	if ((Stream_Length(s) != pdu->length) ||
+	    (memcmp(Stream_Buffer(s), pdu->data, pdu->length) != 0))
+	{
+		fprintf(stderr, "TestTransport: PDU %" PRIuz " corrupted\n", test->received - 1);
+		test->mismatch = TRUE;
+		return -1;
+	}
+
+	return 0;
+}
+
+static BOOL test_add_pdu(TestLoopback* test, size_t length)
+{
+	size_t i;
+	TestPdu* pdu = &test->pdus[test->count];
+
+	if ((test->count >= TEST_MAX_PDUS) || (length < 7) || (length > 0xFFFF))
+		return FALSE;
+
+	pdu->data = malloc(length);
+	if (!pdu->data)
+		return FALSE;
+
+	pdu->length = length;
+	pdu->data[0] = 0x03; /* TPKT version */
+	pdu->data[1] = 0x00;
+	pdu->data[2] = (BYTE)(length >> 8);
+	pdu->data[3] = (BYTE)(length & 0xFF);
+
+	for (i = 4; i < length; i++)
+		pdu->data[i] = (BYTE)(i * 7 + test->count);
+
+	test->count++;
+	return TRUE;
+}
+
+/* sends the next length bytes of the PDU stream */
+static BOOL test_send(TestLoopback* test, size_t length)
+{
+	size_t i;
+	size_t offset = 0;
+
+	for (i = 0; (i < test->count) && (length > 0); i++)
+	{
+		const TestPdu* pdu = &test->pdus[i];
+
+		if (test->sent < offset + pdu->length)
+		{
+			const size_t start = test->sent - offset;
+			const size_t chunk = MIN(length, pdu->length - start);
+
+			if (_send(test->peer, (const char*)&pdu->data[start], (int)chunk, 0) != (int)chunk)
+				return FALSE;
+
+			test->sent += chunk;
+			length -= chunk;
+		}
+
+		offset += pdu->length;
+	}
+
+	return length == 0;
+}
+
+/* runs transport_check_fds until the expected number of PDUs arrived */
+static BOOL test_receive(TestLoopback* test, size_t expected)
+{
+	size_t i;
+
+	for (i = 0; i < 100; i++)
+	{
+		if (transport_check_fds(test->transport) < 0)
+		{
+			fprintf(stderr, "TestTransport: transport_check_fds failed after %" PRIuz " PDUs\n",
+			        test->received);
+			return FALSE;
+		}
+
+		if (test->received >= expected)
+			break;
+
+		Sleep(10);
+	}
+
+	return !test->mismatch && (test->received == expected);
+}
+
+static BOOL test_connect(TestLoopback* test)
+{
+	BOOL rc = FALSE;
+	struct sockaddr_in addr = { 0 };
+	int length = sizeof(addr);
+	SOCKET server;
+	SOCKET client = INVALID_SOCKET;
+
+	server = _socket(AF_INET, SOCK_STREAM, 0);
+	if (server == INVALID_SOCKET)
+		return FALSE;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	if ((_bind(server, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (_listen(server, 1) != 0) ||
+	    (_getsockname(server, (struct sockaddr*)&addr, &length) != 0))
+		goto fail;
+
+	client = _socket(AF_INET, SOCK_STREAM, 0);
+	if ((client == INVALID_SOCKET) ||
+	    (_connect(client, (struct sockaddr*)&addr, sizeof(addr)) != 0))
+		goto fail;
+
+	length = sizeof(addr);
+	test->peer = _accept(server, (struct sockaddr*)&addr, &length);
+	if (test->peer == INVALID_SOCKET)
+		goto fail;
+
+	/* the transport owns the socket from here on */
+	rc = transport_attach(test->transport, (int)client);
+	client = INVALID_SOCKET;
+fail:
+	if (client != INVALID_SOCKET)
+		closesocket(client);
+	closesocket(server);
+	return rc;
+}
+
+int TestTransport(int argc, char* argv[])
+{
+	int rc = -1;
+	size_t i;
+	TestLoopback test = { 0 };
+	WSADATA wsaData;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	test.peer = INVALID_SOCKET;
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return -1;
+
+	test.instance = freerdp_new();
+	if (!test.instance || !freerdp_context_new(test.instance))
+		goto fail;
+
+	test.transport = test.instance->context->rdp->transport;
+
+	if (!test_connect(&test) || !transport_set_blocking_mode(test.transport, FALSE) ||
+	    !transport_set_recv_callbacks(test.transport, test_recv, &test))
+		goto fail;
+
+	/*
+	 * A fills the first half of the buffer and stays incomplete. The next read fills the
+	 * buffer to its end, so the ring wraps with the rest of A, B and the start of C buffered.
+	 */
+	if (!test_add_pdu(&test, TEST_BUFFER_SIZE + 100) || !test_add_pdu(&test, 8000) ||
+	    !test_add_pdu(&test, 9000) || !test_add_pdu(&test, 1000))
+		goto fail;
+
+	if (!test_send(&test, TEST_BUFFER_SIZE) || !test_receive(&test, 0))
+		goto fail;
+
+	if (!test_send(&test, TEST_RING_SIZE - TEST_BUFFER_SIZE) || !test_receive(&test, 2))
+		goto fail;
+
+	/* A and B are consumed, the rest of C must be appended behind its start */
+	if (!test_send(&test, test.pdus[0].length + test.pdus[1].length + test.pdus[2].length +
+	                          test.pdus[3].length - test.sent) ||
+	    !test_receive(&test, test.count))
+		goto fail;
+
+	rc = 0;
+fail:
+	if (rc != 0)
+		fprintf(stderr, "TestTransport failed\n");
+
+	if (test.peer != INVALID_SOCKET)
+		closesocket(test.peer);
+
+	if (test.instance)
+		freerdp_context_free(test.instance);
+
+	freerdp_free(test.instance);
+
+	for (i = 0; i < test.count; i++)
+		free(test.pdus[i].data);
+
+	WSACleanup();
+	return rc;
+}
@@ -57,6 +57,10 @@
 
 #define BUFFER_SIZE 16384
 
+/* Coalesced output is flushed when it would exceed one TLS record or got this old (ms) */
+#define WRITE_BATCH_SIZE 16384
+#define WRITE_BATCH_TIMEOUT 10
+
 struct rdp_transport
 {
 	TRANSPORT_LAYER layer;
@@ -81,8 +85,17 @@ struct rdp_transport
 	BOOL haveMoreBytesToRead;
 	wLog* log;
 	rdpTransportIo io;
+	RingBuffer ReadBuffer;
+	size_t ReadBufferReserved;
+	wStream* WriteBuffer;
+	UINT32 WriteBatchDepth;
+	UINT64 WriteBufferDue;
+	HANDLE WriteTimer;
 };
 
+static int transport_default_read_pdu(rdpTransport* transport, wStream* s);
+static size_t transport_buffered_bytes(const rdpTransport* transport);
+
 static void transport_ssl_cb(SSL* ssl, int where, int ret)
 {
 	if (where & SSL_CB_ALERT)
@@ -210,6 +223,16 @@ BOOL transport_connect_rdp(rdpTransport* transport)
 	}
 }
 
+/* Data read ahead on the plain connection would be lost when TLS is put on top of it */
+static BOOL transport_check_read_buffer_empty(rdpTransport* transport)
+{
+	if (transport_buffered_bytes(transport) == 0)
+		return TRUE;
+
+	WLog_Print(transport->log, WLOG_ERROR, "unexpected data received before the TLS handshake");
+	return FALSE;
+}
+
 BOOL transport_connect_tls(rdpTransport* transport)
 {
 	const rdpSettings* settings;
@@ -250,6 +273,9 @@ static BOOL transport_default_connect_tls(rdpTransport* transport)
 	settings = context->settings;
 	WINPR_ASSERT(settings);
 
+	if (!transport_check_read_buffer_empty(transport))
+		return FALSE;
+
 	if (!(tls = tls_new(settings)))
 		return FALSE;
 
@@ -470,6 +496,9 @@ static BOOL transport_default_accept_tls(rdpTransport* transport)
 	settings = context->settings;
 	WINPR_ASSERT(settings);
 
+	if (!transport_check_read_buffer_empty(transport))
+		return FALSE;
+
 	if (!transport->tls)
 		transport->tls = tls_new(settings);
 
@@ -560,7 +589,8 @@ static void transport_bio_error_log(rdpTransport* transport, LPCSTR biofunc, BIO
 	}
 }
 
-static SSIZE_T transport_read_layer(rdpTransport* transport, BYTE* data, size_t bytes)
+static SSIZE_T transport_read_layer_ex(rdpTransport* transport, BYTE* data, size_t bytes,
+                                      BOOL exact)
 {
 	SSIZE_T read = 0;
 	rdpRdp* rdp;
@@ -609,7 +639,7 @@ static SSIZE_T transport_read_layer(rdpTransport* transport, BYTE* data, size_t
 			}
 
 			/* non blocking will survive a partial read */
-			if (!transport->blocking)
+			if (!transport->blocking || !exact)
 				return read;
 
 			/* blocking means that we can't continue until we have read the number of requested
@@ -628,11 +658,172 @@ static SSIZE_T transport_read_layer(rdpTransport* transport, BYTE* data, size_t
 #endif
 		read += status;
 		rdp->inBytes += status;
+
+		if (!exact)
+			break;
 	}
 
 	return read;
 }
 
+static SSIZE_T transport_read_layer(rdpTransport* transport, BYTE* data, size_t bytes)
+{
+	return transport_read_layer_ex(transport, data, bytes, TRUE);
+}
+
+/* Bytes in the read buffer that were not handed out yet */
+static size_t transport_buffered_bytes(const rdpTransport* transport)
+{
+	WINPR_ASSERT(transport);
+	return ringbuffer_used(&transport->ReadBuffer) - transport->ReadBufferReserved;
+}
+
+/**
+ * @brief Copies up to bytes bytes from the read buffer
+ *
+ * While a PDU is dispatched directly from the read buffer the buffer must not move, so the
+ * bytes read by a nested transport_read_pdu() are only reserved and released with the PDU.
+ *
+ * @return the number of bytes copied
+ */
+static size_t transport_read_buffered(rdpTransport* transport, BYTE* data, size_t bytes)
+{
+	int x;
+	int count;
+	size_t copied = 0;
+	DataChunk chunks[2] = { 0 };
+	size_t skip = transport->ReadBufferReserved;
+
+	count = ringbuffer_peek(&transport->ReadBuffer, chunks, skip + bytes);
+
+	for (x = 0; x < count; x++)
+	{
+		size_t len;
+		const DataChunk* chunk = &chunks[x];
+
+		if (skip >= chunk->size)
+		{
+			skip -= chunk->size;
+			continue;
+		}
+
+		len = chunk->size - skip;
+		CopyMemory(&data[copied], &chunk->data[skip], len);
+		copied += len;
+		skip = 0;
+	}
+
+	if (transport->ReadBufferReserved > 0)
+		transport->ReadBufferReserved += copied;
+	else
+		ringbuffer_commit_read_bytes(&transport->ReadBuffer, copied);
+
+	return copied;
+}
+
+static void transport_reset_read_buffer(rdpTransport* transport)
+{
+	WINPR_ASSERT(transport);
+	ringbuffer_commit_read_bytes(&transport->ReadBuffer, ringbuffer_used(&transport->ReadBuffer));
+	transport->ReadBufferReserved = 0;
+}
+
+/**
+ * @brief Reads whatever the transport has available, up to BUFFER_SIZE bytes, into the read
+ * buffer
+ *
+ * Only linear writes are used, so the buffered data never wraps and complete PDUs can be
+ * handed out without a copy.
+ *
+ * @return < 0 on error; 0 if no data is available; > 0 number of bytes read
+ */
+static SSIZE_T transport_fill_read_buffer(rdpTransport* transport)
+{
+	BYTE* data;
+	SSIZE_T status;
+
+	WINPR_ASSERT(transport);
+	WINPR_ASSERT(transport->ReadBufferReserved == 0);
+
+	data = ringbuffer_ensure_linear_write(&transport->ReadBuffer, BUFFER_SIZE);
+
+	if (!data)
+		return -1;
+
+	status = transport_read_layer_ex(transport, data, BUFFER_SIZE, FALSE);
+
+	if (status <= 0)
+		return status;
+
+	if (!ringbuffer_commit_written_bytes(&transport->ReadBuffer, (size_t)status))
+		return -1;
+
+	return status;
+}
+
+/**
+ * @brief Checks if the read buffer starts with a complete PDU
+ *
+ * @param[in] transport rdpTransport
+ * @param[out] data set to the start of the PDU in the read buffer
+ * @return < 0 on error; 0 if no complete PDU is buffered; > 0 length of the PDU
+ */
+static SSIZE_T transport_buffered_pdu(rdpTransport* transport, BYTE** data)
+{
+	size_t x;
+	SSIZE_T length = 0;
+	BOOL incomplete = TRUE;
+	DataChunk chunks[2] = { 0 };
+	wStream sbuffer = { 0 };
+	wStream* s;
+	const size_t used = ringbuffer_used(&transport->ReadBuffer);
+	const int count = ringbuffer_peek(&transport->ReadBuffer, chunks, used);
+
+	if (count < 1)
+		return 0;
+
+	if (count != 1)
+	{
+		WLog_Print(transport->log, WLOG_ERROR, "read buffer is not linear");
+		return -1;
+	}
+
+	s = Stream_StaticConstInit(&sbuffer, chunks[0].data, chunks[0].size);
+
+	/* transport_parse_pdu() takes the position as the number of bytes read, which must not
+	 * exceed the PDU length. Grow it one header byte at a time. */
+	for (x = 2; (x <= MIN(chunks[0].size, 4)) && (length == 0); x++)
+	{
+		Stream_SetPosition(s, x);
+		length = transport_parse_pdu(transport, s, &incomplete);
+	}
+
+	if (length <= 0)
+		return length;
+
+	if ((size_t)length > chunks[0].size)
+		return 0;
+
+	*data = (BYTE*)chunks[0].data;
+	return length;
+}
+
+/* The buffered receive path only applies to the default I/O callbacks and can not be entered
+ * while a PDU is already being dispatched from the read buffer. */
+static BOOL transport_use_read_buffer(rdpTransport* transport)
+{
+	WINPR_ASSERT(transport);
+
+	if (transport->ReadBufferReserved > 0)
+		return FALSE;
+
+	if (Stream_GetPosition(transport->ReceiveBuffer) != 0)
+		return FALSE;
+
+	return (transport->io.ReadPdu == transport_default_read_pdu) &&
+	       (transport->io.ReadBytes == transport_read_layer);
+}
+
 /**
  * @brief Tries to read toRead bytes from the specified transport
  *
@@ -656,6 +847,19 @@ static SSIZE_T transport_read_layer_bytes(rdpTransport* transport, wStream* s, s
 	if (toRead > SSIZE_MAX)
 		return 0;
 
+	/* Serve data already read ahead by transport_check_fds() first */
+	if (transport_buffered_bytes(transport) > 0)
+	{
+		const size_t copied = transport_read_buffered(transport, Stream_Pointer(s), toRead);
+
+		Stream_Seek(s, copied);
+
+		if (copied == toRead)
+			return 1;
+
+		toRead -= copied;
+	}
+
 	status = IFCALLRESULT(-1, transport->io.ReadBytes, transport, Stream_Pointer(s), toRead);
 
 	if (status <= 0)
@@ -867,44 +1071,18 @@ int transport_write(rdpTransport* transport, wStream* s)
 	return IFCALLRESULT(-1, transport->io.WritePdu, transport, s);
 }
 
-static int transport_default_write(rdpTransport* transport, wStream* s)
+/* Writes data to the front BIO, the WriteLock must be held */
+static int transport_write_layer(rdpTransport* transport, const BYTE* data, size_t length)
 {
-	size_t length;
 	int status = -1;
-	int writtenlength = 0;
-	rdpRdp* rdp;
 	rdpContext* context = transport_get_context(transport);
 
-	WINPR_ASSERT(transport);
 	WINPR_ASSERT(context);
 
-	if (!s)
-		return -1;
-
-	Stream_AddRef(s);
-
-	rdp = context->rdp;
-	if (!rdp)
-		goto fail;
-
-	EnterCriticalSection(&(transport->WriteLock));
-	if (!transport->frontBio)
-		goto out_cleanup;
-
-	length = Stream_GetPosition(s);
-	writtenlength = length;
-	Stream_SetPosition(s, 0);
-
-	if (length > 0)
-	{
-		rdp->outBytes += length;
-		WLog_Packet(transport->log, WLOG_TRACE, Stream_Buffer(s), length, WLOG_PACKET_OUTBOUND);
-	}
-
 	while (length > 0)
 	{
 		ERR_clear_error();
-		status = BIO_write(transport->frontBio, Stream_Pointer(s), length);
+		status = BIO_write(transport->frontBio, data, length);
 
 		if (status <= 0)
 		{
@@ -915,21 +1093,20 @@ static int transport_default_write(rdpTransport* transport, wStream* s)
 			if (!BIO_should_retry(transport->frontBio))
 			{
 				WLog_ERR_BIO(transport, "BIO_should_retry", transport->frontBio);
-				goto out_cleanup;
+				return -1;
 			}
 
 			/* non-blocking can live with blocked IOs */
 			if (!transport->blocking)
 			{
 				WLog_ERR_BIO(transport, "BIO_write", transport->frontBio);
-				goto out_cleanup;
+				return -1;
 			}
 
 			if (BIO_wait_write(transport->frontBio, 100) < 0)
 			{
 				WLog_ERR_BIO(transport, "BIO_wait_write", transport->frontBio);
-				status = -1;
-				goto out_cleanup;
+				return -1;
 			}
 
 			continue;
@@ -943,39 +1120,196 @@ static int transport_default_write(rdpTransport* transport, wStream* s)
 				if (BIO_wait_write(transport->frontBio, 100) < 0)
 				{
 					WLog_Print(transport->log, WLOG_ERROR, "error when selecting for write");
-					status = -1;
-					goto out_cleanup;
+					return -1;
 				}
 
 				if (BIO_flush(transport->frontBio) < 1)
 				{
 					WLog_Print(transport->log, WLOG_ERROR, "error when flushing outputBuffer");
-					status = -1;
-					goto out_cleanup;
+					return -1;
 				}
 			}
 		}
 
-		length -= status;
-		Stream_Seek(s, status);
+		length -= (size_t)status;
+		data += status;
 	}
 
-	transport->written += writtenlength;
-out_cleanup:
+	return status;
+}
+
+static void transport_write_failed(rdpTransport* transport)
+{
+	rdpContext* context = transport_get_context(transport);
+
+	/* A write error indicates that the peer has dropped the connection */
+	transport->layer = TRANSPORT_LAYER_CLOSED;
+	freerdp_set_last_error_if_not(context, FREERDP_ERROR_CONNECT_TRANSPORT_FAILED);
+}
+
+/* Sends the coalesced output in one write, the WriteLock must be held */
+static int transport_flush_write_buffer(rdpTransport* transport)
+{
+	int status;
+	const size_t length = Stream_GetPosition(transport->WriteBuffer);
+
+	if (length == 0)
+		return 0;
+
+	Stream_SetPosition(transport->WriteBuffer, 0);
+
+	if (!transport->frontBio)
+		return -1;
+
+	status = transport_write_layer(transport, Stream_Buffer(transport->WriteBuffer), length);
 
 	if (status < 0)
+		transport_write_failed(transport);
+
+	return status;
+}
+
+static int transport_default_write(rdpTransport* transport, wStream* s)
+{
+	size_t length;
+	int status = -1;
+	rdpRdp* rdp;
+	rdpContext* context = transport_get_context(transport);
+
+	WINPR_ASSERT(transport);
+	WINPR_ASSERT(context);
+
+	if (!s)
+		return -1;
+
+	Stream_AddRef(s);
+
+	rdp = context->rdp;
+	if (!rdp)
+		goto fail;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	if (!transport->frontBio)
+		goto out_cleanup;
+
+	length = Stream_GetPosition(s);
+
+	if (length > 0)
 	{
-		/* A write error indicates that the peer has dropped the connection */
-		transport->layer = TRANSPORT_LAYER_CLOSED;
-		freerdp_set_last_error_if_not(context, FREERDP_ERROR_CONNECT_TRANSPORT_FAILED);
+		rdp->outBytes += length;
+		WLog_Packet(transport->log, WLOG_TRACE, Stream_Buffer(s), length, WLOG_PACKET_OUTBOUND);
 	}
 
+	if ((transport->WriteBatchDepth > 0) && (length < WRITE_BATCH_SIZE))
+	{
+		const UINT64 now = GetTickCount64();
+
+		/* Queue the PDU, the whole batch goes out as one TLS record */
+		if (Stream_GetPosition(transport->WriteBuffer) + length > WRITE_BATCH_SIZE)
+		{
+			if (transport_flush_write_buffer(transport) < 0)
+				goto out_cleanup;
+		}
+
+		if (Stream_GetPosition(transport->WriteBuffer) == 0)
+		{
+			LARGE_INTEGER due;
+
+			/* The timer wakes up the event loop when the batch is not ended in time */
+			transport->WriteBufferDue = now + WRITE_BATCH_TIMEOUT;
+			due.QuadPart = -10000LL * WRITE_BATCH_TIMEOUT;
+			SetWaitableTimer(transport->WriteTimer, &due, 0, NULL, NULL, FALSE);
+		}
+
+		Stream_Write(transport->WriteBuffer, Stream_Buffer(s), length);
+		status = (int)length;
+
+		if (now >= transport->WriteBufferDue)
+		{
+			if (transport_flush_write_buffer(transport) < 0)
+			{
+				status = -1;
+				goto out_cleanup;
+			}
+		}
+	}
+	else
+	{
+		/* Keep the order, anything queued goes first */
+		if (transport_flush_write_buffer(transport) < 0)
+			goto out_cleanup;
+
+		status = transport_write_layer(transport, Stream_Buffer(s), length);
+	}
+
+	Stream_SetPosition(s, length);
+
+	if (status >= 0)
+		transport->written += length;
+out_cleanup:
+
+	if (status < 0)
+		transport_write_failed(transport);
+
 	LeaveCriticalSection(&(transport->WriteLock));
 fail:
 	Stream_Release(s);
 	return status;
 }
 
+BOOL transport_begin_write_batch(rdpTransport* transport)
+{
+	WINPR_ASSERT(transport);
+
+	EnterCriticalSection(&(transport->WriteLock));
+	transport->WriteBatchDepth++;
+	LeaveCriticalSection(&(transport->WriteLock));
+	return TRUE;
+}
+
+BOOL transport_end_write_batch(rdpTransport* transport)
+{
+	int status = 0;
+
+	WINPR_ASSERT(transport);
+
+	EnterCriticalSection(&(transport->WriteLock));
+	if (transport->WriteBatchDepth == 0)
+	{
+		WLog_Print(transport->log, WLOG_WARN, "unbalanced write batch");
+		status = -1;
+	}
+	else if (--transport->WriteBatchDepth == 0)
+		status = transport_flush_write_buffer(transport);
+	LeaveCriticalSection(&(transport->WriteLock));
+	return status >= 0;
+}
+
+BOOL transport_flush(rdpTransport* transport)
+{
+	int status;
+
+	WINPR_ASSERT(transport);
+
+	EnterCriticalSection(&(transport->WriteLock));
+	status = transport_flush_write_buffer(transport);
+	LeaveCriticalSection(&(transport->WriteLock));
+	return status >= 0;
+}
+
+/* Enforces the time bound on output queued by a long running batch */
+static BOOL transport_flush_if_due(rdpTransport* transport)
+{
+	int status = 0;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	if ((Stream_GetPosition(transport->WriteBuffer) > 0) &&
+	    (GetTickCount64() >= transport->WriteBufferDue))
+		status = transport_flush_write_buffer(transport);
+	LeaveCriticalSection(&(transport->WriteLock));
+	return status >= 0;
+}
+
 DWORD transport_get_event_handles(rdpTransport* transport, HANDLE* events, DWORD count)
 {
 	DWORD nCount = 1; /* always the reread Event */
@@ -1044,6 +1378,9 @@ DWORD transport_get_event_handles(rdpTransport* transport, HANDLE* events, DWORD
 		}
 	}
 
+	if (events && (nCount < count))
+		events[nCount++] = transport->WriteTimer;
+
 	return nCount;
 }
 
@@ -1083,6 +1420,10 @@ int transport_drain_output_buffer(rdpTransport* transport)
 
 	WINPR_ASSERT(transport);
 	WINPR_ASSERT(transport->frontBio);
+
+	if (!transport_flush(transport))
+		return -1;
+
 	if (BIO_write_blocked(transport->frontBio))
 	{
 		if (BIO_flush(transport->frontBio) < 1)
@@ -1094,6 +1435,86 @@ int transport_drain_output_buffer(rdpTransport* transport)
 	return status;
 }
 
+static void transport_set_reread(rdpTransport* transport)
+{
+	SetEvent(transport->rereadEvent);
+	transport->haveMoreBytesToRead = TRUE;
+}
+
+/**
+ * Reads everything the transport has into the read buffer and hands each complete PDU to the
+ * ReceiveCallback straight from there, so a wakeup costs one read for a batch of PDUs instead
+ * of two reads per PDU.
+ */
+static int transport_check_fds_buffered(rdpTransport* transport, UINT64 dueDate)
+{
+	UINT64 now = GetTickCount64();
+	rdpContext* context = transport_get_context(transport);
+
+	while (now < dueDate)
+	{
+		int recv_status;
+		BYTE* data = NULL;
+		wStream sbuffer = { 0 };
+		wStream* received;
+		SSIZE_T length;
+
+		if (freerdp_shall_disconnect_context(context))
+			return -1;
+
+		length = transport_buffered_pdu(transport, &data);
+
+		if (length < 0)
+			return -1;
+
+		if (length == 0)
+		{
+			const SSIZE_T status = transport_fill_read_buffer(transport);
+
+			if (status < 0)
+				WLog_Print(transport->log, WLOG_DEBUG,
+				           "transport_check_fds: transport_fill_read_buffer() - %" PRIdz, status);
+
+			if (status <= 0)
+				return (int)status;
+
+			continue;
+		}
+
+		received = Stream_StaticInit(&sbuffer, data, (size_t)length);
+		WLog_Packet(transport->log, WLOG_TRACE, data, (size_t)length, WLOG_PACKET_INBOUND);
+
+		/* The PDU stays in the read buffer until the callback returns */
+		transport->ReadBufferReserved = (size_t)length;
+		WINPR_ASSERT(transport->ReceiveCallback);
+		recv_status = transport->ReceiveCallback(transport, received, transport->ReceiveExtra);
+		ringbuffer_commit_read_bytes(&transport->ReadBuffer, transport->ReadBufferReserved);
+		transport->ReadBufferReserved = 0;
+
+		/* session redirection or activation */
+		if (recv_status == 1 || recv_status == 2)
+		{
+			/* The socket will not signal data that is already buffered */
+			if (transport_buffered_bytes(transport) > 0)
+				transport_set_reread(transport);
+
+			return recv_status;
+		}
+
+		if (recv_status < 0)
+		{
+			WLog_Print(transport->log, WLOG_ERROR,
+			           "transport_check_fds: transport->ReceiveCallback() - %i", recv_status);
+			return -1;
+		}
+
+		now = GetTickCount64();
+	}
+
+	transport_set_reread(transport);
+	return 0;
+}
+
 int transport_check_fds(rdpTransport* transport)
 {
 	int status;
@@ -1115,12 +1536,18 @@ int transport_check_fds(rdpTransport* transport)
 	WINPR_ASSERT(context->settings);
 	dueDate = now + context->settings->MaxTimeInCheckLoop;
 
+	if (!transport_flush_if_due(transport))
+		return -1;
+
 	if (transport->haveMoreBytesToRead)
 	{
 		transport->haveMoreBytesToRead = FALSE;
 		ResetEvent(transport->rereadEvent);
 	}
 
+	if (transport_use_read_buffer(transport))
+		return transport_check_fds_buffered(transport, dueDate);
+
 	while (now < dueDate)
 	{
 		WINPR_ASSERT(context);
@@ -1179,10 +1606,7 @@ int transport_check_fds(rdpTransport* transport)
 	}
 
 	if (now >= dueDate)
-	{
-		SetEvent(transport->rereadEvent);
-		transport->haveMoreBytesToRead = TRUE;
-	}
+		transport_set_reread(transport);
 
 	return 0;
 }
@@ -1251,6 +1675,10 @@ static BOOL transport_default_disconnect(rdpTransport* transport)
 
 	transport->frontBio = NULL;
 	transport->layer = TRANSPORT_LAYER_TCP;
+	transport_reset_read_buffer(transport);
+
+	if (transport->WriteBuffer)
+		Stream_SetPosition(transport->WriteBuffer, 0);
 	return status;
 }
 
@@ -1289,6 +1717,21 @@ rdpTransport* transport_new(rdpContext* context)
 	if (!transport->ReceiveBuffer)
 		goto fail;
 
+	/* read ahead buffer for transport_check_fds */
+	if (!ringbuffer_init(&transport->ReadBuffer, BUFFER_SIZE * 2))
+		goto fail;
+
+	/* coalescing buffer for write batches */
+	transport->WriteBuffer = Stream_New(NULL, WRITE_BATCH_SIZE);
+
+	if (!transport->WriteBuffer)
+		goto fail;
+
+	transport->WriteTimer = CreateWaitableTimerA(NULL, FALSE, NULL);
+
+	if (!transport->WriteTimer)
+		goto fail;
+
 	transport->connectedEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
 	if (!transport->connectedEvent || transport->connectedEvent == INVALID_HANDLE_VALUE)
@@ -1327,6 +1770,10 @@ void transport_free(rdpTransport* transport)
 		Stream_Release(transport->ReceiveBuffer);
 
 	nla_free(transport->nla);
+	ringbuffer_destroy(&transport->ReadBuffer);
+	Stream_Free(transport->WriteBuffer, TRUE);
+	if (transport->WriteTimer)
+		CloseHandle(transport->WriteTimer);
 	StreamPool_Free(transport->ReceivePool);
 	CloseHandle(transport->connectedEvent);
 	CloseHandle(transport->rereadEvent);
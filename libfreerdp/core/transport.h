@@ -82,6 +82,10 @@ FREERDP_LOCAL void transport_set_nla_mode(rdpTransport* transport, BOOL NlaMode)
 FREERDP_LOCAL BOOL transport_is_write_blocked(rdpTransport* transport);
 FREERDP_LOCAL int transport_drain_output_buffer(rdpTransport* transport);
 
+FREERDP_LOCAL BOOL transport_begin_write_batch(rdpTransport* transport);
+FREERDP_LOCAL BOOL transport_end_write_batch(rdpTransport* transport);
+FREERDP_LOCAL BOOL transport_flush(rdpTransport* transport);
+
 FREERDP_LOCAL wStream* transport_receive_pool_take(rdpTransport* transport);
 FREERDP_LOCAL int transport_receive_pool_return(rdpTransport* transport, wStream* pdu);
 
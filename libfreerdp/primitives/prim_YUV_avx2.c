@@ -0,0 +1,409 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * AVX2 RGB to YUV conversion operations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/sysinfo.h>
+#include <winpr/crt.h>
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+#include <immintrin.h>
+
+#if !defined(WITH_AVX2)
+#error "This file needs WITH_AVX2 enabled!"
+#endif
+
+/* The previously selected (SSSE3 or generic) versions, used for the
+ * columns that do not fill a whole 32 pixel block */
+static __RGBToYUV420_8u_P3AC4R_t fallback_RGBToYUV420 = NULL;
+static __RGBToAVC444YUV_t fallback_RGBToAVC444YUV = NULL;
+
+/****************************************************************************/
+/* AVX2 RGB -> YUV420 conversion                                           **/
+/****************************************************************************/
+
+/**
+ * Same factors and fixed point arithmetic as the SSSE3 implementation, see
+ * prim_YUV_ssse3.c, so both produce identical output.
+ */
+
+#define BGRX_Y_FACTORS                                                                        \
+	_mm256_set_epi8(0, 27, 92, 9, 0, 27, 92, 9, 0, 27, 92, 9, 0, 27, 92, 9, 0, 27, 92, 9, 0, \
+	                27, 92, 9, 0, 27, 92, 9, 0, 27, 92, 9)
+#define BGRX_U_FACTORS                                                                            \
+	_mm256_set_epi8(0, -29, -99, 127, 0, -29, -99, 127, 0, -29, -99, 127, 0, -29, -99, 127, 0, \
+	                -29, -99, 127, 0, -29, -99, 127, 0, -29, -99, 127, 0, -29, -99, 127)
+#define BGRX_V_FACTORS                                                                          \
+	_mm256_set_epi8(0, 127, -116, -12, 0, 127, -116, -12, 0, 127, -116, -12, 0, 127, -116, -12, \
+	                0, 127, -116, -12, 0, 127, -116, -12, 0, 127, -116, -12, 0, 127, -116, -12)
+#define CONST128_FACTORS _mm256_set1_epi8(-128)
+
+#define Y_SHIFT 7
+#define U_SHIFT 8
+#define V_SHIFT 8
+
+/* Horizontal adds and packs work within 128 bit lanes, which leaves the
+ * 4 pixel groups of a 32 pixel block in the order 0 2 4 6 | 1 3 5 7.
+ * This permutation restores the natural order. */
+#define PIXEL_ORDER _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)
+
+/* compute the luma (Y) of 32 BGRX pixels */
+static INLINE __m256i avx2_BGRX_Y(__m256i x0, __m256i x1, __m256i x2, __m256i x3)
+{
+	const __m256i y_factors = BGRX_Y_FACTORS;
+	const __m256i y0 = _mm256_srli_epi16(_mm256_hadd_epi16(_mm256_maddubs_epi16(x0, y_factors),
+	                                                       _mm256_maddubs_epi16(x1, y_factors)),
+	                                     Y_SHIFT);
+	const __m256i y1 = _mm256_srli_epi16(_mm256_hadd_epi16(_mm256_maddubs_epi16(x2, y_factors),
+	                                                       _mm256_maddubs_epi16(x3, y_factors)),
+	                                     Y_SHIFT);
+	return _mm256_permutevar8x32_epi32(_mm256_packus_epi16(y0, y1), PIXEL_ORDER);
+}
+
+/* compute a chrominance (U or V) component of 32 BGRX pixels */
+static INLINE __m256i avx2_BGRX_UV(__m256i x0, __m256i x1, __m256i x2, __m256i x3,
+                                   __m256i factors)
+{
+	const __m256i c0 = _mm256_srai_epi16(
+	    _mm256_hadd_epi16(_mm256_maddubs_epi16(x0, factors), _mm256_maddubs_epi16(x1, factors)),
+	    U_SHIFT);
+	const __m256i c1 = _mm256_srai_epi16(
+	    _mm256_hadd_epi16(_mm256_maddubs_epi16(x2, factors), _mm256_maddubs_epi16(x3, factors)),
+	    U_SHIFT);
+	const __m256i c = _mm256_sub_epi8(_mm256_packs_epi16(c0, c1), CONST128_FACTORS);
+	return _mm256_permutevar8x32_epi32(c, PIXEL_ORDER);
+}
+
+/* compute the luma (Y) component from a single rgb source line */
+static INLINE void avx2_RGBToYUV420_BGRX_Y(const BYTE* src, BYTE* dst, UINT32 width)
+{
+	UINT32 x;
+	const __m256i* argb = (const __m256i*)src;
+	__m256i* ydst = (__m256i*)dst;
+
+	for (x = 0; x < width; x += 32)
+	{
+		/* store 32 rgba pixels in 4 256 bit registers */
+		const __m256i x0 = _mm256_loadu_si256(argb++);
+		const __m256i x1 = _mm256_loadu_si256(argb++);
+		const __m256i x2 = _mm256_loadu_si256(argb++);
+		const __m256i x3 = _mm256_loadu_si256(argb++);
+		_mm256_storeu_si256(ydst++, avx2_BGRX_Y(x0, x1, x2, x3));
+	}
+}
+
+/* compute the chrominance (UV) components from two rgb source lines */
+static INLINE void avx2_RGBToYUV420_BGRX_UV(const BYTE* src1, const BYTE* src2, BYTE* dst1,
+                                            BYTE* dst2, UINT32 width)
+{
+	UINT32 x;
+	const __m256i u_factors = BGRX_U_FACTORS;
+	const __m256i v_factors = BGRX_V_FACTORS;
+	/* groups the 16 bit U (V) pairs of both lanes back into pixel order */
+	const __m256i interleave = _mm256_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14,
+	                                            15, 0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7,
+	                                            14, 15);
+	const __m256i* rgb1 = (const __m256i*)src1;
+	const __m256i* rgb2 = (const __m256i*)src2;
+	__m128i* udst = (__m128i*)dst1;
+	__m128i* vdst = (__m128i*)dst2;
+
+	for (x = 0; x < width; x += 32)
+	{
+		__m256i x0, x1, x2, x3, x4, u0, u1, v0, v1, uv;
+		/* subsample 32x2 pixels into 32x1 pixels */
+		x0 = _mm256_avg_epu8(_mm256_loadu_si256(rgb1++), _mm256_loadu_si256(rgb2++));
+		x1 = _mm256_avg_epu8(_mm256_loadu_si256(rgb1++), _mm256_loadu_si256(rgb2++));
+		x2 = _mm256_avg_epu8(_mm256_loadu_si256(rgb1++), _mm256_loadu_si256(rgb2++));
+		x3 = _mm256_avg_epu8(_mm256_loadu_si256(rgb1++), _mm256_loadu_si256(rgb2++));
+		/* subsample these 32x1 pixels into 16x1 pixels */
+		x4 = _mm256_castps_si256(
+		    _mm256_shuffle_ps(_mm256_castsi256_ps(x0), _mm256_castsi256_ps(x1), 0x88));
+		x0 = _mm256_castps_si256(
+		    _mm256_shuffle_ps(_mm256_castsi256_ps(x0), _mm256_castsi256_ps(x1), 0xdd));
+		x0 = _mm256_avg_epu8(x0, x4);
+		x4 = _mm256_castps_si256(
+		    _mm256_shuffle_ps(_mm256_castsi256_ps(x2), _mm256_castsi256_ps(x3), 0x88));
+		x1 = _mm256_castps_si256(
+		    _mm256_shuffle_ps(_mm256_castsi256_ps(x2), _mm256_castsi256_ps(x3), 0xdd));
+		x1 = _mm256_avg_epu8(x1, x4);
+		/* multiplications, subtotals and the total sums */
+		u0 = _mm256_maddubs_epi16(x0, u_factors);
+		u1 = _mm256_maddubs_epi16(x1, u_factors);
+		v0 = _mm256_maddubs_epi16(x0, v_factors);
+		v1 = _mm256_maddubs_epi16(x1, v_factors);
+		u0 = _mm256_srai_epi16(_mm256_hadd_epi16(u0, u1), U_SHIFT);
+		v0 = _mm256_srai_epi16(_mm256_hadd_epi16(v0, v1), V_SHIFT);
+		/* pack the words into bytes and add 128 */
+		uv = _mm256_sub_epi8(_mm256_packs_epi16(u0, v0), CONST128_FACTORS);
+		/* lane 0 holds U (V) of pixel pairs 0 1 4 5..., lane 1 those of 2 3 6 7... */
+		uv = _mm256_permute4x64_epi64(uv, 0xD8);
+		uv = _mm256_shuffle_epi8(uv, interleave);
+		/* the lower 16 bytes go to the u plane, the upper to the v plane */
+		_mm_storeu_si128(udst++, _mm256_castsi256_si128(uv));
+		_mm_storeu_si128(vdst++, _mm256_extracti128_si256(uv, 1));
+	}
+}
+
+static pstatus_t avx2_RGBToYUV420_BGRX(const BYTE* pSrc, UINT32 srcStep, BYTE* pDst[3],
+                                       const UINT32 dstStep[3], UINT32 width, UINT32 height)
+{
+	UINT32 y;
+	const BYTE* argb = pSrc;
+	BYTE* ydst = pDst[0];
+	BYTE* udst = pDst[1];
+	BYTE* vdst = pDst[2];
+
+	for (y = 0; y < height - 1; y += 2)
+	{
+		const BYTE* line1 = argb;
+		const BYTE* line2 = argb + srcStep;
+		avx2_RGBToYUV420_BGRX_UV(line1, line2, udst, vdst, width);
+		avx2_RGBToYUV420_BGRX_Y(line1, ydst, width);
+		avx2_RGBToYUV420_BGRX_Y(line2, ydst + dstStep[0], width);
+		argb += 2 * srcStep;
+		ydst += 2 * dstStep[0];
+		udst += 1 * dstStep[1];
+		vdst += 1 * dstStep[2];
+	}
+
+	if (height & 1)
+	{
+		/* pass the same last line of an odd height twice for UV */
+		avx2_RGBToYUV420_BGRX_UV(argb, argb, udst, vdst, width);
+		avx2_RGBToYUV420_BGRX_Y(argb, ydst, width);
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+static pstatus_t avx2_RGBToYUV420(const BYTE* pSrc, UINT32 srcFormat, UINT32 srcStep,
+                                  BYTE* pDst[3], const UINT32 dstStep[3], const prim_size_t* roi)
+{
+	pstatus_t status;
+	const UINT32 nw = roi->width & ~31u;
+
+	if (roi->height < 1 || roi->width < 1)
+		return !PRIMITIVES_SUCCESS;
+
+	switch (srcFormat)
+	{
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_BGRA32:
+			break;
+
+		default:
+			return fallback_RGBToYUV420(pSrc, srcFormat, srcStep, pDst, dstStep, roi);
+	}
+
+	if (nw == 0)
+		return fallback_RGBToYUV420(pSrc, srcFormat, srcStep, pDst, dstStep, roi);
+
+	status = avx2_RGBToYUV420_BGRX(pSrc, srcStep, pDst, dstStep, nw, roi->height);
+
+	if ((status == PRIMITIVES_SUCCESS) && (nw < roi->width))
+	{
+		const prim_size_t rest = { roi->width - nw, roi->height };
+		BYTE* dst[3] = { pDst[0] + nw, pDst[1] + nw / 2, pDst[2] + nw / 2 };
+		status = fallback_RGBToYUV420(pSrc + nw * 4, srcFormat, srcStep, dst, dstStep, &rest);
+	}
+
+	return status;
+}
+
+/****************************************************************************/
+/* AVX2 RGB -> AVC444-YUV conversion                                       **/
+/****************************************************************************/
+
+/* even (or odd) bytes of each lane, moved to the lower 128 bits */
+static INLINE __m128i avx2_even_bytes(__m256i v, BOOL odd)
+{
+	const __m256i even = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1,
+	                                      -1, 0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1,
+	                                      -1, -1);
+	const __m256i mask = odd ? _mm256_add_epi8(even, _mm256_set1_epi8(1)) : even;
+	return _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, mask), 0xD8));
+}
+
+/* average of 2x2 blocks, e holds the even, o the odd line */
+static INLINE __m128i avx2_avg_2x2(__m256i e, __m256i o)
+{
+	const __m256i ones = _mm256_set1_epi8(1);
+	const __m256i sum = _mm256_add_epi16(_mm256_maddubs_epi16(e, ones), _mm256_maddubs_epi16(o, ones));
+	const __m256i avg16 = _mm256_srai_epi16(sum, 2);
+	const __m256i avg = _mm256_packus_epi16(avg16, avg16);
+	return _mm256_castsi256_si128(_mm256_permute4x64_epi64(avg, 0xD8));
+}
+
+static INLINE void avx2_RGBToAVC444YUV_BGRX_DOUBLE_ROW(const BYTE* srcEven, const BYTE* srcOdd,
+                                                       BYTE* b1Even, BYTE* b1Odd, BYTE* b2,
+                                                       BYTE* b3, BYTE* b4, BYTE* b5, BYTE* b6,
+                                                       BYTE* b7, UINT32 width)
+{
+	UINT32 x;
+	const __m256i* argbEven = (const __m256i*)srcEven;
+	const __m256i* argbOdd = (const __m256i*)srcOdd;
+	const __m256i u_factors = BGRX_U_FACTORS;
+	const __m256i v_factors = BGRX_V_FACTORS;
+
+	for (x = 0; x < width; x += 32)
+	{
+		/* store 32 rgba pixels in 4 256 bit registers */
+		const __m256i xe1 = _mm256_loadu_si256(argbEven++);
+		const __m256i xe2 = _mm256_loadu_si256(argbEven++);
+		const __m256i xe3 = _mm256_loadu_si256(argbEven++);
+		const __m256i xe4 = _mm256_loadu_si256(argbEven++);
+		const __m256i xo1 = _mm256_loadu_si256(argbOdd++);
+		const __m256i xo2 = _mm256_loadu_si256(argbOdd++);
+		const __m256i xo3 = _mm256_loadu_si256(argbOdd++);
+		const __m256i xo4 = _mm256_loadu_si256(argbOdd++);
+		/* Y [b1] */
+		_mm256_storeu_si256((__m256i*)b1Even, avx2_BGRX_Y(xe1, xe2, xe3, xe4));
+		b1Even += 32;
+
+		if (b1Odd)
+		{
+			_mm256_storeu_si256((__m256i*)b1Odd, avx2_BGRX_Y(xo1, xo2, xo3, xo4));
+			b1Odd += 32;
+		}
+
+		{
+			/* 3.3.8.3.2 YUV420p Stream Combination for YUV444 mode:
+			 * 2x   2y    -> b2
+			 * x    2y+1  -> b4
+			 * 2x+1 2y    -> b6 */
+			const __m256i ue = avx2_BGRX_UV(xe1, xe2, xe3, xe4, u_factors);
+
+			if (b1Odd)
+			{
+				const __m256i uo = avx2_BGRX_UV(xo1, xo2, xo3, xo4, u_factors);
+				_mm_storeu_si128((__m128i*)b2, avx2_avg_2x2(ue, uo));
+				_mm256_storeu_si256((__m256i*)b4, uo);
+				b4 += 32;
+			}
+			else
+				_mm_storeu_si128((__m128i*)b2, avx2_even_bytes(ue, FALSE));
+
+			b2 += 16;
+			_mm_storeu_si128((__m128i*)b6, avx2_even_bytes(ue, TRUE));
+			b6 += 16;
+		}
+		{
+			/* 2x   2y    -> b3
+			 * x    2y+1  -> b5
+			 * 2x+1 2y    -> b7 */
+			const __m256i ve = avx2_BGRX_UV(xe1, xe2, xe3, xe4, v_factors);
+
+			if (b1Odd)
+			{
+				const __m256i vo = avx2_BGRX_UV(xo1, xo2, xo3, xo4, v_factors);
+				_mm_storeu_si128((__m128i*)b3, avx2_avg_2x2(ve, vo));
+				_mm256_storeu_si256((__m256i*)b5, vo);
+				b5 += 32;
+			}
+			else
+				_mm_storeu_si128((__m128i*)b3, avx2_even_bytes(ve, FALSE));
+
+			b3 += 16;
+			_mm_storeu_si128((__m128i*)b7, avx2_even_bytes(ve, TRUE));
+			b7 += 16;
+		}
+	}
+}
+
+static pstatus_t avx2_RGBToAVC444YUV_BGRX(const BYTE* pSrc, UINT32 srcStep, BYTE* pDst1[3],
+                                          const UINT32 dst1Step[3], BYTE* pDst2[3],
+                                          const UINT32 dst2Step[3], UINT32 width, UINT32 height)
+{
+	UINT32 y;
+	const BYTE* pMaxSrc = pSrc + (height - 1) * srcStep;
+
+	for (y = 0; y < height; y += 2)
+	{
+		const BOOL last = (y >= (height - 1));
+		const BYTE* srcEven = y < height ? pSrc + y * srcStep : pMaxSrc;
+		const BYTE* srcOdd = !last ? pSrc + (y + 1) * srcStep : pMaxSrc;
+		const UINT32 i = y >> 1;
+		const UINT32 n = (i & ~7) + i;
+		BYTE* b1Even = pDst1[0] + y * dst1Step[0];
+		BYTE* b1Odd = !last ? (b1Even + dst1Step[0]) : NULL;
+		BYTE* b2 = pDst1[1] + (y / 2) * dst1Step[1];
+		BYTE* b3 = pDst1[2] + (y / 2) * dst1Step[2];
+		BYTE* b4 = pDst2[0] + dst2Step[0] * n;
+		BYTE* b5 = b4 + 8 * dst2Step[0];
+		BYTE* b6 = pDst2[1] + (y / 2) * dst2Step[1];
+		BYTE* b7 = pDst2[2] + (y / 2) * dst2Step[2];
+		avx2_RGBToAVC444YUV_BGRX_DOUBLE_ROW(srcEven, srcOdd, b1Even, b1Odd, b2, b3, b4, b5, b6, b7,
+		                                    width);
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+static pstatus_t avx2_RGBToAVC444YUV(const BYTE* pSrc, UINT32 srcFormat, UINT32 srcStep,
+                                     BYTE* pDst1[3], const UINT32 dst1Step[3], BYTE* pDst2[3],
+                                     const UINT32 dst2Step[3], const prim_size_t* roi)
+{
+	pstatus_t status;
+	const UINT32 nw = roi->width & ~31u;
+
+	if (roi->height < 1 || roi->width < 1)
+		return !PRIMITIVES_SUCCESS;
+
+	switch (srcFormat)
+	{
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_BGRA32:
+			break;
+
+		default:
+			return fallback_RGBToAVC444YUV(pSrc, srcFormat, srcStep, pDst1, dst1Step, pDst2,
+			                               dst2Step, roi);
+	}
+
+	if (nw == 0)
+		return fallback_RGBToAVC444YUV(pSrc, srcFormat, srcStep, pDst1, dst1Step, pDst2, dst2Step,
+		                               roi);
+
+	status = avx2_RGBToAVC444YUV_BGRX(pSrc, srcStep, pDst1, dst1Step, pDst2, dst2Step, nw,
+	                                  roi->height);
+
+	if ((status == PRIMITIVES_SUCCESS) && (nw < roi->width))
+	{
+		const prim_size_t rest = { roi->width - nw, roi->height };
+		BYTE* dst1[3] = { pDst1[0] + nw, pDst1[1] + nw / 2, pDst1[2] + nw / 2 };
+		BYTE* dst2[3] = { pDst2[0] + nw, pDst2[1] + nw / 2, pDst2[2] + nw / 2 };
+		status = fallback_RGBToAVC444YUV(pSrc + nw * 4, srcFormat, srcStep, dst1, dst1Step, dst2,
+		                                 dst2Step, &rest);
+	}
+
+	return status;
+}
+
+void primitives_init_YUV_avx2(primitives_t* prims)
+{
+	if (IsProcessorFeaturePresentEx(PF_EX_AVX2))
+	{
+		fallback_RGBToYUV420 = prims->RGBToYUV420_8u_P3AC4R;
+		fallback_RGBToAVC444YUV = prims->RGBToAVC444YUV;
+		prims->RGBToYUV420_8u_P3AC4R = avx2_RGBToYUV420;
+		prims->RGBToAVC444YUV = avx2_RGBToAVC444YUV;
+	}
+}
@@ -1463,4 +1463,8 @@ void primitives_init_YUV_opt(primitives_t* prims)
 		prims->YUV444ToRGB_8u_P3AC4R = ssse3_YUV444ToRGB_8u_P3AC4R;
 		prims->YUV420CombineToYUV444 = ssse3_YUV420CombineToYUV444;
 	}
+
+#if defined(WITH_AVX2)
+	primitives_init_YUV_avx2(prims);
+#endif
 }
@@ -0,0 +1,111 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * AVX2 alpha blending routines.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ *
+ * Same arithmetic as the SSE2 version, 8 pixels at a time.
+ */
+
+#include <freerdp/config.h>
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <winpr/sysinfo.h>
+
+#include <immintrin.h>
+
+#include "prim_internal.h"
+
+#if !defined(WITH_AVX2)
+#error "This file needs WITH_AVX2 enabled!"
+#endif
+
+static primitives_t* generic = NULL;
+
+/* ------------------------------------------------------------------------- */
+static INLINE __m256i avx2_alphaComp_half(__m256i src1, __m256i src2)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+	/* 00Bb00Gb00Rb00Ab00Ba00Ga00Ra00Aa */
+	__m256i alpha = src1;
+	/* subtract */
+	const __m256i diff = _mm256_subs_epi16(src1, src2);
+	/* 00Ab00Ab00Ab00Ab00Aa00Aa00Aa00Aa */
+	alpha = _mm256_shufflelo_epi16(alpha, 0xff);
+	alpha = _mm256_shufflehi_epi16(alpha, 0xff);
+	/* Add one to alphas */
+	alpha = _mm256_adds_epi16(alpha, one);
+	/* Multiply, take low word and shift 8 right */
+	alpha = _mm256_srai_epi16(_mm256_mullo_epi16(alpha, diff), 8);
+	/* Add src2, mask off remainders or pack gets confused */
+	return _mm256_and_si256(_mm256_adds_epi16(alpha, src2), _mm256_set1_epi16(0x00ff));
+}
+
+static pstatus_t avx2_alphaComp_argb(const BYTE* pSrc1, UINT32 src1Step, const BYTE* pSrc2,
+                                     UINT32 src2Step, BYTE* pDst, UINT32 dstStep, UINT32 width,
+                                     UINT32 height)
+{
+	UINT32 y;
+	const __m256i zero = _mm256_setzero_si256();
+	const UINT32 nw = width & ~7u;
+
+	if ((width == 0) || (height == 0))
+		return PRIMITIVES_SUCCESS;
+
+	if (nw == 0) /* pointless if too small */
+	{
+		return generic->alphaComp_argb(pSrc1, src1Step, pSrc2, src2Step, pDst, dstStep, width,
+		                               height);
+	}
+
+	for (y = 0; y < height; y++)
+	{
+		UINT32 x;
+		const BYTE* sptr1 = &pSrc1[(size_t)y * src1Step];
+		const BYTE* sptr2 = &pSrc2[(size_t)y * src2Step];
+		BYTE* dptr = &pDst[(size_t)y * dstStep];
+
+		/* Unpacking and packing work within 128 bit lanes, so the pixel
+		 * order is preserved without any cross lane permutation. */
+		for (x = 0; x < nw; x += 8)
+		{
+			const __m256i s1 = _mm256_loadu_si256((const __m256i*)&sptr1[x * 4]);
+			const __m256i s2 = _mm256_loadu_si256((const __m256i*)&sptr2[x * 4]);
+			const __m256i hi = avx2_alphaComp_half(_mm256_unpackhi_epi8(s1, zero),
+			                                       _mm256_unpackhi_epi8(s2, zero));
+			const __m256i lo = avx2_alphaComp_half(_mm256_unpacklo_epi8(s1, zero),
+			                                       _mm256_unpacklo_epi8(s2, zero));
+			_mm256_storeu_si256((__m256i*)&dptr[x * 4], _mm256_packus_epi16(lo, hi));
+		}
+
+		/* Finish off the remainder. */
+		if (nw < width)
+		{
+			const pstatus_t status =
+			    generic->alphaComp_argb(&sptr1[nw * 4], src1Step, &sptr2[nw * 4], src2Step,
+			                            &dptr[nw * 4], dstStep, width - nw, 1);
+
+			if (status != PRIMITIVES_SUCCESS)
+				return status;
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_alphaComp_avx2(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+
+	if (IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		prims->alphaComp_argb = avx2_alphaComp_argb;
+}
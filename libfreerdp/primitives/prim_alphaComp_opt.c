@@ -232,5 +232,9 @@ void primitives_init_alphaComp_opt(primitives_t* prims)
 		prims->alphaComp_argb = sse2_alphaComp_argb;
 	}
 
+#if defined(WITH_AVX2)
+	primitives_init_alphaComp_avx2(prims);
+#endif
+
 #endif
 }
@@ -266,12 +266,12 @@ static pstatus_t general_RGBToYCbCr_16s16s_P3P3(const INT16* const pSrc[3], INT3
 			*crptr++ = (INT16)MINMAX(cr, -4096, 4095);
 		}
 
-		yptr += srcbump;
-		cbptr += srcbump;
-		crptr += srcbump;
-		rptr += dstbump;
-		gptr += dstbump;
-		bptr += dstbump;
+		yptr += dstbump;
+		cbptr += dstbump;
+		crptr += dstbump;
+		rptr += srcbump;
+		gptr += srcbump;
+		bptr += srcbump;
 	}
 
 	return PRIMITIVES_SUCCESS;
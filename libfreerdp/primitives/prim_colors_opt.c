@@ -675,7 +675,7 @@ static pstatus_t sse2_RGBToYCbCr_16s16s_P3P3(const INT16* const pSrc[3], int src
 			 * values used in the multiplication by << 5+(16-n).
 			 */
 			__m128i r, g, b, y, cb, cr;
-			r = _mm_load_si128(y_buf + i);
+			r = _mm_load_si128(r_buf + i);
 			g = _mm_load_si128(g_buf + i);
 			b = _mm_load_si128(b_buf + i);
 			/* r<<6; g<<6; b<<6 */
@@ -706,12 +706,12 @@ static pstatus_t sse2_RGBToYCbCr_16s16s_P3P3(const INT16* const pSrc[3], int src
 			_mm_store_si128(cr_buf + i, cr);
 		}
 
-		y_buf += srcbump;
-		cb_buf += srcbump;
-		cr_buf += srcbump;
-		r_buf += dstbump;
-		g_buf += dstbump;
-		b_buf += dstbump;
+		y_buf += dstbump;
+		cb_buf += dstbump;
+		cr_buf += dstbump;
+		r_buf += srcbump;
+		g_buf += srcbump;
+		b_buf += srcbump;
 	}
 
 	return PRIMITIVES_SUCCESS;
@@ -1502,6 +1502,10 @@ void primitives_init_colors_opt(primitives_t* prims)
 		prims->RGBToYCbCr_16s16s_P3P3 = sse2_RGBToYCbCr_16s16s_P3P3;
 	}
 
+#if defined(WITH_AVX2)
+	primitives_init_colors_avx2(prims);
+#endif
+
 #elif defined(WITH_NEON)
 
 	if (IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
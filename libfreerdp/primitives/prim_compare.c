@@ -0,0 +1,64 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Tile comparison operations.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <string.h>
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+/* ----------------------------------------------------------------------------
+ * Compare a band of height rows of 32bpp pixels in 16 pixel wide tiles.
+ * pDirty[x] is set to 1 if tile x contains at least one differing pixel.
+ */
+static pstatus_t general_compareTiles_32u(const BYTE* pSrc1, UINT32 src1Step, const BYTE* pSrc2,
+                                          UINT32 src2Step, UINT32 width, UINT32 height,
+                                          BYTE* pDirty)
+{
+	UINT32 x, y;
+	const UINT32 ncol = (width + 15) / 16;
+
+	for (x = 0; x < ncol; x++)
+	{
+		const UINT32 tw = MIN(16, width - x * 16);
+		const BYTE* p1 = &pSrc1[x * 16 * 4];
+		const BYTE* p2 = &pSrc2[x * 16 * 4];
+		BYTE dirty = 0;
+
+		for (y = 0; y < height; y++)
+		{
+			if (memcmp(p1, p2, tw * 4) != 0)
+			{
+				dirty = 1;
+				break;
+			}
+
+			p1 += src1Step;
+			p2 += src2Step;
+		}
+
+		pDirty[x] = dirty;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_compare(primitives_t* prims)
+{
+	/* Start with the default. */
+	prims->compareTiles_32u = general_compareTiles_32u;
+}
@@ -0,0 +1,89 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * AVX2 tile comparison operations.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ *
+ * Same scan as the SSE2 version, a 64 byte tile row takes two loads.
+ */
+
+#include <freerdp/config.h>
+
+#include <string.h>
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <winpr/sysinfo.h>
+
+#include <immintrin.h>
+
+#include "prim_internal.h"
+
+#if !defined(WITH_AVX2)
+#error "This file needs WITH_AVX2 enabled!"
+#endif
+
+/* Compare one 64 byte tile row (16 pixels) */
+static INLINE BOOL avx2_tile_row_differs(const BYTE* p1, const BYTE* p2)
+{
+	const __m256i c0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&p1[0]),
+	                                     _mm256_loadu_si256((const __m256i*)&p2[0]));
+	const __m256i c1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&p1[32]),
+	                                     _mm256_loadu_si256((const __m256i*)&p2[32]));
+	return _mm256_movemask_epi8(_mm256_and_si256(c0, c1)) != -1;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t avx2_compareTiles_32u(const BYTE* pSrc1, UINT32 src1Step, const BYTE* pSrc2,
+                                       UINT32 src2Step, UINT32 width, UINT32 height, BYTE* pDirty)
+{
+	UINT32 x, y;
+	const UINT32 nfull = width / 16;
+	const UINT32 rest = width % 16;
+	const UINT32 ncol = (width + 15) / 16;
+	UINT32 clean = ncol;
+
+	memset(pDirty, 0, ncol);
+
+	for (y = 0; (y < height) && (clean > 0); y++)
+	{
+		const BYTE* p1 = &pSrc1[(size_t)y * src1Step];
+		const BYTE* p2 = &pSrc2[(size_t)y * src2Step];
+
+		for (x = 0; x < nfull; x++)
+		{
+			if (pDirty[x])
+				continue;
+
+			if (avx2_tile_row_differs(&p1[x * 16 * 4], &p2[x * 16 * 4]))
+			{
+				pDirty[x] = 1;
+				clean--;
+			}
+		}
+
+		if ((rest > 0) && !pDirty[nfull])
+		{
+			if (memcmp(&p1[nfull * 16 * 4], &p2[nfull * 16 * 4], rest * 4) != 0)
+			{
+				pDirty[nfull] = 1;
+				clean--;
+			}
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_compare_avx2(primitives_t* prims)
+{
+	if (IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		prims->compareTiles_32u = avx2_compareTiles_32u;
+}
@@ -0,0 +1,104 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized tile comparison operations.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <string.h>
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <winpr/sysinfo.h>
+
+#ifdef WITH_SSE2
+#include <emmintrin.h>
+#endif /* WITH_SSE2 */
+
+#include "prim_internal.h"
+
+#ifdef WITH_SSE2
+/* Compare one 64 byte tile row (16 pixels) */
+static INLINE BOOL tile_row_differs(const BYTE* p1, const BYTE* p2)
+{
+	const __m128i c0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&p1[0]),
+	                                  _mm_loadu_si128((const __m128i*)&p2[0]));
+	const __m128i c1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&p1[16]),
+	                                  _mm_loadu_si128((const __m128i*)&p2[16]));
+	const __m128i c2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&p1[32]),
+	                                  _mm_loadu_si128((const __m128i*)&p2[32]));
+	const __m128i c3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&p1[48]),
+	                                  _mm_loadu_si128((const __m128i*)&p2[48]));
+	const __m128i c = _mm_and_si128(_mm_and_si128(c0, c1), _mm_and_si128(c2, c3));
+	return _mm_movemask_epi8(c) != 0xFFFF;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Unlike the generic version the band is walked row by row so the source
+ * buffers are read sequentially. Tiles already found dirty are skipped and
+ * the scan stops as soon as every tile of the band is dirty. */
+static pstatus_t opt_compareTiles_32u(const BYTE* pSrc1, UINT32 src1Step, const BYTE* pSrc2,
+                                      UINT32 src2Step, UINT32 width, UINT32 height, BYTE* pDirty)
+{
+	UINT32 x, y;
+	const UINT32 nfull = width / 16;
+	const UINT32 rest = width % 16;
+	const UINT32 ncol = (width + 15) / 16;
+	UINT32 clean = ncol;
+
+	memset(pDirty, 0, ncol);
+
+	for (y = 0; (y < height) && (clean > 0); y++)
+	{
+		const BYTE* p1 = &pSrc1[(size_t)y * src1Step];
+		const BYTE* p2 = &pSrc2[(size_t)y * src2Step];
+
+		for (x = 0; x < nfull; x++)
+		{
+			if (pDirty[x])
+				continue;
+
+			if (tile_row_differs(&p1[x * 16 * 4], &p2[x * 16 * 4]))
+			{
+				pDirty[x] = 1;
+				clean--;
+			}
+		}
+
+		if ((rest > 0) && !pDirty[nfull])
+		{
+			if (memcmp(&p1[nfull * 16 * 4], &p2[nfull * 16 * 4], rest * 4) != 0)
+			{
+				pDirty[nfull] = 1;
+				clean--;
+			}
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+#endif /* WITH_SSE2 */
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_compare_opt(primitives_t* prims)
+{
+	primitives_init_compare(prims);
+#if defined(WITH_SSE2)
+
+	if (IsProcessorFeaturePresent(PF_SSE2_INSTRUCTIONS_AVAILABLE))
+		prims->compareTiles_32u = opt_compareTiles_32u;
+
+#if defined(WITH_AVX2)
+	primitives_init_compare_avx2(prims);
+#endif
+
+#endif /* WITH_SSE2 */
+}
@@ -0,0 +1,83 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Planar codec plane split and delta encoding.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <string.h>
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+
+#include "prim_internal.h"
+
+/* ----------------------------------------------------------------------------
+ * Split width x height pixels of srcFormat into the planar codec planes
+ * pDst[0] (alpha), pDst[1] (red), pDst[2] (green) and pDst[3] (blue).
+ * srcStep may be negative to read the image bottom up.
+ */
+static pstatus_t general_splitPlanes_8u(const BYTE* pSrc, INT32 srcStep, UINT32 srcFormat,
+                                        BYTE* pDst[4], UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+	size_t k = 0;
+	const UINT32 bpp = FreeRDPGetBytesPerPixel(srcFormat);
+
+	for (y = 0; y < height; y++)
+	{
+		const BYTE* pixel = &pSrc[(INT64)srcStep * y];
+
+		for (x = 0; x < width; x++)
+		{
+			const UINT32 color = FreeRDPReadColor(pixel, srcFormat);
+			pixel += bpp;
+			FreeRDPSplitColor(color, srcFormat, &pDst[1][k], &pDst[2][k], &pDst[3][k],
+			                  &pDst[0][k], NULL);
+			k++;
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ----------------------------------------------------------------------------
+ * Planar delta encoding: the first row is copied, every other byte is the
+ * difference to the byte above in sign/magnitude form (magnitude << 1 | sign).
+ */
+static pstatus_t general_deltaEncodePlane_8u(const BYTE* pSrc, BYTE* pDst, UINT32 width,
+                                             UINT32 height)
+{
+	size_t x;
+	const size_t size = (size_t)width * height;
+
+	if (size == 0)
+		return PRIMITIVES_SUCCESS;
+
+	memcpy(pDst, pSrc, width);
+
+	for (x = width; x < size; x++)
+	{
+		const INT8 delta = (INT8)(pSrc[x] - pSrc[x - width]);
+		pDst[x] = (BYTE)((delta >= 0) ? (delta << 1) : (((-delta) << 1) - 1));
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_planar(primitives_t* prims)
+{
+	/* Start with the default. */
+	prims->splitPlanes_8u = general_splitPlanes_8u;
+	prims->deltaEncodePlane_8u = general_deltaEncodePlane_8u;
+}
@@ -0,0 +1,174 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized planar codec plane split and delta encoding.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <string.h>
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+#include <winpr/sysinfo.h>
+
+#ifdef WITH_SSE2
+#include <emmintrin.h>
+#endif /* WITH_SSE2 */
+
+#include "prim_internal.h"
+
+#ifdef WITH_SSE2
+static primitives_t* generic = NULL;
+
+/* Finds the bit offset of every plane channel inside a little endian 32bpp pixel */
+static BOOL sse2_plane_shifts(UINT32 format, UINT32 shifts[4])
+{
+	size_t i;
+	BYTE pixel[4] = { 0 };
+
+	if (FreeRDPGetBytesPerPixel(format) != 4)
+		return FALSE;
+
+	if (!FreeRDPWriteColor(pixel, format, FreeRDPGetColor(format, 1, 2, 3, 4)))
+		return FALSE;
+
+	/* Formats without alpha read back 0xFF, that case is handled separately */
+	shifts[0] = 32;
+	shifts[1] = shifts[2] = shifts[3] = 32;
+
+	for (i = 0; i < 4; i++)
+	{
+		if ((pixel[i] >= 1) && (pixel[i] <= 3))
+			shifts[pixel[i]] = (UINT32)(8 * i);
+		else if ((pixel[i] == 4) && FreeRDPColorHasAlpha(format))
+			shifts[0] = (UINT32)(8 * i);
+	}
+
+	return (shifts[1] < 32) && (shifts[2] < 32) && (shifts[3] < 32);
+}
+
+static INLINE __m128i sse2_extract_channel(__m128i p0, __m128i p1, __m128i p2, __m128i p3,
+                                           __m128i shift, __m128i mask)
+{
+	const __m128i c0 = _mm_and_si128(_mm_srl_epi32(p0, shift), mask);
+	const __m128i c1 = _mm_and_si128(_mm_srl_epi32(p1, shift), mask);
+	const __m128i c2 = _mm_and_si128(_mm_srl_epi32(p2, shift), mask);
+	const __m128i c3 = _mm_and_si128(_mm_srl_epi32(p3, shift), mask);
+	return _mm_packus_epi16(_mm_packs_epi32(c0, c1), _mm_packs_epi32(c2, c3));
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t sse2_splitPlanes_8u(const BYTE* pSrc, INT32 srcStep, UINT32 srcFormat,
+                                     BYTE* pDst[4], UINT32 width, UINT32 height)
+{
+	UINT32 x, y, i;
+	UINT32 shifts[4];
+	BOOL alpha;
+	__m128i shift[4];
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const __m128i opaque = _mm_set1_epi8((char)0xFF);
+	BYTE* dst[4] = { pDst[0], pDst[1], pDst[2], pDst[3] };
+
+	if (!sse2_plane_shifts(srcFormat, shifts))
+		return generic->splitPlanes_8u(pSrc, srcStep, srcFormat, pDst, width, height);
+
+	alpha = shifts[0] < 32;
+
+	for (i = 0; i < 4; i++)
+		shift[i] = _mm_cvtsi32_si128((int)((shifts[i] < 32) ? shifts[i] : 0));
+
+	for (y = 0; y < height; y++)
+	{
+		const BYTE* row = &pSrc[(INT64)srcStep * y];
+
+		for (x = 0; x + 16 <= width; x += 16)
+		{
+			const __m128i p0 = _mm_loadu_si128((const __m128i*)&row[x * 4 + 0]);
+			const __m128i p1 = _mm_loadu_si128((const __m128i*)&row[x * 4 + 16]);
+			const __m128i p2 = _mm_loadu_si128((const __m128i*)&row[x * 4 + 32]);
+			const __m128i p3 = _mm_loadu_si128((const __m128i*)&row[x * 4 + 48]);
+
+			if (alpha)
+				_mm_storeu_si128((__m128i*)&dst[0][x],
+				                 sse2_extract_channel(p0, p1, p2, p3, shift[0], mask));
+			else
+				_mm_storeu_si128((__m128i*)&dst[0][x], opaque);
+
+			for (i = 1; i < 4; i++)
+				_mm_storeu_si128((__m128i*)&dst[i][x],
+				                 sse2_extract_channel(p0, p1, p2, p3, shift[i], mask));
+		}
+
+		for (; x < width; x++)
+		{
+			const BYTE* pixel = &row[x * 4];
+			dst[0][x] = alpha ? pixel[shifts[0] / 8] : 0xFF;
+			dst[1][x] = pixel[shifts[1] / 8];
+			dst[2][x] = pixel[shifts[2] / 8];
+			dst[3][x] = pixel[shifts[3] / 8];
+		}
+
+		for (i = 0; i < 4; i++)
+			dst[i] += width;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/* The sign/magnitude form of a delta d is (d << 1) ^ (d >> 7) */
+static pstatus_t sse2_deltaEncodePlane_8u(const BYTE* pSrc, BYTE* pDst, UINT32 width,
+                                          UINT32 height)
+{
+	size_t x;
+	const size_t size = (size_t)width * height;
+	const __m128i zero = _mm_setzero_si128();
+
+	if (size == 0)
+		return PRIMITIVES_SUCCESS;
+
+	memcpy(pDst, pSrc, width);
+
+	for (x = width; x + 16 <= size; x += 16)
+	{
+		const __m128i cur = _mm_loadu_si128((const __m128i*)&pSrc[x]);
+		const __m128i prev = _mm_loadu_si128((const __m128i*)&pSrc[x - width]);
+		const __m128i delta = _mm_sub_epi8(cur, prev);
+		const __m128i sign = _mm_cmpgt_epi8(zero, delta);
+		_mm_storeu_si128((__m128i*)&pDst[x], _mm_xor_si128(_mm_add_epi8(delta, delta), sign));
+	}
+
+	for (; x < size; x++)
+	{
+		const INT8 delta = (INT8)(pSrc[x] - pSrc[x - width]);
+		pDst[x] = (BYTE)((delta >= 0) ? (delta << 1) : (((-delta) << 1) - 1));
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+#endif /* WITH_SSE2 */
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_planar_opt(primitives_t* prims)
+{
+	primitives_init_planar(prims);
+#if defined(WITH_SSE2)
+	generic = primitives_get_generic();
+
+	if (IsProcessorFeaturePresent(PF_SSE2_INSTRUCTIONS_AVAILABLE))
+	{
+		prims->splitPlanes_8u = sse2_splitPlanes_8u;
+		prims->deltaEncodePlane_8u = sse2_deltaEncodePlane_8u;
+	}
+
+#endif /* WITH_SSE2 */
+}
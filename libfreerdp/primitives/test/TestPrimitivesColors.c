@@ -259,6 +259,105 @@ static int test_yCbCrToRGB_16s16s_P3P3_speed(void)
 	return TRUE;
 }
 
+/* ========================================================================= */
+static BOOL test_RGBToYCbCr_16s16s_P3P3_func(prim_size_t roi)
+{
+	pstatus_t status;
+	INT16 ALIGN(r[4096]), ALIGN(g[4096]), ALIGN(b[4096]);
+	INT16 ALIGN(y1[4096]), ALIGN(cb1[4096]), ALIGN(cr1[4096]);
+	INT16 ALIGN(y2[4096]), ALIGN(cb2[4096]), ALIGN(cr2[4096]);
+	UINT32 i;
+	const INT16* in[3];
+	INT16* out1[3];
+	INT16* out2[3];
+	winpr_RAND((BYTE*)r, sizeof(r));
+	winpr_RAND((BYTE*)g, sizeof(g));
+	winpr_RAND((BYTE*)b, sizeof(b));
+
+	/* Plain 8 bit color values, as produced by the RemoteFX encoder */
+	for (i = 0; i < 4096; ++i)
+	{
+		r[i] &= 0xFFU;
+		g[i] &= 0xFFU;
+		b[i] &= 0xFFU;
+	}
+
+	memset(y1, 0, sizeof(y1));
+	memset(cb1, 0, sizeof(cb1));
+	memset(cr1, 0, sizeof(cr1));
+	memset(y2, 0, sizeof(y2));
+	memset(cb2, 0, sizeof(cb2));
+	memset(cr2, 0, sizeof(cr2));
+	in[0] = r;
+	in[1] = g;
+	in[2] = b;
+	out1[0] = y1;
+	out1[1] = cb1;
+	out1[2] = cr1;
+	out2[0] = y2;
+	out2[1] = cb2;
+	out2[2] = cr2;
+	status = generic->RGBToYCbCr_16s16s_P3P3(in, 64 * 2, out1, 64 * 2, &roi);
+
+	if (status != PRIMITIVES_SUCCESS)
+		return FALSE;
+
+	status = optimized->RGBToYCbCr_16s16s_P3P3(in, 64 * 2, out2, 64 * 2, &roi);
+
+	if (status != PRIMITIVES_SUCCESS)
+		return FALSE;
+
+	for (i = 0; i < 4096; ++i)
+	{
+		/* The optimized versions use 16 bit intermediates */
+		if ((ABS(y1[i] - y2[i]) > 4) || (ABS(cb1[i] - cb2[i]) > 4) || (ABS(cr1[i] - cr2[i]) > 4))
+		{
+			printf("RGBToYCbCr FAIL[%" PRIu32 "]: %" PRId16 ",%" PRId16 ",%" PRId16
+			       " vs %" PRId16 ",%" PRId16 ",%" PRId16 "\n",
+			       i, y1[i], cb1[i], cr1[i], y2[i], cb2[i], cr2[i]);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_RGBToYCbCr_16s16s_P3P3_speed(void)
+{
+	prim_size_t roi = { 64, 64 };
+	INT16 ALIGN(r[4096]), ALIGN(g[4096]), ALIGN(b[4096]);
+	INT16 ALIGN(y[4096]), ALIGN(cb[4096]), ALIGN(cr[4096]);
+	int i;
+	const INT16* input[3];
+	INT16* output[3];
+	winpr_RAND((BYTE*)r, sizeof(r));
+	winpr_RAND((BYTE*)g, sizeof(g));
+	winpr_RAND((BYTE*)b, sizeof(b));
+
+	for (i = 0; i < 4096; ++i)
+	{
+		r[i] &= 0xFFU;
+		g[i] &= 0xFFU;
+		b[i] &= 0xFFU;
+	}
+
+	input[0] = r;
+	input[1] = g;
+	input[2] = b;
+	output[0] = y;
+	output[1] = cb;
+	output[2] = cr;
+
+	if (!speed_test("RGBToYCbCr_16s16s_P3P3", "aligned", g_Iterations,
+	                (speed_test_fkt)generic->RGBToYCbCr_16s16s_P3P3,
+	                (speed_test_fkt)optimized->RGBToYCbCr_16s16s_P3P3, input, 64 * 2, output,
+	                64 * 2, &roi))
+		return FALSE;
+
+	return TRUE;
+}
+
 int TestPrimitivesColors(int argc, char* argv[])
 {
 	const DWORD formats[] = { PIXEL_FORMAT_ARGB32, PIXEL_FORMAT_XRGB32, PIXEL_FORMAT_ABGR32,
@@ -295,5 +394,22 @@ int TestPrimitivesColors(int argc, char* argv[])
 #endif
 	}
 
+	{
+		/* 60 is not a multiple of the vector width, the rest takes the scalar path */
+		const prim_size_t rois[] = { { 64, 64 }, { 60, 64 }, { 7, 3 } };
+
+		for (x = 0; x < sizeof(rois) / sizeof(rois[0]); x++)
+		{
+			if (!test_RGBToYCbCr_16s16s_P3P3_func(rois[x]))
+				return 1;
+		}
+
+		if (g_TestPrimitivesPerformance)
+		{
+			if (!test_RGBToYCbCr_16s16s_P3P3_speed())
+				return 1;
+		}
+	}
+
 	return 0;
 }
@@ -0,0 +1,159 @@
+/* test_compare.c
+ * vi:ts=4 sw=4
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/sysinfo.h>
+#include "prim_test.h"
+
+#define TEST_WIDTH 1000 /* not a multiple of the tile width */
+#define TEST_HEIGHT 16
+#define TEST_STEP (TEST_WIDTH * 4 + 12)
+#define TEST_TILES ((TEST_WIDTH + 15) / 16)
+
+/* ------------------------------------------------------------------------- */
+static BOOL check_compareTiles(const BYTE* src1, const BYTE* src2, UINT32 height,
+                               const BYTE* expected)
+{
+	pstatus_t status;
+	BYTE d1[TEST_TILES] = { 0 };
+	BYTE d2[TEST_TILES] = { 0 };
+
+	memset(d1, 0xCC, sizeof(d1));
+	memset(d2, 0xCC, sizeof(d2));
+	status = generic->compareTiles_32u(src1, TEST_STEP, src2, TEST_STEP, TEST_WIDTH, height, d1);
+
+	if (status != PRIMITIVES_SUCCESS)
+		return FALSE;
+
+	status = optimized->compareTiles_32u(src1, TEST_STEP, src2, TEST_STEP, TEST_WIDTH, height, d2);
+
+	if (status != PRIMITIVES_SUCCESS)
+		return FALSE;
+
+	if (memcmp(d1, expected, sizeof(d1)) != 0)
+	{
+		printf("compareTiles_32u: generic result mismatch\n");
+		return FALSE;
+	}
+
+	if (memcmp(d2, expected, sizeof(d2)) != 0)
+	{
+		printf("compareTiles_32u: optimized result mismatch\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_compareTiles_func(void)
+{
+	UINT32 x;
+	BOOL rc = FALSE;
+	BYTE expected[TEST_TILES] = { 0 };
+	BYTE* src1 = calloc(TEST_HEIGHT, TEST_STEP);
+	BYTE* src2 = calloc(TEST_HEIGHT, TEST_STEP);
+
+	if (!src1 || !src2)
+		goto fail;
+
+	winpr_RAND(src1, TEST_HEIGHT * TEST_STEP);
+	memcpy(src2, src1, TEST_HEIGHT * TEST_STEP);
+
+	/* Identical buffers */
+	if (!check_compareTiles(src1, src2, TEST_HEIGHT, expected))
+		goto fail;
+
+	/* Differences in the row padding must be ignored */
+	for (x = 0; x < TEST_HEIGHT; x++)
+		src2[x * TEST_STEP + TEST_WIDTH * 4] ^= 0xFF;
+
+	if (!check_compareTiles(src1, src2, TEST_HEIGHT, expected))
+		goto fail;
+
+	/* Single byte changes in the first, a middle and the partial last tile */
+	src2[0] ^= 0x01;
+	expected[0] = 1;
+	src2[(TEST_HEIGHT - 1) * TEST_STEP + 17 * 16 * 4 + 63] ^= 0x80;
+	expected[17] = 1;
+	src2[7 * TEST_STEP + TEST_WIDTH * 4 - 1] ^= 0x10;
+	expected[TEST_TILES - 1] = 1;
+
+	if (!check_compareTiles(src1, src2, TEST_HEIGHT, expected))
+		goto fail;
+
+	/* A band of fewer rows does not see the change in the last row */
+	expected[17] = 0;
+
+	if (!check_compareTiles(src1, src2, TEST_HEIGHT - 1, expected))
+		goto fail;
+
+	/* Everything dirty */
+	for (x = 0; x < TEST_TILES; x++)
+	{
+		src2[TEST_STEP + MIN(x * 16 * 4, TEST_WIDTH * 4 - 4)] ^= 0x01;
+		expected[x] = 1;
+	}
+
+	if (!check_compareTiles(src1, src2, TEST_HEIGHT, expected))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	free(src1);
+	free(src2);
+	return rc;
+}
+
+static BOOL test_compareTiles_speed(void)
+{
+	BOOL rc = FALSE;
+	BYTE dirty[TEST_TILES];
+	BYTE* src1 = calloc(TEST_HEIGHT, TEST_STEP);
+	BYTE* src2 = calloc(TEST_HEIGHT, TEST_STEP);
+
+	if (!src1 || !src2)
+		goto fail;
+
+	/* Equal buffers are the worst case, every pixel needs to be compared */
+	if (!speed_test("compareTiles_32u", "equal", g_Iterations,
+	                (speed_test_fkt)generic->compareTiles_32u,
+	                (speed_test_fkt)optimized->compareTiles_32u, src1, TEST_STEP, src2, TEST_STEP,
+	                TEST_WIDTH, TEST_HEIGHT, dirty))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	free(src1);
+	free(src2);
+	return rc;
+}
+
+int TestPrimitivesCompare(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	prim_test_setup(FALSE);
+
+	if (!test_compareTiles_func())
+		return 1;
+
+	if (g_TestPrimitivesPerformance)
+	{
+		if (!test_compareTiles_speed())
+			return 1;
+	}
+
+	return 0;
+}
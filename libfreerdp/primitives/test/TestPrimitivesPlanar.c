@@ -0,0 +1,192 @@
+/* test_planar.c
+ * vi:ts=4 sw=4
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/sysinfo.h>
+#include <freerdp/codec/color.h>
+#include "prim_test.h"
+
+#define TEST_WIDTH 133 /* not a multiple of the vector width */
+#define TEST_HEIGHT 17
+#define TEST_STEP (TEST_WIDTH * 4 + 12)
+#define TEST_PLANE (TEST_WIDTH * TEST_HEIGHT)
+
+static const UINT32 TEST_FORMATS[] = { PIXEL_FORMAT_ARGB32, PIXEL_FORMAT_XRGB32,
+	                                   PIXEL_FORMAT_ABGR32, PIXEL_FORMAT_XBGR32,
+	                                   PIXEL_FORMAT_RGBA32, PIXEL_FORMAT_RGBX32,
+	                                   PIXEL_FORMAT_BGRA32, PIXEL_FORMAT_BGRX32,
+	                                   PIXEL_FORMAT_RGB24,  PIXEL_FORMAT_RGB16 };
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_splitPlanes_func(void)
+{
+	size_t i, p;
+	BOOL rc = FALSE;
+	BYTE* src = calloc(TEST_HEIGHT, TEST_STEP);
+	BYTE* d1 = calloc(4, TEST_PLANE);
+	BYTE* d2 = calloc(4, TEST_PLANE);
+
+	if (!src || !d1 || !d2)
+		goto fail;
+
+	winpr_RAND(src, TEST_HEIGHT * TEST_STEP);
+
+	for (i = 0; i < ARRAYSIZE(TEST_FORMATS); i++)
+	{
+		const UINT32 format = TEST_FORMATS[i];
+		BYTE* p1[4] = { &d1[0], &d1[TEST_PLANE], &d1[2 * TEST_PLANE], &d1[3 * TEST_PLANE] };
+		BYTE* p2[4] = { &d2[0], &d2[TEST_PLANE], &d2[2 * TEST_PLANE], &d2[3 * TEST_PLANE] };
+		const BYTE* last = &src[(TEST_HEIGHT - 1) * TEST_STEP];
+
+		/* Top down and bottom up */
+		for (p = 0; p < 2; p++)
+		{
+			const BYTE* pSrc = (p == 0) ? src : last;
+			const INT32 step = (p == 0) ? TEST_STEP : -TEST_STEP;
+			memset(d1, 0xCC, 4 * TEST_PLANE);
+			memset(d2, 0x33, 4 * TEST_PLANE);
+
+			if (generic->splitPlanes_8u(pSrc, step, format, p1, TEST_WIDTH, TEST_HEIGHT) !=
+			    PRIMITIVES_SUCCESS)
+				goto fail;
+
+			if (optimized->splitPlanes_8u(pSrc, step, format, p2, TEST_WIDTH, TEST_HEIGHT) !=
+			    PRIMITIVES_SUCCESS)
+				goto fail;
+
+			if (memcmp(d1, d2, 4 * TEST_PLANE) != 0)
+			{
+				printf("splitPlanes_8u: %s mismatch\n", FreeRDPGetColorFormatName(format));
+				goto fail;
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(src);
+	free(d1);
+	free(d2);
+	return rc;
+}
+
+static BOOL test_deltaEncodePlane_func(void)
+{
+	size_t x;
+	BOOL rc = FALSE;
+	BYTE src[TEST_PLANE];
+	BYTE d1[TEST_PLANE];
+	BYTE d2[TEST_PLANE];
+
+	winpr_RAND(src, sizeof(src));
+
+	/* Make sure the extreme deltas are covered */
+	src[TEST_WIDTH] = 0x80;
+	src[0] = 0x00;
+	src[TEST_WIDTH + 1] = 0x00;
+	src[1] = 0x80;
+	src[TEST_WIDTH + 2] = 0xFF;
+	src[2] = 0x00;
+
+	if (generic->deltaEncodePlane_8u(src, d1, TEST_WIDTH, TEST_HEIGHT) != PRIMITIVES_SUCCESS)
+		goto fail;
+
+	if (optimized->deltaEncodePlane_8u(src, d2, TEST_WIDTH, TEST_HEIGHT) != PRIMITIVES_SUCCESS)
+		goto fail;
+
+	if (memcmp(d1, src, TEST_WIDTH) != 0)
+	{
+		printf("deltaEncodePlane_8u: first row not copied\n");
+		goto fail;
+	}
+
+	for (x = TEST_WIDTH; x < TEST_PLANE; x++)
+	{
+		const INT32 delta = (INT8)(src[x] - src[x - TEST_WIDTH]);
+		const BYTE expected = (BYTE)((delta >= 0) ? 2 * delta : -2 * delta - 1);
+
+		if (d1[x] != expected)
+		{
+			printf("deltaEncodePlane_8u: generic mismatch at %" PRIuz "\n", x);
+			goto fail;
+		}
+	}
+
+	if (memcmp(d1, d2, sizeof(d1)) != 0)
+	{
+		printf("deltaEncodePlane_8u: optimized mismatch\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	return rc;
+}
+
+static BOOL test_planar_speed(void)
+{
+	BOOL rc = FALSE;
+	BYTE* src = calloc(TEST_HEIGHT, TEST_STEP);
+	BYTE* dst = calloc(4, TEST_PLANE);
+	BYTE* planes[4] = { 0 };
+
+	if (!src || !dst)
+		goto fail;
+
+	planes[0] = &dst[0];
+	planes[1] = &dst[TEST_PLANE];
+	planes[2] = &dst[2 * TEST_PLANE];
+	planes[3] = &dst[3 * TEST_PLANE];
+	winpr_RAND(src, TEST_HEIGHT * TEST_STEP);
+
+	if (!speed_test("splitPlanes_8u", "BGRX32", g_Iterations,
+	                (speed_test_fkt)generic->splitPlanes_8u,
+	                (speed_test_fkt)optimized->splitPlanes_8u, src, TEST_STEP,
+	                PIXEL_FORMAT_BGRX32, planes, TEST_WIDTH, TEST_HEIGHT))
+		goto fail;
+
+	if (!speed_test("deltaEncodePlane_8u", "", g_Iterations,
+	                (speed_test_fkt)generic->deltaEncodePlane_8u,
+	                (speed_test_fkt)optimized->deltaEncodePlane_8u, src, dst, TEST_WIDTH,
+	                TEST_HEIGHT))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	free(src);
+	free(dst);
+	return rc;
+}
+
+int TestPrimitivesPlanar(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	prim_test_setup(FALSE);
+
+	if (!test_splitPlanes_func())
+		return 1;
+
+	if (!test_deltaEncodePlane_func())
+		return 1;
+
+	if (g_TestPrimitivesPerformance)
+	{
+		if (!test_planar_speed())
+			return 1;
+	}
+
+	return 0;
+}
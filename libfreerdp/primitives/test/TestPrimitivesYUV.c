@@ -867,6 +867,80 @@ fail:
 	return res;
 }
 
+/* Compare the optimized RGB to YUV420 conversion against the generic one.
+ * Widths not being a multiple of the vector size check the remainder handling. */
+static BOOL TestPrimitiveRgbToYUV420(primitives_t* prims, prim_size_t roi)
+{
+	BOOL res = FALSE;
+	UINT32 x, y;
+	BYTE* yuv[3] = { 0 };
+	BYTE* yuvGeneric[3] = { 0 };
+	UINT32 yuv_step[3];
+	BYTE* rgb = NULL;
+	const size_t padding = 0x1000;
+	const UINT32 awidth = (roi.width + 15) & ~15u;
+	const UINT32 aheight = (roi.height + 15) & ~15u;
+	const UINT32 stride = awidth * sizeof(UINT32);
+	const size_t size = 1ull * awidth * aheight;
+	const UINT32 formats[] = { PIXEL_FORMAT_BGRX32, PIXEL_FORMAT_BGRA32, PIXEL_FORMAT_RGBX32 };
+
+	if (!prims || !generic)
+		return FALSE;
+
+	fprintf(stderr, "Running RGBToYUV420 on frame size %" PRIu32 "x%" PRIu32 "\n", roi.width,
+	        roi.height);
+
+	if (!(rgb = set_padding(size * sizeof(UINT32), padding)))
+		goto fail;
+
+	if (!allocate_yuv420(yuv, awidth, aheight, padding))
+		goto fail;
+
+	if (!allocate_yuv420(yuvGeneric, awidth, aheight, padding))
+		goto fail;
+
+	for (y = 0; y < roi.height; y++)
+	{
+		BYTE* line = &rgb[y * stride];
+
+		for (x = 0; x < roi.width * 4; x++)
+			line[x] = rand();
+	}
+
+	yuv_step[0] = awidth;
+	yuv_step[1] = (awidth + 1) / 2;
+	yuv_step[2] = (awidth + 1) / 2;
+
+	for (x = 0; x < sizeof(formats) / sizeof(formats[0]); x++)
+	{
+		const UINT32 SrcFormat = formats[x];
+		printf("Testing source color format %s\n", FreeRDPGetColorFormatName(SrcFormat));
+
+		if (prims->RGBToYUV420_8u_P3AC4R(rgb, SrcFormat, stride, yuv, yuv_step, &roi) !=
+		    PRIMITIVES_SUCCESS)
+			goto fail;
+
+		if (generic->RGBToYUV420_8u_P3AC4R(rgb, SrcFormat, stride, yuvGeneric, yuv_step, &roi) !=
+		    PRIMITIVES_SUCCESS)
+			goto fail;
+
+		if (!check_padding(rgb, size * sizeof(UINT32), padding, "rgb") ||
+		    !check_yuv420(yuv, awidth, aheight, padding) ||
+		    !check_yuv420(yuvGeneric, awidth, aheight, padding))
+			goto fail;
+
+		if (!compare_yuv420(yuv, yuvGeneric, awidth, aheight, padding))
+			goto fail;
+	}
+
+	res = TRUE;
+fail:
+	free_padding(rgb, padding);
+	free_yuv420(yuv, padding);
+	free_yuv420(yuvGeneric, padding);
+	return res;
+}
+
 int TestPrimitivesYUV(int argc, char* argv[])
 {
 	BOOL large = (argc > 1);
@@ -965,6 +1039,15 @@ int TestPrimitivesYUV(int argc, char* argv[])
 			goto end;
 		}
 
+		printf("---------------------- END --------------------------\n");
+		printf("------------------- OPTIMIZED -----------------------\n");
+
+		if (!TestPrimitiveRgbToYUV420(prims, roi))
+		{
+			printf("TestPrimitiveRgbToYUV420 failed.\n");
+			goto end;
+		}
+
 		printf("---------------------- END --------------------------\n");
 	}
 
@@ -0,0 +1,354 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Weighted fair queue
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <freerdp/types.h>
+#include <freerdp/utils/fair_queue.h>
+
+#include <winpr/crt.h>
+#include <winpr/assert.h>
+#include <winpr/synch.h>
+
+/*
+ * Start-time fair queueing: every flow carries a virtual start tag that
+ * advances by chunk length / weight when it is served, and the backlogged
+ * flow with the smallest tag goes next. A flow that was idle starts at the
+ * current virtual time, so it cannot bank credit while it has nothing to send.
+ */
+
+#define FAIR_QUEUE_SCALE 65536ULL
+
+typedef struct s_fair_queue_node FairQueueNode;
+
+struct s_fair_queue_node
+{
+	void* item;
+	size_t length;
+	size_t offset;
+	FairQueueNode* next;
+};
+
+typedef struct
+{
+	UINT32 id;
+	UINT32 weight;
+	UINT64 tag;
+	FairQueueNode* head;
+	FairQueueNode* tail;
+	FairQueueStats stats;
+} FairQueueFlow;
+
+struct s_fair_queue
+{
+	CRITICAL_SECTION lock;
+	UINT64 vtime;
+	size_t count;
+	size_t flowCount;
+	size_t flowCapacity;
+	FairQueueFlow* flows;
+};
+
+static FairQueueFlow* fair_queue_find_flow(FairQueue* queue, UINT32 id)
+{
+	size_t i;
+
+	for (i = 0; i < queue->flowCount; i++)
+	{
+		if (queue->flows[i].id == id)
+			return &queue->flows[i];
+	}
+
+	return NULL;
+}
+
+static FairQueueFlow* fair_queue_get_flow(FairQueue* queue, UINT32 id)
+{
+	FairQueueFlow* flow = fair_queue_find_flow(queue, id);
+
+	if (flow)
+		return flow;
+
+	if (queue->flowCount == queue->flowCapacity)
+	{
+		const size_t capacity = queue->flowCapacity ? queue->flowCapacity * 2 : 8;
+		FairQueueFlow* flows = realloc(queue->flows, capacity * sizeof(FairQueueFlow));
+
+		if (!flows)
+			return NULL;
+
+		queue->flows = flows;
+		queue->flowCapacity = capacity;
+	}
+
+	flow = &queue->flows[queue->flowCount++];
+	ZeroMemory(flow, sizeof(FairQueueFlow));
+	flow->id = id;
+	flow->weight = FAIR_QUEUE_DEFAULT_WEIGHT;
+	flow->stats.weight = flow->weight;
+	flow->tag = queue->vtime;
+	return flow;
+}
+
+static void fair_queue_unlink_head(FairQueue* queue, FairQueueFlow* flow)
+{
+	FairQueueNode* node = flow->head;
+
+	flow->head = node->next;
+
+	if (!flow->head)
+		flow->tail = NULL;
+
+	flow->stats.queuedItems--;
+	flow->stats.queuedBytes -= node->length - node->offset;
+	queue->count--;
+	free(node);
+}
+
+FairQueue* fair_queue_new(void)
+{
+	FairQueue* queue = (FairQueue*)calloc(1, sizeof(FairQueue));
+
+	if (!queue)
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&queue->lock, 4000))
+	{
+		free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+void fair_queue_free(FairQueue* queue)
+{
+	size_t i;
+
+	if (!queue)
+		return;
+
+	for (i = 0; i < queue->flowCount; i++)
+	{
+		FairQueueNode* node = queue->flows[i].head;
+
+		while (node)
+		{
+			FairQueueNode* next = node->next;
+			free(node);
+			node = next;
+		}
+	}
+
+	DeleteCriticalSection(&queue->lock);
+	free(queue->flows);
+	free(queue);
+}
+
+BOOL fair_queue_set_weight(FairQueue* queue, UINT32 flow, UINT32 weight)
+{
+	FairQueueFlow* f;
+
+	WINPR_ASSERT(queue);
+
+	if (weight == 0)
+		return FALSE;
+
+	EnterCriticalSection(&queue->lock);
+	f = fair_queue_get_flow(queue, flow);
+
+	if (f)
+	{
+		f->weight = weight;
+		f->stats.weight = weight;
+	}
+
+	LeaveCriticalSection(&queue->lock);
+	return f != NULL;
+}
+
+BOOL fair_queue_push(FairQueue* queue, UINT32 flow, void* item, size_t length)
+{
+	FairQueueFlow* f;
+	FairQueueNode* node;
+
+	WINPR_ASSERT(queue);
+
+	if (length == 0)
+		return FALSE;
+
+	node = (FairQueueNode*)calloc(1, sizeof(FairQueueNode));
+
+	if (!node)
+		return FALSE;
+
+	node->item = item;
+	node->length = length;
+	EnterCriticalSection(&queue->lock);
+	f = fair_queue_get_flow(queue, flow);
+
+	if (!f)
+	{
+		LeaveCriticalSection(&queue->lock);
+		free(node);
+		return FALSE;
+	}
+
+	if (!f->head)
+	{
+		f->tag = MAX(f->tag, queue->vtime);
+		f->head = node;
+	}
+	else
+		f->tail->next = node;
+
+	f->tail = node;
+	f->stats.queuedItems++;
+	f->stats.queuedBytes += length;
+	f->stats.maxQueuedBytes = MAX(f->stats.maxQueuedBytes, f->stats.queuedBytes);
+	queue->count++;
+	LeaveCriticalSection(&queue->lock);
+	return TRUE;
+}
+
+BOOL fair_queue_next(FairQueue* queue, size_t maxChunk, FairQueueChunk* chunk)
+{
+	size_t i;
+	FairQueueNode* node;
+	FairQueueFlow* best = NULL;
+
+	WINPR_ASSERT(queue);
+	WINPR_ASSERT(chunk);
+
+	EnterCriticalSection(&queue->lock);
+
+	for (i = 0; i < queue->flowCount; i++)
+	{
+		FairQueueFlow* f = &queue->flows[i];
+
+		if (f->head && (!best || (f->tag < best->tag)))
+			best = f;
+	}
+
+	if (!best)
+	{
+		LeaveCriticalSection(&queue->lock);
+		return FALSE;
+	}
+
+	node = best->head;
+	chunk->flow = best->id;
+	chunk->item = node->item;
+	chunk->offset = node->offset;
+	chunk->total = node->length;
+	chunk->length = node->length - node->offset;
+
+	if ((maxChunk > 0) && (chunk->length > maxChunk))
+		chunk->length = maxChunk;
+
+	queue->vtime = best->tag;
+	best->tag += MAX(1, chunk->length * FAIR_QUEUE_SCALE / best->weight);
+	best->stats.sentBytes += chunk->length;
+
+	if (chunk->offset + chunk->length == node->length)
+	{
+		best->stats.sentItems++;
+		fair_queue_unlink_head(queue, best);
+	}
+	else
+	{
+		node->offset += chunk->length;
+		best->stats.queuedBytes -= chunk->length;
+	}
+
+	LeaveCriticalSection(&queue->lock);
+	return TRUE;
+}
+
+void* fair_queue_pop(FairQueue* queue, UINT32* flow)
+{
+	size_t i;
+	void* item = NULL;
+
+	WINPR_ASSERT(queue);
+	EnterCriticalSection(&queue->lock);
+
+	for (i = 0; i < queue->flowCount; i++)
+	{
+		FairQueueFlow* f = &queue->flows[i];
+
+		if (f->head)
+		{
+			item = f->head->item;
+
+			if (flow)
+				*flow = f->id;
+
+			fair_queue_unlink_head(queue, f);
+			break;
+		}
+	}
+
+	LeaveCriticalSection(&queue->lock);
+	return item;
+}
+
+size_t fair_queue_count(FairQueue* queue)
+{
+	size_t count;
+
+	WINPR_ASSERT(queue);
+	EnterCriticalSection(&queue->lock);
+	count = queue->count;
+	LeaveCriticalSection(&queue->lock);
+	return count;
+}
+
+BOOL fair_queue_get_stats(FairQueue* queue, UINT32 flow, FairQueueStats* stats)
+{
+	const FairQueueFlow* f;
+
+	WINPR_ASSERT(queue);
+	WINPR_ASSERT(stats);
+	EnterCriticalSection(&queue->lock);
+	f = fair_queue_find_flow(queue, flow);
+
+	if (f)
+		*stats = f->stats;
+
+	LeaveCriticalSection(&queue->lock);
+	return f != NULL;
+}
+
+void fair_queue_remove_flow(FairQueue* queue, UINT32 flow)
+{
+	FairQueueFlow* f;
+
+	WINPR_ASSERT(queue);
+	EnterCriticalSection(&queue->lock);
+	f = fair_queue_find_flow(queue, flow);
+
+	if (f)
+	{
+		while (f->head)
+			fair_queue_unlink_head(queue, f);
+
+		*f = queue->flows[--queue->flowCount];
+	}
+
+	LeaveCriticalSection(&queue->lock);
+}
@@ -74,7 +74,7 @@ static BOOL ringbuffer_realloc(RingBuffer* rb, size_t targetSize)
 	BYTE* newData;
 	DEBUG_RINGBUFFER("ringbuffer_realloc(%p): targetSize: %" PRIdz "", (void*)rb, targetSize);
 
-	if (rb->writePtr == rb->readPtr)
+	if (ringbuffer_used(rb) == 0)
 	{
 		/* when no size is used we can realloc() and set the heads at the
 		 * beginning of the buffer
@@ -87,7 +87,7 @@ static BOOL ringbuffer_realloc(RingBuffer* rb, size_t targetSize)
 		rb->readPtr = rb->writePtr = 0;
 		rb->buffer = newData;
 	}
-	else if ((rb->writePtr >= rb->readPtr) && (rb->writePtr < targetSize))
+	else if ((rb->writePtr > rb->readPtr) && (rb->writePtr < targetSize))
 	{
 		/* we reallocate only if we're in that case, realloc don't touch read
 		 * and write heads
@@ -196,6 +196,7 @@ BOOL ringbuffer_write(RingBuffer* rb, const BYTE* ptr, size_t sz)
 
 BYTE* ringbuffer_ensure_linear_write(RingBuffer* rb, size_t sz)
 {
+	size_t used;
 	DEBUG_RINGBUFFER("ringbuffer_ensure_linear_write(%p): sz: %" PRIdz "", (void*)rb, sz);
 
 	if (rb->freeSize < sz)
@@ -204,11 +205,25 @@ BYTE* ringbuffer_ensure_linear_write(RingBuffer* rb, size_t sz)
 			return NULL;
 	}
 
-	if (rb->writePtr == rb->readPtr)
+	used = ringbuffer_used(rb);
+
+	if (used == 0)
 	{
 		rb->writePtr = rb->readPtr = 0;
 	}
 
+	if (rb->readPtr + used > rb->size)
+	{
+		/* wrapped by ringbuffer_write, reallocating moves the data to the start */
+		if (!ringbuffer_realloc(rb, rb->size))
+			return NULL;
+
+		return rb->buffer + rb->writePtr;
+	}
+
+	/* a write up to the end of the buffer wraps writePtr to 0, the data is still linear */
+	rb->writePtr = rb->readPtr + used;
+
 	if (rb->writePtr + sz < rb->size)
 		return rb->buffer + rb->writePtr;
 
@@ -219,9 +234,9 @@ BYTE* ringbuffer_ensure_linear_write(RingBuffer* rb, size_t sz)
 	 * result:
 	 * [XXXXXXXXX.......     ]
 	 */
-	memmove(rb->buffer, rb->buffer + rb->readPtr, rb->writePtr - rb->readPtr);
+	memmove(rb->buffer, rb->buffer + rb->readPtr, used);
 	rb->readPtr = 0;
-	rb->writePtr = rb->size - rb->freeSize;
+	rb->writePtr = used;
 	return rb->buffer + rb->writePtr;
 }
 
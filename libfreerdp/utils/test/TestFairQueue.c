@@ -0,0 +1,186 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * TestFairQueue
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+
+#include <freerdp/utils/fair_queue.h>
+
+static int items[64];
+
+static BOOL test_weighted_share(void)
+{
+	size_t i;
+	size_t sent[2] = { 0 };
+	FairQueueChunk chunk;
+	BOOL rc = FALSE;
+	FairQueue* queue = fair_queue_new();
+
+	if (!queue)
+		return FALSE;
+
+	if (!fair_queue_set_weight(queue, 1, 1) || !fair_queue_set_weight(queue, 2, 3))
+		goto out;
+
+	for (i = 0; i < 32; i++)
+	{
+		if (!fair_queue_push(queue, 1, &items[i], 1000) ||
+		    !fair_queue_push(queue, 2, &items[32 + i], 1000))
+			goto out;
+	}
+
+	/* while both flows are backlogged flow 2 gets three quarters of the bytes */
+	for (i = 0; i < 80; i++)
+	{
+		if (!fair_queue_next(queue, 500, &chunk))
+			goto out;
+
+		sent[chunk.flow - 1] += chunk.length;
+	}
+
+	if ((sent[1] < 29000) || (sent[1] > 31000))
+	{
+		fprintf(stderr, "flow 2 sent %" PRIuz " of 40000 bytes\n", sent[1]);
+		goto out;
+	}
+
+	rc = TRUE;
+out:
+	fair_queue_free(queue);
+	return rc;
+}
+
+static BOOL test_chunking(void)
+{
+	size_t expected = 0;
+	FairQueueChunk chunk;
+	FairQueueStats stats;
+	BOOL rc = FALSE;
+	FairQueue* queue = fair_queue_new();
+
+	if (!queue)
+		return FALSE;
+
+	if (fair_queue_push(queue, 7, &items[0], 0))
+		goto out;
+
+	if (!fair_queue_push(queue, 7, &items[0], 2500) || !fair_queue_push(queue, 7, &items[1], 10))
+		goto out;
+
+	if (!fair_queue_get_stats(queue, 7, &stats) || (stats.queuedItems != 2) ||
+	    (stats.queuedBytes != 2510) || (stats.maxQueuedBytes != 2510))
+		goto out;
+
+	/* the first item leaves in three chunks before the second one starts */
+	while (expected < 2500)
+	{
+		if (!fair_queue_next(queue, 1000, &chunk))
+			goto out;
+
+		if ((chunk.item != &items[0]) || (chunk.offset != expected) || (chunk.total != 2500))
+			goto out;
+
+		expected += chunk.length;
+	}
+
+	if (!fair_queue_get_stats(queue, 7, &stats) || (stats.queuedItems != 1) ||
+	    (stats.queuedBytes != 10) || (stats.sentItems != 1) || (stats.sentBytes != 2500))
+		goto out;
+
+	if (!fair_queue_next(queue, 1000, &chunk) || (chunk.item != &items[1]) ||
+	    (chunk.length != 10))
+		goto out;
+
+	if (fair_queue_next(queue, 1000, &chunk) || (fair_queue_count(queue) != 0))
+		goto out;
+
+	rc = TRUE;
+out:
+	fair_queue_free(queue);
+	return rc;
+}
+
+static BOOL test_idle_flow(void)
+{
+	size_t i;
+	size_t sent[2] = { 0 };
+	FairQueueChunk chunk;
+	FairQueueStats stats;
+	BOOL rc = FALSE;
+	FairQueue* queue = fair_queue_new();
+
+	if (!queue)
+		return FALSE;
+
+	for (i = 0; i < 16; i++)
+	{
+		if (!fair_queue_push(queue, 1, &items[i], 1000))
+			goto out;
+	}
+
+	for (i = 0; i < 8; i++)
+	{
+		if (!fair_queue_next(queue, 1000, &chunk) || (chunk.flow != 1))
+			goto out;
+	}
+
+	/* a flow that joins late must neither starve the busy one nor be starved */
+	for (i = 0; i < 8; i++)
+	{
+		if (!fair_queue_push(queue, 2, &items[32 + i], 1000))
+			goto out;
+	}
+
+	for (i = 0; i < 8; i++)
+	{
+		if (!fair_queue_next(queue, 1000, &chunk))
+			goto out;
+
+		sent[chunk.flow - 1]++;
+	}
+
+	if ((sent[0] != 4) || (sent[1] != 4))
+		goto out;
+
+	if (!fair_queue_pop(queue, NULL) || (fair_queue_count(queue) != 7))
+		goto out;
+
+	fair_queue_remove_flow(queue, 1);
+
+	if ((fair_queue_count(queue) != 4) || fair_queue_get_stats(queue, 1, &stats))
+		goto out;
+
+	rc = TRUE;
+out:
+	fair_queue_free(queue);
+	return rc;
+}
+
+int TestFairQueue(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_weighted_share())
+		return -1;
+
+	if (!test_chunking())
+		return -2;
+
+	if (!test_idle_flow())
+		return -3;
+
+	return 0;
+}
@@ -80,6 +80,57 @@ error:
 	return FALSE;
 }
 
+/* a linear write up to the end of the buffer wraps the write head to 0 */
+static BOOL test_linear_write_to_end(void)
+{
+	RingBuffer rb;
+	DataChunk chunks[2];
+	BYTE* ptr;
+	size_t i;
+
+	if (!ringbuffer_init(&rb, 32))
+		return FALSE;
+
+	for (i = 0; i < 2; i++) /* [XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX] */
+	{
+		ptr = ringbuffer_ensure_linear_write(&rb, 16);
+		if (!ptr)
+			goto error;
+
+		memset(ptr, (int)i, 16);
+		if (!ringbuffer_commit_written_bytes(&rb, 16))
+			goto error;
+	}
+
+	if ((ringbuffer_peek(&rb, chunks, 32) != 1) || (chunks[0].size != 32))
+		goto error;
+
+	ringbuffer_commit_read_bytes(&rb, 24); /* [........................XXXXXXXX] */
+
+	ptr = ringbuffer_ensure_linear_write(&rb, 16);
+	if (!ptr)
+		goto error;
+
+	memset(ptr, 2, 16);
+	if (!ringbuffer_commit_written_bytes(&rb, 16))
+		goto error;
+
+	if ((ringbuffer_peek(&rb, chunks, 24) != 1) || (chunks[0].size != 24))
+		goto error;
+
+	for (i = 0; i < 24; i++)
+	{
+		if (chunks[0].data[i] != ((i < 8) ? 1 : 2))
+			goto error;
+	}
+
+	ringbuffer_destroy(&rb);
+	return TRUE;
+error:
+	ringbuffer_destroy(&rb);
+	return FALSE;
+}
+
 int TestRingBuffer(int argc, char* argv[])
 {
 	RingBuffer ringBuffer;
@@ -223,6 +274,14 @@ int TestRingBuffer(int argc, char* argv[])
 	}
 	fprintf(stderr, "ok\n");
 
+	fprintf(stderr, "%d: linear write up to the end...", ++testNo);
+	if (!test_linear_write_to_end())
+	{
+		fprintf(stderr, "ko\n");
+		return -1;
+	}
+	fprintf(stderr, "ok\n");
+
 	ringbuffer_destroy(&ringBuffer);
 	free(tmpBuf);
 	return 0;
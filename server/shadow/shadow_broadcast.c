@@ -0,0 +1,336 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/assert.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#include "shadow.h"
+
+#include "shadow_broadcast.h"
+
+#include <freerdp/log.h>
+#define TAG SERVER_TAG("shadow.broadcast")
+
+/* Viewers that keep missing frames must not turn every frame into an IDR frame */
+#define SHADOW_BROADCAST_REFRESH_MS 1000
+
+static void shadow_broadcast_frame_free(SHADOW_BROADCAST_FRAME* frame)
+{
+	size_t x;
+
+	if (!frame)
+		return;
+
+	for (x = 0; x < ARRAYSIZE(frame->avc444.bitstream); x++)
+	{
+		free(frame->avc444.bitstream[x].data);
+		free_h264_metablock(&frame->avc444.bitstream[x].meta);
+	}
+
+	free(frame);
+}
+
+void shadow_broadcast_frame_release(SHADOW_BROADCAST_FRAME* frame)
+{
+	if (!frame)
+		return;
+
+	if (InterlockedDecrement(&frame->refCount) == 0)
+		shadow_broadcast_frame_free(frame);
+}
+
+static BOOL shadow_broadcast_stream_reset(SHADOW_BROADCAST_STREAM* stream)
+{
+	rdpShadowServer* server = stream->server;
+
+	WINPR_ASSERT(server);
+
+	/* A new encoder instance starts with an IDR frame covering the whole surface */
+	h264_context_free(stream->h264);
+	stream->h264 = h264_context_new(TRUE);
+
+	if (!stream->h264)
+		return FALSE;
+
+	if (!h264_context_reset(stream->h264, stream->width, stream->height))
+		return FALSE;
+
+	stream->h264->RateControlMode = server->h264RateControlMode;
+	stream->h264->BitRate = server->h264BitRate;
+	stream->h264->FrameRate = server->h264FrameRate;
+	stream->h264->QP = server->h264QP;
+	return TRUE;
+}
+
+static INT32 shadow_broadcast_stream_encode(SHADOW_BROADCAST_STREAM* stream, const BYTE* pSrcData,
+                                            UINT32 SrcFormat, UINT32 nSrcStep)
+{
+	size_t x;
+	INT32 rc;
+	BOOL keyframe = FALSE;
+	RECTANGLE_16 regionRect = { 0 };
+	SHADOW_BROADCAST_FRAME* frame;
+	RDPGFX_AVC444_BITMAP_STREAM avc444 = { 0 };
+	const UINT64 now = GetTickCount64();
+
+	if (!stream->h264 ||
+	    (stream->refresh && (now - stream->refreshedAt >= SHADOW_BROADCAST_REFRESH_MS)))
+	{
+		if (!shadow_broadcast_stream_reset(stream))
+		{
+			WLog_ERR(TAG, "Failed to create the shared H.264 encoder");
+			return -1;
+		}
+
+		keyframe = TRUE;
+		stream->refresh = FALSE;
+		stream->refreshedAt = now;
+	}
+
+	regionRect.right = (UINT16)stream->width;
+	regionRect.bottom = (UINT16)stream->height;
+
+	if (stream->codecId == RDPGFX_CODECID_AVC420)
+		rc = avc420_compress(stream->h264, pSrcData, SrcFormat, nSrcStep, stream->width,
+		                     stream->height, &regionRect, &avc444.bitstream[0].data,
+		                     &avc444.bitstream[0].length, &avc444.bitstream[0].meta);
+	else
+		rc = avc444_compress(stream->h264, pSrcData, SrcFormat, nSrcStep, stream->width,
+		                     stream->height, (stream->codecId == RDPGFX_CODECID_AVC444v2) ? 2 : 1,
+		                     &regionRect, &avc444.LC, &avc444.bitstream[0].data,
+		                     &avc444.bitstream[0].length, &avc444.bitstream[1].data,
+		                     &avc444.bitstream[1].length, &avc444.bitstream[0].meta,
+		                     &avc444.bitstream[1].meta);
+
+	if (rc <= 0)
+	{
+		free_h264_metablock(&avc444.bitstream[0].meta);
+		free_h264_metablock(&avc444.bitstream[1].meta);
+		return rc;
+	}
+
+	frame = (SHADOW_BROADCAST_FRAME*)calloc(1, sizeof(SHADOW_BROADCAST_FRAME));
+
+	if (!frame)
+	{
+		free_h264_metablock(&avc444.bitstream[0].meta);
+		free_h264_metablock(&avc444.bitstream[1].meta);
+		return -1;
+	}
+
+	/* The bitstreams live in the encoder, the frame may outlive the next encode */
+	frame->avc444 = avc444;
+	frame->refCount = 1;
+
+	for (x = 0; x < ARRAYSIZE(avc444.bitstream); x++)
+	{
+		frame->avc444.bitstream[x].data = NULL;
+
+		if (avc444.bitstream[x].length == 0)
+			continue;
+
+		frame->avc444.bitstream[x].data = (BYTE*)malloc(avc444.bitstream[x].length);
+
+		if (!frame->avc444.bitstream[x].data)
+		{
+			shadow_broadcast_frame_free(frame);
+			return -1;
+		}
+
+		CopyMemory(frame->avc444.bitstream[x].data, avc444.bitstream[x].data,
+		           avc444.bitstream[x].length);
+	}
+
+	frame->sequence = ++stream->sequence;
+	frame->keyframe = keyframe;
+	frame->codecId = stream->codecId;
+	stream->frame = frame;
+	return 1;
+}
+
+INT32 shadow_broadcast_encode(SHADOW_BROADCAST_STREAM* stream, UINT32 frameSequence,
+                              const BYTE* pSrcData, UINT32 SrcFormat, UINT32 nSrcStep,
+                              SHADOW_BROADCAST_FRAME** ppFrame)
+{
+	INT32 rc = 0;
+
+	WINPR_ASSERT(stream);
+	WINPR_ASSERT(ppFrame);
+
+	*ppFrame = NULL;
+	EnterCriticalSection(&stream->lock);
+
+	if (!stream->encoded || (stream->frameSequence != frameSequence))
+	{
+		shadow_broadcast_frame_release(stream->frame);
+		stream->frame = NULL;
+		stream->encoded = FALSE;
+
+		if (shadow_broadcast_stream_encode(stream, pSrcData, SrcFormat, nSrcStep) < 0)
+		{
+			rc = -1;
+			goto out;
+		}
+
+		stream->encoded = TRUE;
+		stream->frameSequence = frameSequence;
+	}
+
+	if (stream->frame)
+	{
+		InterlockedIncrement(&stream->frame->refCount);
+		*ppFrame = stream->frame;
+		rc = 1;
+	}
+
+out:
+	LeaveCriticalSection(&stream->lock);
+	return rc;
+}
+
+void shadow_broadcast_request_refresh(SHADOW_BROADCAST_STREAM* stream)
+{
+	WINPR_ASSERT(stream);
+
+	EnterCriticalSection(&stream->lock);
+	stream->refresh = TRUE;
+	LeaveCriticalSection(&stream->lock);
+}
+
+static void shadow_broadcast_stream_free(void* obj)
+{
+	SHADOW_BROADCAST_STREAM* stream = (SHADOW_BROADCAST_STREAM*)obj;
+
+	if (!stream)
+		return;
+
+	shadow_broadcast_frame_release(stream->frame);
+	h264_context_free(stream->h264);
+	DeleteCriticalSection(&stream->lock);
+	free(stream);
+}
+
+SHADOW_BROADCAST_STREAM* shadow_broadcast_subscribe(rdpShadowBroadcast* broadcast,
+                                                    const rdpShadowSurface* surface,
+                                                    UINT32 codecId, UINT32 width, UINT32 height)
+{
+	size_t x;
+	SHADOW_BROADCAST_STREAM* found = NULL;
+
+	WINPR_ASSERT(broadcast);
+
+	ArrayList_Lock(broadcast->streams);
+
+	for (x = 0; x < ArrayList_Count(broadcast->streams); x++)
+	{
+		SHADOW_BROADCAST_STREAM* stream =
+		    (SHADOW_BROADCAST_STREAM*)ArrayList_GetItem(broadcast->streams, x);
+
+		if ((stream->surface == surface) && (stream->codecId == codecId) &&
+		    (stream->width == width) && (stream->height == height))
+		{
+			found = stream;
+			break;
+		}
+	}
+
+	if (found)
+	{
+		/* The viewer starts on its own encoder and asks for an IDR frame to join */
+		found->subscribers++;
+	}
+	else
+	{
+		found = (SHADOW_BROADCAST_STREAM*)calloc(1, sizeof(SHADOW_BROADCAST_STREAM));
+
+		if (found)
+		{
+			found->server = broadcast->server;
+			found->surface = surface;
+			found->codecId = codecId;
+			found->width = width;
+			found->height = height;
+			found->subscribers = 1;
+
+			if (!InitializeCriticalSectionAndSpinCount(&found->lock, 4000))
+			{
+				free(found);
+				found = NULL;
+			}
+			else if (!ArrayList_Append(broadcast->streams, found))
+			{
+				shadow_broadcast_stream_free(found);
+				found = NULL;
+			}
+		}
+	}
+
+	if (found)
+		WLog_DBG(TAG, "codec 0x%04" PRIx32 " %" PRIu32 "x%" PRIu32 ": %" PRIuz " viewers",
+		         codecId, width, height, found->subscribers);
+
+	ArrayList_Unlock(broadcast->streams);
+	return found;
+}
+
+void shadow_broadcast_unsubscribe(rdpShadowBroadcast* broadcast, SHADOW_BROADCAST_STREAM* stream)
+{
+	if (!broadcast || !stream)
+		return;
+
+	ArrayList_Lock(broadcast->streams);
+
+	if (--stream->subscribers == 0)
+		ArrayList_Remove(broadcast->streams, stream);
+
+	ArrayList_Unlock(broadcast->streams);
+}
+
+rdpShadowBroadcast* shadow_broadcast_new(rdpShadowServer* server)
+{
+	wObject* obj;
+	rdpShadowBroadcast* broadcast;
+
+	broadcast = (rdpShadowBroadcast*)calloc(1, sizeof(rdpShadowBroadcast));
+
+	if (!broadcast)
+		return NULL;
+
+	broadcast->server = server;
+	broadcast->streams = ArrayList_New(TRUE);
+
+	if (!broadcast->streams)
+	{
+		free(broadcast);
+		return NULL;
+	}
+
+	obj = ArrayList_Object(broadcast->streams);
+	obj->fnObjectFree = shadow_broadcast_stream_free;
+	return broadcast;
+}
+
+void shadow_broadcast_free(rdpShadowBroadcast* broadcast)
+{
+	if (!broadcast)
+		return;
+
+	ArrayList_Free(broadcast->streams);
+	free(broadcast);
+}
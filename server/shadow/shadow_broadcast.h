@@ -0,0 +1,98 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_BROADCAST_H
+#define FREERDP_SERVER_SHADOW_BROADCAST_H
+
+#include <freerdp/server/shadow.h>
+#include <freerdp/codec/h264.h>
+#include <freerdp/channels/rdpgfx.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/collections.h>
+
+/*
+ * Shared H.264 encoders for full screen GFX updates.
+ * Clients showing the same surface at the same resolution and AVC profile
+ * subscribe to one encoder and send the same bitstream. The encoder output
+ * only decodes as an unbroken sequence, so a client that joins or misses a
+ * frame falls back to its own encoder until the next IDR frame of the stream.
+ */
+
+typedef struct
+{
+	UINT32 sequence; /* consecutive for every encoder output, starts at 1 */
+	BOOL keyframe;
+	UINT32 codecId;                     /* RDPGFX_CODECID_AVC420, _AVC444 or _AVC444v2 */
+	RDPGFX_AVC444_BITMAP_STREAM avc444; /* AVC420 only uses bitstream[0] */
+	volatile LONG refCount;
+} SHADOW_BROADCAST_FRAME;
+
+typedef struct
+{
+	rdpShadowServer* server;
+	const rdpShadowSurface* surface;
+	UINT32 codecId;
+	UINT32 width;
+	UINT32 height;
+	size_t subscribers;
+
+	CRITICAL_SECTION lock;
+	H264_CONTEXT* h264;
+	BOOL refresh;
+	UINT64 refreshedAt;
+	UINT32 sequence;
+	BOOL encoded;
+	UINT32 frameSequence;          /* surface frame encoded last */
+	SHADOW_BROADCAST_FRAME* frame; /* its output, NULL if nothing changed */
+} SHADOW_BROADCAST_STREAM;
+
+struct rdp_shadow_broadcast
+{
+	rdpShadowServer* server;
+	wArrayList* streams;
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	SHADOW_BROADCAST_STREAM* shadow_broadcast_subscribe(rdpShadowBroadcast* broadcast,
+	                                                    const rdpShadowSurface* surface,
+	                                                    UINT32 codecId, UINT32 width,
+	                                                    UINT32 height);
+	void shadow_broadcast_unsubscribe(rdpShadowBroadcast* broadcast,
+	                                  SHADOW_BROADCAST_STREAM* stream);
+	void shadow_broadcast_request_refresh(SHADOW_BROADCAST_STREAM* stream);
+
+	/** Encode the surface frame unless a subscriber already did
+	 *  \return 1 and a reference in \b ppFrame, 0 if nothing changed, -1 on failure
+	 */
+	INT32 shadow_broadcast_encode(SHADOW_BROADCAST_STREAM* stream, UINT32 frameSequence,
+	                              const BYTE* pSrcData, UINT32 SrcFormat, UINT32 nSrcStep,
+	                              SHADOW_BROADCAST_FRAME** ppFrame);
+	void shadow_broadcast_frame_release(SHADOW_BROADCAST_FRAME* frame);
+
+	rdpShadowBroadcast* shadow_broadcast_new(rdpShadowServer* server);
+	void shadow_broadcast_free(rdpShadowBroadcast* broadcast);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_BROADCAST_H */
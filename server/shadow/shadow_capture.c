@@ -22,6 +22,7 @@
 #include <winpr/print.h>
 
 #include <freerdp/log.h>
+#include <freerdp/primitives.h>
 
 #include "shadow_surface.h"
 
@@ -77,149 +78,158 @@ int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip)
 	return 1;
 }
 
-int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight, BYTE* pData2,
-                           UINT32 nStep2, RECTANGLE_16* rect)
+/* Emit the dirty tile runs of a tile row band spanning rows [top, bottom) */
+static BOOL shadow_capture_add_runs(REGION16* region, const BYTE* dirty, UINT32 ncol,
+                                    UINT32 nWidth, UINT32 top, UINT32 bottom)
 {
-	BOOL equal;
-	BOOL allEqual;
-	UINT32 tw, th;
-	UINT32 tx, ty, k;
-	UINT32 nrow, ncol;
-	UINT32 l, t, r, b;
-	BYTE *p1, *p2;
-	BOOL rows[1024];
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	BOOL cols[1024];
-#endif
-	allEqual = TRUE;
-	ZeroMemory(rect, sizeof(RECTANGLE_16));
-	FillMemory(rows, sizeof(rows), 0xFF);
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	FillMemory(cols, sizeof(cols), 0xFF);
-#endif
-	nrow = (nHeight + 15) / 16;
-	ncol = (nWidth + 15) / 16;
-	l = ncol + 1;
-	r = 0;
-	t = nrow + 1;
-	b = 0;
+	UINT32 tx = 0;
 
-	for (ty = 0; ty < nrow; ty++)
+	while (tx < ncol)
 	{
-		th = ((ty + 1) == nrow) ? (nHeight % 16) : 16;
-
-		if (!th)
-			th = 16;
+		RECTANGLE_16 rect;
+		UINT32 end;
 
-		for (tx = 0; tx < ncol; tx++)
+		if (!dirty[tx])
 		{
-			equal = TRUE;
-			tw = ((tx + 1) == ncol) ? (nWidth % 16) : 16;
+			tx++;
+			continue;
+		}
 
-			if (!tw)
-				tw = 16;
+		for (end = tx + 1; (end < ncol) && dirty[end]; end++)
+			;
 
-			p1 = &pData1[(ty * 16 * nStep1) + (tx * 16 * 4)];
-			p2 = &pData2[(ty * 16 * nStep2) + (tx * 16 * 4)];
+		rect.left = (UINT16)(tx * 16);
+		rect.top = (UINT16)top;
+		rect.right = (UINT16)MIN(end * 16, nWidth);
+		rect.bottom = (UINT16)bottom;
 
-			for (k = 0; k < th; k++)
-			{
-				if (memcmp(p1, p2, tw * 4) != 0)
-				{
-					equal = FALSE;
-					break;
-				}
-
-				p1 += nStep1;
-				p2 += nStep2;
-			}
+		if (!region16_union_rect(region, region, &rect))
+			return FALSE;
 
-			if (!equal)
-			{
-				rows[ty] = FALSE;
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-				cols[tx] = FALSE;
-#endif
+		tx = end;
+	}
 
-				if (l > tx)
-					l = tx;
+	return TRUE;
+}
 
-				if (r < tx)
-					r = tx;
-			}
-		}
+int shadow_capture_compare_region(const BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight,
+                                  const BYTE* pData2, UINT32 nStep2, REGION16* region)
+{
+	int rc = -1;
+	UINT32 ty;
+	UINT32 nrow, ncol;
+	UINT32 bandTop = 0;
+	BOOL bandDirty = FALSE;
+	BOOL allEqual = TRUE;
+	BYTE* band;
+	BYTE* cur;
+	const primitives_t* prims = primitives_get();
+
+	WINPR_ASSERT(pData1);
+	WINPR_ASSERT(pData2);
+	WINPR_ASSERT(region);
+	WINPR_ASSERT(prims);
+
+	if ((nWidth > UINT16_MAX) || (nHeight > UINT16_MAX))
+		return -1;
+
+	region16_clear(region);
+	nrow = (nHeight + 15) / 16;
+	ncol = (nWidth + 15) / 16;
 
-		if (!rows[ty])
-		{
-			allEqual = FALSE;
+	if (ncol == 0)
+		return 0;
 
-			if (t > ty)
-				t = ty;
+	/* band: dirty tiles of the pending rows, cur: dirty tiles of the current row */
+	band = (BYTE*)calloc(2, ncol);
 
-			if (b < ty)
-				b = ty;
-		}
-	}
+	if (!band)
+		return -1;
 
-	if (allEqual)
-		return 0;
+	cur = &band[ncol];
 
-	WINPR_ASSERT(l * 16 <= UINT16_MAX);
-	WINPR_ASSERT(t * 16 <= UINT16_MAX);
-	WINPR_ASSERT((r + 1) * 16 <= UINT16_MAX);
-	WINPR_ASSERT((b + 1) * 16 <= UINT16_MAX);
-	rect->left = (UINT16)l * 16;
-	rect->top = (UINT16)t * 16;
-	rect->right = (UINT16)(r + 1) * 16;
-	rect->bottom = (UINT16)(b + 1) * 16;
+	for (ty = 0; ty < nrow; ty++)
+	{
+		const UINT32 top = ty * 16;
+		const UINT32 th = MIN(16, nHeight - top);
+		BOOL rowDirty;
 
-	WINPR_ASSERT(nWidth <= UINT16_MAX);
-	if (rect->right > nWidth)
-		rect->right = (UINT16)nWidth;
+		if (prims->compareTiles_32u(&pData1[(size_t)top * nStep1], nStep1,
+		                            &pData2[(size_t)top * nStep2], nStep2, nWidth, th,
+		                            cur) != PRIMITIVES_SUCCESS)
+			goto fail;
 
-	WINPR_ASSERT(nHeight <= UINT16_MAX);
-	if (rect->bottom > nHeight)
-		rect->bottom = (UINT16)nHeight;
+		rowDirty = memchr(cur, 1, ncol) != NULL;
 
 #ifdef WITH_DEBUG_SHADOW_CAPTURE
-	size_t size = ncol + 1;
-	char* col_str = calloc(size, sizeof(char));
+		{
+			UINT32 tx;
+			char* row_str = calloc(ncol + 1, sizeof(char));
 
-	if (!col_str)
-	{
-		WLog_ERR(TAG, "calloc failed!");
-		return 1;
-	}
+			if (row_str)
+			{
+				for (tx = 0; tx < ncol; tx++)
+					row_str[tx] = cur[tx] ? 'X' : 'O';
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "-");
+				WLog_INFO(TAG, "|%s|", row_str);
+				free(row_str);
+			}
+		}
+#endif
 
-	WLog_INFO(TAG, "%s", col_str);
+		/* Consecutive rows with the same dirty pattern are merged into one band
+		 * to keep the number of rectangles added to the region low. */
+		if (bandDirty && rowDirty && (memcmp(band, cur, ncol) == 0))
+			continue;
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "%c", cols[tx] ? 'O' : 'X');
+		if (bandDirty && !shadow_capture_add_runs(region, band, ncol, nWidth, bandTop, top))
+			goto fail;
 
-	WLog_INFO(TAG, "%s", col_str);
+		bandDirty = rowDirty;
+		bandTop = top;
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "-");
+		if (rowDirty)
+		{
+			allEqual = FALSE;
+			memcpy(band, cur, ncol);
+		}
+	}
 
-	WLog_INFO(TAG, "%s", col_str);
+	if (bandDirty && !shadow_capture_add_runs(region, band, ncol, nWidth, bandTop, nHeight))
+		goto fail;
 
-	for (ty = 0; ty < nrow; ty++)
-	{
-		for (tx = 0; tx < ncol; tx++)
-			sprintf_s(&col_str[tx], size - tx, "%c", cols[tx] ? 'O' : 'X');
+	rc = allEqual ? 0 : 1;
+fail:
+	free(band);
+	return rc;
+}
+
+int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight, BYTE* pData2,
+                           UINT32 nStep2, RECTANGLE_16* rect)
+{
+	int rc;
+	REGION16 region;
+
+	WINPR_ASSERT(rect);
+
+	ZeroMemory(rect, sizeof(RECTANGLE_16));
+	region16_init(&region);
+	rc = shadow_capture_compare_region(pData1, nStep1, nWidth, nHeight, pData2, nStep2, &region);
 
-		WLog_INFO(TAG, "%s", col_str);
-		WLog_INFO(TAG, "|%s|", rows[ty] ? "O" : "X");
+	if (rc > 0)
+		*rect = *region16_extents(&region);
+	else if (rc < 0)
+	{
+		/* Comparison failed, report the whole area as changed */
+		WLog_WARN(TAG, "tile comparison failed, invalidating %" PRIu32 "x%" PRIu32, nWidth,
+		          nHeight);
+		rect->right = (UINT16)MIN(nWidth, UINT16_MAX);
+		rect->bottom = (UINT16)MIN(nHeight, UINT16_MAX);
+		rc = 1;
 	}
 
-	WLog_INFO(TAG, "left: %d top: %d right: %d bottom: %d ncol: %d nrow: %d", l, t, r, b, ncol,
-	          nrow);
-	free(col_str);
-#endif
-	return 1;
+	region16_uninit(&region);
+	return rc;
 }
 
 rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
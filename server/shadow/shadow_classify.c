@@ -0,0 +1,252 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/assert.h>
+
+#include "shadow.h"
+
+#include "shadow_classify.h"
+
+/* Tiles with at most this many distinct sampled colors are text or UI */
+#define SHADOW_CLASSIFY_TEXT_COLORS 48
+/* Sharp edges per 1024 pairs above which a tile is text even with many colors */
+#define SHADOW_CLASSIFY_TEXT_EDGES 128
+/* Luma step between neighbours that counts as a sharp edge */
+#define SHADOW_CLASSIFY_EDGE_STEP 48
+/* Activity from which many-colored tiles are video, about four damaged frames in a row */
+#define SHADOW_CLASSIFY_VIDEO_ACTIVITY 160
+/* Size of the color set, twice the largest count that is told apart */
+#define SHADOW_CLASSIFY_COLOR_SLOTS 256
+
+static INLINE UINT32 shadow_classify_luma(UINT32 pixel)
+{
+	return (((pixel >> 16) & 0xFF) + 2 * ((pixel >> 8) & 0xFF) + (pixel & 0xFF)) >> 2;
+}
+
+/* Samples every second pixel of every second row of the tile */
+static void shadow_classify_sample(const rdpShadowSurface* surface, UINT32 left, UINT32 top,
+                                   UINT32 width, UINT32 height, SHADOW_CLASSIFY_TILE* tile)
+{
+	UINT32 x, y;
+	UINT32 colors = 0;
+	UINT32 edges = 0;
+	UINT32 pairs = 0;
+	UINT32 set[SHADOW_CLASSIFY_COLOR_SLOTS] = { 0 };
+
+	for (y = 0; y < height; y += 2)
+	{
+		const UINT32* line =
+		    (const UINT32*)&surface->data[(top + y) * surface->scanline + left * 4];
+
+		for (x = 0; x < width; x += 2)
+		{
+			const UINT32 pixel = line[x] & 0x00FFFFFF;
+
+			if (colors < SHADOW_CLASSIFY_COLOR_SLOTS / 2)
+			{
+				UINT32 slot = (pixel * 2654435761u) >> 24;
+
+				/* Slots store the color plus one, zero is free */
+				while (set[slot] && (set[slot] != pixel + 1))
+					slot = (slot + 1) % SHADOW_CLASSIFY_COLOR_SLOTS;
+
+				if (!set[slot])
+				{
+					set[slot] = pixel + 1;
+					colors++;
+				}
+			}
+
+			if (x + 1 < width)
+			{
+				const INT32 step = (INT32)shadow_classify_luma(pixel) -
+				                   (INT32)shadow_classify_luma(line[x + 1] & 0x00FFFFFF);
+
+				if ((step >= SHADOW_CLASSIFY_EDGE_STEP) || (step <= -SHADOW_CLASSIFY_EDGE_STEP))
+					edges++;
+
+				pairs++;
+			}
+		}
+	}
+
+	tile->colors = (UINT16)colors;
+	tile->edges = (UINT16)(pairs ? (edges * 1024) / pairs : 0);
+}
+
+static SHADOW_CONTENT_TYPE shadow_classify_tile(const SHADOW_CLASSIFY_TILE* tile)
+{
+	if (tile->colors <= SHADOW_CLASSIFY_TEXT_COLORS)
+		return SHADOW_CONTENT_TEXT;
+
+	/* Video keeps its class while it plays even if a frame has many edges */
+	if (tile->activity >= SHADOW_CLASSIFY_VIDEO_ACTIVITY)
+	{
+		if ((tile->type == SHADOW_CONTENT_VIDEO) || (tile->edges < SHADOW_CLASSIFY_TEXT_EDGES))
+			return SHADOW_CONTENT_VIDEO;
+	}
+
+	if (tile->edges >= SHADOW_CLASSIFY_TEXT_EDGES)
+		return SHADOW_CONTENT_TEXT;
+
+	return SHADOW_CONTENT_IMAGE;
+}
+
+static BOOL shadow_classifier_resize(rdpShadowClassifier* classifier, UINT32 width, UINT32 height)
+{
+	const UINT32 tilesX = (width + SHADOW_CLASSIFY_TILE_SIZE - 1) / SHADOW_CLASSIFY_TILE_SIZE;
+	const UINT32 tilesY = (height + SHADOW_CLASSIFY_TILE_SIZE - 1) / SHADOW_CLASSIFY_TILE_SIZE;
+	const size_t count = MAX((size_t)tilesX * tilesY, 1);
+
+	free(classifier->tiles);
+	free(classifier->damaged);
+	classifier->tiles = (SHADOW_CLASSIFY_TILE*)calloc(count, sizeof(SHADOW_CLASSIFY_TILE));
+	classifier->damaged = (BYTE*)calloc(count, sizeof(BYTE));
+
+	if (!classifier->tiles || !classifier->damaged)
+	{
+		free(classifier->tiles);
+		free(classifier->damaged);
+		classifier->tiles = NULL;
+		classifier->damaged = NULL;
+		classifier->width = classifier->height = 0;
+		classifier->tilesX = classifier->tilesY = 0;
+		return FALSE;
+	}
+
+	classifier->width = width;
+	classifier->height = height;
+	classifier->tilesX = tilesX;
+	classifier->tilesY = tilesY;
+	return TRUE;
+}
+
+BOOL shadow_classifier_update(rdpShadowClassifier* classifier, const rdpShadowSurface* surface)
+{
+	UINT32 x, y;
+	UINT32 index;
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects;
+	RECTANGLE_16 video = { UINT16_MAX, UINT16_MAX, 0, 0 };
+
+	WINPR_ASSERT(classifier);
+	WINPR_ASSERT(surface);
+
+	if ((classifier->width != surface->width) || (classifier->height != surface->height) ||
+	    !classifier->tiles)
+	{
+		if (!shadow_classifier_resize(classifier, surface->width, surface->height))
+			return FALSE;
+	}
+
+	ZeroMemory(classifier->damaged, (size_t)classifier->tilesX * classifier->tilesY);
+	rects = region16_rects(&surface->invalidRegion, &numRects);
+
+	for (index = 0; index < numRects; index++)
+	{
+		const RECTANGLE_16* rect = &rects[index];
+		const UINT32 right = MIN(rect->right, classifier->width);
+		const UINT32 bottom = MIN(rect->bottom, classifier->height);
+
+		if ((rect->left >= right) || (rect->top >= bottom))
+			continue;
+
+		for (y = rect->top / SHADOW_CLASSIFY_TILE_SIZE;
+		     y <= (bottom - 1) / SHADOW_CLASSIFY_TILE_SIZE; y++)
+		{
+			for (x = rect->left / SHADOW_CLASSIFY_TILE_SIZE;
+			     x <= (right - 1) / SHADOW_CLASSIFY_TILE_SIZE; x++)
+				classifier->damaged[y * classifier->tilesX + x] = 1;
+		}
+	}
+
+	classifier->videoTiles = 0;
+
+	for (y = 0; y < classifier->tilesY; y++)
+	{
+		for (x = 0; x < classifier->tilesX; x++)
+		{
+			SHADOW_CLASSIFY_TILE* tile = &classifier->tiles[y * classifier->tilesX + x];
+
+			if (classifier->damaged[y * classifier->tilesX + x])
+			{
+				const UINT32 left = x * SHADOW_CLASSIFY_TILE_SIZE;
+				const UINT32 top = y * SHADOW_CLASSIFY_TILE_SIZE;
+
+				tile->activity += (255 - tile->activity + 3) / 4;
+				shadow_classify_sample(surface, left, top,
+				                       MIN(SHADOW_CLASSIFY_TILE_SIZE, classifier->width - left),
+				                       MIN(SHADOW_CLASSIFY_TILE_SIZE, classifier->height - top),
+				                       tile);
+				tile->type = (BYTE)shadow_classify_tile(tile);
+			}
+			else
+			{
+				tile->activity -= (tile->activity + 7) / 8;
+
+				/* A paused video is an image, its tiles are sent as such once they change */
+				if ((tile->type == SHADOW_CONTENT_VIDEO) &&
+				    (tile->activity < SHADOW_CLASSIFY_VIDEO_ACTIVITY / 2))
+					tile->type = SHADOW_CONTENT_IMAGE;
+			}
+
+			if (tile->type == SHADOW_CONTENT_VIDEO)
+			{
+				video.left = (UINT16)MIN(video.left, x * SHADOW_CLASSIFY_TILE_SIZE);
+				video.top = (UINT16)MIN(video.top, y * SHADOW_CLASSIFY_TILE_SIZE);
+				video.right = (UINT16)MAX(
+				    video.right, MIN((x + 1) * SHADOW_CLASSIFY_TILE_SIZE, classifier->width));
+				video.bottom = (UINT16)MAX(
+				    video.bottom, MIN((y + 1) * SHADOW_CLASSIFY_TILE_SIZE, classifier->height));
+				classifier->videoTiles++;
+			}
+		}
+	}
+
+	if (classifier->videoTiles == 0)
+		ZeroMemory(&video, sizeof(video));
+
+	classifier->videoRect = video;
+	return TRUE;
+}
+
+SHADOW_CONTENT_TYPE shadow_classifier_tile_type(const rdpShadowClassifier* classifier,
+                                                UINT32 tileX, UINT32 tileY)
+{
+	WINPR_ASSERT(classifier);
+
+	if ((tileX >= classifier->tilesX) || (tileY >= classifier->tilesY))
+		return SHADOW_CONTENT_NONE;
+
+	return (SHADOW_CONTENT_TYPE)classifier->tiles[tileY * classifier->tilesX + tileX].type;
+}
+
+rdpShadowClassifier* shadow_classifier_new(void)
+{
+	return (rdpShadowClassifier*)calloc(1, sizeof(rdpShadowClassifier));
+}
+
+void shadow_classifier_free(rdpShadowClassifier* classifier)
+{
+	if (!classifier)
+		return;
+
+	free(classifier->tiles);
+	free(classifier->damaged);
+	free(classifier);
+}
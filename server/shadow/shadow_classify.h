@@ -0,0 +1,82 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_CLASSIFY_H
+#define FREERDP_SERVER_SHADOW_CLASSIFY_H
+
+#include <freerdp/server/shadow.h>
+
+#include <winpr/crt.h>
+
+/*
+ * Content classifier of the server surface.
+ * Every frame the damaged 64x64 tiles are sampled for their color count and
+ * the density of sharp edges, and the damage frequency of every tile is
+ * tracked. The GFX path uses the result to send video-like tiles as H.264
+ * and text and UI tiles as planar within one frame.
+ */
+
+#define SHADOW_CLASSIFY_TILE_SIZE 64
+
+typedef enum
+{
+	SHADOW_CONTENT_NONE = 0, /* not damaged since the classifier started */
+	SHADOW_CONTENT_TEXT,     /* few colors or dense sharp edges: text and UI */
+	SHADOW_CONTENT_IMAGE,    /* many colors, changing rarely */
+	SHADOW_CONTENT_VIDEO     /* many colors, smooth, damaged nearly every frame */
+} SHADOW_CONTENT_TYPE;
+
+typedef struct
+{
+	BYTE type;     /* SHADOW_CONTENT_TYPE */
+	BYTE activity; /* decaying damage frequency, 255 is damaged every frame */
+	UINT16 colors; /* distinct colors among the samples, saturates */
+	UINT16 edges;  /* sharp edges per 1024 sampled pixel pairs */
+} SHADOW_CLASSIFY_TILE;
+
+struct rdp_shadow_classifier
+{
+	UINT32 width;
+	UINT32 height;
+	UINT32 tilesX;
+	UINT32 tilesY;
+	SHADOW_CLASSIFY_TILE* tiles;
+	BYTE* damaged; /* tiles touched by the current frame */
+
+	RECTANGLE_16 videoRect; /* bounds of the video tiles, empty if there are none */
+	UINT32 videoTiles;
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	/* Call with the surface lock held, after the frame's damage is in surface->invalidRegion */
+	FREERDP_LOCAL BOOL shadow_classifier_update(rdpShadowClassifier* classifier,
+	                                            const rdpShadowSurface* surface);
+
+	FREERDP_LOCAL SHADOW_CONTENT_TYPE
+	shadow_classifier_tile_type(const rdpShadowClassifier* classifier, UINT32 tileX, UINT32 tileY);
+
+	FREERDP_LOCAL rdpShadowClassifier* shadow_classifier_new(void);
+	FREERDP_LOCAL void shadow_classifier_free(rdpShadowClassifier* classifier);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_CLASSIFY_H */
@@ -523,6 +523,20 @@ static BOOL shadow_client_refresh_request(rdpShadowClient* client)
 	return MessageQueue_Dispatch(MsgPipe->In, &message);
 }
 
+/* A client that keeps falling out of step asks the shared stream for IDR frames less often */
+#define SHADOW_BROADCAST_STABLE_MS 10000
+#define SHADOW_BROADCAST_BACKOFF_MIN_MS 1000
+#define SHADOW_BROADCAST_BACKOFF_MAX_MS 30000
+
+static void shadow_client_broadcast_detach(rdpShadowEncoder* encoder, UINT64 now)
+{
+	WINPR_ASSERT(encoder);
+
+	encoder->broadcastSequence = 0;
+	encoder->broadcastBridging = FALSE;
+	encoder->broadcastNextRequest = now + encoder->broadcastBackoff;
+}
+
 static BOOL shadow_client_refresh_rect(rdpContext* context, BYTE count, const RECTANGLE_16* areas)
 {
 	rdpShadowClient* client = (rdpShadowClient*)context;
@@ -550,6 +564,10 @@ static BOOL shadow_client_refresh_rect(rdpContext* context, BYTE count, const RE
 		shadow_client_mark_invalid(client, 0, NULL);
 	}
 
+	/* Refreshed by the own H.264 encoder of the client, the shared stream keeps going */
+	if (client->encoder)
+		shadow_client_broadcast_detach(client->encoder, GetTickCount64());
+
 	return shadow_client_refresh_request(client);
 }
 
@@ -697,7 +715,7 @@ static INLINE void shadow_client_common_frame_acknowledge(rdpShadowClient* clien
 	 */
 	WINPR_ASSERT(client);
 	WINPR_ASSERT(client->encoder);
-	client->encoder->lastAckframeId = frameId;
+	shadow_encoder_frame_acknowledged(client->encoder, frameId);
 }
 
 static BOOL shadow_client_surface_frame_acknowledge(rdpContext* context, UINT32 frameId)
@@ -993,6 +1011,695 @@ static INLINE UINT32 rdpgfx_estimate_h264_avc420(RDPGFX_AVC420_BITMAP_STREAM* ha
 	       havc420->length;
 }
 
+/**
+ * Function description
+ * Build the server wide encode cache key for the current frame.
+ * Sharing only pays off with more than one connected client.
+ *
+ * @return TRUE if the encode result should be looked up and stored in the cache
+ */
+static BOOL shadow_client_encode_cache_key(rdpShadowClient* client, UINT32 codecId,
+                                           const UINT32* params, size_t count, UINT16 x, UINT16 y,
+                                           UINT16 width, UINT16 height,
+                                           SHADOW_ENCODE_CACHE_KEY* key)
+{
+	rdpShadowServer* server;
+	rdpShadowSurface* surface;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(key);
+
+	server = client->server;
+	WINPR_ASSERT(server);
+
+	if (!server->encodeCache || (ArrayList_Count(server->clients) < 2))
+		return FALSE;
+
+	surface = client->inLobby ? server->lobby : server->surface;
+
+	if (!surface)
+		return FALSE;
+
+	key->surface = surface;
+	key->frameSequence = surface->frameSequence;
+	key->codecId = codecId;
+
+	if (!shadow_encode_cache_key_set_params(key, params, count))
+		return FALSE;
+
+	key->rect.left = x;
+	key->rect.top = y;
+	key->rect.right = x + width;
+	key->rect.bottom = y + height;
+	return TRUE;
+}
+
+static void shadow_client_encode_cache_store(rdpShadowClient* client,
+                                             const SHADOW_ENCODE_CACHE_KEY* key, const BYTE* data,
+                                             size_t length)
+{
+	SHADOW_ENCODE_CACHE_ENTRY* entry;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(client->server);
+
+	entry = shadow_encode_cache_entry_new(key);
+
+	if (!entry)
+		return;
+
+	/* A failed insert only costs the next client a re-encode */
+	if (shadow_encode_cache_entry_add_part(entry, data, length))
+		shadow_encode_cache_insert(client->server->encodeCache, entry);
+
+	shadow_encode_cache_release(entry);
+}
+
+/**
+ * Function description
+ * Encodes the video rectangle of the content classifier as H.264.
+ *
+ * @return < 0 on failure, 0 if nothing changed, > 0 if cmd holds a command
+ */
+static INT32 shadow_client_encode_avc(rdpShadowClient* client, const BYTE* pSrcData,
+                                      UINT32 nSrcStep, const RECTANGLE_16* regionRect,
+                                      RDPGFX_SURFACE_COMMAND* cmd,
+                                      RDPGFX_AVC420_BITMAP_STREAM* avc420,
+                                      RDPGFX_AVC444_BITMAP_STREAM* avc444)
+{
+	INT32 rc;
+	const rdpSettings* settings = client->context.settings;
+	rdpShadowEncoder* encoder = client->encoder;
+
+	if (settings->GfxAVC444 || settings->GfxAVC444v2)
+	{
+		const BYTE version = settings->GfxAVC444v2 ? 2 : 1;
+
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC444) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_AVC444");
+			return -1;
+		}
+
+		rc = avc444_compress(encoder->h264, pSrcData, cmd->format, nSrcStep, cmd->width,
+		                     cmd->height, version, regionRect, &avc444->LC,
+		                     &avc444->bitstream[0].data, &avc444->bitstream[0].length,
+		                     &avc444->bitstream[1].data, &avc444->bitstream[1].length,
+		                     &avc444->bitstream[0].meta, &avc444->bitstream[1].meta);
+
+		if (rc > 0)
+		{
+			avc444->cbAvc420EncodedBitstream1 = rdpgfx_estimate_h264_avc420(&avc444->bitstream[0]);
+			cmd->codecId =
+			    settings->GfxAVC444v2 ? RDPGFX_CODECID_AVC444v2 : RDPGFX_CODECID_AVC444;
+			cmd->extra = (void*)avc444;
+		}
+	}
+	else
+	{
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC420) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_AVC420");
+			return -1;
+		}
+
+		rc = avc420_compress(encoder->h264, pSrcData, cmd->format, nSrcStep, cmd->width,
+		                     cmd->height, regionRect, &avc420->data, &avc420->length,
+		                     &avc420->meta);
+
+		if (rc > 0)
+		{
+			cmd->codecId = RDPGFX_CODECID_AVC420;
+			cmd->extra = (void*)avc420;
+		}
+	}
+
+	if (rc < 0)
+		WLog_ERR(TAG, "H.264 encoding of the video region failed");
+
+	return rc;
+}
+
+/**
+ * Function description
+ * Sends one GFX frame with codecs picked per tile by the content classifier:
+ * the video rectangle goes out as H.264, all other damaged tiles as planar.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_gfx_adaptive(rdpShadowClient* client, const BYTE* pSrcData,
+                                                    UINT32 nSrcStep, UINT32 SrcFormat,
+                                                    UINT16 nWidth, UINT16 nHeight,
+                                                    const REGION16* damage)
+{
+	INT32 status = 0;
+	BOOL rc = FALSE;
+	BOOL transition;
+	UINT32 x, y;
+	UINT32 index;
+	UINT32 numRects = 0;
+	size_t count = 0;
+	size_t sent = 0;
+	UINT error = CHANNEL_RC_OK;
+	const RECTANGLE_16* rects;
+	RECTANGLE_16 video;
+	BYTE* marked = NULL;
+	BYTE* buffer = NULL;
+	PLANAR_TILE* tiles = NULL;
+	RDPGFX_SURFACE_COMMAND avc = { 0 };
+	RDPGFX_AVC420_BITMAP_STREAM avc420 = { 0 };
+	RDPGFX_AVC444_BITMAP_STREAM avc444 = { 0 };
+	RDPGFX_START_FRAME_PDU cmdstart = { 0 };
+	RDPGFX_END_FRAME_PDU cmdend = { 0 };
+	SYSTEMTIME sTime = { 0 };
+	const UINT32 tileSize = SHADOW_CLASSIFY_TILE_SIZE;
+	const UINT32 tileCapacity = freerdp_bitmap_planar_max_size(tileSize, tileSize);
+	const UINT32 tilesX = (nWidth + tileSize - 1) / tileSize;
+	const UINT32 tilesY = (nHeight + tileSize - 1) / tileSize;
+	rdpShadowEncoder* encoder = client->encoder;
+	const rdpShadowClassifier* classifier = client->server->classifier;
+
+	WINPR_ASSERT(encoder);
+	WINPR_ASSERT(classifier);
+	WINPR_ASSERT(damage);
+
+	avc.surfaceId = client->surfaceId;
+	avc.format = PIXEL_FORMAT_BGRX32;
+	avc.right = avc.width = nWidth;
+	avc.bottom = avc.height = nHeight;
+
+	/*
+	 * The H.264 encoder only refreshes its region of the frame, so when the
+	 * region moves the tiles entering it may not be picked up as changed.
+	 * Frames with a new region therefore send all damaged tiles as planar.
+	 */
+	video = classifier->videoRect;
+	video.right = MIN(video.right, nWidth);
+	video.bottom = MIN(video.bottom, nHeight);
+
+	if ((video.left >= video.right) || (video.top >= video.bottom))
+		ZeroMemory(&video, sizeof(video));
+
+	transition = !rectangles_equal(&video, &encoder->videoRect);
+	encoder->videoRect = video;
+
+	if (!rectangle_is_empty(&video))
+	{
+		status = shadow_client_encode_avc(client, pSrcData, nSrcStep, &video, &avc, &avc420,
+		                                  &avc444);
+
+		if (status < 0)
+			goto fail;
+	}
+
+	marked = (BYTE*)calloc(MAX((size_t)tilesX * tilesY, 1), sizeof(BYTE));
+	tiles = (PLANAR_TILE*)calloc(MAX((size_t)tilesX * tilesY, 1), sizeof(PLANAR_TILE));
+
+	if (!marked || !tiles)
+		goto fail;
+
+	rects = region16_rects(damage, &numRects);
+
+	for (index = 0; index < numRects; index++)
+	{
+		const UINT32 right = MIN(rects[index].right, nWidth);
+		const UINT32 bottom = MIN(rects[index].bottom, nHeight);
+
+		if ((rects[index].left >= right) || (rects[index].top >= bottom))
+			continue;
+
+		for (y = rects[index].top / tileSize; y <= (bottom - 1) / tileSize; y++)
+		{
+			for (x = rects[index].left / tileSize; x <= (right - 1) / tileSize; x++)
+				marked[y * tilesX + x] = 1;
+		}
+	}
+
+	for (y = 0; y < tilesY; y++)
+	{
+		for (x = 0; x < tilesX; x++)
+		{
+			PLANAR_TILE* tile = &tiles[count];
+
+			if (!marked[y * tilesX + x])
+				continue;
+
+			if (!transition &&
+			    (shadow_classifier_tile_type(classifier, x, y) == SHADOW_CONTENT_VIDEO))
+				continue;
+
+			tile->data = &pSrcData[y * tileSize * nSrcStep + x * tileSize * 4];
+			tile->width = MIN(tileSize, nWidth - x * tileSize);
+			tile->height = MIN(tileSize, nHeight - y * tileSize);
+			tile->dstSize = tileCapacity;
+			marked[y * tilesX + x] = 2;
+			count++;
+		}
+	}
+
+	if (count > 0)
+	{
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PLANAR) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PLANAR");
+			goto fail;
+		}
+
+		if ((encoder->planar->maxWidth != tileSize) || (encoder->planar->maxHeight != tileSize))
+		{
+			if (!freerdp_bitmap_planar_context_reset(encoder->planar, tileSize, tileSize))
+				goto fail;
+		}
+
+		freerdp_planar_topdown_image(encoder->planar, TRUE);
+
+		if (!(buffer = (BYTE*)malloc(count * tileCapacity)))
+			goto fail;
+
+		for (index = 0; index < count; index++)
+			tiles[index].dstData = &buffer[index * tileCapacity];
+
+		if (!freerdp_bitmap_planar_compress_tiles(encoder->planar, SrcFormat, nSrcStep, tiles,
+		                                          count))
+		{
+			WLog_ERR(TAG, "freerdp_bitmap_planar_compress_tiles failed");
+			goto fail;
+		}
+	}
+
+	/* Nothing changed */
+	if ((status == 0) && (count == 0))
+	{
+		rc = TRUE;
+		goto fail;
+	}
+
+	cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
+	GetSystemTime(&sTime);
+	cmdstart.timestamp = (UINT32)(sTime.wHour << 22U | sTime.wMinute << 16U | sTime.wSecond << 10U |
+	                              sTime.wMilliseconds);
+	cmdend.frameId = cmdstart.frameId;
+
+	/* H.264 first, the planar tiles inside its region are drawn over it */
+	if (status > 0)
+	{
+		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &avc, &cmdstart,
+		          (count == 0) ? &cmdend : NULL);
+		sent++;
+	}
+
+	index = 0;
+
+	for (y = 0; (error == CHANNEL_RC_OK) && (y < tilesY); y++)
+	{
+		for (x = 0; (error == CHANNEL_RC_OK) && (x < tilesX); x++)
+		{
+			RDPGFX_SURFACE_COMMAND cmd = { 0 };
+			const PLANAR_TILE* tile;
+
+			if (marked[y * tilesX + x] != 2)
+				continue;
+
+			tile = &tiles[index++];
+			cmd.surfaceId = client->surfaceId;
+			cmd.codecId = RDPGFX_CODECID_PLANAR;
+			cmd.format = PIXEL_FORMAT_BGRX32;
+			cmd.left = x * tileSize;
+			cmd.top = y * tileSize;
+			cmd.right = cmd.left + tile->width;
+			cmd.bottom = cmd.top + tile->height;
+			cmd.width = tile->width;
+			cmd.height = tile->height;
+			cmd.data = tile->dstData;
+			cmd.length = tile->dstSize;
+
+			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
+			          (sent == 0) ? &cmdstart : NULL, (index == count) ? &cmdend : NULL);
+			sent++;
+		}
+	}
+
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free_h264_metablock(&avc420.meta);
+	free_h264_metablock(&avc444.bitstream[0].meta);
+	free_h264_metablock(&avc444.bitstream[1].meta);
+	free(buffer);
+	free(tiles);
+	free(marked);
+	return rc;
+}
+
+/**
+ * Function description
+ * Send the full screen H.264 frame of the shared encoder of this resolution and profile
+ * *sent is FALSE if the client is out of step, the frame is then up to its own encoder
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_avc_broadcast(rdpShadowClient* client,
+                                                     const BYTE* pSrcData, UINT32 nSrcStep,
+                                                     UINT32 SrcFormat, RDPGFX_SURFACE_COMMAND* cmd,
+                                                     RDPGFX_START_FRAME_PDU* cmdstart,
+                                                     RDPGFX_END_FRAME_PDU* cmdend, BOOL* sent)
+{
+	INT32 rc;
+	UINT32 codecId;
+	UINT error = CHANNEL_RC_OK;
+	rdpSettings* settings;
+	rdpShadowServer* server;
+	rdpShadowSurface* surface;
+	rdpShadowEncoder* encoder;
+	SHADOW_BROADCAST_STREAM* stream;
+	SHADOW_BROADCAST_FRAME* frame = NULL;
+	RDPGFX_AVC444_BITMAP_STREAM avc444;
+	const UINT64 now = GetTickCount64();
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(cmd);
+	WINPR_ASSERT(sent);
+
+	settings = client->context.settings;
+	server = client->server;
+	encoder = client->encoder;
+	WINPR_ASSERT(settings);
+	WINPR_ASSERT(server);
+	WINPR_ASSERT(encoder);
+
+	*sent = FALSE;
+	surface = client->inLobby ? server->lobby : server->surface;
+
+	if (settings->GfxAVC444v2)
+		codecId = RDPGFX_CODECID_AVC444v2;
+	else if (settings->GfxAVC444)
+		codecId = RDPGFX_CODECID_AVC444;
+	else
+		codecId = RDPGFX_CODECID_AVC420;
+
+	stream = encoder->broadcast;
+
+	if (!stream || (stream->surface != surface) || (stream->codecId != codecId) ||
+	    (stream->width != cmd->width) || (stream->height != cmd->height))
+	{
+		shadow_broadcast_unsubscribe(server->broadcast, stream);
+		encoder->broadcastBackoff = 0;
+		shadow_client_broadcast_detach(encoder, now);
+		stream = shadow_broadcast_subscribe(server->broadcast, surface, codecId, cmd->width,
+		                                    cmd->height);
+		encoder->broadcast = stream;
+
+		if (!stream)
+			return FALSE;
+	}
+
+	rc = shadow_broadcast_encode(stream, surface->frameSequence, pSrcData, SrcFormat, nSrcStep,
+	                             &frame);
+
+	if (rc < 0)
+	{
+		WLog_ERR(TAG, "shadow_broadcast_encode failed");
+		return FALSE;
+	}
+
+	if (encoder->broadcastSequence != 0)
+	{
+		if (rc == 0)
+		{
+			*sent = TRUE;
+			return TRUE;
+		}
+
+		/* A P frame only decodes on top of all frames before it, e.g. one the rate control
+		 * deferred. Only this client recovers, the other viewers keep their P frames. */
+		if (!frame->keyframe && (frame->sequence != encoder->broadcastSequence + 1))
+		{
+			if (now - encoder->broadcastJoinedAt < SHADOW_BROADCAST_STABLE_MS)
+				encoder->broadcastBackoff =
+				    MIN(MAX(encoder->broadcastBackoff * 2, SHADOW_BROADCAST_BACKOFF_MIN_MS),
+				        SHADOW_BROADCAST_BACKOFF_MAX_MS);
+			else
+				encoder->broadcastBackoff = 0;
+
+			shadow_client_broadcast_detach(encoder, now);
+		}
+	}
+
+	if (encoder->broadcastSequence == 0)
+	{
+		if (frame && frame->keyframe)
+			encoder->broadcastJoinedAt = now;
+		else
+		{
+			if (now >= encoder->broadcastNextRequest)
+			{
+				shadow_broadcast_request_refresh(stream);
+				encoder->broadcastNextRequest =
+				    now + MAX(encoder->broadcastBackoff, SHADOW_BROADCAST_BACKOFF_MIN_MS);
+			}
+
+			/* A new encoder instance starts with an IDR frame for this client alone */
+			if (!encoder->broadcastBridging)
+			{
+				shadow_encoder_restart_h264(encoder);
+				encoder->broadcastBridging = TRUE;
+			}
+
+			shadow_broadcast_frame_release(frame);
+			return TRUE;
+		}
+	}
+
+	encoder->broadcastSequence = frame->sequence;
+	encoder->broadcastBridging = FALSE;
+	cmd->codecId = frame->codecId;
+
+	avc444 = frame->avc444;
+
+	if (frame->codecId == RDPGFX_CODECID_AVC420)
+		cmd->extra = (void*)&avc444.bitstream[0];
+	else
+	{
+		avc444.cbAvc420EncodedBitstream1 = rdpgfx_estimate_h264_avc420(&avc444.bitstream[0]);
+		cmd->extra = (void*)&avc444;
+	}
+
+	IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, cmd, cmdstart, cmdend);
+	shadow_broadcast_frame_release(frame);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
+		return FALSE;
+	}
+
+	*sent = TRUE;
+	return TRUE;
+}
+
+/* Idle time before the progressive tiles of the last frames are refined by one quality step */
+#define SHADOW_PROGRESSIVE_UPGRADE_DELAY 100
+
+/**
+ * Function description
+ * Sends the damage as the first pass of the progressive quality ladder. The tile state
+ * lives in the progressive context of the client, so the output is not cached.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_progressive(rdpShadowClient* client, const BYTE* pSrcData,
+                                                   UINT32 nSrcStep, const REGION16* damage,
+                                                   RDPGFX_SURFACE_COMMAND* cmd,
+                                                   RDPGFX_START_FRAME_PDU* cmdstart,
+                                                   RDPGFX_END_FRAME_PDU* cmdend)
+{
+	INT32 rc;
+	UINT32 index;
+	UINT32 numRects = 0;
+	UINT error = CHANNEL_RC_OK;
+	REGION16 region;
+	RECTANGLE_16 surfaceRect;
+	const RECTANGLE_16* rects;
+	rdpShadowEncoder* encoder = client->encoder;
+	const rdpShadowServer* server = client->server;
+
+	WINPR_ASSERT(encoder);
+	WINPR_ASSERT(encoder->progressive);
+	WINPR_ASSERT(cmd);
+
+	/* A new surface starts without tile state */
+	if (encoder->progressiveSurfaceId != client->surfaceId)
+	{
+		if (encoder->progressiveSurfaceId != 0)
+			progressive_delete_surface_context(encoder->progressive,
+			                                   encoder->progressiveSurfaceId);
+
+		encoder->progressiveSurfaceId = 0;
+		encoder->progressiveUpgradeAt = 0;
+
+		if (progressive_create_surface_context(encoder->progressive, client->surfaceId,
+		                                       cmd->width, cmd->height) < 0)
+		{
+			WLog_ERR(TAG, "progressive_create_surface_context failed");
+			return FALSE;
+		}
+
+		encoder->progressiveSurfaceId = client->surfaceId;
+	}
+
+	surfaceRect.left = (UINT16)cmd->left;
+	surfaceRect.top = (UINT16)cmd->top;
+	surfaceRect.right = (UINT16)cmd->right;
+	surfaceRect.bottom = (UINT16)cmd->bottom;
+	region16_init(&region);
+
+	/* Only the damaged tiles restart at the first pass, the damage is relative to the sub rect */
+	if (damage)
+	{
+		rects = region16_rects(damage, &numRects);
+
+		for (index = 0; index < numRects; index++)
+		{
+			RECTANGLE_16 rect = rects[index];
+
+			if (server->shareSubRect)
+			{
+				rect.left -= server->subRect.left;
+				rect.top -= server->subRect.top;
+				rect.right -= server->subRect.left;
+				rect.bottom -= server->subRect.top;
+			}
+
+			if (!region16_union_rect(&region, &region, &rect))
+				goto fail;
+		}
+
+		if (!region16_intersect_rect(&region, &region, &surfaceRect))
+			goto fail;
+	}
+	else if (!region16_union_rect(&region, &region, &surfaceRect))
+		goto fail;
+
+	rc = progressive_compress_surface(encoder->progressive, client->surfaceId, pSrcData,
+	                                  nSrcStep * cmd->height, cmd->format, cmd->width, cmd->height,
+	                                  nSrcStep, &region, &cmd->data, &cmd->length);
+	region16_uninit(&region);
+
+	if (rc < 0)
+	{
+		WLog_ERR(TAG, "progressive_compress_surface failed");
+		return FALSE;
+	}
+
+	/* rc > 0 means new data */
+	if (rc == 0)
+		return TRUE;
+
+	cmd->codecId = RDPGFX_CODECID_CAPROGRESSIVE;
+	IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, cmd, cmdstart, cmdend);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
+		return FALSE;
+	}
+
+	/* Upgrades wait until the screen is idle, every new frame postpones them */
+	encoder->progressiveUpgradeAt = GetTickCount64() + SHADOW_PROGRESSIVE_UPGRADE_DELAY;
+	return shadow_encoder_schedule_refresh(encoder, SHADOW_PROGRESSIVE_UPGRADE_DELAY);
+fail:
+	region16_uninit(&region);
+	return FALSE;
+}
+
+/**
+ * Function description
+ * Refines the progressive tiles by one quality step once the screen was idle for
+ * SHADOW_PROGRESSIVE_UPGRADE_DELAY. Called when the refresh timer of the encoder fires.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_progressive_upgrade(rdpShadowClient* client,
+                                                   const SHADOW_GFX_STATUS* pStatus)
+{
+	INT32 rc;
+	UINT64 now;
+	UINT error = CHANNEL_RC_OK;
+	const rdpSettings* settings = ((rdpContext*)client)->settings;
+	rdpShadowEncoder* encoder = client->encoder;
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+	RDPGFX_START_FRAME_PDU cmdstart = { 0 };
+	RDPGFX_END_FRAME_PDU cmdend = { 0 };
+	SYSTEMTIME sTime = { 0 };
+
+	WINPR_ASSERT(pStatus);
+
+	if (!encoder || !encoder->progressive || (encoder->progressiveUpgradeAt == 0))
+		return TRUE;
+
+	/* The tile state belongs to a surface that is gone */
+	if (!pStatus->gfxSurfaceCreated || (encoder->progressiveSurfaceId != client->surfaceId))
+	{
+		encoder->progressiveUpgradeAt = 0;
+		return TRUE;
+	}
+
+	now = GetTickCount64();
+
+	if (now < encoder->progressiveUpgradeAt)
+		return shadow_encoder_schedule_refresh(encoder,
+		                                       (UINT32)(encoder->progressiveUpgradeAt - now));
+
+	/* Congested, the rate control rearmed the refresh timer */
+	if (!shadow_encoder_update_rate(encoder))
+		return TRUE;
+
+	rc = progressive_compress_upgrade(encoder->progressive, client->surfaceId, &cmd.data,
+	                                  &cmd.length);
+
+	if (rc < 0)
+	{
+		WLog_ERR(TAG, "progressive_compress_upgrade failed");
+		return FALSE;
+	}
+
+	/* Every tile is at the final quality */
+	if (rc == 0)
+	{
+		encoder->progressiveUpgradeAt = 0;
+		return TRUE;
+	}
+
+	cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
+	GetSystemTime(&sTime);
+	cmdstart.timestamp = (UINT32)(sTime.wHour << 22U | sTime.wMinute << 16U | sTime.wSecond << 10U |
+	                              sTime.wMilliseconds);
+	cmdend.frameId = cmdstart.frameId;
+	cmd.surfaceId = client->surfaceId;
+	cmd.codecId = RDPGFX_CODECID_CAPROGRESSIVE;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.right = cmd.width = freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth);
+	cmd.bottom = cmd.height = freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight);
+
+	IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
+	          &cmdend);
+	shadow_encoder_account_sent(encoder);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
+		return FALSE;
+	}
+
+	encoder->progressiveUpgradeAt = now + SHADOW_PROGRESSIVE_UPGRADE_DELAY;
+	return shadow_encoder_schedule_refresh(encoder, SHADOW_PROGRESSIVE_UPGRADE_DELAY);
+}
+
 /**
  * Function description
  *
@@ -1000,7 +1707,8 @@ static INLINE UINT32 rdpgfx_estimate_h264_avc420(RDPGFX_AVC420_BITMAP_STREAM* ha
  */
 static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE* pSrcData,
                                            UINT32 nSrcStep, UINT32 SrcFormat, UINT16 nXSrc,
-                                           UINT16 nYSrc, UINT16 nWidth, UINT16 nHeight)
+                                           UINT16 nYSrc, UINT16 nWidth, UINT16 nHeight,
+                                           const REGION16* damage)
 {
 	UINT32 id;
 	UINT error = CHANNEL_RC_OK;
@@ -1027,6 +1735,13 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		client->first_frame = FALSE;
 	}
 
+	/* Mixed codec frames need H.264 and surface coordinates that match the damage */
+	if (client->server->gfxAdaptive && client->server->classifier && damage &&
+	    !client->inLobby && !client->server->shareSubRect &&
+	    (settings->GfxAVC444 || settings->GfxAVC444v2 || settings->GfxH264))
+		return shadow_client_send_surface_gfx_adaptive(client, pSrcData, nSrcStep, SrcFormat,
+		                                               nWidth, nHeight, damage);
+
 	cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
 	GetSystemTime(&sTime);
 	cmdstart.timestamp = (UINT32)(sTime.wHour << 22U | sTime.wMinute << 16U | sTime.wSecond << 10U |
@@ -1042,6 +1757,19 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	cmd.height = nHeight;
 
 	id = freerdp_settings_get_uint32(settings, FreeRDP_RemoteFxCodecId);
+	if (client->server->gfxBroadcast && client->server->broadcast &&
+	    (settings->GfxAVC444 || settings->GfxAVC444v2 || settings->GfxH264))
+	{
+		BOOL sent = FALSE;
+
+		if (!shadow_client_send_surface_avc_broadcast(client, pSrcData, nSrcStep, SrcFormat, &cmd,
+		                                              &cmdstart, &cmdend, &sent))
+			return FALSE;
+
+		if (sent)
+			return TRUE;
+	}
+
 	if (settings->GfxAVC444 || settings->GfxAVC444v2)
 	{
 		INT32 rc;
@@ -1137,11 +1865,48 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 			return FALSE;
 		}
 	}
+	else if (client->server->gfxClear)
+	{
+		int rc;
+		const UINT32 bpp = FreeRDPGetBytesPerPixel(SrcFormat);
+		const BYTE* src = &pSrcData[cmd.top * nSrcStep + cmd.left * bpp];
+
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_CLEARCODEC) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_CLEARCODEC");
+			return FALSE;
+		}
+
+		/* The output depends on the V-bar and glyph caches of this client,
+		 * so it is never shared through the encode cache. */
+		rc = clear_compress(encoder->clear, src, nSrcStep * (nHeight - 1) + nWidth * bpp,
+		                    SrcFormat, nWidth, nHeight, nSrcStep, &cmd.data, &cmd.length);
+
+		if (rc < 0)
+		{
+			WLog_ERR(TAG, "clear_compress failed");
+			return FALSE;
+		}
+
+		cmd.codecId = RDPGFX_CODECID_CLEARCODEC;
+
+		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
+		          &cmdend);
+		if (error)
+		{
+			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
+			return FALSE;
+		}
+	}
 	else if (freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec) && (id != 0))
 	{
 		BOOL rc;
 		wStream* s;
 		RFX_RECT rect;
+		BOOL cacheable;
+		SHADOW_ENCODE_CACHE_KEY key = { 0 };
+		SHADOW_ENCODE_CACHE_ENTRY* entry = NULL;
+		UINT32 params[6];
 
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
 		{
@@ -1161,7 +1926,41 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		rect.width = (UINT16)cmd.right - cmd.left;
 		rect.height = (UINT16)cmd.bottom - cmd.top;
 
-		rc = rfx_compose_message(encoder->rfx, s, &rect, 1, pSrcData, nWidth, nHeight, nSrcStep);
+		params[0] = RDPGFX_CODECID_CAVIDEO;
+		params[1] = encoder->rfx->mode;
+		params[2] = cmd.format;
+		params[3] = encoder->rfx->width;
+		params[4] = encoder->rfx->height;
+		params[5] = encoder->quality;
+		cacheable = shadow_client_encode_cache_key(client, FREERDP_CODEC_REMOTEFX, params,
+		                                           ARRAYSIZE(params), rect.x, rect.y, rect.width,
+		                                           rect.height, &key);
+		if (cacheable)
+			entry = shadow_encode_cache_lookup(client->server->encodeCache, &key);
+
+		/* Headers and frame indices are per connection, only the frame data is shared */
+		rc = rfx_write_message_header(encoder->rfx, s);
+
+		if (rc && entry)
+		{
+			wStream* part = shadow_encode_cache_entry_part(entry, 0);
+
+			rc = part && rfx_write_encoded_message(encoder->rfx, s, Stream_Buffer(part),
+			                                       Stream_Length(part));
+		}
+		else if (rc)
+		{
+			const size_t start = Stream_GetPosition(s);
+
+			rc = rfx_compose_message(encoder->rfx, s, &rect, 1, pSrcData, nWidth, nHeight,
+			                         nSrcStep);
+
+			if (rc && cacheable)
+				shadow_client_encode_cache_store(client, &key, Stream_Buffer(s) + start,
+				                                 Stream_GetPosition(s) - start);
+		}
+
+		shadow_encode_cache_release(entry);
 
 		if (!rc)
 		{
@@ -1191,11 +1990,28 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 			return FALSE;
 		}
 	}
+	else if (freerdp_settings_get_bool(settings, FreeRDP_GfxProgressive) &&
+	         (client->server->progressiveLadderCount > 0))
+	{
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PROGRESSIVE) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PROGRESSIVE");
+			return FALSE;
+		}
+
+		if (!shadow_client_send_surface_progressive(client, pSrcData, nSrcStep, damage, &cmd,
+		                                            &cmdstart, &cmdend))
+			return FALSE;
+	}
 	else if (freerdp_settings_get_bool(settings, FreeRDP_GfxProgressive))
 	{
 		INT32 rc;
 		REGION16 region;
 		RECTANGLE_16 regionRect;
+		BOOL cacheable;
+		SHADOW_ENCODE_CACHE_KEY key = { 0 };
+		SHADOW_ENCODE_CACHE_ENTRY* entry = NULL;
+		UINT32 params[3];
 
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PROGRESSIVE) < 0)
 		{
@@ -1211,14 +2027,43 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		regionRect.top = (UINT16)cmd.top;
 		regionRect.right = (UINT16)cmd.right;
 		regionRect.bottom = (UINT16)cmd.bottom;
-		region16_init(&region);
-		region16_union_rect(&region, &region, &regionRect);
-		rc = progressive_compress(encoder->progressive, pSrcData, nSrcStep * nHeight, cmd.format,
-		                          nWidth, nHeight, nSrcStep, &region, &cmd.data, &cmd.length);
-		region16_uninit(&region);
+		params[0] = RDPGFX_CODECID_CAPROGRESSIVE;
+		params[1] = cmd.format;
+		params[2] = nSrcStep;
+		cacheable =
+		    shadow_client_encode_cache_key(client, FREERDP_CODEC_PROGRESSIVE, params,
+		                                   ARRAYSIZE(params), regionRect.left, regionRect.top,
+		                                   nWidth, nHeight, &key);
+		if (cacheable)
+			entry = shadow_encode_cache_lookup(client->server->encodeCache, &key);
+
+		if (entry)
+		{
+			wStream* part = shadow_encode_cache_entry_part(entry, 0);
+
+			rc = part ? 1 : -1;
+			if (part)
+			{
+				cmd.data = Stream_Buffer(part);
+				cmd.length = (UINT32)Stream_Length(part);
+			}
+		}
+		else
+		{
+			region16_init(&region);
+			region16_union_rect(&region, &region, &regionRect);
+			rc = progressive_compress(encoder->progressive, pSrcData, nSrcStep * nHeight,
+			                          cmd.format, nWidth, nHeight, nSrcStep, &region, &cmd.data,
+			                          &cmd.length);
+			region16_uninit(&region);
+
+			if ((rc > 0) && cacheable)
+				shadow_client_encode_cache_store(client, &key, cmd.data, cmd.length);
+		}
 		if (rc < 0)
 		{
 			WLog_ERR(TAG, "progressive_compress failed");
+			shadow_encode_cache_release(entry);
 			return FALSE;
 		}
 
@@ -1231,6 +2076,8 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 			          &cmdend);
 		}
 
+		shadow_encode_cache_release(entry);
+
 		if (error)
 		{
 			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
@@ -1244,25 +2091,56 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		const UINT32 h = cmd.bottom - cmd.top;
 		const BYTE* src =
 		    &pSrcData[cmd.top * nSrcStep + cmd.left * FreeRDPGetBytesPerPixel(SrcFormat)];
+		BOOL cacheable;
+		SHADOW_ENCODE_CACHE_KEY key = { 0 };
+		SHADOW_ENCODE_CACHE_ENTRY* entry = NULL;
+		UINT32 params[3];
+
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PLANAR) < 0)
 		{
 			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PLANAR");
 			return FALSE;
 		}
 
-		rc = freerdp_bitmap_planar_context_reset(encoder->planar, w, h);
-		WINPR_ASSERT(rc);
-		freerdp_planar_topdown_image(encoder->planar, TRUE);
+		params[0] = RDPGFX_CODECID_PLANAR;
+		params[1] = SrcFormat;
+		params[2] = settings->DrawAllowSkipAlpha;
+		cacheable = shadow_client_encode_cache_key(client, FREERDP_CODEC_PLANAR, params,
+		                                           ARRAYSIZE(params), (UINT16)cmd.left,
+		                                           (UINT16)cmd.top, (UINT16)w, (UINT16)h, &key);
+		if (cacheable)
+			entry = shadow_encode_cache_lookup(client->server->encodeCache, &key);
+
+		if (entry)
+		{
+			wStream* part = shadow_encode_cache_entry_part(entry, 0);
+			WINPR_ASSERT(part);
 
-		cmd.data = freerdp_bitmap_compress_planar(encoder->planar, src, SrcFormat, w, h, nSrcStep,
-		                                          NULL, &cmd.length);
-		WINPR_ASSERT(cmd.data || (cmd.length == 0));
+			cmd.data = Stream_Buffer(part);
+			cmd.length = (UINT32)Stream_Length(part);
+		}
+		else
+		{
+			rc = freerdp_bitmap_planar_context_reset(encoder->planar, w, h);
+			WINPR_ASSERT(rc);
+			freerdp_planar_topdown_image(encoder->planar, TRUE);
+
+			cmd.data = freerdp_bitmap_compress_planar(encoder->planar, src, SrcFormat, w, h,
+			                                          nSrcStep, NULL, &cmd.length);
+			WINPR_ASSERT(cmd.data || (cmd.length == 0));
+
+			if (cmd.data && cacheable)
+				shadow_client_encode_cache_store(client, &key, cmd.data, cmd.length);
+		}
 
 		cmd.codecId = RDPGFX_CODECID_PLANAR;
 
 		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
 		          &cmdend);
-		free(cmd.data);
+		if (entry)
+			shadow_encode_cache_release(entry);
+		else
+			free(cmd.data);
 		if (error)
 		{
 			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
@@ -1340,8 +2218,13 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 	if (freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec) && (rfxID != 0))
 	{
 		RFX_RECT rect;
-		RFX_MESSAGE* messages;
+		RFX_MESSAGE* messages = NULL;
 		RFX_RECT* messageRects = NULL;
+		BOOL cacheable;
+		SHADOW_ENCODE_CACHE_KEY key = { 0 };
+		SHADOW_ENCODE_CACHE_ENTRY* entry = NULL;
+		SHADOW_ENCODE_CACHE_ENTRY* store = NULL;
+		UINT32 params[7];
 
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
 		{
@@ -1355,12 +2238,34 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 		rect.width = nWidth;
 		rect.height = nHeight;
 
-		if (!(messages = rfx_encode_messages(
-		          encoder->rfx, &rect, 1, pSrcData, settings->DesktopWidth, settings->DesktopHeight,
-		          nSrcStep, &numMessages, settings->MultifragMaxRequestSize)))
+		params[0] = rfxID;
+		params[1] = encoder->rfx->mode;
+		params[2] = encoder->rfx->pixel_format;
+		params[3] = settings->DesktopWidth;
+		params[4] = settings->DesktopHeight;
+		params[5] = settings->MultifragMaxRequestSize;
+		params[6] = encoder->quality;
+		cacheable = shadow_client_encode_cache_key(client, FREERDP_CODEC_REMOTEFX, params,
+		                                           ARRAYSIZE(params), nXSrc, nYSrc, nWidth, nHeight,
+		                                           &key);
+		if (cacheable)
+			entry = shadow_encode_cache_lookup(client->server->encodeCache, &key);
+
+		if (entry)
+			numMessages = shadow_encode_cache_entry_count(entry);
+		else
 		{
-			WLog_ERR(TAG, "rfx_encode_messages failed");
-			return FALSE;
+			if (!(messages = rfx_encode_messages(encoder->rfx, &rect, 1, pSrcData,
+			                                     settings->DesktopWidth, settings->DesktopHeight,
+			                                     nSrcStep, &numMessages,
+			                                     settings->MultifragMaxRequestSize)))
+			{
+				WLog_ERR(TAG, "rfx_encode_messages failed");
+				return FALSE;
+			}
+
+			if (cacheable)
+				store = shadow_encode_cache_entry_new(&key);
 		}
 
 		cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
@@ -1378,26 +2283,51 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 		cmd.bmp.height = (UINT16)settings->DesktopHeight;
 		cmd.skipCompression = TRUE;
 
-		if (numMessages > 0)
+		if (messages && (numMessages > 0))
 			messageRects = messages[0].rects;
 
 		for (i = 0; i < numMessages; i++)
 		{
+			size_t start;
 			Stream_SetPosition(s, 0);
 
-			if (!rfx_write_message(encoder->rfx, s, &messages[i]))
+			/* Headers and frame indices are per connection, only the frame data is shared */
+			if (!rfx_write_message_header(encoder->rfx, s))
+				ret = FALSE;
+
+			start = Stream_GetPosition(s);
+
+			if (ret && entry)
 			{
-				while (i < numMessages)
+				wStream* part = shadow_encode_cache_entry_part(entry, i);
+
+				ret = part && rfx_write_encoded_message(encoder->rfx, s, Stream_Buffer(part),
+				                                        Stream_Length(part));
+			}
+			else if (ret)
+				ret = rfx_write_message(encoder->rfx, s, &messages[i]);
+
+			if (!ret)
+			{
+				while (messages && (i < numMessages))
 				{
 					rfx_message_free(encoder->rfx, &messages[i++]);
 				}
 
 				WLog_ERR(TAG, "rfx_write_message failed");
-				ret = FALSE;
 				break;
 			}
 
-			rfx_message_free(encoder->rfx, &messages[i]);
+			if (messages)
+				rfx_message_free(encoder->rfx, &messages[i]);
+
+			if (store && !shadow_encode_cache_entry_add_part(store, Stream_Buffer(s) + start,
+			                                                 Stream_GetPosition(s) - start))
+			{
+				shadow_encode_cache_release(store);
+				store = NULL;
+			}
+
 			WINPR_ASSERT(Stream_GetPosition(s) <= UINT32_MAX);
 			cmd.bmp.bitmapDataLength = (UINT32)Stream_GetPosition(s);
 			cmd.bmp.bitmapData = Stream_Buffer(s);
@@ -1417,11 +2347,22 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 			}
 		}
 
+		if (store && ret)
+			shadow_encode_cache_insert(client->server->encodeCache, store);
+
+		shadow_encode_cache_release(store);
+		shadow_encode_cache_release(entry);
 		free(messageRects);
 		free(messages);
 	}
 	if (freerdp_settings_get_bool(settings, FreeRDP_NSCodec) && (nsID != 0))
 	{
+		BOOL hit;
+		BOOL cacheable;
+		SHADOW_ENCODE_CACHE_KEY key = { 0 };
+		SHADOW_ENCODE_CACHE_ENTRY* entry = NULL;
+		UINT32 params[4];
+
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_NSCODEC) < 0)
 		{
 			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_NSCODEC");
@@ -1430,8 +2371,42 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 
 		s = encoder->bs;
 		Stream_SetPosition(s, 0);
-		pSrcData = &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)];
-		nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep);
+
+		params[0] = nsID;
+		params[1] = settings->NSCodecColorLossLevel;
+		params[2] = settings->NSCodecAllowSubsampling;
+		params[3] = settings->NSCodecAllowDynamicColorFidelity;
+		cacheable = shadow_client_encode_cache_key(client, FREERDP_CODEC_NSCODEC, params,
+		                                           ARRAYSIZE(params), nXSrc, nYSrc, nWidth, nHeight,
+		                                           &key);
+		if (cacheable)
+			entry = shadow_encode_cache_lookup(client->server->encodeCache, &key);
+
+		hit = (entry != NULL);
+
+		if (entry)
+		{
+			wStream* part = shadow_encode_cache_entry_part(entry, 0);
+
+			if (part && Stream_EnsureRemainingCapacity(s, Stream_Length(part)))
+				Stream_Write(s, Stream_Buffer(part), Stream_Length(part));
+			else
+				hit = FALSE;
+		}
+
+		/* A missing or unusable cache entry falls back to encoding */
+		if (!hit)
+		{
+			Stream_SetPosition(s, 0);
+			pSrcData = &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)];
+			nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep);
+
+			if (cacheable && !entry)
+				shadow_client_encode_cache_store(client, &key, Stream_Buffer(s),
+				                                 Stream_GetPosition(s));
+		}
+
+		shadow_encode_cache_release(entry);
 		cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
 		cmd.bmp.bpp = 32;
 		WINPR_ASSERT(nsID <= UINT16_MAX);
@@ -1488,6 +2463,7 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client, BYTE* pSrc
 	UINT32 updateSizeEstimate;
 	BITMAP_DATA* bitmapData;
 	BITMAP_UPDATE bitmapUpdate;
+	PLANAR_TILE* tiles = NULL;
 	rdpShadowEncoder* encoder;
 
 	if (!context || !pSrcData)
@@ -1544,6 +2520,16 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client, BYTE* pSrc
 
 	bitmapUpdate.rectangles = bitmapData;
 
+	/* Planar tiles are collected first and compressed in one call */
+	if (freerdp_settings_get_uint32(settings, FreeRDP_ColorDepth) >= 32)
+	{
+		if (!(tiles = (PLANAR_TILE*)calloc(bitmapUpdate.number, sizeof(PLANAR_TILE))))
+		{
+			free(bitmapData);
+			return FALSE;
+		}
+	}
+
 	if ((nWidth % 4) != 0)
 	{
 		nWidth += (4 - (nWidth % 4));
@@ -1594,15 +2580,15 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client, BYTE* pSrc
 			}
 			else
 			{
-				UINT32 dstSize;
-				buffer = encoder->grid[k];
+				PLANAR_TILE* tile = &tiles[k];
 				data = &pSrcData[(bitmap->destTop * nSrcStep) + (bitmap->destLeft * 4)];
 
-				buffer =
-				    freerdp_bitmap_compress_planar(encoder->planar, data, SrcFormat, bitmap->width,
-				                                   bitmap->height, nSrcStep, buffer, &dstSize);
-				bitmap->bitmapDataStream = buffer;
-				bitmap->bitmapLength = dstSize;
+				tile->data = data;
+				tile->width = bitmap->width;
+				tile->height = bitmap->height;
+				tile->dstData = encoder->grid[k];
+				tile->dstSize =
+				    freerdp_bitmap_planar_max_size(encoder->maxTileWidth, encoder->maxTileHeight);
 				bitmap->bitsPerPixel = 32;
 				bitmap->cbScanWidth = bitmap->width * 4;
 				bitmap->cbUncompressedSize = bitmap->width * bitmap->height * 4;
@@ -1615,6 +2601,26 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client, BYTE* pSrc
 		}
 	}
 
+	if (tiles)
+	{
+		UINT32 i;
+
+		if (!freerdp_bitmap_planar_compress_tiles(encoder->planar, SrcFormat, nSrcStep, tiles, k))
+		{
+			WLog_ERR(TAG, "Failed to compress planar tiles");
+			ret = FALSE;
+			goto out;
+		}
+
+		for (i = 0; i < k; i++)
+		{
+			bitmapData[i].bitmapDataStream = tiles[i].dstData;
+			bitmapData[i].bitmapLength = tiles[i].dstSize;
+			bitmapData[i].cbCompMainBodySize = tiles[i].dstSize;
+			totalBitmapSize += tiles[i].dstSize;
+		}
+	}
+
 	bitmapUpdate.number = k;
 	updateSizeEstimate = totalBitmapSize + (k * bitmapUpdate.number) + 16;
 
@@ -1678,18 +2684,24 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client, BYTE* pSrc
 	}
 
 out:
+	free(tiles);
 	free(bitmapData);
 	return ret;
 }
 
 /**
  * Function description
+ * Sends the damage of this client, and of the surface for a frame published by
+ * the subsystem. Without a frame only the damage the client kept is sent, e.g.
+ * an update the rate control deferred.
  *
  * @return TRUE on success (or nothing need to be updated)
  */
-static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GFX_STATUS* pStatus)
+static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GFX_STATUS* pStatus,
+                                              BOOL frame)
 {
 	BOOL ret = TRUE;
+	BOOL batch = FALSE;
 	INT64 nXSrc, nYSrc;
 	INT64 nWidth, nHeight;
 	rdpContext* context = (rdpContext*)client;
@@ -1726,10 +2738,14 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 	LeaveCriticalSection(&(client->lock));
 
 	EnterCriticalSection(&surface->lock);
-	rects = region16_rects(&(surface->invalidRegion), &numRects);
 
-	for (index = 0; index < numRects; index++)
-		region16_union_rect(&invalidRegion, &invalidRegion, &rects[index]);
+	if (frame)
+	{
+		rects = region16_rects(&(surface->invalidRegion), &numRects);
+
+		for (index = 0; index < numRects; index++)
+			region16_union_rect(&invalidRegion, &invalidRegion, &rects[index]);
+	}
 
 	surfaceRect.left = 0;
 	surfaceRect.top = 0;
@@ -1777,6 +2793,21 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 	// WLog_INFO(TAG, "shadow_client_send_surface_update: x: %d y: %d width: %d height: %d right: %d
 	// bottom: %d", 	nXSrc, nYSrc, nWidth, nHeight, nXSrc + nWidth, nYSrc + nHeight);
 
+	/* Congested, keep the damage for one of the next updates */
+	if (client->encoder && !shadow_encoder_update_rate(client->encoder))
+	{
+		rects = region16_rects(&invalidRegion, &numRects);
+		shadow_client_mark_invalid(client, numRects, rects);
+		goto out;
+	}
+
+	/* Surface bits go out in as few TLS records as possible. GFX PDUs are queued on the
+	 * drdynvc channel instead and batched when the channel manager flushes them. */
+	if (!(ret = context->peer->BeginWriteBatch(context->peer)))
+		goto out;
+
+	batch = TRUE;
+
 	if (settings->SupportGraphicsPipeline && pStatus->gfxOpened)
 	{
 		/* GFX/h264 always full screen encoded */
@@ -1801,7 +2832,7 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 		WINPR_ASSERT(nHeight >= 0);
 		WINPR_ASSERT(nHeight <= UINT16_MAX);
 		ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, SrcFormat, 0, 0,
-		                                     (UINT16)nWidth, (UINT16)nHeight);
+		                                     (UINT16)nWidth, (UINT16)nHeight, &invalidRegion);
 	}
 	else if (settings->RemoteFxCodec || freerdp_settings_get_bool(settings, FreeRDP_NSCodec))
 	{
@@ -1831,6 +2862,12 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 	}
 
 out:
+	if (batch && !context->peer->EndWriteBatch(context->peer))
+		ret = FALSE;
+
+	if (batch && client->encoder)
+		shadow_encoder_account_sent(client->encoder);
+
 	LeaveCriticalSection(&surface->lock);
 	region16_uninit(&invalidRegion);
 	return ret;
@@ -2135,11 +3172,35 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 		}
 		events[nCount++] = ChannelEvent;
 		events[nCount++] = MessageQueue_Event(MsgQueue);
+
+		if (client->encoder)
+			events[nCount++] = client->encoder->refreshTimer;
+
 		status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
 
 		if (status == WAIT_FAILED)
 			goto fail;
 
+		/* Damage held back by the rate control and progressive upgrades, sent without waiting
+		 * for a new frame. A pending resize is left to the next frame, which sends the damage
+		 * as well. */
+		if (client->encoder && shadow_encoder_refresh_due(client->encoder) &&
+		    client->activated && !client->suppressOutput &&
+		    !shadow_client_recalc_desktop_size(client))
+		{
+			if (!shadow_client_send_surface_update(client, &gfxstatus, FALSE))
+			{
+				WLog_ERR(TAG, "Failed to send deferred surface update");
+				break;
+			}
+
+			if (!shadow_client_send_progressive_upgrade(client, &gfxstatus))
+			{
+				WLog_ERR(TAG, "Failed to send progressive upgrade");
+				break;
+			}
+		}
+
 		if (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0)
 		{
 			/* The UpdateEvent means to start sending current frame. It is
@@ -2166,7 +3227,7 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 				else
 				{
 					/* Send frame */
-					if (!shadow_client_send_surface_update(client, &gfxstatus))
+					if (!shadow_client_send_surface_update(client, &gfxstatus, TRUE))
 					{
 						WLog_ERR(TAG, "Failed to send surface update");
 						break;
@@ -0,0 +1,257 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/assert.h>
+#include <winpr/interlocked.h>
+
+#include "shadow.h"
+
+#include "shadow_encode_cache.h"
+
+#include <freerdp/log.h>
+#define TAG SERVER_TAG("shadow.encodecache")
+
+BOOL shadow_encode_cache_key_set_params(SHADOW_ENCODE_CACHE_KEY* key, const UINT32* values,
+                                        size_t count)
+{
+	WINPR_ASSERT(key);
+	WINPR_ASSERT(values || (count == 0));
+
+	if (count > ARRAYSIZE(key->params))
+		return FALSE;
+
+	ZeroMemory(key->params, sizeof(key->params));
+	CopyMemory(key->params, values, count * sizeof(UINT32));
+	key->paramCount = (UINT32)count;
+	return TRUE;
+}
+
+static BOOL shadow_encode_cache_key_equals(const SHADOW_ENCODE_CACHE_KEY* a,
+                                           const SHADOW_ENCODE_CACHE_KEY* b)
+{
+	WINPR_ASSERT(a);
+	WINPR_ASSERT(b);
+
+	if ((a->surface != b->surface) || (a->frameSequence != b->frameSequence))
+		return FALSE;
+
+	if ((a->codecId != b->codecId) || (a->paramCount != b->paramCount))
+		return FALSE;
+
+	if (memcmp(a->params, b->params, a->paramCount * sizeof(UINT32)) != 0)
+		return FALSE;
+
+	return (a->rect.left == b->rect.left) && (a->rect.top == b->rect.top) &&
+	       (a->rect.right == b->rect.right) && (a->rect.bottom == b->rect.bottom);
+}
+
+static void shadow_encode_cache_part_free(void* obj)
+{
+	Stream_Free((wStream*)obj, TRUE);
+}
+
+SHADOW_ENCODE_CACHE_ENTRY* shadow_encode_cache_entry_new(const SHADOW_ENCODE_CACHE_KEY* key)
+{
+	wObject* obj;
+	SHADOW_ENCODE_CACHE_ENTRY* entry;
+
+	WINPR_ASSERT(key);
+
+	entry = (SHADOW_ENCODE_CACHE_ENTRY*)calloc(1, sizeof(SHADOW_ENCODE_CACHE_ENTRY));
+
+	if (!entry)
+		return NULL;
+
+	entry->key = *key;
+	entry->refCount = 1;
+	entry->parts = ArrayList_New(FALSE);
+
+	if (!entry->parts)
+	{
+		free(entry);
+		return NULL;
+	}
+
+	obj = ArrayList_Object(entry->parts);
+	obj->fnObjectFree = shadow_encode_cache_part_free;
+	return entry;
+}
+
+static void shadow_encode_cache_entry_free(SHADOW_ENCODE_CACHE_ENTRY* entry)
+{
+	if (!entry)
+		return;
+
+	ArrayList_Free(entry->parts);
+	free(entry);
+}
+
+BOOL shadow_encode_cache_entry_add_part(SHADOW_ENCODE_CACHE_ENTRY* entry, const BYTE* data,
+                                        size_t length)
+{
+	wStream* s;
+
+	WINPR_ASSERT(entry);
+	WINPR_ASSERT(data || (length == 0));
+
+	s = Stream_New(NULL, length + 1);
+
+	if (!s)
+		return FALSE;
+
+	Stream_Write(s, data, length);
+	Stream_SealLength(s);
+
+	if (!ArrayList_Append(entry->parts, s))
+	{
+		Stream_Free(s, TRUE);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+size_t shadow_encode_cache_entry_count(const SHADOW_ENCODE_CACHE_ENTRY* entry)
+{
+	WINPR_ASSERT(entry);
+	return ArrayList_Count(entry->parts);
+}
+
+wStream* shadow_encode_cache_entry_part(const SHADOW_ENCODE_CACHE_ENTRY* entry, size_t index)
+{
+	WINPR_ASSERT(entry);
+	return (wStream*)ArrayList_GetItem(entry->parts, index);
+}
+
+void shadow_encode_cache_release(SHADOW_ENCODE_CACHE_ENTRY* entry)
+{
+	if (!entry)
+		return;
+
+	if (InterlockedDecrement(&entry->refCount) == 0)
+		shadow_encode_cache_entry_free(entry);
+}
+
+static void shadow_encode_cache_entry_release(void* obj)
+{
+	shadow_encode_cache_release((SHADOW_ENCODE_CACHE_ENTRY*)obj);
+}
+
+SHADOW_ENCODE_CACHE_ENTRY* shadow_encode_cache_lookup(rdpShadowEncodeCache* cache,
+                                                      const SHADOW_ENCODE_CACHE_KEY* key)
+{
+	size_t x;
+	SHADOW_ENCODE_CACHE_ENTRY* found = NULL;
+
+	WINPR_ASSERT(cache);
+	WINPR_ASSERT(key);
+
+	ArrayList_Lock(cache->entries);
+
+	for (x = 0; x < ArrayList_Count(cache->entries); x++)
+	{
+		SHADOW_ENCODE_CACHE_ENTRY* entry =
+		    (SHADOW_ENCODE_CACHE_ENTRY*)ArrayList_GetItem(cache->entries, x);
+
+		if (shadow_encode_cache_key_equals(&entry->key, key))
+		{
+			InterlockedIncrement(&entry->refCount);
+			found = entry;
+			break;
+		}
+	}
+
+	if (found)
+		cache->hits++;
+	else
+		cache->misses++;
+
+	ArrayList_Unlock(cache->entries);
+	return found;
+}
+
+BOOL shadow_encode_cache_insert(rdpShadowEncodeCache* cache, SHADOW_ENCODE_CACHE_ENTRY* entry)
+{
+	size_t x;
+	BOOL rc;
+
+	WINPR_ASSERT(cache);
+	WINPR_ASSERT(entry);
+
+	ArrayList_Lock(cache->entries);
+
+	/* Results of older frames of the same surface can never be hit again */
+	for (x = ArrayList_Count(cache->entries); x > 0; x--)
+	{
+		const SHADOW_ENCODE_CACHE_ENTRY* cur =
+		    (const SHADOW_ENCODE_CACHE_ENTRY*)ArrayList_GetItem(cache->entries, x - 1);
+
+		if ((cur->key.surface == entry->key.surface) &&
+		    (cur->key.frameSequence != entry->key.frameSequence))
+			ArrayList_RemoveAt(cache->entries, x - 1);
+	}
+
+	while (ArrayList_Count(cache->entries) >= cache->maxEntries)
+		ArrayList_RemoveAt(cache->entries, 0);
+
+	/* The cache holds its own reference, dropped on eviction */
+	InterlockedIncrement(&entry->refCount);
+	rc = ArrayList_Append(cache->entries, entry);
+
+	if (!rc)
+		InterlockedDecrement(&entry->refCount);
+
+	WLog_DBG(TAG, "frame %" PRIu32 " codec 0x%08" PRIx32 ": %" PRIu64 " hits, %" PRIu64 " misses",
+	         entry->key.frameSequence, entry->key.codecId, cache->hits, cache->misses);
+	ArrayList_Unlock(cache->entries);
+	return rc;
+}
+
+rdpShadowEncodeCache* shadow_encode_cache_new(rdpShadowServer* server, size_t maxEntries)
+{
+	wObject* obj;
+	rdpShadowEncodeCache* cache;
+
+	cache = (rdpShadowEncodeCache*)calloc(1, sizeof(rdpShadowEncodeCache));
+
+	if (!cache)
+		return NULL;
+
+	cache->server = server;
+	cache->maxEntries = (maxEntries > 0) ? maxEntries : 1;
+	cache->entries = ArrayList_New(TRUE);
+
+	if (!cache->entries)
+	{
+		free(cache);
+		return NULL;
+	}
+
+	obj = ArrayList_Object(cache->entries);
+	obj->fnObjectFree = shadow_encode_cache_entry_release;
+	return cache;
+}
+
+void shadow_encode_cache_free(rdpShadowEncodeCache* cache)
+{
+	if (!cache)
+		return;
+
+	ArrayList_Free(cache->entries);
+	free(cache);
+}
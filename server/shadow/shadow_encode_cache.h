@@ -0,0 +1,90 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_ENCODE_CACHE_H
+#define FREERDP_SERVER_SHADOW_ENCODE_CACHE_H
+
+#include <freerdp/server/shadow.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/stream.h>
+#include <winpr/collections.h>
+
+/*
+ * Server wide cache of encoded frames.
+ * All clients are served from the same surface, so clients negotiating
+ * identical codec parameters can share one encode result per frame and only
+ * do their own packetization (headers, frame ids, PDU framing).
+ */
+
+#define SHADOW_ENCODE_CACHE_MAX_PARAMS 8
+
+typedef struct
+{
+	const rdpShadowSurface* surface;
+	UINT32 frameSequence;
+	UINT32 codecId; /* FREERDP_CODEC_* */
+	UINT32 paramCount;
+	UINT32 params[SHADOW_ENCODE_CACHE_MAX_PARAMS]; /* codec parameters the result depends on */
+	RECTANGLE_16 rect;
+} SHADOW_ENCODE_CACHE_KEY;
+
+typedef struct
+{
+	SHADOW_ENCODE_CACHE_KEY key;
+	wArrayList* parts; /* wStream*, one per encoded message */
+	volatile LONG refCount;
+} SHADOW_ENCODE_CACHE_ENTRY;
+
+struct rdp_shadow_encode_cache
+{
+	rdpShadowServer* server;
+
+	size_t maxEntries;
+	wArrayList* entries;
+
+	UINT64 hits;
+	UINT64 misses;
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	BOOL shadow_encode_cache_key_set_params(SHADOW_ENCODE_CACHE_KEY* key, const UINT32* values,
+	                                        size_t count);
+
+	SHADOW_ENCODE_CACHE_ENTRY* shadow_encode_cache_lookup(rdpShadowEncodeCache* cache,
+	                                                      const SHADOW_ENCODE_CACHE_KEY* key);
+	BOOL shadow_encode_cache_insert(rdpShadowEncodeCache* cache, SHADOW_ENCODE_CACHE_ENTRY* entry);
+	void shadow_encode_cache_release(SHADOW_ENCODE_CACHE_ENTRY* entry);
+
+	SHADOW_ENCODE_CACHE_ENTRY* shadow_encode_cache_entry_new(const SHADOW_ENCODE_CACHE_KEY* key);
+	BOOL shadow_encode_cache_entry_add_part(SHADOW_ENCODE_CACHE_ENTRY* entry, const BYTE* data,
+	                                        size_t length);
+	size_t shadow_encode_cache_entry_count(const SHADOW_ENCODE_CACHE_ENTRY* entry);
+	wStream* shadow_encode_cache_entry_part(const SHADOW_ENCODE_CACHE_ENTRY* entry, size_t index);
+
+	rdpShadowEncodeCache* shadow_encode_cache_new(rdpShadowServer* server, size_t maxEntries);
+	void shadow_encode_cache_free(rdpShadowEncodeCache* cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_ENCODE_CACHE_H */
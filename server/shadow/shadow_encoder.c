@@ -19,6 +19,7 @@
 #include <freerdp/config.h>
 
 #include <winpr/assert.h>
+#include <winpr/sysinfo.h>
 
 #include "shadow.h"
 
@@ -49,33 +50,353 @@ UINT32 shadow_encoder_inflight_frames(rdpShadowEncoder* encoder)
 	           : encoder->frameId - encoder->lastAckframeId;
 }
 
+/* Unacknowledged frames older than this are assumed to be lost */
+#define SHADOW_RATE_EXPIRE_MS 2000
+/* The lowest acknowledge latency is forgotten after this, routes change */
+#define SHADOW_RATE_BASE_WINDOW_MS 10000
+#define SHADOW_RATE_MAX_QUALITY 6
+#define SHADOW_RATE_MIN_BITRATE 250000
+
+static const UINT32 shadow_rfx_quantization_values[] = { 6, 6, 6, 6, 7, 7, 8, 8, 8, 9 };
+
+BOOL shadow_encoder_get_rate_metrics(rdpShadowEncoder* encoder, SHADOW_RATE_METRICS* metrics)
+{
+	if (!encoder || !metrics)
+		return FALSE;
+
+	*metrics = encoder->metrics;
+	metrics->fps = encoder->fps;
+	return TRUE;
+}
+
 UINT32 shadow_encoder_create_frame_id(rdpShadowEncoder* encoder)
 {
-	UINT32 frameId;
-	UINT32 inFlightFrames = shadow_encoder_inflight_frames(encoder);
+	SHADOW_RATE_SAMPLE* sample;
+	const UINT32 frameId = ++encoder->frameId;
+
+	/*
+	 * The fps is tuned in shadow_encoder_update_rate, here we only
+	 * remember when the frame left to measure the acknowledge latency.
+	 */
+	sample = &encoder->samples[frameId % SHADOW_RATE_HISTORY];
+	sample->frameId = frameId;
+	sample->sentAt = GetTickCount64();
+	sample->bytes = 0;
+	encoder->metrics.framesSent++;
+	return frameId;
+}
+
+void shadow_encoder_account_sent(rdpShadowEncoder* encoder)
+{
+	ULONG total;
+	ULONG bytes;
+	SHADOW_RATE_SAMPLE* sample;
+	rdpContext* context = (rdpContext*)encoder->client;
+
+	WINPR_ASSERT(context);
+
+	/*
+	 * Everything written since the last call belongs to the latest frame.
+	 * Dynamic channel data leaves later than the encoder produces it, so
+	 * this is called before and after each update.
+	 */
+	total = freerdp_get_transport_sent(context, FALSE);
+	bytes = total - encoder->sentTotal;
+	encoder->sentTotal = total;
+	sample = &encoder->samples[encoder->frameId % SHADOW_RATE_HISTORY];
+
+	if ((encoder->frameId != 0) && (sample->frameId == encoder->frameId))
+		sample->bytes = (UINT32)MIN((UINT64)sample->bytes + bytes, UINT32_MAX);
+}
+
+void shadow_encoder_frame_acknowledged(rdpShadowEncoder* encoder, UINT32 frameId)
+{
+	UINT32 latency;
+	const UINT64 now = GetTickCount64();
+	SHADOW_RATE_METRICS* metrics = &encoder->metrics;
+	SHADOW_RATE_SAMPLE* sample = &encoder->samples[frameId % SHADOW_RATE_HISTORY];
+
+	encoder->lastAckframeId = frameId;
+
+	if ((sample->frameId != frameId) || (sample->sentAt == 0))
+		return;
+
+	latency = (UINT32)MIN(now - sample->sentAt, UINT32_MAX);
+	sample->sentAt = 0;
+
+	if (metrics->ackLatency == 0)
+		metrics->ackLatency = latency;
+	else
+		metrics->ackLatency = (metrics->ackLatency * 7 + latency) / 8;
+
+	if ((metrics->baseLatency == 0) || (latency <= metrics->baseLatency) ||
+	    (now - encoder->baseLatencyAt > SHADOW_RATE_BASE_WINDOW_MS))
+	{
+		metrics->baseLatency = MAX(latency, 1);
+		encoder->baseLatencyAt = now;
+	}
+
+	/* Delivered rate, a lower bound of the bandwidth measured over a second or more */
+	if (encoder->ackedSince == 0)
+		encoder->ackedSince = now;
+
+	encoder->ackedBytes += sample->bytes;
+
+	if (now - encoder->ackedSince >= 1000)
+	{
+		encoder->throughput =
+		    (UINT32)MIN(encoder->ackedBytes * 8 / (now - encoder->ackedSince), UINT32_MAX);
+		encoder->ackedBytes = 0;
+		encoder->ackedSince = now;
+	}
+}
+
+static UINT64 shadow_encoder_inflight_bytes(rdpShadowEncoder* encoder, UINT64 now)
+{
+	size_t index;
+	UINT64 bytes = 0;
+
+	if (encoder->queueDepth == SUSPEND_FRAME_ACKNOWLEDGEMENT)
+		return 0;
+
+	for (index = 0; index < SHADOW_RATE_HISTORY; index++)
+	{
+		const SHADOW_RATE_SAMPLE* sample = &encoder->samples[index];
+
+		if ((sample->sentAt == 0) || ((INT32)(sample->frameId - encoder->lastAckframeId) <= 0))
+			continue;
+
+		if (now - sample->sentAt > SHADOW_RATE_EXPIRE_MS)
+			continue;
+
+		bytes += sample->bytes;
+	}
+
+	return bytes;
+}
+
+static BOOL shadow_encoder_set_rfx_quality(rdpShadowEncoder* encoder, UINT32 quality)
+{
+	size_t index;
+	RFX_CONTEXT* rfx = encoder->rfx;
+
+	/* A fresh context installs the default table itself */
+	if ((rfx->numQuant == 0) && (quality == 0))
+		return TRUE;
+
+	if ((rfx->numQuant == 1) && (encoder->quality == quality))
+		return TRUE;
+
+	if (rfx->numQuant != 1)
+	{
+		UINT32* quants = (UINT32*)realloc(rfx->quants, sizeof(shadow_rfx_quantization_values));
+
+		if (!quants)
+			return FALSE;
+
+		rfx->quants = quants;
+		rfx->numQuant = 1;
+		rfx->quantIdxY = 0;
+		rfx->quantIdxCb = 0;
+		rfx->quantIdxCr = 0;
+	}
+
+	/* Every step halves the precision of all sub-bands, 15 is the coarsest value allowed */
+	for (index = 0; index < ARRAYSIZE(shadow_rfx_quantization_values); index++)
+		rfx->quants[index] = MIN(shadow_rfx_quantization_values[index] + quality, 15);
+
+	encoder->quality = quality;
+	return TRUE;
+}
+
+BOOL shadow_encoder_update_rate(rdpShadowEncoder* encoder)
+{
+	BOOL blocked = FALSE;
+	BOOL congested;
+	BOOL relaxed;
+	UINT32 rtt = 0;
+	UINT32 bandwidth = 0;
+	UINT64 budget = 0;
+	UINT64 maxBitRate;
+	UINT64 bitRate;
+	UINT32 quality;
+	rdpNetworkCharacteristics netchar = { 0 };
+	const UINT64 now = GetTickCount64();
+	rdpContext* context = (rdpContext*)encoder->client;
+	SHADOW_RATE_METRICS* metrics = &encoder->metrics;
+
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(encoder->server);
+
+	shadow_encoder_account_sent(encoder);
+
+	/* Measured continuously if the client supports network autodetection, 0 until then */
+	if (freerdp_get_network_characteristics(context, &netchar))
+	{
+		bandwidth = netchar.bandwidth;
+		rtt = netchar.averageRTT;
+	}
+
+	if (context->peer && context->peer->IsWriteBlocked)
+		blocked = context->peer->IsWriteBlocked(context->peer);
+
+	if (blocked)
+		metrics->writeBlocked++;
+
+	metrics->inflightFrames = shadow_encoder_inflight_frames(encoder);
+	metrics->inflightBytes = shadow_encoder_inflight_bytes(encoder, now);
+	metrics->bandwidth = bandwidth ? bandwidth : encoder->throughput;
+
+	/* Allow a round trip worth of data on the wire, but never less than 100ms */
+	if (bandwidth)
+		budget = (UINT64)bandwidth * 1000 / 8 * MAX(MAX(rtt, metrics->ackLatency), 100) / 1000;
+
+	congested = blocked || (budget && (metrics->inflightBytes > budget)) ||
+	            (metrics->baseLatency &&
+	             (metrics->ackLatency > metrics->baseLatency * 2 + 50));
+	relaxed = !congested && (!budget || (metrics->inflightBytes <= budget / 2)) &&
+	          (metrics->ackLatency <= metrics->baseLatency * 3 / 2 + 20);
 
 	/*
 	 * Calculate preferred fps according to how much frames are
 	 * in-progress. Note that it only works when subsytem implementation
 	 * calls shadow_encoder_preferred_fps and takes the suggestion.
 	 */
-	if (inFlightFrames > 1)
+	if (congested)
 	{
-		encoder->fps = (100 / (inFlightFrames + 1) * encoder->maxFps) / 100;
+		encoder->fps = encoder->fps * 3 / 4;
 	}
-	else
+	else if (metrics->inflightFrames > 1)
+	{
+		encoder->fps = (100 / (metrics->inflightFrames + 1) * encoder->maxFps) / 100;
+	}
+	else if (encoder->frameId != 0)
 	{
 		encoder->fps += 2;
-
-		if (encoder->fps > encoder->maxFps)
-			encoder->fps = encoder->maxFps;
 	}
 
+	if (encoder->fps > encoder->maxFps)
+		encoder->fps = encoder->maxFps;
+
 	if (encoder->fps < 1)
 		encoder->fps = 1;
 
-	frameId = ++encoder->frameId;
-	return frameId;
+	/* Coarser quantization first, it frees bandwidth without adding latency */
+	quality = metrics->quality;
+
+	if (congested && (quality < SHADOW_RATE_MAX_QUALITY))
+		quality++;
+	else if (relaxed && (quality > 0) && (encoder->fps == encoder->maxFps))
+		quality--;
+
+	maxBitRate = encoder->server->h264BitRate;
+
+	if (bandwidth)
+		maxBitRate = MIN(maxBitRate, (UINT64)bandwidth * 800);
+
+	bitRate = metrics->bitRate ? metrics->bitRate : maxBitRate;
+
+	if (congested)
+	{
+		bitRate = bitRate * 3 / 4;
+
+		/* While congested the delivered rate is close to what the link can carry */
+		if (encoder->throughput)
+			bitRate = MIN(bitRate, (UINT64)encoder->throughput * 800);
+	}
+	else if (relaxed)
+		bitRate += bitRate / 16;
+
+	bitRate = MAX(bitRate, MIN(SHADOW_RATE_MIN_BITRATE, maxBitRate));
+	bitRate = MIN(bitRate, maxBitRate);
+
+	if ((quality != metrics->quality) || ((UINT32)bitRate != metrics->bitRate))
+		WLog_DBG(TAG,
+		         "rate control: %s fps %" PRIu32 " quality %" PRIu32 " bitrate %" PRIu64
+		         " latency %" PRIu32 "/%" PRIu32 "ms inflight %" PRIu64 " bytes",
+		         congested ? "congested" : "clear", encoder->fps, quality, bitRate,
+		         metrics->ackLatency, metrics->baseLatency, metrics->inflightBytes);
+
+	metrics->quality = quality;
+	metrics->bitRate = (UINT32)bitRate;
+	metrics->fps = encoder->fps;
+
+	if (encoder->h264)
+	{
+		if (encoder->h264->RateControlMode == H264_RATECONTROL_VBR)
+		{
+			if (metrics->bitRate)
+				encoder->h264->BitRate = metrics->bitRate;
+		}
+		else
+			encoder->h264->QP = MIN(encoder->server->h264QP + quality * 4, 51);
+	}
+
+	if (encoder->rfx && !shadow_encoder_set_rfx_quality(encoder, quality))
+		WLog_WARN(TAG, "Failed to change the RemoteFX quantization");
+
+	/*
+	 * Frames sent into a full queue only add latency, keep the damage
+	 * for a later update instead. Give up after a second worth of frames
+	 * so a stalled acknowledgement can not freeze the screen.
+	 */
+	if ((blocked || (budget && (metrics->inflightBytes > budget * 2))) &&
+	    (encoder->deferred < encoder->maxFps))
+	{
+		encoder->deferred++;
+		metrics->framesDeferred++;
+
+		/* Subsystems only signal new damage, retry on our own after a frame interval */
+		if (!shadow_encoder_schedule_refresh(encoder, 1000 / encoder->fps))
+			WLog_WARN(TAG, "Failed to schedule the deferred update");
+
+		return FALSE;
+	}
+
+	encoder->deferred = 0;
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Arms the refresh timer of the client, a refresh that is already due
+ * earlier is kept.
+ *
+ * @param delay milliseconds until the client should send its pending damage
+ */
+BOOL shadow_encoder_schedule_refresh(rdpShadowEncoder* encoder, UINT32 delay)
+{
+	LARGE_INTEGER due;
+	const UINT64 now = GetTickCount64();
+
+	WINPR_ASSERT(encoder);
+
+	if ((encoder->refreshDue > now) && (encoder->refreshDue <= now + delay))
+		return TRUE;
+
+	delay = MAX(delay, 1);
+	encoder->refreshDue = now + delay;
+	due.QuadPart = -10000LL * delay;
+	return SetWaitableTimer(encoder->refreshTimer, &due, 0, NULL, NULL, FALSE);
+}
+
+/**
+ * Function description
+ * Checks if a scheduled refresh is due, the caller then sends the damage it
+ * kept. The timer only wakes up the client thread.
+ */
+BOOL shadow_encoder_refresh_due(rdpShadowEncoder* encoder)
+{
+	WINPR_ASSERT(encoder);
+
+	/* Drains the timer if the wait did not already */
+	WaitForSingleObject(encoder->refreshTimer, 0);
+
+	if ((encoder->refreshDue == 0) || (GetTickCount64() < encoder->refreshDue))
+		return FALSE;
+
+	encoder->refreshDue = 0;
+	return TRUE;
 }
 
 static int shadow_encoder_init_grid(rdpShadowEncoder* encoder)
@@ -86,7 +407,8 @@ static int shadow_encoder_init_grid(rdpShadowEncoder* encoder)
 	encoder->gridWidth = ((encoder->width + (encoder->maxTileWidth - 1)) / encoder->maxTileWidth);
 	encoder->gridHeight =
 	    ((encoder->height + (encoder->maxTileHeight - 1)) / encoder->maxTileHeight);
-	tileSize = encoder->maxTileWidth * encoder->maxTileHeight * 4;
+	/* Planar tiles fall back to raw planes, which is larger than the tile itself */
+	tileSize = freerdp_bitmap_planar_max_size(encoder->maxTileWidth, encoder->maxTileHeight);
 	tileCount = encoder->gridWidth * encoder->gridHeight;
 	encoder->gridBuffer = (BYTE*)calloc(tileSize, tileCount);
 
@@ -265,10 +587,34 @@ static int shadow_encoder_init_progressive(rdpShadowEncoder* encoder)
 	if (!progressive_context_reset(encoder->progressive))
 		goto fail;
 
+	if (!progressive_set_quality_ladder(encoder->progressive, encoder->server->progressiveLadder,
+	                                    encoder->server->progressiveLadderCount))
+		goto fail;
+
+	encoder->progressiveSurfaceId = 0;
+	encoder->progressiveUpgradeAt = 0;
 	encoder->codecs |= FREERDP_CODEC_PROGRESSIVE;
 	return 1;
 fail:
 	progressive_context_free(encoder->progressive);
+	encoder->progressive = NULL;
+	return -1;
+}
+
+static int shadow_encoder_init_clear(rdpShadowEncoder* encoder)
+{
+	WINPR_ASSERT(encoder);
+	if (!encoder->clear)
+		encoder->clear = clear_context_new(TRUE);
+
+	if (!encoder->clear)
+		goto fail;
+
+	encoder->codecs |= FREERDP_CODEC_CLEARCODEC;
+	return 1;
+fail:
+	clear_context_free(encoder->clear);
+	encoder->clear = NULL;
 	return -1;
 }
 
@@ -349,6 +695,13 @@ static int shadow_encoder_uninit_h264(rdpShadowEncoder* encoder)
 	return 1;
 }
 
+/* The next frame of a new encoder instance is an IDR frame */
+void shadow_encoder_restart_h264(rdpShadowEncoder* encoder)
+{
+	WINPR_ASSERT(encoder);
+	shadow_encoder_uninit_h264(encoder);
+}
+
 static int shadow_encoder_uninit_progressive(rdpShadowEncoder* encoder)
 {
 	WINPR_ASSERT(encoder);
@@ -358,10 +711,25 @@ static int shadow_encoder_uninit_progressive(rdpShadowEncoder* encoder)
 		encoder->progressive = NULL;
 	}
 
+	encoder->progressiveSurfaceId = 0;
+	encoder->progressiveUpgradeAt = 0;
 	encoder->codecs &= (UINT32)~FREERDP_CODEC_PROGRESSIVE;
 	return 1;
 }
 
+static int shadow_encoder_uninit_clear(rdpShadowEncoder* encoder)
+{
+	WINPR_ASSERT(encoder);
+	if (encoder->clear)
+	{
+		clear_context_free(encoder->clear);
+		encoder->clear = NULL;
+	}
+
+	encoder->codecs &= (UINT32)~FREERDP_CODEC_CLEARCODEC;
+	return 1;
+}
+
 static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 {
 	shadow_encoder_uninit_grid(encoder);
@@ -383,6 +751,12 @@ static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 
 	shadow_encoder_uninit_progressive(encoder);
 
+	shadow_encoder_uninit_clear(encoder);
+
+	shadow_broadcast_unsubscribe(encoder->server->broadcast, encoder->broadcast);
+	encoder->broadcast = NULL;
+	encoder->broadcastSequence = 0;
+
 	return 1;
 }
 
@@ -412,6 +786,10 @@ int shadow_encoder_reset(rdpShadowEncoder* encoder)
 	encoder->frameId = 0;
 	encoder->lastAckframeId = 0;
 	encoder->frameAck = settings->SurfaceFrameMarkerEnabled;
+	ZeroMemory(&encoder->videoRect, sizeof(encoder->videoRect));
+	ZeroMemory(encoder->samples, sizeof(encoder->samples));
+	encoder->deferred = 0;
+	encoder->quality = 0;
 	return 1;
 }
 
@@ -474,6 +852,15 @@ int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs)
 			return -1;
 	}
 
+	if ((codecs & FREERDP_CODEC_CLEARCODEC) && !(encoder->codecs & FREERDP_CODEC_CLEARCODEC))
+	{
+		WLog_DBG(TAG, "initializing ClearCodec encoder");
+		status = shadow_encoder_init_clear(encoder);
+
+		if (status < 0)
+			return -1;
+	}
+
 	return 1;
 }
 
@@ -490,9 +877,17 @@ rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client)
 	encoder->server = server;
 	encoder->fps = 16;
 	encoder->maxFps = 32;
+	encoder->refreshTimer = CreateWaitableTimerA(NULL, FALSE, NULL);
+
+	if (!encoder->refreshTimer)
+	{
+		free(encoder);
+		return NULL;
+	}
 
 	if (shadow_encoder_init(encoder) < 0)
 	{
+		CloseHandle(encoder->refreshTimer);
 		free(encoder);
 		return NULL;
 	}
@@ -506,5 +901,6 @@ void shadow_encoder_free(rdpShadowEncoder* encoder)
 		return;
 
 	shadow_encoder_uninit(encoder);
+	CloseHandle(encoder->refreshTimer);
 	free(encoder);
 }
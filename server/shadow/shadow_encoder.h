@@ -27,6 +27,17 @@
 
 #include <freerdp/server/shadow.h>
 
+#include "shadow_broadcast.h"
+
+#define SHADOW_RATE_HISTORY 64
+
+typedef struct
+{
+	UINT32 frameId;
+	UINT64 sentAt;
+	UINT32 bytes;
+} SHADOW_RATE_SAMPLE;
+
 struct rdp_shadow_encoder
 {
 	rdpShadowClient* client;
@@ -51,6 +62,19 @@ struct rdp_shadow_encoder
 	BITMAP_INTERLEAVED_CONTEXT* interleaved;
 	H264_CONTEXT* h264;
 	PROGRESSIVE_CONTEXT* progressive;
+	CLEAR_CONTEXT* clear;
+
+	/* H.264 region of the last adaptive GFX frame, see shadow_classify.h */
+	RECTANGLE_16 videoRect;
+
+	/* Shared H.264 encoder and its last frame sent, 0 while the client is out of step */
+	SHADOW_BROADCAST_STREAM* broadcast;
+	UINT32 broadcastSequence;
+	/* Out of step, the client gets frames of its own H.264 encoder until the next shared IDR */
+	BOOL broadcastBridging;
+	UINT64 broadcastJoinedAt;
+	UINT64 broadcastNextRequest;
+	UINT32 broadcastBackoff;
 
 	UINT32 fps;
 	UINT32 maxFps;
@@ -58,6 +82,25 @@ struct rdp_shadow_encoder
 	UINT32 frameId;
 	UINT32 lastAckframeId;
 	UINT32 queueDepth;
+
+	/* Rate control, see shadow_encoder_update_rate */
+	SHADOW_RATE_SAMPLE samples[SHADOW_RATE_HISTORY];
+	SHADOW_RATE_METRICS metrics;
+	UINT64 baseLatencyAt;
+	ULONG sentTotal;
+	UINT64 ackedBytes;
+	UINT64 ackedSince;
+	UINT32 throughput;
+	UINT32 deferred;
+	UINT32 quality;
+
+	/* Wakes up the client thread to send damage held back, see shadow_encoder_schedule_refresh */
+	HANDLE refreshTimer;
+	UINT64 refreshDue;
+
+	/* Multi pass progressive, see shadow_client_send_progressive_upgrade */
+	UINT16 progressiveSurfaceId; /* surface with tile state in the progressive context, or 0 */
+	UINT64 progressiveUpgradeAt; /* tick of the next upgrade pass, 0 if none is pending */
 };
 
 #ifdef __cplusplus
@@ -68,6 +111,13 @@ extern "C"
 	int shadow_encoder_reset(rdpShadowEncoder* encoder);
 	int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs);
 	UINT32 shadow_encoder_create_frame_id(rdpShadowEncoder* encoder);
+	void shadow_encoder_account_sent(rdpShadowEncoder* encoder);
+	void shadow_encoder_frame_acknowledged(rdpShadowEncoder* encoder, UINT32 frameId);
+	/* Tunes fps, bitrate and quantization, FALSE if the update should be deferred */
+	BOOL shadow_encoder_update_rate(rdpShadowEncoder* encoder);
+	BOOL shadow_encoder_schedule_refresh(rdpShadowEncoder* encoder, UINT32 delay);
+	BOOL shadow_encoder_refresh_due(rdpShadowEncoder* encoder);
+	void shadow_encoder_restart_h264(rdpShadowEncoder* encoder);
 
 	rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client);
 	void shadow_encoder_free(rdpShadowEncoder* encoder);
@@ -80,6 +80,7 @@ BOOL shadow_client_init_lobby(rdpShadowServer* server)
 	rdtk_engine_free(engine);
 
 	region16_union_rect(&(lobby->invalidRegion), &(lobby->invalidRegion), &invalidRect);
+	lobby->frameSequence++;
 
 	return TRUE;
 }
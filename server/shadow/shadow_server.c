@@ -114,6 +114,42 @@ static int shadow_server_print_command_line_help(int argc, char** argv,
 	return 1;
 }
 
+static BOOL shadow_server_parse_quality_ladder(rdpShadowServer* server, const char* list)
+{
+	size_t i;
+	size_t count = 0;
+	BOOL rc = FALSE;
+	char** values = CommandLineParseCommaSeparatedValues(list, &count);
+
+	if (!values || (count == 0) || (count > ARRAYSIZE(server->progressiveLadder)))
+		goto fail;
+
+	for (i = 0; i < count; i++)
+	{
+		unsigned long quality;
+
+		errno = 0;
+		quality = strtoul(values[i], NULL, 0);
+
+		if ((errno != 0) || (quality < 1) || (quality > 100))
+			goto fail;
+
+		if ((i > 0) && (quality <= server->progressiveLadder[i - 1]))
+			goto fail;
+
+		server->progressiveLadder[i] = (BYTE)quality;
+	}
+
+	server->progressiveLadderCount = (UINT32)count;
+	rc = TRUE;
+fail:
+	if (!rc)
+		WLog_ERR(TAG, "Invalid progressive quality ladder '%s'", list);
+
+	free(values);
+	return rc;
+}
+
 int shadow_server_command_line_status_print(rdpShadowServer* server, int argc, char** argv,
                                             int status, COMMAND_LINE_ARGUMENT_A* cargs)
 {
@@ -368,6 +404,11 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 			                               arg->Value ? TRUE : FALSE))
 				return COMMAND_LINE_ERROR;
 		}
+		CommandLineSwitchCase(arg, "gfx-progressive-ladder")
+		{
+			if (!shadow_server_parse_quality_ladder(server, arg->Value))
+				return COMMAND_LINE_ERROR;
+		}
 		CommandLineSwitchCase(arg, "gfx-rfx")
 		{
 			if (!freerdp_settings_set_bool(settings, FreeRDP_RemoteFxCodec,
@@ -392,6 +433,18 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 			if (!freerdp_settings_set_bool(settings, FreeRDP_GfxAVC444, arg->Value ? TRUE : FALSE))
 				return COMMAND_LINE_ERROR;
 		}
+		CommandLineSwitchCase(arg, "gfx-clear")
+		{
+			server->gfxClear = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "gfx-adaptive")
+		{
+			server->gfxAdaptive = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "gfx-broadcast")
+		{
+			server->gfxBroadcast = arg->Value ? TRUE : FALSE;
+		}
 		CommandLineSwitchCase(arg, "keytab")
 		{
 			if (!freerdp_settings_set_string(settings, FreeRDP_KerberosKeytab, arg->Value))
@@ -584,6 +637,30 @@ int shadow_server_start(rdpShadowServer* server)
 		return -1;
 	}
 
+	server->encodeCache = shadow_encode_cache_new(server, 16);
+
+	if (!server->encodeCache)
+	{
+		WLog_ERR(TAG, "encode_cache_new failed");
+		return -1;
+	}
+
+	server->classifier = shadow_classifier_new();
+
+	if (!server->classifier)
+	{
+		WLog_ERR(TAG, "classifier_new failed");
+		return -1;
+	}
+
+	server->broadcast = shadow_broadcast_new(server);
+
+	if (!server->broadcast)
+	{
+		WLog_ERR(TAG, "broadcast_new failed");
+		return -1;
+	}
+
 	/* Bind magic:
 	 *
 	 * emtpy                 ... bind TCP all
@@ -671,6 +748,24 @@ int shadow_server_stop(rdpShadowServer* server)
 		server->capture = NULL;
 	}
 
+	if (server->encodeCache)
+	{
+		shadow_encode_cache_free(server->encodeCache);
+		server->encodeCache = NULL;
+	}
+
+	if (server->classifier)
+	{
+		shadow_classifier_free(server->classifier);
+		server->classifier = NULL;
+	}
+
+	if (server->broadcast)
+	{
+		shadow_broadcast_free(server->broadcast);
+		server->broadcast = NULL;
+	}
+
 	return 0;
 }
 
@@ -22,6 +22,9 @@
 
 #include "shadow_subsystem.h"
 
+#include <freerdp/log.h>
+#define TAG SERVER_TAG("shadow.subsystem")
+
 static pfnShadowSubsystemEntry pSubsystemEntry = NULL;
 
 void shadow_subsystem_set_entry(pfnShadowSubsystemEntry pEntry)
@@ -279,5 +282,22 @@ int shadow_subsystem_pointer_convert_alpha_pointer_data(
 
 void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem)
 {
+	rdpShadowServer* server = subsystem->server;
+	rdpShadowSurface* surface = server ? server->surface : NULL;
+
+	/* New frame content, invalidates all cached encoder output */
+	if (surface)
+	{
+		EnterCriticalSection(&surface->lock);
+		surface->frameSequence++;
+
+		/* Classified once per frame, all clients pick their codecs from the result */
+		if (server->gfxAdaptive && server->classifier &&
+		    !shadow_classifier_update(server->classifier, surface))
+			WLog_WARN(TAG, "content classification failed");
+
+		LeaveCriticalSection(&surface->lock);
+	}
+
 	shadow_multiclient_publish_and_wait(subsystem->updateEvent);
 }
@@ -97,6 +97,7 @@ BOOL shadow_surface_resize(rdpShadowSurface* surface, UINT16 x, UINT16 y, UINT32
 		surface->height = height;
 		surface->scanline = scanline;
 		surface->data = buffer;
+		surface->frameSequence++;
 		return TRUE;
 	}
 
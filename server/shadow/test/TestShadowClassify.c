@@ -0,0 +1,154 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/crypto.h>
+
+#include <freerdp/codec/region.h>
+
+#include "../shadow_classify.h"
+
+/*
+ * Runs the classifier over a synthetic 256x128 surface, four tiles per row:
+ * flat UI, a still image, a gradient that moves every frame and an untouched tile.
+ * The second row holds noise, which has many colors but dense sharp edges.
+ */
+
+#define TEST_WIDTH 256
+#define TEST_HEIGHT 128
+#define TEST_TILE SHADOW_CLASSIFY_TILE_SIZE
+
+static void test_fill(rdpShadowSurface* surface, UINT32 tileX, UINT32 tileY, UINT32 frame)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < TEST_TILE; y++)
+	{
+		UINT32* line = (UINT32*)&surface->data[(tileY * TEST_TILE + y) * surface->scanline +
+		                                       tileX * TEST_TILE * 4];
+
+		for (x = 0; x < TEST_TILE; x++)
+		{
+			if (tileX == 0)
+				line[x] = ((x / 8 + y / 8) % 2) ? 0xFFFFFFFF : 0xFF2040A0;
+			else
+				line[x] = 0xFF000000 | (((x * 2 + frame * 3) & 0xFF) << 16) | ((y * 2) << 8) |
+				          (x + y + frame);
+		}
+	}
+}
+
+static BOOL test_damage(rdpShadowSurface* surface, UINT32 tileX, UINT32 tileY)
+{
+	RECTANGLE_16 rect;
+
+	rect.left = (UINT16)(tileX * TEST_TILE);
+	rect.top = (UINT16)(tileY * TEST_TILE);
+	rect.right = (UINT16)(rect.left + TEST_TILE);
+	rect.bottom = (UINT16)(rect.top + TEST_TILE);
+	return region16_union_rect(&surface->invalidRegion, &surface->invalidRegion, &rect);
+}
+
+static BOOL test_expect(const rdpShadowClassifier* classifier, UINT32 tileX, UINT32 tileY,
+                        SHADOW_CONTENT_TYPE expected, const char* what)
+{
+	const SHADOW_CONTENT_TYPE type = shadow_classifier_tile_type(classifier, tileX, tileY);
+
+	if (type == expected)
+		return TRUE;
+
+	fprintf(stderr, "TestShadowClassify: %s tile is %d, expected %d\n", what, type, expected);
+	return FALSE;
+}
+
+int TestShadowClassify(int argc, char* argv[])
+{
+	int rc = -1;
+	UINT32 frame;
+	rdpShadowSurface surface = { 0 };
+	rdpShadowClassifier* classifier = shadow_classifier_new();
+	const RECTANGLE_16 videoTile = { 2 * TEST_TILE, 0, 3 * TEST_TILE, TEST_TILE };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	surface.width = TEST_WIDTH;
+	surface.height = TEST_HEIGHT;
+	surface.scanline = TEST_WIDTH * 4;
+	surface.format = PIXEL_FORMAT_BGRX32;
+	surface.data = (BYTE*)calloc(TEST_HEIGHT, surface.scanline);
+	region16_init(&surface.invalidRegion);
+
+	if (!classifier || !surface.data)
+		goto fail;
+
+	if (!test_expect(classifier, 0, 0, SHADOW_CONTENT_NONE, "unclassified"))
+		goto fail;
+
+	/* The first frame damages everything but the last tile of the first row */
+	test_fill(&surface, 0, 0, 0);
+	test_fill(&surface, 1, 0, 0);
+	test_fill(&surface, 2, 0, 0);
+	winpr_RAND(&surface.data[TEST_TILE * surface.scanline], TEST_TILE * surface.scanline);
+
+	if (!test_damage(&surface, 0, 0) || !test_damage(&surface, 1, 0) ||
+	    !test_damage(&surface, 2, 0) || !test_damage(&surface, 0, 1) ||
+	    !test_damage(&surface, 1, 1) || !test_damage(&surface, 2, 1) ||
+	    !test_damage(&surface, 3, 1))
+		goto fail;
+
+	if (!shadow_classifier_update(classifier, &surface))
+		goto fail;
+
+	if (!test_expect(classifier, 0, 0, SHADOW_CONTENT_TEXT, "flat") ||
+	    !test_expect(classifier, 1, 0, SHADOW_CONTENT_IMAGE, "gradient") ||
+	    !test_expect(classifier, 2, 0, SHADOW_CONTENT_IMAGE, "first frame of the video") ||
+	    !test_expect(classifier, 3, 0, SHADOW_CONTENT_NONE, "untouched") ||
+	    !test_expect(classifier, 0, 1, SHADOW_CONTENT_TEXT, "noise") ||
+	    !test_expect(classifier, 4, 0, SHADOW_CONTENT_NONE, "out of range"))
+		goto fail;
+
+	if (!rectangle_is_empty(&classifier->videoRect))
+		goto fail;
+
+	/* A tile damaged in consecutive frames turns into video */
+	for (frame = 1; frame < 8; frame++)
+	{
+		region16_clear(&surface.invalidRegion);
+		test_fill(&surface, 2, 0, frame);
+
+		if (!test_damage(&surface, 2, 0) || !shadow_classifier_update(classifier, &surface))
+			goto fail;
+	}
+
+	if (!test_expect(classifier, 2, 0, SHADOW_CONTENT_VIDEO, "moving gradient") ||
+	    !test_expect(classifier, 1, 0, SHADOW_CONTENT_IMAGE, "still gradient"))
+		goto fail;
+
+	if ((classifier->videoTiles != 1) || !rectangles_equal(&classifier->videoRect, &videoTile))
+		goto fail;
+
+	/* Once it stops changing the video is an image again */
+	region16_clear(&surface.invalidRegion);
+
+	for (frame = 0; frame < 16; frame++)
+	{
+		if (!shadow_classifier_update(classifier, &surface))
+			goto fail;
+	}
+
+	if (!test_expect(classifier, 2, 0, SHADOW_CONTENT_IMAGE, "paused video"))
+		goto fail;
+
+	if ((classifier->videoTiles != 0) || !rectangle_is_empty(&classifier->videoRect))
+		goto fail;
+
+	rc = 0;
+fail:
+	if (rc != 0)
+		fprintf(stderr, "TestShadowClassify failed\n");
+
+	region16_uninit(&surface.invalidRegion);
+	free(surface.data);
+	shadow_classifier_free(classifier);
+	return rc;
+}
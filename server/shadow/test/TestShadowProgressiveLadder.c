@@ -0,0 +1,60 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/cmdline.h>
+
+#include <freerdp/server/shadow.h>
+
+static BOOL test_parse(const char* value, BOOL valid, const BYTE* expected, UINT32 count)
+{
+	int status;
+	BOOL rc = FALSE;
+	char option[128] = { 0 };
+	char* argv[] = { "TestShadowProgressiveLadder", option };
+	COMMAND_LINE_ARGUMENT_A args[] = {
+		{ "gfx-progressive-ladder", COMMAND_LINE_VALUE_REQUIRED, "<quality>[,<quality>...]", NULL,
+		  NULL, -1, NULL, "progressive quality ladder" },
+		{ NULL, 0, NULL, NULL, NULL, -1, NULL, NULL }
+	};
+	rdpShadowServer* server = shadow_server_new();
+
+	if (!server)
+		return FALSE;
+
+	sprintf_s(option, sizeof(option), "/gfx-progressive-ladder:%s", value);
+	status = shadow_server_parse_command_line(server, ARRAYSIZE(argv), argv, args);
+
+	if (!valid)
+		rc = (status < 0) && (server->progressiveLadderCount == 0);
+	else
+		rc = (status >= 0) && (server->progressiveLadderCount == count) &&
+		     (memcmp(server->progressiveLadder, expected, count) == 0);
+
+	if (!rc)
+		fprintf(stderr, "TestShadowProgressiveLadder: '%s' parsed wrong\n", value);
+
+	shadow_server_free(server);
+	return rc;
+}
+
+int TestShadowProgressiveLadder(int argc, char* argv[])
+{
+	const BYTE ladder[] = { 30, 60, 100 };
+	const BYTE single[] = { 100 };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_parse("30,60,100", TRUE, ladder, ARRAYSIZE(ladder)) ||
+	    !test_parse("100", TRUE, single, ARRAYSIZE(single)))
+		return -1;
+
+	/* not ascending, out of range, not a number and longer than the codec supports */
+	if (!test_parse("60,30", FALSE, NULL, 0) || !test_parse("60,60", FALSE, NULL, 0) ||
+	    !test_parse("0,50", FALSE, NULL, 0) || !test_parse("50,101", FALSE, NULL, 0) ||
+	    !test_parse("high", FALSE, NULL, 0) ||
+	    !test_parse("1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17", FALSE, NULL, 0))
+		return -1;
+
+	return 0;
+}
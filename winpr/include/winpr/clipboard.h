@@ -66,6 +66,31 @@ struct s_wClipboardDelegate
 	BOOL (*IsFileNameComponentValid)(LPCWSTR lpFileName);
 };
 
+/**
+ * A file contents pipeline keeps several range requests in flight, collects the responses
+ * in any order and answers reads from them, prefetching ahead of sequential readers.
+ */
+typedef struct s_wClipboardPipeline wClipboardPipeline;
+
+typedef UINT (*CLIPBOARD_PIPELINE_REQUEST_FN)(void* context, UINT32 streamId, UINT32 listIndex,
+                                              UINT64 offset, UINT32 length);
+typedef void (*CLIPBOARD_PIPELINE_COMPLETE_FN)(void* context, void* userdata, UINT error,
+                                               const BYTE* data, UINT32 size);
+
+#define CLIPBOARD_PIPELINE_DEFAULT_WINDOW 16
+#define CLIPBOARD_PIPELINE_DEFAULT_CHUNK_SIZE 65536
+
+typedef struct
+{
+	UINT32 window;        /* range requests in flight at most, 0 for the default */
+	UINT32 chunkSize;     /* bytes per range request, 0 for the default */
+	UINT32 prefetch;      /* chunks requested ahead of a sequential reader, 0 for the window */
+	UINT32 firstStreamId; /* stream ids of the pipeline count up from here */
+	void* context;
+	CLIPBOARD_PIPELINE_REQUEST_FN RequestRange;
+	CLIPBOARD_PIPELINE_COMPLETE_FN ReadComplete;
+} wClipboardPipelineConfig;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -100,6 +125,22 @@ extern "C"
 	WINPR_API wClipboard* ClipboardCreate(void);
 	WINPR_API void ClipboardDestroy(wClipboard* clipboard);
 
+	/**
+	 * The callbacks of a pipeline are called with its lock held. ReadComplete is called
+	 * exactly once per read, the data is only valid during the call.
+	 * ClipboardPipelineResponse returns FALSE for stream ids the pipeline did not issue.
+	 */
+	WINPR_API wClipboardPipeline* ClipboardPipelineNew(const wClipboardPipelineConfig* config);
+	WINPR_API void ClipboardPipelineFree(wClipboardPipeline* pipeline);
+
+	WINPR_API UINT ClipboardPipelineRead(wClipboardPipeline* pipeline, UINT32 listIndex,
+	                                     UINT64 offset, UINT32 length, void* userdata);
+	WINPR_API BOOL ClipboardPipelineResponse(wClipboardPipeline* pipeline, UINT32 streamId,
+	                                         UINT error, const BYTE* data, UINT32 size);
+	WINPR_API void ClipboardPipelineSetFileSize(wClipboardPipeline* pipeline, UINT32 listIndex,
+	                                            UINT64 size);
+	WINPR_API void ClipboardPipelineReset(wClipboardPipeline* pipeline, UINT error);
+
 #ifdef __cplusplus
 }
 #endif
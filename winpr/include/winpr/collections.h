@@ -381,6 +381,26 @@ extern "C"
 	WINPR_API wBufferPool* BufferPool_New(BOOL synchronized, SSIZE_T fixedSize, DWORD alignment);
 	WINPR_API void BufferPool_Free(wBufferPool* pool);
 
+	/* Arena */
+
+	/**
+	 * Bump allocator for memory that lives for one processing cycle (e.g. one
+	 * encoded frame). Allocations are not freed individually, Arena_Reset
+	 * releases all of them and keeps the memory for the next cycle.
+	 */
+	typedef struct s_wArena wArena;
+
+	WINPR_API void* Arena_Alloc(wArena* arena, size_t size);
+	WINPR_API void* Arena_Calloc(wArena* arena, size_t nmemb, size_t size);
+	WINPR_API BOOL Arena_Contains(wArena* arena, const void* ptr);
+	WINPR_API void Arena_Reset(wArena* arena);
+
+	WINPR_API size_t Arena_GetUsed(wArena* arena);
+	WINPR_API size_t Arena_GetCapacity(wArena* arena);
+
+	WINPR_API wArena* Arena_New(BOOL synchronized, size_t blockSize, DWORD alignment);
+	WINPR_API void Arena_Free(wArena* arena);
+
 	/* ObjectPool */
 
 	typedef struct s_wObjectPool wObjectPool;
@@ -275,6 +275,26 @@ extern "C"
 	}
 #endif
 
+	/* Parallel For (WinPR extension, available with native thread pools too) */
+
+	/**
+	 * Processes the items [first, first + count) of a winpr_ThreadpoolParallelFor call.
+	 * Return FALSE to mark the whole batch as failed, other ranges are still processed.
+	 */
+	typedef BOOL (*WINPR_PARALLEL_FOR_CALLBACK)(PVOID context, size_t first, size_t count);
+
+	/**
+	 * Splits the items [0, count) into chunks ranges and runs them on the pool of pcbe
+	 * (the default pool if NULL). The calling thread processes ranges as well and only waits
+	 * for the ranges of this call, so it can be nested in pool callbacks.
+	 *
+	 * @param chunks The number of ranges, 0 for one per processor
+	 * @return TRUE if all ranges were processed successfully
+	 */
+	WINPR_API BOOL winpr_ThreadpoolParallelFor(PTP_CALLBACK_ENVIRON pcbe, size_t count,
+	                                           size_t chunks, WINPR_PARALLEL_FOR_CALLBACK callback,
+	                                           PVOID context);
+
 #ifdef __cplusplus
 }
 #endif
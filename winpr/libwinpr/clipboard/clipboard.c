@@ -587,6 +587,8 @@ void ClipboardDestroy(wClipboard* clipboard)
 	if (!clipboard)
 		return;
 
+	ClipboardPipelineFree(clipboard->localFileReader);
+	clipboard->localFileReader = NULL;
 	ArrayList_Free(clipboard->localFiles);
 	clipboard->localFiles = NULL;
 
@@ -61,6 +61,8 @@ struct s_wClipboard
 
 	wArrayList* localFiles;
 	UINT32 fileListSequenceNumber;
+	wClipboardPipeline* localFileReader;
+	UINT32 localFileReaderSequenceNumber;
 
 	wClipboardDelegate delegate;
 
@@ -0,0 +1,645 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Clipboard Functions: pipelined file contents
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/config.h>
+
+#include <winpr/crt.h>
+#include <winpr/assert.h>
+#include <winpr/synch.h>
+#include <winpr/clipboard.h>
+#include <winpr/collections.h>
+
+#include "../log.h"
+#define TAG WINPR_TAG("clipboard.pipeline")
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#ifndef MAX
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#endif
+
+/*
+ * Files are split into chunks of chunkSize bytes at aligned offsets, every chunk is one
+ * range request. Reads wait until all chunks they cover arrived, no matter in which order
+ * the responses come in. A read that continues where the previous read of the file ended
+ * also queues the following chunks, so the peer is already sending them when they are read.
+ */
+
+typedef enum
+{
+	PIPELINE_CHUNK_QUEUED,
+	PIPELINE_CHUNK_IN_FLIGHT,
+	PIPELINE_CHUNK_DONE,
+	PIPELINE_CHUNK_ORPHANED /* in flight when the pipeline was reset */
+} wClipboardPipelineChunkState;
+
+typedef struct
+{
+	UINT32 listIndex;
+	UINT64 offset;
+	UINT32 length;
+	UINT32 streamId;
+	wClipboardPipelineChunkState state;
+	UINT error;
+	BYTE* data;
+	UINT32 size;
+} wClipboardPipelineChunk;
+
+typedef struct
+{
+	UINT32 listIndex;
+	UINT64 offset;
+	UINT32 length;
+	void* userdata;
+} wClipboardPipelineRead;
+
+typedef struct
+{
+	UINT32 listIndex;
+	UINT64 size;       /* UINT64_MAX until known */
+	UINT64 nextOffset; /* where a sequential read continues */
+} wClipboardPipelineFile;
+
+struct s_wClipboardPipeline
+{
+	CRITICAL_SECTION lock;
+	wClipboardPipelineConfig config;
+	UINT32 nextStreamId;
+	UINT32 inFlight;
+	wArrayList* chunks;
+	wArrayList* reads;
+	wArrayList* files;
+};
+
+static void pipeline_chunk_free(void* obj)
+{
+	wClipboardPipelineChunk* chunk = (wClipboardPipelineChunk*)obj;
+
+	if (!chunk)
+		return;
+
+	free(chunk->data);
+	free(chunk);
+}
+
+static wClipboardPipelineFile* pipeline_get_file(wClipboardPipeline* pipeline, UINT32 listIndex,
+                                                 BOOL create)
+{
+	size_t i;
+	wClipboardPipelineFile* file;
+
+	for (i = 0; i < ArrayList_Count(pipeline->files); i++)
+	{
+		file = (wClipboardPipelineFile*)ArrayList_GetItem(pipeline->files, i);
+
+		if (file->listIndex == listIndex)
+			return file;
+	}
+
+	if (!create)
+		return NULL;
+
+	file = (wClipboardPipelineFile*)calloc(1, sizeof(wClipboardPipelineFile));
+
+	if (!file)
+		return NULL;
+
+	file->listIndex = listIndex;
+	file->size = UINT64_MAX;
+
+	if (!ArrayList_Append(pipeline->files, file))
+	{
+		free(file);
+		return NULL;
+	}
+
+	return file;
+}
+
+static wClipboardPipelineChunk* pipeline_find_chunk(wClipboardPipeline* pipeline,
+                                                    UINT32 listIndex, UINT64 offset)
+{
+	size_t i;
+
+	for (i = 0; i < ArrayList_Count(pipeline->chunks); i++)
+	{
+		wClipboardPipelineChunk* chunk =
+		    (wClipboardPipelineChunk*)ArrayList_GetItem(pipeline->chunks, i);
+
+		if ((chunk->state != PIPELINE_CHUNK_ORPHANED) && (chunk->listIndex == listIndex) &&
+		    (chunk->offset == offset))
+			return chunk;
+	}
+
+	return NULL;
+}
+
+static BOOL pipeline_add_chunk(wClipboardPipeline* pipeline, const wClipboardPipelineFile* file,
+                               UINT64 offset)
+{
+	wClipboardPipelineChunk* chunk;
+
+	if ((offset >= file->size) || pipeline_find_chunk(pipeline, file->listIndex, offset))
+		return TRUE;
+
+	chunk = (wClipboardPipelineChunk*)calloc(1, sizeof(wClipboardPipelineChunk));
+
+	if (!chunk)
+		return FALSE;
+
+	chunk->listIndex = file->listIndex;
+	chunk->offset = offset;
+	chunk->length = (UINT32)MIN(pipeline->config.chunkSize, file->size - offset);
+	chunk->state = PIPELINE_CHUNK_QUEUED;
+
+	if (!ArrayList_Append(pipeline->chunks, chunk))
+	{
+		free(chunk);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static wClipboardPipelineChunk* pipeline_find_stream(wClipboardPipeline* pipeline,
+                                                     UINT32 streamId, size_t* index)
+{
+	size_t i;
+
+	for (i = 0; i < ArrayList_Count(pipeline->chunks); i++)
+	{
+		wClipboardPipelineChunk* chunk =
+		    (wClipboardPipelineChunk*)ArrayList_GetItem(pipeline->chunks, i);
+
+		if (((chunk->state == PIPELINE_CHUNK_IN_FLIGHT) ||
+		     (chunk->state == PIPELINE_CHUNK_ORPHANED)) &&
+		    (chunk->streamId == streamId))
+		{
+			if (index)
+				*index = i;
+
+			return chunk;
+		}
+	}
+
+	return NULL;
+}
+
+/* Sends queued chunks in the order they were queued while the window has room */
+static void pipeline_pump(wClipboardPipeline* pipeline)
+{
+	while (pipeline->inFlight < pipeline->config.window)
+	{
+		size_t i;
+		UINT error;
+		UINT32 streamId;
+		wClipboardPipelineChunk* chunk = NULL;
+
+		for (i = 0; i < ArrayList_Count(pipeline->chunks); i++)
+		{
+			chunk = (wClipboardPipelineChunk*)ArrayList_GetItem(pipeline->chunks, i);
+
+			if (chunk->state == PIPELINE_CHUNK_QUEUED)
+				break;
+
+			chunk = NULL;
+		}
+
+		if (!chunk)
+			break;
+
+		streamId = pipeline->nextStreamId++;
+		chunk->streamId = streamId;
+		chunk->state = PIPELINE_CHUNK_IN_FLIGHT;
+		pipeline->inFlight++;
+
+		/* the response may already have been processed when this returns */
+		error = pipeline->config.RequestRange(pipeline->config.context, streamId,
+		                                      chunk->listIndex, chunk->offset, chunk->length);
+
+		if (error && (chunk = pipeline_find_stream(pipeline, streamId, NULL)))
+		{
+			WLog_WARN(TAG, "range request failed with error 0x%08" PRIX32, error);
+			chunk->state = PIPELINE_CHUNK_DONE;
+			chunk->error = error;
+			pipeline->inFlight--;
+		}
+	}
+}
+
+static UINT64 pipeline_read_end(const wClipboardPipelineFile* file,
+                                const wClipboardPipelineRead* read)
+{
+	return MIN(read->offset + read->length, MAX(file->size, read->offset));
+}
+
+/* A read is ready when every chunk it covers is done or one of them failed */
+static BOOL pipeline_read_ready(wClipboardPipeline* pipeline, const wClipboardPipelineRead* read,
+                                UINT* error)
+{
+	UINT64 pos;
+	const UINT32 chunkSize = pipeline->config.chunkSize;
+	const wClipboardPipelineFile* file = pipeline_get_file(pipeline, read->listIndex, FALSE);
+	const UINT64 end = pipeline_read_end(file, read);
+
+	*error = 0;
+
+	if (read->offset >= end)
+		return TRUE;
+
+	for (pos = read->offset - read->offset % chunkSize; pos < end; pos += chunkSize)
+	{
+		const wClipboardPipelineChunk* chunk = pipeline_find_chunk(pipeline, read->listIndex, pos);
+
+		if (!chunk || (chunk->state != PIPELINE_CHUNK_DONE))
+			return FALSE;
+
+		if (chunk->error)
+			*error = chunk->error;
+	}
+
+	return TRUE;
+}
+
+static BYTE* pipeline_assemble(wClipboardPipeline* pipeline, const wClipboardPipelineRead* read,
+                               UINT32* size)
+{
+	size_t i;
+	BYTE* data;
+	const wClipboardPipelineFile* file = pipeline_get_file(pipeline, read->listIndex, FALSE);
+	const UINT64 end = pipeline_read_end(file, read);
+
+	*size = (UINT32)(end - read->offset);
+
+	if (*size == 0)
+		return NULL;
+
+	data = (BYTE*)malloc(*size);
+
+	if (!data)
+		return NULL;
+
+	for (i = 0; i < ArrayList_Count(pipeline->chunks); i++)
+	{
+		UINT64 from;
+		UINT64 to;
+		const wClipboardPipelineChunk* chunk =
+		    (const wClipboardPipelineChunk*)ArrayList_GetItem(pipeline->chunks, i);
+
+		if ((chunk->state != PIPELINE_CHUNK_DONE) || (chunk->listIndex != read->listIndex))
+			continue;
+
+		from = MAX(chunk->offset, read->offset);
+		to = MIN(chunk->offset + chunk->size, end);
+
+		if (from < to)
+			CopyMemory(&data[from - read->offset], &chunk->data[from - chunk->offset], to - from);
+	}
+
+	return data;
+}
+
+/* Completes ready reads in the order they were issued */
+static void pipeline_complete(wClipboardPipeline* pipeline)
+{
+	size_t i = 0;
+
+	while (i < ArrayList_Count(pipeline->reads))
+	{
+		UINT error;
+		UINT32 size = 0;
+		BYTE* data = NULL;
+		wClipboardPipelineRead read =
+		    *(wClipboardPipelineRead*)ArrayList_GetItem(pipeline->reads, i);
+
+		if (!pipeline_read_ready(pipeline, &read, &error))
+		{
+			i++;
+			continue;
+		}
+
+		if (!error)
+		{
+			data = pipeline_assemble(pipeline, &read, &size);
+
+			if (!data && (size > 0))
+				error = ERROR_NOT_ENOUGH_MEMORY;
+		}
+
+		ArrayList_RemoveAt(pipeline->reads, i);
+		pipeline->config.ReadComplete(pipeline->config.context, read.userdata, error, data,
+		                              error ? 0 : size);
+		free(data);
+		i = 0;
+	}
+}
+
+static BOOL pipeline_chunk_needed(wClipboardPipeline* pipeline,
+                                  const wClipboardPipelineChunk* chunk)
+{
+	size_t i;
+	const wClipboardPipelineFile* file = pipeline_get_file(pipeline, chunk->listIndex, FALSE);
+
+	/* still ahead of the reader */
+	if (!chunk->error && (chunk->offset + chunk->length > file->nextOffset))
+		return TRUE;
+
+	for (i = 0; i < ArrayList_Count(pipeline->reads); i++)
+	{
+		const wClipboardPipelineRead* read =
+		    (const wClipboardPipelineRead*)ArrayList_GetItem(pipeline->reads, i);
+
+		if ((read->listIndex == chunk->listIndex) &&
+		    (read->offset < chunk->offset + chunk->length) &&
+		    (chunk->offset < read->offset + read->length))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Drops chunks that were read or are past the end of their file */
+static void pipeline_evict(wClipboardPipeline* pipeline)
+{
+	size_t i = ArrayList_Count(pipeline->chunks);
+
+	while (i-- > 0)
+	{
+		const wClipboardPipelineChunk* chunk =
+		    (const wClipboardPipelineChunk*)ArrayList_GetItem(pipeline->chunks, i);
+		const wClipboardPipelineFile* file = pipeline_get_file(pipeline, chunk->listIndex, FALSE);
+
+		if ((chunk->state == PIPELINE_CHUNK_QUEUED) || (chunk->state == PIPELINE_CHUNK_DONE))
+		{
+			if (chunk->offset >= file->size)
+				ArrayList_RemoveAt(pipeline->chunks, i);
+			else if ((chunk->state == PIPELINE_CHUNK_DONE) &&
+			         !pipeline_chunk_needed(pipeline, chunk))
+				ArrayList_RemoveAt(pipeline->chunks, i);
+		}
+	}
+}
+
+static void pipeline_run(wClipboardPipeline* pipeline)
+{
+	pipeline_pump(pipeline);
+	pipeline_complete(pipeline);
+	pipeline_evict(pipeline);
+}
+
+wClipboardPipeline* ClipboardPipelineNew(const wClipboardPipelineConfig* config)
+{
+	wClipboardPipeline* pipeline;
+
+	if (!config || !config->RequestRange || !config->ReadComplete)
+		return NULL;
+
+	pipeline = (wClipboardPipeline*)calloc(1, sizeof(wClipboardPipeline));
+
+	if (!pipeline)
+		return NULL;
+
+	pipeline->config = *config;
+
+	if (pipeline->config.window == 0)
+		pipeline->config.window = CLIPBOARD_PIPELINE_DEFAULT_WINDOW;
+
+	if (pipeline->config.chunkSize == 0)
+		pipeline->config.chunkSize = CLIPBOARD_PIPELINE_DEFAULT_CHUNK_SIZE;
+
+	if (pipeline->config.prefetch == 0)
+		pipeline->config.prefetch = pipeline->config.window;
+
+	pipeline->nextStreamId = config->firstStreamId;
+
+	if (!InitializeCriticalSectionAndSpinCount(&pipeline->lock, 4000))
+	{
+		free(pipeline);
+		return NULL;
+	}
+
+	pipeline->chunks = ArrayList_New(FALSE);
+	pipeline->reads = ArrayList_New(FALSE);
+	pipeline->files = ArrayList_New(FALSE);
+
+	if (!pipeline->chunks || !pipeline->reads || !pipeline->files)
+		goto fail;
+
+	ArrayList_Object(pipeline->chunks)->fnObjectFree = pipeline_chunk_free;
+	ArrayList_Object(pipeline->reads)->fnObjectFree = free;
+	ArrayList_Object(pipeline->files)->fnObjectFree = free;
+	return pipeline;
+fail:
+	ClipboardPipelineFree(pipeline);
+	return NULL;
+}
+
+void ClipboardPipelineFree(wClipboardPipeline* pipeline)
+{
+	if (!pipeline)
+		return;
+
+	ArrayList_Free(pipeline->chunks);
+	ArrayList_Free(pipeline->reads);
+	ArrayList_Free(pipeline->files);
+	DeleteCriticalSection(&pipeline->lock);
+	free(pipeline);
+}
+
+UINT ClipboardPipelineRead(wClipboardPipeline* pipeline, UINT32 listIndex, UINT64 offset,
+                           UINT32 length, void* userdata)
+{
+	UINT64 pos;
+	UINT64 end;
+	BOOL sequential;
+	wClipboardPipelineRead* read;
+	wClipboardPipelineFile* file;
+	UINT error = ERROR_NOT_ENOUGH_MEMORY;
+	const UINT32 chunkSize = pipeline ? pipeline->config.chunkSize : 0;
+
+	if (!pipeline || (offset > UINT64_MAX - length))
+		return ERROR_INVALID_PARAMETER;
+
+	EnterCriticalSection(&pipeline->lock);
+	file = pipeline_get_file(pipeline, listIndex, TRUE);
+	read = (wClipboardPipelineRead*)calloc(1, sizeof(wClipboardPipelineRead));
+
+	if (!file || !read)
+		goto out;
+
+	read->listIndex = listIndex;
+	read->offset = offset;
+	read->length = length;
+	read->userdata = userdata;
+
+	if (!ArrayList_Append(pipeline->reads, read))
+		goto out;
+
+	read = NULL;
+	sequential = (offset == file->nextOffset);
+	file->nextOffset = offset + length;
+	end = offset + length;
+
+	if (sequential)
+		end += (UINT64)pipeline->config.prefetch * chunkSize;
+
+	if (offset < file->size)
+	{
+		for (pos = offset - offset % chunkSize; (pos < end) && (pos < file->size);
+		     pos += chunkSize)
+		{
+			if (!pipeline_add_chunk(pipeline, file, pos))
+				break;
+		}
+
+		/* running short of memory while prefetching is fine, but not for the read itself */
+		if (pos < MIN(offset + length, file->size))
+		{
+			ArrayList_RemoveAt(pipeline->reads, ArrayList_Count(pipeline->reads) - 1);
+			goto out;
+		}
+	}
+
+	pipeline_run(pipeline);
+	error = NO_ERROR;
+out:
+	LeaveCriticalSection(&pipeline->lock);
+	free(read);
+	return error;
+}
+
+BOOL ClipboardPipelineResponse(wClipboardPipeline* pipeline, UINT32 streamId, UINT error,
+                               const BYTE* data, UINT32 size)
+{
+	size_t index = 0;
+	wClipboardPipelineFile* file;
+	wClipboardPipelineChunk* chunk;
+
+	if (!pipeline)
+		return FALSE;
+
+	EnterCriticalSection(&pipeline->lock);
+	chunk = pipeline_find_stream(pipeline, streamId, &index);
+
+	if (!chunk)
+	{
+		LeaveCriticalSection(&pipeline->lock);
+		return FALSE;
+	}
+
+	pipeline->inFlight--;
+
+	if (chunk->state == PIPELINE_CHUNK_ORPHANED)
+	{
+		ArrayList_RemoveAt(pipeline->chunks, index);
+		pipeline_pump(pipeline);
+		LeaveCriticalSection(&pipeline->lock);
+		return TRUE;
+	}
+
+	file = pipeline_get_file(pipeline, chunk->listIndex, FALSE);
+	chunk->state = PIPELINE_CHUNK_DONE;
+
+	/* prefetched past the end while the size was not known yet */
+	if (error && (chunk->offset >= file->size))
+		error = 0;
+
+	if (error)
+		chunk->error = error;
+	else
+	{
+		size = MIN(size, chunk->length);
+
+		if (size > 0)
+		{
+			chunk->data = (BYTE*)malloc(size);
+
+			if (!chunk->data)
+				chunk->error = ERROR_NOT_ENOUGH_MEMORY;
+			else
+				CopyMemory(chunk->data, data, size);
+		}
+
+		chunk->size = chunk->data ? size : 0;
+
+		/* a short range means the file ends there */
+		if (!chunk->error && (size < chunk->length))
+			file->size = MIN(file->size, chunk->offset + size);
+	}
+
+	pipeline_run(pipeline);
+	LeaveCriticalSection(&pipeline->lock);
+	return TRUE;
+}
+
+void ClipboardPipelineSetFileSize(wClipboardPipeline* pipeline, UINT32 listIndex, UINT64 size)
+{
+	wClipboardPipelineFile* file;
+
+	if (!pipeline)
+		return;
+
+	EnterCriticalSection(&pipeline->lock);
+	file = pipeline_get_file(pipeline, listIndex, TRUE);
+
+	if (file)
+	{
+		file->size = size;
+		pipeline_run(pipeline);
+	}
+
+	LeaveCriticalSection(&pipeline->lock);
+}
+
+void ClipboardPipelineReset(wClipboardPipeline* pipeline, UINT error)
+{
+	size_t i;
+
+	if (!pipeline)
+		return;
+
+	WINPR_ASSERT(error != 0);
+	EnterCriticalSection(&pipeline->lock);
+
+	while (ArrayList_Count(pipeline->reads) > 0)
+	{
+		const wClipboardPipelineRead read =
+		    *(wClipboardPipelineRead*)ArrayList_GetItem(pipeline->reads, 0);
+
+		ArrayList_RemoveAt(pipeline->reads, 0);
+		pipeline->config.ReadComplete(pipeline->config.context, read.userdata, error, NULL, 0);
+	}
+
+	i = ArrayList_Count(pipeline->chunks);
+
+	while (i-- > 0)
+	{
+		wClipboardPipelineChunk* chunk =
+		    (wClipboardPipelineChunk*)ArrayList_GetItem(pipeline->chunks, i);
+
+		/* keep the stream id so the late response is still recognized */
+		if (chunk->state == PIPELINE_CHUNK_IN_FLIGHT)
+			chunk->state = PIPELINE_CHUNK_ORPHANED;
+		else if (chunk->state != PIPELINE_CHUNK_ORPHANED)
+			ArrayList_RemoveAt(pipeline->chunks, i);
+	}
+
+	ArrayList_Clear(pipeline->files);
+	LeaveCriticalSection(&pipeline->lock);
+}
@@ -63,6 +63,14 @@ const char* mime_nautilus_clipboard = "x-special/nautilus-clipboard";
 const char* mime_gnome_copied_files = "x-special/gnome-copied-files";
 const char* mime_mate_copied_files = "x-special/mate-copied-files";
 
+/*
+ * Local files are read in large chunks, one ahead of the peer, and the
+ * usually much smaller ranges the peer asks for are served from them.
+ */
+#define POSIX_FILE_READ_CHUNK_SIZE (1024 * 1024)
+#define POSIX_FILE_READ_WINDOW 2
+#define POSIX_FILE_READ_PREFETCH 1
+
 struct posix_file
 {
 	char* local_name;
@@ -1360,38 +1368,90 @@ out:
 	return error;
 }
 
+static UINT posix_file_read_chunk(void* context, UINT32 streamId, UINT32 listIndex, UINT64 offset,
+                                  UINT32 length)
+{
+	UINT error;
+	BYTE* data = NULL;
+	UINT32 size = 0;
+	wClipboard* clipboard = (wClipboard*)context;
+	struct posix_file* file = ArrayList_GetItem(clipboard->localFiles, listIndex);
+
+	if (!file)
+		error = ERROR_INDEX_ABSENT;
+	else
+		error = posix_file_get_range(file, offset, length, &data, &size);
+
+	ClipboardPipelineResponse(clipboard->localFileReader, streamId, error, data, size);
+	free(data);
+	return NO_ERROR;
+}
+
+static void posix_file_range_complete(void* context, void* userdata, UINT error, const BYTE* data,
+                                      UINT32 size)
+{
+	wClipboard* clipboard = (wClipboard*)context;
+	wClipboardDelegate* delegate = &clipboard->delegate;
+	wClipboardFileRangeRequest* request = (wClipboardFileRangeRequest*)userdata;
+
+	if (error)
+		error = delegate->ClipboardFileRangeFailure(delegate, request, error);
+	else
+		error = delegate->ClipboardFileRangeSuccess(delegate, request, data, size);
+
+	if (error)
+		WLog_WARN(TAG, "failed to report file range result: 0x%08X", error);
+
+	free(request);
+}
+
 static UINT posix_file_request_range(wClipboardDelegate* delegate,
                                      const wClipboardFileRangeRequest* request)
 {
 	UINT error = 0;
-	BYTE* data = NULL;
-	UINT32 size = 0;
 	UINT64 offset = 0;
-	struct posix_file* file = NULL;
+	wClipboard* clipboard = NULL;
+	wClipboardFileRangeRequest* pending = NULL;
 
 	if (!delegate || !delegate->clipboard || !request)
 		return ERROR_BAD_ARGUMENTS;
 
-	if (delegate->clipboard->sequenceNumber != delegate->clipboard->fileListSequenceNumber)
-		return ERROR_INVALID_STATE;
+	clipboard = delegate->clipboard;
 
-	file = ArrayList_GetItem(delegate->clipboard->localFiles, request->listIndex);
+	if (clipboard->sequenceNumber != clipboard->fileListSequenceNumber)
+		return ERROR_INVALID_STATE;
 
-	if (!file)
+	if (!ArrayList_GetItem(clipboard->localFiles, request->listIndex))
 		return ERROR_INDEX_ABSENT;
 
+	/* chunks of an older file list must not answer requests for the current one */
+	if (clipboard->localFileReaderSequenceNumber != clipboard->fileListSequenceNumber)
+	{
+		ClipboardPipelineReset(clipboard->localFileReader, ERROR_INVALID_STATE);
+		clipboard->localFileReaderSequenceNumber = clipboard->fileListSequenceNumber;
+	}
+
 	offset = (((UINT64)request->nPositionHigh) << 32) | ((UINT64)request->nPositionLow);
-	error = posix_file_get_range(file, offset, request->cbRequested, &data, &size);
+	pending = malloc(sizeof(wClipboardFileRangeRequest));
 
-	if (error)
-		error = delegate->ClipboardFileRangeFailure(delegate, request, error);
+	if (!pending)
+		error = ERROR_NOT_ENOUGH_MEMORY;
 	else
-		error = delegate->ClipboardFileRangeSuccess(delegate, request, data, size);
+	{
+		*pending = *request;
+		error = ClipboardPipelineRead(clipboard->localFileReader, request->listIndex, offset,
+		                              request->cbRequested, pending);
+	}
 
 	if (error)
-		WLog_WARN(TAG, "failed to report file range result: 0x%08X", error);
+	{
+		free(pending);
+		error = delegate->ClipboardFileRangeFailure(delegate, request, error);
+
+		if (error)
+			WLog_WARN(TAG, "failed to report file range result: 0x%08X", error);
+	}
 
-	free(data);
 	return NO_ERROR;
 }
 
@@ -1433,12 +1493,25 @@ static void setup_delegate(wClipboardDelegate* delegate)
 
 BOOL ClipboardInitPosixFileSubsystem(wClipboard* clipboard)
 {
+	wClipboardPipelineConfig config = { 0 };
+
 	if (!clipboard)
 		return FALSE;
 
 	if (!register_file_formats_and_synthesizers(clipboard))
 		return FALSE;
 
+	config.window = POSIX_FILE_READ_WINDOW;
+	config.chunkSize = POSIX_FILE_READ_CHUNK_SIZE;
+	config.prefetch = POSIX_FILE_READ_PREFETCH;
+	config.context = clipboard;
+	config.RequestRange = posix_file_read_chunk;
+	config.ReadComplete = posix_file_range_complete;
+	clipboard->localFileReader = ClipboardPipelineNew(&config);
+
+	if (!clipboard->localFileReader)
+		return FALSE;
+
 	setup_delegate(&clipboard->delegate);
 	return TRUE;
 }
@@ -0,0 +1,190 @@
+#include <winpr/crt.h>
+#include <winpr/error.h>
+#include <winpr/clipboard.h>
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#ifndef MAX
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#endif
+
+#define TEST_FILE_SIZE 10000
+#define TEST_CHUNK_SIZE 1024
+#define TEST_WINDOW 4
+
+typedef struct
+{
+	UINT32 streamId;
+	UINT32 listIndex;
+	UINT64 offset;
+	UINT32 length;
+} TestRequest;
+
+typedef struct
+{
+	TestRequest requests[64];
+	size_t count;
+	size_t maxCount;
+	BYTE file[TEST_FILE_SIZE];
+	BYTE buffer[TEST_FILE_SIZE];
+	size_t completed;
+	UINT error;
+	UINT32 size;
+} TestPeer;
+
+static UINT test_request_range(void* context, UINT32 streamId, UINT32 listIndex, UINT64 offset,
+                               UINT32 length)
+{
+	TestPeer* peer = (TestPeer*)context;
+	TestRequest* request = &peer->requests[peer->count++];
+
+	request->streamId = streamId;
+	request->listIndex = listIndex;
+	request->offset = offset;
+	request->length = length;
+	peer->maxCount = MAX(peer->maxCount, peer->count);
+	return NO_ERROR;
+}
+
+static void test_read_complete(void* context, void* userdata, UINT error, const BYTE* data,
+                               UINT32 size)
+{
+	TestPeer* peer = (TestPeer*)context;
+	const size_t offset = (size_t)userdata;
+
+	peer->completed++;
+	peer->error = error;
+	peer->size = size;
+
+	if (!error && (size > 0))
+		CopyMemory(&peer->buffer[offset], data, size);
+}
+
+/* answers the pending requests newest first */
+static BOOL test_answer_reversed(wClipboardPipeline* pipeline, TestPeer* peer)
+{
+	while (peer->count > 0)
+	{
+		UINT32 size = 0;
+		const TestRequest request = peer->requests[--peer->count];
+
+		if (request.offset < TEST_FILE_SIZE)
+			size = (UINT32)MIN(request.length, TEST_FILE_SIZE - request.offset);
+
+		if (!ClipboardPipelineResponse(pipeline, request.streamId, 0,
+		                               &peer->file[MIN(request.offset, TEST_FILE_SIZE)], size))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+int TestClipboardPipeline(int argc, char* argv[])
+{
+	size_t i;
+	UINT64 offset;
+	int rc = -1;
+	TestPeer* peer;
+	wClipboardPipeline* pipeline = NULL;
+	wClipboardPipelineConfig config = { 0 };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	peer = (TestPeer*)calloc(1, sizeof(TestPeer));
+
+	if (!peer)
+		return -1;
+
+	for (i = 0; i < TEST_FILE_SIZE; i++)
+		peer->file[i] = (BYTE)(i * 7);
+
+	config.window = TEST_WINDOW;
+	config.chunkSize = TEST_CHUNK_SIZE;
+	config.firstStreamId = 0x100;
+	config.context = peer;
+	config.RequestRange = test_request_range;
+	config.ReadComplete = test_read_complete;
+	pipeline = ClipboardPipelineNew(&config);
+
+	if (!pipeline)
+		goto fail;
+
+	/* the first read fills the window */
+	if (ClipboardPipelineRead(pipeline, 3, 0, 1500, (void*)(size_t)0) != 0)
+		goto fail;
+
+	if ((peer->count != TEST_WINDOW) || (peer->requests[0].streamId != 0x100) ||
+	    (peer->requests[1].offset != TEST_CHUNK_SIZE) || (peer->completed != 0))
+		goto fail;
+
+	if (ClipboardPipelineResponse(pipeline, 0x42, 0, peer->file, 1))
+		goto fail;
+
+	if (!test_answer_reversed(pipeline, peer) || (peer->completed != 1) || (peer->error != 0) ||
+	    (peer->size != 1500))
+		goto fail;
+
+	/* sequential reads until past the end, the size is not known to the pipeline */
+	offset = 1500;
+
+	while (offset < TEST_FILE_SIZE)
+	{
+		const size_t completed = peer->completed;
+
+		if (ClipboardPipelineRead(pipeline, 3, offset, 1500, (void*)(size_t)offset) != 0)
+			goto fail;
+
+		while (peer->completed == completed)
+		{
+			if ((peer->count == 0) || !test_answer_reversed(pipeline, peer))
+				goto fail;
+		}
+
+		if (peer->error != 0)
+			goto fail;
+
+		offset += peer->size;
+
+		if (peer->size < 1500)
+			break;
+	}
+
+	if ((offset != TEST_FILE_SIZE) || (memcmp(peer->buffer, peer->file, TEST_FILE_SIZE) != 0))
+		goto fail;
+
+	if (peer->maxCount > TEST_WINDOW)
+		goto fail;
+
+	/* reads past the end complete at once and empty */
+	if ((ClipboardPipelineRead(pipeline, 3, TEST_FILE_SIZE, 100, NULL) != 0) ||
+	    (peer->size != 0) || (peer->error != 0))
+		goto fail;
+
+	/* a reset fails pending reads and swallows late responses */
+	ClipboardPipelineSetFileSize(pipeline, 4, TEST_FILE_SIZE);
+	peer->count = 0;
+
+	if (ClipboardPipelineRead(pipeline, 4, 0, 100, NULL) != 0)
+		goto fail;
+
+	i = peer->completed;
+	ClipboardPipelineReset(pipeline, ERROR_INVALID_STATE);
+
+	if ((peer->completed != i + 1) || (peer->error != ERROR_INVALID_STATE))
+		goto fail;
+
+	if (!test_answer_reversed(pipeline, peer) || (peer->completed != i + 1))
+		goto fail;
+
+	rc = 0;
+fail:
+	if (rc != 0)
+		fprintf(stderr, "TestClipboardPipeline failed\n");
+
+	ClipboardPipelineFree(pipeline);
+	free(peer);
+	return rc;
+}
@@ -0,0 +1,153 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Thread Pool API (Parallel For)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/config.h>
+
+#include <winpr/crt.h>
+#include <winpr/pool.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#include "../log.h"
+#define TAG WINPR_TAG("pool")
+
+/*
+ * The batch is shared by the caller and the submitted work items. The caller only waits for
+ * ranges that are being processed, not for work items still queued behind other work of the
+ * pool. Those find no range left when they run, so the last one to finish frees the batch.
+ */
+typedef struct
+{
+	WINPR_PARALLEL_FOR_CALLBACK callback;
+	PVOID context;
+	size_t count;
+	size_t chunks;
+	LONG volatile next;
+	LONG volatile done;
+	LONG volatile failed;
+	LONG volatile refs;
+	PTP_WORK work;
+	HANDLE finished;
+} WINPR_PARALLEL_FOR;
+
+static void parallel_for_release(WINPR_PARALLEL_FOR* batch)
+{
+	if (InterlockedDecrement(&batch->refs) != 0)
+		return;
+
+	if (batch->work)
+		CloseThreadpoolWork(batch->work);
+
+	if (batch->finished)
+		CloseHandle(batch->finished);
+
+	free(batch);
+}
+
+/* Ranges are handed out dynamically, whoever is free first takes the next one */
+static void parallel_for_run(WINPR_PARALLEL_FOR* batch)
+{
+	for (;;)
+	{
+		const size_t chunk = (size_t)InterlockedIncrement(&batch->next) - 1;
+		size_t first, last;
+
+		if (chunk >= batch->chunks)
+			break;
+
+		first = chunk * batch->count / batch->chunks;
+		last = (chunk + 1) * batch->count / batch->chunks;
+
+		if (!batch->callback(batch->context, first, last - first))
+			InterlockedExchange(&batch->failed, 1);
+
+		if ((size_t)InterlockedIncrement(&batch->done) == batch->chunks)
+			SetEvent(batch->finished);
+	}
+}
+
+static void CALLBACK parallel_for_work_callback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                                PTP_WORK work)
+{
+	WINPR_PARALLEL_FOR* batch = (WINPR_PARALLEL_FOR*)context;
+
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	parallel_for_run(batch);
+	parallel_for_release(batch);
+}
+
+BOOL winpr_ThreadpoolParallelFor(PTP_CALLBACK_ENVIRON pcbe, size_t count, size_t chunks,
+                                 WINPR_PARALLEL_FOR_CALLBACK callback, PVOID context)
+{
+	BOOL rc;
+	size_t index;
+	WINPR_PARALLEL_FOR* batch;
+
+	if (!callback)
+		return FALSE;
+
+	if (count == 0)
+		return TRUE;
+
+	if (chunks == 0)
+	{
+		SYSTEM_INFO sysinfo = { 0 };
+		GetSystemInfo(&sysinfo);
+		chunks = sysinfo.dwNumberOfProcessors;
+	}
+
+	if (chunks > count)
+		chunks = count;
+
+	if (chunks <= 1)
+		return callback(context, 0, count);
+
+	if (!(batch = (WINPR_PARALLEL_FOR*)calloc(1, sizeof(WINPR_PARALLEL_FOR))))
+		return callback(context, 0, count);
+
+	batch->callback = callback;
+	batch->context = context;
+	batch->count = count;
+	batch->chunks = chunks;
+	batch->refs = 1;
+	batch->finished = CreateEventA(NULL, TRUE, FALSE, NULL);
+	batch->work = CreateThreadpoolWork(parallel_for_work_callback, batch, pcbe);
+
+	if (!batch->finished || !batch->work)
+	{
+		WLog_ERR(TAG, "CreateThreadpoolWork failed");
+		parallel_for_release(batch);
+		return callback(context, 0, count);
+	}
+
+	/* The calling thread takes one of the ranges itself */
+	for (index = 1; index < chunks; index++)
+	{
+		InterlockedIncrement(&batch->refs);
+		SubmitThreadpoolWork(batch->work);
+	}
+
+	parallel_for_run(batch);
+
+	if (WaitForSingleObject(batch->finished, INFINITE) != WAIT_OBJECT_0)
+		InterlockedExchange(&batch->failed, 1);
+
+	rc = (batch->failed == 0);
+	parallel_for_release(batch);
+	return rc;
+}
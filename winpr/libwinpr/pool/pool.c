@@ -17,11 +17,22 @@
  * limitations under the License.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <winpr/config.h>
 
 #include <winpr/crt.h>
 #include <winpr/pool.h>
 #include <winpr/library.h>
+#include <winpr/sysinfo.h>
+#include <winpr/environment.h>
+#include <winpr/interlocked.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 #include "pool.h"
 
@@ -48,47 +59,197 @@ static BOOL CALLBACK init_module(PINIT_ONCE once, PVOID param, PVOID* context)
 }
 #endif
 
+/* Keep at least this many workers, callbacks (e.g. smartcard calls) may block */
+#define WORKER_MIN_COUNT 4
+#define WORKER_QUEUE_SIZE 64
+
+static INIT_ONCE init_once_worker = INIT_ONCE_STATIC_INIT;
+static DWORD worker_tls_index = TLS_OUT_OF_INDEXES;
+
 static TP_POOL DEFAULT_POOL = {
 	0,    /* DWORD Minimum */
 	500,  /* DWORD Maximum */
 	NULL, /* wArrayList* Threads */
-	NULL, /* wQueue* PendingQueue */
-	NULL, /* HANDLE TerminateEvent */
+	NULL, /* TP_WORKER** Workers */
+	0,    /* DWORD WorkerCapacity */
+	0,    /* LONG WorkerCount */
+	0,    /* LONG NextWorker */
+	0,    /* LONG IdleWorkers */
+	0,    /* LONG Terminate */
+	NULL, /* HANDLE WorkAvailable */
+	0,    /* BOOL Affinity */
 	NULL, /* wCountdownEvent* WorkComplete */
 };
 
-static DWORD WINAPI thread_pool_work_func(LPVOID arg)
+static BOOL CALLBACK init_worker_tls(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+	worker_tls_index = TlsAlloc();
+	return worker_tls_index != TLS_OUT_OF_INDEXES;
+}
+
+static TP_WORKER* worker_current(PTP_POOL pool)
+{
+	TP_WORKER* worker;
+
+	if (worker_tls_index == TLS_OUT_OF_INDEXES)
+		return NULL;
+
+	worker = (TP_WORKER*)TlsGetValue(worker_tls_index);
+
+	if (!worker || (worker->Pool != pool))
+		return NULL;
+
+	return worker;
+}
+
+static BOOL worker_push(TP_WORKER* worker, PTP_WORK work)
+{
+	BOOL rc = FALSE;
+	EnterCriticalSection(&worker->Lock);
+
+	if (worker->Count == worker->Capacity)
+	{
+		size_t x;
+		const size_t capacity = worker->Capacity * 2;
+		PTP_WORK* items = (PTP_WORK*)calloc(capacity, sizeof(PTP_WORK));
+
+		if (!items)
+			goto out;
+
+		for (x = 0; x < worker->Count; x++)
+			items[x] = worker->Items[(worker->Head + x) % worker->Capacity];
+
+		free(worker->Items);
+		worker->Items = items;
+		worker->Capacity = capacity;
+		worker->Head = 0;
+	}
+
+	worker->Items[(worker->Head + worker->Count) % worker->Capacity] = work;
+	worker->Count++;
+	rc = TRUE;
+out:
+	LeaveCriticalSection(&worker->Lock);
+	return rc;
+}
+
+/* The owner takes the most recently submitted work */
+static PTP_WORK worker_pop(TP_WORKER* worker)
+{
+	PTP_WORK work = NULL;
+
+	if (worker->Count == 0)
+		return NULL;
+
+	EnterCriticalSection(&worker->Lock);
+
+	if (worker->Count > 0)
+	{
+		worker->Count--;
+		work = worker->Items[(worker->Head + worker->Count) % worker->Capacity];
+	}
+
+	LeaveCriticalSection(&worker->Lock);
+	return work;
+}
+
+/* Thieves take the oldest work */
+static PTP_WORK worker_steal(TP_WORKER* worker)
 {
-	DWORD status;
-	PTP_POOL pool;
-	PTP_WORK work;
-	HANDLE events[2];
-	PTP_CALLBACK_INSTANCE callbackInstance;
+	PTP_WORK work = NULL;
 
-	pool = (PTP_POOL)arg;
+	if (worker->Count == 0)
+		return NULL;
 
-	events[0] = pool->TerminateEvent;
-	events[1] = Queue_Event(pool->PendingQueue);
+	EnterCriticalSection(&worker->Lock);
 
-	while (1)
+	if (worker->Count > 0)
 	{
-		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+		work = worker->Items[worker->Head];
+		worker->Head = (worker->Head + 1) % worker->Capacity;
+		worker->Count--;
+	}
+
+	LeaveCriticalSection(&worker->Lock);
+	return work;
+}
+
+static PTP_WORK worker_find_work(TP_WORKER* worker)
+{
+	LONG x;
+	PTP_POOL pool = worker->Pool;
+	const LONG count = InterlockedCompareExchange(&pool->WorkerCount, 0, 0);
+	PTP_WORK work = worker_pop(worker);
+
+	for (x = 1; !work && (x < count); x++)
+		work = worker_steal(pool->Workers[(worker->Index + x) % count]);
 
-		if (status == WAIT_OBJECT_0)
-			break;
+	return work;
+}
+
+static void worker_run(PTP_POOL pool, PTP_WORK work)
+{
+	TP_CALLBACK_INSTANCE instance = { 0 };
+
+	instance.Work = work;
+	work->WorkCallback(&instance, work->CallbackParameter, work);
+	CountdownEvent_Signal(pool->WorkComplete, 1);
+}
 
-		if (status != (WAIT_OBJECT_0 + 1))
-			break;
+static void worker_set_affinity(TP_WORKER* worker)
+{
+	SYSTEM_INFO sysinfo = { 0 };
+
+	GetSystemInfo(&sysinfo);
 
-		callbackInstance = (PTP_CALLBACK_INSTANCE)Queue_Dequeue(pool->PendingQueue);
+	if (sysinfo.dwNumberOfProcessors < 2)
+		return;
 
-		if (callbackInstance)
+#if defined(__linux__)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(worker->Index % sysinfo.dwNumberOfProcessors, &set);
+		sched_setaffinity(0, sizeof(set), &set);
+	}
+#elif defined(_WIN32)
+	SetThreadAffinityMask(GetCurrentThread(),
+	                      (DWORD_PTR)1 << (worker->Index % sysinfo.dwNumberOfProcessors));
+#endif
+}
+
+static DWORD WINAPI thread_pool_work_func(LPVOID arg)
+{
+	TP_WORKER* worker = (TP_WORKER*)arg;
+	PTP_POOL pool = worker->Pool;
+
+	TlsSetValue(worker_tls_index, worker);
+
+	if (pool->Affinity)
+		worker_set_affinity(worker);
+
+	while (!InterlockedCompareExchange(&pool->Terminate, 0, 0))
+	{
+		PTP_WORK work = worker_find_work(worker);
+
+		if (!work)
 		{
-			work = callbackInstance->Work;
-			work->WorkCallback(callbackInstance, work->CallbackParameter, work);
-			CountdownEvent_Signal(pool->WorkComplete, 1);
-			free(callbackInstance);
+			/* Announce we are going to sleep before the final check, a submitter
+			 * either sees us idle or we see its work. */
+			InterlockedIncrement(&pool->IdleWorkers);
+			work = worker_find_work(worker);
+
+			if (!work)
+				WaitForSingleObject(pool->WorkAvailable, INFINITE);
+
+			InterlockedDecrement(&pool->IdleWorkers);
 		}
+
+		if (work)
+			worker_run(pool, work);
 	}
 
 	ExitThread(0);
@@ -101,52 +262,158 @@ static void threads_close(void* thread)
 	CloseHandle(thread);
 }
 
+static void worker_free(TP_WORKER* worker)
+{
+	if (!worker)
+		return;
+
+	DeleteCriticalSection(&worker->Lock);
+	free(worker->Items);
+	free(worker);
+}
+
+static BOOL worker_new(PTP_POOL pool)
+{
+	HANDLE thread;
+	TP_WORKER* worker;
+	const LONG index = InterlockedCompareExchange(&pool->WorkerCount, 0, 0);
+
+	if ((DWORD)index >= pool->WorkerCapacity)
+		return FALSE;
+
+	worker = (TP_WORKER*)calloc(1, sizeof(TP_WORKER));
+
+	if (!worker)
+		return FALSE;
+
+	worker->Pool = pool;
+	worker->Index = (DWORD)index;
+	worker->Capacity = WORKER_QUEUE_SIZE;
+	worker->Items = (PTP_WORK*)calloc(worker->Capacity, sizeof(PTP_WORK));
+
+	if (!worker->Items || !InitializeCriticalSectionAndSpinCount(&worker->Lock, 4000))
+	{
+		free(worker->Items);
+		free(worker);
+		return FALSE;
+	}
+
+	/* Publish the deque before the thread exists, thieves only look at
+	 * WorkerCount entries. */
+	pool->Workers[index] = worker;
+
+	if (!(thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)worker, CREATE_SUSPENDED,
+	                            NULL)))
+		goto fail;
+
+	if (!ArrayList_Append(pool->Threads, thread))
+	{
+		CloseHandle(thread);
+		goto fail;
+	}
+
+	InterlockedIncrement(&pool->WorkerCount);
+	ResumeThread(thread);
+	return TRUE;
+
+fail:
+	pool->Workers[index] = NULL;
+	worker_free(worker);
+	return FALSE;
+}
+
+BOOL ThreadpoolEnqueueWork(PTP_POOL pool, PTP_WORK work)
+{
+	TP_WORKER* worker;
+	LONG count;
+
+	count = InterlockedCompareExchange(&pool->WorkerCount, 0, 0);
+
+	if (count <= 0)
+		return FALSE;
+
+	CountdownEvent_AddCount(pool->WorkComplete, 1);
+
+	/* Work submitted from a pool callback stays on that thread, everything
+	 * else is spread round robin. */
+	worker = worker_current(pool);
+
+	if (!worker)
+	{
+		const LONG next = InterlockedIncrement(&pool->NextWorker);
+		worker = pool->Workers[(ULONG)next % (ULONG)count];
+	}
+
+	if (!worker_push(worker, work))
+	{
+		CountdownEvent_Signal(pool->WorkComplete, 1);
+		return FALSE;
+	}
+
+	if (InterlockedCompareExchange(&pool->IdleWorkers, 0, 0) > 0)
+		ReleaseSemaphore(pool->WorkAvailable, 1, NULL);
+
+	return TRUE;
+}
+
 static BOOL InitializeThreadpool(PTP_POOL pool)
 {
-	BOOL rc = FALSE;
-	int index;
+	DWORD count;
 	wObject* obj;
-	HANDLE thread;
+	SYSTEM_INFO sysinfo = { 0 };
+	char affinity[8] = { 0 };
 
 	if (pool->Threads)
 		return TRUE;
 
+	if (!InitOnceExecuteOnce(&init_once_worker, init_worker_tls, NULL, NULL))
+		return FALSE;
+
 	pool->Minimum = 0;
 	pool->Maximum = 500;
 
-	if (!(pool->PendingQueue = Queue_New(TRUE, -1, -1)))
-		goto fail;
+	/* The default pool gets one worker per processor. Private pools are created per codec
+	 * context, so they keep the fixed worker count and grow with SetThreadpoolThreadMinimum. */
+	count = WORKER_MIN_COUNT;
+
+	if (pool == &DEFAULT_POOL)
+	{
+		GetSystemInfo(&sysinfo);
+
+		if (sysinfo.dwNumberOfProcessors > count)
+			count = sysinfo.dwNumberOfProcessors;
+	}
+
+	if (count > pool->Maximum)
+		count = pool->Maximum;
+
+	pool->WorkerCapacity = pool->Maximum;
+	pool->Affinity = (GetEnvironmentVariableA("WINPR_THREADPOOL_AFFINITY", affinity,
+	                                          sizeof(affinity)) > 0) &&
+	                 (strcmp(affinity, "0") != 0);
+
+	if (!(pool->Workers = (TP_WORKER**)calloc(pool->WorkerCapacity, sizeof(TP_WORKER*))))
+		return FALSE;
 
 	if (!(pool->WorkComplete = CountdownEvent_New(0)))
-		goto fail;
+		return FALSE;
 
-	if (!(pool->TerminateEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
-		goto fail;
+	if (!(pool->WorkAvailable = CreateSemaphoreA(NULL, 0, MAXLONG, NULL)))
+		return FALSE;
 
 	if (!(pool->Threads = ArrayList_New(TRUE)))
-		goto fail;
+		return FALSE;
 
 	obj = ArrayList_Object(pool->Threads);
 	obj->fnObjectFree = threads_close;
 
-	for (index = 0; index < 4; index++)
+	while ((DWORD)pool->WorkerCount < count)
 	{
-		if (!(thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)pool, 0, NULL)))
-		{
-			goto fail;
-		}
-
-		if (!ArrayList_Append(pool->Threads, thread))
-		{
-			CloseHandle(thread);
-			goto fail;
-		}
+		if (!worker_new(pool))
+			return FALSE;
 	}
 
-	rc = TRUE;
-
-fail:
-	return rc;
+	return TRUE;
 }
 
 PTP_POOL GetDefaultThreadpool(void)
@@ -193,12 +460,27 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 		return;
 	}
 #endif
-	SetEvent(ptpp->TerminateEvent);
+	InterlockedExchange(&ptpp->Terminate, 1);
+
+	if (ptpp->WorkAvailable && (ptpp->WorkerCount > 0))
+		ReleaseSemaphore(ptpp->WorkAvailable, ptpp->WorkerCount, NULL);
 
 	ArrayList_Free(ptpp->Threads);
-	Queue_Free(ptpp->PendingQueue);
+
+	if (ptpp->Workers)
+	{
+		LONG index;
+
+		for (index = 0; index < ptpp->WorkerCount; index++)
+			worker_free(ptpp->Workers[index]);
+
+		free(ptpp->Workers);
+	}
+
 	CountdownEvent_Free(ptpp->WorkComplete);
-	CloseHandle(ptpp->TerminateEvent);
+
+	if (ptpp->WorkAvailable)
+		CloseHandle(ptpp->WorkAvailable);
 
 	{
 		TP_POOL empty = { 0 };
@@ -211,7 +493,6 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 
 BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 {
-	HANDLE thread;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 	if (pSetThreadpoolThreadMinimum)
@@ -219,18 +500,10 @@ BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 #endif
 	ptpp->Minimum = cthrdMic;
 
-	while (ArrayList_Count(ptpp->Threads) < (INT64)ptpp->Minimum)
+	while ((DWORD)InterlockedCompareExchange(&ptpp->WorkerCount, 0, 0) < ptpp->Minimum)
 	{
-		if (!(thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)ptpp, 0, NULL)))
-		{
+		if (!worker_new(ptpp))
 			return FALSE;
-		}
-
-		if (!ArrayList_Append(ptpp->Threads, thread))
-		{
-			CloseHandle(thread);
-			return FALSE;
-		}
 	}
 
 	return TRUE;
@@ -26,6 +26,21 @@
 #include <winpr/thread.h>
 #include <winpr/collections.h>
 
+/**
+ * Every pool thread owns a deque of submitted work. The owner pushes and pops
+ * at the bottom (LIFO, cache friendly), idle threads steal from the top (FIFO).
+ */
+typedef struct
+{
+	PTP_POOL Pool;
+	DWORD Index;
+	CRITICAL_SECTION Lock;
+	PTP_WORK* Items;
+	size_t Capacity;
+	size_t Head;
+	volatile size_t Count;
+} TP_WORKER;
+
 #if defined(_WIN32)
 #if (_WIN32_WINNT < _WIN32_WINNT_WIN6) || defined(__MINGW32__)
 struct _TP_CALLBACK_INSTANCE
@@ -38,8 +53,14 @@ struct _TP_POOL
 	DWORD Minimum;
 	DWORD Maximum;
 	wArrayList* Threads;
-	wQueue* PendingQueue;
-	HANDLE TerminateEvent;
+	TP_WORKER** Workers;
+	DWORD WorkerCapacity;
+	volatile LONG WorkerCount;
+	volatile LONG NextWorker;
+	volatile LONG IdleWorkers;
+	volatile LONG Terminate;
+	HANDLE WorkAvailable;
+	BOOL Affinity;
 	wCountdownEvent* WorkComplete;
 };
 
@@ -82,8 +103,14 @@ struct S_TP_POOL
 	DWORD Minimum;
 	DWORD Maximum;
 	wArrayList* Threads;
-	wQueue* PendingQueue;
-	HANDLE TerminateEvent;
+	TP_WORKER** Workers;
+	DWORD WorkerCapacity;
+	volatile LONG WorkerCount;
+	volatile LONG NextWorker;
+	volatile LONG IdleWorkers;
+	volatile LONG Terminate;
+	HANDLE WorkAvailable;
+	BOOL Affinity;
 	wCountdownEvent* WorkComplete;
 };
 
@@ -118,5 +145,6 @@ struct S_TP_CLEANUP_GROUP
 #endif
 
 PTP_POOL GetDefaultThreadpool(void);
+BOOL ThreadpoolEnqueueWork(PTP_POOL pool, PTP_WORK work);
 
 #endif /* WINPR_POOL_PRIVATE_H */
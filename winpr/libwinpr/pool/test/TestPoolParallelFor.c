@@ -0,0 +1,189 @@
+
+#include <winpr/crt.h>
+#include <winpr/pool.h>
+#include <winpr/interlocked.h>
+
+#define TEST_ITEMS 1000
+#define TEST_ROWS 20
+#define TEST_ROW_ITEMS (TEST_ITEMS / TEST_ROWS)
+
+static LONG hits[TEST_ITEMS];
+static LONG calls = 0;
+
+static BOOL test_ParallelForCallback(PVOID context, size_t first, size_t count)
+{
+	size_t index;
+	const size_t* fail = (const size_t*)context;
+
+	InterlockedIncrement(&calls);
+
+	for (index = first; index < first + count; index++)
+		InterlockedIncrement(&hits[index]);
+
+	if (fail && (first <= *fail) && (*fail < first + count))
+		return FALSE;
+
+	return TRUE;
+}
+
+static BOOL test_range(PTP_CALLBACK_ENVIRON environment, size_t count, size_t chunks)
+{
+	size_t index;
+
+	ZeroMemory(hits, sizeof(hits));
+	calls = 0;
+
+	if (!winpr_ThreadpoolParallelFor(environment, count, chunks, test_ParallelForCallback, NULL))
+	{
+		printf("winpr_ThreadpoolParallelFor(%" PRIuz ", %" PRIuz ") failed\n", count, chunks);
+		return FALSE;
+	}
+
+	for (index = 0; index < TEST_ITEMS; index++)
+	{
+		const LONG expected = (index < count) ? 1 : 0;
+
+		if (hits[index] != expected)
+		{
+			printf("item %" PRIuz " processed %" PRId32 " times, expected %" PRId32 "\n", index,
+			       hits[index], expected);
+			return FALSE;
+		}
+	}
+
+	if ((chunks > 0) && (calls != (LONG)((chunks < count) ? chunks : count)))
+	{
+		printf("%" PRId32 " ranges for %" PRIuz " chunks\n", calls, chunks);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_failure(PTP_CALLBACK_ENVIRON environment)
+{
+	size_t index;
+	size_t fail = TEST_ITEMS / 2;
+
+	ZeroMemory(hits, sizeof(hits));
+
+	if (winpr_ThreadpoolParallelFor(environment, TEST_ITEMS, 7, test_ParallelForCallback, &fail))
+	{
+		printf("winpr_ThreadpoolParallelFor did not report the failing range\n");
+		return FALSE;
+	}
+
+	/* The other ranges must have run anyway */
+	for (index = 0; index < TEST_ITEMS; index++)
+	{
+		if (hits[index] != 1)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_RowCallback(PVOID context, size_t first, size_t count)
+{
+	size_t index;
+	const size_t row = *(const size_t*)context;
+
+	for (index = first; index < first + count; index++)
+		InterlockedIncrement(&hits[row * TEST_ROW_ITEMS + index]);
+
+	return TRUE;
+}
+
+/* Every row runs a parallel for of its own from inside the pool */
+static BOOL test_NestedCallback(PVOID context, size_t first, size_t count)
+{
+	size_t row;
+
+	for (row = first; row < first + count; row++)
+	{
+		if (!winpr_ThreadpoolParallelFor((PTP_CALLBACK_ENVIRON)context, TEST_ROW_ITEMS, 8,
+		                                 test_RowCallback, &row))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_nested(PTP_CALLBACK_ENVIRON environment)
+{
+	size_t index;
+
+	ZeroMemory(hits, sizeof(hits));
+
+	if (!winpr_ThreadpoolParallelFor(environment, TEST_ROWS, TEST_ROWS, test_NestedCallback,
+	                                 environment))
+	{
+		printf("nested winpr_ThreadpoolParallelFor failed\n");
+		return FALSE;
+	}
+
+	for (index = 0; index < TEST_ITEMS; index++)
+	{
+		if (hits[index] != 1)
+		{
+			printf("nested item %" PRIuz " processed %" PRId32 " times\n", index, hits[index]);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL test_all(PTP_CALLBACK_ENVIRON environment)
+{
+	if (!test_range(environment, 0, 0))
+		return FALSE;
+
+	if (!test_range(environment, 1, 0))
+		return FALSE;
+
+	if (!test_range(environment, TEST_ITEMS, 0))
+		return FALSE;
+
+	if (!test_range(environment, TEST_ITEMS, 1))
+		return FALSE;
+
+	if (!test_range(environment, TEST_ITEMS - 3, 16))
+		return FALSE;
+
+	if (!test_range(environment, 5, 64))
+		return FALSE;
+
+	if (!test_failure(environment))
+		return FALSE;
+
+	return test_nested(environment);
+}
+
+int TestPoolParallelFor(int argc, char* argv[])
+{
+	int rc = -1;
+	PTP_POOL pool;
+	TP_CALLBACK_ENVIRON environment;
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_all(NULL))
+		return -1;
+
+	if (!(pool = CreateThreadpool(NULL)))
+	{
+		printf("CreateThreadpool failure\n");
+		return -1;
+	}
+
+	InitializeThreadpoolEnvironment(&environment);
+	SetThreadpoolCallbackPool(&environment, pool);
+
+	if (test_all(&environment))
+		rc = 0;
+
+	DestroyThreadpoolEnvironment(&environment);
+	CloseThreadpool(pool);
+	return rc;
+}
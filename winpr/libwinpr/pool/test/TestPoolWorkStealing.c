@@ -0,0 +1,164 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Thread Pool API (work stealing)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/crt.h>
+#include <winpr/pool.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#define TEST_ITEMS 100000
+
+static LONG executed = 0;
+static LONG remaining = 0;
+static PTP_WORK spawnWork = NULL;
+
+static void CALLBACK test_TinyCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                       PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(context);
+	WINPR_UNUSED(work);
+	InterlockedIncrement(&executed);
+}
+
+/* Every item submits up to two children from inside the pool, these stay on
+ * the submitting worker and are stolen by the others. */
+static void CALLBACK test_SpawnCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                        PTP_WORK work)
+{
+	int index;
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(context);
+	InterlockedIncrement(&executed);
+
+	for (index = 0; index < 2; index++)
+	{
+		if (InterlockedDecrement(&remaining) < 0)
+			break;
+
+		SubmitThreadpoolWork(work);
+	}
+}
+
+/* The throughput is printed for comparison between runs, only the item count is checked */
+static BOOL report(const char* name, UINT64 start)
+{
+	UINT64 duration = GetTickCount64() - start;
+
+	if (duration == 0)
+		duration = 1;
+
+	if (executed != TEST_ITEMS)
+	{
+		printf("%s: executed %" PRId32 " of %d items\n", name, executed, TEST_ITEMS);
+		return FALSE;
+	}
+
+	printf("%s: %d items in %" PRIu64 "ms (%" PRIu64 " items/s)\n", name, TEST_ITEMS, duration,
+	       (UINT64)TEST_ITEMS * 1000 / duration);
+	return TRUE;
+}
+
+static BOOL test_flood(PTP_CALLBACK_ENVIRON environment)
+{
+	int index;
+	BOOL rc;
+	UINT64 start;
+	PTP_WORK work = CreateThreadpoolWork(test_TinyCallback, NULL, environment);
+
+	if (!work)
+	{
+		printf("CreateThreadpoolWork failure\n");
+		return FALSE;
+	}
+
+	executed = 0;
+	start = GetTickCount64();
+
+	for (index = 0; index < TEST_ITEMS; index++)
+		SubmitThreadpoolWork(work);
+
+	WaitForThreadpoolWorkCallbacks(work, FALSE);
+	rc = report("flood", start);
+	CloseThreadpoolWork(work);
+	return rc;
+}
+
+static BOOL test_spawn(PTP_CALLBACK_ENVIRON environment)
+{
+	BOOL rc;
+	UINT64 start;
+
+	spawnWork = CreateThreadpoolWork(test_SpawnCallback, NULL, environment);
+
+	if (!spawnWork)
+	{
+		printf("CreateThreadpoolWork failure\n");
+		return FALSE;
+	}
+
+	executed = 0;
+	remaining = TEST_ITEMS - 1;
+	start = GetTickCount64();
+	SubmitThreadpoolWork(spawnWork);
+	WaitForThreadpoolWorkCallbacks(spawnWork, FALSE);
+	rc = report("spawn", start);
+	CloseThreadpoolWork(spawnWork);
+	return rc;
+}
+
+int TestPoolWorkStealing(int argc, char* argv[])
+{
+	int rc = -1;
+	PTP_POOL pool;
+	TP_CALLBACK_ENVIRON environment;
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_flood(NULL))
+		return -1;
+
+	if (!test_spawn(NULL))
+		return -1;
+
+	if (!(pool = CreateThreadpool(NULL)))
+	{
+		printf("CreateThreadpool failure\n");
+		return -1;
+	}
+
+	if (!SetThreadpoolThreadMinimum(pool, 8))
+	{
+		printf("SetThreadpoolThreadMinimum failure\n");
+		goto fail;
+	}
+
+	InitializeThreadpoolEnvironment(&environment);
+	SetThreadpoolCallbackPool(&environment, pool);
+
+	if (!test_flood(&environment))
+		goto fail;
+
+	if (!test_spawn(&environment))
+		goto fail;
+
+	rc = 0;
+fail:
+	DestroyThreadpoolEnvironment(&environment);
+	CloseThreadpool(pool);
+	return rc;
+}
@@ -19,6 +19,16 @@ int TestSynchWaitableTimer(int argc, char* argv[])
 		goto out;
 	}
 
+	status = WaitForSingleObject(timer, 0);
+
+	if (status != WAIT_TIMEOUT)
+	{
+		printf("WaitForSingleObject(timer, 0) on an unset timer failure: Actual: 0x%08" PRIX32
+		       ", Expected: 0x%08X\n",
+		       status, WAIT_TIMEOUT);
+		goto out;
+	}
+
 	due.QuadPart = -1500000LL; /* 0.15 seconds */
 
 	if (!SetWaitableTimer(timer, &due, 0, NULL, NULL, 0))
@@ -364,11 +364,17 @@ HANDLE CreateWaitableTimerA(LPSECURITY_ATTRIBUTES lpTimerAttributes, BOOL bManua
 		dispatch_set_context(timer->source, timer);
 		dispatch_source_set_event_handler_f(timer->source, WaitableTimerHandler);
 #endif
+
+#if defined(TIMER_IMPL_TIMERFD)
+		/* A timer that was never set must be waitable, which needs the descriptor */
+		if (InitializeWaitableTimer(timer) < 0)
+			goto fail;
+#endif
 	}
 
 	return handle;
 
-#if defined(TIMER_IMPL_DISPATCH) || defined(TIMER_IMPL_POSIX)
+#if defined(TIMER_IMPL_DISPATCH) || defined(TIMER_IMPL_POSIX) || defined(TIMER_IMPL_TIMERFD)
 fail:
 	TimerCloseHandle(handle);
 	return NULL;
@@ -0,0 +1,275 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Arena Allocator
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/config.h>
+
+#include <winpr/crt.h>
+
+#include <winpr/collections.h>
+
+typedef struct s_wArenaBlock wArenaBlock;
+
+struct s_wArenaBlock
+{
+	wArenaBlock* next;
+	size_t size;
+	size_t used;
+	BYTE* data;
+};
+
+struct s_wArena
+{
+	size_t blockSize;
+	DWORD alignment;
+	BOOL synchronized;
+	CRITICAL_SECTION lock;
+
+	wArenaBlock* blocks; /* the current block comes first */
+	size_t capacity;
+	size_t used;
+};
+
+static void Arena_Lock(wArena* arena)
+{
+	if (arena->synchronized)
+		EnterCriticalSection(&arena->lock);
+}
+
+static void Arena_Unlock(wArena* arena)
+{
+	if (arena->synchronized)
+		LeaveCriticalSection(&arena->lock);
+}
+
+static wArenaBlock* Arena_BlockNew(wArena* arena, size_t size)
+{
+	wArenaBlock* block = (wArenaBlock*)calloc(1, sizeof(wArenaBlock));
+
+	if (!block)
+		return NULL;
+
+	block->data = (BYTE*)winpr_aligned_malloc(size, arena->alignment);
+
+	if (!block->data)
+	{
+		free(block);
+		return NULL;
+	}
+
+	block->size = size;
+	block->next = arena->blocks;
+	arena->blocks = block;
+	arena->capacity += size;
+	return block;
+}
+
+static void Arena_FreeBlocks(wArena* arena)
+{
+	wArenaBlock* block = arena->blocks;
+
+	while (block)
+	{
+		wArenaBlock* next = block->next;
+		winpr_aligned_free(block->data);
+		free(block);
+		block = next;
+	}
+
+	arena->blocks = NULL;
+	arena->capacity = 0;
+}
+
+/**
+ * Methods
+ */
+
+/**
+ * Returns size bytes aligned to the arena alignment. The memory stays valid
+ * until the next Arena_Reset or Arena_Free, it is never released on its own.
+ */
+void* Arena_Alloc(wArena* arena, size_t size)
+{
+	void* ptr = NULL;
+	size_t aligned;
+	wArenaBlock* block;
+
+	if (!arena || (size == 0))
+		return NULL;
+
+	aligned = (size + arena->alignment - 1) & ~((size_t)arena->alignment - 1);
+
+	if (aligned < size)
+		return NULL;
+
+	Arena_Lock(arena);
+	block = arena->blocks;
+
+	if (!block || (block->size - block->used < aligned))
+	{
+		const size_t size = (aligned > arena->blockSize) ? aligned : arena->blockSize;
+
+		if (!(block = Arena_BlockNew(arena, size)))
+			goto out;
+	}
+
+	ptr = &block->data[block->used];
+	block->used += aligned;
+	arena->used += aligned;
+
+out:
+	Arena_Unlock(arena);
+	return ptr;
+}
+
+void* Arena_Calloc(wArena* arena, size_t nmemb, size_t size)
+{
+	void* ptr;
+
+	if ((size > 0) && (nmemb > SIZE_MAX / size))
+		return NULL;
+
+	ptr = Arena_Alloc(arena, nmemb * size);
+
+	if (ptr)
+		ZeroMemory(ptr, nmemb * size);
+
+	return ptr;
+}
+
+BOOL Arena_Contains(wArena* arena, const void* ptr)
+{
+	BOOL rc = FALSE;
+	wArenaBlock* block;
+	const BYTE* p = (const BYTE*)ptr;
+
+	if (!arena || !ptr)
+		return FALSE;
+
+	Arena_Lock(arena);
+
+	for (block = arena->blocks; block; block = block->next)
+	{
+		if ((p >= block->data) && (p < &block->data[block->size]))
+		{
+			rc = TRUE;
+			break;
+		}
+	}
+
+	Arena_Unlock(arena);
+	return rc;
+}
+
+/**
+ * Releases all allocations at once. If the last cycle needed more than one
+ * block they are merged, so the next cycle of the same size is served from a
+ * single block without touching the heap.
+ */
+void Arena_Reset(wArena* arena)
+{
+	if (!arena)
+		return;
+
+	Arena_Lock(arena);
+
+	if (arena->blocks && arena->blocks->next)
+	{
+		const size_t size = arena->capacity;
+		Arena_FreeBlocks(arena);
+		Arena_BlockNew(arena, size);
+	}
+	else if (arena->blocks)
+		arena->blocks->used = 0;
+
+	arena->used = 0;
+	Arena_Unlock(arena);
+}
+
+size_t Arena_GetUsed(wArena* arena)
+{
+	size_t used;
+
+	if (!arena)
+		return 0;
+
+	Arena_Lock(arena);
+	used = arena->used;
+	Arena_Unlock(arena);
+	return used;
+}
+
+size_t Arena_GetCapacity(wArena* arena)
+{
+	size_t capacity;
+
+	if (!arena)
+		return 0;
+
+	Arena_Lock(arena);
+	capacity = arena->capacity;
+	Arena_Unlock(arena);
+	return capacity;
+}
+
+/**
+ * Construction, Destruction
+ */
+
+wArena* Arena_New(BOOL synchronized, size_t blockSize, DWORD alignment)
+{
+	wArena* arena = NULL;
+
+	if (alignment == 0)
+		alignment = 16;
+
+	/* winpr_aligned_malloc needs a power of two */
+	if ((alignment & (alignment - 1)) != 0)
+		return NULL;
+
+	arena = (wArena*)calloc(1, sizeof(wArena));
+
+	if (!arena)
+		return NULL;
+
+	arena->blockSize = (blockSize > 0) ? blockSize : 64 * 1024;
+	arena->alignment = alignment;
+	arena->synchronized = synchronized;
+
+	if (arena->synchronized)
+	{
+		if (!InitializeCriticalSectionAndSpinCount(&arena->lock, 4000))
+		{
+			free(arena);
+			return NULL;
+		}
+	}
+
+	return arena;
+}
+
+void Arena_Free(wArena* arena)
+{
+	if (!arena)
+		return;
+
+	Arena_FreeBlocks(arena);
+
+	if (arena->synchronized)
+		DeleteCriticalSection(&arena->lock);
+
+	free(arena);
+}
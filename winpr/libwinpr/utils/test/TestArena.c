@@ -0,0 +1,97 @@
+
+#include <winpr/crt.h>
+#include <winpr/collections.h>
+
+static BOOL test_arena(BOOL synchronized)
+{
+	size_t i;
+	size_t capacity;
+	BOOL rc = FALSE;
+	BYTE* ptr;
+	BYTE* big;
+	wArena* arena = Arena_New(synchronized, 1024, 32);
+
+	if (!arena)
+		return FALSE;
+
+	if (Arena_Alloc(arena, 0) || Arena_Calloc(arena, SIZE_MAX, 2))
+	{
+		printf("Arena_Alloc accepted an invalid size\n");
+		goto fail;
+	}
+
+	/* Allocations are aligned and zeroed on request */
+	for (i = 1; i < 40; i++)
+	{
+		ptr = Arena_Calloc(arena, i, 3);
+
+		if (!ptr || (((size_t)ptr) % 32 != 0))
+		{
+			printf("Arena_Calloc(%" PRIuz ") returned a misaligned buffer\n", i * 3);
+			goto fail;
+		}
+
+		if (ptr[0] != 0 || ptr[i * 3 - 1] != 0)
+			goto fail;
+
+		FillMemory(ptr, i * 3, 0xAB);
+	}
+
+	/* Larger than the block size */
+	if (!(big = Arena_Alloc(arena, 4000)))
+		goto fail;
+
+	FillMemory(big, 4000, 0xCD);
+
+	if (!Arena_Contains(arena, big) || !Arena_Contains(arena, &big[3999]) ||
+	    Arena_Contains(arena, &i))
+	{
+		printf("Arena_Contains failure\n");
+		goto fail;
+	}
+
+	if (Arena_GetUsed(arena) < 4000 + 39 * 20 * 3 / 2)
+		goto fail;
+
+	/* After a reset the whole last cycle fits into a single block */
+	Arena_Reset(arena);
+
+	if (Arena_GetUsed(arena) != 0)
+		goto fail;
+
+	capacity = Arena_GetCapacity(arena);
+
+	for (i = 1; i < 40; i++)
+	{
+		if (!Arena_Alloc(arena, i * 3))
+			goto fail;
+	}
+
+	if (!Arena_Alloc(arena, 4000))
+		goto fail;
+
+	if (Arena_GetCapacity(arena) != capacity)
+	{
+		printf("Arena_Reset did not keep the memory of the last cycle\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	Arena_Free(arena);
+	return rc;
+}
+
+int TestArena(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_arena(FALSE))
+		return -1;
+
+	if (!test_arena(TRUE))
+		return -1;
+
+	return 0;
+}